@@ -0,0 +1,39 @@
+// fork and exec a program in a loop, the way configure scripts spend their
+// time. See run_exec_bench.sh.
+//
+// Usage: execLoop <iterations> [program]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s <iterations> [program]\n", argv[0]);
+    return 1;
+  }
+
+  long iterations = strtol(argv[1], NULL, 10);
+  const char* program = argc == 3 ? argv[2] : "/bin/true";
+  for (long i = 0; i < iterations; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      execl(program, program, (char*)NULL);
+      perror("execl");
+      _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s failed\n", program);
+      return 1;
+    }
+  }
+  return 0;
+}
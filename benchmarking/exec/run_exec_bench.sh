@@ -0,0 +1,46 @@
+#!/bin/bash -e
+
+## Measure what one fork+exec of a short lived program costs under dettrace:
+## ptrace stops, system calls we inject, process_vm calls and wall time, per
+## exec. A run with no iterations is subtracted, so start up doesn't count.
+## Usage: ./run_exec_bench.sh [path/to/dettrace] [iterations] [program]
+
+DETTRACE=$(realpath ${1:-../../bin/dettrace})
+ITERATIONS=${2:-500}
+PROGRAM=${3:-/bin/true}
+
+cc -O2 -o execLoop execLoop.c
+
+# Run execLoop under dettrace, print the wall time in nanoseconds followed by
+# the statistics we report.
+run() {
+    local stats=$(mktemp)
+    local start=$(date +%s%N)
+    $DETTRACE --print-statistics ./execLoop $1 $PROGRAM > /dev/null 2> $stats
+    local end=$(date +%s%N)
+    echo "wall $((end - start))"
+    sed -n 's/^dettrace Statistic\. \(.*\): \([0-9]*\)$/\1\t\2/p' $stats |
+        tr ' ' '_'
+    rm -f $stats
+}
+
+baseline=$(run 0)
+traced=$(run $ITERATIONS)
+
+# Per exec difference of a statistic between the two runs.
+perExec() {
+    local before=$(echo "$baseline" | awk -v k="$1" '$1 == k { print $2 }')
+    local after=$(echo "$traced" | awk -v k="$1" '$1 == k { print $2 }')
+    awk -v a="${after:-0}" -v b="${before:-0}" -v n=$ITERATIONS \
+        'BEGIN { printf "%.2f", (a - b) / n }'
+}
+
+echo "$ITERATIONS x fork+exec $PROGRAM, per exec:"
+echo "  exec events:           $(perExec exec_events)"
+echo "  ptrace stops:          $(perExec ptrace_stops)"
+echo "  injected code stops:   $(perExec injected_code_stops)"
+echo "  injected system calls: $(perExec injected_system_calls)"
+echo "  process_vm_reads:      $(perExec process_vm_reads)"
+echo "  process_vm_writes:     $(perExec process_vm_writes)"
+echo "  ptrace peeks:          $(perExec ptrace_peeks)"
+echo "  wall time:             $(perExec wall) ns"
@@ -0,0 +1,49 @@
+// Issue system calls that our seccomp filter allows in kernel, so their cost
+// under dettrace is only the BPF filter itself. See run_filter_cost.sh.
+// lseek and pread64 are allowed by number alone, which Linux 5.11 and newer
+// cache, fcntl(F_GETFL) is allowed for that command only and always runs the
+// filter.
+//
+// Usage: filterCost <lseek|pread64|fcntl> <iterations>
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <lseek|pread64|fcntl> <iterations>\n", argv[0]);
+    return 1;
+  }
+
+  long iterations = strtol(argv[2], NULL, 10);
+  int fd = open("/dev/zero", O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  char buf[8];
+  if (strcmp(argv[1], "lseek") == 0) {
+    for (long i = 0; i < iterations; i++) {
+      syscall(SYS_lseek, fd, 0, SEEK_SET);
+    }
+  } else if (strcmp(argv[1], "pread64") == 0) {
+    for (long i = 0; i < iterations; i++) {
+      syscall(SYS_pread64, fd, buf, sizeof(buf), 0);
+    }
+  } else if (strcmp(argv[1], "fcntl") == 0) {
+    for (long i = 0; i < iterations; i++) {
+      syscall(SYS_fcntl, fd, F_GETFL);
+    }
+  } else {
+    fprintf(stderr, "unknown system call: %s\n", argv[1]);
+    return 1;
+  }
+
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash -e
+
+## Measure the per call cost our seccomp filter adds to system calls it allows
+## in kernel. Time is taken outside the tracee, as dettrace determinizes clocks.
+## On Linux 5.11 and newer lseek and pread64 skip the filter through the
+## kernel's action cache and should cost what they do natively; fcntl is only
+## allowed for some commands, so it pays for the filter on every call.
+## Usage: ./run_filter_cost.sh [path/to/dettrace] [iterations]
+
+DETTRACE=${1:-../../bin/dettrace}
+ITERATIONS=${2:-1000000}
+
+cc -O2 -o filterCost filterCost.c
+
+# Wall clock time of a command in nanoseconds.
+timeNs() {
+    local start=$(date +%s%N)
+    "$@" > /dev/null
+    local end=$(date +%s%N)
+    echo $((end - start))
+}
+
+for syscall in lseek pread64 fcntl; do
+    native=$(timeNs ./filterCost $syscall $ITERATIONS)
+    # A run with no iterations measures dettrace start up and tear down.
+    baseline=$(timeNs $DETTRACE ./filterCost $syscall 0)
+    traced=$(timeNs $DETTRACE ./filterCost $syscall $ITERATIONS)
+
+    perCall=$(((traced - baseline) / ITERATIONS))
+    echo "$syscall: native $((native / ITERATIONS)) ns/call," \
+         "dettrace $perCall ns/call," \
+         "filter $((perCall - native / ITERATIONS)) ns/call"
+done
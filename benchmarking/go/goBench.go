@@ -0,0 +1,106 @@
+// What Go programs spend their time on under dettrace: goroutines handing
+// work to each other across threads, a garbage collector stopping the world,
+// and the netpoller serving http over loopback. See run_go_bench.sh.
+//
+// Usage: goBench pingpong|gc|http <iterations>
+package main
+
+import (
+	"fmt"
+	"io"
+	"net"
+	"net/http"
+	"os"
+	"runtime"
+	"strconv"
+)
+
+// Two goroutines bounce a value back and forth, on different threads once
+// the scheduler spreads them out: futex waits and wakes.
+func pingPong(iterations int) {
+	ping, pong := make(chan int), make(chan int)
+	go func() {
+		for v := range ping {
+			pong <- v + 1
+		}
+		close(pong)
+	}()
+	for i := 0; i < iterations; i++ {
+		ping <- i
+		<-pong
+	}
+	close(ping)
+}
+
+// Allocate short lived garbage from a few goroutines: GC cycles, their
+// background workers, preemption signals and timed sleeps.
+var sink [][]byte
+
+func gc(iterations int) {
+	workers := runtime.GOMAXPROCS(0)
+	done := make(chan bool)
+	for w := 0; w < workers; w++ {
+		go func() {
+			var local [][]byte
+			for i := 0; i < iterations; i++ {
+				local = append(local, make([]byte, 1024))
+				if len(local) == 1024 {
+					local = nil
+				}
+			}
+			done <- true
+		}()
+	}
+	for w := 0; w < workers; w++ {
+		<-done
+	}
+	sink = nil
+}
+
+// GET a small page from our own server over loopback: epoll_pwait, nonblocking
+// sockets and the threads handling them.
+func httpLoopback(iterations int) {
+	listener, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		fmt.Fprintln(os.Stderr, err)
+		os.Exit(1)
+	}
+	go http.Serve(listener, http.HandlerFunc(
+		func(w http.ResponseWriter, r *http.Request) {
+			io.WriteString(w, "hello world\n")
+		}))
+	url := "http://" + listener.Addr().String() + "/"
+	for i := 0; i < iterations; i++ {
+		response, err := http.Get(url)
+		if err != nil {
+			fmt.Fprintln(os.Stderr, err)
+			os.Exit(1)
+		}
+		io.Copy(io.Discard, response.Body)
+		response.Body.Close()
+	}
+}
+
+func main() {
+	if len(os.Args) != 3 {
+		fmt.Fprintf(os.Stderr, "usage: %s pingpong|gc|http <iterations>\n",
+			os.Args[0])
+		os.Exit(1)
+	}
+	iterations, err := strconv.Atoi(os.Args[2])
+	if err != nil {
+		fmt.Fprintln(os.Stderr, err)
+		os.Exit(1)
+	}
+	switch os.Args[1] {
+	case "pingpong":
+		pingPong(iterations)
+	case "gc":
+		gc(iterations)
+	case "http":
+		httpLoopback(iterations)
+	default:
+		fmt.Fprintf(os.Stderr, "unknown benchmark %s\n", os.Args[1])
+		os.Exit(1)
+	}
+}
@@ -0,0 +1,34 @@
+#!/bin/bash -e
+
+## Time Go programs natively and under dettrace: goroutine ping-pong, GC heavy
+## allocation and net/http over loopback, see goBench.go. Prints wall time of
+## both, and per benchmark the statistics that show where the stops went.
+## Usage: ./run_go_bench.sh [path/to/dettrace] [iterations]
+
+DETTRACE=$(realpath ${1:-../../bin/dettrace})
+ITERATIONS=${2:-2000}
+
+go build -o goBench goBench.go
+
+# Wall time in milliseconds of running the arguments.
+wall() {
+    local start=$(date +%s%N)
+    "$@" > /dev/null
+    local end=$(date +%s%N)
+    echo $(((end - start) / 1000000))
+}
+
+for bench in pingpong gc http; do
+    stats=$(mktemp)
+    native=$(wall ./goBench $bench $ITERATIONS)
+    start=$(date +%s%N)
+    # Loopback needs the network.
+    $DETTRACE --print-statistics --network ./goBench $bench $ITERATIONS \
+        > /dev/null 2> $stats
+    end=$(date +%s%N)
+    echo "$bench x $ITERATIONS: native $native ms," \
+        "dettrace $(((end - start) / 1000000)) ms"
+    grep -E 'ptrace stops|futex waits|sleeps parked|skipped in their' \
+        $stats | sed 's/^dettrace Statistic\. /  /'
+    rm -f $stats
+done
@@ -0,0 +1,275 @@
+#!/usr/bin/env python3
+"""Reproducible build benchmark harness.
+
+Builds every package of a manifest natively and under dettrace inside the
+wheezy chroot made by ./createChroot.sh, several times each, with as many
+builds running at once as there are cores. Records wall, user and sys time and
+the --stats-json counters of each build, the dettrace/native slowdown of each
+package with a confidence interval, and compares them against a stored
+baseline to flag regressions.
+
+The manifest lists one package per line, as installed by install_package.sh,
+blank lines and `#` comments are ignored. An optional second column gives the
+source directory under /home/<package>, `build` by default.
+
+Typical use, from benchmarking/:
+
+    ./harness.py packages.txt --save-baseline baselines/0.1.0.json
+    ./harness.py packages.txt --baseline baselines/0.1.0.json
+
+Exits with status 2 if any package regressed.
+"""
+
+import argparse
+import concurrent.futures
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+# Two sided 95% quantiles of Student's t distribution, by degrees of freedom.
+T95 = [
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+]
+
+
+def t95(df):
+    if df < 1:
+        return float("inf")
+    return T95[df - 1] if df <= len(T95) else 1.960
+
+
+def mean(xs):
+    return sum(xs) / len(xs)
+
+
+def variance(xs):
+    if len(xs) < 2:
+        return 0.0
+    m = mean(xs)
+    return sum((x - m) ** 2 for x in xs) / (len(xs) - 1)
+
+
+def slowdown(native, traced):
+    """Ratio of mean wall times, with a 95% confidence interval.
+
+    The interval is taken on the log of the ratio, whose variance is about
+    var(a)/(n a^2) + var(b)/(m b^2), with the smaller sample's degrees of
+    freedom.
+    """
+    a, b = mean(traced), mean(native)
+    ratio = a / b
+    spread = variance(traced) / (len(traced) * a * a) + \
+        variance(native) / (len(native) * b * b)
+    half = t95(min(len(traced), len(native)) - 1) * math.sqrt(spread)
+    return {"ratio": ratio, "low": ratio / math.exp(half),
+            "high": ratio * math.exp(half)}
+
+
+def geometricMean(ratios):
+    """Geometric mean slowdown over packages, with a 95% interval."""
+    logs = [math.log(r) for r in ratios]
+    m = mean(logs)
+    half = t95(len(logs) - 1) * math.sqrt(variance(logs) / len(logs))
+    return {"ratio": math.exp(m), "low": math.exp(m - half),
+            "high": math.exp(m + half)}
+
+
+def readManifest(path):
+    packages = []
+    with open(path) as manifest:
+        for line in manifest:
+            fields = line.split("#", 1)[0].split()
+            if fields:
+                packages.append(
+                    (fields[0], fields[1] if len(fields) > 1 else "build"))
+    return packages
+
+
+def shellQuote(s):
+    return "'" + s.replace("'", "'\\''") + "'"
+
+
+def runBuild(args, package, source, mode, run):
+    """One build of package in a fresh copy of its sources, under dettrace if
+    mode is "dettrace". Returns its times and counters.
+    """
+    home = "/home/" + package
+    copy = "{}/{}-{}-{}".format(home, source, mode, run)
+    hostCopy = args.chroot + copy
+    shutil.rmtree(hostCopy, ignore_errors=True)
+    subprocess.check_call(
+        ["cp", "-a", args.chroot + home + "/" + source, hostCopy])
+
+    build = "dpkg-buildpackage -uc -us -b"
+    stats = copy + ".stats.json"
+    if mode == "dettrace":
+        build = "/usr/local/bin/dettrace --already-in-chroot " \
+            "--stats-json {} -w {} -- {}".format(stats, copy, build)
+    script = "mount proc /proc -t proc && mount devpts /dev/pts -t devpts && " \
+        "mount sysfs /sys -t sysfs && cd {} && LC_ALL=C exec {}".format(
+            shellQuote(copy), build)
+
+    log = open(hostCopy + ".log", "w")
+    start = time.monotonic()
+    child = subprocess.Popen(
+        ["unshare", "-m", "chroot", args.chroot, "/bin/sh", "-c", script],
+        stdout=log, stderr=subprocess.STDOUT)
+    _, status, usage = os.wait4(child.pid, 0)
+    wall = time.monotonic() - start
+    child.returncode = status
+    log.close()
+
+    result = {"package": package, "mode": mode, "run": run,
+              "ok": os.WIFEXITED(status) and os.WEXITSTATUS(status) == 0,
+              "wall": wall, "user": usage.ru_utime, "sys": usage.ru_stime}
+    if mode == "dettrace" and os.path.exists(args.chroot + stats):
+        with open(args.chroot + stats) as counters:
+            result["counters"] = json.load(counters)["totals"]
+    if result["ok"] and not args.keep:
+        shutil.rmtree(hostCopy, ignore_errors=True)
+    return result
+
+
+def summarize(package, builds):
+    """Per package summary of successful builds, None if a mode has none."""
+    times = {}
+    for mode in ("native", "dettrace"):
+        ok = [b for b in builds if b["mode"] == mode and b["ok"]]
+        if not ok:
+            return None
+        times[mode] = {key: mean([b[key] for b in ok])
+                       for key in ("wall", "user", "sys")}
+        times[mode]["runs"] = len(ok)
+
+    traced = [b for b in builds if b["mode"] == "dettrace" and b["ok"]]
+    counters = {}
+    for b in traced:
+        for key, value in b.get("counters", {}).items():
+            counters[key] = counters.get(key, 0) + value / len(traced)
+
+    summary = slowdown(
+        [b["wall"] for b in builds if b["mode"] == "native" and b["ok"]],
+        [b["wall"] for b in traced])
+    summary.update({"package": package, "native": times["native"],
+                    "dettrace": times["dettrace"], "counters": counters})
+    return summary
+
+
+def compare(results, baseline, threshold):
+    """Packages whose slowdown is, beyond doubt, threshold worse than in
+    baseline: the low end of its interval is above the baseline's ratio.
+    """
+    before = {p["package"]: p for p in baseline["packages"]}
+    regressions = []
+    for p in results["packages"]:
+        old = before.get(p["package"])
+        if old is not None and p["low"] > old["ratio"] * (1 + threshold):
+            regressions.append((p["package"], old["ratio"], p))
+    return regressions
+
+
+def dettraceVersion(binary):
+    return subprocess.check_output([binary, "--version"]).decode().strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("manifest", help="packages to build, one per line")
+    parser.add_argument("--chroot", default="./wheezy",
+                        help="chroot the packages are installed in")
+    parser.add_argument("--dettrace", default="../bin/dettrace-static",
+                        help="dettrace binary, static as it runs in the chroot")
+    parser.add_argument("--runs", type=int, default=3,
+                        help="builds of each package in each mode")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count(),
+                        help="builds running at once")
+    parser.add_argument("--output", default="results.json",
+                        help="where to write every build and the summary")
+    parser.add_argument("--baseline", help="results to compare against")
+    parser.add_argument("--save-baseline",
+                        help="also write the results here, as a new baseline")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="slowdown increase that counts as a regression")
+    parser.add_argument("--keep", action="store_true",
+                        help="keep the build directories of successful builds")
+    args = parser.parse_args()
+
+    if os.geteuid() != 0:
+        sys.exit("Building in the chroot needs root, run with sudo.")
+    args.chroot = os.path.abspath(args.chroot)
+    shutil.copy(args.dettrace, args.chroot + "/usr/local/bin/dettrace")
+    packages = readManifest(args.manifest)
+
+    # Runs of a package in both modes are interleaved, so that a noisy period
+    # of the machine doesn't land on one mode only.
+    jobs = [(package, source, mode, run)
+            for run in range(args.runs)
+            for package, source in packages
+            for mode in ("native", "dettrace")]
+    builds = []
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        futures = [pool.submit(runBuild, args, *job) for job in jobs]
+        for done, future in enumerate(
+                concurrent.futures.as_completed(futures), 1):
+            b = future.result()
+            builds.append(b)
+            print("[{}/{}] {} {} #{}: {:.1f}s{}".format(
+                done, len(jobs), b["package"], b["mode"], b["run"],
+                b["wall"], "" if b["ok"] else " FAILED"), flush=True)
+
+    summaries = []
+    for package, _ in packages:
+        summary = summarize(
+            package, [b for b in builds if b["package"] == package])
+        if summary is None:
+            print("{}: no successful build in some mode, skipped".format(
+                package))
+        else:
+            summaries.append(summary)
+
+    results = {"dettrace_version": dettraceVersion(args.dettrace),
+               "runs": args.runs, "jobs": args.jobs, "packages": summaries,
+               "builds": sorted(builds, key=lambda b: (
+                   b["package"], b["mode"], b["run"]))}
+    if summaries:
+        results["overall"] = geometricMean([p["ratio"] for p in summaries])
+
+    print("\n{:<24} {:>10} {:>10} {:>9}  {}".format(
+        "package", "native s", "dettrace s", "slowdown", "95% interval"))
+    for p in summaries:
+        print("{:<24} {:>10.1f} {:>10.1f} {:>8.2f}x  [{:.2f}, {:.2f}]".format(
+            p["package"], p["native"]["wall"], p["dettrace"]["wall"],
+            p["ratio"], p["low"], p["high"]))
+    if summaries:
+        o = results["overall"]
+        print("{:<24} {:>10} {:>10} {:>8.2f}x  [{:.2f}, {:.2f}]".format(
+            "geometric mean", "", "", o["ratio"], o["low"], o["high"]))
+
+    for path in filter(None, (args.output, args.save_baseline)):
+        with open(path, "w") as out:
+            json.dump(results, out, indent=2, sort_keys=True)
+
+    if args.baseline:
+        with open(args.baseline) as b:
+            baseline = json.load(b)
+        regressions = compare(results, baseline, args.threshold)
+        print("\nCompared against {} ({}):".format(
+            args.baseline, baseline.get("dettrace_version", "unknown")))
+        for package, old, new in regressions:
+            print("  REGRESSION {}: {:.2f}x -> {:.2f}x [{:.2f}, {:.2f}]".format(
+                package, old, new["ratio"], new["low"], new["high"]))
+        if regressions:
+            sys.exit(2)
+        print("  no regressions")
+
+
+if __name__ == "__main__":
+    main()
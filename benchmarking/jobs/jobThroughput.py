@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+"""Tiny job throughput benchmark.
+
+Runs tiny jobs back to back under dettrace, several at once, the way a farm of
+sub-second jobs does: /bin/true, `sh -c 'echo hi'` and `python3 -c pass`. For
+each it prints jobs per second, the median and 99th percentile time from
+launching dettrace to its exit, and the mean of each startup phase dettrace
+reports with --print-statistics.
+
+Jobs run as one-shot `dettrace -- PROGRAM` invocations, or with `--mode
+server` as `dettrace --connect` clients of a `dettrace --server` started for
+the benchmark, so the server, its `--pool` of zygotes and `--server-cores`
+are measured on the same scale:
+
+    ./jobThroughput.py --jobs 500
+    ./jobThroughput.py --jobs 500 --mode server --pool 8
+    ./jobThroughput.py --mode server --server-flag=--server-cores=4
+
+`--flag` options go to every dettrace, servers and clients alike: a pool's
+zygotes only serve jobs whose flags match the server's.
+"""
+
+import argparse
+import concurrent.futures
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+WORKLOADS = {
+    "true": ["/bin/true"],
+    "echo": ["sh", "-c", "echo hi"],
+    "python": ["python3", "-c", "pass"],
+}
+
+STAT_PREFIX = "dettrace Statistic. "
+
+# Per job times --print-statistics reports besides the startup phases, in us.
+JOB_TIMES = {
+    "job setup (us)": "job_setup_us",
+    "job run (us)": "job_run_us",
+    "tracer teardown (us)": "tracer_teardown_us",
+}
+
+
+def percentile(xs, p):
+    """The p-th percentile of xs, by the nearest rank."""
+    ranked = sorted(xs)
+    return ranked[max(0, math.ceil(p / 100 * len(ranked)) - 1)]
+
+
+def parse_phases(stderr):
+    """Startup phases and job times of one job's --print-statistics, in us."""
+    phases = {}
+    for line in stderr.splitlines():
+        if not line.startswith(STAT_PREFIX):
+            continue
+        key, _, value = line[len(STAT_PREFIX):].partition(": ")
+        if key == "startup (json)":
+            try:
+                phases.update(json.loads(value))
+            except ValueError:
+                pass
+        elif key in JOB_TIMES:
+            phases[JOB_TIMES[key]] = int(value)
+    return phases
+
+
+def run_job(command):
+    """Run one job, return its wall time in seconds, exit status and phases."""
+    start = time.perf_counter()
+    done = subprocess.run(command, stdin=subprocess.DEVNULL,
+                          stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                          universal_newlines=True)
+    wall = time.perf_counter() - start
+    return wall, done.returncode, parse_phases(done.stderr)
+
+
+def run_workload(command, jobs, concurrency):
+    """Run jobs jobs of command, concurrency at a time in back to back lanes."""
+    results = []
+    lock = threading.Lock()
+    left = [jobs]
+
+    def lane():
+        while True:
+            with lock:
+                if left[0] == 0:
+                    return
+                left[0] -= 1
+            result = run_job(command)
+            with lock:
+                results.append(result)
+
+    start = time.perf_counter()
+    with concurrent.futures.ThreadPoolExecutor(concurrency) as lanes:
+        for future in [lanes.submit(lane) for _ in range(concurrency)]:
+            future.result()
+    return time.perf_counter() - start, results
+
+
+def summarize(name, elapsed, results):
+    walls = [wall for wall, status, _ in results if status == 0]
+    summary = {
+        "workload": name,
+        "jobs": len(results),
+        "failed": len(results) - len(walls),
+        "elapsed": elapsed,
+        "jobs_per_second": len(walls) / elapsed if elapsed > 0 else 0.0,
+        "phases_us": {},
+    }
+    if walls:
+        summary["p50_ms"] = percentile(walls, 50) * 1000
+        summary["p99_ms"] = percentile(walls, 99) * 1000
+    reported = [phases for _, status, phases in results
+                if status == 0 and phases]
+    # In the order dettrace reports them.
+    names = []
+    for phases in reported:
+        names += [key for key in phases if key not in names]
+    for phase in names:
+        values = [phases[phase] for phases in reported if phase in phases]
+        summary["phases_us"][phase] = sum(values) / len(values)
+    return summary
+
+
+def print_summary(summary):
+    print("%s: %d jobs, %d failed, %.1f jobs/s, p50 %.2f ms, p99 %.2f ms" % (
+        summary["workload"], summary["jobs"], summary["failed"],
+        summary["jobs_per_second"], summary.get("p50_ms", 0.0),
+        summary.get("p99_ms", 0.0)))
+    for phase, mean_us in summary["phases_us"].items():
+        print("  %-20s %10.0f" % (phase, mean_us))
+
+
+class Server:
+    """A dettrace --server for the benchmark, stopped on exit."""
+
+    def __init__(self, dettrace, flags, pool, server_flags):
+        self.directory = tempfile.TemporaryDirectory(prefix="dettrace-bench")
+        self.socket = os.path.join(self.directory.name, "server.sock")
+        command = [dettrace] + flags + ["--server", self.socket]
+        if pool:
+            command += ["--pool", str(pool)]
+        self.process = subprocess.Popen(command + server_flags,
+                                        stdin=subprocess.DEVNULL)
+
+    def __enter__(self):
+        deadline = time.monotonic() + 30
+        while not os.path.exists(self.socket):
+            if self.process.poll() is not None:
+                sys.exit("dettrace --server exited with status %d"
+                         % self.process.returncode)
+            if time.monotonic() > deadline:
+                self.process.kill()
+                sys.exit("dettrace --server did not listen on " + self.socket)
+            time.sleep(0.01)
+        return self
+
+    def __exit__(self, *exc):
+        self.process.terminate()
+        self.process.wait()
+        self.directory.cleanup()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("--dettrace", default="../../bin/dettrace",
+                        help="dettrace binary (default %(default)s)")
+    parser.add_argument("--jobs", type=int, default=200,
+                        help="jobs of each workload (default %(default)s)")
+    parser.add_argument("--concurrency", type=int, default=os.cpu_count(),
+                        help="jobs running at once (default the core count)")
+    parser.add_argument("--workload", action="append",
+                        choices=sorted(WORKLOADS),
+                        help="workloads to run (default all)")
+    parser.add_argument("--mode", choices=["cli", "server"], default="cli",
+                        help="one-shot dettrace runs or clients of a server")
+    parser.add_argument("--pool", type=int, default=0,
+                        help="zygotes the server keeps (--mode server)")
+    parser.add_argument("--server-flag", action="append", default=[],
+                        help="extra flag of the server, e.g. "
+                             "--server-flag=--server-cores=4")
+    parser.add_argument("--flag", action="append", default=[],
+                        help="extra flag of every dettrace")
+    parser.add_argument("--native", action="store_true",
+                        help="also run each workload without dettrace")
+    parser.add_argument("--output", help="write the summaries there as JSON")
+    args = parser.parse_args()
+
+    dettrace = os.path.realpath(args.dettrace)
+    flags = ["--print-statistics"] + args.flag
+    workloads = args.workload or list(WORKLOADS)
+    print("%d jobs of each workload, %d at once, %s mode" % (
+        args.jobs, args.concurrency, args.mode))
+
+    summaries = []
+
+    def measure(name, command):
+        elapsed, results = run_workload(command, args.jobs, args.concurrency)
+        summary = summarize(name, elapsed, results)
+        print_summary(summary)
+        summaries.append(summary)
+
+    if args.native:
+        for name in workloads:
+            measure(name + " (native)", WORKLOADS[name])
+    if args.mode == "server":
+        with Server(dettrace, flags, args.pool, args.server_flag) as running:
+            for name in workloads:
+                measure(name, [dettrace] + flags +
+                        ["--connect", running.socket, "--"] + WORKLOADS[name])
+    else:
+        for name in workloads:
+            measure(name, [dettrace] + flags + ["--"] + WORKLOADS[name])
+
+    if args.output:
+        with open(args.output, "w") as out:
+            json.dump({"mode": args.mode, "pool": args.pool,
+                       "concurrency": args.concurrency,
+                       "summaries": summaries}, out, indent=2)
+    if any(summary["failed"] for summary in summaries):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
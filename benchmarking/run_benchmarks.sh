@@ -6,18 +6,9 @@ then
     echo "Please call this script from within the benchmarking/ dir."
 fi
 
-# Build dettrace
-make -C ../
-# remove old files
-rm *.time || true
+# Build dettrace, statically as it runs inside the chroot.
+make -C ../ static
 
-for package in xdelta sl whiff xdelta3 xdg-utils xdiskusage; do
-    for i in 1 2 3; do
-        /usr/bin/time --append -o $package.time \
-        -f "build time, real %e, user %U, sys %S" \
-        ../bin/dettrace --chroot ./wheezy --working-dir ./wheezy/home/$package/build \
-        dpkg-buildpackage -uc -us -b
-    done
-done
-
-more *.time
+# Build the packages of packages.txt natively and under dettrace, see
+# harness.py. Extra arguments go to the harness, e.g. --baseline.
+./harness.py packages.txt "$@"
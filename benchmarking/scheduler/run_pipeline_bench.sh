@@ -0,0 +1,36 @@
+#!/bin/bash -e
+
+## Replays of blocked pipe reads and writes per scheduling policy: shell
+## pipelines of a few stages, each run with the default highest pid first
+## order, with --producer-first and with --clock-order.
+## Usage: ./run_pipeline_bench.sh [path/to/dettrace] [stages...]
+
+DETTRACE=$(realpath ${1:-../../bin/dettrace})
+STAGES=${*:2}
+STAGES=${STAGES:-2 4 8}
+
+# A pipeline of $1 stages moving a few MiB through cat.
+pipeline() {
+    local command="head -c 4000000 /dev/zero"
+    for ((i = 1; i < $1; i++)); do
+        command="$command | cat"
+    done
+    echo "$command | wc -c"
+}
+
+# Statistic $1 of the --print-statistics output in $2.
+stat() {
+    echo "$2" | sed -n "s/^dettrace Statistic\. $1: \([0-9]*\)$/\1/p"
+}
+
+echo "stages  policy            replays  producers run first"
+for stages in $STAGES; do
+    command=$(pipeline $stages)
+    for policy in "" --producer-first --clock-order; do
+        stats=$($DETTRACE --print-statistics $policy bash -c "$command" \
+            2>&1 > /dev/null)
+        printf "%6d  %-16s  %7d  %19d\n" $stages "${policy:-highest pid}" \
+            $(stat "Total replays" "$stats") \
+            $(stat "Producers run ahead of their turn" "$stats")
+    done
+done
@@ -0,0 +1,17 @@
+#!/bin/bash -e
+
+## Compare the scheduler's pidBitmap run queues against the old priority_queue
+## ones. Also checks that both pick processes in the same order.
+## Usage: ./run_scheduler_bench.sh [processes] [rounds]
+
+ROOT=../..
+CXX=${CXX:-c++}
+
+$CXX -O2 -std=c++14 -D_GNU_SOURCE -I $ROOT/include -o schedulerBench \
+    schedulerBench.cpp $ROOT/src/scheduler.cpp $ROOT/src/logger.cpp \
+    $ROOT/src/util.cpp $ROOT/src/timeline.cpp $ROOT/src/timerWheel.cpp \
+    $ROOT/src/scheduleLog.cpp -pthread
+
+for processes in ${1:-64 1024 4096}; do
+    ./schedulerBench $processes ${2:-200}
+done
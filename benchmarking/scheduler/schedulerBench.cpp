@@ -0,0 +1,119 @@
+// Micro-benchmark for the scheduler's run queues.
+//
+// Simulates a build with many live processes: every round, each runnable
+// process is picked (highest pid first) and preempted, a few processes exit
+// and new ones are spawned. This is run against the real scheduler and against
+// a copy of the old priority_queue based queues, so the two can be compared:
+//
+//   ./schedulerBench [processes] [rounds]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <set>
+#include <vector>
+
+#include "logger.hpp"
+#include "scheduler.hpp"
+
+using namespace std;
+
+// The run queues as they were before pidBitmap: pick is O(log n), removing an
+// arbitrary pid rebuilds the heap.
+struct legacyQueues {
+  priority_queue<pid_t> runnable, blocked;
+  set<pid_t> finished;
+
+  static bool removeFrom(priority_queue<pid_t>& heap, pid_t element) {
+    vector<pid_t> elements;
+    bool found = false;
+    while (!heap.empty()) {
+      pid_t p = heap.top();
+      heap.pop();
+      if (p == element) {
+        found = true;
+      } else {
+        elements.push_back(p);
+      }
+    }
+    for (auto e : elements) {
+      heap.push(e);
+    }
+    return found;
+  }
+
+  void add(pid_t p) { runnable.push(p); }
+  void remove(pid_t p) {
+    if (!removeFrom(runnable, p)) {
+      removeFrom(blocked, p);
+    }
+    if (runnable.empty()) {
+      swap(runnable, blocked);
+    }
+  }
+  void preempt() {
+    blocked.push(runnable.top());
+    runnable.pop();
+    if (runnable.empty()) {
+      swap(runnable, blocked);
+    }
+  }
+  pid_t next() { return runnable.top(); }
+};
+
+struct bitmapQueues {
+  logger log{"", 0};
+  scheduler sched;
+
+  explicit bitmapQueues(pid_t first) : sched(first, log) {}
+  void add(pid_t p) { sched.addAndScheduleNext(p); }
+  void remove(pid_t p) { sched.removeAndScheduleNext(p); }
+  void preempt() { sched.preemptAndScheduleNext(); }
+  pid_t next() { return sched.getNext(); }
+};
+
+template <typename Queues>
+static double run(Queues& q, int processes, int rounds, pid_t& checksum) {
+  auto start = chrono::steady_clock::now();
+  pid_t nextPid = processes + 2;
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < processes; i++) {
+      checksum += q.next();
+      q.preempt();
+    }
+    // Churn: one process exits, one is spawned.
+    q.remove(q.next());
+    q.add(nextPid++);
+  }
+  auto end = chrono::steady_clock::now();
+  return chrono::duration<double, nano>(end - start).count() /
+         ((double)processes * rounds);
+}
+
+int main(int argc, char** argv) {
+  int processes = argc > 1 ? atoi(argv[1]) : 4096;
+  int rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+  legacyQueues legacy;
+  bitmapQueues bitmap{1};
+  legacy.add(1);
+  for (pid_t p = 2; p <= processes; p++) {
+    legacy.add(p);
+    bitmap.add(p);
+  }
+
+  pid_t legacySum = 0, bitmapSum = 0;
+  double legacyNs = run(legacy, processes, rounds, legacySum);
+  double bitmapNs = run(bitmap, processes, rounds, bitmapSum);
+
+  printf(
+      "%d processes, %d rounds: priority_queue %.1f ns/decision, "
+      "pidBitmap %.1f ns/decision\n",
+      processes, rounds, legacyNs, bitmapNs);
+  if (legacySum != bitmapSum) {
+    printf("Schedules differ! The scheduling policy changed.\n");
+    return 1;
+  }
+  return 0;
+}
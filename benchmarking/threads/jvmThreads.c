@@ -0,0 +1,84 @@
+// What a JVM build tool looks like to dettrace: a pool of many threads taking
+// tasks off a shared queue guarded by a futex based lock, timestamping them
+// with clock_gettime all along, and all stopping together now and then, like
+// at a GC safepoint. See run_thread_bench.sh.
+//
+// Usage: jvmThreads <threads> <tasks per thread>
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Tasks between two safepoints, per thread.
+#define SAFEPOINT_EVERY 64
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t haveTasks = PTHREAD_COND_INITIALIZER;
+static long tasksLeft;
+static pthread_barrier_t safepoint;
+static long rounds;
+
+static long nowNanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void* worker(void* arg) {
+  long busy = 0;
+  for (long round = 0; round < rounds; round++) {
+    for (int i = 0; i < SAFEPOINT_EVERY; i++) {
+      pthread_mutex_lock(&lock);
+      while (tasksLeft == 0) {
+        pthread_cond_wait(&haveTasks, &lock);
+      }
+      tasksLeft--;
+      pthread_mutex_unlock(&lock);
+
+      long start = nowNanos();
+      for (volatile int spin = 0; spin < 1000; spin++) {
+      }
+      busy += nowNanos() - start;
+    }
+    pthread_barrier_wait(&safepoint);
+  }
+  return (void*)busy;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <threads> <tasks per thread>\n", argv[0]);
+    return 1;
+  }
+  long threads = strtol(argv[1], NULL, 10);
+  rounds = strtol(argv[2], NULL, 10) / SAFEPOINT_EVERY;
+  if (threads < 1 || rounds < 1) {
+    fprintf(stderr, "need a thread and %d tasks per thread\n", SAFEPOINT_EVERY);
+    return 1;
+  }
+
+  pthread_t* pool = malloc(threads * sizeof(pthread_t));
+  // Every worker, plus us handing out the tasks.
+  pthread_barrier_init(&safepoint, NULL, threads + 1);
+  for (long t = 0; t < threads; t++) {
+    if (pthread_create(&pool[t], NULL, worker, NULL) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+
+  for (long round = 0; round < rounds; round++) {
+    pthread_mutex_lock(&lock);
+    tasksLeft += threads * SAFEPOINT_EVERY;
+    pthread_cond_broadcast(&haveTasks);
+    pthread_mutex_unlock(&lock);
+    pthread_barrier_wait(&safepoint);
+  }
+
+  for (long t = 0; t < threads; t++) {
+    pthread_join(pool[t], NULL);
+  }
+  free(pool);
+  return 0;
+}
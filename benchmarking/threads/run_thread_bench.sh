@@ -0,0 +1,48 @@
+#!/bin/bash -e
+
+## How dettrace scales with the thread count of JVM like workloads, see
+## jvmThreads.c: for each thread count, the tracer's memory per thread, beyond
+## what it needs for one, the mean time a stopped tracee waits to be resumed,
+## ptrace stops per task and wall time.
+## Usage: ./run_thread_bench.sh [path/to/dettrace] [tasks/thread] [threads...]
+
+DETTRACE=$(realpath ${1:-../../bin/dettrace})
+TASKS=${2:-640}
+THREADS=${*:3}
+THREADS=${THREADS:-8 32 64 128 200}
+
+cc -O2 -pthread -o jvmThreads jvmThreads.c
+
+# Run jvmThreads with $1 threads under dettrace, print the wall time in
+# nanoseconds followed by the statistics we report.
+run() {
+    local stats=$(mktemp)
+    local start=$(date +%s%N)
+    $DETTRACE --print-statistics ./jvmThreads $1 $TASKS > /dev/null 2> $stats
+    local end=$(date +%s%N)
+    echo "wall $((end - start))"
+    sed -n 's/^dettrace Statistic\. \(.*\): \([0-9]*\)$/\1\t\2/p' $stats |
+        tr ' ' '_'
+    rm -f $stats
+}
+
+# Statistic $1 of the run in $2.
+stat() {
+    echo "$2" | awk -v k="$1" '$1 == k { print $2 }'
+}
+
+single=$(run 1)
+singleMemory=$(stat "tracer_peak_memory_(KiB)" "$single")
+
+echo "threads  memory/thread (bytes)  stop to resume (ns)  stops/task  wall (ms)"
+for threads in $THREADS; do
+    traced=$(run $threads)
+    memory=$(stat "tracer_peak_memory_(KiB)" "$traced")
+    awk -v n=$threads -v m=$memory -v m1=$singleMemory -v tasks=$TASKS \
+        -v latency=$(stat "mean_stop_to_resume_(ns)" "$traced") \
+        -v stops=$(stat "ptrace_stops" "$traced") \
+        -v wall=$(stat wall "$traced") \
+        'BEGIN { printf "%7d  %21.0f  %19d  %10.2f  %9.0f\n", n,
+                 n > 1 ? (m - m1) * 1024 / (n - 1) : 0, latency,
+                 stops / (n * tasks), wall / 1000000 }'
+done
@@ -31,6 +31,7 @@ stdenv.mkDerivation {
     mkdir -p "$out/bin";
     cp bin/dettrace "$out/bin/";
     cp -a root "$out/root";
+    cp -a profiles "$out/profiles";
     cp -a test/samplePrograms "$out/samplePrograms";
   '';
 }
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "taskPool.hpp"
 
 /** This class implements an Xorshift Linear-Feedback Shift Register
 https://en.wikipedia.org/wiki/Linear-feedback_shift_register#Xorshift_LFSRs
@@ -23,3 +28,136 @@ private:
   /** Our current internal state */
   uint16_t lfsr;
 };
+
+/** xoshiro256++ http://prng.di.unimi.it/ run as several independent lanes, for
+generating pseudorandom bytes in bulk. Each step of a lane is only adds, shifts,
+rotates and xors on 64-bit words, the same for every lane, so compilers turn
+the inner loops into vector instructions.
+ */
+class blockPRNG {
+public:
+  /** Number of interleaved generators, fill() produces 8 bytes per lane. */
+  static const size_t lanes = 4;
+
+  /** Expand seed into the state of every lane with splitmix64. */
+  blockPRNG(uint64_t seed) {
+    for (size_t word = 0; word < 4; word++) {
+      for (size_t lane = 0; lane < lanes; lane++) {
+        seed += 0x9e3779b97f4a7c15;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        s[word][lane] = z ^ (z >> 31);
+      }
+    }
+  }
+
+  /** Fill buf with size pseudorandom bytes, size is a multiple of 8 * lanes.
+   */
+  void fill(uint8_t* buf, size_t size) {
+    for (size_t done = 0; done < size; done += sizeof(out)) {
+      for (size_t lane = 0; lane < lanes; lane++) {
+        out[lane] = rotl(s[0][lane] + s[3][lane], 23) + s[0][lane];
+        uint64_t t = s[1][lane] << 17;
+        s[2][lane] ^= s[0][lane];
+        s[3][lane] ^= s[1][lane];
+        s[1][lane] ^= s[2][lane];
+        s[0][lane] ^= s[3][lane];
+        s[2][lane] ^= t;
+        s[3][lane] = rotl(s[3][lane], 45);
+      }
+      memcpy(buf + done, out, sizeof(out));
+    }
+  }
+
+private:
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+  /** Four state words per lane, word-major so each word is a vector. */
+  uint64_t s[4][lanes];
+  /** Output of the last step of every lane. */
+  uint64_t out[lanes];
+};
+
+/** Mix b into seed a with the splitmix64 finalizer, for deriving the seeds of
+independent streams, e.g. one per tracee, from one seed.
+ */
+inline uint64_t mixSeed(uint64_t a, uint64_t b) {
+  uint64_t z = a + 0x9e3779b97f4a7c15 * (b + 1);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+/** The bytes of a blockPRNG as a stream, handed out in pieces of any size.
+With a taskPool, the next block is generated by a helper while this one is
+handed out. Either way the stream is the same.
+ */
+class randomByteStream {
+public:
+  randomByteStream(uint64_t seed) : prng(seed), block(blockSize) {}
+
+  /** The helper may still be filling in. */
+  ~randomByteStream() {
+    if (next.valid()) {
+      next.get();
+    }
+  }
+
+  randomByteStream(const randomByteStream&) = delete;
+  randomByteStream& operator=(const randomByteStream&) = delete;
+
+  /** Generate blocks ahead on a helper of tasks from now on. */
+  void generateOn(taskPool& tasks) { this->tasks = &tasks; }
+
+  /** Copy the next count bytes of the stream to buf. */
+  void read(uint8_t* buf, size_t count) {
+    while (count > 0) {
+      if (used == blockSize) {
+        nextBlock();
+        used = 0;
+      }
+      size_t bytes = count < blockSize - used ? count : blockSize - used;
+      memcpy(buf, block.data() + used, bytes);
+      buf += bytes;
+      count -= bytes;
+      used += bytes;
+      handedOut += bytes;
+    }
+  }
+
+  /** Bytes read so far. */
+  uint64_t position() const { return handedOut; }
+
+private:
+  static const size_t blockSize = 64 * 1024;
+
+  /** Make block the next one, and start on the one after. */
+  void nextBlock() {
+    if (tasks == nullptr) {
+      prng.fill(block.data(), blockSize);
+      return;
+    }
+    if (!next.valid()) {
+      next = generate(std::move(block));
+    }
+    block = next.get();
+    // Only the task touches prng until we take its block.
+    next = generate(std::vector<uint8_t>(blockSize));
+  }
+
+  taskResult<std::vector<uint8_t>> generate(std::vector<uint8_t>&& into) {
+    return tasks->run([this, into = std::move(into)]() mutable {
+      prng.fill(into.data(), blockSize);
+      return std::move(into);
+    });
+  }
+
+  blockPRNG prng;
+  taskPool* tasks = nullptr;
+  taskResult<std::vector<uint8_t>> next;
+  std::vector<uint8_t> block;
+  /** Bytes of block already handed out. */
+  size_t used = blockSize;
+  uint64_t handedOut = 0;
+};
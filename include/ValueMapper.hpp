@@ -1,14 +1,17 @@
 #ifndef VALUE_MAPPER_H
 #define VALUE_MAPPER_H
 
-#include <unordered_map>
+#include <functional>
+#include <vector>
+
+#include "flatHashMap.hpp"
 #include "logger.hpp"
 
 using namespace std;
 
 /**
- * Simple wrapper around std::map for virtualizing values like inodes.
- * Template parameter Virtual must be an integral type.
+ * Simple wrapper around a hash map for virtualizing values like inodes.
+ * Template parameter Virtual must be an integral type, and Real too.
  */
 template <typename Real, typename Virtual>
 class ValueMapper {
@@ -19,14 +22,41 @@ protected:
    * C++ doesn't support that unless I use phantom types and wrapper classes...
    */
 
-  unordered_map<Real, Virtual>
+  flatHashMap<Real, Virtual>
       realToVirtualValue; /**< A mapping from Real to Virtual. */
+  /**< Inverse of realToVirtualValue, only kept if asked for. */
+  flatHashMap<Virtual, Real> virtualToRealValue;
+  bool keepReverse;
   Virtual freshValue; /**< Next available Virtual value to be added to map. */
   logger& myLogger; /**< A logger. */
   const string
       mappingName; /**< String name of this map, useful for debugging. */
 
+  Virtual setMapping(Virtual& slot, Real realValue, Virtual virtualValue) {
+    slot = virtualValue;
+    if (keepReverse) {
+      *virtualToRealValue.lookupOrInsert(virtualValue).first = realValue;
+    }
+    if (onMapping) {
+      onMapping(realValue, virtualValue);
+    }
+    return virtualValue;
+  }
+
+  void logNewValue(Real realValue) {
+    DETTRACE_LOG(
+        myLogger, Importance::info,
+        mappingName + ": New virtual value added: " + to_string(freshValue) +
+            "\n");
+    DETTRACE_LOG(
+        myLogger, Importance::extra,
+        "  (Real value was: " + to_string(realValue) + ")\n");
+  }
+
 public:
+  /** Called with every mapping made, e.g. to export it, see sharedTables. */
+  function<void(Real, Virtual)> onMapping;
+
   /**
    * Constructor.
    * Takes in logger for writing data, name of the mapping, and a starting
@@ -34,9 +64,14 @@ public:
    * @param logr initialized logger to write data to.
    * @param name string name of this mapping, useful for debugging.
    * @param startingValue initial Virtual value to start with.
+   * @param keepReverse also map virtual values back, see getRealValue.
    */
-  ValueMapper(logger& logr, string name, Virtual startingValue)
-      : myLogger(logr), mappingName(name) {
+  ValueMapper(
+      logger& logr,
+      string name,
+      Virtual startingValue,
+      bool keepReverse = false)
+      : keepReverse(keepReverse), myLogger(logr), mappingName(name) {
     freshValue = startingValue;
   }
 
@@ -47,25 +82,68 @@ public:
    * @return the mapped virtual value.
    */
   Virtual addRealValue(Real realValue) {
+    auto entry = realToVirtualValue.lookupOrInsert(realValue);
     // it is nondet whether this realValue (typically an inode) has been seen
     // before, so we need to print either way to keep log message IDs
     // deterministic
-    if (realToVirtualValue.find(realValue) != realToVirtualValue.end()) {
-      myLogger.writeToLog(Importance::extra, "Overwriting old value in map.\n");
+    if (!entry.second) {
+      DETTRACE_LOG(
+          myLogger, Importance::extra, "Overwriting old value in map.\n");
     } else {
-      myLogger.writeToLog(Importance::extra, "Allocating new value in map.\n");
+      DETTRACE_LOG(
+          myLogger, Importance::extra, "Allocating new value in map.\n");
     }
 
-    myLogger.writeToLog(
-        Importance::info, mappingName + ": New virtual value added: " +
-                              to_string(freshValue) + "\n");
-    myLogger.writeToLog(
-        Importance::extra,
+    logNewValue(realValue);
+    return setMapping(*entry.first, realValue, freshValue++);
+  }
+
+  /**
+   * Virtual value of realValue, mapping it to a fresh one if it has none yet.
+   * One lookup, where realValueExists followed by getVirtualValue or
+   * addRealValue takes two.
+   * @param realValue real value to virtualize.
+   * @return virtual value that is mapped to the real one.
+   */
+  Virtual lookupOrAdd(Real realValue) {
+    auto entry = realToVirtualValue.lookupOrInsert(realValue);
+    if (entry.second) {
+      logNewValue(realValue);
+      return setMapping(*entry.first, realValue, freshValue++);
+    }
+
+    DETTRACE_LOG(
+        myLogger, Importance::info,
+        mappingName + " fetched virtual value: " + to_string(*entry.first) +
+            "\n");
+    DETTRACE_LOG(
+        myLogger, Importance::extra,
         "  (Real value was: " + to_string(realValue) + ")\n");
+    return *entry.first;
+  }
 
-    Virtual vValue = freshValue++;
-    realToVirtualValue[realValue] = vValue;
-    return vValue;
+  /**
+   * lookupOrAdd of every value in reals, in order, into virtuals. Logs once
+   * for the whole batch, and looks keys up a few ahead so their slots are in
+   * cache by the time we get to them. For large directories, see
+   * virtualizeEntries.
+   */
+  void lookupOrAddAll(const vector<Real>& reals, vector<Virtual>& virtuals) {
+    const size_t ahead = 8;
+    virtuals.resize(reals.size());
+    for (size_t i = 0; i < reals.size(); i++) {
+      if (i + ahead < reals.size()) {
+        realToVirtualValue.prefetch(reals[i + ahead]);
+      }
+      auto entry = realToVirtualValue.lookupOrInsert(reals[i]);
+      virtuals[i] = entry.second
+          ? setMapping(*entry.first, reals[i], freshValue++)
+          : *entry.first;
+    }
+    DETTRACE_LOG(
+        myLogger, Importance::info,
+        mappingName + " fetched " + to_string(reals.size()) +
+            " virtual values\n");
   }
 
   /**
@@ -75,36 +153,95 @@ public:
    * @return virtual value that is mapped to the real one.
    */
   Virtual getVirtualValue(Real realValue) {
-    if (realToVirtualValue.find(realValue) != realToVirtualValue.end()) {
-      Virtual virtValue = realToVirtualValue.at(realValue);
-      myLogger.writeToLog(
-          Importance::info, mappingName + " fetched virtual value: " +
-                                to_string(virtValue) + "\n");
-      myLogger.writeToLog(
-          Importance::extra,
+    const Virtual* virtValue = realToVirtualValue.find(realValue);
+    if (virtValue != nullptr) {
+      DETTRACE_LOG(
+          myLogger, Importance::info, mappingName + " fetched virtual value: " +
+                                          to_string(*virtValue) + "\n");
+      DETTRACE_LOG(
+          myLogger, Importance::extra,
           "  (Real value was: " + to_string(realValue) + ")\n");
 
-      return virtValue;
+      return *virtValue;
     }
     throw runtime_error(
         "dettrace runtime exception: " + mappingName + ": getVirtualValue(" +
         to_string(realValue) + ") does not exist\n");
   }
 
+  /**
+   * Get the real value a virtual value was last handed out for. Only for
+   * mappers constructed with keepReverse.
+   * Throws error if virtual value does not exist.
+   */
+  Real getRealValue(Virtual virtualValue) {
+    const Real* realValue = virtualToRealValue.find(virtualValue);
+    if (!keepReverse || realValue == nullptr) {
+      throw runtime_error(
+          "dettrace runtime exception: " + mappingName + ": getRealValue(" +
+          to_string(virtualValue) + ") does not exist\n");
+    }
+    return *realValue;
+  }
+
   /**
    * Check if real value is already in map for real values.
    * @param realValue: real value to check for.
    * @return True if real value exists, otherwise False.
    */
   bool realValueExists(Real realValue) {
-    bool keyExists =
-        realToVirtualValue.find(realValue) != realToVirtualValue.end();
-    myLogger.writeToLog(
-        Importance::extra, mappingName + "realValueExists(" +
-                               to_string(realValue) +
-                               ") = " + to_string(keyExists) + "\n");
+    bool keyExists = realToVirtualValue.find(realValue) != nullptr;
+    DETTRACE_LOG(
+        myLogger, Importance::extra, mappingName + "realValueExists(" +
+                                         to_string(realValue) +
+                                         ") = " + to_string(keyExists) + "\n");
     return keyExists;
   }
+
+  /**
+   * Map realValue to virtualValue as a previous run did, without logging.
+   * @see loadInodeSnapshot
+   */
+  void restoreValue(Real realValue, Virtual virtualValue) {
+    setMapping(
+        *realToVirtualValue.lookupOrInsert(realValue).first, realValue,
+        virtualValue);
+  }
+
+  /**
+   * Drop realValue's mapping, e.g. once its file is gone. Its virtual value is
+   * never handed out again, a later realValue gets a fresh one.
+   * @return whether realValue had a mapping.
+   */
+  bool forget(Real realValue) {
+    const Virtual* virtValue = realToVirtualValue.find(realValue);
+    if (virtValue == nullptr) {
+      return false;
+    }
+    if (keepReverse) {
+      virtualToRealValue.erase(*virtValue);
+    }
+    realToVirtualValue.erase(realValue);
+    DETTRACE_LOG(
+        myLogger, Importance::extra,
+        mappingName + ": forgot real value " + to_string(realValue) + "\n");
+    return true;
+  }
+
+  /** Next virtual value addRealValue hands out. */
+  Virtual nextFreshValue() const { return freshValue; }
+
+  void setFreshValue(Virtual value) { freshValue = value; }
+
+  /** Bytes of both maps, see memoryUsage. */
+  size_t bytesHeld() const {
+    return realToVirtualValue.bytesHeld() + virtualToRealValue.bytesHeld();
+  }
+
+  /** Every real value we know of, to its virtual value. */
+  const flatHashMap<Real, Virtual>& mappings() const {
+    return realToVirtualValue;
+  }
 };
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef ADDRESS_SPACE_H
+#define ADDRESS_SPACE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vdso.hpp"
+
+using namespace std;
+
+/** One mapping of a tracee, [start, end). */
+struct vma {
+  uint64_t start;
+  uint64_t end;
+  /** ProcMapPerm bits. */
+  long perms;
+  /** Offset in the mapped file of start. */
+  uint64_t offset;
+  /** Path of the mapped file, [vdso], [stack] and so on, "" if anonymous. */
+  string name;
+};
+
+/**
+ * A tracee's mappings, keyed by start address: finding the one holding an
+ * address is a tree lookup rather than a read of /proc/pid/maps.
+ *
+ * Seeded from one read of /proc/pid/maps, then kept up to date with the
+ * mappings we make and unmap in the tracee ourselves. The tracee's own mmap,
+ * munmap, mremap, mprotect and brk go by without stopping, so users read the
+ * maps again when a lookup misses, see trapProfile.
+ */
+class addressSpace {
+public:
+  addressSpace() = default;
+
+  /** The mappings parseProcMapEntries found. */
+  explicit addressSpace(const vector<ProcMapEntry>& entries);
+
+  /** The mapping holding addr, nullptr if none does. */
+  const vma* find(uint64_t addr) const;
+
+  /** m was mapped, over whatever was there before, like mmap with MAP_FIXED. */
+  void map(const vma& m);
+
+  /** [start, end) was unmapped, mappings it covers partly are split. */
+  void unmap(uint64_t start, uint64_t end);
+
+  size_t size() const { return byStart.size(); }
+
+private:
+  std::map<uint64_t, vma> byStart;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef BRANCH_COUNTER_H
+#define BRANCH_COUNTER_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <unordered_map>
+
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * Per tracee retired conditional branch counters, used to preempt tracees that
+ * spin in user space without making system calls, like rr does.
+ *
+ * Every tracee gets a user space only perf counter that raises overflowSignal
+ * in that thread after each quantum of branches. The tracer sees the signal as
+ * a signal-delivery-stop, suppresses it and may preempt the tracee. Branch
+ * counts only depend on what the tracee executed, so preemption points are
+ * the same from run to run, give or take the counter's skid.
+ *
+ * If the kernel or CPU has no usable counter (VMs, perf_event_paranoid...) we
+ * log it once and stop trying: tracees then run without branch preemption.
+ */
+class branchCounter {
+public:
+  /** Signal counters raise on overflow, rr uses the same one. */
+  static const int overflowSignal = SIGSTKFLT;
+
+  /**
+   * @param quantum branches between overflow signals, 0 disables counting.
+   */
+  branchCounter(uint64_t quantum, logger& log);
+  ~branchCounter();
+  branchCounter(const branchCounter&) = delete;
+  branchCounter& operator=(const branchCounter&) = delete;
+
+  bool enabled() const { return quantum != 0 && supported; }
+
+  /** Start counting tid's branches. tid must be stopped. */
+  void attach(pid_t tid);
+
+  /** tid is gone, drop its counter. Fine to call on unknown tids. */
+  void detach(pid_t tid);
+
+  /**
+   * Whether a signal tid received came from its counter, from the si_fd of its
+   * siginfo.
+   */
+  bool isOverflow(pid_t tid, int signalFd) const;
+
+private:
+  /** perf event fd counting tid's branches, -1 on failure. */
+  int openCounter(pid_t tid);
+
+  uint64_t quantum;
+  logger& log;
+  bool supported = true;
+  /** Tracee tid to its counter's fd. */
+  unordered_map<pid_t, int> counters;
+};
+
+#endif
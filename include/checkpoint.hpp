@@ -0,0 +1,156 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <string>
+
+#include "logger.hpp"
+#include "traceePtr.hpp"
+
+using namespace std;
+
+/**
+ * --checkpoint-at: a snapshot of a run, taken the first time its tracee gets
+ * to a marker, that later runs start from instead of running the
+ * deterministic prefix up to it again.
+ *
+ * The snapshot is made of forks. At the marker's seccomp stop the tracee's
+ * system call becomes a fork, whose child we leave stopped: the frozen copy
+ * of the tracee. Then the tracer forks too, the holder, which keeps all of
+ * the tracer's state as it was at the marker: states, globalState, the
+ * scheduler, the logical clocks. The run itself goes on as if nothing
+ * happened, the tracee makes its system call again.
+ *
+ * For every restore the holder forks the frozen copy, into the pid the
+ * tracee had, and forks itself, into a tracer that attaches the new tracee
+ * and goes on from the marker. Both sides start from what they were at the
+ * marker, so the run from there is the same as the first one: the pids it
+ * allocates too, as the namespace's last pid is set back every time. Our own
+ * processes get pids at the top of the range, out of the tracees' way.
+ *
+ * What is not in the snapshot is shared by all runs: the file system, and
+ * the open file descriptions the tracee had at the marker, pipes, sockets and
+ * file offsets included. Needs dettrace's pid namespace, and only one tracee
+ * thread at the marker, see execution::takeCheckpoint.
+ */
+class checkpoint {
+public:
+  /** Where to take it: systemCall, or an open of path. */
+  struct marker {
+    int systemCall = -1;
+    string path;
+  };
+
+  /**
+   * The marker of --checkpoint-at text, `syscall:NAME` or `open:PATH`.
+   * runtimeError() on anything else.
+   */
+  static marker parseMarker(const string& text);
+
+  enum class role {
+    original, /*< The run that took it, goes on as usual. */
+    restored, /*< A run from the checkpoint, we are its new tracer. */
+    failed, /*< None taken, logged. */
+  };
+
+  checkpoint(marker at, logger& log);
+  ~checkpoint() { release(); }
+  checkpoint(const checkpoint&) = delete;
+  checkpoint& operator=(const checkpoint&) = delete;
+
+  /**
+   * Whether a tracee making systemCall is at the marker, path being what it
+   * opens, if it opens one. Never once one was taken or given up on.
+   */
+  bool isMarker(int systemCall, const string& path) const;
+
+  /** There is a checkpoint to restore() from, held by another process. */
+  bool taken() const { return holder != -1; }
+
+  /**
+   * Take it, pid being our only tracee, in the seccomp stop of its system
+   * call at the marker. pid is in that stop again when we return, in every
+   * role. Threads of ours other than the caller must be stopped: only the
+   * caller is forked.
+   * @param scratch tracee memory of ours restores may write to, for the
+   * paths of the streams they are given
+   */
+  role take(pid_t pid, traceePtr<void> scratch);
+
+  /**
+   * Run from the checkpoint once more, after the original run ended, and
+   * wait for it while reaping what it leaves us, as we are pid 1.
+   * @param streams stdin, stdout and stderr for the restored tracee instead
+   * of the ones it had at the marker, if not null
+   * @return its exit code, 1 if it could not be started.
+   */
+  int restore(const int* streams = nullptr);
+
+  /** Stop the holder and its frozen tracee, no restore() after this. */
+  void release();
+
+private:
+  /**
+   * The holder: restore whenever asked to, exit once the channel closes.
+   * Only returns in the tracer of a restore.
+   */
+  void hold();
+
+  /**
+   * Fork the frozen copy into the pid the tracee had, set up to make its
+   * system call at the marker again, and left stopped. -1 on failure.
+   */
+  pid_t forkFrozenTracee();
+
+  /** Attach the stopped restoredPid and run it to the marker's stop. */
+  void attachRestored(pid_t restoredPid);
+
+  /**
+   * Give restoredPid, in the marker's stop, streams of ours as its fds 0 to
+   * 2. It opens them through /proc, so pipes, files and terminals do, sockets
+   * don't.
+   */
+  void redirectStreams(pid_t restoredPid, const int* streams);
+
+  /**
+   * Have pid, in the marker's stop, make system call nr instead, then stop
+   * there again. @return what it returned.
+   */
+  long injectAtMarker(pid_t pid, long nr, long a0, long a1, long a2);
+
+  /** Set the pid namespace's last pid, the next one allocated follows it. */
+  bool setLastPid(pid_t pid);
+
+  /** fork() into pid, high in the range. -1 on failure. */
+  pid_t forkInto(pid_t pid);
+
+  /** Detach the stopped pid, leaving it stopped. */
+  static void leaveStopped(pid_t pid);
+
+  marker at;
+  logger& log;
+  bool givenUp = false;
+
+  /** /proc/sys/kernel/ns_last_pid, open from take() on. */
+  int lastPidFd = -1;
+  /** The last pid when we took it, and the tracee's. */
+  pid_t lastPid = 0;
+  pid_t traceePid = -1;
+  /** The tracee's registers in its seccomp stop at the marker. */
+  struct user_regs_struct markerRegs;
+  traceePtr<void> scratch{nullptr};
+
+  /**
+   * pid_max, the frozen tracee, the holder and the tracers of restores are
+   * the pids right below it.
+   */
+  pid_t topPid = 0;
+  pid_t frozen = -1;
+  pid_t holder = -1;
+  /** To the holder, restore requests and their exit codes. */
+  int channel = -1;
+};
+
+#endif
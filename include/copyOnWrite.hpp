@@ -0,0 +1,63 @@
+#ifndef COPY_ON_WRITE_H
+#define COPY_ON_WRITE_H
+
+#include <memory>
+
+using namespace std;
+
+/**
+ * Per process tracer state a forked child starts out sharing with its parent,
+ * copied only once either of them changes it. Most children exec right away,
+ * and exec throws most of it out anyway.
+ *
+ * Copies of a copyOnWrite are the same value and see each other's writes, as
+ * the threads of a process do. forked() makes a new one, which shares the value
+ * until one side calls write().
+ */
+template <typename T>
+class copyOnWrite {
+public:
+  /** A new, value initialized, T. */
+  copyOnWrite() : slot(make_shared<shared_ptr<T>>(make_shared<T>())) {}
+
+  const T& operator*() const { return **slot; }
+
+  const T* operator->() const { return slot->get(); }
+
+  /**
+   * The value, to change it. Copied first if another process still shares it,
+   * threads sharing this see the copy too.
+   */
+  T& write() {
+    if (slot->use_count() > 1) {
+      *slot = make_shared<T>(**slot);
+    }
+    return **slot;
+  }
+
+  /**
+   * Erase key from a map or set value. Only a value that has key is copied,
+   * closing an fd we never tracked costs nothing.
+   */
+  template <typename K>
+  void erase(const K& key) {
+    if ((*slot)->count(key) != 0) {
+      write().erase(key);
+    }
+  }
+
+  /** For a forked child: the same value, until one side writes to it. */
+  copyOnWrite forked() const { return copyOnWrite(*slot); }
+
+  /** Start over with a new T, e.g. after execve. Threads sharing this too. */
+  void reset() { *slot = make_shared<T>(); }
+
+private:
+  explicit copyOnWrite(const shared_ptr<T>& value)
+      : slot(make_shared<shared_ptr<T>>(value)) {}
+
+  /** Shared by the threads of a process, points to the value processes share. */
+  shared_ptr<shared_ptr<T>> slot;
+};
+
+#endif
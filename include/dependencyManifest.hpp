@@ -0,0 +1,66 @@
+#ifndef DEPENDENCY_MANIFEST_H
+#define DEPENDENCY_MANIFEST_H
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fileHasher.hpp"
+#include "ptracer.hpp"
+#include "state.hpp"
+
+using namespace std;
+
+/**
+ * Files each exec of a run read, with their content hashes, written by
+ * --dependencies as JSON once the run is over:
+ *
+ *   [{"pid": 2, "exe": "/usr/bin/cc1", "argv": ["cc1", ...],
+ *     "reads": {"/usr/include/stdio.h": "<hash>", ...}}, ...]
+ *
+ * Reads of a process that forked but didn't exec count for the exec it came
+ * from. Files are hashed on a thread of our own as the tracees open them,
+ * once per version (inode, size and times), see fileHasher. A file written to
+ * between its open and our read of it has a null hash.
+ */
+class dependencyManifest {
+public:
+  /** Write to path, hashing with hashes. */
+  dependencyManifest(const string& path, fileHasher& hashes);
+
+  /** Writes the manifest out. */
+  ~dependencyManifest();
+
+  dependencyManifest(const dependencyManifest&) = delete;
+  dependencyManifest& operator=(const dependencyManifest&) = delete;
+
+  /** pid exec'ed: later reads belong to a new exec. */
+  void execed(pid_t pid);
+
+  /** child's reads count for the exec parent belongs to. */
+  void spawned(pid_t parent, pid_t child);
+
+  /** The tracee stopped at syscallNum's post-hook, note what it opened. */
+  void systemCall(state& s, ptracer& t, int syscallNum);
+
+  void exited(pid_t pid) { execOf.erase(pid); }
+
+private:
+  struct exec {
+    pid_t pid;
+    string exe;
+    vector<string> argv;
+    map<string, fileIdentity> reads;
+  };
+
+  string path;
+  fileHasher& hashes;
+  vector<exec> execs;
+  /** Index in execs of the exec a live process belongs to. */
+  unordered_map<pid_t, size_t> execOf;
+};
+
+#endif
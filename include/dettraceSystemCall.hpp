@@ -15,6 +15,32 @@ using namespace std;
 #define ARCH_GET_CPUID 0x1011
 #define ARCH_SET_CPUID 0x1012
 
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+
+/**
+ * A system call reported through the seccomp notify fd instead of a ptrace
+ * stop. The tracee is blocked in the kernel, not stopped, so only its
+ * arguments and memory are available: handleNotify hooks may inspect those and
+ * optionally make the system call fail with returnValue, but cannot touch
+ * registers or request a post-hook. Only handlers that fit this are declared
+ * notify-safe, see seccomp::inspect.
+ */
+struct seccompNotification {
+  /** System call number. */
+  int systemCall;
+  /** Raw arguments, in order, args[0] is what ptracer::arg1() would return. */
+  uint64_t args[6];
+  /** If true, skip the system call and return returnValue instead. */
+  bool spoofReturn = false;
+  /** Negative errno or value to return when spoofReturn is set. */
+  int64_t returnValue = 0;
+};
+
 /**
  * Hopefully this will server as documentation for all our system calls.
  * Please keep in alphabetical order.
@@ -59,6 +85,22 @@ public:
   const string syscallName = "access";
 };
 // =======================================================================================
+/**
+ * int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+ *
+ * Only seen as it may create a unix socket, a path we may know missing.
+ */
+class bindSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_bind;
+  const string syscallName = "bind";
+};
+// =======================================================================================
 class brkSystemCall {
 public:
   static bool handleDetPre(
@@ -88,6 +130,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_chdir;
   const string syscallName = "chdir";
@@ -97,7 +141,8 @@ public:
  * int chmod(const char *pathname, mode_t mode);
  *
  * This is deterministic and jailed thanks to our jail. We keep it here to print
- * it's path for debugging!
+ * it's path for debugging! With --fakeroot we remember the mode, see
+ * fakeOwnership.
  */
 class chmodSystemCall {
 public:
@@ -105,6 +150,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_chmod;
   const string syscallName = "chmod";
@@ -115,6 +162,9 @@ public:
  *
  * int clock_gettime(clockid_t clk_id, struct timespec *tp);
  *
+ * Answered from our logical clock in the pre-hook, the kernel skips it, unless
+ * system calls can't be skipped (see globalState::skipSystemCalls) or the clock
+ * is one we leave to the kernel. Then the post-hook overwrites the answer.
  */
 class clock_gettimeSystemCall {
 public:
@@ -143,6 +193,24 @@ public:
   const string syscallName = "close";
 };
 // =======================================================================================
+/**
+ * int close_range(unsigned int first, unsigned int last, unsigned int flags);
+ *
+ * close of every fd from first to last, Python's subprocess and others close
+ * everything above 2 before each exec this way. We forget the fds we know of
+ * in the range in one go. CLOSE_RANGE_CLOEXEC closes nothing until execve.
+ */
+class close_rangeSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_close_range;
+  const string syscallName = "close_range";
+};
+// =======================================================================================
 /**
  *
  * int connect(int sockfd, const struct sockaddr *addr, socklen_t
@@ -240,6 +308,38 @@ public:
   const string syscallName = "epoll_pwait";
 };
 // =======================================================================================
+/**
+ * int eventfd(unsigned int initval);
+ *
+ * Eventfds tracees read are served by the tracer, see serveEventfdRead.
+ */
+class eventfdSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_eventfd;
+  const string syscallName = "eventfd";
+};
+// =======================================================================================
+/**
+ * int eventfd2(unsigned int initval, int flags);
+ *
+ * See eventfd.
+ */
+class eventfd2SystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_eventfd2;
+  const string syscallName = "eventfd2";
+};
+// =======================================================================================
 /**
  * int faccessat(int dirfd, const char *pathname, int mode, int flags);
  *
@@ -251,11 +351,62 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_faccessat;
   const string syscallName = "faccessat";
 };
 // =======================================================================================
+/**
+ * int fchdir(int fd);
+ *
+ * Same as chdir, with the directory given as an open file descriptor. We only
+ * see it to forget the cached cwd of the tracee, see traceePaths.
+ */
+class fchdirSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_fchdir;
+  const string syscallName = "fchdir";
+};
+// =======================================================================================
+/**
+ * int fchmod(int fd, mode_t mode);
+ *
+ * Only stopped for with --fakeroot, like chmod.
+ */
+class fchmodSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_fchmod;
+  const string syscallName = "fchmod";
+};
+// =======================================================================================
+/**
+ * int fchmodat(int dirfd, const char *pathname, mode_t mode, int flags);
+ *
+ * Only stopped for with --fakeroot, like chmod.
+ */
+class fchmodatSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_fchmodat;
+  const string syscallName = "fchmodat";
+};
+// =======================================================================================
 
 /**
  * ssize_t fgetxattr(int fd, const char *name, static void *value, size_t size);
@@ -327,8 +478,8 @@ public:
  * flags);
  *
  * change owner of file with f and at variant. Deterministic thanks to light
- * weight container.
- *
+ * weight container. The chown family converts owners to 0 for --convert-uids,
+ * with --fakeroot it only changes the owner stat reports, see fakeOwnership.
  */
 class fchownatSystemCall {
 public:
@@ -436,7 +587,9 @@ public:
  *
  * char* getcwd(char *buf, size_t size);
  *
- * Deterministic. We print the path for debugging purposes here.
+ * Deterministic. We print the path for debugging purposes here, the filter
+ * only stops it with --debug. The path comes from our cwd cache when we have
+ * it, see traceePaths, answering in the pre-hook.
  *
  */
 class getcwdSystemCall {
@@ -580,6 +733,7 @@ public:
  *
  * gives the number of seconds and microseconds since the Epoch
  *
+ * Answered in the pre-hook, like clock_gettime, tz as UTC.
  */
 class gettimeofdaySystemCall {
 public:
@@ -614,6 +768,47 @@ public:
   const int syscallNumber = SYS_ioctl;
   const string syscallName = "ioctl";
 };
+#ifdef SYS_io_uring_setup
+// =======================================================================================
+/**
+ * int io_uring_setup(u32 entries, struct io_uring_params *p);
+ *
+ * Only intercepted with --io-uring. Rings are set up disabled, and the
+ * post-hook maps them into the tracer, restricts and enables them, see
+ * ioUring. Setups asking for what we don't support fail with ENOSYS, as they
+ * do without --io-uring.
+ */
+class io_uring_setupSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_io_uring_setup;
+  const string syscallName = "io_uring_setup";
+};
+// =======================================================================================
+/**
+ * int io_uring_enter(unsigned int fd, unsigned int to_submit,
+ *                    unsigned int min_complete, unsigned int flags,
+ *                    const void *argp, size_t argsz);
+ *
+ * The pre-hook readies the SQEs about to be submitted, the post-hook waits
+ * for all of them to complete, replaying the call, and orders their CQEs, see
+ * ioUring.
+ */
+class io_uring_enterSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_io_uring_enter;
+  const string syscallName = "io_uring_enter";
+};
+#endif
 // =======================================================================================
 /*
  * ssize_t llistxattr(const char *path, char *list, size_t size);
@@ -787,6 +982,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_link;
   const string syscallName = "link";
@@ -804,6 +1001,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_linkat;
   const string syscallName = "linkat";
@@ -859,6 +1058,24 @@ public:
   const string syscallName = "openat";
 };
 // =======================================================================================
+/**
+ * int openat2(int dirfd, const char *pathname, struct open_how *how,
+ *             size_t size);
+ *
+ * openat with its flags and mode in how, handled the same way. The resolve
+ * flags only restrict which paths open.
+ */
+class openat2SystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_openat2;
+  const string syscallName = "openat2";
+};
+// =======================================================================================
 /**
  * int pause(void);
  *
@@ -1021,6 +1238,10 @@ public:
  *
  * TODO
  * FILESYSTEM RELATED.
+ *
+ * Reads of /dev/null are answered in the pre-hook, like writes, see
+ * writeSystemCall. Regular files and /dev/zero go to the kernel without a
+ * post-hook.
  */
 class readSystemCall {
 public:
@@ -1057,7 +1278,11 @@ public:
  * ssize_t readlink(const char *pathname, char *buf, size_t bufsiz);
  *
  * readlink, readlinkat - read value of a symbolic link
- * Deterministic thanks to our jail. Intercepted merely for debugging purposes.
+ * Deterministic thanks to our jail, except for the inodes in pipe:[N] and
+ * socket:[N] fd links. Where the filter stops it, with --debug, the links of
+ * /proc/self/exe and /proc/self/fd/N (and /proc/thread-self) are answered in
+ * the pre-hook from our fd table and the tracee's root, inodes virtual. Any
+ * other link goes to the kernel.
  *
  */
 class readlinkSystemCall {
@@ -1066,6 +1291,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_readlink;
   const string syscallName = "readlink";
@@ -1076,7 +1303,7 @@ public:
  * bufsiz);
  *
  * readlinkat - read value of a symbolic link
- * Deterministic thanks to our jail. Intercepted merely for debugging purposes.
+ * See readlinkSystemCall, only absolute paths are answered.
  *
  */
 class readlinkatSystemCall {
@@ -1085,6 +1312,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_readlinkat;
   const string syscallName = "readlinkat";
@@ -1256,6 +1485,42 @@ public:
   const string syscallName = "recvfrom";
 };
 
+// =======================================================================================
+/**
+ * int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask);
+ *
+ * Only stopped for with --cpus: every tracee may run on all gs.cpus CPUs of
+ * the machine we show, whatever the host has. Answered in the pre-hook, with
+ * the bytes of mask written like the system call, not its glibc wrapper.
+ */
+class sched_getaffinitySystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_sched_getaffinity;
+  const string syscallName = "sched_getaffinity";
+};
+// =======================================================================================
+/**
+ * int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask);
+ *
+ * Only stopped for with --cpus. Succeeds for any mask with one of the CPUs we
+ * show, without running: tracees keep running where the host puts them, so
+ * one asking for CPU 5 of 8 on a host with 4 still works.
+ */
+class sched_setaffinitySystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_sched_setaffinity;
+  const string syscallName = "sched_setaffinity";
+};
 // =======================================================================================
 /**
  * int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
@@ -1291,6 +1556,41 @@ public:
   const string syscallName = "set_robust_list";
 };
 // =======================================================================================
+/**
+ * ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+ *
+ * In-kernel copy, as deterministic as the read and write it replaces. Only
+ * stops for a post-hook when one end is a pipe the tracee thinks blocks: ours
+ * are secretly non blocking, so we wait and replay where it gets EAGAIN.
+ */
+class sendfileSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_sendfile;
+  const string syscallName = "sendfile";
+};
+// =======================================================================================
+/**
+ * ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+ *                size_t len, unsigned int flags);
+ *
+ * Same as sendfile, unless SPLICE_F_NONBLOCK asks for EAGAIN.
+ */
+class spliceSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_splice;
+  const string syscallName = "splice";
+};
+// =======================================================================================
 /**
  * int rt_sigprocmask(int how, const sigset_t* set, const sigset_t* oldset,
  * size_t sigsetsize);
@@ -1397,6 +1697,26 @@ public:
   const string syscallName = "stat";
 };
 // =======================================================================================
+/**
+ * int statx(int dirfd, const char *pathname, int flags, unsigned int mask,
+ *           struct statx *statxbuf);
+ *
+ * stat with a mask of the fields wanted. We rewrite the fields the kernel says
+ * it filled in (the returned stx_mask) with the same values as stat: inode,
+ * times, link count, blocks and device, plus btime, which is the epoch, and
+ * the mount id, which is 0.
+ */
+class statxSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_statx;
+  const string syscallName = "statx";
+};
+// =======================================================================================
 /**
  * int statfs(const char *path, struct statfs *buf);
  * Implement various fields.
@@ -1532,7 +1852,9 @@ public:
  *
  * TODO: Document and verify implementation.
  * TODO: Add logical clock for rt_sigprocmask.
- * Return results from our logical clock.
+ * Return results from our logical clock, in the pre-hook like clock_gettime.
+ * The post-hook also finishes the system calls turned into time(), see
+ * replaceSystemCallWithNoop.
  */
 class timeSystemCall {
 public:
@@ -1745,7 +2067,9 @@ public:
  * the  space  it  was using is made available for reuse.
  *
  * Similarly to other system calls, under deterministic threads and processes,
- * this should be deterministic. We keep it here to print it's path.
+ * this should be deterministic. We keep it here to print it's path, and to
+ * forget the inode of the file once it is gone, see
+ * globalState::reclaimUnlinkedInodes. Like unlinkat and rmdir.
  */
 class unlinkSystemCall {
 public:
@@ -1887,6 +2211,8 @@ public:
       globalState& gs, state& s, ptracer& t, scheduler& sched);
   static void handleDetPost(
       globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleNotify(
+      globalState& gs, state& s, ptracer& t, seccompNotification& n);
 
   const int syscallNumber = SYS_epoll_ctl;
   const string syscallName = "epoll_ctl";
@@ -1995,6 +2321,9 @@ public:
  *
  * TODO: Check number of bytes written, and continue writting until _count_
  * bytes are written. This may cause blocking issues in some cases.
+ *
+ * Writes to /dev/null take count bytes in the pre-hook, unless we hash
+ * outputs.
  */
 class writeSystemCall {
 public:
@@ -2026,6 +2355,25 @@ public:
   const int syscallNumber = SYS_socket;
   const string syscallName = "socket";
 };
+// =======================================================================================
+/**
+ * int socketpair(int domain, int type, int protocol, int sv[2]);
+ *
+ * AF_UNIX stream socketpairs are made non blocking like pipes, and their ends
+ * waited on and completed like pipes' are, see socketPairEnd. SCM_RIGHTS
+ * messages on any AF_UNIX socketpair carry what we know of the fds they pass,
+ * see sendmsg.
+ */
+class socketpairSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_socketpair;
+  const string syscallName = "socketpair";
+};
 
 // =======================================================================================
 /**
@@ -2095,31 +2443,126 @@ public:
 // =======================================================================================
 // Iterate through our vector of entries, which represent the binary memory for
 // linux_dirents or linux_dirent64. We virtualize the inodes and add entries to
-// our inodeMap.
+// our inodeMap, all in one batch, see ValueMapper::lookupOrAddAll.
 template <typename DirEntry>
 void virtualizeEntries(
     vector<uint8_t>& entries, ValueMapper<ino_t, ino_t>& inodeMap) {
-  // Variable size data, we cannot "iterate" over the entries in the array.
+  vector<DirEntry*> index;
+  vector<ino_t> inodes;
   uint8_t* position = entries.data();
 
   // Variable size data, we cannot "iterate" over the entries in the array.
   while (position < entries.data() + entries.size()) {
     DirEntry* currentEntry = (DirEntry*)position;
-    size_t entrySize = currentEntry->d_reclen;
 
     // Offset values are only meaninful to the filesystem, programs should not
     // be using it.
     currentEntry->d_off = 0;
-
-    // Virtualize our inode.
-    ino64_t inode = currentEntry->d_ino;
-    currentEntry->d_ino = !inodeMap.realValueExists(inode)
-                              ? inodeMap.addRealValue(inode)
-                              : inodeMap.getVirtualValue(inode);
+    index.push_back(currentEntry);
+    inodes.push_back(currentEntry->d_ino);
 
     // Next entry...
-    position += entrySize;
+    position += currentEntry->d_reclen;
+  }
+
+  vector<ino_t> virtualInodes;
+  inodeMap.lookupOrAddAll(inodes, virtualInodes);
+  for (size_t i = 0; i < index.size(); i++) {
+    index[i]->d_ino = virtualInodes[i];
+  }
+}
+// =======================================================================================
+/**
+ * Stamp of the directory the tracee's fd points to, false if it is not a
+ * directory.
+ */
+bool stampDirectory(
+    globalState& gs, state& s, int fd, bool dirent64, directoryStamp& stamp);
+
+/**
+ * Read the whole directory behind the tracee's fd ourselves, through a copy of
+ * it from duplicateTraceeFd, into entries.
+ * @return false if we couldn't, the tracee's fd is left as it was.
+ */
+bool readDirectoryInTracer(
+    globalState& gs,
+    state& s,
+    int fd,
+    bool dirent64,
+    directoryEntries<linux_dirent>& entries);
+
+/**
+ * Up to bytes of the cached listing entries of the tracee's fd. The tracee's
+ * file offset is ours to keep: we leave it at the cookie of the next entry,
+ * and an offset found elsewhere next time is an lseek (seekdir, rewinddir)
+ * the tracee made since, which entries then follow. lseek itself never stops.
+ * @param fresh entries were just set up, the offset isn't ours yet.
+ */
+vector<uint8_t> serveDirectoryEntries(
+    globalState& gs,
+    state& s,
+    int fd,
+    directoryEntries<linux_dirent>& entries,
+    size_t bytes,
+    bool fresh);
+
+/**
+ * Pre-hook of getdents and getdents64. On the first call on a directory, its
+ * listing comes from gs.dirCache, or failing that from reading the directory
+ * ourselves. Then every call on it is served from there, as a noop returning
+ * the bytes we wrote, see serveDirectoryEntries. If neither works, run the
+ * system call, see handleDents.
+ */
+template <typename T>
+bool handleDentsPre(globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int fd = (int)t.arg1();
+  constexpr bool dirent64 = is_same<T, linux_dirent64>::value;
+
+  // Serving entries moves the read position, writes either way.
+  auto& dirEntries = s.dirEntries.write();
+  auto entries = dirEntries.find(fd);
+  bool fresh = entries == dirEntries.end();
+  if (fresh) {
+    directoryStamp stamp;
+    if (!stampDirectory(gs, s, fd, dirent64, stamp)) {
+      return true;
+    }
+    auto cached = gs.dirCache.find(stamp);
+    if (cached != nullptr) {
+      DETTRACE_LOG(
+          gs.log, Importance::info,
+          "Serving cached directory entries of fd %d\n", fd);
+      gs.dirCacheHits++;
+      entries =
+          dirEntries
+              .emplace(fd, directoryEntries<linux_dirent>{*cached, gs.log})
+              .first;
+    } else {
+      directoryEntries<linux_dirent> read{s.dirEntriesBytes, gs.log};
+      if (!readDirectoryInTracer(gs, s, fd, dirent64, read)) {
+        s.dirStamps.write()[fd] = stamp;
+        return true;
+      }
+
+      vector<uint8_t> all = read.allSortedEntries();
+      virtualizeEntries<T>(all, gs.inodeMap);
+      entries = dirEntries
+                    .emplace(fd, directoryEntries<linux_dirent>{all, gs.log})
+                    .first;
+      gs.dirCache.insert(stamp, std::move(all));
+    }
+  } else if (!entries->second.cached) {
+    return true;
   }
+
+  vector<uint8_t> filledVector = serveDirectoryEntries(
+      gs, s, fd, entries->second, (size_t)t.arg3(), fresh);
+  traceePtr<uint8_t> traceeBuffer((uint8_t*)t.arg2());
+  writeVmTraceeRaw(
+      filledVector.data(), traceeBuffer, filledVector.size(), t.getPid());
+  t.writeVmCalls++;
+  replaceSystemCallWithNoop(gs, s, t, filledVector.size());
+  return true;
 }
 // =======================================================================================
 template <typename T>
@@ -2136,29 +2579,42 @@ void handleDents(globalState& gs, state& s, ptracer& t, scheduler& sched) {
 
   // We have never seen this entry before! This is a new getdents call, not a
   // replay by us.
-  if (s.dirEntries.count(fd) == 0) {
+  auto& dirEntries = s.dirEntries.write();
+  if (dirEntries.count(fd) == 0) {
     auto msg = "Tracee requested getdents for the first time for fd: %d.\n";
-    gs.log.writeToLog(Importance::info, msg, fd);
+    DETTRACE_LOG(gs.log, Importance::info, msg, fd);
 
-    s.dirEntries.emplace(
+    dirEntries.emplace(
         fd, directoryEntries<linux_dirent>{s.dirEntriesBytes, gs.log});
   }
 
   // We have read zero bytes. We're done!
   if (t.getReturnValue() == 0) {
-    gs.log.writeToLog(Importance::info, "All bytes have been read.\n");
-    gs.log.writeToLog(
-        Importance::info, "Returning sorted entries to tracee.\n");
+    DETTRACE_LOG(gs.log, Importance::info, "All bytes have been read.\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Returning sorted entries to tracee.\n");
+
+    // First time we get here, we have the whole directory. Cached under how
+    // it was when we started: if it changed since, its stamp won't match.
+    auto stamp = s.dirStamps->find(fd);
+    if (stamp != s.dirStamps->end()) {
+      if (!dirEntries.at(fd).isSorted()) {
+        vector<uint8_t> all = dirEntries.at(fd).allSortedEntries();
+        virtualizeEntries<T>(all, gs.inodeMap);
+        gs.dirCache.insert(stamp->second, std::move(all));
+      }
+      s.dirStamps.erase(fd);
+    }
 
     // We want to fill up to traceeBufferSize which is the size the tracee
     // originally asked for.
 
     vector<uint8_t> filledVector =
-        s.dirEntries.at(fd).getSortedEntries(traceeBufferSize);
+        dirEntries.at(fd).getSortedEntries(traceeBufferSize);
     virtualizeEntries<T>(filledVector, gs.inodeMap);
 
-    gs.log.writeToLog(
-        Importance::info, "Returning %d bytes!\n", filledVector.size());
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Returning %d bytes!\n", filledVector.size());
 
     // Write entry back to tracee!
     writeVmTraceeRaw(
@@ -2171,26 +2627,23 @@ void handleDents(globalState& gs, state& s, ptracer& t, scheduler& sched) {
   }
   // We read some bytes but there might be more to read.
   else {
-    gs.log.writeToLog(Importance::info, "Reading directory entries...\n");
+    DETTRACE_LOG(gs.log, Importance::info, "Reading directory entries...\n");
 
     // Read entries from tracee's buffer.
     // We only copy over the return value, which is how many bytes were actually
     // filled by the kernel into the tracee's buffer.
+    // Straight into our directory entry for this file descriptor.
     size_t bytesToCopy = t.getReturnValue();
-    uint8_t localBuffer[bytesToCopy];
+    uint8_t* chunk = dirEntries.at(fd).addChunk(bytesToCopy);
     doWithCheck(
-        readVmTraceeRaw(traceeBuffer, localBuffer, bytesToCopy, t.getPid()),
+        readVmTraceeRaw(traceeBuffer, chunk, bytesToCopy, t.getPid()),
         "readVmTraceeRaw: Unable to read bytes for dirent into buffer.");
     // Explicitly increase counter.
     t.readVmCalls++;
 
-    vector<uint8_t> newChunk{localBuffer, localBuffer + bytesToCopy};
-
-    // Copy chunks over to our directory entry for this file descriptor.
-    s.dirEntries.at(fd).addChunk(newChunk);
-
-    gs.log.writeToLog(
-        Importance::info, "Replaying system call to read more bytes...\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "Replaying system call to read more bytes...\n");
     replaySystemCall(gs, t, t.getSystemCallNumber());
   }
   return;
@@ -0,0 +1,74 @@
+#ifndef DIRECTORY_CACHE_H
+#define DIRECTORY_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "logicalclock.hpp"
+
+using namespace std;
+
+/**
+ * What a directory looked like when we started listing it. A cached listing is
+ * only served while the directory still matches it.
+ */
+struct directoryStamp {
+  dev_t device;
+  ino_t inode; /**< Real inode. */
+  bool dirent64; /**< Entries are linux_dirent64, not linux_dirent. */
+  struct timespec mtime; /**< Real modification time. */
+  struct timespec ctime; /**< Real status change time. */
+  logical_clock::time_point logicalMtime; /**< From the ModTimeMap. */
+};
+
+/**
+ * Sorted, virtualized getdents listings of directories we've read in full,
+ * shared by every tracee.
+ *
+ * Build systems list the same directories over and over, every listing costs a
+ * getdents per chunk and a sort. A listing whose directory still has the same
+ * real mtime and ctime and logical mtime is served from here instead, with no
+ * getdents run at all. Cached entries are exactly what the tracee would have
+ * read, so hits don't change what tracees see.
+ */
+class directoryCache {
+public:
+  /**
+   * Cached entries of the directory stamp was taken from, nullptr if we don't
+   * have them or the directory changed since.
+   */
+  shared_ptr<const vector<uint8_t>> find(const directoryStamp& stamp) const;
+
+  /** Cache the sorted, virtualized entries of the directory of stamp. */
+  void insert(const directoryStamp& stamp, vector<uint8_t> entries);
+
+  /**
+   * Bytes of the cached entries and, roughly, of the map holding them, see
+   * memoryUsage.
+   */
+  size_t bytesHeld() const {
+    return cachedBytes +
+        listings.size() * (sizeof(listing) + 4 * sizeof(void*));
+  }
+
+private:
+  /** Cap on cached bytes, dropping everything once reached. */
+  static const size_t maxBytes = 64 * 1024 * 1024;
+
+  struct listing {
+    directoryStamp stamp;
+    shared_ptr<const vector<uint8_t>> entries;
+  };
+
+  /** (device, inode, dirent64) to its listing. */
+  map<tuple<dev_t, ino_t, bool>, listing> listings;
+  size_t cachedBytes = 0;
+};
+
+#endif
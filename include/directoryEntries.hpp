@@ -3,11 +3,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <cstddef>
 #include <cstdint>
 
 #include <algorithm>
-#include <deque>
 #include <memory>
 #include <string>
 #include <vector>
@@ -42,6 +43,11 @@ struct linux_dirent64 {
  *
  * WARNING: This class can only be be instantiated with linux_dirent or
  * linux_dirent64.
+ *
+ * Entries handed out have a d_off of their own: the position of the entry
+ * after them in our sorted order, its index. That is the cookie telldir
+ * returns and seekdir gives back to lseek, see seek(). Unlike the kernel's
+ * (hashes, on ext4), it is the same on every machine.
  */
 template <typename T>
 class directoryEntries {
@@ -50,68 +56,127 @@ public:
 
   /**
    * Constructor.
-   * Dynamically allocate enough memory to hold all directory entries by the
-   * user.
-   * @param bytes total bytes
+   * Memory for the entries is only allocated once the first chunk is added.
+   * @param bytes total bytes we expect, reserved with the first chunk
    * @param log log file handler
    */
-  directoryEntries(size_t bytes, logger& log) : log(log) {
-    rawEntries.reserve(bytes);
-  }
+  directoryEntries(size_t bytes, logger& log) : log(log), reserveBytes(bytes) {}
+
+  /**
+   * Constructor for entries already sorted and virtualized, from the
+   * directoryCache or read by the tracer itself.
+   * @param sortedEntries entries as returned by allSortedEntries.
+   * @param log log file handler
+   */
+  directoryEntries(const vector<uint8_t>& sortedEntries, logger& log)
+      : log(log), cached(true), rawEntries(sortedEntries), presorted(true) {}
 
   /**
-   * Add a chunk of count size to our internal buffer.
-   * Resize if needed.
-   * @param newChunk chunk to be added as a array of bytes
+   * Entries were sorted and virtualized up front: they are served without
+   * running getdents, and must not be virtualized again.
    */
-  void addChunk(vector<uint8_t> newChunk) {
-    rawEntries.insert(rawEntries.end(), newChunk.begin(), newChunk.end());
-    return;
+  bool cached = false;
+
+  /**
+   * The tracee's file offset follows position(), see serveDirectoryEntries.
+   * Cleared for directories that can't be positioned.
+   */
+  bool seekable = true;
+
+  /**
+   * Make room for a chunk of bytes at the end of our internal buffer.
+   * @param bytes size of the chunk
+   * @return where to copy the chunk to, valid until the next call.
+   */
+  uint8_t* addChunk(size_t bytes) {
+    if (rawEntries.capacity() == 0) {
+      rawEntries.reserve(max(reserveBytes, bytes));
+    }
+    size_t oldSize = rawEntries.size();
+    rawEntries.resize(oldSize + bytes);
+    return rawEntries.data() + oldSize;
   }
 
   /**
    * Return an array of size < bytesNeeded, in order to fill it with as many
    * entries as possible. This operation consumes the previous entries so
-   * subsequent calls with same argument will return new entries.
+   * subsequent calls with same argument will return new entries. Each
+   * entry's d_off is the position after it.
    * @param bytesNeeded maximum array size to return.
    * @return sorted array of entries
    */
   vector<uint8_t> getSortedEntries(size_t bytesNeeded) {
-    vector<uint8_t> toFill{};
-
     if (!sorted) {
       sorted = true;
       sortOurEntries();
     }
 
-    while (true) {
-      /** We read all entries before filling this buffer. */
-      if (entries.empty()) {
-        break;
-      }
+    /** Entries that fit, we read all entries when we run out of them. */
+    size_t last = next;
+    size_t bytes = 0;
+    while (last < index.size() && bytes + index[last].size <= bytesNeeded) {
+      bytes += index[last].size;
+      last++;
+    }
 
-      /** Get current head entry from our queue. */
-      auto tupleEntry = entries.front();
-      size_t entrySize = get<2>(tupleEntry);
+    vector<uint8_t> toFill(bytes);
+    uint8_t* position = toFill.data();
+    for (; next < last; next++) {
+      const entry& e = index[next];
+      DETTRACE_LOG(
+          log, Importance::extra,
+          "Returning entry: " + string{nameOf(e), e.nameLength} + "\n");
+      memcpy(position, rawEntries.data() + e.offset, e.size);
+      // Where d_off is in both linux_dirent and linux_dirent64.
+      static_assert(
+          offsetof(linux_dirent, d_off) == offsetof(linux_dirent64, d_off),
+          "d_off moved");
+      ((T*)position)->d_off = next + 1;
+      position += e.size;
+    }
 
-      /** Ensure we have enough room for this entry. Otherwise we're done! */
-      if (entrySize + toFill.size() > bytesNeeded) {
-        break;
-      }
+    return toFill;
+  }
 
-      log.writeToLog(
-          Importance::extra, "Returning entry: " + get<0>(tupleEntry) + "\n");
+  /**
+   * All entries not returned yet, sorted, without consuming them. Right after
+   * the last chunk was added this is the whole directory.
+   */
+  vector<uint8_t> allSortedEntries() {
+    if (!sorted) {
+      sorted = true;
+      sortOurEntries();
+    }
+
+    vector<uint8_t> all;
+    for (size_t i = next; i < index.size(); i++) {
+      const uint8_t* start = rawEntries.data() + index[i].offset;
+      all.insert(all.end(), start, start + index[i].size);
+    }
+    return all;
+  }
+
+  /** Whether entries were returned to the tracee, or are about to be. */
+  bool isSorted() const { return sorted; }
 
-      /** We know we have enough room, it is now okay to get rid of this entry.
-       */
-      entries.pop_front();
+  /** Index of the next entry getSortedEntries returns, its d_off cookie. */
+  size_t position() const { return next; }
 
-      /** Copy over entry based on address and size of struct. */
-      toFill.insert(
-          toFill.end(), get<1>(tupleEntry), get<1>(tupleEntry) + entrySize);
+  /**
+   * Return entries from the one at cookie on, as the tracee's lseek, seekdir
+   * or rewinddir asked. Past the last entry there is nothing left to return.
+   */
+  void seek(uint64_t cookie) {
+    if (!sorted) {
+      sorted = true;
+      sortOurEntries();
     }
+    next = min<uint64_t>(cookie, index.size());
+  }
 
-    return toFill;
+  /** Bytes of the entries and their index, see memoryUsage. */
+  size_t bytesHeld() const {
+    return rawEntries.capacity() + index.capacity() * sizeof(entry);
   }
 
 private:
@@ -121,13 +186,28 @@ private:
    */
   vector<uint8_t> rawEntries;
 
+  /** Bytes to reserve for rawEntries once the first chunk comes in. */
+  size_t reserveBytes = 0;
+
   bool sorted = false; /**<  If the entries have been sorted*/
+  bool presorted = false; /**< rawEntries are already in order. */
+
+  /** Where an entry lives in rawEntries. */
+  struct entry {
+    uint32_t offset;
+    uint16_t size;
+    uint16_t nameLength;
+  };
+
+  const char* nameOf(const entry& e) const {
+    return (const char*)(rawEntries.data() + e.offset + offsetof(T, d_name));
+  }
 
   /**
    * Sorts directory entries from raw entries.
    */
   void sortOurEntries() {
-    if (!entries.empty()) {
+    if (!index.empty()) {
       throw runtime_error(
           "dettrace runtime exception: sortOurEntries was called with "
           "non-empty entries.");
@@ -135,28 +215,37 @@ private:
 
     /** Variable size data, we cannot "iterate" over the entries in the array.
      */
-    uint8_t* position = rawEntries.data();
-    while (position < rawEntries.data() + rawEntries.size()) {
-      T* currentEntry = (T*)position;
+    size_t position = 0;
+    while (position < rawEntries.size()) {
+      T* currentEntry = (T*)(rawEntries.data() + position);
       size_t entrySize = currentEntry->d_reclen;
+      size_t nameLength =
+          strnlen(currentEntry->d_name, entrySize - offsetof(T, d_name));
 
-      entries.push_back(make_tuple(
-          string{currentEntry->d_name}, (uint8_t*)currentEntry, entrySize));
+      index.push_back(
+          entry{(uint32_t)position, (uint16_t)entrySize, (uint16_t)nameLength});
       position += entrySize;
     }
 
-    // Sort!
-    sort(entries.begin(), entries.end(), [](auto& p1, auto& p2) {
-      return get<0>(p1) > get<0>(p2);
+    if (presorted) {
+      return;
+    }
+
+    // Sort by name, largest first! Compared byte by byte like strings are.
+    sort(index.begin(), index.end(), [this](const entry& e1, const entry& e2) {
+      int order = memcmp(
+          nameOf(e1), nameOf(e2), min(e1.nameLength, e2.nameLength));
+      return order != 0 ? order > 0 : e1.nameLength > e2.nameLength;
     });
   }
 
   /**
-   * Turn our entries into a vector of (name, address, byteSize) for easy
-   * sorting. Each address is it's location on our array this way, we can "sort"
-   * the variable sized structs by their filename.
+   * Our entries as offsets into rawEntries, for easy sorting of the variable
+   * sized structs by their filename without copying them around.
    */
-  deque<tuple<string, uint8_t*, size_t>> entries;
+  vector<entry> index;
+  /** First entry of index not returned yet. */
+  size_t next = 0;
 };
 
 #endif
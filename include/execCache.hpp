@@ -0,0 +1,191 @@
+#ifndef EXEC_CACHE_H
+#define EXEC_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "fileHasher.hpp"
+#include "globalState.hpp"
+#include "ptracer.hpp"
+#include "remoteCache.hpp"
+#include "state.hpp"
+
+using namespace std;
+
+/**
+ * Cache of whole process subtrees, written and used by --exec-cache.
+ *
+ * Under dettrace what a process writes only depends on what it reads. So for
+ * every execve we record, for the new image and everything it spawns, the
+ * files opened or stat'ed (with their contents, or their absence) and the
+ * files written, renamed or removed. When the image exits with status 0 we
+ * store its outputs under a key made of the executable, argv, envp and cwd.
+ * The next execve with that key whose recorded input files are all still the
+ * same restores the outputs and exits with 0 instead of running.
+ *
+ * Subtrees that do anything we can't replay aren't stored: reading or writing
+ * pipes, sockets or terminals (so any output on stdout and stderr), listing a
+ * directory, making directories or links, changing metadata, or leaving
+ * processes behind. Values dettrace makes up for the subtree, such as logical
+ * time and random numbers, aren't part of the key: cache programs whose
+ * outputs don't depend on them.
+ *
+ * The cache directory holds entries/<key>, a text file listing the inputs
+ * and outputs of an entry, and blobs/<hash>, the contents of outputs.
+ *
+ * Experimental: with a remote command, a miss is first handed to it, to run
+ * the exec somewhere else and put the entry and its blobs in the cache. It
+ * gets a job file, remote/<key>.job, with the exec's exe, cwd, argv and envp
+ * and, from a stale entry of the key, the inputs the exec read last time.
+ * The tracer waits for it, so what runs remotely and what locally doesn't
+ * depend on timing.
+ *
+ * With a remoteCache the directory is the first level of a cache shared by
+ * many machines: entries missing here are fetched from the store, blobs
+ * first, and whatever we store goes to the store too.
+ */
+class execCache {
+public:
+  /**
+   * Use the cache in dir, creating it if need be, hashing with hashes.
+   * @param salt part of every key: what outputs depend on besides the exec,
+   * like our version, epoch and seed
+   * @param remoteCommand shell command misses go to, with the job file and
+   * dir as $1 and $2, if "" none
+   * @param remote store shared with other machines, if not null
+   */
+  execCache(
+      const string& dir,
+      fileHasher& hashes,
+      const string& salt,
+      const string& remoteCommand = "",
+      remoteCache* remote = nullptr);
+
+  execCache(const execCache&) = delete;
+  execCache& operator=(const execCache&) = delete;
+
+  /**
+   * s is about to execve. If the cache has an entry whose inputs still hold,
+   * restore its outputs and return true: the caller turns the execve into an
+   * exit_group(0). Otherwise remember the key, to record the image under, if
+   * the execve succeeds.
+   */
+  bool restore(globalState& gs, state& s, ptracer& t);
+
+  /** pid's execve succeeded, start recording its subtree. */
+  void execed(pid_t pid);
+
+  /** child was forked or cloned by parent, and belongs to its subtrees. */
+  void spawned(pid_t parent, pid_t child, bool isThread);
+
+  /** The tracee stopped at syscallNum's post-hook, note what it touched. */
+  void systemCall(globalState& gs, state& s, ptracer& t, int syscallNum);
+
+  /** pid is about to exit_group(status), store its record if it is one's. */
+  void exitGroup(pid_t pid, int status);
+
+  /** pid is gone. */
+  void exited(pid_t pid);
+
+  /** Execs restored from the cache, and images stored in it. */
+  uint64_t hits = 0;
+  uint64_t stored = 0;
+  /** Misses handed to the remote command, and restored from what it ran. */
+  uint64_t remoteJobs = 0;
+  uint64_t remoteHits = 0;
+  /** Entries fetched from the shared store. */
+  uint64_t remoteFetches = 0;
+
+private:
+  struct record {
+    string key;
+    pid_t root;
+    bool poisoned = false;
+    bool finished = false;
+    /** Host paths read or looked up, and what they were, see inputHash. */
+    map<string, string> inputs;
+    /** Host paths written, renamed or removed, stored as they end up. */
+    set<string> outputs;
+    /** Live processes of the subtree, threads aside. */
+    unordered_set<pid_t> members;
+  };
+
+  /**
+   * Hash of what path is for an input: "-" if it doesn't exist, "=" and its
+   * type if it isn't a regular file or with contentToo false, else its
+   * contents' hash. "" if we can't tell.
+   */
+  string inputHash(const string& path, bool contentToo);
+
+  /**
+   * path is an input of pid's subtrees, whose inputHash is known, if it is
+   * not "".
+   */
+  void input(
+      pid_t pid,
+      const string& path,
+      bool contentToo,
+      const string& known = "");
+
+  /** path is an output of pid's subtrees. */
+  void output(pid_t pid, const string& path);
+
+  /** pid did something we can't replay, its subtrees aren't stored. */
+  void poison(pid_t pid);
+
+  /**
+   * Restore the outputs of the entry keyHex, pid's exec of exe, if its inputs
+   * still hold.
+   */
+  bool restoreEntry(
+      globalState& gs,
+      state& s,
+      const string& keyHex,
+      const string& exe);
+
+  /**
+   * Hand the exec of exe to the remote command, with argv and envp as
+   * strings, and wait for it. True if it says it stored an entry.
+   */
+  bool runRemotely(
+      const string& keyHex,
+      const string& exe,
+      const string& cwd,
+      const vector<string>& argv,
+      const vector<string>& envp);
+
+  /** Fetch entry keyHex and the blobs we lack from the shared store. */
+  void fetchRemote(const string& keyHex);
+
+  /** Store entry keyHex and the blobs the shared store lacks there. */
+  void storeRemote(const string& keyHex, const string& entry);
+
+  /** Write r to the cache, false if an output can't be read. */
+  bool store(record& r);
+
+  /**
+   * Host path a path argument of the tracee refers to, "" if we can't tell.
+   */
+  string hostPath(
+      globalState& gs, state& s, ptracer& t, uint64_t path, int dirfd);
+
+  string dir;
+  fileHasher& hashes;
+  string salt;
+  string remoteCommand;
+  remoteCache* remote;
+  /** Keys of execve calls whose success is still to be seen. */
+  unordered_map<pid_t, string> pendingKeys;
+  /** Records pid belongs to, its own last. */
+  unordered_map<pid_t, vector<shared_ptr<record>>> recordsOf;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef EXEC_SETUP_H
+#define EXEC_SETUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/user.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Straight line program of system calls for a tracee to run right after
+ * execve, so that setting the new image up costs the tracer one stop instead
+ * of one per system call, see execution::runSetupProgram.
+ *
+ * Each call may keep its return value in a callee saved register, later calls
+ * may pass it as an argument, and the tracer reads them all back from the
+ * registers at the int3 ending the program. The code only uses rip relative
+ * addressing, for the strings placed after it, so it runs from anywhere.
+ */
+class setupProgram {
+public:
+  /** Registers results can be kept in. */
+  enum resultReg { r12, r13, r14, r15, rbx, rbp, noResult };
+
+  /** A system call argument. */
+  struct arg {
+    enum { immediate, result, text } kind;
+    uint64_t value;
+    resultReg reg;
+    std::string str;
+  };
+
+  static arg imm(uint64_t value) { return arg{arg::immediate, value}; }
+
+  static arg resultOf(resultReg reg) {
+    return arg{arg::result, 0, reg};
+  }
+
+  /** Address of a NUL terminated copy of str, placed after the code. */
+  static arg stringAt(const std::string& str) {
+    return arg{arg::text, 0, noResult, str};
+  }
+
+  /** Append a system call, keeping its return value in into. */
+  void call(long systemCall, resultReg into, const vector<arg>& args);
+
+  /** Byte code of the whole program, ending with int3. */
+  vector<uint8_t> code() const;
+
+  bool empty() const { return calls.empty(); }
+
+  /** Number of system calls. */
+  size_t size() const { return calls.size(); }
+
+  /** Return value kept in reg, from the registers at the final int3. */
+  static long result(const struct user_regs_struct& regs, resultReg reg);
+
+private:
+  struct systemCall {
+    long number;
+    resultReg into;
+    vector<arg> args;
+  };
+
+  vector<systemCall> calls;
+};
+
+#endif
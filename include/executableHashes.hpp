@@ -0,0 +1,85 @@
+#ifndef EXECUTABLE_HASHES_H
+#define EXECUTABLE_HASHES_H
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "fileHasher.hpp"
+#include "taskPool.hpp"
+
+using namespace std;
+
+/**
+ * Content hashes of the executables tracees run, a stable identity for each
+ * binary where a path isn't one: /usr/bin/cc on two hosts, a binary rebuilt
+ * in place. Memoized per version of the file, its device, inode, size and
+ * mtime, so /usr/bin/gcc is read once however many times it is execed, and
+ * read on a helper thread while its tracee goes on, see taskPool.
+ *
+ * The memo can be saved, --inode-snapshot keeps it next to its snapshot, so
+ * the next run over the same tree hashes nothing it already knows. A saved
+ * memo is lines of "device inode size mtime hash".
+ */
+class executableHashes {
+public:
+  /** @param tasks where executables are hashed. */
+  explicit executableHashes(taskPool& tasks) : tasks(tasks) {}
+
+  /** Waits for the executables still being hashed. */
+  ~executableHashes();
+
+  executableHashes(const executableHashes&) = delete;
+  executableHashes& operator=(const executableHashes&) = delete;
+
+  /**
+   * Add the memo saved at path, false if there is none or it isn't one.
+   * Versions of files we don't have anymore cost a line, nothing else.
+   */
+  bool load(const string& path);
+
+  /** Write the memo to path, next to it and renamed over it. */
+  void save(const string& path);
+
+  /** pid execed: hash what it runs now, unless we know it already. */
+  void execed(pid_t pid);
+
+  /** A child runs what its parent does, until it execs. */
+  void spawned(pid_t parent, pid_t child);
+
+  void exited(pid_t pid);
+
+  /**
+   * Hash of the executable pid runs, waiting for it if a helper is still at
+   * it. "" for tracees we didn't see exec or whose executable isn't readable.
+   */
+  string hashOf(pid_t pid);
+
+  /** Executables read and hashed, and execs served from the memo. */
+  uint64_t executablesHashed = 0;
+  uint64_t memoHits = 0;
+
+  /** Versions known, hashed or loaded. */
+  size_t size() const { return memo.size() + pending.size(); }
+
+private:
+  /**
+   * fileIdentity without ctime: a link or a chmod changes it, not what the
+   * file runs, and the memo should outlive both.
+   */
+  static fileIdentity keyOf(const fileIdentity& id);
+
+  /** Take what a helper got for key into memo. */
+  void settle(const fileIdentity& key);
+
+  taskPool& tasks;
+  map<fileIdentity, string> memo;
+  /** Versions a helper is hashing, until someone asks. */
+  map<fileIdentity, taskResult<string>> pending;
+  /** What each tracee we saw exec runs. */
+  unordered_map<pid_t, fileIdentity> running;
+};
+
+#endif
@@ -2,18 +2,42 @@
 #define EXECUTION_H
 
 #include "ValueMapper.hpp"
+#include "branchCounter.hpp"
 #include "dettraceSystemCall.hpp"
+#include "dependencyManifest.hpp"
+#include "execCache.hpp"
+#include "executableHashes.hpp"
+#include "checkpoint.hpp"
+#include "hardwareCounters.hpp"
 #include "globalState.hpp"
+#include "inputLog.hpp"
+#include "liveStats.hpp"
+#include "scheduleLog.hpp"
 #include "logger.hpp"
 #include "logicalclock.hpp"
+#include "memoryUsage.hpp"
+#include "outputHasher.hpp"
+#include "patchSiteCache.hpp"
+#include "policyProfile.hpp"
+#include "processTable.hpp"
 #include "ptracer.hpp"
 #include "scheduler.hpp"
+#include "startupReads.hpp"
 #include "state.hpp"
+#include "syncOrder.hpp"
+#include "syscallStats.hpp"
 #include "systemCallList.hpp"
+#include "taskPool.hpp"
+#include "timeline.hpp"
+#include "trapProfile.hpp"
+#include "traceFile.hpp"
 #include "util.hpp"
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <stack>
+#include <unordered_map>
 
 #define ARCH_GET_CPUID 0x1011
 #define ARCH_SET_CPUID 0x1012
@@ -54,6 +78,25 @@ private:
    */
   bool kernelPre4_8;
 
+  /**
+   * What the event loop must know about the kernel, fixed for a run. The loop
+   * is instantiated once per kernel and picked at startup, see runProgram, so
+   * the common case carries none of the older kernels' branches.
+   */
+  struct modernKernel {
+    /** A seccomp stop is followed by a ptrace system call enter stop. */
+    static const bool doubleSyscallEvents = false;
+  };
+  struct legacyKernel {
+    static const bool doubleSyscallEvents = true;
+  };
+
+  /**
+   * Using kernel version < 5.3 . PTRACE_GET_SYSCALL_INFO is not available, so
+   * we must fetch all registers on every seccomp stop.
+   */
+  bool kernelPre5_3;
+
   /** Main log.
    * For writing all messages.
    */
@@ -69,15 +112,10 @@ private:
   bool printStatistics;
 
   /**
-   * The pthread_t for the /dev/random thread, which we cancel when dettrace
-   * exits.
+   * The pthread_t for the thread filling the /dev/random and /dev/urandom
+   * fifos, which we cancel when dettrace exits.
    */
   pthread_t devRandomPthread;
-  /**
-   * The pthread_t for the /dev/urandom thread, which we cancel when dettrace
-   * exits.
-   */
-  pthread_t devUrandomPthread;
 
   /**
    * ptrace wrapper.
@@ -86,29 +124,25 @@ private:
   ptracer tracer;
 
   /**
-   * System call state map.
-   * State represents all state we wish to maintain between subsequent system
-   * calls, e.g. logical time, etc. Since we may have multiple processes and
-   * threads, we hold a state per pid.
-   * TODO: do different threads have the same pid but different tid? I think so,
-   * tid might be a better choice for keys.
+   * Helper threads for work that needs no ptrace, see taskPool. Declared
+   * before everything handing them work.
    */
-  map<pid_t, state> states;
+  taskPool helpers;
 
   /**
-   * Global inode mapper.
-   * Ensures consistent state among all processes.
+   * Every tracee we know about.
+   * Holds the state we maintain between subsequent system calls (e.g. logical
+   * time) for each process and thread, as well as the process tree and thread
+   * groups. We can only ever exit once all our children have exited.
+   * Declared before myGlobalState, which keeps a reference to it.
    */
-  globalState myGlobalState;
+  processTable processes;
 
   /**
-   * Map of parent processes to children.
-   * Keep track of our children. We can only ever exit once all our children
-   * have exited. We map the parent's process id to children: 1 -> 2 1 -> 3 2 ->
-   * 4 (Process 1 has two children: 2 and 3. Process 2 has one child: 4).
-   * Threads are also counted as children of their thread group leader.
+   * Global inode mapper.
+   * Ensures consistent state among all processes.
    */
-  multimap<pid_t, pid_t> processTree;
+  globalState myGlobalState;
 
   /**
    * Process scheduler.
@@ -150,14 +184,190 @@ private:
    */
   uint32_t rdtscpEvents = 0;
 
+  /**
+   * rdtsc and rdtscp sites rewritten to stop trapping, see patchTscSite.
+   */
+  uint32_t tscSitesPatched = 0;
+
+  /**
+   * cpuid sites rewritten to stop trapping, see patchCpuidSite.
+   */
+  uint32_t cpuidSitesPatched = 0;
+
+  /**
+   * read, write and time system call sites rewritten to go through the clock
+   * page, see bufferSystemCallSite.
+   */
+  uint32_t syscallSitesPatched = 0;
+
+  /**
+   * Sites patched without trapping, included in the above, because another
+   * process or run learned them, see patchKnownSites.
+   */
+  uint32_t knownSitesPatched = 0;
+
+  /**
+   * logicalClockPage::bufferedSystemCalls of new images: read, and write
+   * unless we hash outputs with --lite, none without site patching or when
+   * recording and replaying.
+   */
+  uint64_t bufferedSystemCalls = 0;
+
+  /**
+   * logicalClockPage::recordedSystemCalls of new images: write when we hash
+   * outputs, see drainSideEffects.
+   */
+  uint64_t recordedSystemCalls = 0;
+
+  /** Records taken from side effect rings, see drainSideEffects. */
+  uint64_t sideEffectsDrained = 0;
+
+  /**
+   * Whether trapping sites get patched, DETTRACE_NO_SITE_PATCHING turns it off.
+   */
+  bool sitePatching = true;
+
+  /**
+   * Counter for tracees preempted for spinning, see handleBranchOverflow.
+   */
+  uint32_t branchPreemptions = 0;
+
   /**
    * Counter for keeping track process spawns: fork, vfork, clone.
    */
   uint32_t processSpawnEvents = 0;
 
+  /**
+   * execve events, see handleExecEvent.
+   */
+  uint32_t execEvents = 0;
+
+  /**
+   * Tracee stops we waited for, not counting the ones running code we
+   * injected.
+   */
+  uint64_t ptraceStops = 0;
+
+  /** Of ptraceStops, the ones --spin-wait caught before blocking. */
+  uint64_t spunStops = 0;
+
+  /**
+   * --pin: the cpu tracees run on, -1 if we leave them where they are, and
+   * the tracee we last pinned there.
+   */
+  int pinTraceeCpu;
+  pid_t pinnedTracee = -1;
+
+  /** Microseconds to poll for a stop before blocking on it, --spin-wait. */
+  uint32_t spinWaitMicros;
+
+  /** Move pid to pinTraceeCpu, with --pin, unless we just did. */
+  void pinTracee(pid_t pid);
+
+  /**
+   * vdso symbols, see vdsoGetSymbols, and where [vvar] is from the vdso, both
+   * looked up once: they are the same for every image.
+   */
   map<string, tuple<unsigned long, unsigned long, unsigned long>> vdsoFuncs;
+  vvarLayout vvar;
+
+  /**
+   * Replace the functions of the tracee's vdso, mapped at vdsoBase, with ours.
+   * With a clockPage, mapped at clockAddr in the tracee, the time functions
+   * read the logical clock from it, see logicalClockPage, otherwise they all
+   * do system calls.
+   */
+  void disableVdso(
+      pid_t traceesPid,
+      unsigned long vdsoBase,
+      unsigned long clockAddr,
+      logicalClockPage* clockPage);
+
+  /**
+   * pid trapped on the rdtsc or rdtscp at site, which is its rip, often enough:
+   * rewrite it into a jump to a trampoline reading the counters from the
+   * tracee's clockPage, see patchSites.
+   * @param trapped pid is at the site: it is set to run the trampoline, and the
+   * site goes in knownSites. Otherwise it is a site patchKnownSites knew.
+   * @return true if patched. Otherwise the site is left alone and keeps
+   * trapping.
+   */
+  bool patchTscSite(
+      pid_t pid, uint64_t site, tscInstruction insn, bool trapped);
+
+  /**
+   * pid trapped on the cpuid at site, which is its rip, asking for a leaf we
+   * have: rewrite it into a jump to a trampoline reading the canonical leaves
+   * from the table mapCpuidTable maps.
+   * @return like patchTscSite.
+   */
+  bool patchCpuidSite(pid_t pid, uint64_t site, bool trapped);
+
+  /**
+   * s is at its syscallNum read or write of a regular file, which we let
+   * through, or at a clock_gettime, gettimeofday or time: once its site
+   * trapped often enough, rewrite it into a jump to a trampoline reading the
+   * time from the clock page like the vdso does, and doing reads and writes of
+   * regular files through the page's gate, which seccomp allows, see
+   * bufferedSystemCallTrampoline. Static binaries don't use the vdso. Sites
+   * are forgotten on execve, the new image's get learned again.
+   */
+  void bufferSystemCallSite(state& s, int syscallNum);
 
-  void disableVdso(pid_t traceesPid);
+  /** Rewrite the syscall at site, see bufferSystemCallSite and patchTscSite. */
+  bool patchSyscallSite(pid_t pid, uint64_t site, bool trapped);
+
+  /** pid's site was patched as kind, remember it in knownSites. */
+  void learnSite(pid_t pid, uint64_t site, patchKind kind);
+
+  /**
+   * pid trapped at site, for the first time: patch the sites knownSites has
+   * for its mapping, unless pid isn't alone in its address space.
+   * @return whether site is one of them, left for the caller to patch.
+   */
+  bool knownSite(pid_t pid, uint64_t site);
+
+  /** pid execed: patch the sites knownSites has for its new mappings. */
+  void patchKnownSitesAtExec(pid_t pid);
+
+  /**
+   * Patch the sites knownSites has for pid's mapping m, the first time we
+   * look at m, all but trappedAt.
+   * @return whether trappedAt is one of them.
+   */
+  bool patchKnownSites(pid_t pid, const vma& m, uint64_t trappedAt);
+
+  /** Patch pid's site, known as kind, if the instruction there is one. */
+  bool patchKnownSite(pid_t pid, uint64_t site, patchKind kind);
+
+  /**
+   * Rewrite the insnLength bytes long instruction at site, pid's rip, into a
+   * jump to the trampoline makeTrampoline generates, see patchSites.
+   * @return the trampoline's address, 0 if the site was left alone.
+   */
+  uint64_t patchSite(
+      pid_t pid,
+      uint64_t site,
+      size_t insnLength,
+      const char* insnName,
+      const function<vector<uint8_t>(
+          const uint8_t* relocated,
+          size_t relocatedLength,
+          uint64_t trampolineAddr,
+          uint64_t returnAddr)>& makeTrampoline);
+
+  /**
+   * Map the read only page of canonical cpuid leaves in pid, once per address
+   * space.
+   * @return its address, 0 if we couldn't.
+   */
+  uint64_t mapCpuidTable(pid_t pid);
+
+  /**
+   * Map a patchSites::regionSize region for trampolines in pid, near site.
+   * @return its address, 0 if we couldn't get one within jump reach.
+   */
+  uint64_t mapPatchRegion(pid_t pid, uint64_t site);
 
   /**
    * starting epoch
@@ -169,6 +379,320 @@ private:
 
   unsigned prngSeed;
 
+  /**
+   * Size in bytes of the scratch memory we map into every tracee on exec, see
+   * state::mmapMemory.
+   */
+  size_t scratchSize;
+
+  /**
+   * Notify-safe system calls reach us through the seccomp notify fd instead of
+   * ptrace stops. See seccomp::inspect.
+   */
+  bool useSeccompNotify;
+
+  /**
+   * Our duplicate of the tracee's seccomp notify fd, -1 if we have none.
+   */
+  int notifyFd = -1;
+
+  /**
+   * We look for the notify fd once, on the first seccomp event.
+   */
+  bool notifyFdAcquired = false;
+
+  /**
+   * Counter for system calls serviced through the seccomp notify fd.
+   */
+  uint32_t notifyEvents = 0;
+
+  /**
+   * System calls pre-hooks emulated and skipped in their seccomp stop, see
+   * globalState::skipSystemCalls.
+   */
+  uint32_t skippedSystemCalls = 0;
+
+  /**
+   * --parallel: tracees run concurrently, we only commit their events one at a
+   * time, in the deterministic order kept by order. myScheduler still keeps
+   * track of processes, but doesn't pick who runs.
+   */
+  bool parallel;
+  syncOrder order;
+
+  /**
+   * Branch counters preempting tracees that spin without system calls.
+   */
+  branchCounter branches;
+
+  /**
+   * --hardware-counters: cycles, instructions and context switches of the
+   * tracer and the tracees.
+   */
+  hardwareCounters hardware;
+
+  /** --checkpoint-at, null unless given. */
+  unique_ptr<checkpoint> checkpointer;
+  /** Runs to restore from it once the original one ended. */
+  unsigned checkpointRuns;
+  /** We are the tracer of a run restored from the checkpoint. */
+  bool restoredRun = false;
+
+  /**
+   * The tracee's system call at pid's seccomp stop is the marker: checkpoint
+   * the run, unless it has more than one tracee thread, then the next time.
+   */
+  void takeCheckpoint(pid_t pid);
+
+  /** Run --checkpoint-runs runs from the checkpoint. */
+  void runRestores();
+
+  /**
+   * A branch counter overflow reached pid: preempt it if it made no system
+   * call since the last one, it is most likely spinning.
+   */
+  void handleBranchOverflow(pid_t pid);
+
+  /**
+   * Stops we took off waitpid before we could handle them, by pid. Either the
+   * tracee's turn hasn't come yet, or it's a new child whose fork event we
+   * haven't seen yet. waitForTracee looks here first, and without --parallel
+   * resumeTracee leaves a tracee with a stop here where it is: that stop is
+   * its next event.
+   */
+  unordered_map<pid_t, int> collectedStops;
+
+  /** Stops of other tracees waitForStop queued in collectedStops. */
+  uint64_t queuedStops = 0;
+
+  /**
+   * Finished parent handleNonEventExit just scheduled for its exit, -1 if none.
+   */
+  pid_t exitingParent = -1;
+
+  /**
+   * One round of --parallel: resume whoever may run, then commit the next
+   * event, or wait for one.
+   * @return whether all tracees are done.
+   */
+  bool stepParallel();
+
+  /** Take the next stop of any tracee off waitpid, into collectedStops. */
+  void collectStop();
+
+  /**
+   * Whether the event in status must wait for every other tracee to stop
+   * before it is committed, see syncOrder.
+   */
+  bool isBarrier(pid_t pid, int status);
+
+  /**
+   * Handle pid's collected event, see it through (finishCommit) and move its
+   * logical clock on.
+   * @return whether all tracees are done.
+   */
+  bool commitParallel(pid_t pid);
+
+  /**
+   * After committing event, run pid until the system call it let through has
+   * returned, or until it is gone if it was exiting. Nothing else is committed
+   * meanwhile, so system calls run in commit order.
+   * @return whether all tracees are done.
+   */
+  bool finishCommit(pid_t pid, ptraceEvent event);
+
+  /**
+   * Binary trace of every event we handle, null unless --trace-file was given.
+   */
+  unique_ptr<traceWriter> traceOutput;
+
+  /** The same records, null unless --trace-stream was given. */
+  unique_ptr<traceStream> traceStreamOutput;
+
+  /**
+   * --inode-snapshot file, "" if none, and the fingerprint it is saved with.
+   */
+  string inodeSnapshotFile;
+  uint64_t snapshotFingerprint;
+  /** Inodes loaded from inodeSnapshotFile. */
+  uint32_t snapshotInodes = 0;
+
+  /** globalState's tables, as tracees see them, see exportTables. */
+  sharedTables tables;
+
+  /** globalState::synthetic. */
+  syntheticFiles synthetic;
+
+  /** globalState::fakeroot. */
+  fakeOwnership fakeOwners;
+
+  /**
+   * Export what globalState holds already to tables, and have it export the
+   * rest as it changes.
+   */
+  void exportTables();
+
+  /**
+   * Per system call and per tracee counters and latencies, null unless
+   * --stats-json or --print-statistics was given, and the file they are
+   * written to at exit, "" if none.
+   */
+  unique_ptr<syscallStats> statsOutput;
+  string statsJsonFile;
+
+  /**
+   * With statsOutput: the most bytes each of our big structures held, sampled
+   * every memorySampleStops stops and at exit.
+   */
+  memoryUsage memoryPeak;
+  static const uint64_t memorySampleStops = 1 << 14;
+  uint64_t stopsUntilMemorySample = memorySampleStops;
+
+  /** Bytes our big structures hold now, see memoryUsage. */
+  memoryUsage memoryNow();
+
+  /**
+   * With statsOutput: the totals --print-statistics prints, by name, and
+   * --stats-json and --live-stats keep.
+   */
+  vector<pair<string, uint64_t>> statisticTotals();
+
+  /** --live-stats page, null without it. */
+  unique_ptr<liveStatsWriter> live;
+
+  /** Copy our counters so far into live. */
+  void publishLiveStats();
+
+  chrono::steady_clock::time_point started = chrono::steady_clock::now();
+  uint64_t nanosSinceStart();
+
+  /** Timeline of the run, null unless --timeline was given. */
+  unique_ptr<timeline> timelineOutput;
+
+  /** Where tracees trap, null unless --trap-profile was given. */
+  unique_ptr<trapProfile> trapProfileOutput;
+
+  /**
+   * Tell a --log-filter, and --log-shards, the messages that follow are about
+   * pid, in system call syscallNum or -1.
+   */
+  void logAbout(pid_t pid, int syscallNum);
+
+  /**
+   * --watchdog found a stall: print the scheduler's queues, and each replayed
+   * tracee's system call, the fd it waits on and who else has that open.
+   */
+  void reportStall();
+
+  /** Sample a trap of pid at its current registers, see trapProfile. */
+  void profileTrap(pid_t pid, const string& trap);
+
+  /**
+   * Nondeterministic inputs recorded or replayed, null unless --record-inputs
+   * or --replay-inputs was given.
+   */
+  unique_ptr<inputLog> inputs;
+
+  /**
+   * Scheduling decisions recorded or followed, null unless --record-schedule
+   * or --use-schedule was given.
+   */
+  unique_ptr<scheduleLog> schedule;
+
+  /** Hashes of files, for execs and dependencies, who must go first. */
+  unique_ptr<fileHasher> fileHashes;
+
+  /**
+   * Hash of the executable each tracee runs, for what handleExecEvent tells
+   * about execs. Null unless --exec-cache, --dependencies or --inode-snapshot
+   * was given, saved next to the inode snapshot.
+   */
+  unique_ptr<executableHashes> exeHashes;
+
+  /**
+   * Sites patched so far, by file and offset, to patch them in new processes
+   * right away. Null without site patching, saved next to the inode snapshot.
+   */
+  unique_ptr<patchSiteCache> knownSites;
+
+  /**
+   * Files each executable read as it started, read ahead at its next exec.
+   * Null without helper threads, saved next to the inode snapshot.
+   */
+  unique_ptr<startupReads> startups;
+
+  /** The store execs shares, null unless --exec-cache-remote was given. */
+  unique_ptr<remoteCache> sharedCache;
+
+  /** Process subtrees cached, null unless --exec-cache was given. */
+  unique_ptr<execCache> execs;
+
+  /** Files each exec read, null unless --dependencies was given. */
+  unique_ptr<dependencyManifest> dependencies;
+
+  /** Hashes of what tracees wrote, null unless --hash-outputs was given. */
+  unique_ptr<outputHasher> outputs;
+
+  /** Hooks that changed outcomes, null unless --suggest-profile was given. */
+  unique_ptr<profileSuggestion> suggestion;
+
+  /**
+   * Whether syscallNum, that s is stopped at, takes an input we log: reads of
+   * remote sockets and /proc files, connect, write, sendto and poll of remote
+   * sockets.
+   */
+  bool isInput(state& s, int syscallNum);
+
+  /**
+   * When replaying, turn the input syscallNum of s into a noop returning what
+   * the recording returned, its buffers written to the tracee.
+   * @return false if we don't replay it, and it must run.
+   */
+  bool replayInput(state& s, int syscallNum);
+
+  /** When recording, log the input syscallNum of s just returned. */
+  void recordInput(state& s, int syscallNum);
+
+  /** Counters a hook's share of is measured by, see countHook. */
+  struct hookCounts {
+    uint64_t replays;
+    uint64_t injected;
+    /** Register and memory writes to tracees, ptracer::traceeChanges. */
+    uint64_t changes;
+    chrono::steady_clock::time_point time;
+  };
+
+  /** The counters now, if we keep statsOutput, timelineOutput or suggestion. */
+  hookCounts hookCountsNow();
+
+  /**
+   * Count a hook of syscallNum for pid in statsOutput and suggestion, with what
+   * it did since before was taken.
+   */
+  void countHook(
+      pid_t pid, int syscallNum, bool post, const hookCounts& before);
+
+  /**
+   * Append an event to traceOutput and traceStreamOutput, if we are tracing.
+   * @param event kind of event.
+   * @param pid tracee the event happened in.
+   * @param number system call or signal number.
+   * @param args system call arguments, or nullptr.
+   * @param returnValue see traceEvent.
+   */
+  void recordTrace(
+      traceEvent event,
+      pid_t pid,
+      int64_t number,
+      const uint64_t* args,
+      int64_t returnValue);
+
+  /**
+   * Record a system call event, taking the arguments from the tracer.
+   */
+  void recordSystemCallTrace(
+      traceEvent event, pid_t pid, int64_t returnValue);
+
 public:
   /**
    * Constructor.
@@ -178,6 +702,74 @@ public:
    * @param Using kernel version < 4.8.
    * @param logFile file to write log messages to, if "" use stderr
    * @param devRandomPthread
+   * @param traceFile file to write a binary trace to, if "" don't trace
+   * @param parallel run tracees concurrently, see syncOrder
+   * @param lite with parallel: commit in arrival order, see --lite
+   * @param preemptBranches preempt a spinning tracee after this many branches,
+   * 0 never does, see branchCounter
+   * @param inodeSnapshotFile inode snapshot to start from and save to at exit,
+   * if "" don't, see inodeSnapshot.hpp
+   * @param snapshotFingerprint fingerprint of the tree we run in
+   * @param virtualDevRandom serve reads of /dev/[u]random from the tracer, see
+   * globalState::virtualDevRandom
+   * @param prngCompat generate getrandom() bytes like older versions, see
+   * globalState::prngCompat
+   * @param statsJsonFile file to write per system call statistics to as JSON,
+   * if "" don't, see syscallStats
+   * @param timelineFile file to write a Chrome trace of the run to, if ""
+   * don't, see timeline
+   * @param trapProfileFile file to write tracee stacks that trap to, if ""
+   * don't, see trapProfile
+   * @param trapProfilePeriod sample every this many traps
+   * @param inputLogFile file to record nondeterministic inputs to, or with
+   * replayInputs to replay them from, if "" neither, see inputLog
+   * @param replayInputs replay inputLogFile instead of recording it
+   * @param scheduleFile file to record scheduling decisions to, or with
+   * useSchedule to follow them from, if "" neither, see scheduleLog
+   * @param useSchedule follow scheduleFile instead of recording it
+   * @param execCacheDir directory of the cache of process subtrees, if "" no
+   * cache, see execCache
+   * @param dependenciesFile file to write the files each exec read to, if ""
+   * none, see dependencyManifest
+   * @param hashOutputsFile file to write hashes of the run's outputs to, if ""
+   * none, see outputHasher
+   * @param traceStreamFd pipe to stream the trace to, if -1 none, see
+   * traceStream
+   * @param suggestProfileFile file to write a profile suggestion to, if ""
+   * none, see profileSuggestion
+   * @param syntheticFileSources files to serve from memory, by tracee path, and
+   * the files of ours with their contents, see syntheticFiles
+   * @param pinTracerCpu cpu to run the tracer on, if -1 any
+   * @param pinTraceeCpu cpu to run the tracee being resumed on, if -1 any
+   * @param spinWaitMicros poll for a stop this long before blocking on it
+   * @param clockOrder run tracees in logical clock order, see
+   * scheduler::orderByClock
+   * @param vectorClocks track causality between thread groups, see vectorClock
+   * @param logFilterText what to log, if "" everything, see logFilter
+   * @param liveStatsFile file to keep statistics in as the run goes, if ""
+   * none, see liveStats.hpp
+   * @param watchdogRounds report stalls over this many rounds of retries, 0
+   * never does, see scheduler::watchForStalls
+   * @param countHardware count cycles of the tracer and tracees, see
+   * hardwareCounters
+   * @param helperThreads threads for work that needs no ptrace, see taskPool
+   * @param producerFirst run the producer of a pipe a tracee parks on next,
+   * see scheduler::preferProducers
+   * @param checkpointAt marker to checkpoint the run at, if "" none, see
+   * checkpoint
+   * @param checkpointRuns runs to restore from the checkpoint at the end
+   * @param remoteExecCommand command exec cache misses go to first, if ""
+   * none, see execCache
+   * @param execCacheRemote url of a store the exec cache shares with other
+   * machines, if "" none, see remoteCache
+   * @param pipeSize bytes every pipe tracees create is resized to, 0 to leave
+   * the kernel's default
+   * @param cpus CPUs of the machine tracees see, 0 for the host's, see
+   * syntheticFiles::addMachine
+   * @param fakeroot keep the owners and modes tracees give files to ourselves,
+   * see fakeOwnership
+   * @param logShards log about each thread group to a file of its own, see
+   * logger::shardByThreadGroup
    */
 
   execution(
@@ -187,12 +779,54 @@ public:
       string logFile,
       bool printStatistics,
       pthread_t devRandomPthread,
-      pthread_t devUrandomPthread,
       map<string, tuple<unsigned long, unsigned long, unsigned long>> vdsoFuncs,
       unsigned prngSeed,
       bool allow_network,
       logical_clock::time_point epoch,
-      logical_clock::duration clock_step);
+      logical_clock::duration clock_step,
+      size_t scratchSize,
+      bool useSeccompNotify,
+      string traceFile,
+      bool parallel,
+      bool lite,
+      uint64_t preemptBranches,
+      string inodeSnapshotFile,
+      uint64_t snapshotFingerprint,
+      bool virtualDevRandom,
+      bool prngCompat,
+      string statsJsonFile,
+      string timelineFile,
+      string trapProfileFile,
+      uint32_t trapProfilePeriod,
+      string inputLogFile,
+      bool replayInputs,
+      string scheduleFile,
+      bool useSchedule,
+      string execCacheDir,
+      string dependenciesFile,
+      string hashOutputsFile,
+      int traceStreamFd,
+      string suggestProfileFile,
+      map<string, string> syntheticFileSources,
+      int pinTracerCpu,
+      int pinTraceeCpu,
+      uint32_t spinWaitMicros,
+      bool clockOrder,
+      bool vectorClocks,
+      string logFilterText,
+      string liveStatsFile,
+      uint32_t watchdogRounds,
+      bool countHardware,
+      unsigned helperThreads,
+      bool producerFirst,
+      string checkpointAt,
+      unsigned checkpointRuns,
+      string remoteExecCommand,
+      string execCacheRemote,
+      int pipeSize,
+      unsigned cpus,
+      bool fakeroot,
+      bool logShards);
 
   /**
    * Handles exit from current process.
@@ -213,6 +847,10 @@ public:
    * REVIEW @return whether to go into post-interception hook
    * @see runProgram()
    */
+  template <typename Kernel>
+  bool handlePreSystemCall(state& currState, const pid_t traceesPid);
+
+  /** handlePreSystemCall for the kernel we run on, outside the event loop. */
   bool handlePreSystemCall(state& currState, const pid_t traceesPid);
 
   /**
@@ -236,13 +874,28 @@ public:
    */
   int runProgram();
 
+  /**
+   * We are the tracer of a run restored from the checkpoint, which is over:
+   * clean up nothing the original run owns.
+   */
+  bool isRestoredRun() const { return restoredRun; }
+
+  /**
+   * --fork-server: run from the checkpoint for every job dettrace --connect
+   * sends on listener, with the job's stdin, stdout and stderr, if it runs
+   * program like we did. Only returns if no checkpoint was taken.
+   */
+  void serveRestores(int listener, const vector<string>& program);
+
   /**
    * Handle the fork event part of @handleFork. Pushes parent to our process
    * hierarchy and creates state for child.
    * @param traceesPid the pid of the tracee
+   * @param isVfork vfork, or a clone with CLONE_VFORK like posix_spawn's: the
+   * parent stays suspended until the child execs or exits.
    * @see handleFork.
    */
-  pid_t handleForkEvent(const pid_t traceesPid, bool isThread);
+  pid_t handleForkEvent(const pid_t traceesPid, bool isThread, bool isVfork);
 
   /**
    * Handle signal event in trace.
@@ -266,6 +919,7 @@ public:
    * @return Return value dictates whether the postHook should be called as
    * well.
    */
+  template <typename Kernel>
   bool handleSeccomp(const pid_t traceesPid);
 
   /**
@@ -296,6 +950,59 @@ public:
       ptracer& t,
       scheduler& sched);
 
+  /**
+   * Call the handleNotify hook for a system call reported through the seccomp
+   * notify fd. Throws if the system call has no such hook.
+   */
+  void callNotifyHook(
+      int syscallNumber,
+      globalState& gs,
+      state& s,
+      ptracer& t,
+      seccompNotification& n);
+
+  /**
+   * Duplicate the seccomp notify fd the tracee's filter created into our
+   * process. Must be called before the tracee's first execve, as the fd is
+   * close-on-exec.
+   * @param traceesPid the pid of the tracee that loaded the filter
+   */
+  void acquireNotifyFd(pid_t traceesPid);
+
+  /**
+   * Receive one pending seccomp notification, run its hook and let the tracee
+   * continue.
+   */
+  void handleSeccompNotify();
+
+  /**
+   * waitpid for pid. While waiting, service any seccomp notifications.
+   * @return pid returned by waitpid.
+   */
+  pid_t waitForTracee(pid_t pid, int* status);
+
+  /**
+   * Take what pid's patched code and vdso left on its clock page since it last
+   * stopped, see drainSideEffects.
+   */
+  void pullFromTracee(pid_t pid);
+
+  /**
+   * Wait for s's first stop, if handleForkEvent left it for later. By the time
+   * we first get back to a new thread it is usually there already.
+   */
+  void takeInitialStop(state& s);
+
+  /** waitForTracee, without catching up with the tracee's logical clock. */
+  pid_t waitForStop(pid_t pid, int* status);
+
+  /**
+   * Hand what s's patched sites put in its side effect ring since its last
+   * stop to whoever needs to know, in order, and empty the ring. See
+   * sideEffectRecord.
+   */
+  void drainSideEffects(state& s);
+
   /**
    * Catch next event from any process that we are tracing. Return the event
    * type as well as the pid for the process that created this event, also set
@@ -310,6 +1017,28 @@ public:
   tuple<ptraceEvent, pid_t, int> getNextEvent(
       pid_t currentPid, bool ptraceSystemCall);
 
+  /**
+   * The first half of getNextEvent: let a stopped tracee continue, delivering
+   * its pending signal.
+   */
+  void resumeTracee(pid_t pid, bool ptraceSystemCall);
+
+  /**
+   * Dispatch one ptrace event from traceesPid to its handler.
+   * @return whether all tracees are done.
+   */
+  template <typename Kernel>
+  bool handleEvent(ptraceEvent ret, pid_t traceesPid, int status);
+
+  /** handleEvent for the kernel we run on, outside the event loop. */
+  bool handleEvent(ptraceEvent ret, pid_t traceesPid, int status);
+
+  /**
+   * The event loop of runProgram, until all tracees are done.
+   */
+  template <typename Kernel>
+  void eventLoop();
+
   /**
    * Gets PtraceEvent type.
    * @param status status number
@@ -324,6 +1053,13 @@ public:
    */
   ptraceEvent handleExitedThread(pid_t currentPid);
 
+  /**
+   * An exit_group took threadGroup's threads, detached with detachThreads:
+   * continue them all at once, collect their exits as they come, then clean up
+   * after each in the order they were created.
+   */
+  void exitThreads(pid_t threadGroup);
+
   // Core looping logic used by handleExitedThread.
   pair<bool, ptraceEvent> loopOnWaitpid(pid_t currentPid);
 
@@ -0,0 +1,70 @@
+#ifndef FAKE_OWNERSHIP_H
+#define FAKE_OWNERSHIP_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * --fakeroot: the owners and modes tracees gave files, what fakeroot's faked
+ * would remember for them, kept in the tracer. chown and its family succeed
+ * without running and only change what stat reports; chmod still runs, but
+ * stat reports the mode asked for. Files no tracee chowned or chmoded are
+ * reported as they are. Files are known by device and inode, like faked does,
+ * so every hard link of a file has its owner.
+ */
+class fakeOwnership {
+public:
+  /**
+   * The owner of the file real describes is now uid and gid, -1 to keep one
+   * as it is. Like chown(2) by root, setuid and setgid bits are then lost.
+   */
+  void chown(const struct stat& real, uid_t uid, gid_t gid);
+
+  /** The mode of the file real describes is now mode's permission bits. */
+  void chmod(const struct stat& real, mode_t mode);
+
+  /** The file is gone, its inode may be reused. */
+  void forget(dev_t device, ino_t inode);
+
+  /**
+   * What stat should report for the file: uid, gid and mode are left as they
+   * are for files we have nothing for.
+   */
+  void apply(dev_t device, ino_t inode, uid_t& uid, gid_t& gid, mode_t& mode)
+      const;
+
+  size_t size() const { return files.size(); }
+
+private:
+  struct fakeFile {
+    uid_t uid;
+    gid_t gid;
+    /** Permission bits, S_ISUID down to S_IXOTH. */
+    mode_t mode;
+  };
+
+  struct fileKey {
+    dev_t device;
+    ino_t inode;
+    bool operator==(const fileKey& other) const {
+      return device == other.device && inode == other.inode;
+    }
+  };
+
+  struct fileKeyHash {
+    size_t operator()(const fileKey& key) const {
+      return hash<ino_t>()(key.inode) ^ (hash<dev_t>()(key.device) << 1);
+    }
+  };
+
+  /** Our entry for the file real describes, made from it if new. */
+  fakeFile& entryFor(const struct stat& real);
+
+  unordered_map<fileKey, fakeFile, fileKeyHash> files;
+};
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+class ioUring;
+
+/** A timerfd the tracee holds, see fdInfo. */
+class timerfdInfo {
+public:
+  /** Its timer in state::timers, shared by dups of the fd. */
+  uint64_t timer = 0;
+  /** Created with TFD_NONBLOCK: reads fail with EAGAIN rather than wait. */
+  bool nonBlocking = false;
+};
+
+/**
+ * An eventfd the tracee holds, shared by dups of the fd, see
+ * serveEventfdRead.
+ */
+class eventfdInfo {
+public:
+  eventfdInfo(int ourFd, uint64_t id) : ourFd{ourFd}, id{id} {}
+  ~eventfdInfo() { ::close(ourFd); }
+  eventfdInfo(const eventfdInfo&) = delete;
+  eventfdInfo& operator=(const eventfdInfo&) = delete;
+
+  /** Our duplicate, sharing the tracee's open file description. */
+  const int ourFd;
+  /** Key readers waiting for its counter park on, see waitKind::eventfd. */
+  const uint64_t id;
+};
+
+/** An end of an AF_UNIX socketpair, see socketpairSystemCall. */
+struct socketPairEnd {
+  /** Inodes of this end and of the other, 0 if fd is no such end. */
+  ino_t inode = 0;
+  ino_t peer = 0;
+
+  /** What waiters on either end park on, like a pipe's inode. */
+  ino_t key() const { return std::min(inode, peer); }
+};
+
+/**
+ * Keep track of file descriptor, whether it's blocking or non blocking.
+ */
+enum class descriptorType {
+  blocking, /*< Set to block by user program (default) */
+  nonBlocking, /*< User used system call pipe2 or fnctl to set as non blocking.
+                */
+};
+
+/**
+ * What a file descriptor refers to, as far as we saw it being created.
+ */
+enum class fdType {
+  unknown, /*< Inherited, or made by a system call we don't intercept. */
+  regular, /*< Regular file, reads and writes never block. */
+  pipe,
+  socket,
+  tty,
+  timerfd,
+  eventfd,
+  devRandom, /*< Our /dev/random, reads are served by the tracer. */
+  devUrandom, /*< Our /dev/urandom, reads are served by the tracer. */
+  devNull, /*< /dev/null, reads and writes are answered in the pre-hook. */
+  devZero, /*< /dev/zero, reads are never short. */
+  procFile, /*< A file of the real /proc, only told apart from regular files
+               when logging inputs, see inputLog. */
+};
+
+/**
+ * Whether reads and writes of fds of type never block, and only come up short
+ * at EOF or on errors: regular files, /dev/null and /dev/zero.
+ */
+inline bool neverBlocks(fdType type) {
+  return type == fdType::regular || type == fdType::devNull ||
+      type == fdType::devZero;
+}
+
+/** What we know of one file descriptor, see fdTable. */
+struct fdInfo {
+  fdType type = fdType::unknown;
+  /**
+   * Whether we track blocking for it: pipes and sockets, set by pipe, pipe2,
+   * socket, accept and fcntl. blocking is meaningless otherwise.
+   */
+  bool tracksBlocking = false;
+  descriptorType blocking = descriptorType::blocking;
+  /** A remote socket, unix domain sockets excluded. */
+  bool remote = false;
+  bool timerfd = false;
+  timerfdInfo timer;
+  /** An io_uring instance, shared by dups of the fd, see ioUring. */
+  shared_ptr<ioUring> ring;
+  shared_ptr<eventfdInfo> eventfd;
+  socketPairEnd socketPair;
+  /**
+   * Real device and inode of the file it is open on, from the stat of its
+   * open, see readInodeFor. 0 if we didn't look.
+   */
+  dev_t device = 0;
+  ino_t inode = 0;
+  /** O_RDONLY, O_WRONLY or O_RDWR as opened, -1 if we didn't look. */
+  int accessMode = -1;
+
+  /** Whether we know anything of it. */
+  bool known() const {
+    return type != fdType::unknown || tracksBlocking || remote || timerfd ||
+        ring != nullptr || eventfd != nullptr || socketPair.inode != 0 ||
+        inode != 0;
+  }
+};
+
+/**
+ * Everything we keep about a process's file descriptors, one slot per fd
+ * indexed by the fd: tracees get the lowest free fds, so the table stays
+ * about as long as the highest fd they use. Looking an fd up is an array
+ * load, close and dup are a single slot reset or copy. Directories being read
+ * keep their listings in state::dirEntries.
+ *
+ * Shared by tracees that share a file descriptor table, copied on fork, see
+ * state::fds.
+ */
+class fdTable {
+public:
+  /** What we know of fd, nothing for fds we never saw. */
+  const fdInfo& operator[](int fd) const {
+    static const fdInfo none;
+    return 0 <= fd && (size_t)fd < slots.size() ? slots[fd] : none;
+  }
+
+  // The setters take fds the tracee got back from the kernel, never negative.
+
+  void setType(int fd, fdType type) { slot(fd).type = type; }
+
+  void setBlocking(int fd, descriptorType blocking) {
+    fdInfo& info = slot(fd);
+    info.tracksBlocking = true;
+    info.blocking = blocking;
+  }
+
+  void setRemote(int fd, bool remote) {
+    fdInfo& info = slot(fd);
+    remoteFds += (int)remote - (int)info.remote;
+    info.remote = remote;
+  }
+
+  void setTimerfd(int fd, timerfdInfo timer) {
+    fdInfo& info = slot(fd);
+    info.timerfd = true;
+    info.timer = timer;
+  }
+
+  void setRing(int fd, shared_ptr<ioUring> ring) { slot(fd).ring = ring; }
+
+  void setEventfd(int fd, shared_ptr<eventfdInfo> eventfd) {
+    fdInfo& info = slot(fd);
+    info.type = fdType::eventfd;
+    info.eventfd = eventfd;
+  }
+
+  void setSocketPair(int fd, socketPairEnd end) {
+    fdInfo& info = slot(fd);
+    info.type = fdType::socket;
+    info.socketPair = end;
+  }
+
+  void setFile(int fd, dev_t device, ino_t inode) {
+    fdInfo& info = slot(fd);
+    info.device = device;
+    info.inode = inode;
+  }
+
+  void setAccessMode(int fd, int accessMode) {
+    slot(fd).accessMode = accessMode;
+  }
+
+  /** fd was closed. */
+  void close(int fd) {
+    if ((*this)[fd].known()) {
+      setRemote(fd, false);
+      slots[fd] = fdInfo();
+    }
+  }
+
+  /** newfd is now a duplicate of oldfd, whatever it was before. */
+  void dup(int oldfd, int newfd) { received(newfd, (*this)[oldfd]); }
+
+  /**
+   * fd is now a duplicate of what info is of, e.g. an fd another process sent
+   * with SCM_RIGHTS.
+   */
+  void received(int fd, fdInfo info) {
+    setRemote(fd, info.remote);
+    slot(fd) = info;
+  }
+
+  /**
+   * After execve: we forget types and blocking, what we learn of inherited fds
+   * again. Remote sockets and timerfds stay what they are. io_uring fds are
+   * close on exec, eventfds and socketpairs may be: inherited ones go to the
+   * kernel.
+   */
+  void execed() {
+    for (fdInfo& info : slots) {
+      info.type = fdType::unknown;
+      info.tracksBlocking = false;
+      info.blocking = descriptorType::blocking;
+      info.ring = nullptr;
+      info.eventfd = nullptr;
+      info.socketPair = socketPairEnd();
+      // Close on exec ones are gone, we can't tell which.
+      info.device = 0;
+      info.inode = 0;
+      info.accessMode = -1;
+    }
+  }
+
+  /** Whether any fd is a remote socket. */
+  bool anyRemote() const { return remoteFds != 0; }
+
+  /** Whether some fd is a timerfd with timer, e.g. a dup of a closed one. */
+  bool timerHeld(uint64_t timer) const {
+    for (const fdInfo& info : slots) {
+      if (info.timerfd && info.timer.timer == timer) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Set bit fd of bits, words words long, for the fds below 64 * words whose
+   * reads and writes never block, see neverBlocks, clear the others.
+   */
+  void regularFds(uint64_t* bits, size_t words) const {
+    size_t fds = min(slots.size(), 64 * words);
+    fill(bits, bits + words, 0);
+    for (size_t fd = 0; fd < fds; fd++) {
+      if (neverBlocks(slots[fd].type)) {
+        bits[fd / 64] |= (uint64_t)1 << (fd % 64);
+      }
+    }
+  }
+
+  /** One past the highest fd we may know of. */
+  int size() const { return slots.size(); }
+
+  /** Bytes of the table, see memoryUsage. */
+  size_t bytesHeld() const { return slots.capacity() * sizeof(fdInfo); }
+
+private:
+  fdInfo& slot(int fd) {
+    if ((size_t)fd >= slots.size()) {
+      slots.resize(fd + 1);
+    }
+    return slots[fd];
+  }
+
+  vector<fdInfo> slots;
+  int remoteFds = 0;
+};
+
+#endif
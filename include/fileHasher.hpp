@@ -0,0 +1,117 @@
+#ifndef FILE_HASHER_H
+#define FILE_HASHER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "taskPool.hpp"
+
+using namespace std;
+
+/**
+ * FNV-1a over 8 byte words, zlib's crc32 and the size: cheap enough to hash a
+ * compiler on every exec, and two unrelated hashes to collide at once.
+ */
+struct contentHasher {
+  uint64_t fnv = 0xcbf29ce484222325ULL;
+  unsigned long crc;
+  uint64_t size = 0;
+
+  contentHasher();
+
+  void add(const char* data, size_t n);
+
+  /** Add str and its NUL, so that consecutive strings can't run together. */
+  void add(const string& str) { add(str.c_str(), str.size() + 1); }
+
+  string hex() const;
+};
+
+/**
+ * Which version of a file a hash is of: its inode, size and times. A file
+ * whose identity didn't change since it was hashed needs no hashing again.
+ */
+struct fileIdentity {
+  dev_t device = 0;
+  ino_t inode = 0;
+  off_t size = 0;
+  int64_t mtime = 0;
+  int64_t ctime = 0;
+
+  bool operator<(const fileIdentity& other) const {
+    return tie(device, inode, size, mtime, ctime) <
+        tie(other.device, other.inode, other.size, other.mtime, other.ctime);
+  }
+  bool operator==(const fileIdentity& other) const {
+    return !(*this < other) && !(other < *this);
+  }
+};
+
+/**
+ * Content hashes of regular files, memoized per fileIdentity so that each
+ * version of a file is read at most once per run. Files can be hashed right
+ * away, or handed to a helper thread to be hashed while the tracer goes on,
+ * see prefetch().
+ */
+class fileHasher {
+public:
+  /** @param tasks where prefetch() hashes. */
+  explicit fileHasher(taskPool& tasks) : tasks(tasks) {}
+
+  /** Waits for the files still being hashed. */
+  ~fileHasher();
+
+  fileHasher(const fileHasher&) = delete;
+  fileHasher& operator=(const fileHasher&) = delete;
+
+  /**
+   * Identity of the regular file at path, false if it isn't one or can't be
+   * stat'ed.
+   */
+  static bool identify(const string& path, fileIdentity& id);
+
+  /**
+   * Hash of the regular file at path, "" if it can't be read. If id is not
+   * null it is set to the identity hashed.
+   */
+  string hash(const string& path, fileIdentity* id = nullptr);
+
+  /**
+   * Hash this version of path in the background, hashOf() picks it up.
+   */
+  void prefetch(const string& path, const fileIdentity& id);
+
+  /**
+   * Hash of version id of path: what prefetch() got, waiting for it if need
+   * be, or path hashed now if it still is at id. "" if it changed since.
+   */
+  string hashOf(const string& path, const fileIdentity& id);
+
+  /** Files read and hashed, and hashes served from the memo. */
+  uint64_t filesHashed = 0;
+  uint64_t memoHits = 0;
+
+  /**
+   * Hash the regular file at path, appending its contents to contents if not
+   * null. "" if it can't be read. Not memoized.
+   */
+  static string hashFile(const string& path, string* contents);
+
+private:
+  /** Hash path if it still is at id, and memoize it. Takes lock itself. */
+  void hashAndMemoize(const string& path, const fileIdentity& id);
+
+  taskPool& tasks;
+  /** Of memo and filesHashed, which helpers write to. */
+  mutex lock;
+  map<fileIdentity, string> memo;
+  /** Identities prefetched, until hashOf() takes them. */
+  map<fileIdentity, taskResult<void>> pending;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef FLAT_HASH_MAP_H
+#define FLAT_HASH_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Open addressing hash map from an integral Key to a Value, for ValueMapper.
+ *
+ * Slots live in one flat array, probed linearly from a Fibonacci hash of the
+ * key, so a lookup is usually a single cache line and inserting never
+ * allocates except when the table doubles. Kept at most half full. The table
+ * never shrinks, erased slots are reused by later insertions.
+ */
+template <typename Key, typename Value>
+class flatHashMap {
+  static_assert(is_integral<Key>::value, "flatHashMap keys must be integral");
+
+public:
+  flatHashMap() : slots(minCapacity) {}
+
+  /**
+   * Find key, adding it with a value initialized Value if it isn't there.
+   * @return the key's value, valid until the next insertion, and whether it
+   * was just added.
+   */
+  pair<Value*, bool> lookupOrInsert(Key key) {
+    if (2 * (count + 1) > slots.size()) {
+      grow();
+    }
+    slot& s = probe(slots, key);
+    bool inserted = !s.used;
+    if (inserted) {
+      s.used = true;
+      s.key = key;
+      s.value = Value{};
+      count++;
+    }
+    return make_pair(&s.value, inserted);
+  }
+
+  /**
+   * Remove key, shifting back the entries probed past it so lookups still
+   * find them.
+   * @return whether key was there.
+   */
+  bool erase(Key key) {
+    size_t mask = slots.size() - 1;
+    size_t hole = &probe(slots, key) - &slots[0];
+    if (!slots[hole].used) {
+      return false;
+    }
+    for (size_t i = (hole + 1) & mask; slots[i].used; i = (i + 1) & mask) {
+      // The entry may move back if its probe passes over the hole.
+      size_t fromHome = (i - home(slots.size(), slots[i].key)) & mask;
+      if (fromHome >= ((i - hole) & mask)) {
+        slots[hole] = slots[i];
+        hole = i;
+      }
+    }
+    slots[hole].used = false;
+    count--;
+    return true;
+  }
+
+  /** key's value, nullptr if it isn't there. */
+  const Value* find(Key key) const {
+    const slot& s = probe(slots, key);
+    return s.used ? &s.value : nullptr;
+  }
+
+  Value* find(Key key) {
+    slot& s = probe(slots, key);
+    return s.used ? &s.value : nullptr;
+  }
+
+  size_t size() const { return count; }
+
+  /**
+   * Start loading the slot where a lookup of key begins, to look it up a
+   * few keys later without waiting on memory.
+   */
+  void prefetch(Key key) const {
+    __builtin_prefetch(&slots[home(slots.size(), key)]);
+  }
+
+  /** Bytes of the slot array, see memoryUsage. */
+  size_t bytesHeld() const { return slots.capacity() * sizeof(slot); }
+
+  /** Call f(key, value) on every entry, in no particular order. */
+  template <typename F>
+  void forEach(F f) const {
+    for (const slot& s : slots) {
+      if (s.used) {
+        f(s.key, s.value);
+      }
+    }
+  }
+
+private:
+  static const size_t minCapacity = 64;
+
+  struct slot {
+    Key key;
+    bool used;
+    Value value;
+  };
+
+  vector<slot> slots; /**< Size is a power of two. */
+  size_t count = 0;
+
+  /** Slot of key in table, or the empty slot where it would go. */
+  template <typename Slots>
+  static auto probe(Slots& table, Key key) -> decltype(table[0]) {
+    size_t mask = table.size() - 1;
+    size_t i = home(table.size(), key);
+    while (table[i].used && table[i].key != key) {
+      i = (i + 1) & mask;
+    }
+    return table[i];
+  }
+
+  /** Slot a probe for key starts at. */
+  static size_t home(size_t capacity, Key key) {
+    return ((uint64_t)key * 0x9e3779b97f4a7c15) >> shift(capacity);
+  }
+
+  /** Shift taking the top log2(capacity) bits of the hash. */
+  static unsigned shift(size_t capacity) {
+    return 64 - __builtin_ctzll(capacity);
+  }
+
+  void grow() {
+    vector<slot> bigger(2 * slots.size());
+    for (const slot& s : slots) {
+      if (s.used) {
+        probe(bigger, s.key) = s;
+      }
+    }
+    slots.swap(bigger);
+  }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef FUTEX_QUEUES_H
+#define FUTEX_QUEUES_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Tracer side model of the kernel's futex wait queues, for private futexes.
+ *
+ * A tracee in FUTEX_WAIT on a word that still holds the expected value is
+ * parked here instead of running the system call, and stays at its seccomp
+ * stop until a FUTEX_WAKE-like operation on the same word takes it off the
+ * queue. Waiters are woken oldest first, and tracees only join or leave queues
+ * from system call handlers, so who wakes whom is the same on every run.
+ *
+ * Queues are keyed by (address space, futex word address). Private futexes
+ * can only be shared by threads, so the address space is the thread group.
+ */
+class futexQueues {
+public:
+  /** Bitset FUTEX_WAIT and FUTEX_WAKE implicitly use. */
+  static const uint32_t matchAny = 0xffffffff;
+
+  /** waiter now waits on uaddr, in addressSpace. */
+  void wait(pid_t addressSpace, uint64_t uaddr, pid_t waiter, uint32_t bitset);
+
+  /**
+   * Take up to count waiters on uaddr whose bitset shares a bit with bitset
+   * off their queue, oldest first.
+   * @return the woken waiters.
+   */
+  vector<pid_t> wake(
+      pid_t addressSpace,
+      uint64_t uaddr,
+      int count,
+      uint32_t bitset = matchAny);
+
+  /**
+   * Move up to count of the oldest waiters on from to the end of to's queue.
+   * @return number of waiters moved.
+   */
+  int requeue(pid_t addressSpace, uint64_t from, uint64_t to, int count);
+
+  /** Take every waiter of addressSpace off its queue, sorted by pid. */
+  vector<pid_t> wakeAll(pid_t addressSpace);
+
+  /** Forget waiter, e.g. it exited. Fine to call on tracees not waiting. */
+  void remove(pid_t waiter);
+
+  bool isWaiting(pid_t waiter) const { return waitingOn.count(waiter) != 0; }
+
+private:
+  typedef pair<pid_t, uint64_t> futexKey;
+
+  struct waiter {
+    pid_t pid;
+    uint32_t bitset;
+  };
+
+  map<futexKey, deque<waiter>> queues;
+  /** Queue each waiter is on. */
+  unordered_map<pid_t, futexKey> waitingOn;
+};
+
+#endif
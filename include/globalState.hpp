@@ -1,12 +1,29 @@
 #ifndef GLOBAL_STATE_H
 #define GLOBAL_STATE_H
 
+#include <deque>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "PRNG.hpp"
 #include "ValueMapper.hpp"
+#include "directoryCache.hpp"
+#include "fakeOwnership.hpp"
+#include "fdTable.hpp"
+#include "futexQueues.hpp"
+#include "missingPaths.hpp"
+#include "pathCache.hpp"
+#include "scratchArena.hpp"
+#include "sharedTables.hpp"
+#include "stringInterner.hpp"
+#include "syntheticFiles.hpp"
 #include "logicalclock.hpp"
+#include "vectorClock.hpp"
+
+class processTable;
+class state;
 
 /**
  * Mapping of inodes to modification times. When we observe the creation of an
@@ -27,9 +44,11 @@ public:
    * @param log global program log
    * @param inodeMap map of inodes and virtual nodes
    * @param mtimeMap map of inode to modification times
+   * @param processes table of all tracees
    */
   globalState(
       logger& log,
+      processTable& processes,
       ValueMapper<ino_t, ino_t> inodeMap,
       ModTimeMap mtimeMap,
       bool kernelPre4_12,
@@ -48,20 +67,195 @@ public:
   ValueMapper<ino_t, ino_t> inodeMap;
 
   /**
-   * Tracker of modification times.
+   * Tracker of modification times. Written through setMtime.
    */
   ModTimeMap mtimeMap;
 
+  /**
+   * Where inodeMap, mtimeMap and the random streams are exported for tracees
+   * to read, null if they aren't, see execution::exportTables.
+   */
+  sharedTables* tables = nullptr;
+
+  /** Canned /proc and /etc files, null if tracees see the real ones. */
+  const syntheticFiles* synthetic = nullptr;
+
+  /** Owners and modes tracees gave files, null without --fakeroot. */
+  fakeOwnership* fakeroot = nullptr;
+
+  /** Set inode's logical mtime, exporting it. */
+  void setMtime(ino_t inode, logical_clock::time_point mtime);
+
+  /**
+   * A file a tracee is about to unlink or rmdir, that we have a virtual inode
+   * or mtime for. Its inode is forgotten once the file is really gone, see
+   * reclaimUnlinkedInodes.
+   */
+  struct unlinkedFile {
+    ino_t inode;
+    /** Host path the tracee unlinked, the file is gone once it misses. */
+    std::string hostPath;
+    /** Its virtual inode then, 0 if none: a new file may get the inode. */
+    ino_t virtualInode;
+  };
+  std::vector<unlinkedFile> unlinkedFiles;
+
+  /** Unlinks between two runs of reclaimUnlinkedInodes. */
+  static const size_t unlinkedFilesBatch = 1024;
+  size_t unlinksUntilReclaim = unlinkedFilesBatch;
+
+  /**
+   * Note that a tracee is about to unlink the last name of a file with a
+   * virtual inode or mtime, see unlinkedFile. Runs reclaimUnlinkedInodes
+   * first every unlinkedFilesBatch files.
+   */
+  void unlinking(ino_t inode, const std::string& hostPath);
+
+  /**
+   * Forget the inodes of unlinkedFiles that are gone: the unlinked path no
+   * longer names them, no tracee has them open or as its cwd or root, and a
+   * newly created file didn't take the inode over since. The rest wait for
+   * the next run if still open, and are dropped otherwise.
+   * Runs every unlinkedFilesBatch unlinks, at the same points every run. The
+   * forgotten virtual inodes are never handed out again.
+   */
+  void reclaimUnlinkedInodes();
+
+  /** Drop the virtual inode and mtime of inode, here and in tables. */
+  void forgetInode(ino_t inode);
+
+  /** Export how far the random streams got, after reading some. */
+  void publishRandomPositions();
+
   /**
    * Using kernel version < 4.12 . 4.12 and above needed for CPUID.
    */
   bool kernelPre4_12;
 
   /**
-   * A pseudorandom number generator to implement getrandom()
+   * A pseudorandom number generator to implement getrandom() with
+   * --prng-compat.
    */
   PRNG prng;
 
+  /**
+   * --prng-seed, every tracee's getrandom() stream is derived from it, see
+   * state::getrandomStream.
+   */
+  uint64_t prngSeed;
+
+  /**
+   * Produce the pseudorandom streams of older dettrace versions, see
+   * --prng-compat.
+   */
+  bool prngCompat = false;
+
+  /**
+   * Serve reads of our /dev/random and /dev/urandom from the tracer, from these
+   * streams, instead of letting them read the fifos. False with --real-proc,
+   * where they are the host's devices, and with --prng-compat.
+   */
+  bool virtualDevRandom = false;
+
+  /**
+   * Open files of /proc as fdType::procFile, whose reads --record-inputs and
+   * --replay-inputs log.
+   */
+  bool logProcReads = false;
+
+  /**
+   * Give every write a post-hook, regular files included, so --hash-outputs
+   * sees what it wrote.
+   */
+  bool hashOutputs = false;
+
+  /**
+   * --lite: reads and writes of pipes, sockets and ttys run in the kernel
+   * without hooks, blocking there if they block.
+   */
+  bool lite = false;
+
+  /**
+   * Let stat-like pre-hooks skip post-hooks of calls on files we see are
+   * missing, see statWillFail. Off when something else wants those results:
+   * --exec-cache records misses as inputs, an --rnr plugin may record them.
+   * Off with --parallel, another tracee could create the file in between.
+   */
+  bool predictMissingFiles = false;
+
+  /**
+   * Let chdir, rename and rmdir pre-hooks drop the cached paths they may
+   * change before the call runs, and skip post-hooks that would only do that
+   * or log. Off when something else wants their results, --exec-cache or an
+   * --rnr plugin, and with --parallel, another tracee may read a path back in
+   * between.
+   */
+  bool pathUpdatesInPreHooks = false;
+
+  /**
+   * Serve blocking reads of remote stream sockets from the tracer, see
+   * serveSocketRead. On with --allow-network, off with --parallel: the tracer
+   * waits for the data.
+   */
+  bool tracerSocketReads = false;
+
+  /**
+   * Keep eventfd counters for tracees, see serveEventfdRead, with the last id
+   * one got. Off with --parallel, a tracee running alongside could empty the
+   * counter between our poll and our read.
+   */
+  bool tracerEventfds = false;
+  uint64_t lastEventfd = 0;
+
+  /**
+   * Bytes every pipe a tracee creates is resized to, --pipe-size, so its
+   * capacity and F_GETPIPE_SZ don't depend on the machine. 0 to leave them
+   * at the kernel's default.
+   */
+  int pipeSize = 0;
+
+  /**
+   * CPUs of the machine tracees see, --cpus, for sched_getaffinity and
+   * sched_setaffinity. 0 to let those through to the host's.
+   */
+  unsigned cpus = 0;
+
+  /**
+   * What we knew of the fds SCM_RIGHTS messages to the socketpair end with
+   * that inode pass, in the order they were sent, until received, see
+   * sendmsgSystemCall.
+   */
+  std::unordered_map<ino_t, std::deque<std::vector<fdInfo>>> fdsInFlight;
+
+  /**
+   * Whether pre-hooks may skip system calls they emulate or fail in their
+   * seccomp stop, a system call number of -1 returning whatever we put in the
+   * return register: kernels from 4.8, where seccomp stops come before the
+   * system call runs. Off for --rnr plugins, which see emulated calls in their
+   * post-hooks.
+   */
+  bool skipSystemCalls = false;
+
+  /**
+   * --vector-clocks: track which thread groups heard of which through pipes,
+   * forks and waits, see vectorClock. pipeClocks has what went into each pipe,
+   * by inode, exitClocks what exited thread groups knew, until reaped.
+   */
+  bool vectorClocks = false;
+  std::unordered_map<ino_t, vectorClock> pipeClocks;
+  std::unordered_map<pid_t, vectorClock> exitClocks;
+
+  /** s sends something: its thread group ticks. @return its clock now. */
+  const vectorClock& causalSend(state& s);
+
+  /**
+   * s receives what sent was sent with.
+   * @return whether it heard of a send it didn't know of yet.
+   */
+  bool causalReceive(state& s, const vectorClock& sent);
+  randomByteStream devRandomBytes;
+  randomByteStream devUrandomBytes;
+
   /**
    * The number of microseconds since the Unix epoch. This is used as the
    * default value for file modification times if it doesn't exist in
@@ -75,6 +269,23 @@ public:
    */
   uint32_t readRetryEvents = 0;
 
+  /**
+   * Read retries the readiness probe answered without running the read.
+   */
+  uint32_t readProbeDeferrals = 0;
+
+  /**
+   * Blocking wait4s and waitids held back until a child exits, without
+   * running them first to find nothing to reap.
+   */
+  uint32_t waitDeferrals = 0;
+
+  /** WNOHANG wait4s answered in their pre-hook: nothing they watch exited. */
+  uint32_t waitPollsAnswered = 0;
+
+  /** causalReceives that heard of new sends. */
+  uint64_t causalReceives = 0;
+
   /**
    * Counter for keeping track of total number of write retries.
    */
@@ -85,6 +296,11 @@ public:
    */
   uint32_t getRandomCalls = 0;
 
+  /**
+   * Bytes returned by those getRandom calls.
+   */
+  uint64_t getRandomBytes = 0;
+
   /**
    * Counter for keeping track of number of open/openat to /dev/urandom
    * Not as interest as "reads" from open urandom, but this is the best we can
@@ -94,6 +310,15 @@ public:
 
   uint32_t devRandomOpens = 0;
 
+  /**
+   * Reads of /dev/[u]random served by the tracer, and the bytes they returned.
+   */
+  uint32_t devRandomReads = 0;
+  uint64_t devRandomBytesRead = 0;
+
+  /** Opens redirected to synthetic's files. */
+  uint32_t syntheticOpens = 0;
+
   /**
    * Counter for keeping track of all time related calls
    */
@@ -110,39 +335,131 @@ public:
    */
   uint32_t totalReplays = 0;
 
+  /**
+   * FUTEX_WAITs parked in futexes instead of being run and replayed.
+   */
+  uint32_t futexWaitsParked = 0;
+
+  /**
+   * Timed FUTEX_WAITs parked until a wake or their logical timeout, and
+   * nanosleeps of threads parked until theirs.
+   */
+  uint32_t futexTimedWaitsParked = 0;
+  uint32_t sleepsParked = 0;
+
+  /**
+   * Replays of poll-like calls with nothing ready, see replayPollWhenReady.
+   */
+  uint32_t emptyPollRetries = 0;
+
+  /**
+   * select, pselect6 and polls answered without the kernel, see
+   * selectFromTracer.
+   */
+  uint32_t pollsInTracer = 0;
+
+  /**
+   * Post-hooks of stat-like calls skipped as the file was missing, see
+   * statWillFail.
+   */
+  uint32_t missingStatsPredicted = 0;
+
+  /** Opens skipped as the file was missing, see handlePreOpens. */
+  uint32_t missingOpensSkipped = 0;
+
+  /**
+   * io_uring SQEs submitted, and those refused being on fds other than
+   * regular files, see ioUring.
+   */
+  uint64_t ioUringSqes = 0;
+  uint64_t ioUringSqesRefused = 0;
+
+  /**
+   * Reads of eventfds served by the tracer, and how many times a reader was
+   * parked until a write, see serveEventfdRead.
+   */
+  uint64_t eventfdReads = 0;
+  uint64_t eventfdWaits = 0;
+
+  /**
+   * Directory listings served from dirCache.
+   */
+  uint32_t dirCacheHits = 0;
+
+  /**
+   * Directories the tracer listed itself instead of the tracee.
+   */
+  uint32_t tracerDirectoryReads = 0;
+
+  /**
+   * Tracee lseeks, seekdirs and rewinddirs on a cached listing, followed
+   * within it.
+   */
+  uint32_t directorySeeks = 0;
+
+  /**
+   * Reads and writes on regular files, let through without a post-hook.
+   */
+  uint32_t regularFileIo = 0;
+
+  /** Reads and writes of /dev/null answered in the pre-hook. */
+  uint32_t devNullIo = 0;
+
+  /**
+   * Bytes of short pipe reads and writes the tracer did on behalf of tracees.
+   */
+  uint64_t tracerPipeBytes = 0;
+
+  /** Bytes of remote socket reads the tracer did on behalf of tracees. */
+  uint64_t tracerSocketBytes = 0;
+
   /**
    * Counter for keeping track of injected system calls
    */
   uint32_t injectedSystemCalls = 0;
 
+  /** Inodes forgotten after their file was unlinked. */
+  uint32_t inodesReclaimed = 0;
+
   /**
-   * Keeps track of live threads in our program.
+   * Every tracee we know about: its state, parent, children and thread group.
+   * Owned by execution, shared here as hooks need to know about thread groups.
    */
-  unordered_set<pid_t> liveThreads;
+  processTable& processes;
+
+  /**
+   * Tracees waiting on private futexes, see futexSystemCall.
+   */
+  futexQueues futexes;
+
+  /**
+   * Listings of directories read in full, see getdentsSystemCall.
+   */
+  directoryCache dirCache;
+
+  /**
+   * Paths found missing, see missingPathError. Only filled with
+   * predictMissingFiles.
+   */
+  missingPaths missing;
+
+  /**
+   * Strings seen from tracees, mostly paths. Compare and key on their ids.
+   */
+  stringInterner strings;
+
+  const stringId devRandomPath = strings.intern("/dev/random");
+  const stringId devUrandomPath = strings.intern("/dev/urandom");
 
   /**
-   * Keeps track of thread groups, each thread groups is composed of the threads
-   * and the single parent process that belongs to that thread group. The
-   * process will always be the last live member of a thread group as it cannot
-   * exit until all it's threads and true process children have exited. When no
-   * members are left, the threadGroup is deleted. The pid of the process is
-   * used as the key into the multimap. Hence {(2, 2), (2, 3), (2, 4)} means for
-   * thread group 2, process 2, thread 3, and thread 4 are members of this
-   * thread group. (k, k) is always the process, and two different processes
-   * cannot belong to the same thread group. Child processes of a process are
-   * NOT included in the thread group, only threads are. A child process will
-   * get it's own thread group.
+   * Directories tracees resolve paths against, see traceePaths.
    */
-  unordered_multimap<pid_t, pid_t> threadGroups;
+  pathTable hostPaths{strings};
 
   /**
-   * Map threadsGroups members back to their thread group.
-   * Makes it easy to look up threads in threadGroups while only knowing their
-   * tid/traceePid. Notice for processes their threadGroupNumber equals their
-   * traceePid, we add them to the map anyways to avoid special cases for the
-   * process owner vs threads.
+   * Buffers a hook only needs until it returns, reset before every hook.
    */
-  unordered_map<pid_t, pid_t> threadGroupNumber;
+  scratchArena scratch;
 
   /**
    * Allow non-deterministic socket/networking
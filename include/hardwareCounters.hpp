@@ -0,0 +1,95 @@
+#ifndef HARDWARE_COUNTERS_H
+#define HARDWARE_COUNTERS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * --hardware-counters: where the cycles of a run go, to tell whether making
+ * the tracer faster would matter for a workload at all.
+ *
+ * The tracer's main thread and every tracee get a group of perf counters:
+ * cycles, cycles in user space, instructions in user space and context
+ * switches. Cycles not in user space are in the kernel. That splits a run
+ * into the tracees' own code, the kernel working for the tracees (their
+ * system calls, and ptrace stopping and resuming them), the kernel working
+ * for the tracer (ptrace, waitpid, process_vm_readv) and our handlers.
+ *
+ * A tracee's group is read once, when it exits. Counts are scaled when the
+ * kernel had to multiplex the groups. Needs perf_event_paranoid at most 1 for
+ * the kernel's cycles; without usable counters we log it once and report none.
+ */
+class hardwareCounters {
+public:
+  struct counts {
+    uint64_t cycles = 0;
+    uint64_t userCycles = 0;
+    uint64_t userInstructions = 0;
+    uint64_t contextSwitches = 0;
+
+    uint64_t kernelCycles() const {
+      return cycles > userCycles ? cycles - userCycles : 0;
+    }
+
+    void add(const counts& other) {
+      cycles += other.cycles;
+      userCycles += other.userCycles;
+      userInstructions += other.userInstructions;
+      contextSwitches += other.contextSwitches;
+    }
+  };
+
+  /** @param enabled start counting the tracer's thread, the caller. */
+  hardwareCounters(bool enabled, logger& log);
+  ~hardwareCounters();
+  hardwareCounters(const hardwareCounters&) = delete;
+  hardwareCounters& operator=(const hardwareCounters&) = delete;
+
+  bool enabled() const { return supported; }
+
+  /** Start counting tid. */
+  void attach(pid_t tid);
+
+  /** tid exited, add its counts to the tracees'. Fine on unknown tids. */
+  void detach(pid_t tid);
+
+  /** Counts of the tracer's thread so far. */
+  counts tracer() const;
+
+  /** Counts of every tracee so far, exited or not. */
+  counts tracees() const;
+
+  /**
+   * The counts as totals, named like the other statistics, and the split of
+   * all cycles between tracees, kernel and tracer as a line to print.
+   */
+  vector<pair<string, uint64_t>> totals() const;
+  string split() const;
+
+private:
+  /** Open a group on tid (0 for ourselves), empty on failure. */
+  vector<int> openGroup(pid_t tid);
+
+  /** Read and scale the group of fds into c. @return false on failure. */
+  static bool readGroup(const vector<int>& fds, counts& c);
+
+  static void closeGroup(const vector<int>& fds);
+
+  logger& log;
+  bool supported;
+  vector<int> tracerGroup;
+  unordered_map<pid_t, vector<int>> groups;
+  /** Of tracees that exited. */
+  counts exited;
+};
+
+#endif
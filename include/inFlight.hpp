@@ -0,0 +1,81 @@
+#ifndef IN_FLIGHT_H
+#define IN_FLIGHT_H
+
+#include <vector>
+
+using namespace std;
+
+/**
+ * Scratch a tracee only needs while some system call is in flight, e.g. the fd
+ * sets of a select, so that a state doesn't carry it the rest of the time.
+ * Taken from a free list on first use and given back by release().
+ *
+ * The tracer is single threaded, the free lists are not locked. A copy of a
+ * state is a new tracee with nothing in flight, so copies start out empty.
+ */
+template <typename T>
+class inFlight {
+public:
+  inFlight() = default;
+
+  inFlight(const inFlight&) {}
+
+  inFlight(inFlight&& other) : value(other.value) { other.value = nullptr; }
+
+  inFlight& operator=(const inFlight& other) {
+    if (this != &other) {
+      release();
+    }
+    return *this;
+  }
+
+  ~inFlight() { release(); }
+
+  /** Whether we hold a value, since the last fresh() or get(). */
+  bool active() const { return value != nullptr; }
+
+  /** The value, a value initialized T if we held none. */
+  T& get() {
+    if (value == nullptr) {
+      value = take();
+    }
+    return *value;
+  }
+
+  /** A value initialized T, dropping the one we held. */
+  T& fresh() {
+    T& v = get();
+    v = T();
+    return v;
+  }
+
+  /** Give the value back to the free list, if we held one. */
+  void release() {
+    if (value != nullptr) {
+      freeList().push_back(value);
+      value = nullptr;
+    }
+  }
+
+private:
+  static vector<T*>& freeList() {
+    // Never freed, tracees come and go the whole run.
+    static vector<T*>* list = new vector<T*>();
+    return *list;
+  }
+
+  static T* take() {
+    vector<T*>& list = freeList();
+    if (list.empty()) {
+      return new T();
+    }
+    T* v = list.back();
+    list.pop_back();
+    *v = T();
+    return v;
+  }
+
+  T* value = nullptr;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef INODE_SNAPSHOT_H
+#define INODE_SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "ValueMapper.hpp"
+#include "globalState.hpp"
+
+using namespace std;
+
+/**
+ * On disk snapshot of globalState's inodeMap and mtimeMap, written by
+ * --inode-snapshot at exit and loaded back at startup by the next run.
+ *
+ * A second dettrace run over the same tree then starts with every inode it
+ * saw before already virtualized, to the same virtual inode, and every file
+ * created before keeps its logical mtime. Snapshots carry a fingerprint of
+ * the chroot and working directory they were taken in, one taken anywhere
+ * else is ignored.
+ *
+ * A snapshot is an inodeSnapshotHeader, inodeCount inodeSnapshotEntries of
+ * (real inode, virtual inode) then mtimeCount of (real inode, logical mtime
+ * in microseconds). Native endian, like trace files.
+ */
+
+/** Bump when inodeSnapshotHeader or inodeSnapshotEntry change. */
+const uint32_t INODE_SNAPSHOT_VERSION = 1;
+
+/** First bytes of every snapshot. */
+const char INODE_SNAPSHOT_MAGIC[8] = {'D', 'E', 'T', 'I', 'N', 'O', 'D', 'E'};
+
+struct inodeSnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entrySize; /*< sizeof(inodeSnapshotEntry) of the writer. */
+  uint64_t fingerprint; /*< @see snapshotFingerprint */
+  uint64_t freshInode; /*< Next virtual inode inodeMap hands out. */
+  uint64_t inodeCount;
+  uint64_t mtimeCount;
+};
+
+struct inodeSnapshotEntry {
+  uint64_t realInode;
+  int64_t value;
+};
+
+/**
+ * Fingerprint of the tree a run sees: the paths given, and the device and
+ * inode of each, so a tree recreated at the same path doesn't match.
+ */
+uint64_t snapshotFingerprint(const vector<string>& paths);
+
+/**
+ * Load the snapshot at path into inodeMap and mtimeMap, which should be empty.
+ * @return number of inodes loaded, 0 if there is no snapshot at path or it
+ * doesn't match fingerprint, so this run starts from scratch.
+ */
+size_t loadInodeSnapshot(
+    const string& path,
+    uint64_t fingerprint,
+    ValueMapper<ino_t, ino_t>& inodeMap,
+    ModTimeMap& mtimeMap,
+    logger& log);
+
+/**
+ * Replace the snapshot at path with inodeMap and mtimeMap. Written next to it
+ * and renamed over it, so a crash leaves the old snapshot intact.
+ */
+void saveInodeSnapshot(
+    const string& path,
+    uint64_t fingerprint,
+    const ValueMapper<ino_t, ino_t>& inodeMap,
+    const ModTimeMap& mtimeMap);
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Log of the nondeterministic inputs of a run with --network or --real-proc:
+ * the bytes reads of remote sockets and of the real /proc returned, and the
+ * results of the other system calls on remote sockets. --record-inputs writes
+ * it, --replay-inputs serves the inputs from it without touching the network.
+ *
+ * A log is an inputLogHeader followed by chunks, each an inputChunkHeader and
+ * zlib compressed records. A record is an inputRecord followed by the bytes
+ * of its buffers. Runs are deterministic, so a replay asks for the inputs in
+ * the order they were recorded, anything else means the run diverged. Native
+ * endian, like trace files.
+ */
+
+/** Bump when the layout of the header, chunks or records changes. */
+const uint32_t INPUT_LOG_VERSION = 1;
+
+/** First bytes of every input log. */
+const char INPUT_LOG_MAGIC[8] = {'D', 'T', 'I', 'N', 'P', 'U', 'T', 'S'};
+
+struct inputLogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize; /*< sizeof(inputRecord) of the writer. */
+};
+
+struct inputChunkHeader {
+  uint32_t rawBytes; /*< Size of the records once uncompressed. */
+  uint32_t compressedBytes; /*< Size of the chunk after this header. */
+};
+
+/** Buffers an input has at most, e.g. recvfrom's data and address. */
+const int INPUT_BUFFERS = 2;
+
+/** One input, followed by its buffers. */
+struct inputRecord {
+  int32_t systemCall;
+  int32_t fd; /*< First argument, the fd the input came from. */
+  int64_t returnValue;
+  uint32_t bufferBytes[INPUT_BUFFERS];
+};
+
+static_assert(sizeof(inputRecord) == 24, "inputRecord layout changed");
+
+class inputLog {
+public:
+  /**
+   * Create (or truncate) the log at path to record to, or with replay, open
+   * it to replay from. Exits if it can't, or it isn't an input log.
+   */
+  inputLog(const string& path, bool replay);
+
+  /** Writes the last chunk out, when recording. */
+  ~inputLog();
+
+  inputLog(const inputLog&) = delete;
+  inputLog& operator=(const inputLog&) = delete;
+
+  bool replaying() const { return isReplay; }
+
+  /** Append an input, with its buffers. */
+  void record(
+      const inputRecord& input, const char* const buffers[INPUT_BUFFERS]);
+
+  /**
+   * The next input, which must be systemCall on fd, otherwise the run took
+   * another path than the recorded one and we exit. buffers are set to its
+   * bytes, valid until the next call.
+   */
+  const inputRecord& next(
+      int systemCall, int fd, const char* buffers[INPUT_BUFFERS]);
+
+  /** Inputs recorded or replayed so far. */
+  uint64_t inputs = 0;
+  /** Bytes of records, uncompressed and compressed. */
+  uint64_t rawBytes = 0;
+  uint64_t compressedBytes = 0;
+
+private:
+  /** Records are compressed this many bytes at a time. */
+  static const size_t chunkSize = 256 * 1024;
+  /** Bytes of the file mapped and grown at a time. Multiple of page size. */
+  static const size_t windowSize = 16 * 1024 * 1024;
+
+  /** Compress pending and append it to the file. */
+  void writeChunk();
+
+  /** Append bytes to the file through the mapped window. */
+  void append(const char* bytes, size_t size);
+
+  /** Unmap the window and map the next one, growing the file. */
+  void mapNextWindow();
+
+  /** Uncompress the chunk at readOffset into chunk, false at the end. */
+  bool readChunk();
+
+  string path;
+  bool isReplay;
+  int fd = -1;
+
+  // Recording.
+  vector<char> pending; /**< Records of the chunk being filled. */
+  vector<char> compressed; /**< Scratch for writeChunk(). */
+  char* window = nullptr;
+  off_t windowStart = 0;
+  size_t windowUsed = 0;
+
+  // Replaying: the whole file is mapped.
+  const char* file = nullptr;
+  size_t fileSize = 0;
+  size_t readOffset = 0;
+  vector<char> chunk; /**< Records of the chunk being replayed. */
+  size_t chunkOffset = 0;
+  inputRecord current; /**< What next() returned last. */
+};
+
+#endif
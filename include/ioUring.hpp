@@ -0,0 +1,138 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * --io-uring: an io_uring instance of a tracee, mapped into the tracer through
+ * a duplicate of its fd.
+ *
+ * Rings are created disabled, and only enabled once restrictions are
+ * registered: SQEs may only be the operations listed in allowedOps, on plain
+ * fds, with IOSQE_IO_DRAIN set, and only buffers and probes may be
+ * registered. The kernel fails every other SQE with EACCES in its CQE, and
+ * every other registration. Those are opens, stats, directory reads, polls,
+ * timeouts and sockets, whose results we would have to virtualize the way
+ * their system calls are, or that depend on time.
+ *
+ * Before io_uring_enter submits, prepareSubmission() sets IOSQE_IO_DRAIN on
+ * every SQE, so each starts after all before it completed, and refuses the
+ * allowed operations on fds that aren't regular files, reads of pipes and
+ * sockets being as racy through a ring as without. After it, the tracee
+ * waits until settled(), and orderCompletions() puts the new CQEs in
+ * submission order: what its CQ ring holds never depends on how fast the
+ * kernel was. SQEs that fail as they are submitted, the refused ones, post
+ * their CQEs right away, ahead of earlier ones still running.
+ */
+class ioUring {
+public:
+  /**
+   * Whether we can make rings as described, Linux 5.10 with io_uring
+   * enabled. Tried on a ring of our own, once.
+   */
+  static bool supported();
+
+  /**
+   * io_uring_setup flags tracees may ask for. SQPOLL and IOPOLL rings
+   * complete on their own, R_DISABLED ones are restricted by the tracee,
+   * the other flags change the rings' layout in ways we don't read.
+   */
+  static const uint32_t setupFlags;
+
+  /**
+   * io_uring_setup flags we ask for instead of flags: disabled, and without
+   * SINGLE_ISSUER, as we are the one enabling the ring.
+   */
+  static uint32_t setupFlagsFor(uint32_t flags);
+
+  /**
+   * Take over the ring of ourFd, set up with params as io_uring_setup
+   * returned them: map it, restrict it and enable it. nullptr if we could
+   * not, ourFd is closed either way once the ring is gone.
+   */
+  static shared_ptr<ioUring> attach(int ourFd, const io_uring_params& params);
+
+  ~ioUring();
+
+  /**
+   * Ready up to toSubmit SQEs io_uring_enter is about to submit, see
+   * ioUring. Their user_data is swapped for a sequence number of ours until
+   * orderCompletions(). regularFile tells the tracee's fds that are regular
+   * files.
+   * @return how many of them were refused.
+   */
+  uint32_t prepareSubmission(
+      uint32_t toSubmit, const function<bool(int)>& regularFile);
+
+  /**
+   * After io_uring_enter: give the SQEs prepared but not submitted, the
+   * call having failed or stopped at an SQE that did, their user_data back.
+   */
+  void finishSubmission();
+
+  /**
+   * Whether every SQE the kernel took has its CQE, or the CQ ring is full,
+   * the rest waiting in the kernel's overflow list for room.
+   */
+  bool settled() const;
+
+  /** min_complete of an io_uring_enter waiting until settled(). */
+  uint32_t unsettled() const;
+
+  /**
+   * Sort the CQEs posted since the last call by when their SQEs were
+   * prepared, and give them their user_data back.
+   */
+  void orderCompletions();
+
+  /** SQEs prepared. */
+  uint64_t submitted = 0;
+
+private:
+  ioUring() = default;
+
+  /** The SQE at position of the SQ ring, nullptr if its index is invalid. */
+  io_uring_sqe* sqeAt(uint32_t position) const;
+
+  int fd = -1;
+  void* sqRing = nullptr;
+  size_t sqRingSize = 0;
+  void* cqRing = nullptr;
+  size_t cqRingSize = 0;
+  void* sqes = nullptr;
+  size_t sqesSize = 0;
+  size_t sqeSize = sizeof(io_uring_sqe);
+
+  uint32_t* sqHead;
+  uint32_t* sqTail;
+  uint32_t sqMask;
+  uint32_t sqEntries;
+  uint32_t* sqDropped;
+  /** nullptr with IORING_SETUP_NO_SQARRAY, SQEs are then in ring order. */
+  uint32_t* sqArray = nullptr;
+  uint32_t* cqHead;
+  uint32_t* cqTail;
+  uint32_t cqMask;
+  uint32_t cqEntries;
+  char* cqes;
+  size_t cqeSize = sizeof(io_uring_cqe);
+
+  /** Sequence number of the next SQE prepared. */
+  uint64_t nextSequence = 0;
+  /** user_data of the SQEs prepared whose CQEs are yet to be ordered. */
+  unordered_map<uint64_t, uint64_t> userData;
+  /** SQ ring positions prepareSubmission() went through last. */
+  uint32_t preparedFrom = 0;
+  uint32_t preparedTo = 0;
+  /** CQ ring position orderCompletions() got to. */
+  uint32_t orderedTo = 0;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef JOB_ADMISSION_H
+#define JOB_ADMISSION_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * dettrace --server's budget of cores and memory for the jobs it runs at once,
+ * --server-cores and --server-memory. A job holds a core, its tracer and
+ * tracee pinned to it: with the tracer serializing the tracees, a job hardly
+ * ever keeps more than one core busy. It holds --job-memory bytes for its
+ * tracees. Jobs that don't fit wait for one to finish.
+ *
+ * Cores are handed out spreading jobs over NUMA nodes, from the node with the
+ * most free cores, so jobs get the memory bandwidth of a node to share with
+ * as few others as there are. None of this is seen by the jobs, apart from
+ * when they run, and so none of it changes their results.
+ */
+class jobAdmission {
+public:
+  /** A core jobs may be pinned to, and the NUMA node it is on. */
+  struct core {
+    int cpu;
+    int node;
+  };
+
+  /**
+   * @param cores jobs get, each runs one job at a time.
+   * @param memoryBytes jobs may hold in total, 0 if memory doesn't count.
+   * @param jobBytes a job holds.
+   */
+  jobAdmission(vector<core> cores, uint64_t memoryBytes, uint64_t jobBytes);
+
+  /**
+   * The first count cores we may run on, on their NUMA nodes, all of them if
+   * count is 0 or more than we have.
+   */
+  static vector<core> hostCores(unsigned count);
+
+  /** "0-3,8,10-11", as the kernel lists cpus, into their numbers. */
+  static vector<int> parseCpuList(const string& list);
+
+  /**
+   * Take a core and the memory of a job, -1 if either is used up.
+   * @return the cpu of the core.
+   */
+  int admit();
+
+  /** A job on cpu finished, its core and memory are free again. */
+  void release(int cpu);
+
+  unsigned running() const { return jobs; }
+
+private:
+  vector<core> cores;
+  /** By index of cores. */
+  vector<bool> taken;
+  uint64_t memoryBytes;
+  uint64_t jobBytes;
+  unsigned jobs = 0;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef JOB_CGROUP_H
+#define JOB_CGROUP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * --cgroup: the cgroup v2 a job's tracees run in, a child of a cgroup the user
+ * delegated to us. It gives us what the job used, cpu.stat, memory.peak and
+ * io.stat, and kills a whole tree of tracees with one write to cgroup.kill
+ * rather than one kill(2) per pid. Optional cpu.max and memory.max limits keep
+ * jobs packed on one host from starving each other.
+ *
+ * The tracer stays outside: what the job used is the tracees' alone, and
+ * killing them doesn't kill us. Moving a tracee in needs write access to
+ * cgroup.procs of the nearest cgroup holding both ours and the job's.
+ */
+class jobCgroup {
+public:
+  /**
+   * A new cgroup under parent, with the cpu, memory and io controllers turned
+   * on where the parent lets us.
+   * @param cpus CPUs of time the job may use at once, 0 for no limit.
+   * @param memoryBytes memory the job may use, 0 for no limit.
+   * Throws a runtimeError if we can't make it or set a limit.
+   */
+  jobCgroup(const string& parent, double cpus, uint64_t memoryBytes);
+
+  /** Kills every process still in it, and removes it. */
+  ~jobCgroup();
+
+  jobCgroup(const jobCgroup&) = delete;
+  jobCgroup& operator=(const jobCgroup&) = delete;
+
+  /** Move pid in; the children it forks from now on are born in it. */
+  void add(pid_t pid);
+
+  /**
+   * SIGKILL every process in it at once. Kernels before 5.14 have no
+   * cgroup.kill, then every pid of cgroup.procs gets its own kill.
+   */
+  void killAll();
+
+  /**
+   * What the job used so far, named like the other statistics. Entries of a
+   * controller the parent didn't give us are left out.
+   */
+  vector<pair<string, uint64_t>> totals() const;
+
+  const string& path() const { return dir; }
+
+private:
+  /** Write contents to file of ours, false if we can't. */
+  bool writeFile(const string& file, const string& contents) const;
+
+  /** Contents of file of ours, "" if we can't read it. */
+  string readFile(const string& file) const;
+
+  string dir;
+};
+
+#endif
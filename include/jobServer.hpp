@@ -0,0 +1,75 @@
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A dettrace invocation sent to `dettrace --server`, see runServer in main.cpp.
+ * The server runs it with the client's arguments, environment, working
+ * directory and standard streams, as if the client had run it itself.
+ */
+struct dettraceJob {
+  /** Namespaces the job runs in, as the client's options ask for. */
+  uint64_t cloneFlags = 0;
+  /**
+   * The client's options, other than what the program itself gets. Jobs with
+   * the server's key may run on a zygote set up with the server's options.
+   */
+  string templateKey;
+  /** The client's command line, argv[0] included. */
+  vector<string> argv;
+  /** The client's environment, as NAME=value strings. */
+  vector<string> env;
+
+  // What the client's options resolved to, all a zygote still needs.
+  /** Program and arguments to run. */
+  vector<string> program;
+  /** Environment the program gets, as NAME=value strings. */
+  vector<string> programEnv;
+  /** Working directory the program starts in. */
+  string workdir;
+
+  /** Core the server runs the job on, -1 for any, see jobAdmission. */
+  int32_t cpu = -1;
+
+  /** stdin, stdout, stderr and the working directory. */
+  int fds[4] = {-1, -1, -1, -1};
+};
+
+/**
+ * Listen on a unix socket at path, only we may connect to, replacing a stale
+ * socket file. Anything else at path is left alone. Exits on failure, like
+ * doWithCheck.
+ */
+int listenOnSocket(const string& path);
+
+/**
+ * Accept a client of listener. -1 with errno set on failure, EPERM if the
+ * client runs as another user.
+ */
+int acceptClient(int listener);
+
+/** Connect to the unix socket at path, -1 with errno set on failure. */
+int connectToSocket(const string& path);
+
+/** Send job over sock, fds included. False with errno set on failure. */
+bool sendJob(int sock, const dettraceJob& job);
+
+/**
+ * Receive a job sent by sendJob. Its fds are new close-on-exec descriptors.
+ * False on failure or if the other end hung up.
+ */
+bool receiveJob(int sock, dettraceJob& job);
+
+/** Send the wait status of a finished job, the server's reply to a job. */
+bool sendJobStatus(int sock, int32_t status);
+
+/** Wait for the reply to a job, false if the server hung up first. */
+bool receiveJobStatus(int sock, int32_t& status);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#include <array>
+
+using namespace std;
+
+/**
+ * Log scale histogram of durations in nanoseconds, HDR style: every power of
+ * two is split in subBuckets linear buckets, so a value is known to within
+ * 1/subBuckets of itself, whatever its size. Recording is a few instructions
+ * and the memory fixed, cheap enough to keep one per system call all run.
+ */
+class latencyHistogram {
+public:
+  void record(uint64_t value) {
+    counts[bucketOf(value)]++;
+    total++;
+    sum += value;
+    if (value > maxValue) {
+      maxValue = value;
+    }
+  }
+
+  uint64_t count() const { return total; }
+
+  uint64_t max() const { return maxValue; }
+
+  /** Exact mean of the values, 0 if there are none. */
+  uint64_t mean() const { return total == 0 ? 0 : sum / total; }
+
+  /**
+   * Smallest bucket bound at or below which a fraction p of the values fall,
+   * never more than the biggest value recorded. 0 if there are none.
+   */
+  uint64_t percentile(double p) const {
+    uint64_t wanted = (uint64_t)(p * total + 0.999999);
+    if (wanted == 0) {
+      wanted = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size() && total != 0; i++) {
+      seen += counts[i];
+      if (seen >= wanted) {
+        uint64_t bound = highestIn(i);
+        return bound < maxValue ? bound : maxValue;
+      }
+    }
+    return maxValue;
+  }
+
+private:
+  static const unsigned subBucketBits = 3;
+  static const unsigned subBuckets = 1 << subBucketBits;
+  /** Values below subBuckets get a bucket each, then 8 per power of two. */
+  static const size_t bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+  static size_t bucketOf(uint64_t value) {
+    if (value < subBuckets) {
+      return value;
+    }
+    unsigned magnitude = 63 - __builtin_clzll(value);
+    unsigned shift = magnitude - subBucketBits;
+    return (shift + 1) * subBuckets + ((value >> shift) & (subBuckets - 1));
+  }
+
+  /** Biggest value that lands in bucket i. */
+  static uint64_t highestIn(size_t i) {
+    if (i < subBuckets) {
+      return i;
+    }
+    unsigned shift = i / subBuckets - 1;
+    uint64_t lowest = (subBuckets + i % subBuckets) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+  }
+
+  array<uint32_t, bucketCount> counts{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t maxValue = 0;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef LIVE_STATS_H
+#define LIVE_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "systemCallList.hpp"
+
+using namespace std;
+
+/**
+ * Statistics page written by --live-stats and read by dettrace-top, to watch
+ * a long run as it goes rather than only at exit with --print-statistics.
+ *
+ * The file is one liveStatsPage, mapped shared by the tracer, which copies its
+ * counters in every so often, see liveStatsWriter. Readers map it read only
+ * and copy it out under the seqlock in sequence, see readLiveStats, so reading
+ * costs the tracer nothing. Native endian, like the trace file.
+ */
+
+/** Bump when the layout of liveStatsPage changes. */
+const uint32_t LIVE_STATS_VERSION = 1;
+
+/** First bytes of every live statistics file. */
+const char LIVE_STATS_MAGIC[8] = {'D', 'E', 'T', 'S', 'T', 'A', 'T', 'S'};
+
+/** One of the totals --print-statistics prints, by the same name. */
+struct liveStatsTotal {
+  char name[56]; /*< NUL terminated, cut short if too long. */
+  uint64_t value;
+};
+
+/** Counters of one system call, see syscallStats::counters. */
+struct liveStatsSystemCall {
+  uint64_t preHooks;
+  uint64_t postHooks;
+  uint64_t replays;
+};
+
+struct liveStatsPage {
+  static const uint32_t maxTotals = 128;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t pageSize; /*< sizeof(liveStatsPage) of the writer. */
+  /** Odd while the tracer is copying counters in. */
+  atomic<uint64_t> sequence;
+  int32_t tracerPid;
+  uint32_t finished; /*< 1 once the run is over, the counters are final. */
+  uint64_t updates; /*< Times the counters were copied in. */
+  uint64_t elapsedNanos; /*< Since the run started, at the last update. */
+  uint32_t totalCount;
+  uint32_t padding;
+  liveStatsTotal totals[maxTotals];
+  liveStatsSystemCall systemCalls[SYSTEM_CALL_COUNT];
+};
+
+static_assert(
+    sizeof(atomic<uint64_t>) == sizeof(uint64_t),
+    "liveStatsPage needs a plain 64 bit sequence");
+
+/**
+ * Copy page into copy as of one update of the writer, retrying while it is
+ * being written. @return false if page isn't a live statistics page we can
+ * read.
+ */
+inline bool readLiveStats(const liveStatsPage* page, liveStatsPage* copy) {
+  if (memcmp(page->magic, LIVE_STATS_MAGIC, sizeof(LIVE_STATS_MAGIC)) != 0 ||
+      page->version != LIVE_STATS_VERSION ||
+      page->pageSize != sizeof(liveStatsPage)) {
+    return false;
+  }
+  for (;;) {
+    uint64_t before = page->sequence.load(memory_order_acquire);
+    if (before % 2 == 1) {
+      continue;
+    }
+    // Plain copy, a torn one is thrown away below. The sequence is copied
+    // along, as a plain word.
+    memcpy((void*)copy, (const void*)page, sizeof(liveStatsPage));
+    atomic_thread_fence(memory_order_acquire);
+    if (page->sequence.load(memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+}
+
+class syscallStats;
+
+/**
+ * The tracer's side of a live statistics file: creates it and copies counters
+ * in under the seqlock. The file stays behind at exit, with the final counters.
+ */
+class liveStatsWriter {
+public:
+  /** Creates (or truncates) the file at path and maps it. */
+  explicit liveStatsWriter(const string& path);
+
+  ~liveStatsWriter();
+
+  liveStatsWriter(const liveStatsWriter&) = delete;
+  liveStatsWriter& operator=(const liveStatsWriter&) = delete;
+
+  /**
+   * Copy totals and the per system call counters of stats, if not null, into
+   * the page. With finished, they are the last.
+   */
+  void publish(
+      const vector<pair<string, uint64_t>>& totals,
+      const syscallStats* stats,
+      uint64_t elapsedNanos,
+      bool finished);
+
+  /**
+   * Whether it is time to publish again, looked at every stop. Reads the time
+   * only every checkStops calls.
+   */
+  bool due();
+
+private:
+  static const uint32_t checkStops = 256;
+  static const uint64_t publishEveryNanos = 200 * 1000 * 1000;
+
+  int fd;
+  liveStatsPage* page;
+  uint32_t stopsUntilCheck = checkStops;
+  uint64_t lastPublish = 0;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LOG_FILTER_H
+#define LOG_FILTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * --log-filter: which part of a run to log, so one misbehaving subprocess can
+ * be debugged at --debug 5 without logging the whole build. Terms are
+ * separated by spaces, a term's values by commas:
+ *
+ *     pid=1204,1210          those threads, or every thread of those groups
+ *     exe=*cc1,*bin/ld       thread groups that execed a matching path, fnmatch
+ *     syscall=openat,read    stops of those system calls
+ *     time=5000-6000         logical time, microseconds since the --epoch
+ *     entry=1a000-1b000      log entry ids, hex as the log prints them
+ *
+ * A message is logged if every term given matches, either end of a range may be
+ * left open. Filtered out messages still take their log entry id, so lines
+ * keep the ids they have in an unfiltered log of the same run.
+ *
+ * The execution tells the logger which event is being handled, see
+ * logger::setContext, this decides once per event. A forked child starts out
+ * matching exe= if its parent did, until it execs.
+ */
+class logFilter {
+public:
+  /** Parse a --log-filter, bad terms are runtimeErrors. */
+  static logFilter parse(const string& text);
+
+  /** True without terms, everything is logged. */
+  bool empty() const;
+
+  /**
+   * Whether messages about thread tid of group tgid are logged, in system
+   * call syscallNum (-1 outside one) at logical time `time`.
+   */
+  bool keeps(pid_t tid, pid_t tgid, int syscallNum, int64_t time) const;
+
+  /** Whether the message with log entry id `entry` is logged. */
+  bool keepsEntry(uint64_t entry) const {
+    if (entries.empty()) {
+      return true;
+    }
+    for (auto& range : entries) {
+      if (range.first <= entry && entry <= range.second) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Whether execed() needs to be told the path, there are exe= terms. */
+  bool matchesExecs() const { return !exes.empty(); }
+
+  /** Thread group tgid execed path. */
+  void execed(pid_t tgid, const string& path);
+
+  /** Process parent forked child, which matches exe= as its parent does. */
+  void forked(pid_t parent, pid_t child);
+
+private:
+  vector<pid_t> pids;
+  vector<string> exes;
+  /** Thread groups whose last exec matched exes. */
+  unordered_set<pid_t> execMatches;
+  /** Indexed by system call number, empty for any system call. */
+  vector<bool> syscalls;
+  vector<pair<int64_t, int64_t>> times;
+  vector<pair<uint64_t, uint64_t>> entries;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef LOG_MERGE_H
+#define LOG_MERGE_H
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <istream>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Reading back the shards of a --log-shards run, for dettrace-log-merge. Each
+ * shard has its entries in the order they were logged, so a k-way merge by
+ * log entry id gives the log of the whole run, as if it had been one file.
+ *
+ * An entry is a line "[3]INTER 1a2b @57 message", a tag, the entry id in hex
+ * and the logical time of its event, followed by the lines of the message
+ * that don't start like one.
+ */
+
+/** The entry id of a line starting an entry, false for any other line. */
+inline bool logEntryOf(const string& line, uint64_t& id) {
+  if (line.size() < 4 || line[0] != '[' || line[2] != ']') {
+    return false;
+  }
+  size_t tagEnd = line.find(' ', 3);
+  if (tagEnd == string::npos) {
+    return false;
+  }
+  size_t idStart = line.find_first_not_of(' ', tagEnd);
+  if (idStart == string::npos || !isxdigit((unsigned char)line[idStart])) {
+    return false;
+  }
+  char* idEnd;
+  id = strtoull(line.c_str() + idStart, &idEnd, 16);
+  return *idEnd == ' ' || *idEnd == '\0';
+}
+
+/** The entries of one shard, in order. */
+class logShardReader {
+public:
+  explicit logShardReader(istream& in) : in(in) {
+    haveLine = (bool)getline(in, line);
+  }
+
+  /**
+   * The next entry, its lines newline terminated, false at the end. Lines
+   * before a shard's first entry come as an entry of id 0.
+   */
+  bool next(uint64_t& id, string& text) {
+    if (!haveLine) {
+      return false;
+    }
+    id = 0;
+    logEntryOf(line, id);
+    text = line + "\n";
+    uint64_t nextId;
+    while ((haveLine = (bool)getline(in, line)) && !logEntryOf(line, nextId)) {
+      text += line + "\n";
+    }
+    return true;
+  }
+
+private:
+  istream& in;
+  /** The line after the last entry read, if haveLine. */
+  string line;
+  bool haveLine;
+};
+
+/** Write the entries of all of shards to out, by entry id. */
+inline void mergeLogShards(const vector<istream*>& shards, ostream& out) {
+  vector<logShardReader> readers;
+  vector<string> texts(shards.size());
+  // Smallest id first, then the shard given first.
+  typedef pair<uint64_t, size_t> head;
+  priority_queue<head, vector<head>, greater<head>> heads;
+  for (size_t i = 0; i < shards.size(); i++) {
+    readers.emplace_back(*shards[i]);
+    uint64_t id;
+    if (readers[i].next(id, texts[i])) {
+      heads.push({id, i});
+    }
+  }
+  while (!heads.empty()) {
+    size_t i = heads.top().second;
+    heads.pop();
+    out << texts[i];
+    uint64_t id;
+    if (readers[i].next(id, texts[i])) {
+      heads.push({id, i});
+    }
+  }
+}
+
+#endif
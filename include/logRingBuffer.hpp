@@ -0,0 +1,86 @@
+#ifndef LOG_RING_BUFFER_H
+#define LOG_RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Lock-free single producer, single consumer byte ring buffer.
+ * The tracer thread appends formatted log lines, the logger's writer thread
+ * drains them with large write() calls. Bytes come out in exactly the order
+ * they went in, so the logEntryID ordering of the log is unchanged.
+ *
+ * head and tail are free running counters; their difference is the number of
+ * unread bytes. Each is only ever stored by one side, so acquire/release
+ * ordering is all the synchronization needed.
+ */
+class logRingBuffer {
+public:
+  /**
+   * Constructor.
+   * @param capacity size of the buffer in bytes, must be a power of two.
+   */
+  explicit logRingBuffer(size_t capacity)
+      : buffer(capacity), mask(capacity - 1) {}
+
+  /**
+   * Producer side: copy as many bytes of data as currently fit.
+   * @return number of bytes copied, zero if the buffer is full.
+   */
+  size_t push(const char* data, size_t length) {
+    uint64_t h = head.load(memory_order_relaxed);
+    uint64_t t = tail.load(memory_order_acquire);
+    size_t n = min(length, (size_t)(buffer.size() - (h - t)));
+    size_t start = h & mask;
+    size_t first = min(n, buffer.size() - start);
+    memcpy(&buffer[start], data, first);
+    memcpy(&buffer[0], data + first, n - first);
+    head.store(h + n, memory_order_release);
+    return n;
+  }
+
+  /**
+   * Consumer side: find the largest contiguous run of unread bytes.
+   * @param data set to the start of the run.
+   * @return length of the run, zero if the buffer is empty.
+   */
+  size_t peek(const char** data) const {
+    uint64_t t = tail.load(memory_order_relaxed);
+    uint64_t h = head.load(memory_order_acquire);
+    size_t start = t & mask;
+    *data = &buffer[start];
+    return min((size_t)(h - t), buffer.size() - start);
+  }
+
+  /**
+   * Consumer side: release n bytes returned by peek() once they are written.
+   */
+  void consume(size_t n) {
+    tail.store(tail.load(memory_order_relaxed) + n, memory_order_release);
+  }
+
+  /**
+   * True once the consumer has released everything the producer pushed.
+   * Safe to call from either side.
+   */
+  bool empty() const {
+    return tail.load(memory_order_acquire) == head.load(memory_order_acquire);
+  }
+
+private:
+  vector<char> buffer;
+  const size_t mask;
+  /** Written by the producer only. Kept on its own cache line. */
+  alignas(64) atomic<uint64_t> head{0};
+  /** Written by the consumer only. */
+  alignas(64) atomic<uint64_t> tail{0};
+};
+
+#endif
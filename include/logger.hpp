@@ -5,9 +5,15 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
+#include "logFilter.hpp"
+#include "logRingBuffer.hpp"
 #include "util.hpp"
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 using namespace std;
 
@@ -30,10 +36,28 @@ enum class Color {
   blue,
 };
 
+struct logCompressor;
+
 /**
  * Simple logger.
  * Write debug info and other information of interest to a file without
  * polluting stderr or stdout. Based off the detmonad libdet logger.
+ *
+ * When writing to a log file, messages are handed to a background writer
+ * thread through a logRingBuffer instead of being flushed one line at a time.
+ * Pending output is flushed on runtimeError(), exit(), uncaught exceptions and
+ * fatal signals, so the last lines before a failure still make it to disk.
+ * Logging to stderr stays synchronous so it interleaves with our other output.
+ *
+ * A log file named *.gz is gzip compressed by the writer thread, as a series
+ * of gzip members of about logFrameBytes each. Every member decodes on its own
+ * and zcat reads them as one stream, so the log of a run that crashed is
+ * readable up to its last complete member: zgrep it.
+ *
+ * With shardByThreadGroup, messages about a thread group go to a file of their
+ * own next to the log instead, see setContext. Entries keep their global log
+ * entry id and get the logical time of their event, so dettrace-log-merge can
+ * put the shards back in the order they were logged, see logMerge.hpp.
  */
 class logger {
 public:
@@ -41,12 +65,21 @@ public:
    * Constructor.
    * Requires file to write to and debug level to use.
    * @param logFile: Path to write log file to. A unique suffix will be
-   * appended.
+   * appended, before the .gz of a compressed log.
    * @param debugLevel debugging level
    * @param useColor whether to use color in logging (default true)
    */
   logger(string logFile, int debugLevel, bool useColor = true);
 
+  /**
+   * Destructor.
+   * Flushes pending output and stops the writer thread.
+   */
+  ~logger();
+
+  logger(const logger&) = delete;
+  logger& operator=(const logger&) = delete;
+
   /**
    * Logging wrapper for printf.
    * Decides wether to print based on debug level.
@@ -67,6 +100,93 @@ public:
   /** Just like writeToLog() but don't interpret % codes in the string */
   void writeToLogNoFormat(Importance imp, std::string s);
 
+  /**
+   * Whether a message of importance imp would be printed at our debug level.
+   * Inline so callers can skip building messages that would be thrown away.
+   * Importance::extra is compiled out entirely when built with
+   * DETTRACE_NO_EXTRA_LOG.
+   * @see DETTRACE_LOG
+   */
+  bool isEnabled(Importance imp) const {
+    switch (imp) {
+    case Importance::inter:
+      return debugLevel >= 2;
+    case Importance::info:
+      return debugLevel >= 4;
+    case Importance::extra:
+#ifdef DETTRACE_NO_EXTRA_LOG
+      return false;
+#else
+      return debugLevel >= 5;
+#endif
+    }
+    return false;
+  }
+
+  /**
+   * With isEnabled(imp): whether the --log-filter lets the next message
+   * through. A message it drops still takes its log entry id.
+   * @see DETTRACE_LOG
+   */
+  bool passesFilter() {
+    if (!filter) {
+      return true;
+    }
+    if (contextKept && filter->keepsEntry(logEntryID)) {
+      return true;
+    }
+    logEntryID++;
+    return false;
+  }
+
+  /** Only log what filter keeps from now on. */
+  void filterBy(const logFilter& filter);
+
+  /** The --log-filter, null without one. */
+  logFilter* getFilter() { return filter.get(); }
+
+  /**
+   * Write the messages about each thread group to the log's path followed by
+   * ".<thread group>", as plain text, and only what comes before the first
+   * setContext to the log itself. Needs a log file that isn't compressed.
+   */
+  void shardByThreadGroup();
+
+  /** Whether we shardByThreadGroup. */
+  bool isSharded() const { return !shardBase.empty(); }
+
+  /**
+   * With a filter or shards: the messages that follow are about thread tid of
+   * group tgid, in system call syscallNum (-1 outside one) at logical time
+   * `time`.
+   */
+  void setContext(pid_t tid, pid_t tgid, int syscallNum, int64_t time) {
+    contextGroup = tgid;
+    contextTime = time;
+    if (filter) {
+      contextKept = filter->keeps(tid, tgid, syscallNum, time);
+    }
+  }
+
+  /**
+   * Block until everything logged so far has been written out.
+   */
+  void flush();
+
+  /**
+   * Flush every live logger. Called by runtimeError() and our exit, terminate
+   * and fatal signal handlers. Only uses atomics and nanosleep, so it is safe
+   * to call from a signal handler.
+   */
+  static void flushAll();
+
+  /**
+   * Write out everything logged so far and stop the writer thread, so we can
+   * fork, then start it again. Logging in between blocks once the ring fills.
+   */
+  void pauseWriter();
+  void resumeWriter();
+
   /**
    * Set padding.
    */
@@ -102,15 +222,115 @@ private:
       useColor; /**< Flag to tell us to use colors or not! Useful for writing
                    output to files without annoying color sequences in file. */
 
-  FILE* fin; /**< File pointer to write to.   */
+  int logFd; /**< File descriptor to write to. */
+
+  /** Path of the log file, "" for stderr. */
+  string logPath;
+
+  /** Buffer between us and the writer thread, null when logging to stderr. */
+  unique_ptr<logRingBuffer> ring;
+
+  thread writer; /**< Drains ring into logFd. */
+
+  /** zlib state of a compressed log, null otherwise. */
+  unique_ptr<logCompressor> compressor;
+
+  /**
+   * Bytes handed to the ring, and bytes the writer has written out, whole
+   * members only when compressing: flush() waits for them to be equal.
+   */
+  atomic<uint64_t> bytesLogged{0};
+  atomic<uint64_t> bytesWritten{0};
+
+  atomic<bool> stopWriter{false}; /**< Tell writer to exit once drained. */
 
   bool padding; /**< Add a 2 space padding to the string to print. Useful for
                    nested messages. */
 
   uint64_t logEntryID = 0;
 
-  bool logPrintfFormattingEnabled; /**< Whether to enable interpretation of
-                                      printf format specifiers within log
-                                      messages */
+  /** --log-filter, and whether it keeps the event being handled. */
+  unique_ptr<logFilter> filter;
+  bool contextKept = true;
+
+  /** Thread group and logical time of the event being handled. */
+  pid_t contextGroup = 0;
+  int64_t contextTime = 0;
+
+  /**
+   * A thread group's shard. Written by the tracer thread in big writes of its
+   * own, reopened each time, so neither a lock nor an fd per thread group is
+   * held.
+   */
+  struct logShard {
+    string pending; /**< Logged, not written yet. */
+    bool created = false; /**< Truncated already, append from now on. */
+  };
+
+  /** Path shards are named after, "" unless isSharded(). */
+  string shardBase;
+  unordered_map<pid_t, logShard> shards;
+  /** Bytes pending over all shards. */
+  size_t shardBytesPending = 0;
+
+  /** Add line to the shard of contextGroup, writing shards out once big. */
+  void emitToShard(const string& line);
+
+  /** Write out what is pending for shard, of group. */
+  void writeShard(pid_t group, logShard& shard);
+
+  /** Write out what is pending for every shard. */
+  void flushShards();
+
+  /** Whether to enable interpretation of printf format specifiers within log
+   * messages */
+  bool logPrintfFormattingEnabled = true;
+
+  /**
+   * Hand a finished line to the writer thread, or write it directly when
+   * there is no ring. Blocks while the ring is full rather than dropping
+   * messages.
+   */
+  void emit(const string& line);
+
+  /**
+   * Writer thread body: copy ring contents to logFd with large writes until
+   * stopWriter is set and the ring is empty.
+   */
+  void drainRing();
+
+  /** Write all of data to logFd. @return false if we couldn't. */
+  bool writeOut(const char* data, size_t size);
+
+  /**
+   * Compress size bytes of data into the current gzip member, finishing it
+   * with finish. Writes out what zlib gives back.
+   */
+  void compressOut(const char* data, size_t size, bool finish);
+
+  /** Register/unregister this logger for flushAll(). */
+  void registerForFlush();
+  void unregisterForFlush();
 };
+/**
+ * Log a message through logger l, only evaluating the format and arguments if
+ * the message would actually be printed, by debug level and --log-filter.
+ * Use this instead of calling writeToLog directly, so quiet runs do not pay
+ * for building strings.
+ */
+#define DETTRACE_LOG(l, imp, ...)                   \
+  do {                                              \
+    if ((l).isEnabled(imp) && (l).passesFilter()) { \
+      (l).writeToLog(imp, __VA_ARGS__);             \
+    }                                               \
+  } while (0)
+
+/** Like DETTRACE_LOG but don't interpret % codes in the string. */
+#define DETTRACE_LOG_NO_FORMAT(l, imp, s)           \
+  do {                                              \
+    if ((l).isEnabled(imp) && (l).passesFilter()) { \
+      (l).writeToLogNoFormat(imp, s);               \
+    }                                               \
+  } while (0)
+
 #endif
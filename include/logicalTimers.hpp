@@ -0,0 +1,136 @@
+#ifndef LOGICAL_TIMERS_H
+#define LOGICAL_TIMERS_H
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <utility>
+
+#include "logicalclock.hpp"
+
+using namespace std;
+
+/** Which of a process's timers, see logicalTimers. */
+enum class timerKind {
+  real, /*< alarm and ITIMER_REAL. */
+  virtualTime, /*< ITIMER_VIRTUAL. */
+  prof, /*< ITIMER_PROF. */
+  posix, /*< timer_create, by timer id. */
+  timerfd, /*< timerfd_create, by its timerfdInfo::timer. */
+};
+
+/**
+ * What a timer is set to: time left until it goes off, zero if disarmed, and
+ * the period it goes off with after that, zero for one-shot timers.
+ */
+struct timerSetting {
+  logical_clock::duration value = logical_clock::duration::zero();
+  logical_clock::duration interval = logical_clock::duration::zero();
+
+  static timerSetting fromItimerspec(const struct itimerspec& spec);
+  static timerSetting fromItimerval(const struct itimerval& val);
+  struct itimerspec toItimerspec() const;
+  struct itimerval toItimerval() const;
+};
+
+/**
+ * The timers of a process: alarm, the interval timers, timer_create timers and
+ * timerfds, on the process's logical clock.
+ *
+ * Expirations are computed from logical time, never from the tracer's: a
+ * periodic timer read after three periods reports three expirations, and an
+ * overrun of two. Timers that raise a signal are kept ordered by expiry, then
+ * by the order they were armed in, execution::resumeTracee queues the signals
+ * of those that came due as the tracee's clock moved past them.
+ */
+class logicalTimers {
+public:
+  typedef pair<timerKind, uint64_t> timerKey;
+
+  /**
+   * Set key, which raises signum when it goes off, or nothing for signum 0.
+   * A zero setting.value disarms it.
+   * @return what key was set to.
+   */
+  timerSetting setTimer(
+      timerKey key,
+      int signum,
+      logical_clock::time_point now,
+      timerSetting setting);
+
+  /** What key is set to at now, disarmed if we never heard of it. */
+  timerSetting getTimer(timerKey key, logical_clock::time_point now) const;
+
+  bool armed(timerKey key) const;
+
+  /** When key next goes off, must be armed. */
+  logical_clock::time_point expiry(timerKey key) const;
+
+  /**
+   * Take the expirations of key up to now: periodic timers move on to their
+   * first expiry after now, one-shot timers disarm.
+   * @return how many there were, 0 if key had not gone off yet.
+   */
+  uint64_t expire(timerKey key, logical_clock::time_point now);
+
+  /** Expirations beyond the first the last expire of key took. */
+  uint64_t overrun(timerKey key) const;
+
+  /** Whether a signal raising timer came due by now. */
+  bool signalDue(logical_clock::time_point now) const {
+    return !bySignalExpiry.empty() && get<0>(*bySignalExpiry.begin()) <= now;
+  }
+
+  /**
+   * Take the expirations of the earliest signal raising timer, if it came due
+   * by now.
+   * @return its signal, 0 if none came due.
+   */
+  int expireNextSignal(logical_clock::time_point now);
+
+  bool empty() const { return timers.empty(); }
+
+  /** For copyOnWrite::erase. */
+  size_t count(timerKey key) const { return timers.count(key); }
+
+  /** Forget key, e.g. its timerfd was closed. */
+  void erase(timerKey key);
+
+  /** A new id for a timerfd. */
+  uint64_t newTimerfd() { return nextTimerfd++; }
+
+  /**
+   * A forked child has none of its parent's alarm, interval and timer_create
+   * timers, but timerfds come with their fds.
+   */
+  void forked();
+
+private:
+  struct timer {
+    /** Next expiry, if armed. */
+    logical_clock::time_point expiry;
+    logical_clock::duration interval = logical_clock::duration::zero();
+    bool armed = false;
+    int signum = 0;
+    uint64_t overrun = 0;
+    /** Arm order, breaks ties between timers expiring at once. */
+    uint64_t sequence = 0;
+  };
+
+  /** (expiry, arm order, key) of armed timers raising a signal. */
+  typedef tuple<logical_clock::time_point, uint64_t, timerKey> signalKey;
+
+  void disarm(timerKey key, timer& t);
+  void arm(timerKey key, timer& t, logical_clock::time_point expiry);
+
+  map<timerKey, timer> timers;
+  set<signalKey> bySignalExpiry;
+  uint64_t nextSequence = 0;
+  uint64_t nextTimerfd = 0;
+};
+
+#endif
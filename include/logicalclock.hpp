@@ -2,6 +2,7 @@
 #define LOGICAL_CLOCK_H
 
 #include <sys/time.h> // for timeval
+#include <sys/types.h> // for pid_t
 #include <chrono>
 #include <ctime> // for time_t
 
@@ -35,4 +36,20 @@ struct logical_clock {
   static time_point from_timeval(const timeval& tv) noexcept;
 };
 
+/**
+ * When an event happened in logical time: tracee tid's clock, ties broken by
+ * tid. A total order, the same in every run, see scheduler::orderByClock.
+ */
+struct logicalStamp {
+  logical_clock::time_point time;
+  pid_t tid;
+
+  bool operator<(const logicalStamp& other) const {
+    return time != other.time ? time < other.time : tid < other.tid;
+  }
+  bool operator==(const logicalStamp& other) const {
+    return time == other.time && tid == other.tid;
+  }
+};
+
 #endif // LOGICAL_CLOCK_H
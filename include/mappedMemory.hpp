@@ -1,6 +1,7 @@
 #ifndef MAPPED_MEMORY_H
 #define MAPPED_MEMORY_H
 #include <sys/mman.h>
+#include <memory>
 #include "globalState.hpp"
 #include "ptracer.hpp"
 #include "state.hpp"
@@ -13,6 +14,14 @@ class state;
  * Class that abstracts over calling mmap to allocate a memory page
  * that can be used for arbitrary writing/reading in the tracee
  * virtual memory.
+ *
+ * When possible the page is backed by a memfd that is also mapped in the
+ * tracer, so we can fill it in with a plain memcpy instead of
+ * process_vm_writev, see write().
+ *
+ * The threads and forked children sharing a mapping each get their own page
+ * of it while there are enough, see takeNextSlot(), so one of them filling in
+ * its arguments doesn't clobber those of another still in the kernel.
  */
 
 class mappedMemory {
@@ -25,9 +34,12 @@ public:
    */
   mappedMemory(size_t length) : length(length) {}
 
+  /** Size of the part of the mapping each sharer gets. */
+  static const size_t slotSize = 4096;
+
   /**
-   * Getter for the starting address of the mapped memory page.
-   * Throws an error if memory wasn't mapped.
+   * Getter for the starting address of this thread's part of the mapped
+   * memory. Throws an error if memory wasn't mapped.
    * @return memory address of mapped memory page in tracee memory
    */
   traceePtr<void> getAddr() {
@@ -35,7 +47,10 @@ public:
       throw runtime_error(
           "Attempting to get address of non-existing MappedMemory.\n");
     }
-    return mmapAddr;
+    if (slotCount() < 2) {
+      return mmapAddr;
+    }
+    return traceePtr<void>((char*)mmapAddr.ptr + slot * slotSize);
   }
 
   /**
@@ -47,13 +62,94 @@ public:
   void setAddr(traceePtr<void> addr) {
     mmapAddr = addr;
     doesExist = true;
+    slot = 0;
+    slotsTaken = make_shared<size_t>(1);
   }
 
   /**
-   * Getter for the length of the mapped memory page.
+   * Getter for the length of this thread's part of the mapped memory.
    * @return length of the memory page.
    */
-  size_t getLength() { return length; }
+  size_t getLength() { return slotCount() < 2 ? length : slotSize; }
+
+  /**
+   * Move to the next part of the mapping no sharer has taken yet, for a new
+   * thread or forked child. Once all are taken they are handed out again from
+   * the first, in the same order every run.
+   */
+  void takeNextSlot() {
+    if (slotsTaken != nullptr && slotCount() >= 2) {
+      slot = (*slotsTaken)++ % slotCount();
+    }
+  }
+
+  /**
+   * Set the tracer side mapping of this memory. Only call this once the tracee
+   * maps the same memfd at getAddr().
+   * @param local tracer mapping, unmapped when the last owner goes away.
+   * @param newLength length of both mappings.
+   */
+  void setLocalMapping(shared_ptr<void> local, size_t newLength) {
+    localMapping = local;
+    length = newLength;
+  }
+
+  /**
+   * Translate a tracee address inside our mapping into a tracer address.
+   * @return tracer address or nullptr if the memory is not shared with us or
+   * [traceeAddress, traceeAddress + size) falls outside the mapping.
+   */
+  void* getLocalAddr(const void* traceeAddress, size_t size) {
+    if (!doesExist || localMapping == nullptr) {
+      return nullptr;
+    }
+    uintptr_t start = (uintptr_t)mmapAddr.ptr;
+    uintptr_t address = (uintptr_t)traceeAddress;
+    if (address < start || address + size > start + length) {
+      return nullptr;
+    }
+    return (char*)localMapping.get() + (address - start);
+  }
+
+  /**
+   * Write bytes into the mapping at the given tracee address. A memcpy if the
+   * mapping is shared with us, otherwise through process_vm_writev.
+   * @param t our tracer
+   * @param traceeAddress destination inside the mapping (tracee address)
+   * @param localAddress source in tracer memory
+   * @param size number of bytes to copy
+   * @param traceePid pid of the tracee
+   */
+  void writeBytes(
+      ptracer& t,
+      traceePtr<void> traceeAddress,
+      const void* localAddress,
+      size_t size,
+      pid_t traceePid) {
+    void* local = getLocalAddr(traceeAddress.ptr, size);
+    if (local == nullptr) {
+      t.writeTraceeBatch(
+          {traceeIo(traceeAddress, (void*)localAddress, size)}, traceePid);
+      return;
+    }
+    // Keep program order with writes still queued in the ptracer.
+    if (t.pendingWriteOverlaps(traceeAddress.ptr, size)) {
+      t.flushTraceeWrites();
+    }
+    // Tracee memory changed under any cached reads.
+    t.clearReadCache();
+    memcpy(local, localAddress, size);
+  }
+
+  /**
+   * Typed version of writeBytes().
+   */
+  template <typename T>
+  void write(
+      ptracer& t, traceePtr<T> traceeAddress, const T& value, pid_t traceePid) {
+    writeBytes(
+        t, traceePtr<void>(traceeAddress.ptr), &value, sizeof(T), traceePid);
+  }
 
   /** boolean flag indicating if a mapping already exists. */
   bool doesExist = false;
@@ -64,5 +160,22 @@ private:
 
   /** the length of the mapping */
   size_t length;
+
+  size_t slotCount() const { return length / slotSize; }
+
+  /** Which part of the mapping is ours, see takeNextSlot(). */
+  size_t slot = 0;
+
+  /**
+   * How many parts of the mapping were handed out, shared by everyone using
+   * it. Null until the mapping exists.
+   */
+  shared_ptr<size_t> slotsTaken;
+
+  /**
+   * Tracer side view of the same memory, null when the memory is private to
+   * the tracee. Shared across forks as the child inherits the mapping.
+   */
+  shared_ptr<void> localMapping;
 };
 #endif
@@ -0,0 +1,71 @@
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Bytes the tracer holds in each of its biggest structures, to tell which one
+ * a large RSS comes from. Counts are what the containers allocated, capacity
+ * rather than size, plus a rough per node overhead for node based ones; the
+ * allocator's own overhead isn't counted. See execution::memoryNow().
+ */
+struct memoryUsage {
+  /** Process table slots and every tracee's state. */
+  uint64_t processTable = 0;
+  uint64_t inodeMap = 0;
+  uint64_t mtimeMap = 0;
+  /** The listings every tracee reads through directoryCache. */
+  uint64_t directoryCache = 0;
+  /** Per process getdents buffers, each counted once however many share it. */
+  uint64_t directoryEntries = 0;
+  /** Per process fd tables, each counted once however many share it. */
+  uint64_t fdTables = 0;
+
+  uint64_t total() const {
+    return processTable + inodeMap + mtimeMap + directoryCache +
+        directoryEntries + fdTables;
+  }
+
+  /** Keep the biggest of each count, ours or now's. */
+  void keepPeak(const memoryUsage& now) {
+    processTable = max(processTable, now.processTable);
+    inodeMap = max(inodeMap, now.inodeMap);
+    mtimeMap = max(mtimeMap, now.mtimeMap);
+    directoryCache = max(directoryCache, now.directoryCache);
+    directoryEntries = max(directoryEntries, now.directoryEntries);
+    fdTables = max(fdTables, now.fdTables);
+  }
+
+  /** Name of each count with its value, as the statistics print them. */
+  vector<pair<string, uint64_t>> named() const {
+    return {
+        {"process table", processTable},
+        {"inode map", inodeMap},
+        {"mtime map", mtimeMap},
+        {"directory cache", directoryCache},
+        {"directory entries", directoryEntries},
+        {"fd tables", fdTables},
+    };
+  }
+};
+
+/**
+ * Rough bytes of a std::unordered_map: its buckets, and a node per element
+ * holding the element and a next pointer.
+ */
+template <typename K, typename V, typename H>
+uint64_t unorderedMapBytes(const unordered_map<K, V, H>& map) {
+  return map.bucket_count() * sizeof(void*) +
+      map.size() * (sizeof(typename unordered_map<K, V, H>::value_type) +
+                    sizeof(void*));
+}
+
+#endif
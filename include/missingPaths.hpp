@@ -0,0 +1,65 @@
+#ifndef MISSING_PATHS_H
+#define MISSING_PATHS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Host paths we found missing, shared by every tracee, so probing the same
+ * search paths again (include directories, LD_LIBRARY_PATH, sys.path) needs no
+ * stat of our own.
+ *
+ * Each path is kept with the directory it is missing from: the deepest of its
+ * ancestors that is a directory. The path can only appear by something being
+ * created in that directory, which created() is told of, or by its ancestors
+ * changing into other directories, through rename, rmdir, or unlinking a
+ * symbolic link, after which everything is cleared. Entries come and go with
+ * what tracees do, so the same runs find the same entries.
+ */
+class missingPaths {
+public:
+  /** errno of stat on path, ENOENT or ENOTDIR, 0 if we don't know. */
+  int find(const string& path) const;
+
+  /**
+   * path is missing with err, from the directory with device and inode
+   * within.
+   */
+  void insert(const string& path, int err, dev_t device, ino_t inode);
+
+  /** Something was created in the directory with device and inode. */
+  void created(dev_t device, ino_t inode);
+
+  /** Directories may have moved, forget everything. */
+  void clear();
+
+  bool empty() const { return paths.empty(); }
+
+  size_t size() const { return paths.size(); }
+
+  /** Lookups of paths we knew were missing. */
+  uint64_t hits = 0;
+
+private:
+  /** Cap on paths, dropping everything once reached. */
+  static const size_t maxPaths = 1 << 16;
+
+  struct entry {
+    int err;
+    pair<dev_t, ino_t> directory;
+  };
+
+  unordered_map<string, entry> paths;
+  /** The paths missing from each directory. */
+  map<pair<dev_t, ino_t>, vector<string>> byDirectory;
+};
+
+#endif
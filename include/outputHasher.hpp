@@ -0,0 +1,59 @@
+#ifndef OUTPUT_HASHER_H
+#define OUTPUT_HASHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fileHasher.hpp"
+#include "ptracer.hpp"
+#include "state.hpp"
+
+using namespace std;
+
+/**
+ * Rolling hashes of everything a run wrote with write and writev, written by
+ * --hash-outputs as JSON once the run is over:
+ *
+ *   {"<stdout>": {"hash": "<hash>", "bytes": 120},
+ *    "/build/hello.o": {"hash": "<hash>", "bytes": 1888}, ...}
+ *
+ * Writes to regular files are keyed by path, in the order the tracees made
+ * them, writes of fds 1 and 2 to anything else are "<stdout>" and
+ * "<stderr>". Writes patched sites make to regular files come through the side
+ * effect ring instead, see execution::drainSideEffects. Two runs of a
+ * deterministic program give the same manifest, comparing them is much cheaper
+ * than keeping and diffing their outputs.
+ * pwrite64, pwritev, sendfile and stores to shared mappings we don't see.
+ */
+class outputHasher {
+public:
+  /** Write the manifest to path. */
+  outputHasher(const string& path);
+
+  /** Writes the manifest out. */
+  ~outputHasher();
+
+  outputHasher(const outputHasher&) = delete;
+  outputHasher& operator=(const outputHasher&) = delete;
+
+  /** The tracee stopped at syscallNum's post-hook, hash what it wrote. */
+  void systemCall(state& s, ptracer& t, int syscallNum);
+
+  /** s wrote n bytes of data to fd without stopping, hash them. */
+  void wrote(state& s, int fd, const char* data, size_t n);
+
+  /** Bytes read from tracees and hashed. */
+  uint64_t bytesHashed = 0;
+
+private:
+  /** What writes to fd are hashed as, "" if they aren't. */
+  static string outputOf(state& s, int fd);
+
+  string path;
+  map<string, contentHasher> outputs;
+  /** Bytes of the write being hashed. */
+  vector<char> buffer;
+};
+
+#endif
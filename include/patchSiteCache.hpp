@@ -0,0 +1,59 @@
+#ifndef PATCH_SITE_CACHE_H
+#define PATCH_SITE_CACHE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "addressSpace.hpp"
+#include "fileHasher.hpp"
+
+using namespace std;
+
+/** What was patched at a site, to patch it again the same way. */
+enum class patchKind : uint8_t { rdtsc, rdtscp, cpuid, syscall };
+
+/**
+ * The sites patchSites learned to patch, by the file they are in and their
+ * offset there, so every later process running the same version of a binary
+ * or library has them patched from the start instead of trapping its way
+ * there again, see execution::patchKnownSites. Versions are a file's device,
+ * inode, size and mtime, like executableHashes'.
+ *
+ * The cache can be saved, --inode-snapshot keeps it next to its snapshot. A
+ * saved cache is lines of "device inode size mtime kind offset".
+ */
+class patchSiteCache {
+public:
+  /** Sites of one file by offset. */
+  typedef map<uint64_t, patchKind> fileSites;
+
+  /**
+   * Add the cache saved at path, false if there is none or it isn't one.
+   */
+  bool load(const string& path);
+
+  /** Write the cache to path, next to it and renamed over it. */
+  void save(const string& path);
+
+  /** The site at offset of file was patched as kind. */
+  void patched(const fileIdentity& file, uint64_t offset, patchKind kind);
+
+  /** The sites known for file, nullptr if none. */
+  const fileSites* sitesOf(const fileIdentity& file) const;
+
+  /**
+   * The version of the file m maps, false for anonymous mappings and files
+   * we can't stat.
+   */
+  static bool identify(const vma& m, fileIdentity& file);
+
+  /** Sites known, learned or loaded. */
+  size_t size() const;
+
+private:
+  map<fileIdentity, fileSites> sites;
+};
+
+#endif
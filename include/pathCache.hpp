@@ -0,0 +1,89 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "stringInterner.hpp"
+
+using namespace std;
+
+/**
+ * Host paths of directories tracees resolve paths against, interned in the
+ * global stringInterner, so the same directory reached through many tracees,
+ * cwds and fds is stored once.
+ *
+ * Renaming or removing a directory moves or breaks everything below it, so
+ * either bumps the generation, and every cached directory path is read again.
+ */
+class pathTable {
+public:
+  explicit pathTable(stringInterner& strings) : strings(strings) {}
+
+  stringInterner& strings;
+
+  /** A directory may have moved, cached paths must be read again. */
+  void invalidateAll() { generation++; }
+
+  uint64_t currentGeneration() const { return generation; }
+
+  /** Directory paths served from a cache instead of readlink. */
+  uint32_t hits = 0;
+
+private:
+  uint64_t generation = 0;
+};
+
+/**
+ * Host paths of one tracee's root, cwd and directory fds: what readlink of
+ * /proc/pid/root, /proc/pid/cwd and /proc/pid/fd/N returns, cached so that
+ * resolving a tracee path usually needs no readlink at all.
+ *
+ * Tracees can't chroot. chdir and fchdir must call forgetCwd(), close and dup2
+ * forgetFd() and execve forgetFds(). Copied on fork, shared by threads, like
+ * state::fds.
+ */
+class traceePaths {
+public:
+  /**
+   * Host paths of traceePid's directories, in table.strings, noString if
+   * readlink failed.
+   */
+  stringId root(pathTable& table, pid_t traceePid);
+  stringId cwd(pathTable& table, pid_t traceePid);
+  stringId dirFd(pathTable& table, pid_t traceePid, int fd);
+
+  void forgetCwd() { cwdPath.path = stringInterner::noString; }
+
+  void forgetFd(int fd) { fdPaths.erase(fd); }
+
+  bool cachesFd(int fd) const { return fdPaths.count(fd) != 0; }
+
+  void forgetFds() { fdPaths.clear(); }
+
+  /** Whether we cache any of fds first to last, for close_range. */
+  bool cachesFds(int first, int last) const;
+
+  void forgetFds(int first, int last);
+
+private:
+  struct cachedPath {
+    stringId path = stringInterner::noString;
+    uint64_t generation = 0;
+  };
+
+  /**
+   * cached if it is still current, otherwise readlink procPath into it.
+   */
+  static stringId lookup(
+      pathTable& table, cachedPath& cached, const string& procPath);
+
+  cachedPath rootPath;
+  cachedPath cwdPath;
+  unordered_map<int, cachedPath> fdPaths;
+};
+
+#endif
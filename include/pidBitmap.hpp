@@ -0,0 +1,132 @@
+#ifndef PID_BITMAP_H
+#define PID_BITMAP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Set of pids stored as a hierarchical bitmap, used by the scheduler for its
+ * run queues.
+ * Bit p of level 0 is set when pid p is in the set. Bit i of level k is set
+ * when word i of level k - 1 is non zero. The top level is a single word, so
+ * finding the highest pid is one count-leading-zeros per level: four levels
+ * cover the default pid_max of 4M. Insert and erase touch one word per level.
+ * Levels grow on demand, memory is proportional to the highest pid seen.
+ */
+class pidBitmap {
+public:
+  pidBitmap() : levels(1, vector<uint64_t>(1, 0)) {}
+
+  void insert(pid_t pid) {
+    while ((uint64_t)pid >= capacity()) {
+      addLevel();
+    }
+    uint64_t index = pid;
+    for (auto& level : levels) {
+      uint64_t& word = level[index / 64];
+      bool wasEmpty = word == 0;
+      word |= bit(index % 64);
+      // Upper levels already know this word is non empty.
+      if (!wasEmpty) {
+        break;
+      }
+      index /= 64;
+    }
+  }
+
+  /**
+   * Remove pid from the set.
+   * @return whether pid was in the set.
+   */
+  bool erase(pid_t pid) {
+    if (!contains(pid)) {
+      return false;
+    }
+    uint64_t index = pid;
+    for (auto& level : levels) {
+      uint64_t& word = level[index / 64];
+      word &= ~bit(index % 64);
+      // Word still has other members, upper levels stay the same.
+      if (word != 0) {
+        break;
+      }
+      index /= 64;
+    }
+    return true;
+  }
+
+  bool contains(pid_t pid) const {
+    if (pid < 0 || (uint64_t)pid >= capacity()) {
+      return false;
+    }
+    return (levels[0][pid / 64] & bit(pid % 64)) != 0;
+  }
+
+  bool empty() const { return levels.back()[0] == 0; }
+
+  /**
+   * Highest pid in the set, -1 if empty.
+   */
+  pid_t highest() const {
+    if (empty()) {
+      return -1;
+    }
+    uint64_t index = 0;
+    for (size_t k = levels.size(); k-- > 0;) {
+      index = index * 64 + highestBit(levels[k][index]);
+    }
+    return (pid_t)index;
+  }
+
+  /**
+   * Highest pid in the set lower than pid, -1 if there is none. Scans level 0
+   * word by word, for debug printing and teardown, not scheduling decisions.
+   */
+  pid_t highestBelow(pid_t pid) const {
+    if (pid <= 0) {
+      return -1;
+    }
+    uint64_t index = min((uint64_t)pid, capacity()) - 1;
+    const vector<uint64_t>& bits = levels[0];
+    // Mask off bits above index in its word.
+    uint64_t word = bits[index / 64] & (~0ULL >> (63 - index % 64));
+    size_t w = index / 64;
+    while (word == 0) {
+      if (w == 0) {
+        return -1;
+      }
+      word = bits[--w];
+    }
+    return (pid_t)(w * 64 + highestBit(word));
+  }
+
+  void swap(pidBitmap& other) { levels.swap(other.levels); }
+
+private:
+  static uint64_t bit(uint64_t i) { return 1ULL << i; }
+
+  static uint64_t highestBit(uint64_t word) {
+    return 63 - __builtin_clzll(word);
+  }
+
+  /** Number of pids the current levels can hold. */
+  uint64_t capacity() const { return levels[0].size() * 64; }
+
+  /** Grow every level 64x and add a new single word top level. */
+  void addLevel() {
+    for (auto& level : levels) {
+      level.resize(level.size() * 64, 0);
+    }
+    levels.push_back(vector<uint64_t>(1, empty() ? 0 : 1));
+  }
+
+  /** levels[0] are the pids, levels.back() is a single summary word. */
+  vector<vector<uint64_t>> levels;
+};
+
+#endif
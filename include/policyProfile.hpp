@@ -0,0 +1,114 @@
+#ifndef POLICY_PROFILE_H
+#define POLICY_PROFILE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+using namespace std;
+
+/** What the seccomp filter does with a system call, see policyProfile. */
+enum class disposition {
+  intercept, /*< Stop the tracee, our handlers run. */
+  allow, /*< Run it in the kernel, no stop. */
+  reject, /*< Fail it in the kernel with an errno, no stop. */
+};
+
+struct systemCallPolicy {
+  disposition what;
+  /** errno of reject. */
+  int err;
+};
+
+/**
+ * --profile: a named set of overrides of the intercept set seccomp::loadRules
+ * builds, for workloads that never need some of it, e.g. a C compiler never
+ * waits on timers.
+ *
+ * A profile file has one system call per line, by name, and its disposition:
+ *
+ *     # Comments run to the end of the line.
+ *     wait4 allow
+ *     timer_create errno ENOSYS
+ *     getrusage intercept
+ *
+ * errno takes a name or a number. Every rule of the system call in loadRules is
+ * replaced, argument filters included. intercept only makes sense for system
+ * calls we have a handler for. --suggest-profile writes profiles, see
+ * profileSuggestion.
+ */
+class policyProfile {
+public:
+  /**
+   * Parse the text of a profile, origin names it in errors, which are
+   * runtimeErrors pointing at the line.
+   */
+  static policyProfile parse(const string& text, const string& origin);
+
+  /** Parse the profile at path. */
+  static policyProfile load(const string& path);
+
+  /**
+   * Path of profile name: name itself if it has a '/', otherwise name.profile
+   * in dir, where named profiles are installed.
+   */
+  static string resolve(const string& name, const string& dir);
+
+  /** The override for systemCall, nullptr if the profile leaves it alone. */
+  const systemCallPolicy* find(long systemCall) const;
+
+  const map<long, systemCallPolicy>& overrides() const { return policies; }
+
+  /** Changes whenever the overrides do, for seccomp::cachePath. */
+  uint64_t fingerprint() const;
+
+private:
+  map<long, systemCallPolicy> policies;
+};
+
+/** Number of the system call called name, -1 if we know none. */
+long systemCallNumber(const string& name);
+
+/**
+ * --suggest-profile: which intercepted system calls ever had their outcome
+ * changed by our handlers during a run, registers or memory written, replays,
+ * injected system calls or held back calls. Written at exit as the narrowest
+ * profile safe for this run: allow for those that never did, unless dettrace
+ * keeps state from them or they may block, see keepsTracerState.
+ * System calls the run never made are left out, loadRules decides.
+ */
+class profileSuggestion {
+public:
+  explicit profileSuggestion(const string& path) : path(path) {}
+
+  /** Writes the profile. */
+  ~profileSuggestion();
+
+  profileSuggestion(const profileSuggestion&) = delete;
+  profileSuggestion& operator=(const profileSuggestion&) = delete;
+
+  /** A hook of systemCall ran, changing its outcome or not. */
+  void hooked(int systemCall, bool changed);
+
+  /** The profile text. */
+  string text() const;
+
+  /**
+   * Whether our handlers keep state later outcomes depend on from systemCall,
+   * or it may block and must be turned into polling: never worth allowing
+   * just because one run didn't need it.
+   */
+  static bool keepsTracerState(long systemCall);
+
+private:
+  struct counts {
+    uint64_t hooks = 0;
+    uint64_t changed = 0;
+  };
+
+  string path;
+  map<int, counts> bySystemCall;
+};
+
+#endif
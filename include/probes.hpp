@@ -0,0 +1,38 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * USDT probes on the tracer's hot path, for bpftrace and perf, e.g.
+ *   bpftrace -e 'usdt:./bin/dettrace:dettrace:pre_hook { @[arg1] = count(); }'
+ * lists the probes and their arguments with `bpftrace -l 'usdt:./bin/dettrace'`.
+ *
+ * Each is a single nop until a tracer attaches. Built in when <sys/sdt.h>
+ * (systemtap-sdt-dev) is there and DETTRACE_NO_USDT isn't defined, otherwise
+ * the probes are compiled out and their arguments never evaluated.
+ */
+
+#if !defined(DETTRACE_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DETTRACE_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef DETTRACE_HAVE_USDT
+#define DETTRACE_PROBE1(name, a1) DTRACE_PROBE1(dettrace, name, a1)
+#define DETTRACE_PROBE2(name, a1, a2) DTRACE_PROBE2(dettrace, name, a1, a2)
+#define DETTRACE_PROBE3(name, a1, a2, a3) \
+  DTRACE_PROBE3(dettrace, name, a1, a2, a3)
+#else
+#define DETTRACE_PROBE1(name, a1) \
+  do {                            \
+  } while (0)
+#define DETTRACE_PROBE2(name, a1, a2) \
+  do {                                \
+  } while (0)
+#define DETTRACE_PROBE3(name, a1, a2, a3) \
+  do {                                    \
+  } while (0)
+#endif
+
+#endif
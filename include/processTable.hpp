@@ -0,0 +1,212 @@
+#ifndef PROCESS_TABLE_H
+#define PROCESS_TABLE_H
+
+#include <sys/types.h>
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "state.hpp"
+
+using namespace std;
+
+/**
+ * Table of every tracee (process or thread) we are tracking.
+ *
+ * Replaces the separate states map, process tree and thread group maps: each
+ * tracee gets one slot holding its state plus intrusive links to its parent,
+ * its children and the other members of its thread group. Slots are found from
+ * a pid through one hash lookup, and adding or removing a tracee is a constant
+ * number of link updates.
+ *
+ * Relationships follow what dettrace always did:
+ * - A thread group is a process (the leader, whose pid is the thread group
+ *   number) plus its threads. Child processes are not members, they lead their
+ *   own group.
+ * - The parent of a new process or thread is the leader of the thread group of
+ *   whoever spawned it. A thread T1 spawning T2 makes T2 a child of T1's
+ *   process, not of T1.
+ *
+ * Slots live in a deque and are recycled through a free list, so references
+ * to a state stay valid until that tracee is removed.
+ *
+ * Nothing a tracee's exit or a wait does walks a list of children or zombies:
+ * what a wait asks about is one lookup, each exit a constant number of updates
+ * plus one per child it orphans. Tearing down a build of thousands of
+ * processes takes time linear in them.
+ */
+class processTable {
+public:
+  /**
+   * Add a tracee with no parent that leads its own thread group, e.g. the
+   * first process.
+   * @return the newly added state.
+   */
+  state& addRoot(pid_t pid, state s);
+
+  /**
+   * Add a new process spawned (fork, vfork, clone) by spawner. It leads its
+   * own thread group and becomes a child of spawner's thread group leader.
+   * @return the newly added state.
+   */
+  state& addProcess(pid_t spawner, pid_t pid, state s);
+
+  /**
+   * Add a new thread created by spawner, in spawner's thread group. It becomes
+   * a child of the group leader.
+   * @return the newly added state.
+   */
+  state& addThread(pid_t spawner, pid_t tid, state s);
+
+  /**
+   * Remove a tracee: unlink it from its parent and thread group and drop its
+   * state. Children that are still alive lose their parent. A process is left
+   * to its parent as unreaped, see hasUnreaped().
+   * A thread group leader must be the last member of its group to go.
+   * @return pid of the parent, -1 if it had none.
+   */
+  pid_t remove(pid_t pid);
+
+  /**
+   * State of a tracee. Throws if pid is not in the table.
+   */
+  state& at(pid_t pid);
+
+  /**
+   * State of a tracee, nullptr if pid is not in the table.
+   */
+  state* find(pid_t pid);
+
+  bool contains(pid_t pid) const { return slotOf.count(pid) != 0; }
+
+  bool empty() const { return slotOf.empty(); }
+
+  /** Number of tracees, processes and threads, we track. */
+  size_t size() const { return slotOf.size(); }
+
+  /** Thread group number (the leader's pid) of a tracee. */
+  pid_t threadGroupOf(pid_t pid) const;
+
+  /** Number of live members, leader included, of pid's thread group. */
+  size_t threadGroupSize(pid_t pid) const;
+
+  /**
+   * Move all threads of pid's thread group onto a separate list, to be taken
+   * off one at a time with popDetachedThread(). Lets us walk a group we are
+   * tearing down while remove() mutates the table, without copying anything.
+   * Detached threads are still members: they count towards threadGroupSize()
+   * until they are removed.
+   */
+  void detachThreads(pid_t pid);
+
+  /**
+   * Take the oldest thread off the list built by detachThreads().
+   * @return its pid, or -1 once the list is empty.
+   */
+  pid_t popDetachedThread(pid_t pid);
+
+  /** Whether pid is a thread rather than a thread group leader. */
+  bool isThread(pid_t pid) const;
+
+  /** Whether any process or thread we track has pid as its parent. */
+  bool hasChildren(pid_t pid) const;
+
+  /**
+   * Whether child, or any if -1, is a live child process, not a thread, of
+   * parent's thread group.
+   */
+  bool hasChildProcess(pid_t parent, pid_t child = -1) const;
+
+  /**
+   * Whether child, or any if -1, is a child process of parent's thread group
+   * that exited and that we did not see reaped, see reaped(). May hold
+   * children the kernel reaped without us noticing, SIGCHLD ignored, never
+   * misses one the parent could reap.
+   */
+  bool hasUnreaped(pid_t parent, pid_t child = -1) const;
+
+  /** parent's thread group reaped child with wait4 or waitid. */
+  void reaped(pid_t parent, pid_t child);
+
+  /** Number of live threads, not counting thread group leaders. */
+  size_t liveThreadCount() const { return threadCount; }
+
+  /** Most threads, leaders not counted, that were ever live at once. */
+  size_t peakThreadCount() const { return peakThreads; }
+
+  /** Call f(pid, state) on every tracee, in no particular order. */
+  template <typename F>
+  void forEach(F f) {
+    for (processEntry& e : entries) {
+      if (e.pid != -1) {
+        f(e.pid, *e.st);
+      }
+    }
+  }
+
+  /**
+   * Bytes of our slots, lookup maps and the states themselves, not of what the
+   * states point to, see memoryUsage.
+   */
+  size_t bytesHeld() const;
+
+private:
+  /** No slot: end of a list, or no parent. */
+  static const int none = -1;
+
+  struct processEntry {
+    pid_t pid = -1; /**< -1 when the slot is free. */
+    unique_ptr<state> st;
+
+    int parent = none;
+    int firstChild = none;
+    int lastChild = none;
+    int prevSibling = none;
+    int nextSibling = none;
+
+    /** Thread group leader, this slot itself for processes. */
+    int leader = none;
+    /** Leader only: first and last thread. */
+    int firstThread = none;
+    int lastThread = none;
+    /** Leader only: threads moved aside by detachThreads(). */
+    int firstDetached = none;
+    int lastDetached = none;
+    /** Thread only: neighbours on whichever list of the leader we are on. */
+    int prevThread = none;
+    int nextThread = none;
+    /** Leader only: number of members, leader included. */
+    size_t groupSize = 0;
+    /** Children that are processes, not threads. */
+    size_t childProcesses = 0;
+  };
+
+  /**
+   * Take a free slot (or a new one) for pid with no links set.
+   */
+  int allocate(pid_t pid, state s);
+
+  /** Slot of a pid, throws if pid is not in the table. */
+  int slot(pid_t pid) const;
+
+  /** Make child the youngest child of parent. */
+  void linkChild(int parent, int child);
+
+  /**
+   * Unlink a thread from whichever of its leader's lists it is on, if any.
+   */
+  void unlinkThread(int thread);
+
+  deque<processEntry> entries;
+  vector<int> freeSlots;
+  unordered_map<pid_t, int> slotOf;
+  /** Thread group leader to the children it has yet to reap. */
+  unordered_map<pid_t, unordered_set<pid_t>> unreaped;
+  size_t threadCount = 0;
+  size_t peakThreads = 0;
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include <memory>
 #include <set>
 #include <tuple>
+#include <vector>
 
 #include "traceePtr.hpp"
 #include "util.hpp"
@@ -30,6 +31,36 @@ using namespace std;
 
 const size_t wordSize = 8; /**< Size of word, 8 bytes for x86_64. */
 
+// Older glibc headers do not know about PTRACE_GET_SYSCALL_INFO (Linux 5.3+).
+#ifndef PTRACE_GET_SYSCALL_INFO
+#define PTRACE_GET_SYSCALL_INFO 0x420e
+#endif
+#ifndef PTRACE_SYSCALL_INFO_SECCOMP
+#define PTRACE_SYSCALL_INFO_SECCOMP 3
+#endif
+
+/**
+ * Layout of the data returned by PTRACE_GET_SYSCALL_INFO, see `man 2 ptrace`.
+ * We only care about seccomp stops. Defined here so we don't depend on the
+ * glibc version we are built against.
+ */
+struct ptraceSyscallInfo {
+  uint8_t op;
+  uint8_t pad[3];
+  uint32_t arch;
+  uint64_t instruction_pointer;
+  uint64_t stack_pointer;
+  union {
+    struct {
+      uint64_t nr;
+      uint64_t args[6];
+      uint32_t ret_data;
+    } seccomp;
+    // Largest member of the kernel union, keeps our struct the same size.
+    uint64_t pad2[8];
+  };
+};
+
 /**
  * ptrace event enum.
  * Types of events we expect returned from getNextEvent(), I wish we had ADTs.
@@ -57,6 +88,28 @@ enum class syscallState {
   post /**< post-hook state*/
 };
 
+/**
+ * One element of a batched tracee memory transfer, see
+ * ptracer::readTraceeBatch() and ptracer::writeTraceeBatch().
+ */
+struct traceeIo {
+  /**
+   * Constructor.
+   * @param traceeAddress memory address in tracee memory
+   * @param localAddress memory address in tracer memory
+   * @param size number of bytes to transfer, defaults to sizeof(T)
+   */
+  template <typename T>
+  traceeIo(traceePtr<T> traceeAddress, T* localAddress, size_t size = sizeof(T))
+      : traceeAddress{(void*)traceeAddress.ptr},
+        localAddress{(void*)localAddress},
+        size{size} {}
+
+  void* traceeAddress; /**< address in tracee memory */
+  void* localAddress; /**< address in tracer memory */
+  size_t size; /**< bytes to transfer */
+};
+
 /**
  * ptracer.
  * Class wrapping the functionality of the system call ptrace.
@@ -74,15 +127,36 @@ public:
   uint32_t writeVmCalls = 0;
 
   /**
-   * counter for peeks, peeks only called through: readTraceeCString.
+   * Register and memory writes we made to tracees, flushed or not, see
+   * profileSuggestion.
+   */
+  uint64_t traceeChanges = 0;
+
+  /** Arguments put back by restoreArgLater(). */
+  uint64_t lazyRestores = 0;
+
+  /**
+   * counter for peeks, peeks only called through: readTraceeCString, when
+   * process_vm_readv is unable to read the string.
    */
   uint32_t ptracePeeks = 0;
 
+  /**
+   * counter for tracee memory reads served from our per-stop read cache.
+   */
+  uint32_t readCacheHits = 0;
+
   /**
    * Map of real inodes to virtual inodes.
    */
   map<ino_t, ino_t> real2VirtualMap;
 
+  /**
+   * Use PTRACE_GET_SYSCALL_INFO on seccomp stops instead of fetching all
+   * registers. Only set when running on kernel >= 5.3.
+   */
+  bool useSyscallInfo = false;
+
   /**
    * Constructor.
    * Create a ptracer. The child must have called PTRACE_TRACEME and then
@@ -144,9 +218,19 @@ public:
 
   /**
    * Set regs to the values given by passed struct.
+   * Like all register writes, this only updates our cached copy, see
+   * flushRegs().
    * @param newValues struct of new register values
    */
   void setRegs(struct user_regs_struct newValues);
+
+  /**
+   * Write cached registers back to the tracee with a single PTRACE_SETREGS.
+   * Does nothing if no register was written since the last flush. Must be
+   * called before the tracee is resumed, or before anybody reads its
+   * registers through raw ptrace calls.
+   */
+  void flushRegs();
   /**
    * Retrieves value for Rip register.
    * @return Rip register value
@@ -208,6 +292,17 @@ public:
    */
   void writeArg6(uint64_t val);
 
+  /**
+   * Put original back in argument register arg, 1 to 6, of the current tracee
+   * at its next stop, if the register still holds ours by then. Lets a
+   * pre-hook that pointed an argument at our scratch memory skip the post-hook
+   * stop that would restore it. Only for system calls whose callers don't read
+   * the argument back before their next stop, e.g. libc wrappers returning
+   * right away: in between the tracee sees ours. Not a change of the next
+   * system call's outcome, so not counted in traceeChanges.
+   */
+  void restoreArgLater(int arg, uint64_t ours, uint64_t original);
+
   /**
    * Write  value to ip register.
    * @param val new ip register value
@@ -276,10 +371,21 @@ public:
 
   /**
    * Update registers to the state of the passed pid. This is now the new pid.
+   * Pending register writes for the old pid are flushed first.
    * @param newPid new pid number
    */
   void updateState(pid_t newPid);
 
+  /**
+   * Like updateState() but for seccomp stops: only fetch the system call
+   * number, arguments, rip and rsp through PTRACE_GET_SYSCALL_INFO. The full
+   * register set is fetched lazily the first time somebody needs a register
+   * not covered by it, or writes to any register. Falls back to updateState()
+   * when useSyscallInfo is false.
+   * @param newPid new pid number
+   */
+  void updateStateSeccomp(pid_t newPid);
+
   /**
    * Return the pid for the current process we have stopped in an event.
    * @return pid
@@ -319,17 +425,27 @@ public:
    */
   template <typename T>
   T readFromTracee(traceePtr<T> sourceAddress, pid_t traceePid) {
-    readVmCalls++;
     T myData;
+    if (lookupReadCache(sourceAddress.ptr, &myData, sizeof(T), traceePid)) {
+      return myData;
+    }
+    // Our own queued writes must be visible.
+    if (pendingWriteOverlaps(sourceAddress.ptr, sizeof(T))) {
+      flushTraceeWrites();
+    }
+
+    readVmCalls++;
     doWithCheck(
         readVmTraceeRaw(sourceAddress, &myData, sizeof(T), traceePid),
         "readFromTracee: Unable to read bytes at address.");
+    insertReadCache(sourceAddress.ptr, &myData, sizeof(T), traceePid);
     return myData;
   }
 
   /**
    * Read the C-string from the tracee's memory.
-   * Notice we keep reading until we hit a null.
+   * Notice we keep reading until we hit a null. Memory is read a page at a
+   * time through process_vm_readv.
    * Undefined behavior will happen if the location is not actually a C-string.
    * @param readAddress address of CString to be read from (in tracee address
    * space)
@@ -340,6 +456,8 @@ public:
 
   /**
    * Write a value to tracee.
+   * The write is queued and only performed by flushTraceeWrites(), together
+   * with all other writes done during this stop.
    * @param writeAddress memory address in trace memory to write to.
    * @param valueToCopy value of type T to be written in tracee memory
    * @param traceePid the pid of the tracee
@@ -347,17 +465,139 @@ public:
   template <typename T>
   void writeToTracee(
       traceePtr<T> writeAddress, T valueToCopy, pid_t traceePid) {
-    writeVmCalls++;
-    writeVmTraceeRaw(
-        &valueToCopy, traceePtr<T>(writeAddress), sizeof(T), traceePid);
-
+    queueTraceeWrite(writeAddress.ptr, &valueToCopy, sizeof(T), traceePid);
     return;
   }
 
+  /**
+   * Read several non-contiguous buffers from the tracee with one
+   * process_vm_readv. Throws if not every byte could be read.
+   * @param ios list of (tracee address, local address, size) to read.
+   * @param traceePid the pid of the tracee
+   */
+  void readTraceeBatch(const vector<traceeIo>& ios, pid_t traceePid);
+
+  /**
+   * Write several non-contiguous buffers to the tracee. Like writeToTracee()
+   * the writes are queued until flushTraceeWrites().
+   * @param ios list of (tracee address, local address, size) to write.
+   * @param traceePid the pid of the tracee
+   */
+  void writeTraceeBatch(const vector<traceeIo>& ios, pid_t traceePid);
+
+  /**
+   * Perform all queued tracee memory writes. Contiguous and overlapping writes
+   * are merged, later writes winning, and everything is written with a single
+   * process_vm_writev. Must be called before the tracee is resumed. Throws if
+   * not every byte could be written.
+   */
+  void flushTraceeWrites();
+
+  /**
+   * Whether [traceeAddress, traceeAddress + size) overlaps any queued write.
+   */
+  bool pendingWriteOverlaps(const void* traceeAddress, size_t size);
+
+  /**
+   * When set, every flushTraceeWrites() reads back the memory it wrote and
+   * checks it against applying the queued writes one by one, in order. Set
+   * through the DETTRACE_VERIFY_WRITES environment variable.
+   */
+  bool verifyWrites = false;
+
+  /**
+   * Forget all tracee memory cached by readFromTracee() and
+   * readTraceeCString(). Must be called whenever the tracee may have run or
+   * its memory was modified behind our back.
+   */
+  void clearReadCache();
+
 private:
   pid_t traceePid; /**< The pid of the tracee.  */
 
   struct user_regs_struct regs; /**< Registers struct defined in sys.   */
+
+  /**
+   * True when regs has been modified since it was last fetched from or written
+   * to the tracee.
+   */
+  bool regsDirty = false;
+
+  /**
+   * True when regs was only partially filled in through
+   * PTRACE_GET_SYSCALL_INFO. See updateStateSeccomp().
+   */
+  bool regsPartial = false;
+
+  /**
+   * Tracee memory we have already read during this stop, keyed by its starting
+   * address in the tracee. Reads are only cached for the current tracee.
+   */
+  map<uintptr_t, string> readCache;
+
+  /**
+   * Copy size bytes at traceeAddress from our read cache into localAddress.
+   * @return true if the whole range was cached.
+   */
+  bool lookupReadCache(
+      const void* traceeAddress,
+      void* localAddress,
+      size_t size,
+      pid_t pid);
+
+  /**
+   * Remember size bytes read from traceeAddress for the rest of this stop.
+   */
+  void insertReadCache(
+      const void* traceeAddress,
+      const void* localAddress,
+      size_t size,
+      pid_t pid);
+
+  /**
+   * Tracee memory writes queued during this stop, in program order, see
+   * flushTraceeWrites(). Always for the current traceePid.
+   */
+  vector<pair<uintptr_t, string>> pendingWrites;
+
+  /**
+   * Queue size bytes at localAddress to be written at traceeAddress.
+   */
+  void queueTraceeWrite(
+      const void* traceeAddress,
+      const void* localAddress,
+      size_t size,
+      pid_t pid);
+
+  /**
+   * Fetch all registers from the tracee if we only have a partial view.
+   */
+  void fetchFullRegs();
+
+  struct pendingRestore {
+    unsigned long long user_regs_struct::*reg;
+    uint64_t ours;
+    uint64_t original;
+  };
+
+  /** restoreArgLater()s not applied yet, by tracee. */
+  map<pid_t, vector<pendingRestore>> pendingRestores;
+
+  /** Apply pendingRestores of traceePid, which just stopped. */
+  void applyPendingRestores();
+
+  /**
+   * Slow path of readTraceeCString, reads one word at a time through
+   * PTRACE_PEEKDATA. Used for memory process_vm_readv cannot read, e.g. pages
+   * without PROT_READ.
+   */
+  string readTraceeCStringPeek(traceePtr<char> readAddress, pid_t traceePid);
+
+  /**
+   * readTraceeCString without consulting our read cache.
+   */
+  string readTraceeCStringUncached(
+      traceePtr<char> readAddress, pid_t traceePid);
 };
 
 #endif
@@ -0,0 +1,129 @@
+#ifndef READINESS_PROBE_H
+#define READINESS_PROBE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * Checks from the tracer whether a tracee's pipe has anything to read, so a
+ * read that would block does not have to be run, rewound and replayed just to
+ * find out. Stream sockets, like the ends of a socketpair, count as pipes.
+ *
+ * The first probe of a descriptor duplicates it into dettrace (pidfd_getfd,
+ * falling back to reopening /proc/pid/fd/N for pipes). The duplicate is cached,
+ * so later probes cost a single poll(). Holding a duplicate keeps the pipe open
+ * on our side, so it must be dropped whenever the tracee's descriptor may go
+ * away: close, dup2, exec and exit, see forget() and forgetAll().
+ *
+ * The same duplicates let the tracer finish short pipe reads and writes for
+ * tracees, see drain() and fill(), and read remote sockets for them, see
+ * receive().
+ *
+ * Shared by tracees that share a file descriptor table, like state::fds.
+ */
+class readinessProbe {
+public:
+  enum class result {
+    ready, /*< Data, EOF or an error is waiting, a read won't block. */
+    empty, /*< A read would block. */
+    unknown, /*< Could not tell, do the read. */
+  };
+
+  readinessProbe() = default;
+  ~readinessProbe();
+  readinessProbe(const readinessProbe&) = delete;
+  readinessProbe& operator=(const readinessProbe&) = delete;
+
+  /** Whether reading fd in traceePid would block right now. */
+  result probe(pid_t traceePid, int fd);
+
+  /**
+   * poll() revents of fd's pipe in traceePid right now, as the tracee's own
+   * poll would see them: only from a duplicate sharing its open file
+   * description, never from one reopened through /proc. -1 if we have none.
+   */
+  int pollEvents(pid_t traceePid, int fd);
+
+  /**
+   * Read up to count bytes of what fd's pipe holds right now into buffer,
+   * never blocking. Only for pipes whose open file description is non
+   * blocking, like the ones we create for tracees, or our own reopened one.
+   * Stream sockets must be readable and writable.
+   * @return bytes read, 0 on EOF, -1 with errno set (EAGAIN if nothing is
+   * there, or we can't read it without blocking).
+   */
+  ssize_t drain(pid_t traceePid, int fd, void* buffer, size_t count);
+
+  /**
+   * Write up to count bytes of buffer into fd's pipe, as much as fits right
+   * now, never blocking. Same conditions as drain(), and fd must be a write
+   * end we could duplicate with pidfd_getfd: reopening a write end through
+   * /proc would leave a reader behind and hide EPIPE from the tracee.
+   * @return bytes written, -1 with errno set (EAGAIN if the pipe is full).
+   */
+  ssize_t fill(pid_t traceePid, int fd, const void* buffer, size_t count);
+
+  /**
+   * Read up to count bytes of fd's stream socket into buffer, waiting for the
+   * first one if nothing is there yet, whatever the tracee's blocking flags.
+   * Sockets are only duplicated with pidfd_getfd.
+   * @return bytes read, 0 on EOF, -1 with errno set (EBADF if fd is no stream
+   * socket we could duplicate).
+   */
+  ssize_t receive(pid_t traceePid, int fd, void* buffer, size_t count);
+
+  /**
+   * Inode of the pipe behind a probed fd, 0 if we have none cached or it is a
+   * socket.
+   */
+  ino_t inodeOf(int fd) const;
+
+  /** fd was closed or replaced in the tracee. */
+  void forget(int fd);
+
+  /** fds first to last were, close_range. */
+  void forget(int first, int last);
+
+  /** Every fd may have changed (exec, exit). */
+  void forgetAll();
+
+private:
+  struct duplicate {
+    int localFd;
+    ino_t inode;
+    /** S_IFIFO or S_IFSOCK. */
+    mode_t type;
+    /** Not reopened, the tracee's own open file description. */
+    bool shared;
+  };
+
+  /**
+   * Our cached duplicate of traceePid's fd, made on first use. nullptr if fd
+   * is neither a pipe nor a stream socket, or can't be duplicated.
+   * @param allowReopen fall back to reopening the pipe through /proc.
+   */
+  duplicate* duplicateOf(pid_t traceePid, int fd, bool allowReopen = true);
+
+  /**
+   * Open description of our duplicate of fd, if it is non blocking and was
+   * opened with accessMode (O_RDONLY or O_WRONLY), or is a socket, -1 with
+   * errno set if not.
+   */
+  int usableFd(pid_t traceePid, int fd, int accessMode);
+
+  /**
+   * Duplicate traceePid's fd into our process, -1 on failure. shared is set
+   * unless it was reopened.
+   */
+  static int duplicateFd(
+      pid_t traceePid, int fd, bool allowReopen, bool& shared);
+
+  /** Tracee fd to our duplicate of it. */
+  unordered_map<int, duplicate> duplicates;
+};
+
+#endif
@@ -2,24 +2,23 @@
 #define REGISTER_SAVER_H
 
 #include <sys/user.h>
+
+#include "inFlight.hpp"
+
 using namespace std;
 /**
  * A register saver class that has the ability to save/retrieve a register
  * struct by pushing and popping. Only a single register struct can be saved at
  * a time, and a pop cannot be performed unless preceded by a push and
- * vice-versa.
+ * vice-versa. The registers are only held while pushed.
  */
 
 class registerSaver {
 private:
   /**
-   * A copy of the saved register state
-   */
-  struct user_regs_struct regs;
-  /**
-   * A boolean indicating whether or not a register state has been pushed
+   * A copy of the saved register state, active iff one has been pushed.
    */
-  bool hasPushed = false;
+  inFlight<struct user_regs_struct> regs;
 
 public:
   /**
@@ -29,15 +28,14 @@ public:
    */
   void pushRegisterState(struct user_regs_struct newRegs) {
     // error checking
-    if (hasPushed) {
+    if (regs.active()) {
       throw runtime_error(
           "dettrace runtime exception: Attempting to push to a filed "
           "registerSaver.\n");
     }
 
     // hasn't pushed, so push state
-    hasPushed = true;
-    regs = newRegs;
+    regs.get() = newRegs;
   };
 
   /**
@@ -46,15 +44,16 @@ public:
    */
   struct user_regs_struct popRegisterState() {
     // error checking
-    if (!hasPushed) {
+    if (!regs.active()) {
       throw runtime_error(
           "dettrace runtime exception: Attempting to pop from an empty "
           "registerSaver.\n");
     }
 
     // return saved state
-    hasPushed = false;
-    return regs;
+    struct user_regs_struct saved = regs.get();
+    regs.release();
+    return saved;
   };
 };
 
@@ -0,0 +1,100 @@
+#ifndef REMOTE_CACHE_H
+#define REMOTE_CACHE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * --exec-cache-remote: a content addressed store over HTTP shared by the exec
+ * caches of many machines, e.g. bazel-remote, nginx with WebDAV, or any
+ * server taking GET, HEAD and PUT of paths under a prefix.
+ *
+ * execCache stays the first level: entries and blobs come from its directory,
+ * and are only fetched from the store when they are not there. Names are
+ * those of the directory, entries/<key> and blobs/<hash>. Requests of one
+ * lookup are pipelined on a single kept alive connection, those left when the
+ * server closes it are sent again on a new one. The first request that fails
+ * or takes longer than the timeout turns the store off for the rest of the
+ * run, we then only use the local cache.
+ */
+class remoteCache {
+public:
+  struct url {
+    string host;
+    string port = "80";
+    /** Prefix of every name, "" or starting with a slash. */
+    string path;
+  };
+
+  /** Parse http://HOST[:PORT][/PREFIX], false if it isn't one. */
+  static bool parseUrl(const string& text, url& out);
+
+  /**
+   * Store at text, runtimeError() if it is not a url we take. Connecting, and
+   * each send or receive, gives up after timeoutMillis.
+   */
+  remoteCache(const string& text, logger& log, int timeoutMillis = 5000);
+  ~remoteCache();
+
+  remoteCache(const remoteCache&) = delete;
+  remoteCache& operator=(const remoteCache&) = delete;
+
+  /**
+   * Fetch names. Those found get true and their contents, the rest false.
+   * @return false if the store failed, all of them are then left missing.
+   */
+  bool fetch(const vector<string>& names, vector<pair<bool, string>>& found);
+
+  /** Which of names the store has, as fetch() does without the contents. */
+  bool has(const vector<string>& names, vector<bool>& found);
+
+  /** Store contents as name, false if the store failed. */
+  bool store(const string& name, const string& contents);
+
+  /** Whether we still use the store. */
+  bool enabled() const { return !failed; }
+
+  /** Objects fetched and stored. */
+  uint64_t fetched = 0;
+  uint64_t stored = 0;
+
+private:
+  /**
+   * Send requests, each a method and name, and read their responses, in
+   * order. statuses and bodies get one per request.
+   */
+  bool exchange(
+      const vector<pair<string, string>>& requests,
+      const string* putBody,
+      vector<int>& statuses,
+      vector<string>* bodies);
+
+  /** Open sock to the store, false, and the store off, if we can't. */
+  bool connectToStore();
+
+  /** Read the next response, its body unless it answers a HEAD. */
+  bool readResponse(bool head, int& status, string& body);
+
+  /** Read until buffer holds bytes after at, false on EOF or error. */
+  bool fill(size_t at);
+
+  /** Close the connection, and if why isn't "", stop using the store. */
+  void disconnect(const string& why);
+
+  url at;
+  logger& log;
+  const int timeoutMillis;
+  int sock = -1;
+  bool failed = false;
+  /** Read but not yet parsed. */
+  string buffer;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define _MY_RNR_LOADER_H
 
 #include "globalState.hpp"
+#include "rnr_plugin.h"
 #include "scheduler.hpp"
 #include "state.hpp"
 
@@ -39,9 +40,15 @@ struct rnr_loader {
 };
 }
 
+/**
+ * The `--rnr` plugin. Plugins exporting rnr_plugin_init get the version 2 ABI
+ * of rnr_plugin.h, others the rnr_sysenter and rnr_sysexit above.
+ */
 class rnr {
 public:
   static void loadRnr(const string& dso);
+  /** Whether a plugin was loaded, it may want every post-hook we can give. */
+  static bool loaded();
   static bool callPreHook(
       int syscallNumber,
       globalState& gs,
@@ -54,6 +61,12 @@ public:
       state& s,
       ptracer& t,
       scheduler& sched);
+
+  /**
+   * Wait for an asynchronous plugin to consume every queued event. Called once
+   * the last tracee is gone.
+   */
+  static void finish();
 };
 
 #endif
@@ -0,0 +1,117 @@
+#ifndef RNR_PLUGIN_H
+#define RNR_PLUGIN_H
+
+/*
+ * Version 2 of the ABI between dettrace and `--rnr` plugins, for plugins
+ * written in C or C++. A plugin exports
+ *
+ *   int rnr_plugin_init(struct rnr_plugin* plugin);
+ *
+ * dettrace calls it once at start up with abi_version already set. It fills
+ * in the rest and returns 0, anything else makes dettrace exit. Plugins that
+ * only export rnr_sysenter and rnr_sysexit get the version 1 ABI of
+ * rnr_loader.hpp: a call per system call with its six arguments.
+ */
+
+#include <sys/user.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RNR_PLUGIN_ABI_VERSION 2
+
+/* System call numbers a plugin may be interested in are below this. */
+#define RNR_MAX_SYSCALLS 512
+
+/* Buffers of one system call given to a plugin, at most. */
+#define RNR_MAX_BUFFERS 2
+
+/* Buffer bytes an asynchronous plugin gets per event, at most. */
+#define RNR_EVENT_BYTES 4096
+
+/* plugin->flags: events go to consume() on a thread of its own. */
+#define RNR_PLUGIN_ASYNC 1u
+
+enum rnr_buffer_kind {
+  /* Read by the system call, pre-read on entry, e.g. what write writes. */
+  RNR_BUFFER_IN,
+  /* Written by the system call, read on exit, as many bytes as it returned,
+   * e.g. what read read. */
+  RNR_BUFFER_OUT,
+  /* A NUL terminated path, read on entry. */
+  RNR_BUFFER_PATH,
+};
+
+/* Tracee memory a system call reads or writes, as dettrace read it. */
+struct rnr_buffer {
+  int arg;  /* argument holding the address, from 0 */
+  int kind; /* enum rnr_buffer_kind */
+  unsigned long addr;
+  /* Bytes the system call passes, for paths without the NUL. */
+  unsigned long size;
+  /* Bytes in data, at most the plugin's max_buffer_bytes. Fewer than size if
+   * it asked for fewer or not all of them could be read. */
+  unsigned long copied;
+  const unsigned char* data;
+};
+
+/* One system call entry or exit. */
+struct rnr_syscall {
+  int pid;
+  int tid;
+  int syscallno;
+  int exit; /* 0 on entry, 1 on exit */
+  /* The tracee's registers, arguments in rdi, rsi, rdx, r10, r8, r9. */
+  struct user_regs_struct regs;
+  long retval; /* on exit only */
+  /* Pre-read buffers, for system calls with any, see rnr_buffer_kind. */
+  unsigned int nbuffers;
+  struct rnr_buffer buffers[RNR_MAX_BUFFERS];
+  /* Set by sysenter to not run the system call. Its return value is what
+   * sysenter returned. */
+  int noop;
+};
+
+struct rnr_plugin {
+  unsigned int abi_version; /* set by dettrace, RNR_PLUGIN_ABI_VERSION */
+  unsigned int flags;       /* RNR_PLUGIN_* */
+  /* Bytes of each buffer to pre-read, 0 for none. */
+  unsigned long max_buffer_bytes;
+  /* Bit per system call number, the plugin only sees those set, see
+   * rnr_want() and rnr_want_all(). */
+  unsigned char interest[RNR_MAX_SYSCALLS / 8];
+  /* Passed back to the callbacks. */
+  void* ctx;
+
+  /* Synchronous plugins: called with the tracee stopped. Either may be
+   * NULL. */
+  long (*sysenter)(void* ctx, struct rnr_syscall* call);
+  void (*sysexit)(void* ctx, const struct rnr_syscall* call);
+
+  /* RNR_PLUGIN_ASYNC plugins: called on a thread of the plugin's own, in
+   * order, for every entry and exit, while the tracee runs on. These can't
+   * noop system calls. Buffers hold at most RNR_EVENT_BYTES between them. call
+   * and its buffers are only valid until consume returns. */
+  void (*consume)(void* ctx, const struct rnr_syscall* call);
+};
+
+static inline void rnr_want(struct rnr_plugin* plugin, int syscallno) {
+  if (syscallno >= 0 && syscallno < RNR_MAX_SYSCALLS) {
+    plugin->interest[syscallno / 8] |= 1u << (syscallno % 8);
+  }
+}
+
+static inline void rnr_want_all(struct rnr_plugin* plugin) {
+  for (int i = 0; i < RNR_MAX_SYSCALLS / 8; i++) {
+    plugin->interest[i] = 0xff;
+  }
+}
+
+int rnr_plugin_init(struct rnr_plugin* plugin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef RUN_QUEUE_H
+#define RUN_QUEUE_H
+
+#include <sys/types.h>
+
+#include <functional>
+#include <set>
+#include <unordered_map>
+
+#include "logicalclock.hpp"
+#include "pidBitmap.hpp"
+
+using namespace std;
+
+/**
+ * One of the scheduler's run queues: the processes in it and which of them
+ * goes first. By default that is the highest pid, see pidBitmap. With
+ * orderBy, it is the lowest logicalStamp instead, taken as the process joins
+ * the queue: a queued process doesn't run, so its clock doesn't move.
+ */
+class runQueue {
+public:
+  void insert(pid_t pid) {
+    if (bits.contains(pid)) {
+      return;
+    }
+    bits.insert(pid);
+    if (stampOf) {
+      logicalStamp stamp = stampOf(pid);
+      order.insert(stamp);
+      stamps[pid] = stamp;
+    }
+  }
+
+  /**
+   * Remove pid from the queue.
+   * @return whether pid was in the queue.
+   */
+  bool erase(pid_t pid) {
+    if (!bits.erase(pid)) {
+      return false;
+    }
+    if (stampOf) {
+      auto it = stamps.find(pid);
+      order.erase(it->second);
+      stamps.erase(it);
+    }
+    return true;
+  }
+
+  bool contains(pid_t pid) const { return bits.contains(pid); }
+
+  bool empty() const { return bits.empty(); }
+
+  /** The process that goes first, -1 if empty. */
+  pid_t first() const {
+    if (!stampOf) {
+      return bits.highest();
+    }
+    return order.empty() ? -1 : order.begin()->tid;
+  }
+
+  /** Every process in the queue, in no particular order. */
+  const pidBitmap& members() const { return bits; }
+
+  void swap(runQueue& other) {
+    bits.swap(other.bits);
+    stampOf.swap(other.stampOf);
+    order.swap(other.order);
+    stamps.swap(other.stamps);
+  }
+
+  /**
+   * Order the queue by the stamps stampOf gives, from now on. Processes
+   * already queued are stamped right away.
+   */
+  void orderBy(function<logicalStamp(pid_t)> stampOf) {
+    this->stampOf = stampOf;
+    order.clear();
+    stamps.clear();
+    for (pid_t pid = bits.highest(); pid != -1; pid = bits.highestBelow(pid)) {
+      logicalStamp stamp = stampOf(pid);
+      order.insert(stamp);
+      stamps[pid] = stamp;
+    }
+  }
+
+private:
+  pidBitmap bits;
+  /** Empty for pid order. */
+  function<logicalStamp(pid_t)> stampOf;
+  /** With stampOf: the stamp of every queued process, and the reverse. */
+  set<logicalStamp> order;
+  unordered_map<pid_t, logicalStamp> stamps;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SCHEDULE_LOG_H
+#define SCHEDULE_LOG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Scheduling decisions of a run, written by --record-schedule and followed by
+ * --use-schedule.
+ *
+ * Every time the scheduler picks a process (scheduler::getNext changes) is a
+ * decision. For each we log the pid picked, and whether the pick was futile:
+ * the process only retried a blocking system call that blocked again, and was
+ * preempted back to the blocked heap. Runs with the same inputs make the same
+ * decisions, so a later run can skip the futile ones outright, which leaves
+ * the scheduler exactly where the retry would have. At the first decision
+ * that doesn't match the log we stop following it and schedule as usual.
+ *
+ * The file is a scheduleLogHeader followed by an int32_t per decision: the
+ * pid, negated if the pick was futile. Native endian, like the other logs.
+ */
+
+/** Bump when the layout of the file changes. */
+const uint32_t SCHEDULE_LOG_VERSION = 1;
+
+/** First bytes of every schedule log. */
+const char SCHEDULE_LOG_MAGIC[8] = {'D', 'T', 'S', 'C', 'H', 'E', 'D', '\0'};
+
+struct scheduleLogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t decisions;
+};
+
+class scheduleLog {
+public:
+  /**
+   * Create (or truncate) the log at path to record to, or with follow, read
+   * it to follow. Exits if it can't, or it isn't a schedule log.
+   */
+  scheduleLog(const string& path, bool follow);
+
+  /** Writes the log out, when recording. */
+  ~scheduleLog();
+
+  scheduleLog(const scheduleLog&) = delete;
+  scheduleLog& operator=(const scheduleLog&) = delete;
+
+  bool following() const { return isFollowing; }
+
+  /** Decision number decision picked pid. Recording only. */
+  void decided(uint64_t decision, pid_t pid);
+
+  /** Decision number decision turned out futile. Recording only. */
+  void futile(uint64_t decision);
+
+  /**
+   * Whether decision, about to pick pid, was futile in the recording. If the
+   * recording picked another process, we diverged and this and every later
+   * call return false.
+   */
+  bool skip(uint64_t decision, pid_t pid);
+
+  /** Futile decisions recorded, or skipped. */
+  uint64_t futileDecisions = 0;
+
+  /** Decision we diverged from the log at, or -1. */
+  int64_t divergedAt = -1;
+
+private:
+  string path;
+  bool isFollowing;
+  vector<int32_t> decisions;
+};
+
+#endif
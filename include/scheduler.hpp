@@ -2,14 +2,42 @@
 #define SCHEDULER_H
 
 #include "logger.hpp"
+#include "logicalclock.hpp"
+#include "pidBitmap.hpp"
+#include "runQueue.hpp"
+#include "scheduleLog.hpp"
 #include "state.hpp"
+#include "timeline.hpp"
+#include "timerWheel.hpp"
 
+#include <functional>
 #include <map>
-#include <queue>
-#include <set>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
+/**
+ * What a tracee whose system call would have blocked is waiting for.
+ * @see scheduler::preemptAndWaitFor
+ */
+enum class waitKind {
+  pipeReadable, /*< Data in the pipe with inode key. */
+  pipeWritable, /*< Space in the pipe with inode key. */
+  childExit, /*< A child of thread group key to exit (wait4/waitid). */
+  futex, /*< Another thread of thread group key to do anything (futex). */
+  futexWord, /*< A wake on the futex tracee key waits on, see futexQueues. */
+  timer, /*< Tracee key's timer, see scheduler::armTimer. */
+  eventfd, /*< A change of the eventfd with eventfdInfo::id key. */
+};
+
+const int WAIT_KIND_COUNT = 7;
+
+struct waitReason {
+  waitKind kind;
+  uint64_t key;
+};
+
 /**
  * Stateful class to keep track of all currently running processes in our
  process tree.
@@ -19,9 +47,46 @@ using namespace std;
 
  * Detects deadlocks in program and throws error, if this ever happens.
 
- * Current Scheduling policy: 2 Priority Queues: runnableHeap and blockedHeap.
+ * Current Scheduling policy: 2 run queues: runnableHeap and blockedHeap.
  * Runs all runnable processes in order of highest PID first.
  * Then tries the blocked processes (and swaps the heaps).
+ * The queues are pidBitmaps, so every scheduling decision is constant time
+ * and allocation free, even with thousands of live processes.
+ * With orderByClock (--clock-order), processes in a queue run in order of
+ * their logical clocks instead, lowest first, ties broken by pid.
+ * With preferProducers (--producer-first), a process parking on a pipe is
+ * followed by whoever last woke a waiter of that pipe, its producer (or
+ * consumer, for a full pipe), ahead of the queue's order.
+ *
+ * Blocked processes that told us what they are waiting for (a pipe, a child, a
+ * futex) are parked in a third set instead of the blockedHeap, and only moved
+ * back to blockedHeap once something happens that could unblock them. This way
+ * they are not replayed over and over on every heap swap. Wake ups come from
+ * deterministic events in the tracer, so scheduling stays deterministic.
+ * As we cannot see every event (e.g. system calls our seccomp filter lets
+ * through), parked processes are also all woken when nothing else can run, and
+ * every waitRetryInterval heap swaps.
+ *
+ * Tracees waiting with a timeout (poll, epoll_wait) also arm a timer on their
+ * logical clock. Whenever we would retry parked processes, the earliest timer
+ * goes off first: instead of spinning until enough retries add up to the
+ * timeout, logical time jumps straight to the deadline.
+ *
+ * With a scheduleLog (--record-schedule, --use-schedule), every decision is
+ * numbered and logged, and retries a recorded run found futile are skipped.
+ *
+ * A run where every process is parked on events we model (pipes, children,
+ * futexes, eventfds, timers), no timer is left and the retries of
+ * maxFutileStalls such stalls in a row made no progress is deadlocked: we
+ * stop with a report of what each process waits for instead of retrying them
+ * forever. A process retried on a back-off waits for something we can't see,
+ * it keeps being retried.
+ *
+ * A run where somebody can always run but hardly anything happens, a poll
+ * loop on a process that is itself blocked, a pipe nobody drains, is not a
+ * deadlock. With watchForStalls (--watchdog), rounds of heap swaps where
+ * fewer than 1 in stallProgressRatio retries made progress are reported, see
+ * takeStall, for the execution to dump what every tracee is waiting on.
  */
 
 class scheduler {
@@ -57,6 +122,63 @@ public:
    */
   void preemptAndScheduleNext();
 
+  /**
+   * Like preemptAndScheduleNext, but park the current process until
+   * wake(reason.kind, reason.key) is called, or our fallbacks kick in.
+   */
+  void preemptAndWaitFor(waitReason reason);
+
+  /**
+   * Like preemptAndWaitFor, but wake up on whichever of reasons comes first.
+   * If retryAfter is not 0, the process is also woken after that many heap
+   * swaps, for events we might not see.
+   */
+  void preemptAndWaitForAny(
+      const vector<waitReason>& reasons, uint32_t retryAfter);
+
+  /**
+   * Whether any process is parked waiting on kind. Cheap, call before doing
+   * work to figure out the key to wake.
+   */
+  bool hasWaiters(waitKind kind) const {
+    return waitingCount[(int)kind] != 0;
+  }
+
+  /**
+   * Something happened that may unblock processes waiting on (kind, key),
+   * move them back to the blockedHeap to be retried.
+   */
+  void wake(waitKind kind, uint64_t key);
+
+  /**
+   * Move every process waiting on kind back to the blockedHeap.
+   */
+  void wakeAll(waitKind kind);
+
+  /**
+   * Arm pid's timer, it goes off (waking whoever waits on waitKind::timer, pid)
+   * once nobody else can run and no earlier timer is left. Replaces pid's
+   * current timer.
+   */
+  void armTimer(pid_t pid, logical_clock::time_point deadline) {
+    expiredTimers.erase(pid);
+    timers.arm(pid, deadline);
+  }
+
+  bool timerArmed(pid_t pid) const { return timers.armed(pid); }
+
+  /**
+   * Whether pid's timer went off, if so it is disarmed and its deadline stored
+   * in deadline.
+   */
+  bool takeExpiredTimer(pid_t pid, logical_clock::time_point* deadline);
+
+  /** pid no longer needs its timer, whether it went off or not. */
+  void cancelTimer(pid_t pid) {
+    timers.cancel(pid);
+    expiredTimers.erase(pid);
+  }
+
   /**
    * Adds new process to scheduler.
    * This new process will be scheduled to run next.
@@ -85,18 +207,114 @@ public:
   uint32_t callsToScheduleNextProcess = 0;
 
   void killAllProcesses() {
-    while (!runnableHeap.empty()) {
-      pid_t pid = runnableHeap.top();
-      kill(pid, SIGKILL);
-      runnableHeap.pop();
+    for (runQueue* heap : {&runnableHeap, &blockedHeap}) {
+      while (!heap->empty()) {
+        pid_t pid = heap->first();
+        kill(pid, SIGKILL);
+        heap->erase(pid);
+      }
     }
-    while (!blockedHeap.empty()) {
-      pid_t pid = blockedHeap.top();
+    while (!waitingSet.empty()) {
+      pid_t pid = waitingSet.highest();
       kill(pid, SIGKILL);
-      blockedHeap.pop();
+      waitingSet.erase(pid);
     }
   }
 
+  /**
+   * --clock-order: from now on run queued processes in order of the
+   * logicalStamp stampOf gives them, lowest first, rather than highest pid
+   * first. Everyone gets to catch up with the process furthest ahead in
+   * logical time before it runs again.
+   */
+  void orderByClock(function<logicalStamp(pid_t)> stampOf) {
+    runnableHeap.orderBy(stampOf);
+    blockedHeap.orderBy(stampOf);
+    byClock = true;
+  }
+
+  /**
+   * --producer-first: when a process parks on a pipe, run next the process
+   * that last woke a process parked on the same end of it, if it can run.
+   * A reader blocked on an empty pipe is then followed by the writer feeding
+   * it rather than by whoever has the highest pid, often another reader only
+   * to block and be replayed in turn. Who woke whom comes from the hooks, so
+   * this is as deterministic as the rest of the schedule.
+   */
+  void preferProducers() { producerFirst = true; }
+
+  // Keep track of how many times a parked process was woken up:
+  uint32_t waitWakeups = 0;
+
+  // Keep track of how many times a producer ran ahead of the queue's order:
+  uint32_t producersPreferred = 0;
+
+  // Keep track of how many timers went off:
+  uint32_t timersFired = 0;
+
+  /** Where to record parked processes and heap swaps, if --timeline. */
+  timeline* events = nullptr;
+
+  /** Decisions to record or follow, if --record-schedule or --use-schedule. */
+  scheduleLog* schedule = nullptr;
+
+  /**
+   * The process picked last ran a system call to completion, or otherwise
+   * made progress, so that pick wasn't futile.
+   */
+  void madeProgress() {
+    pickProgressed = true;
+    progressSinceStall = true;
+    windowProgress++;
+  }
+
+  /**
+   * Some process ran a system call to completion without a post-hook. Not a
+   * decision's progress, see madeProgress, but proof we are not deadlocked.
+   */
+  void ranSystemCall() {
+    progressSinceStall = true;
+    windowProgress++;
+  }
+
+  /**
+   * pid's system call would have blocked and is replayed. If pid was picked
+   * by the decision before last, did nothing else since, and was preempted
+   * back to the blocked heap, that decision was futile.
+   */
+  void replayed(pid_t pid);
+
+  /**
+   * --watchdog: look for stalls every rounds heap swaps, doubling after each
+   * stall reported until a round makes progress again.
+   */
+  void watchForStalls(uint32_t rounds) { stallRounds = stallWindow = rounds; }
+
+  /**
+   * Whether the last window of rounds was a stall, see watchForStalls. Only
+   * true once per stall.
+   */
+  bool takeStall() {
+    bool stall = stallFound;
+    stallFound = false;
+    return stall;
+  }
+
+  /** What the stall takeStall found, how often each process was replayed. */
+  struct stallReport {
+    uint32_t rounds;
+    uint64_t progress;
+    uint64_t replays;
+    map<pid_t, uint64_t> replaysOf;
+  };
+  const stallReport& lastStall() const { return stall; }
+
+  /**
+   * Every process we run or retry, by queue, with what parked ones wait for.
+   * One process per line, each line starting with indent.
+   */
+  string describeQueues(const string& indent) const;
+
 private:
   logger& log; /**< log file wrapper */
 
@@ -106,18 +324,134 @@ private:
   pid_t nextPid = -1;
 
   /**
-   * Two max heaps: runnableHeap and blockedHeap.
-   * Processes with higher PIDs go first.
+   * Two run queues: runnableHeap and blockedHeap.
+   * Processes with higher PIDs go first, or lower stamps, see orderByClock.
    * Run all runnable processes. When we run out of these, switch the names of
    * the heaps, and continue.
    */
-  priority_queue<pid_t> runnableHeap;
-  priority_queue<pid_t> blockedHeap;
+  runQueue runnableHeap;
+  runQueue blockedHeap;
+
+  /** See orderByClock. */
+  bool byClock = false;
+
+  /**
+   * See preferProducers. wokenBy maps a pipe to the process that last woke a
+   * waiter of it, per waitKind, preferred is the one to run next if it still
+   * can.
+   */
+  bool producerFirst = false;
+  unordered_map<uint64_t, pid_t> wokenBy[WAIT_KIND_COUNT];
+  pid_t preferred = -1;
+
+  /** With producerFirst, pick the process feeding a pipe one of reasons is. */
+  void preferWakerOf(const vector<waitReason>& reasons);
+
+  /** The process to run out of runnableHeap: preferred, or the first. */
+  pid_t firstRunnable();
+
+  /**
+   * The process running, to preempt: the first runnable one, or with
+   * orderByClock or preferProducers the one we picked last, a new child may
+   * have a lower stamp than its parent, a producer need not come first.
+   */
+  pid_t current() const {
+    return byClock || producerFirst ? nextPid : runnableHeap.first();
+  }
 
   /**
    * Set of finished processes.
    */
-  set<pid_t> finishedProcesses;
+  pidBitmap finishedProcesses;
+
+  /**
+   * Blocked processes parked until an event they wait for, see
+   * preemptAndWaitFor. waiters is indexed by waitKind and maps a key to the
+   * processes waiting on it, waitingFor is the reverse mapping.
+   */
+  pidBitmap waitingSet;
+  unordered_multimap<uint64_t, pid_t> waiters[WAIT_KIND_COUNT];
+  unordered_map<pid_t, vector<waitReason>> waitingFor;
+  /** Number of entries in waiters, per kind. */
+  size_t waitingCount[WAIT_KIND_COUNT] = {};
+
+  /**
+   * Waiting processes to wake at a given heap swap, in the order they asked,
+   * see preemptAndWaitForAny. retryOf is the reverse mapping.
+   */
+  multimap<uint32_t, pid_t> retries;
+  unordered_map<pid_t, multimap<uint32_t, pid_t>::iterator> retryOf;
+
+  /** Wake the processes whose retry is due. */
+  void wakeDueRetries();
+
+  /**
+   * Wake every parked process this often (in heap swaps), as a safety net for
+   * wake ups we did not see.
+   */
+  static const uint32_t waitRetryInterval = 64;
+  uint32_t heapSwaps = 0;
+
+  /**
+   * Stalls, every process parked and no timer left, in a row whose retries
+   * made no progress, see checkDeadlock. Retries may not notice the event they
+   * wait for right away, a read waiting on a pipe from outside only runs after
+   * state::maxReadDeferrals of them, so plenty are allowed before we give up.
+   */
+  static const uint32_t maxFutileStalls = 64;
+  uint32_t futileStalls = 0;
+  bool progressSinceStall = true;
+
+  /**
+   * Nobody can run and no timer is left: count the stall, and once
+   * maxFutileStalls of them made no progress throw a runtimeError reporting
+   * the wait of every parked process. Stalls with a process waiting on a
+   * back-off retry, see preemptAndWaitForAny, don't count.
+   */
+  void checkDeadlock();
+
+  /** What process waits for, "pipe readable 1234 or timer 7". */
+  string describeWait(pid_t process) const;
+
+  /** A stall is under 1 in this many retries making progress. */
+  static const uint64_t stallProgressRatio = 100;
+  /** --watchdog rounds, 0 for none, and the window we are at with backoff. */
+  uint32_t stallRounds = 0;
+  uint32_t stallWindow = 0;
+  uint32_t windowStart = 0;
+  uint64_t windowProgress = 0;
+  uint64_t windowReplays = 0;
+  map<pid_t, uint64_t> windowReplaysOf;
+  bool stallFound = false;
+  stallReport stall;
+
+  /** At the end of a window: was it a stall? */
+  void checkStall();
+
+  /** Decisions made so far, and the one that picked the current process. */
+  uint64_t decisions = 0;
+  uint64_t pickedAt = 0;
+  bool pickProgressed = false;
+
+  /**
+   * Pending timers, and deadlines of the ones that went off but whose tracee
+   * has yet to notice.
+   */
+  timerWheel timers;
+  unordered_map<pid_t, logical_clock::time_point> expiredTimers;
+
+  /**
+   * Fire the earliest timer, if any.
+   * @return whether one went off.
+   */
+  bool fireNextTimer();
+
+  /**
+   * Drop process from the waiting set, it is up to the caller to put it back
+   * in a run queue.
+   * @return whether process was waiting.
+   */
+  bool forgetWaiter(pid_t process);
 
   /** Remove process from scheduler.
    * Calls deleteProcess, used to share code between
@@ -132,10 +466,14 @@ private:
   /**
    * Get next process based on whether the runnableHeap is empty.
    * If the runnableHeap is empty, swap the heaps, and continue.
+   * Counts the decision, and skips it if the schedule says it is futile.
    * @return next process to schedule.
    */
   pid_t scheduleNextProcess();
 
+  /** scheduleNextProcess without the decision bookkeeping. */
+  pid_t pickNextProcess();
+
   /**< Debug function to print all data about processes. */
   void printProcesses();
 };
@@ -0,0 +1,81 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Bump allocator for the buffers a system call hook only needs until it
+ * returns, e.g. the chunks tracer side reads and writes go through.
+ *
+ * reset() makes all of it free again at once, execution does before every
+ * hook. Blocks are kept, so once the arena has grown to what the hooks need
+ * it hands out memory without calling malloc. Only one off huge requests, like
+ * a 32MiB getrandom, get their memory back. Only for trivially destructible
+ * types: nothing is ever destroyed.
+ */
+class scratchArena {
+public:
+  /** Uninitialized room for count Ts, valid until the next reset(). */
+  template <typename T>
+  T* allocate(size_t count) {
+    return static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+  }
+
+  /** Free everything allocated so far. Blocks bigger than usual go too. */
+  void reset() {
+    blocks.erase(
+        remove_if(
+            blocks.begin(), blocks.end(),
+            [](const block& b) { return b.size > blockSize; }),
+        blocks.end());
+    current = 0;
+    used = 0;
+  }
+
+  /** Bytes held in blocks. */
+  size_t capacity() const {
+    size_t total = 0;
+    for (auto& b : blocks) {
+      total += b.size;
+    }
+    return total;
+  }
+
+private:
+  static const size_t blockSize = 256 * 1024;
+
+  struct block {
+    unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  void* allocateBytes(size_t size, size_t align) {
+    for (; current < blocks.size(); current++, used = 0) {
+      size_t start = (used + align - 1) & ~(align - 1);
+      if (start + size <= blocks[current].size) {
+        used = start + size;
+        return blocks[current].data.get() + start;
+      }
+    }
+    // new[] memory is aligned for any fundamental type.
+    size_t bytes = size > blockSize ? size : blockSize;
+    blocks.push_back(block{unique_ptr<char[]>(new char[bytes]), bytes});
+    used = size;
+    return blocks[current].data.get();
+  }
+
+  vector<block> blocks;
+  /** The block we allocate from, blocks before it are full. */
+  size_t current = 0;
+  /** Bytes used in blocks[current]. */
+  size_t used = 0;
+};
+
+#endif
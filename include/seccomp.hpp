@@ -3,6 +3,7 @@
 
 #include <fcntl.h>
 #include <libgen.h>
+#include <linux/filter.h>
 #include <seccomp.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -13,11 +14,15 @@
 #include <cstdlib>
 #include <cstring> // for strlen
 #include <string>
+#include <vector>
 
 #include <sched.h>
 #include <iostream>
+#include <set>
 #include <tuple>
 
+#include "policyProfile.hpp"
+
 /**
  * seccomp class.
  * Helper class for working with seccomp (short for secure computing mode), a
@@ -34,7 +39,43 @@ private:
    * Holds return state of seccomp_init.
    * @see seccomp_init.
    */
-  scmp_filter_ctx ctx;
+  scmp_filter_ctx ctx = nullptr;
+
+  /**
+   * BPF program read from the cache, or exported from ctx for bufferGate,
+   * loaded instead of compiling ctx. Empty when we built the rules and load
+   * them through libseccomp.
+   * @see cachePath
+   */
+  std::vector<struct sock_filter> cachedProgram;
+
+  /**
+   * Service notify-safe system calls through the seccomp notify fd instead of
+   * ptrace.
+   * @see inspect
+   */
+  bool useNotify;
+
+  /**
+   * Let reads and writes made from the logical clock page's gate through,
+   * see gateRules. Never with useNotify, whose filter libseccomp loads.
+   */
+  bool bufferGate;
+
+  /** --lite, see liteSystemCalls. */
+  bool lite;
+
+  /** --profile, nullptr without one. */
+  const policyProfile* profile;
+
+  /** System calls whose profile override is in ctx already. */
+  std::set<long> overridesApplied;
+
+  /**
+   * Whether profile overrides systemCall, whose rules are then skipped: the
+   * first of them adds the override instead.
+   */
+  bool overridden(uint16_t systemCall);
 
   /**
    * Code defining all system call that we implement or let through with debug
@@ -48,7 +89,67 @@ private:
    * Code defining all system call that we implement or let through.
    * @param debug True for debug mode. (Extra logging if true).
    */
-  void loadRules(bool debug, bool convertUids);
+  void loadRules(
+      bool debug,
+      bool convertUids,
+      bool traceWritev,
+      bool ioUring,
+      bool ephemeral,
+      bool virtualCpus,
+      bool fakeroot);
+
+  /**
+   * Order the compiled filter so frequent system calls are matched first, and
+   * use a binary search tree for the rest when libseccomp supports it.
+   */
+  void optimizeRuleOrder();
+
+  /**
+   * Where the compiled filter for this policy is cached. The policy only
+   * depends on the debug rules, convertUids, traceWritev, lite, ioUring,
+   * ephemeral, virtualCpus, fakeroot, the profile, our build and the
+   * libseccomp we run with, which the file name covers. Empty if there is no
+   * cache directory to use, or DETTRACE_NO_SECCOMP_CACHE is set.
+   */
+  static std::string cachePath(
+      bool debug,
+      bool convertUids,
+      bool traceWritev,
+      bool lite,
+      bool ioUring,
+      bool ephemeral,
+      bool virtualCpus,
+      bool fakeroot,
+      const policyProfile* profile);
+
+  /** Read a cached BPF program into cachedProgram, false if there is none. */
+  bool loadCache(const std::string& path);
+
+  /** Export ctx's BPF program to path, best effort. */
+  void saveCache(const std::string& path);
+
+  /** Export ctx's BPF program to program, false if we couldn't. */
+  bool exportProgram(std::vector<struct sock_filter>& program);
+
+  /**
+   * Rules allowing read and write when the instruction pointer is in the
+   * gate of the logical clock page, checked before every other rule. Patched
+   * system call sites of regular files go through the gate, see
+   * bufferedSystemCallTrampoline. libseccomp has no rule for the instruction
+   * pointer, so these are put in front of its program. Only read and write
+   * look at it, the kernel still caches the other system calls we allow.
+   */
+  static std::vector<struct sock_filter> gateRules();
+
+  /** Put gateRules in front of program, if they fit. */
+  static void addGate(std::vector<struct sock_filter>& program);
+
+  /**
+   * The system calls our filter allows whatever their arguments, which Linux
+   * 5.11 and newer let through without running it, see seccompActionCache.
+   * Empty if we have no program to look at.
+   */
+  std::vector<uint32_t> alwaysAllowed();
 
   /**
    * Add system call to whitelist but no call to ptrace.
@@ -63,6 +164,38 @@ private:
    */
   void intercept(uint16_t systemCall);
 
+  /**
+   * Intercept a system call whose handler only inspects its arguments. Goes
+   * through the seccomp notify fd when useNotify is set, and through ptrace
+   * otherwise.
+   * @param systemCall system call with a handleNotify hook.
+   */
+  void inspect(uint16_t systemCall);
+
+  /**
+   * Same as inspect, but only if cond is true, otherwise, no interception.
+   * @param systemCall system call with a handleNotify hook.
+   */
+  void inspect(uint16_t systemCall, bool cond);
+
+  /**
+   * Fail system call in kernel with errno err, without stopping the tracee.
+   * Used for system calls we never support, so programs probing for them fall
+   * back to an older interface at no cost.
+   * @param systemCall system call to reject.
+   * @param err errno value returned to the tracee.
+   */
+  void reject(uint16_t systemCall, int err);
+
+  /**
+   * Return 0 from system call in the kernel, without running it or stopping
+   * the tracee, when all the argument comparisons in argFilters hold.
+   * @param systemCall system call to skip.
+   * @param argFilters comparisons that must all match, built with SCMP_A*.
+   */
+  void succeed(
+      uint16_t systemCall, const std::vector<scmp_arg_cmp>& argFilters = {});
+
   /**
    * Add system call to whitelist.
    * Intercept based on whether cond is true, otherwise,
@@ -71,6 +204,26 @@ private:
    */
   void intercept(uint16_t systemCall, bool cond);
 
+  /**
+   * Add system call to whitelist, but only when all the argument comparisons
+   * in argFilters hold. Calls that match no rule fall through to the filter's
+   * default action, so this is used to let the uninteresting operations of a
+   * multiplexed system call (ioctl, fcntl, futex) run without a ptrace stop.
+   * @param systemCall system call to add to whitelist.
+   * @param argFilters comparisons that must all match, built with SCMP_A*.
+   */
+  void noIntercept(
+      uint16_t systemCall, const std::vector<scmp_arg_cmp>& argFilters);
+
+  /**
+   * Add system call to whitelist and intercept it with ptrace, but only when
+   * all the argument comparisons in argFilters hold.
+   * @param systemCall system call to intercept.
+   * @param argFilters comparisons that must all match, built with SCMP_A*.
+   */
+  void intercept(
+      uint16_t systemCall, const std::vector<scmp_arg_cmp>& argFilters);
+
 public:
   /**
    * Constructor.
@@ -81,11 +234,43 @@ public:
    * This system call doesn't actually load the filter to the kernel. Merely
    * initializes it. Please use loadFilterToKernel.
    *
+   * Without useNotify, a filter compiled by an earlier run for the same
+   * policy is read from the cache instead, and no rules are built at all.
+   *
    * PTRACEME should be called by the tracee before this call.
    *
    * @param debugLevel: If 4 or 5, will intercept several more system calls.
+   * @param useNotify: Report notify-safe system calls through the seccomp
+   * notify fd, see isNotifySupported.
+   * @param traceWritev: Stop for writev too, which --hash-outputs needs to
+   * see.
+   * @param bufferGate: Let reads and writes from the logical clock page's gate
+   * through, see gateRules.
+   * @param lite: Let the system calls that block and only matter to the order
+   * tracees run in through, see liteSystemCalls.
+   * @param ioUring: Intercept io_uring_setup and io_uring_enter, rather than
+   * fail them with ENOSYS, see ioUring.
+   * @param ephemeral: Succeed fsync and the other flushes to disk without
+   * running them, --ephemeral.
+   * @param virtualCpus: Intercept sched_getaffinity and sched_setaffinity, to
+   * answer them for the machine of --cpus.
+   * @param fakeroot: Intercept the chown and chmod families, see
+   * fakeOwnership.
+   * @param profile: Overrides of our rules, nullptr for none, see
+   * policyProfile.
    */
-  seccomp(int debugLevel, bool convertUids);
+  seccomp(
+      int debugLevel,
+      bool convertUids,
+      bool useNotify,
+      bool traceWritev,
+      bool bufferGate,
+      bool lite,
+      bool ioUring,
+      bool ephemeral,
+      bool virtualCpus,
+      bool fakeroot,
+      const policyProfile* profile);
 
   /**
    * Used to avoid raise conditions between the tracee and tracee of a ptrace
@@ -94,6 +279,29 @@ public:
    */
   void loadFilterToKernel();
 
+  /**
+   * How many system calls the kernel's action cache lets through without
+   * running our filter, and their names, for --print-statistics. Rules with
+   * argument checks keep their system call out of it, so the multiplexed
+   * calls we only let through for some arguments (fcntl, futex, ioctl,
+   * rt_sigprocmask) run the filter every time.
+   */
+  std::string describeAlwaysAllowed();
+
+  /**
+   * True if systemCall is only intercepted for some of its arguments. Such
+   * calls reach the tracer through the filter's default action (INT16_MAX)
+   * and should be handled as if they had been intercepted directly.
+   * @param systemCall system call number read from the tracee.
+   */
+  static bool isArgumentFiltered(long systemCall);
+
+  /**
+   * True if we were built against a libseccomp with user notification support
+   * (2.5 and newer).
+   */
+  static bool isNotifySupported();
+
   /**
    * Destructor.
    * Free all resources now that kernel has filter.
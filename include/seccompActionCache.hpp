@@ -0,0 +1,43 @@
+#ifndef SECCOMP_ACTION_CACHE_H
+#define SECCOMP_ACTION_CACHE_H
+
+#include <linux/filter.h>
+#include <stdint.h>
+
+#include <vector>
+
+using namespace std;
+
+/**
+ * What Linux 5.11 and newer make of a seccomp filter for its action cache.
+ * When a filter allows a system call whatever its arguments and instruction
+ * pointer, the kernel sets the call's bit in a per architecture bitmap at load
+ * time and lets it through from then on without running the filter at all.
+ * It finds those calls by running the filter on the number and architecture
+ * alone, bailing on any instruction reading anything else; alwaysAllows does
+ * the same, like seccomp_is_const_allow in kernel/seccomp.c.
+ *
+ * Only a filter with nothing but the number and architecture in front of a
+ * system call's verdict gets it cached: rules checking arguments, and our
+ * gate's instruction pointer checks, keep their system calls running the
+ * filter, see seccomp::gateRules.
+ */
+class seccompActionCache {
+public:
+  /** System call numbers a cache covers, past the last x86_64 one. */
+  static const uint32_t systemCallCount = 512;
+
+  /**
+   * True if program returns SECCOMP_RET_ALLOW for system call nr of arch
+   * without looking at anything else, false if it returns anything else or we
+   * can't tell.
+   */
+  static bool alwaysAllows(
+      const vector<struct sock_filter>& program, uint32_t arch, uint32_t nr);
+
+  /** The system calls below systemCallCount program always allows for arch. */
+  static vector<uint32_t> alwaysAllowed(
+      const vector<struct sock_filter>& program, uint32_t arch);
+};
+
+#endif
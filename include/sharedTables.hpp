@@ -0,0 +1,170 @@
+#ifndef SHARED_TABLES_H
+#define SHARED_TABLES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+using namespace std;
+
+/**
+ * Tracer state a tracee may read without trapping, for fast paths running in
+ * the tracee to give the answers the tracer would: virtual inodes, logical
+ * mtimes and how far the random byte streams got. The logical clock is per
+ * process, it lives in each tracee's logicalClockPage.
+ *
+ * One memfd shared by every tracee, which map it read only, see
+ * execution::handleExecEvent, the tracer writes it through its own mapping.
+ * Layout: a sharedTablesHeader, then sharedTableSlots sharedTableEntries of
+ * inodes, (real inode, virtual inode), then as many of mtimes, (real inode,
+ * logical mtime in microseconds). Both are open addressed on the real inode,
+ * linear probing, 0 marks a free slot: no file has inode 0.
+ *
+ * Consistency is a seqlock: the tracer makes sequence odd, writes, makes it
+ * even again. Readers, see sharedTablesRead, retry until they read the same
+ * even sequence before and after.
+ */
+
+/** Bump when the layout changes. */
+const uint32_t SHARED_TABLES_VERSION = 1;
+
+/** Slots of each table, a power of two. */
+const uint32_t sharedTableSlots = 1 << 16;
+
+struct sharedTableEntry {
+  uint64_t realInode;
+  int64_t value;
+};
+
+struct sharedTablesHeader {
+  uint32_t version;
+  uint32_t slots;
+  /** Odd while the tracer writes. */
+  atomic<uint64_t> sequence;
+  /**
+   * Whether the tables hold every mapping the tracer has. Once one fills up,
+   * a miss only means the tracer has to be asked.
+   */
+  uint64_t complete;
+  /** Logical mtime of files the run never wrote, globalState::epoch. */
+  int64_t epoch;
+  /**
+   * Bytes handed out by globalState's random streams, and by the getrandom()
+   * streams of every tracee together.
+   */
+  uint64_t getrandomPosition;
+  uint64_t devRandomPosition;
+  uint64_t devUrandomPosition;
+  uint64_t inodes;
+  uint64_t mtimes;
+};
+
+/** Bytes of the shared tables mapping. */
+const size_t sharedTablesSize =
+    sizeof(sharedTablesHeader) + 2 * sharedTableSlots * sizeof(sharedTableEntry);
+
+/** Slot to start probing from for realInode. */
+inline uint32_t sharedTableSlot(uint64_t realInode) {
+  return (realInode * 0x9e3779b97f4a7c15) >> 48;
+}
+
+static_assert(
+    sharedTableSlots == 1 << 16, "sharedTableSlot hashes to 16 bits");
+
+/** The tables after header, inodes then mtimes. */
+inline const sharedTableEntry* sharedTablesInodes(
+    const sharedTablesHeader* header) {
+  return (const sharedTableEntry*)(header + 1);
+}
+
+inline const sharedTableEntry* sharedTablesMtimes(
+    const sharedTablesHeader* header) {
+  return sharedTablesInodes(header) + sharedTableSlots;
+}
+
+/** Lock free lookup of realInode in table, false if it's not there. */
+inline bool sharedTableFind(
+    const sharedTableEntry* table, uint64_t realInode, int64_t& value) {
+  for (uint32_t i = sharedTableSlot(realInode), n = 0; n < sharedTableSlots;
+       i = (i + 1) & (sharedTableSlots - 1), n++) {
+    uint64_t key = ((volatile const sharedTableEntry*)&table[i])->realInode;
+    if (key == realInode) {
+      value = ((volatile const sharedTableEntry*)&table[i])->value;
+      return true;
+    }
+    if (key == 0) {
+      return false;
+    }
+  }
+  return false;
+}
+
+/**
+ * Run read(header) until it ran on a consistent snapshot: no write started or
+ * finished while it ran. read may see torn values, its result is only kept
+ * from the run that didn't.
+ */
+template <typename F>
+void sharedTablesRead(const sharedTablesHeader* header, F read) {
+  for (;;) {
+    uint64_t before = header->sequence.load(memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    read(header);
+    atomic_thread_fence(memory_order_acquire);
+    if (header->sequence.load(memory_order_relaxed) == before) {
+      return;
+    }
+  }
+}
+
+/**
+ * The tracer's side of the tables: created once, published to as globalState
+ * changes, see globalState::tables.
+ */
+class sharedTables {
+public:
+  /** A new memfd holding empty tables, valid() is false if we couldn't. */
+  sharedTables();
+  ~sharedTables();
+
+  sharedTables(const sharedTables&) = delete;
+  sharedTables& operator=(const sharedTables&) = delete;
+
+  bool valid() const { return header != nullptr; }
+
+  /** The memfd, for tracees to open through /proc/<tracer>/fd/. */
+  int fd() const { return memfd; }
+
+  const sharedTablesHeader* get() const { return header; }
+
+  /** Each publish is one seqlock write. */
+  void publishInode(uint64_t realInode, uint64_t virtualInode);
+  void publishMtime(uint64_t realInode, int64_t mtime);
+  void publishEpoch(int64_t epoch);
+  void publishRandomPositions(
+      uint64_t getrandom, uint64_t devRandom, uint64_t devUrandom);
+  /** Drop realInode from both tables, see globalState::forgetInode. */
+  void forgetInode(uint64_t realInode);
+
+private:
+  void beginWrite();
+  void endWrite();
+
+  /** Set realInode to value in table, holding count entries. */
+  void insert(
+      sharedTableEntry* table,
+      uint64_t& count,
+      uint64_t realInode,
+      int64_t value);
+
+  /** Remove realInode from table, holding count entries. */
+  void erase(sharedTableEntry* table, uint64_t& count, uint64_t realInode);
+
+  sharedTablesHeader* header = nullptr;
+  int memfd = -1;
+};
+
+#endif
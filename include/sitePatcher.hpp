@@ -0,0 +1,169 @@
+#ifndef SITE_PATCHER_H
+#define SITE_PATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+/** Which of the two time stamp counter instructions trapped. */
+enum class tscInstruction { rdtsc, rdtscp };
+
+/**
+ * The trapping rdtsc, rdtscp, cpuid and system call sites of one address
+ * space. A site that keeps trapping gets rewritten into a jump to a trampoline
+ * doing what the trap handler would, see execution::patchTscSite,
+ * execution::patchCpuidSite and execution::bufferSystemCallSite.
+ *
+ * Sites patched are remembered across processes and runs, see patchSiteCache.
+ *
+ * Copied on fork, the child inherits the patched code and the trampolines.
+ * Shared by threads, replaced on execve.
+ */
+class patchSites {
+public:
+  /**
+   * Traps a site takes before we try patching it. Programs read the time
+   * stamp counter from all over, but only loops are worth it. cpuid sites
+   * mostly run once per process, but every process runs them.
+   */
+  static const uint32_t tscTrapsBeforePatching = 4;
+  static const uint32_t cpuidTrapsBeforePatching = 1;
+  /** Reads and writes of regular files, which loop like rdtsc does. */
+  static const uint32_t syscallTrapsBeforePatching = 4;
+
+  /** Bytes of tracee memory we map at a time to put trampolines in. */
+  static const size_t regionSize = 64 * 1024;
+
+  /**
+   * Count a trap at site.
+   * @return true if it trapped trapsBeforePatching times, time to patch it.
+   */
+  bool trapped(uint64_t site, uint32_t trapsBeforePatching);
+
+  /** The site can't be patched, it will trap forever. */
+  void giveUp(uint64_t site);
+
+  /** Whether site trapped before, or was given up on. */
+  bool seen(uint64_t site) const { return traps.count(site) != 0; }
+
+  /**
+   * Whether the mapping starting at start is new to patchKnownSites, which
+   * looks at each mapping once.
+   */
+  bool firstLookAt(uint64_t start) {
+    return mappingsLooked.insert(start).second;
+  }
+
+  /**
+   * Take size bytes of one of our regions within jump reach of site.
+   * @return tracee address of the bytes, 0 if no region has room.
+   */
+  uint64_t reserve(uint64_t site, size_t size);
+
+  /** A region of regionSize bytes was mapped at start in the tracee. */
+  void addRegion(uint64_t start);
+
+  /** Whether addr is in one of our regions, e.g. a trampoline's own trap. */
+  bool inRegion(uint64_t addr) const;
+
+  /** Tracee address of the read only page of canonical cpuid leaves, 0 if we
+   * haven't mapped it yet. */
+  uint64_t cpuidTable = 0;
+
+private:
+  struct region {
+    uint64_t start;
+    size_t used;
+  };
+
+  /** Traps by site, giveUp() sets them to UINT32_MAX. */
+  unordered_map<uint64_t, uint32_t> traps;
+  vector<region> regions;
+  unordered_set<uint64_t> mappingsLooked;
+};
+
+/** Whether a jmp rel32 at from reaches to. */
+bool inJumpReach(uint64_t from, uint64_t to);
+
+/**
+ * How many bytes of code, starting at a trapping instruction of insnLength
+ * bytes, we take over to fit in a 5 byte jmp: the instruction and enough of the
+ * ones following it. Those must be simple enough to run from anywhere, no
+ * branches and nothing rip relative.
+ * @param code bytes at the site
+ * @param available how many bytes of code we read
+ * @return the length, or 0 if the site can't be patched.
+ */
+size_t sitePatchLength(
+    const uint8_t* code, size_t available, size_t insnLength);
+
+/**
+ * Byte code of the trampoline for a site, to be placed at trampolineAddr:
+ * emulate insn with the counters at countersAddr like the trap handler does,
+ * run the relocated instructions, then jump back to returnAddr.
+ */
+vector<uint8_t> tscTrampoline(
+    tscInstruction insn,
+    uint64_t countersAddr,
+    uint64_t step,
+    const uint8_t* relocated,
+    size_t relocatedLength,
+    uint64_t trampolineAddr,
+    uint64_t returnAddr);
+
+/**
+ * Byte code of the trampoline for a cpuid site, to be placed at
+ * trampolineAddr: look the leaf in %eax up in the table at tableAddr, leaves
+ * basic leaves followed by extendedLeaves leaves from 0x80000000, each the
+ * eax, ebx, ecx and edx it returns, run the relocated instructions and jump
+ * back to returnAddr. Leaves outside the table run the real cpuid, which
+ * traps, for the trap handler to complain.
+ */
+vector<uint8_t> cpuidTrampoline(
+    uint64_t tableAddr,
+    uint32_t leaves,
+    uint32_t extendedLeaves,
+    const uint8_t* relocated,
+    size_t relocatedLength,
+    uint64_t trampolineAddr,
+    uint64_t returnAddr);
+
+/**
+ * Byte code of the trampoline for a syscall site, to be placed at
+ * trampolineAddr: clock_gettime, gettimeofday and time call the logical clock
+ * functions of the logicalClockPage at pageAddr, see layOutLogicalClock. A
+ * system call in its bufferedSystemCalls whose fd is in its regularFds goes
+ * through the page's gate, which the seccomp filter lets through. Anything
+ * else runs a system call of its own, which traps as the site did. Then it
+ * runs the relocated instructions and jumps back to returnAddr.
+ *
+ * The last trampolineTail(relocatedLength) bytes are the relocated
+ * instructions and the jump back, where a system call already under way at
+ * the site returns to.
+ */
+vector<uint8_t> bufferedSystemCallTrampoline(
+    uint64_t pageAddr,
+    const uint8_t* relocated,
+    size_t relocatedLength,
+    uint64_t trampolineAddr,
+    uint64_t returnAddr);
+
+/** Bytes of a trampoline after what it does instead of the trapping insn. */
+size_t trampolineTail(size_t relocatedLength);
+
+/** Byte code of a logicalClockPage's gate, logicalClockGateSize bytes. */
+vector<uint8_t> bufferedSystemCallGate();
+
+/**
+ * Byte code replacing patchLength bytes at site: a jump to trampolineAddr,
+ * padded with int3.
+ */
+vector<uint8_t> sitePatchJump(
+    uint64_t site, size_t patchLength, uint64_t trampolineAddr);
+
+#endif
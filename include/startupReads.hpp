@@ -0,0 +1,83 @@
+#ifndef STARTUP_READS_H
+#define STARTUP_READS_H
+
+#include <sys/types.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fileHasher.hpp"
+#include "ptracer.hpp"
+#include "state.hpp"
+#include "taskPool.hpp"
+
+using namespace std;
+
+/**
+ * The files each executable read as it started, its shared objects, locale
+ * and configuration files, by version of the executable like
+ * executableHashes. The next exec of the same version has a helper thread
+ * read them ahead, posix_fadvise(WILLNEED), while the dynamic loader is still
+ * getting there, see taskPool: on a cold page cache the tracee spends less
+ * time blocked on the disk. Only the page cache changes, never what tracees
+ * see or when they stop.
+ *
+ * An exec's startup is the first maxStartupReads files it opens for reading.
+ * Only the first exec of each version in a run reads ahead and is noted, the
+ * page cache has the files by its next one. What the last run noted is what
+ * the next reads ahead.
+ * The memo can be saved, --inode-snapshot keeps it next to its snapshot. A
+ * saved memo is lines of "device inode size mtime path".
+ */
+class startupReads {
+public:
+  /** @param tasks where files are read ahead. */
+  explicit startupReads(taskPool& tasks) : tasks(tasks) {}
+
+  startupReads(const startupReads&) = delete;
+  startupReads& operator=(const startupReads&) = delete;
+
+  /** Add the memo saved at path, false if there is none or it isn't one. */
+  bool load(const string& path);
+
+  /** Write the memo to path, next to it and renamed over it. */
+  void save(const string& path);
+
+  /**
+   * pid execed: read ahead what its executable read last time, and note what
+   * it reads this time.
+   */
+  void execed(pid_t pid);
+
+  /** The tracee stopped at syscallNum's post-hook, note what it opened. */
+  void systemCall(state& s, ptracer& t, int syscallNum);
+
+  /** pid's startup, if it was still going, is over. */
+  void exited(pid_t pid);
+
+  /** Execs whose startup files were read ahead, and files read ahead. */
+  uint64_t execsReadAhead = 0;
+  uint64_t filesReadAhead = 0;
+
+private:
+  /** An exec's startup so far. */
+  struct startup {
+    fileIdentity exe;
+    vector<string> reads;
+  };
+
+  /** Keep what pid read as its executable's startup. */
+  void finish(pid_t pid);
+
+  taskPool& tasks;
+  map<fileIdentity, vector<string>> memo;
+  /** Versions execed in this run. */
+  set<fileIdentity> execedVersions;
+  /** Processes noting their startup, until it is over. */
+  unordered_map<pid_t, startup> starting;
+};
+
+#endif
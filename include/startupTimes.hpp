@@ -0,0 +1,54 @@
+#ifndef STARTUP_TIMES_H
+#define STARTUP_TIMES_H
+
+#include <stdint.h>
+
+#include <string>
+
+using namespace std;
+
+/**
+ * Where the time until the tracee's program starts goes, in microseconds, for
+ * --print-statistics. Phases are measured by the tracer and the tracee both,
+ * so after share() they live in memory every process forked later sees.
+ */
+struct startupTimes {
+  int64_t optionParse = 0;
+  int64_t vdsoParse = 0;
+  int64_t namespaceClone = 0;
+  int64_t mounts = 0;
+  int64_t devNodes = 0;
+  int64_t fifoThreads = 0;
+  /** seccomp::loadRules, in the seccomp constructor. */
+  int64_t seccompBuild = 0;
+  int64_t seccompLoad = 0;
+  /** From the tracee's execvpe to the tracer seeing the exec. */
+  int64_t firstExec = 0;
+
+  /** now() at the clone and at the execvpe underway, 0 if none is. */
+  int64_t cloneStarted = 0;
+  int64_t execStarted = 0;
+
+  /** This process' times. */
+  static startupTimes& get();
+
+  /**
+   * Move our times to fresh shared memory, so the phases processes forked from
+   * now on measure are ours too. Each tracer calls this before its fork.
+   */
+  static void share();
+
+  /** A steady clock in nanoseconds, the same in every process. */
+  static int64_t now();
+
+  /** Add the microseconds since start, a now(), to phase. */
+  static void add(int64_t& phase, int64_t start);
+
+  /** End a phase started at *start, if one is underway. */
+  static void finish(int64_t& phase, int64_t& start);
+
+  /** All phases as one JSON object. */
+  string toJson() const;
+};
+
+#endif
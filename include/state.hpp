@@ -1,6 +1,7 @@
 #ifndef STATE_H
 #define STATE_H
 
+#include <signal.h>
 #include <sys/ptrace.h>
 #include <sys/reg.h>
 #include <sys/select.h>
@@ -8,16 +9,29 @@
 #include <sys/types.h>
 #include <sys/user.h>
 #include <sys/vfs.h>
+#include <map>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
+#include "PRNG.hpp"
 #include "ValueMapper.hpp"
+#include "copyOnWrite.hpp"
+#include "directoryCache.hpp"
 #include "directoryEntries.hpp"
+#include "fdTable.hpp"
+#include "inFlight.hpp"
+#include "logicalTimers.hpp"
 #include "logicalclock.hpp"
 #include "mappedMemory.hpp"
+#include "pathCache.hpp"
 #include "ptracer.hpp"
+#include "readinessProbe.hpp"
 #include "registerSaver.hpp"
+#include "sitePatcher.hpp"
+#include "vdso.hpp"
+#include "vectorClock.hpp"
 
 using namespace std;
 
@@ -42,12 +56,56 @@ public:
 };
 
 /**
- * Keep track of file descriptor, whether it's blocking or non blocking.
+ * The fd sets a select was called with, our pre-hook reads them and the
+ * post-hook gives them back to the tracee if it has to replay it.
  */
-enum class descriptorType {
-  blocking, /*< Set to block by user program (default) */
-  nonBlocking, /*< User used system call pipe2 or fnctl to set as non blocking.
-                */
+struct selectFdSets {
+  bool rdfsNotNull = false; /**< Indicates whether rdfs is NULL. */
+  bool wrfsNotNull = false; /**< Indicates whether wrfs is NULL. */
+  bool exfsNotNull = false; /**< Indicates whether exfs is NULL. */
+  fd_set origRdfs; /**< Original file descriptors set to watch for read
+                      availability. */
+  fd_set origWrfs; /**< Original file descriptors set to watch for write
+                      availability. */
+  fd_set
+      origExfs; /**< Original file descriptors set to watch for exceptions. */
+};
+
+/**
+ * Signals the tracer raised for a tracee, e.g. for its timers, and has yet to
+ * deliver, in order. Like the kernel, a standard signal already pending is not
+ * queued again, real-time signals are.
+ *
+ * Almost always empty and never long: a vector, which unlike a deque doesn't
+ * allocate until something is queued, as every thread has one.
+ */
+struct signalQueue {
+  vector<int> signals;
+  /** Bit n set when standard signal n is in signals. */
+  uint64_t standard = 0;
+
+  /** @return false if signum was coalesced with a pending one. */
+  bool push(int signum) {
+    if (signum < SIGRTMIN) {
+      if (standard & (1ULL << signum)) {
+        return false;
+      }
+      standard |= 1ULL << signum;
+    }
+    signals.push_back(signum);
+    return true;
+  }
+
+  int pop() {
+    int signum = signals.front();
+    signals.erase(signals.begin());
+    if (signum < SIGRTMIN) {
+      standard &= ~(1ULL << signum);
+    }
+    return signum;
+  }
+
+  bool empty() const { return signals.empty(); }
 };
 
 // Needed to avoid recursive dependencies between classes.
@@ -75,6 +133,91 @@ private:
   logical_clock::duration clock_step;
 
 public:
+  // Looked at on every stop, kept together with the clock.
+
+  /**
+   * The pid of the process represented by this state.
+   */
+  pid_t traceePid;
+
+  /*
+   * Per process bool to know if this is the pre or post hook event as ptrace
+   * does not track this for us. Only used for older kernel vesions.
+   */
+  bool onPreExitEvent = true;
+
+  /*
+   * Per process bool to know if we should go into the post hook.
+   */
+  bool callPostHook = false;
+
+  /**
+   * A pre-hook held this tracee at its seccomp stop without letting the system
+   * call run (e.g. a read that would block). When it is scheduled again, run
+   * the pre-hook again instead of resuming it.
+   */
+  bool deferredPreHook = false;
+
+  /**
+   * A new thread whose first stop, ptrace's SIGSTOP of new tracees, we have yet
+   * to wait for. Taken the first time it is resumed, see
+   * execution::takeInitialStop.
+   */
+  bool initialStopPending = false;
+
+  /**
+   * Spawned by vfork or posix_spawn and yet to exec: it runs on its suspended
+   * parent's memory, for a few system calls. Its branch counter is only opened
+   * for the image it execs, see execution::handleForkEvent.
+   */
+  bool vforkChild = false;
+
+  /**
+   * Whether the tracee made a system call since its last branch counter
+   * overflow, see execution::handleBranchOverflow.
+   */
+  bool systemCallSinceOverflow = false;
+
+  /**
+   * The system call last replayed and its first argument, usually the fd it
+   * waits on, for --watchdog reports.
+   */
+  int replayedSystemCall = -1;
+  uint64_t replayedArg1 = 0;
+
+  /*
+   * Indicator to differentiate between a syscall we are injecting and one that
+   * has already been replayed. Used since Ptrace cannot tell the difference.
+   *
+   * If true, system call is being injected for the first try.
+   * If false, system call is being replayed.
+   */
+  bool firstTrySystemcall = true;
+
+  /** Flag to let us know if the current system call was artifically injected by
+   * us. */
+  bool syscallInjected = false;
+
+  /** Whether we have injected a noop system call. Return value of the noop
+      (currently, getpid) needs to be fixed up so that tracee doesn't notice
+      the noop. */
+  bool noopSystemCall = false;
+
+  /**
+   * Keeps track of whether this process just exit_group-ed, we need to remember
+   * this since there is no post-hook for exit group.
+   */
+  bool isExitGroup = false;
+
+  /**
+   * Keep track of places where it's okay to see a stuck thread versus where
+   * it's not. We should only see a stuck thread after a pre-hook where we skip
+   * the post-hook, or a post-hook, continuing to the next system call.
+   */
+  bool canGetStuck = false;
+
+  // The rest is only looked at by the system calls using it.
+
   /**
    * Constructor.
    * Initialize traceePid and debugLevel to the provided values, and
@@ -89,61 +232,98 @@ public:
       logical_clock::duration clock_step);
 
   /**
-   * fork a new state when fork/vfork is called
+   * fork a new state when fork/vfork is called. The child shares the
+   * copyOnWrite parts of our state until one of us changes them, so a child
+   * that execs right away copies none of them.
    */
   state forked(pid_t childPid) const;
 
   /**
-   * cloned a new state when clone is called
+   * cloned a new state when clone is called, for a thread sharing everything
+   * copyOnWrite with us.
    */
   state cloned(pid_t childPid) const;
 
   /**
-   * Keep track of file descriptor status for blocking descriptors, as set by
-   the
-   * user program. Irregardless of what we set it to. These are
-   * set in either pipe (non blocking) or pipe2 (either), or duplicated through,
-   * dup, dup2, or can be set through fnctl. Deleted through close(). We only
-   support
-   * pipes, should be extended with fifo's at some point.
-
-   * When reading/writing we check this status to know whether to block this
-   process,
-   * and replay, or simply preempt as Runnable by the scheduler.
+   * What we know of this tracee's file descriptors: their type, whether they
+   * block, as the user program set it (pipe, pipe2, socket, accept, fcntl)
+   * irregardless of what we set them to, whether they are remote sockets or
+   * timerfds. Duplicated by dup, dup2 and fcntl, dropped by close and
+   * close_range, types and blocking are forgotten on execve.
+   *
+   * When reading/writing we check the blocking status to know whether to
+   * block this process, and replay, or simply preempt as Runnable by the
+   * scheduler.
    */
-  shared_ptr<unordered_map<int, descriptorType>> fdStatus;
+  copyOnWrite<fdTable> fds;
+
+  const fdInfo& fdInfoOf(int fd) const { return (*fds)[fd]; }
+
+  void setFdStatus(int fd, descriptorType dt) {
+    fds.write().setBlocking(fd, dt);
+  }
+
+  /** Only meaningful if countFdStatus(fd). */
+  descriptorType getFdStatus(int fd) const { return fdInfoOf(fd).blocking; }
+
+  /** Whether we track blocking for fd, pipes and sockets. */
+  int countFdStatus(int fd) const { return fdInfoOf(fd).tracksBlocking; }
 
-  void setFdStatus(int fd, descriptorType dt);
+  void setFdType(int fd, fdType type) { fds.write().setType(fd, type); }
 
-  descriptorType getFdStatus(int fd);
+  fdType getFdType(int fd) const { return fdInfoOf(fd).type; }
 
-  int countFdStatus(int fd);
+  /** fd is open on the file with real device and inode. */
+  void setFdFile(int fd, dev_t device, ino_t inode) {
+    fds.write().setFile(fd, device, inode);
+  }
+
+  /** fd was opened with accessMode, see fdInfo::accessMode. */
+  void setFdAccessMode(int fd, int accessMode) {
+    fds.write().setAccessMode(fd, accessMode);
+  }
+
+  /** newfd is now a duplicate of oldfd. */
+  void dupFd(int oldfd, int newfd) {
+    if (fdInfoOf(oldfd).known() || fdInfoOf(newfd).known()) {
+      fds.write().dup(oldfd, newfd);
+    }
+  }
 
   /**
    * Map from file descriptors to directory entries.
    */
-  unordered_map<int, directoryEntries<linux_dirent>> dirEntries;
+  copyOnWrite<unordered_map<int, directoryEntries<linux_dirent>>> dirEntries;
 
   /**
-   * The pid of the process represented by this state.
+   * Directories of dirEntries being read, as they were when we started, to
+   * cache their listing once read in full. @see directoryCache
    */
-  pid_t traceePid;
+  copyOnWrite<unordered_map<int, directoryStamp>> dirStamps;
 
   /**
    * Remember whether wait4 was originally blocking or not.
    */
   bool wait4Blocking = false;
 
-  /*
-   * Per process bool to know if this is the pre or post hook event as ptrace
-   * does not track this for us. Only used for older kernel vesions.
+  /**
+   * A wake took this tracee off its futexQueues queue, its FUTEX_WAIT returns
+   * 0 without running.
    */
-  bool onPreExitEvent = true;
+  bool futexWoken = false;
 
-  /*
-   * Per process bool to know if we should go into the post hook.
+  /**
+   * Value of the second futex word before a FUTEX_WAKE_OP changed it.
    */
-  bool callPostHook = false;
+  uint32_t futexOldValue = 0;
+
+  /**
+   * Number of times in a row the readiness probe kept a read from running. We
+   * only see close/dup2, not every way a descriptor may change, so every
+   * maxReadDeferrals the read is run anyway.
+   */
+  int readDeferrals = 0;
+  static const int maxReadDeferrals = 16;
 
   /**
    * Signal to be delivered the next time this process runs. If 0, no signal
@@ -152,66 +332,43 @@ public:
   int signalToDeliver = 0;
 
   /**
-   * inode number to be deleted.
-   * We need to delete inodes from our maps whenever the tracee calls unlink,
-   * unlinkat, or rmdir, that is, any system call that removes files. This is
-   * necessary since the filesystem may recycle this inode leading to
-   * unreproducible behavior when: 1) Some file is given an inode say i1. 2) Our
-   * inode map says i1 -> n1. 3) This file is deleted by a call to unlink,
-   * unlinkat, rmdir. 4) Some new file comes around and _sometimes_ gets
-   * assigned i1.
-   *
-   * This messes up our assumption that files get unique inodes for the lifetime
-   * of the program. So we delete inodes when they're done and delete them from
-   * our maps.
-   *
-   * We would like to do:
-   * 1) See a call to unlink, unlinkat, or rmdir.
-   * 2) On the post hook we inject a call to newfstatat to find what the inode
-   * belonging to this file is. We use this inode as a key to delete that entry
-   * from our inode map and mtime map.
-   *
-   * This doesn't work though, as the call to newfstatat fails since the file
-   * has already been deleted at this point! So instead we do: 1) See a call to
-   * unlink, unlinkat, or rmdir. If this is the first time we have seen this
-   * syscall we cut if off early at the pre hook and do a call to newfstatat to
-   *    find the correct inode, we populate inodeToDelete in the state class.
-   * From newfstatat we replay the call to unlink, unlinkat, or rmdir
-   * respectively. In the post hook of the original call we use inodeToDelete to
-   * remove the correct entries.
+   * Signals to deliver after signalToDeliver, one per resume, see
+   * execution::resumeTracee.
    */
-  ino_t inodeToDelete = -1;
+  signalQueue pendingSignals;
+
+  /**
+   * Stopped at a signal-delivery-stop: the signal we resume with, if any, is
+   * delivered right away, without the tracee stopping for it again.
+   */
+  bool atSignalStop = false;
 
   /*
-   * register values from (the post-hook) before any retries
+   * register values from (the post-hook) before any retries, active while a
+   * read or write is being retried.
    */
-  struct user_regs_struct beforeRetry = {0};
+  inFlight<struct user_regs_struct> beforeRetry;
 
   /**
    * Number of total bytes.
    */
   uint64_t totalBytes = 0;
 
-  /*
-   * Indicator to differentiate between a syscall we are injecting and one that
-   * has already been replayed. Used since Ptrace cannot tell the difference.
-   *
-   * If true, system call is being injected for the first try.
-   * If false, system call is being replayed.
-   */
-  bool firstTrySystemcall = true;
-
-  /** Flag to let us know if the current system call was artifically injected by
-   * us. */
-  bool syscallInjected = false;
+  /** What the noop returns to the tracee, see replaceSystemCallWithNoop. */
+  int64_t noopReturnValue = 0;
 
-  /** Whether we have injected a noop system call. Return value of the noop
-      (currently, getpid) needs to be fixed up so that tracee doesn't notice
-      the noop. */
-  bool noopSystemCall = false;
+  /**
+   * The pre-hook skipped the system call in its seccomp stop, there is no
+   * post-hook to run, see replaceSystemCallWithNoop.
+   */
+  bool systemCallSkipped = false;
 
-  /** Whether we've injected a signal for alarm/timer modeling. */
-  bool signalInjected = false;
+  /**
+   * The tracer read the current read or recvfrom of a remote socket itself,
+   * its post-hook returns socketReadResult, see serveSocketRead.
+   */
+  bool socketReadServed = false;
+  int64_t socketReadResult = 0;
 
   /** What kind of signal handler this tracee has requested via
       signal/sigaction. The currentSignalHandlers map is updated iff the syscall
@@ -224,20 +381,19 @@ public:
 
   /** Track, for each signal, what kind of handler this tracee currently has
    * registered. */
-  shared_ptr<unordered_map<int, enum sighandler_type>> currentSignalHandlers;
+  copyOnWrite<unordered_map<int, enum sighandler_type>> currentSignalHandlers;
 
   /** track timers created via timer_create */
-  shared_ptr<unordered_map<timerID_t, timerInfo>> timerCreateTimers;
+  copyOnWrite<unordered_map<timerID_t, timerInfo>> timerCreateTimers;
 
-  bool rdfsNotNull = false; /**< Indicates whether rdfs is NULL. */
-  bool wrfsNotNull = false; /**< Indicates whether wrfs is NULL. */
-  bool exfsNotNull = false; /**< Indicates whether exfs is NULL. */
-  fd_set origRdfs; /**< Original file descriptors set to watch for read
-                      availability. */
-  fd_set origWrfs; /**< Original file descriptors set to watch for write
-                      availability. */
-  fd_set
-      origExfs; /**< Original file descriptors set to watch for exceptions. */
+  /**
+   * Expiry of alarm, the interval timers, timer_create timers and timerfds, on
+   * our logical clock. Copied on fork, where only timerfds survive.
+   */
+  copyOnWrite<logicalTimers> timers;
+
+  /** The fd sets of the select in flight, see selectFdSets. */
+  inFlight<selectFdSets> selectSets;
 
   /** Flag to differentiate between our injected timeout into a system call from
    * a user one. */
@@ -266,6 +422,22 @@ public:
   uint64_t originalArg5 = 0; /**< original register arg 5 */
   uint64_t originalArg6 = 0; /**< original register arg 5 */
 
+  /**
+   * Path the pre-hook of a mkdir, mkdirat, symlink or symlinkat read to log,
+   * so its post-hook needn't read it again. Empty when not logging.
+   */
+  string createdPath;
+
+  /** The flags of io_uring_setup's params, before the pre-hook set ours. */
+  uint32_t ioUringFlags = 0;
+
+  /**
+   * io_uring_enter was replayed to wait for its SQEs to complete, see
+   * ioUring::settled. ioUringResult is what the tracee's own call returned.
+   */
+  bool ioUringWaiting = false;
+  int64_t ioUringResult = 0;
+
   /**
    * Debug level. Mainly used by the dettraceSytemCall classes to avoid doing
    * unnecesary work when logging data if not needed.
@@ -283,11 +455,64 @@ public:
    */
   void incrementTime() { clock += clock_step; }
 
+  /**
+   * Move the logical clock forward to t, e.g. a timeout went off. Never goes
+   * back.
+   */
+  void advanceTimeTo(logical_clock::time_point t) {
+    if (clock < t) {
+      clock = t;
+    }
+  }
+
   /**
    * Function to get value of internal logical clock.
    */
   logical_clock::time_point getLogicalTime() const { return clock; }
 
+  /**
+   * The tracer side of the page our vdso functions read the time from, null
+   * when they do system calls. The page belongs to the address space, so it is
+   * inherited like mmapMemory.
+   */
+  shared_ptr<logicalClockPage> clockPage;
+
+  /** Where clockPage is mapped in the tracee. */
+  uint64_t clockPageAddr = 0;
+
+  /** Where our sharedTables are mapped, read only, in the tracee, 0 if not. */
+  uint64_t sharedTablesAddr = 0;
+
+  /**
+   * Patched rdtsc, rdtscp and cpuid sites of this address space. Copied on
+   * fork, shared by threads.
+   */
+  copyOnWrite<patchSites> sitePatches;
+
+  /** Catch up with the time reads the tracee did through clockPage. */
+  void pullClock() {
+    if (clockPage != nullptr) {
+      advanceTimeTo(
+          logical_clock::time_point{logical_clock::duration{clockPage->now}});
+    }
+  }
+
+  /**
+   * Let the tracee read our logical clock through clockPage, and tell its
+   * patched system call sites which of its fds are regular files.
+   */
+  void pushClock() {
+    if (clockPage != nullptr) {
+      clockPage->now = clock.time_since_epoch().count();
+      clockPage->step = clock_step.count();
+      clockPage->readsLeft = logicalClockReads;
+      if (clockPage->bufferedSystemCalls != 0) {
+        fds->regularFds(
+            clockPage->regularFds, sizeof(clockPage->regularFds) / 8);
+      }
+    }
+  }
+
   /**
    * We must keep track of file creation. For open and openat, we set this flag.
    * On the posthook, if the system call succeeded, we check if the file existed
@@ -296,67 +521,89 @@ public:
   bool fileExisted = false;
 
   /**
-   * Keeps track of whether this process just exit_group-ed, we need to remember
-   * this since there is no post-hook for exit group.
+   * Set by the open and openat pre-hooks when opening our /dev/random or
+   * /dev/urandom, the type the new fd gets in the post-hook.
    */
-  bool isExitGroup = false;
+  fdType openingRandom = fdType::unknown;
 
   /**
-   * Keep track of places where it's okay to see a stuck thread versus where
-   * it's not. We should only see a stuck thread after a pre-hook where we skip
-   * the post-hook, or a post-hook, continuing to the next system call.
+   * Set by the open, openat and openat2 pre-hooks when they redirected the
+   * open to one of gs.synthetic's files, the post-hook restores the path.
    */
-  bool canGetStuck = false;
+  bool openingSynthetic = false;
 
   /**
-   * poll retry count
-   * poll can choose a negative timeout for wait indefinitely
-   * or a positive timeout (in mili-seconds) to wait only certain amount of time
-   * we replay poll syscall for only `timeout` of times, by simply assume every
-   * retry is roughly 1-milli-sec.
+   * Heap swaps before a poll-like call that found nothing ready is retried
+   * anyway, doubled on every empty retry and reset once something is ready.
+   * @see replayPollWhenReady
    */
-  long poll_retry_count;
+  uint32_t pollBackoff = 1;
 
   /**
-   * poll retry maximum
+   * check whether a file descriptor is a remote socket fd
    */
-  long poll_retry_maximum;
+  bool fd_is_remote(int fd) const { return fdInfoOf(fd).remote; }
 
   /**
-   * remote socket file descriptors, unix domain sockets excluded.
+   * check whether a file descriptor is a timerfd, its timer is in timers.
    */
-  std::shared_ptr<std::unordered_set<int>> remote_sockfds;
+  bool fd_is_timerfd(int fd) const { return fdInfoOf(fd).timerfd; }
 
   /**
-   * check whether a file descriptor is a remote socket fd
+   * Where this tracee sits in the tree of forks and clones: 0 for the first
+   * tracee, mixSeed of its parent's and of how many children the parent had
+   * spawned before it otherwise. The same in every run, whichever order
+   * tracees ran in, see childForkPath.
    */
-  bool fd_is_remote(int fd) const {
-    return remote_sockfds->find(fd) != remote_sockfds->end();
+  uint64_t forkPath = 0;
+
+  /** Children this tracee spawned so far, threads included. */
+  uint64_t childrenSpawned = 0;
+
+  /** forkPath of the next child this tracee spawns. */
+  uint64_t childForkPath() { return mixSeed(forkPath, childrenSpawned++); }
+
+  /**
+   * This tracee's getrandom() bytes: its own stream, derived from prngSeed and
+   * forkPath, so what it draws doesn't depend on what other tracees drew or
+   * when. The first tracee's is the plain prngSeed stream. Made on first use,
+   * most tracees never call getrandom.
+   */
+  randomByteStream& getrandomStream(uint64_t prngSeed) {
+    if (getrandomBytes == nullptr) {
+      getrandomBytes = std::make_shared<randomByteStream>(
+          forkPath == 0 ? prngSeed : mixSeed(prngSeed, forkPath));
+    }
+    return *getrandomBytes;
   }
 
   /**
-   * timerfds
+   * Our duplicates of this tracee's pipes, to check whether reads would block.
+   * Shared like fds.
    */
-  std::shared_ptr<std::unordered_map<int, struct itimerspec>> timerfds;
+  std::shared_ptr<readinessProbe> readProbe;
+
+  /** See getrandomStream, never shared. */
+  std::shared_ptr<randomByteStream> getrandomBytes;
 
   /**
-   * check whether a file descriptor is a timerfd
+   * What this tracee's thread group heard of, with --vector-clocks. A forked
+   * child starts out with its parent's, threads share it.
    */
-  bool fd_is_timerfd(int fd) const {
-    return timerfds->find(fd) != timerfds->end();
-  }
+  copyOnWrite<vectorClock> causality;
 
   /**
-   * signalfds
+   * Interest sets of this tracee's epoll fds, as registered with epoll_ctl:
+   * epoll fd to (fd to its events). Only epoll fds created or changed while
+   * traced are known. Copied on fork, shared by threads, like fds.
    */
-  std::shared_ptr<std::unordered_set<int>> signalfds;
+  copyOnWrite<std::unordered_map<int, std::map<int, uint32_t>>> epollInterests;
 
   /**
-   * check whether a file descriptor is a signalfd
+   * Host paths of this tracee's root, cwd and directory fds, for
+   * resolve_tracee_path. Copied on fork, shared by threads.
    */
-  bool fd_is_signalfd(int fd) const {
-    return signalfds->find(fd) != signalfds->end();
-  }
+  copyOnWrite<traceePaths> paths;
 };
 
 #endif
@@ -0,0 +1,83 @@
+#ifndef STRING_INTERNER_H
+#define STRING_INTERNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Id of an interned string. Ids are handed out densely from 0, in the order
+ * strings are first interned.
+ */
+typedef uint32_t stringId;
+
+/**
+ * Hash-consed table of strings seen from tracees, mostly paths.
+ *
+ * Every distinct string is stored once, NUL terminated, in large arena blocks
+ * that never move, so ids and the views they map to stay valid for the
+ * lifetime of the interner. Equal strings get equal ids: comparing or hashing
+ * interned strings is comparing or hashing integers. Nothing is ever freed.
+ */
+class stringInterner {
+public:
+  /** Id find() returns for strings that were never interned. */
+  static const stringId noString = UINT32_MAX;
+
+  stringInterner();
+
+  /** Id of the string, interning a copy of it if it is new. */
+  stringId intern(const char* data, size_t size);
+  stringId intern(const string& str) { return intern(str.data(), str.size()); }
+
+  /** Id of the string if it was interned, noString otherwise. */
+  stringId find(const char* data, size_t size) const;
+  stringId find(const string& str) const {
+    return find(str.data(), str.size());
+  }
+
+  /** NUL terminated contents of id. */
+  const char* data(stringId id) const { return views[id].data; }
+
+  size_t size(stringId id) const { return views[id].size; }
+
+  string str(stringId id) const { return string{data(id), size(id)}; }
+
+  /** Number of distinct strings interned. */
+  size_t count() const { return views.size(); }
+
+private:
+  static const size_t blockSize = 64 * 1024;
+
+  struct view {
+    const char* data;
+    uint32_t size;
+    uint32_t hash;
+  };
+
+  /** Copy of data, NUL terminated, in the arena. */
+  const char* store(const char* data, size_t size);
+
+  /** Slot of the string in slots, or the empty slot where it would go. */
+  size_t probe(const char* data, size_t size, uint32_t hash) const;
+
+  void grow();
+
+  vector<unique_ptr<char[]>> blocks;
+  /** Bytes used in blocks.back(). */
+  size_t blockUsed = blockSize;
+  /** Strings too big to share a block. */
+  vector<unique_ptr<char[]>> bigBlocks;
+
+  /** Interned strings, by id. */
+  vector<view> views;
+  /** Open addressing table of ids, noString when empty, at most half full. */
+  vector<stringId> slots;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef SYNC_ORDER_H
+#define SYNC_ORDER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Deterministic commit order for --parallel.
+ *
+ * Tracees run concurrently, but every event we intercept (system call, signal,
+ * exit...) is handled ("committed") one at a time, in an order that does not
+ * depend on how fast each tracee runs.
+ *
+ * Each tracee has a logical clock, the number of events it has committed.
+ * A stopped tracee may commit when (ticks, pid) is the lowest among all
+ * tracees that are running or stopped: a running tracee's clock can only grow,
+ * so nobody with a lower clock can show up later and should have gone first.
+ * If a running tracee has the lowest clock, we wait for it to stop.
+ * Barrier events (signals sent to other tracees, exits, waits) also wait until
+ * no tracee is running, so their effects on others land at a deterministic
+ * point.
+ *
+ * Threads share memory, so at most one thread per thread group runs or waits
+ * to commit at a time. The others are ready and resume in clock order as the
+ * group frees up.
+ *
+ * With --lite, see commitInArrivalOrder, events are committed in the order
+ * tracees stopped with them, and threads run side by side: nothing waits on
+ * a running tracee, which may be blocked in the kernel on another one.
+ */
+class syncOrder {
+public:
+  /**
+   * Commit in the order tracees stop, no barriers, every thread its own group.
+   * Nondeterministic, call before adding anyone.
+   */
+  void commitInArrivalOrder() { byArrival = true; }
+  /**
+   * Track a new tracee, stopped and ready to be resumed, e.g. a new child
+   * which starts on its parent's clock.
+   */
+  void add(pid_t pid, pid_t group, uint64_t ticks);
+
+  /**
+   * Stop tracking pid (it exited, or exited and waits on its children). Fine to
+   * call on untracked pids.
+   */
+  void remove(pid_t pid);
+
+  bool contains(pid_t pid) const { return tracees.count(pid) != 0; }
+
+  bool empty() const { return tracees.empty(); }
+
+  /**
+   * pid stopped with an event for us to commit. May be called again on a
+   * stopped tracee if it was killed and has a new event.
+   */
+  void stopped(pid_t pid, bool barrier);
+
+  /**
+   * The tracee whose event goes next, -1 if we must wait for a running tracee
+   * to stop first.
+   */
+  pid_t nextCommit() const;
+
+  /**
+   * pid's event was handled and its clock moves on. It is ready to resume, see
+   * takeResumable().
+   */
+  void committed(pid_t pid);
+
+  /**
+   * Ready tracees that may run now, one per thread group with nobody running.
+   * They are marked as running.
+   */
+  vector<pid_t> takeResumable();
+
+  uint64_t ticksOf(pid_t pid) const { return tracees.at(pid).ticks; }
+
+  size_t runningCount() const { return running; }
+
+private:
+  enum class status { ready, running, stopped };
+
+  struct tracee {
+    pid_t group;
+    uint64_t ticks;
+    status st;
+    bool barrier;
+    /** Its place in stoppedByArrival, when stopped with byArrival. */
+    uint64_t arrival;
+  };
+
+  typedef pair<uint64_t, pid_t> clockKey;
+
+  /** group may have a ready member to resume, see takeResumable(). */
+  void markDirty(pid_t group) { dirtyGroups.insert(group); }
+
+  unordered_map<pid_t, tracee> tracees;
+  /** Running and stopped tracees, by clock. */
+  set<clockKey> active;
+  /** Ready tracees, by thread group then clock. */
+  map<pid_t, set<clockKey>> readyByGroup;
+  /** Number of running or stopped members of each thread group. */
+  unordered_map<pid_t, int> activeMembers;
+  /** Groups that may have someone to resume. */
+  set<pid_t> dirtyGroups;
+  size_t running = 0;
+
+  bool byArrival = false;
+  /** With byArrival: stopped tracees, by when they stopped. */
+  set<pair<uint64_t, pid_t>> stoppedByArrival;
+  uint64_t arrivals = 0;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SYNTHETIC_FILES_H
+#define SYNTHETIC_FILES_H
+
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * Files of /proc and /etc tracees see our canned versions of, from root/ of the
+ * chroot, served from memory rather than bind mounted over their paths in every
+ * job. Each is a sealed memfd of the tracer: handlePreOpens redirects read only
+ * opens of its path to the memfd through /proc/<tracer>/fd/, and reads, seeks,
+ * fstat and mmap of the new fd then run in the kernel, it is a regular file.
+ * Opens for writing still get the real file.
+ */
+class syntheticFiles {
+public:
+  syntheticFiles() = default;
+  ~syntheticFiles();
+
+  syntheticFiles(const syntheticFiles&) = delete;
+  syntheticFiles& operator=(const syntheticFiles&) = delete;
+
+  /**
+   * Serve the contents source has now at path, an absolute tracee path.
+   * Throws a runtimeError if source can't be read.
+   */
+  void add(const string& path, const string& source);
+
+  /** Serve bytes at path, an absolute tracee path. */
+  void addContents(const string& path, const string& bytes);
+
+  /**
+   * Serve the files tools count CPUs from for a machine of cpus CPUs, --cpus:
+   * /proc/cpuinfo, /proc/stat and /sys/devices/system/cpu/{online,possible,
+   * present}. Replaces what add() serves at those paths.
+   */
+  void addMachine(unsigned cpus);
+
+  /** "0-<cpus - 1>\n", a cpu list of /sys/devices/system/cpu. */
+  static string cpuList(unsigned cpus);
+
+  /** /proc/stat of a machine of cpus CPUs, as idle as it is at boot. */
+  static string procStat(unsigned cpus);
+
+  /** /proc/cpuinfo of cpus CPUs like the one our cpuid leaves describe. */
+  static string procCpuinfo(unsigned cpus);
+
+  /**
+   * The path tracees open instead of path, nullptr if we don't serve path.
+   * Only exact matches: tracees name these files by their absolute paths.
+   */
+  const string* redirect(const string& path) const;
+
+  bool empty() const { return files.empty(); }
+
+private:
+  struct file {
+    int memfd;
+    /** /proc/<tracer>/fd/<memfd>. */
+    string openPath;
+  };
+
+  unordered_map<string, file> files;
+};
+
+#endif
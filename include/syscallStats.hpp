@@ -0,0 +1,161 @@
+#ifndef SYSCALL_STATS_H
+#define SYSCALL_STATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "latencyHistogram.hpp"
+#include "systemCallList.hpp"
+
+using namespace std;
+
+/**
+ * Where the tracer's work goes, per system call and per tracee, written by
+ * --stats-json. execution counts every hook it runs, with the replays and
+ * system calls injected while it ran and the time it took.
+ *
+ * Per system call we also keep histograms of the hooks' times, and of how long
+ * a tracee stopped for the system call waited to be resumed, for
+ * --print-statistics. One more histogram takes the wait of every stop, system
+ * call or not.
+ *
+ * Stops, replays and hook time are also summed per executable, the path each
+ * tracee last execed, with the wall time its processes ran that executable.
+ */
+class syscallStats {
+public:
+  struct counters {
+    uint64_t preHooks = 0;
+    uint64_t postHooks = 0;
+    uint64_t replays = 0;
+    uint64_t injected = 0;
+    /** Time spent in the hooks. */
+    uint64_t tracerNanos = 0;
+  };
+
+  /**
+   * Count a pre or post hook of systemCall that pid stopped for.
+   * @param replays replays the hook did.
+   * @param injected system calls the hook injected.
+   * @param nanos time the hook took.
+   */
+  void recordHook(
+      pid_t pid,
+      int systemCall,
+      bool post,
+      uint64_t replays,
+      uint64_t injected,
+      uint64_t nanos);
+
+  /** Counters of one executable, summed over the processes that ran it. */
+  struct executableCounters {
+    uint64_t execs = 0;
+    uint64_t stops = 0;
+    uint64_t replays = 0;
+    uint64_t tracerNanos = 0;
+    /** From exec, or fork, to exit or the next exec. */
+    uint64_t wallNanos = 0;
+  };
+
+  /** Process pid now runs the executable at path. */
+  void execed(pid_t pid, const string& path);
+
+  /** child was forked by parent and runs what parent runs. */
+  void spawned(pid_t parent, pid_t child, bool isThread);
+
+  /** pid exited. */
+  void exited(pid_t pid);
+
+  /** pid stopped, waitpid just told us. */
+  void stopped(pid_t pid);
+
+  /**
+   * pid runs again. If it stopped for a system call, that system call waited
+   * since stopped(pid).
+   */
+  void resumed(pid_t pid);
+
+  /**
+   * p50, p99 and max wait to be resumed of all stops, then hook time and wait
+   * to be resumed per system call.
+   */
+  void printLatencies(ostream& out) const;
+
+  /** Mean nanoseconds a stopped tracee waited to be resumed, over all stops. */
+  uint64_t meanStopToResume() const { return anyStop.mean(); }
+
+  /**
+   * ptrace stops per call of each system call, costliest first: its pre and
+   * post hooks and the system calls they injected, which stop the tracee once
+   * each. Replays are stops of the call they replay, not calls of their own.
+   */
+  void printStops(ostream& out) const;
+
+  /** The lines executables with the most hook time, with their counters. */
+  void printExecutables(ostream& out, size_t lines) const;
+
+  /** Our counters of systemCall. */
+  const counters& of(int systemCall) const { return bySystemCall[systemCall]; }
+
+  /** Stops per call of c, see printStops. */
+  static double stopsPerCall(const counters& c);
+
+  /**
+   * Write totals, as the text statistics name them, then our counters per
+   * system call and per tracee to path as one JSON object.
+   */
+  void writeJson(
+      const string& path,
+      const vector<pair<string, uint64_t>>& totals) const;
+
+private:
+  struct latencies {
+    latencyHistogram hook;
+    latencyHistogram stopToResume;
+  };
+
+  /** A tracee we have not resumed yet, and the system call it stopped for. */
+  struct pendingStop {
+    chrono::steady_clock::time_point at;
+    int systemCall = -1;
+  };
+
+  /** What a tracee runs, and since when if it is a process. */
+  struct running {
+    executableCounters* executable;
+    bool isThread;
+    chrono::steady_clock::time_point since;
+  };
+
+  /** The histograms of systemCall, made on first use. */
+  latencies& latenciesOf(int systemCall);
+
+  /** The executable pid runs, null if we don't know. */
+  executableCounters* executableOf(pid_t pid);
+
+  /** Wall time r ran its executable so far, 0 for threads. */
+  static uint64_t runningNanos(const running& r);
+
+  /** Counters per executable, with the wall time of processes still running. */
+  vector<pair<string, executableCounters>> executablesNow() const;
+
+  counters bySystemCall[SYSTEM_CALL_COUNT];
+  unordered_map<pid_t, counters> byProcess;
+  array<unique_ptr<latencies>, SYSTEM_CALL_COUNT> bySystemCallLatency;
+  latencyHistogram anyStop;
+  unordered_map<pid_t, pendingStop> stops;
+  /** By path, never erased, so runners may point into it. */
+  unordered_map<string, executableCounters> byExecutable;
+  unordered_map<pid_t, running> runners;
+};
+
+#endif
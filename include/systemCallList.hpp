@@ -7,7 +7,7 @@
  * The count of system calls.
  * @see systemCallMappings
  */
-const int SYSTEM_CALL_COUNT = 333;
+const int SYSTEM_CALL_COUNT = 440;
 
 /**
  * A list of system calls. This information was scraped from
@@ -24,6 +24,10 @@ const int SYSTEM_CALL_COUNT = 333;
  * machine. If you are using a more recent version of the Linux kernel,
  * you may have additional system calls that are not present in this list.
  * If so, please run the script and add them!
+ *
+ * io_pgetevents (333) through faccessat2 (439) were added by hand from the
+ * kernel's arch/x86/entry/syscalls/syscall_64.tbl. 335 to 423 are unused on
+ * x86_64 and left empty.
  */
 const std::string systemCallMappings[SYSTEM_CALL_COUNT] = {
     "read",
@@ -358,6 +362,113 @@ const std::string systemCallMappings[SYSTEM_CALL_COUNT] = {
     "pkey_mprotect",
     "pkey_alloc",
     "pkey_free",
-    "statx"};
+    "statx",
+    "io_pgetevents",
+    "rseq",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "pidfd_send_signal",
+    "io_uring_setup",
+    "io_uring_enter",
+    "io_uring_register",
+    "open_tree",
+    "move_mount",
+    "fsopen",
+    "fsconfig",
+    "fsmount",
+    "fspick",
+    "pidfd_open",
+    "clone3",
+    "close_range",
+    "openat2",
+    "pidfd_getfd",
+    "faccessat2"};
 
 #endif
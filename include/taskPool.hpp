@@ -0,0 +1,125 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A few helper threads for the tracer's work that needs no ptrace: hashing
+ * files, generating random bytes ahead of the tracees reading them.
+ *
+ * Tasks only ever see what they were given and hand back a result, which the
+ * tracer takes with taskResult::get() when it needs it. A task no helper has
+ * started by then is run by the tracer itself, inside get(). So what tracees
+ * see doesn't depend on the helpers, how many there are or how fast they go:
+ * with none at all every task simply runs in its get().
+ */
+class taskPool {
+  /** Whoever claims it first runs it: a helper, or whoever needs the result. */
+  struct pendingTask {
+    virtual ~pendingTask() = default;
+    virtual void run() = 0;
+
+    bool claim() { return !claimed.exchange(true); }
+
+    atomic<bool> claimed{false};
+  };
+
+  template <typename T>
+  struct typedTask : pendingTask {
+    explicit typedTask(packaged_task<T()>&& job) : job(move(job)) {}
+    void run() override { job(); }
+
+    packaged_task<T()> job;
+  };
+
+public:
+  /** The result of a task, taken once. */
+  template <typename T>
+  class taskResult {
+  public:
+    taskResult() = default;
+
+    /** Submitted and not taken yet. */
+    bool valid() const { return task != nullptr; }
+
+    /** Wait for the result, running the task now if no helper started it. */
+    T get() {
+      shared_ptr<typedTask<T>> t = move(task);
+      if (t->claim()) {
+        t->run();
+      }
+      return result.get();
+    }
+
+  private:
+    friend class taskPool;
+
+    shared_ptr<typedTask<T>> task;
+    future<T> result;
+  };
+
+  /** @param helpers threads to start, 0 runs every task in its get(). */
+  explicit taskPool(unsigned helpers);
+
+  /** Runs what is left in the queue, then joins the helpers. */
+  ~taskPool();
+
+  taskPool(const taskPool&) = delete;
+  taskPool& operator=(const taskPool&) = delete;
+
+  /**
+   * Run what is queued and join the helpers, so we can fork, then start as
+   * many again. Tasks submitted in between wait for their get().
+   */
+  void pause();
+  void resume();
+
+  /** Queue job, a callable taking nothing, for a helper. */
+  template <typename F>
+  taskResult<typename result_of<F()>::type> run(F job) {
+    using T = typename result_of<F()>::type;
+    taskResult<T> r;
+    packaged_task<T()> packaged(move(job));
+    r.result = packaged.get_future();
+    r.task = make_shared<typedTask<T>>(move(packaged));
+    submitted++;
+    if (!helpers.empty()) {
+      enqueue(r.task);
+    }
+    return r;
+  }
+
+  /** Tasks submitted, and run by a helper rather than the tracer. */
+  uint64_t submitted = 0;
+  atomic<uint64_t> ranByHelpers{0};
+
+private:
+  void enqueue(shared_ptr<pendingTask> task);
+
+  /** A helper: runs tasks until told to stop. */
+  void work();
+
+  mutex lock;
+  condition_variable changed;
+  deque<shared_ptr<pendingTask>> queue;
+  bool stopping = false;
+  vector<thread> helpers;
+  /** Helpers to start again on resume(). */
+  unsigned paused = 0;
+};
+
+template <typename T>
+using taskResult = taskPool::taskResult<T>;
+
+#endif
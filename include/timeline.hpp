@@ -0,0 +1,81 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * Timeline of a run written by --timeline, in the Chrome trace event JSON
+ * format that chrome://tracing and ui.perfetto.dev open.
+ *
+ * Every tracee is a track, with a slice for every time it ran and every time
+ * the scheduler parked it, instants for replays and injected system calls,
+ * and a counter with its logical clock. The tracer's own track (tid 0) has
+ * the hooks and the scheduler's heap swaps. Times are wall clock, since the
+ * timeline was created.
+ */
+class timeline {
+public:
+  /** Creates (or truncates) the file at path. */
+  explicit timeline(const string& path);
+
+  /** Ends the JSON array, the file is complete from here on. */
+  ~timeline();
+
+  timeline(const timeline&) = delete;
+  timeline& operator=(const timeline&) = delete;
+
+  /** Name the track of a tracee the first time we see it. */
+  void nameTrack(pid_t pid);
+
+  /** pid was resumed, its run slice starts. */
+  void resumed(pid_t pid);
+
+  /** pid stopped, ending the run slice resumed(pid) started. */
+  void stopped(pid_t pid);
+
+  /** The scheduler parked pid until it is woken, for reason. */
+  void parked(pid_t pid, const char* reason);
+
+  /** pid is back in a run queue, ending the slice parked(pid) started. */
+  void woken(pid_t pid);
+
+  /** A hook named name ran on the tracer since start. */
+  void hook(
+      pid_t pid,
+      const string& name,
+      chrono::steady_clock::time_point start);
+
+  /** Something that happens at once, on pid's track, 0 for the tracer's. */
+  void instant(pid_t pid, const string& name);
+
+  /** pid's logical clock is now at logicalMicros. */
+  void logicalTime(pid_t pid, int64_t logicalMicros);
+
+private:
+  /** Microseconds since the timeline was created. */
+  double since(chrono::steady_clock::time_point t) const;
+
+  void slice(
+      pid_t pid,
+      const string& name,
+      chrono::steady_clock::time_point start,
+      chrono::steady_clock::time_point end);
+
+  FILE* out;
+  chrono::steady_clock::time_point created;
+  /** Start of pid's run slice, or of the time it has been parked. */
+  unordered_map<pid_t, chrono::steady_clock::time_point> running;
+  unordered_map<pid_t, pair<chrono::steady_clock::time_point, const char*>>
+      parkedSince;
+  unordered_map<pid_t, bool> named;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <set>
+#include <tuple>
+#include <unordered_map>
+
+#include "logicalclock.hpp"
+
+using namespace std;
+
+/**
+ * Pending timeouts of tracees, on logical time, at most one per tracee.
+ *
+ * Ordered by deadline, then by the order timers were armed in, so the next
+ * timer to go off never depends on anything but the order of events in the
+ * tracer. The scheduler fires the earliest one when nobody can run, letting
+ * logical time jump straight to it, see scheduler::fireNextTimer.
+ */
+class timerWheel {
+public:
+  /** Arm pid's timer, replacing the one it had. */
+  void arm(pid_t pid, logical_clock::time_point deadline);
+
+  /** Disarm pid's timer, if any. */
+  void cancel(pid_t pid);
+
+  bool armed(pid_t pid) const { return timers.count(pid) != 0; }
+
+  bool empty() const { return timers.empty(); }
+
+  /**
+   * Take the earliest timer off the wheel, must not be empty.
+   * @return pid the timer belonged to.
+   */
+  pid_t popEarliest(logical_clock::time_point* deadline);
+
+private:
+  /** (deadline, arm order, pid) */
+  typedef tuple<logical_clock::time_point, uint64_t, pid_t> timerKey;
+
+  set<timerKey> byDeadline;
+  unordered_map<pid_t, timerKey> timers;
+  /** Arm order of the next timer. */
+  uint64_t nextSequence = 0;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Binary trace format written by --trace-file and read by dettrace-trace.
+ *
+ * A trace is a traceFileHeader followed by a flat array of fixed size
+ * traceRecords in the order the tracer processed the events. Everything is
+ * native endian, traces are meant to be read back on the machine (or at least
+ * the architecture) that produced them.
+ */
+
+/** Bump when the layout of traceFileHeader or traceRecord changes. */
+const uint32_t TRACE_FILE_VERSION = 1;
+
+/** First bytes of every trace file. */
+const char TRACE_FILE_MAGIC[8] = {'D', 'E', 'T', 'T', 'R', 'A', 'C', 'E'};
+
+/**
+ * Kind of event a traceRecord describes.
+ */
+enum class traceEvent : uint32_t {
+  syscallPre = 0, /*< Seccomp stop, before our pre-hook ran. */
+  syscallPost = 1, /*< After our post-hook ran, with the final return value. */
+  signal = 2, /*< Signal delivered to tracee, number is the signal. */
+  fork = 3, /*< New process (number 0) or thread (number 1), returnValue is
+               the new pid. */
+  exec = 4, /*< Successful execve. */
+  exit = 5, /*< Tracee exited, number is the fatal signal or 0, returnValue is
+               the exit status. */
+};
+
+struct traceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize; /*< sizeof(traceRecord) of the writer. */
+};
+
+/**
+ * One event. Fixed size so traces can be indexed, mmap-ed and compared
+ * record by record.
+ */
+struct traceRecord {
+  uint64_t entryID; /*< Position of this record in the trace. */
+  int32_t pid; /*< Tracee the event happened in. */
+  traceEvent event;
+  int64_t number; /*< System call or signal number, unused otherwise. */
+  uint64_t args[6]; /*< System call arguments at the pre-hook. */
+  int64_t returnValue; /*< See traceEvent for meaning. */
+  int64_t logicalTime; /*< Tracee's logical clock, in microseconds. */
+};
+
+static_assert(sizeof(traceRecord) == 88, "traceRecord layout changed");
+
+/**
+ * Append-only writer for a trace file.
+ * Records are copied straight into a shared, memory-mapped window of the file.
+ * The file is grown one window at a time, so appending is a memcpy except once
+ * every windowSize bytes. The file is truncated to its exact length when the
+ * writer is destroyed. If we crash first, the rest of the last window is zero
+ * filled; readers stop at the first record with pid 0, which no tracee has.
+ */
+class traceWriter {
+public:
+  /**
+   * Constructor.
+   * Creates (or truncates) the file at path and writes the header.
+   * @param path file to write the trace to.
+   */
+  explicit traceWriter(string path);
+
+  ~traceWriter();
+
+  traceWriter(const traceWriter&) = delete;
+  traceWriter& operator=(const traceWriter&) = delete;
+
+  /**
+   * Append a record. entryID is filled in by the writer.
+   */
+  void append(traceRecord record);
+
+  /** Number of records written so far. */
+  uint64_t recordCount() const { return nextEntryID; }
+
+private:
+  /** Bytes mapped and added to the file at a time. Multiple of page size. */
+  static const size_t windowSize = 16 * 1024 * 1024;
+
+  /** Unmap the current window and map the next one, growing the file. */
+  void mapNextWindow();
+
+  int fd;
+  char* window = nullptr; /**< Current mapping, windowSize bytes. */
+  off_t windowStart = 0; /**< File offset of window. */
+  size_t windowUsed = 0; /**< Bytes of window already written. */
+  uint64_t nextEntryID = 0;
+};
+
+/**
+ * Writer of the same header and records to a pipe, given by --trace-stream,
+ * for dettrace-trace check to compare as the run goes. Records are sent a
+ * batch at a time: the reader sees them soon after they happen, without a
+ * write per record.
+ */
+class traceStream {
+public:
+  /** Takes fd over and writes the header to it. */
+  explicit traceStream(int fd);
+
+  /** Sends the records left and closes fd. */
+  ~traceStream();
+
+  traceStream(const traceStream&) = delete;
+  traceStream& operator=(const traceStream&) = delete;
+
+  /** Append a record. entryID is filled in by the writer. */
+  void append(traceRecord record);
+
+private:
+  static const size_t batchRecords = 64;
+
+  /** Write bytes out, giving up on the stream once its reader is gone. */
+  void send(const void* bytes, size_t size);
+
+  int fd;
+  vector<traceRecord> batch;
+  uint64_t nextEntryID = 0;
+};
+
+#endif
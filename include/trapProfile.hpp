@@ -0,0 +1,65 @@
+#ifndef TRAP_PROFILE_H
+#define TRAP_PROFILE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "addressSpace.hpp"
+
+using namespace std;
+
+/**
+ * --trap-profile: which tracee code stops it the most, for deciding what to
+ * patch or let through. Every period-th trap (system call, rdtsc, rdtscp or
+ * cpuid) we take the tracee's rip and walk its frame pointers, then count the
+ * stack. Frames are named module+offset from /proc/pid/maps, addr2line turns
+ * them into functions.
+ *
+ * Written at exit in the folded format flamegraph.pl and speedscope read: one
+ * line per stack, outermost frame first, the trap last, then its count.
+ */
+class trapProfile {
+public:
+  trapProfile(const string& path, uint32_t period);
+
+  /** Writes the profile. */
+  ~trapProfile();
+
+  trapProfile(const trapProfile&) = delete;
+  trapProfile& operator=(const trapProfile&) = delete;
+
+  /**
+   * pid trapped for trap at rip. Sampled every period-th call.
+   * @param rbp frame pointer to walk from.
+   */
+  void trapped(pid_t pid, const string& trap, uint64_t rip, uint64_t rbp);
+
+  /** pid exec-ed or exited, its mappings are gone. */
+  void forget(pid_t pid) { maps.erase(pid); }
+
+  /** We mapped m in pid, name frames in it without reading pid's maps. */
+  void mapped(pid_t pid, const vma& m);
+
+private:
+  /** Frames walked at most, past that we are likely lost anyway. */
+  static const int maxFrames = 32;
+
+  /** addr in pid as module+offset, reading pid's maps again if we must. */
+  string frameName(pid_t pid, uint64_t addr);
+
+  /** A mapping's name as a frame: its file's name without separators. */
+  static string moduleName(const vma& m);
+
+  string path;
+  uint32_t period;
+  uint64_t traps = 0;
+  unordered_map<pid_t, addressSpace> maps;
+  map<string, uint64_t> stacks;
+};
+
+#endif
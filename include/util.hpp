@@ -1,6 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,7 +12,10 @@
 #include <sys/uio.h>
 #include <iostream>
 
+#include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 
 #include <linux/futex.h>
 
@@ -63,12 +67,54 @@ int parseNum(const char* const numToParse);
  *  doWithCheck(mount(cwd, pathToBuild.c_str(), nullptr, MS_BIND, nullptr),
  *             "Unable to bind mount cwd");
  *
+ * Nothing is built unless the call failed: pass a string literal, or for a
+ * message that needs formatting a callable returning it, which is only called
+ * on failure:
+ *  doWithCheck(kill(pid, signum), [&]() { return "kill " + to_string(pid); });
+ *
  * @param returnValue the int return value of a clib function
  * @param errorMessage a string to be appended to the description of errno if
  *                     an the clib function returned -1 (failed)
  * @return the return value of the clib function.
  */
-int doWithCheck(int returnValue, string errorMessage);
+inline int doWithCheck(int returnValue, const char* errorMessage);
+
+/**
+ * Throw errorMessage with the description of error, an errno, for
+ * doWithCheck. Out of line, so the checks stay small.
+ */
+void failWithErrno(const string& errorMessage, int error);
+
+inline int doWithCheck(int returnValue, const char* errorMessage) {
+  if (returnValue == -1) {
+    failWithErrno(errorMessage, errno);
+  }
+  return returnValue;
+}
+
+/** doWithCheck with a message already built. */
+inline int doWithCheck(int returnValue, const string& errorMessage) {
+  if (returnValue == -1) {
+    failWithErrno(errorMessage, errno);
+  }
+  return returnValue;
+}
+
+/** doWithCheck with a message only built if the call failed. */
+template <
+    typename Message,
+    typename = decltype(string(std::declval<Message>()()))>
+int doWithCheck(int returnValue, Message errorMessage) {
+  if (returnValue == -1) {
+    // Building the message may clobber errno.
+    int error = errno;
+    failWithErrno(errorMessage(), error);
+  }
+  return returnValue;
+}
+
+/** str as a JSON string, quotes included. */
+string jsonString(const string& str);
 
 // =======================================================================================
 /**
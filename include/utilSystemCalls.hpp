@@ -27,6 +27,17 @@ bool preemptIfBlocked(
  */
 void zeroOutStatfs(struct statfs& stats);
 
+/**
+ * What every stat-like call reports for the file with real inode realinode:
+ * its inode from gs.inodeMap, and its modification time, the epoch unless we
+ * saw the file written during the run (gs.mtimeMap).
+ */
+ino_t virtualInode(globalState& gs, ino_t realinode);
+struct timespec virtualMtime(globalState& gs, ino_t realinode);
+
+/** The size stat-like calls report, directory sizes vary across kernels. */
+off_t virtualSize(mode_t mode, off_t size);
+
 /**
  * All stat functions can be handled the same, newfstatat is special. Pass the
  * name of the function to syscallName if it's "newfstatat" it's treated
@@ -57,9 +68,16 @@ pair<int, int> getPipeFds(globalState& gs, state& s, ptracer& t);
 /* Turn system call into a noop by changing it into a time. This should be
  *called from the pre hook only! We use time (a vdso system call), since we
  *don't expect it to be called often, unlike getpid, which is expensive to use
- *as a noop since it is called a lot.
+ *as a noop since it is called a lot. The tracee sees returnValue as the
+ *result of its system call.
+ *
+ *Where the kernel lets us, see globalState::skipSystemCalls, the system call
+ *is skipped in this seccomp stop instead, returning returnValue, and no
+ *post-hook runs whatever the pre-hook returns.
+ *@return true if it was skipped, false if time's post-hook finishes it.
  */
-void replaceSystemCallWithNoop(globalState& gs, state& s, ptracer& t);
+bool replaceSystemCallWithNoop(
+    globalState& gs, state& s, ptracer& t, int64_t returnValue = 0);
 
 /**
  * cancel is pending SECCOMP syscall
@@ -71,17 +89,78 @@ void cancelSystemCall(globalState& gs, state& s, ptracer& t);
  * force return failure on a pending syscall
  * must be called on seccomp syscall enter
  * errno is a positive integer defined in errno.h
+ * Callers don't run a post-hook. Where we can, see
+ * globalState::skipSystemCalls, the system call is skipped in this stop rather
+ * than single stepped over, and reads as -1 until then.
  */
 void failSystemCall(globalState& gs, state& s, ptracer& t, int err);
 
 /**
- * Go through "/proc/$tracee_pid/fd/$fd" to get the file descriptor represented
- * by fd. Basically, do a stat by looking at /proc/ section of the tracee. Calls
- * stat("/proc/$tracee_pid/fd/$fd") which dereferences symbolic link. This is
- * fine, unless your path _is_ a symbolic link. You will end up derreferencing
- * too many symbolic links! Assumes that `fd` is currently open for traceePid.
+ * Real inode of the file fd of s is open on. Recorded in s's fd table as the
+ * fd was opened, see fdInfo::inode, or else stat("/proc/$tracee_pid/fd/$fd")
+ * once and recorded. The stat dereferences the symbolic link, this is fine,
+ * unless your path _is_ a symbolic link. Assumes that `fd` is currently open.
+ */
+ino_t readInodeFor(logger& log, state& s, int fd);
+
+/**
+ * Inode of the pipe (or FIFO) fd refers to in traceePid, 0 when fd is not a
+ * pipe. Unlike readInodeFor, never throws, the fd may be gone by now.
+ */
+ino_t pipeInodeFor(pid_t traceePid, int fd);
+
+/** Inode of the socket fd refers to in traceePid, 0 when fd is no socket. */
+ino_t socketInodeFor(pid_t traceePid, int fd);
+
+/**
+ * What waiters on fd of s, a pipe or an end of a socketpair, park on: the
+ * pipe's inode, or what both ends of the socketpair share, see socketPairEnd.
+ * 0 if fd is neither.
+ */
+ino_t pipeKeyFor(state& s, int fd);
+
+/**
+ * Host path of the file fd of traceePid is open on, "" if it has none (pipes,
+ * sockets, anonymous inodes) or fd is gone.
+ */
+string traceeFdPath(pid_t traceePid, int fd);
+
+/**
+ * At the post-hook of an open, openat or openat2: the fd it opened for
+ * reading, -1 if it failed or only opened for writing, or for any other
+ * system call.
+ */
+int fdOpenedForReading(state& s, ptracer& t, int syscallNum);
+
+/**
+ * Duplicate fd of traceePid into the tracer with pidfd_getfd (Linux 5.6+). The
+ * copy shares the tracee's open file description, offset included.
+ * @return our copy, -1 on failure. If the kernel doesn't let us, we don't try
+ * again.
+ */
+int duplicateTraceeFd(pid_t traceePid, int fd);
+
+/**
+ * A pipe end may have been closed (close, dup2, exec, exit), its other end
+ * sees EOF or EPIPE now. Wake up every process blocked on a pipe.
  */
-ino_t readInodeFor(logger& log, pid_t traceePid, int fd);
+void wakePipeWaiters(scheduler& sched);
+
+/**
+ * --vector-clocks: s wrote to the pipe fd, or read from it, see vectorClock.
+ * inode is the pipe's, see pipeKeyFor, 0 to look it up. A read that heard of new sends shows
+ * up in the timeline.
+ */
+void pipeSent(globalState& gs, state& s, int fd, ino_t inode);
+void pipeReceived(
+    globalState& gs, state& s, scheduler& sched, int fd, ino_t inode);
+
+/**
+ * Tracees a futex wake took off their futexQueues queue: their FUTEX_WAIT
+ * returns 0 once they are scheduled again.
+ */
+void wakeFutexWaiters(
+    globalState& gs, scheduler& sched, const vector<pid_t>& woken);
 
 /**
  * Takes care of resolution for a path relative to the tracee process.
@@ -92,7 +171,7 @@ ino_t readInodeFor(logger& log, pid_t traceePid, int fd);
  * currently open for traceePid.
  */
 ino_t inode_from_tracee(
-    const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd);
+    globalState& gs, state& s, const string& traceePath, int traceeDirFd);
 
 /**
  *
@@ -100,6 +179,9 @@ ino_t inode_from_tracee(
  * that the libc call would have returned. Also logs event in logger. For
  * example for read: replaySyscallIfBlocked(s, t, sched, EAGAIN);
  *
+ * When reason is given, the process is parked until that event instead of
+ * being retried on every heap swap, see scheduler::preemptAndWaitFor.
+ *
  * @return: true if call was replayed, else false.
  */
 bool replaySyscallIfBlocked(
@@ -107,7 +189,60 @@ bool replaySyscallIfBlocked(
     state& s,
     ptracer& t,
     scheduler& sched,
-    int64_t errnoValue);
+    int64_t errnoValue,
+    const waitReason* reason = nullptr);
+
+/**
+ * If fd is one of the tracee's pipes or socketpairs, add the events that could
+ * make it ready to reasons: data to read for readable, space to write for
+ * writable. For an eventfd of serveEventfdRead's, a write to it, whatever is
+ * waited for.
+ * @return whether fd is one of the tracee's pipes, socketpairs or such
+ * eventfds.
+ */
+bool addPipeReadyReasons(
+    state& s,
+    int fd,
+    bool readable,
+    bool writable,
+    vector<waitReason>& reasons);
+
+/**
+ * A poll-like system call found nothing ready (returned 0): replay it once one
+ * of reasons happens, or after s.pollBackoff heap swaps for events we can't
+ * see, like data arriving on a socket. The back-off doubles on every empty
+ * retry, so pollers on idle fds stop competing with tracees doing work.
+ *
+ * backOff false means reasons covers everything that could make the call
+ * ready, the call is then only replayed on one of them.
+ *
+ * @return true if replayed, false if something was ready.
+ */
+bool replayPollWhenReady(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    const vector<waitReason>& reasons,
+    bool backOff = true);
+
+/**
+ * A poll-like system call with a timeout found nothing ready: replay it once
+ * its timer goes off or one of reasons happens, see scheduler::armTimer and
+ * replayPollWhenReady. The timer is armed on the first try, timeout after the
+ * tracee's logical time.
+ *
+ * @return true if replayed. false if the timer went off: the tracee's clock
+ * jumped to the deadline, and the call should return as it is (timed out).
+ */
+bool replayUntilTimeout(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    logical_clock::duration timeout,
+    const vector<waitReason>& reasons = {},
+    bool backOff = true);
 
 /**
  * Replay system call by rewinding the PC register. Does NOT restore old
@@ -127,7 +262,8 @@ void replaySystemCall(globalState& gs, ptracer& t, uint64_t systemCall);
    the state::currentSignalHandlers map.
 
    Then, when a tracee requests a signal be delivered some time in the future,
-   we convert this request into immediate deterministic signal delivery. Let's
+   we convert this request into immediate deterministic signal delivery: its
+   logical clock jumps to the timer's first expiry, see setSignalTimer. Let's
    refer to alarm(), setitimer() and timer_settime() as signal-generated
    functions (SGFs).
 
@@ -140,41 +276,108 @@ void replaySystemCall(globalState& gs, ptracer& t, uint64_t systemCall);
    default behavior), we convert the SGF into an exit() syscall.
 
    If the signal generated by the SGF invokes a custom handler, then we have to
-   actually send a real signal. We convert the SGF into a pause() syscall and
-   send a real signal from the tracer to the tracee via tgkill(). When the
-   tracee receives the signal, its handler will run and pause() will then
-   return.
+   actually send a real signal. We convert the SGF into a sched_yield(), which
+   returns 0 like the SGF would, with no post-hook, and queue the signal on
+   state::pendingSignals. The next time the tracee is resumed the signal goes
+   with it, see execution::resumeTracee, and its handler runs as the SGF
+   returns.
 */
 bool sendTraceeSignalNow(
     int signum, globalState& gs, state& s, ptracer& t, scheduler& sched);
 
+/**
+ * Set the tracee's timer key, raising signum, to setting from the pre-hook of
+ * an SGF (see sendTraceeSignalNow). Arming it sends the signal now, the
+ * tracee's clock jumping to the expiry, later periods go off as the clock gets
+ * to them, see execution::resumeTracee. Disarming it, or arming a timer
+ * raising no signal (signum 0), turns the call into a noop.
+ * @param old what the timer was set to, for the SGF's old value.
+ * @return whether to run the post-hook.
+ */
+bool setSignalTimer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    logicalTimers::timerKey key,
+    int signum,
+    timerSetting setting,
+    timerSetting* old);
+
+/**
+ * The setting spec, as given to timer_settime or timerfd_settime, asks for at
+ * now. An absolute (TIMER_ABSTIME) expiry in the past goes off right away.
+ */
+timerSetting timerSettingAt(
+    const struct itimerspec& spec,
+    bool absolute,
+    logical_clock::time_point now);
+
 /**
  * Given a path used by the tracee, either relative or absolute, resolve the
  * exact file the tracee refered to. Uses combination of /proc/traceePid/cwd,
- * /proc/traceePid/root, to resolve path. Takes optional dirfd argument, for
- * tracee calls using *at.
+ * /proc/traceePid/root, to resolve path, as cached by s.paths. Takes optional
+ * dirfd argument, for tracee calls using *at.
  */
 string resolve_tracee_path(
-    const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd);
+    globalState& gs, state& s, const string& traceePath, int traceeDirFd);
+
+/**
+ * Whether a stat-like call on the tracee's path (relative to dirfd) is sure
+ * to fail with ENOENT or ENOTDIR, as our own stat of it does. Its pre-hook then
+ * skips the post-hook that only rewrites what a successful call returned:
+ * header and PATH searches miss far more often than they hit.
+ * Never sure unless gs.predictMissingFiles.
+ */
+bool statWillFail(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool followLinks);
+
+/**
+ * errno a stat of hostPath fails with when it is missing, ENOENT or ENOTDIR,
+ * 0 if it isn't. Answered from gs.missing when it can be, kept there when
+ * missing from an existing directory.
+ */
+int missingPathError(
+    globalState& gs, const string& hostPath, bool followLinks);
+
+/**
+ * Something is about to be created at hostPath, or moved there: paths
+ * gs.missing knows missing from its directory may no longer be.
+ */
+void forgetMissing(globalState& gs, const string& hostPath);
+
+/** Same for the tracee's path, relative to dirfd. */
+void forgetMissing(
+    globalState& gs, state& s, ptracer& t, traceePtr<char> path, int dirfd);
 
 /**
  * Check if a file relative to a tracee exists. Calls resolve_tracee_path,
  * uses stat on file to emulate behavior of open() and openat().
  */
 bool tracee_file_exists(
-    const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd);
+    globalState& gs, state& s, const string& traceePath, int traceeDirFd);
 /**
  * Handler for open and openat. Checks if the file exists and sets
  * s.fileExisted, if O_CREAT was set. This way we know whether a new file was
  * created if the system call suceeds.
+ * An open of a file we know is missing is skipped, failing as it would, when
+ * gs.predictMissingFiles and plainLookup: false for openat2 resolve flags.
+ * @return tracee address of the path to open instead, in s.mmapMemory: a read
+ * only open of a file of gs.synthetic. 0 to open charpath.
  */
-void handlePreOpens(
+uint64_t handlePreOpens(
     globalState& gs,
     state& s,
     ptracer& t,
     int dirfd,
     traceePtr<char> charpath,
-    int flags);
+    int flags,
+    bool plainLookup);
 /**
  * Handler for open and openat. Checks if the file previously existed, if it
  * didn't and O_CREAT was set, we know a new file was created. Handles O_TMPFILE
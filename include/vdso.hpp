@@ -1,6 +1,9 @@
 #ifndef _DETTRACE_VDSO_HPP
 #define _DETTRACE_VDSO_HPP
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -27,7 +30,147 @@ std::ostream& operator<<(std::ostream& out, ProcMapEntry const& e);
 std::vector<ProcMapEntry> parseProcMapEntries(pid_t pid);
 std::map<std::string, std::basic_string<unsigned char>> vdsoGetCandidateData(
     void);
+
+/**
+ * Start of a page mapped in a tracee and shared with us, from which the
+ * logical clock vdso functions read the time without trapping. The tracer
+ * writes the tracee's logical clock here before resuming it and reads it back
+ * at its next stop, see state::pushClock() and state::pullClock().
+ */
+struct logicalClockPage {
+  /** Logical time, microseconds since the Unix epoch. */
+  int64_t now;
+  /** What every read of the time adds to now. */
+  int64_t step;
+  /** Counts down every read, the one taking it to 0 does the system call. */
+  int64_t readsLeft;
+  /** execution::tscCounter and tscpCounter, for patched rdtsc sites. */
+  uint64_t tsc;
+  uint64_t tscp;
+  /**
+   * Bit n set: patched sites of system call n run it from the gate when its
+   * fd is in regularFds, see bufferedSystemCallTrampoline.
+   */
+  uint64_t bufferedSystemCalls;
+  /**
+   * Bit n set: fd n of the tracee running is a regular file, /dev/null or
+   * /dev/zero, whose reads and writes we let through anyway, see neverBlocks.
+   * Written with the clock, see state::pushClock().
+   */
+  uint64_t regularFds[16];
+  /**
+   * Bit n set, and n in bufferedSystemCalls: what patched sites of system call
+   * n let through the gate also goes in the side effect ring, for what we only
+   * need to know about afterwards. Sites that can't fit theirs in it stop.
+   */
+  uint64_t recordedSystemCalls;
+  /**
+   * Bytes of sideEffectRecords in the ring, which follows the page, since the
+   * tracer last drained it, see execution::drainSideEffects.
+   */
+  uint64_t sideEffectBytes;
+};
+
+/**
+ * A system call a patched site let through the gate, in the side effect ring
+ * of its logicalClockPage: only those that succeeded, followed by result bytes
+ * of its buffer (what a write wrote) and padded to 8 bytes. Tracees fill the
+ * ring without stopping, the tracer drains it in order at their next stop,
+ * before the stop itself is handled. Only one tracee sharing a ring runs at a
+ * time, the one stopping, so every record in it is of the tracee stopped.
+ */
+struct sideEffectRecord {
+  uint32_t syscallNumber;
+  int32_t fd;
+  int64_t result;
+};
+
+/** Size of the side effect ring, mapped right after the logicalClockPage. */
+const size_t sideEffectRingSize = 64 * 1024;
+
+/** fds regularFds has a bit for. */
+const int bufferedFds = 64 * 16;
+
+/** Reads of the time a tracee gets between trips to the tracer. */
+const int64_t logicalClockReads = 256;
+
+/** Size of the logicalClockPage mapping. */
+const size_t logicalClockPageSize = 4096;
+
+/**
+ * Where we map the logical clock page. The seccomp filter is loaded before the
+ * program runs, so the gate it lets reads and writes through from must be at
+ * an address known before that. Tracees mapping something else there get the
+ * page elsewhere, and no gate.
+ */
+const uint64_t logicalClockPageAddr = 0x7e0000000000;
+
+/**
+ * Offset in the page of the gate: a system call and a return, see
+ * bufferedSystemCallGate. The seccomp filter lets reads and writes made from
+ * its logicalClockGateSize bytes through without stopping.
+ */
+const unsigned long logicalClockGateOffset = 192;
+const size_t logicalClockGateSize = 16;
+
+static_assert(
+    sizeof(logicalClockPage) <= logicalClockGateOffset,
+    "logicalClockPage overlaps its gate");
+
+/** Offset in the page of the first logical clock function. */
+const unsigned long logicalClockCodeOffset =
+    logicalClockGateOffset + logicalClockGateSize;
+
+/**
+ * Byte code of the logical clock vdso functions, by vdso symbol, to be copied
+ * anywhere after logicalClockCodeOffset in a logicalClockPage.
+ */
+std::map<std::string, std::basic_string<unsigned char>> vdsoGetLogicalClockData(
+    void);
+
+/**
+ * Offset in a logicalClockPage of the logical clock function replacing vdso
+ * symbol name, where layOutLogicalClock puts it.
+ */
+unsigned long logicalClockFunctionOffset(const std::string& name);
+
+/**
+ * Copy the logical clock functions to their offsets in page, for the vdso's
+ * and patched system call sites to call, see bufferedSystemCallTrampoline.
+ */
+void layOutLogicalClock(logicalClockPage* page);
+
+/**
+ * Byte code replacing a vdso function, jumping to its logical clock version at
+ * target.
+ */
+std::basic_string<unsigned char> vdsoLogicalClockTrampoline(
+    unsigned long target);
+/**
+ * Symbols of the vdso functions, by name: offset in the vdso, size and
+ * alignment. Only for our own pid, the vdso is read from our memory; the vdso
+ * is the same in every process.
+ */
 std::map<std::string, std::tuple<unsigned long, unsigned long, unsigned long>>
 vdsoGetSymbols(pid_t pid);
 
+/**
+ * Where pid's vdso is mapped, from AT_SYSINFO_EHDR in its auxiliary vector, 0
+ * if it has none.
+ */
+unsigned long vdsoGetBase(pid_t pid);
+
+/**
+ * Where [vvar] is mapped, relative to the [vdso] start. The kernel lays the two
+ * out the same way in every process, so one look at pid's maps does for all.
+ */
+struct vvarLayout {
+  /** Start of [vvar] minus start of [vdso]. */
+  long offset;
+  /** Bytes mapped, 0 if there is no [vvar]. */
+  unsigned long size;
+};
+
+vvarLayout vdsoGetVvarLayout(pid_t pid);
+
 #endif
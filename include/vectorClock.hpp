@@ -0,0 +1,103 @@
+#ifndef VECTOR_CLOCK_H
+#define VECTOR_CLOCK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * --vector-clocks: what a thread group has heard of the others, for every
+ * thread group, how many of its sends happened before now. A send is a write
+ * to a pipe, a fork or an exit, a receive is reading a pipe, being forked or
+ * reaping a child, see globalState::causalSend and causalReceive.
+ *
+ * Thread groups that never sent anything are left out, most clocks only have
+ * a few entries: kept sorted by thread group in a vector.
+ */
+class vectorClock {
+public:
+  /** group sent something, its own entry goes up. */
+  void tick(pid_t group) {
+    auto it = find(group);
+    if (it == entries.end() || it->first != group) {
+      it = entries.insert(it, {group, 0});
+    }
+    it->second++;
+  }
+
+  /**
+   * Take in everything other heard of.
+   * @return whether other knew of a send we didn't.
+   */
+  bool merge(const vectorClock& other) {
+    bool learned = false;
+    for (auto& entry : other.entries) {
+      auto it = find(entry.first);
+      if (it == entries.end() || it->first != entry.first) {
+        entries.insert(it, entry);
+        learned = true;
+      } else if (it->second < entry.second) {
+        it->second = entry.second;
+        learned = true;
+      }
+    }
+    return learned;
+  }
+
+  /** Sends of group we heard of. */
+  uint64_t operator[](pid_t group) const {
+    auto it =
+        lower_bound(entries.begin(), entries.end(), group, entryBefore);
+    return it == entries.end() || it->first != group ? 0 : it->second;
+  }
+
+  /**
+   * Whether we heard of nothing other didn't: everything up to us happened
+   * before other, or we are the same.
+   */
+  bool before(const vectorClock& other) const {
+    for (auto& entry : entries) {
+      if (other[entry.first] < entry.second) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** Neither happened before the other. */
+  bool concurrent(const vectorClock& other) const {
+    return !before(other) && !other.before(*this);
+  }
+
+  /** e.g. "{1: 3, 5: 2}". */
+  string str() const {
+    string text = "{";
+    for (auto& entry : entries) {
+      if (text.size() > 1) {
+        text += ", ";
+      }
+      text += to_string(entry.first) + ": " + to_string(entry.second);
+    }
+    return text + "}";
+  }
+
+private:
+  /** First entry of group or after it. */
+  vector<pair<pid_t, uint64_t>>::iterator find(pid_t group) {
+    return lower_bound(entries.begin(), entries.end(), group, entryBefore);
+  }
+
+  static bool entryBefore(const pair<pid_t, uint64_t>& entry, pid_t group) {
+    return entry.first < group;
+  }
+
+  vector<pair<pid_t, uint64_t>> entries;
+};
+
+#endif
@@ -0,0 +1,16 @@
+# dettrace --profile compile: C and C++ builds, compilers, assemblers, linkers
+# and the make and shells driving them.
+#
+# None of these use POSIX timers or timerfds, fail them in the kernel rather
+# than stop for a handler that's never needed. Builds never serve sockets, the
+# rest of the socket calls stay intercepted.
+timer_create errno ENOSYS
+timer_settime errno EINVAL
+timer_gettime errno EINVAL
+timer_getoverrun errno EINVAL
+timer_delete errno EINVAL
+timerfd_create errno ENOSYS
+timerfd_settime errno EINVAL
+timerfd_gettime errno EINVAL
+listen allow
+shutdown allow
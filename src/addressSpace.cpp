@@ -0,0 +1,51 @@
+#include "addressSpace.hpp"
+
+#include <iterator>
+
+// =======================================================================================
+addressSpace::addressSpace(const vector<ProcMapEntry>& entries) {
+  for (const ProcMapEntry& e : entries) {
+    vma m{e.procMapBase, e.procMapBase + e.procMapSize, e.procMapPerms,
+          e.procMapOffset, e.procMapName};
+    // /proc/pid/maps is sorted already.
+    byStart.emplace_hint(byStart.end(), m.start, m);
+  }
+}
+// =======================================================================================
+const vma* addressSpace::find(uint64_t addr) const {
+  auto after = byStart.upper_bound(addr);
+  if (after == byStart.begin()) {
+    return nullptr;
+  }
+  const vma& m = prev(after)->second;
+  return addr < m.end ? &m : nullptr;
+}
+// =======================================================================================
+void addressSpace::map(const vma& m) {
+  unmap(m.start, m.end);
+  byStart.emplace(m.start, m);
+}
+// =======================================================================================
+void addressSpace::unmap(uint64_t start, uint64_t end) {
+  auto it = byStart.lower_bound(start);
+  if (it != byStart.begin() && prev(it)->second.end > start) {
+    --it;
+  }
+  while (it != byStart.end() && it->first < end) {
+    vma m = it->second;
+    it = byStart.erase(it);
+    if (m.start < start) {
+      vma below = m;
+      below.end = start;
+      byStart.emplace_hint(it, below.start, below);
+    }
+    if (m.end > end) {
+      vma above = m;
+      above.offset += end - m.start;
+      above.start = end;
+      byStart.emplace_hint(it, above.start, above);
+      break;
+    }
+  }
+}
+// =======================================================================================
@@ -0,0 +1,114 @@
+#include "branchCounter.hpp"
+
+#include <cpuid.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Raw retired conditional branch events, as used by rr. Intel:
+ * BR_INST_RETIRED.CONDITIONAL, AMD Zen: retired conditional branches.
+ */
+static const uint64_t intelConditionalBranches = 0x5101c4;
+static const uint64_t amdConditionalBranches = 0x5100d1;
+
+/**
+ * Pick the retired conditional branch event of this CPU, falling back to the
+ * generic branch instruction counter on vendors we don't know.
+ */
+static void setBranchEvent(struct perf_event_attr& attr) {
+  unsigned int eax, ebx, ecx, edx;
+  char vendor[13] = {0};
+  if (__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+  }
+
+  if (strcmp(vendor, "GenuineIntel") == 0) {
+    attr.type = PERF_TYPE_RAW;
+    attr.config = intelConditionalBranches;
+  } else if (strcmp(vendor, "AuthenticAMD") == 0) {
+    attr.type = PERF_TYPE_RAW;
+    attr.config = amdConditionalBranches;
+  } else {
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+  }
+}
+// =======================================================================================
+branchCounter::branchCounter(uint64_t quantum, logger& log)
+    : quantum(quantum), log(log) {}
+// =======================================================================================
+branchCounter::~branchCounter() {
+  for (auto& c : counters) {
+    close(c.second);
+  }
+}
+// =======================================================================================
+void branchCounter::attach(pid_t tid) {
+  if (!enabled()) {
+    return;
+  }
+  int fd = openCounter(tid);
+  if (fd == -1) {
+    supported = false;
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(
+            Color::red,
+            "Unable to count branches of [%d]: %s. Tracees run without branch "
+            "preemption.\n"),
+        tid, strerror(errno));
+    return;
+  }
+  counters[tid] = fd;
+}
+// =======================================================================================
+void branchCounter::detach(pid_t tid) {
+  auto it = counters.find(tid);
+  if (it != counters.end()) {
+    close(it->second);
+    counters.erase(it);
+  }
+}
+// =======================================================================================
+bool branchCounter::isOverflow(pid_t tid, int signalFd) const {
+  auto it = counters.find(tid);
+  return it != counters.end() && it->second == signalFd;
+}
+// =======================================================================================
+int branchCounter::openCounter(pid_t tid) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  setBranchEvent(attr);
+  attr.sample_period = quantum;
+  attr.wakeup_events = 1;
+  // Only what the tracee itself executes, and never multiplexed with other
+  // events, either would make counts differ between runs.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.pinned = 1;
+
+  int fd = syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+  if (fd == -1) {
+    return -1;
+  }
+
+  // Overflows raise overflowSignal in tid itself.
+  struct f_owner_ex owner = {F_OWNER_TID, tid};
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+      fcntl(fd, F_SETOWN_EX, &owner) == -1 ||
+      fcntl(fd, F_SETSIG, overflowSignal) == -1 ||
+      fcntl(fd, F_SETFL, O_ASYNC) == -1) {
+    int savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    return -1;
+  }
+  return fd;
+}
+// =======================================================================================
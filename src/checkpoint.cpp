@@ -0,0 +1,518 @@
+#include "checkpoint.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "ptracer.hpp"
+#include "systemCallList.hpp"
+#include "util.hpp"
+
+/** What waitpid reports for a ptrace event stop. */
+static bool isEventStop(int status, int event) {
+  return WIFSTOPPED(status) && status >> 8 == (SIGTRAP | (event << 8));
+}
+
+/** regs, made to run the system call they stopped in again. */
+static struct user_regs_struct atSystemCall(struct user_regs_struct regs) {
+  regs.rax = regs.orig_rax;
+  // Back to the syscall instruction, 0f 05. No restart to apply on top.
+  regs.rip -= 2;
+  regs.orig_rax = -1;
+  return regs;
+}
+
+/** Exit code of a tracer we waited for, as dettrace itself would exit. */
+static int exitCodeOf(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  return WIFSIGNALED(status) ? WTERMSIG(status) : 1;
+}
+
+/** Wait for pid to stop running its initial stop, as auto attached children. */
+static bool waitForStop(pid_t pid) {
+  int status;
+  return waitpid(pid, &status, __WALL) == pid && WIFSTOPPED(status);
+}
+
+/**
+ * Send a restore request over sock, and streams, if not null, for the
+ * restored tracee.
+ */
+static bool sendRequest(int sock, const int* streams) {
+  char request = streams != nullptr;
+  struct iovec iov = {&request, sizeof(request)};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  union {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  if (streams != nullptr) {
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), streams, 3 * sizeof(int));
+  }
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+/**
+ * Receive a request sent by sendRequest, its streams as new close-on-exec
+ * fds, -1 if none came. @return what recvmsg did.
+ */
+static ssize_t receiveRequest(int sock, int* streams) {
+  char request;
+  struct iovec iov = {&request, sizeof(request)};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  union {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  streams[0] = streams[1] = streams[2] = -1;
+  ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  struct cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+  if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+    memcpy(streams, CMSG_DATA(cmsg), 3 * sizeof(int));
+  }
+  return n;
+}
+
+static void closeStreams(int* streams) {
+  for (int i = 0; i < 3; i++) {
+    if (streams[i] != -1) {
+      close(streams[i]);
+      streams[i] = -1;
+    }
+  }
+}
+
+/** Run a stopped pid until its next seccomp stop. */
+static void runToSeccompStop(pid_t pid) {
+  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
+  int status;
+  while (waitpid(pid, &status, __WALL) == pid &&
+         !isEventStop(status, PTRACE_EVENT_SECCOMP)) {
+    // Left stopped, the frozen copy told its parent: not a real signal of the
+    // run, dropped.
+    if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGCHLD) {
+      runtimeError(
+          "checkpoint: tracee did not get back to the marker, status " +
+          to_string(status) + ".\n");
+    }
+    ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
+  }
+}
+// =======================================================================================
+checkpoint::marker checkpoint::parseMarker(const string& text) {
+  marker m;
+  size_t colon = text.find(':');
+  string kind = text.substr(0, colon);
+  string what = colon == string::npos ? "" : text.substr(colon + 1);
+  if (kind == "syscall") {
+    for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+      if (systemCallMappings[i] == what) {
+        m.systemCall = i;
+        return m;
+      }
+    }
+  } else if (kind == "open" && !what.empty()) {
+    m.path = what;
+    return m;
+  }
+  runtimeError(
+      "--checkpoint-at expects syscall:NAME or open:PATH, got: " + text);
+  return m;
+}
+// =======================================================================================
+checkpoint::checkpoint(marker at, logger& log) : at(at), log(log) {}
+// =======================================================================================
+bool checkpoint::isMarker(int systemCall, const string& path) const {
+  if (givenUp) {
+    return false;
+  }
+  if (at.systemCall != -1) {
+    return systemCall == at.systemCall;
+  }
+  return (systemCall == SYS_open || systemCall == SYS_openat ||
+          systemCall == SYS_creat) &&
+      path == at.path;
+}
+// =======================================================================================
+checkpoint::role checkpoint::take(pid_t pid, traceePtr<void> scratch) {
+  // One go, whatever happens.
+  givenUp = true;
+  lastPidFd = open("/proc/sys/kernel/ns_last_pid", O_RDWR | O_CLOEXEC);
+  FILE* maxFile = fopen("/proc/sys/kernel/pid_max", "re");
+  char last[32] = {0};
+  if (maxFile == nullptr || fscanf(maxFile, "%d", &topPid) != 1 ||
+      lastPidFd == -1 || pread(lastPidFd, last, sizeof(last) - 1, 0) <= 0) {
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(
+            Color::red,
+            "No checkpoint: cannot set the pid namespace's last pid: %s\n"),
+        strerror(errno));
+    if (maxFile != nullptr) {
+      fclose(maxFile);
+    }
+    return role::failed;
+  }
+  fclose(maxFile);
+  lastPid = atoi(last);
+  traceePid = pid;
+  this->scratch = scratch;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &markerRegs);
+
+  // Its system call becomes the fork of the frozen copy, then it makes it
+  // again. The copy returns from the fork with the tracee's memory and
+  // registers at the marker.
+  struct user_regs_struct regs = markerRegs;
+  regs.orig_rax = SYS_clone;
+  regs.rdi = SIGCHLD;
+  regs.rsi = regs.rdx = regs.r10 = regs.r8 = 0;
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  setLastPid(topPid - 2);
+  ptracer::doPtrace(PTRACE_SYSCALL, pid, 0, 0);
+  for (;;) {
+    int status;
+    doWithCheck(waitpid(pid, &status, __WALL), "checkpoint waitpid");
+    if (isEventStop(status, PTRACE_EVENT_FORK)) {
+      unsigned long child;
+      ptracer::doPtrace(PTRACE_GETEVENTMSG, pid, 0, &child);
+      frozen = child;
+      ptracer::doPtrace(PTRACE_SYSCALL, pid, 0, 0);
+      continue;
+    }
+    if (!WIFSTOPPED(status) || WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+      runtimeError("checkpoint: tracee did not get through its fork.\n");
+    }
+    break;
+  }
+  setLastPid(lastPid);
+  if (frozen != -1 && waitForStop(frozen)) {
+    // Stopped, and no longer ours, until a restore.
+    leaveStopped(frozen);
+  }
+  regs = atSystemCall(markerRegs);
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  runToSeccompStop(pid);
+  if (frozen == -1) {
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(Color::red, "No checkpoint: the fork failed.\n"));
+    return role::failed;
+  }
+
+  int sockets[2];
+  doWithCheck(
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets),
+      "checkpoint socketpair");
+  pid_t child = forkInto(topPid - 2);
+  if (child == 0) {
+    close(sockets[0]);
+    channel = sockets[1];
+    hold();
+    return role::restored;
+  }
+  close(sockets[1]);
+  if (child == -1) {
+    close(sockets[0]);
+    kill(frozen, SIGKILL);
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(
+            Color::red, "No checkpoint: the tracer cannot fork: %s\n"),
+        strerror(errno));
+    return role::failed;
+  }
+  channel = sockets[0];
+  holder = child;
+  DETTRACE_LOG(
+      log, Importance::inter,
+      log.makeTextColored(
+          Color::blue, "Checkpoint of [%d] taken, frozen as [%d].\n"),
+      pid, frozen);
+  return role::original;
+}
+// =======================================================================================
+int checkpoint::restore(const int* streams) {
+  if (!taken() || !sendRequest(channel, streams)) {
+    return 1;
+  }
+  for (;;) {
+    struct pollfd pfd = {channel, POLLIN, 0};
+    if (poll(&pfd, 1, 100) == -1 && errno != EINTR) {
+      return 1;
+    }
+    // The restored tracee is our child, and orphans are ours: as pid 1, we
+    // reap them, or their pids are still taken next time.
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG | __WALL)) > 0) {
+      if (pid == holder) {
+        holder = -1;
+        return 1;
+      }
+    }
+    if ((pfd.revents & POLLIN) != 0) {
+      int32_t exitCode;
+      ssize_t n = read(channel, &exitCode, sizeof(exitCode));
+      return n == (ssize_t)sizeof(exitCode) ? exitCode : 1;
+    }
+    if ((pfd.revents & (POLLHUP | POLLERR)) != 0) {
+      return 1;
+    }
+  }
+}
+// =======================================================================================
+void checkpoint::release() {
+  if (!taken()) {
+    return;
+  }
+  // The holder kills the frozen tracee once the channel closes.
+  close(channel);
+  channel = -1;
+  waitpid(holder, nullptr, 0);
+  holder = -1;
+  kill(frozen, SIGKILL);
+  waitpid(frozen, nullptr, __WALL);
+}
+// =======================================================================================
+void checkpoint::hold() {
+  for (;;) {
+    int streams[3];
+    ssize_t n = receiveRequest(channel, streams);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      kill(frozen, SIGKILL);
+      _exit(0);
+    }
+
+    int32_t exitCode = 1;
+    pid_t restored = forkFrozenTracee();
+    if (restored == -1) {
+      closeStreams(streams);
+    } else {
+      pid_t tracerPid = forkInto(topPid - 3);
+      if (tracerPid == 0) {
+        close(channel);
+        channel = -1;
+        attachRestored(restored);
+        if (streams[0] != -1) {
+          redirectStreams(restored, streams);
+        }
+        closeStreams(streams);
+        return;
+      }
+      closeStreams(streams);
+      int status;
+      if (tracerPid == -1) {
+        kill(restored, SIGKILL);
+      } else if (waitpid(tracerPid, &status, 0) == tracerPid) {
+        exitCode = exitCodeOf(status);
+      }
+    }
+    if (write(channel, &exitCode, sizeof(exitCode)) != sizeof(exitCode)) {
+      kill(frozen, SIGKILL);
+      _exit(1);
+    }
+  }
+}
+// =======================================================================================
+pid_t checkpoint::forkFrozenTracee() {
+  // Ours for as long as the fork takes. Seizing a stopped process traps it.
+  int options = PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL;
+  if (ptrace(PTRACE_SEIZE, frozen, 0, (void*)(long)options) == -1 ||
+      !waitForStop(frozen)) {
+    return -1;
+  }
+
+  // A `syscall; int3` stub where the system call at the marker returns to,
+  // borrowed from the code there.
+  errno = 0;
+  long savedInsn = ptrace(PTRACE_PEEKTEXT, frozen, (void*)markerRegs.rip, 0);
+  if (errno != 0) {
+    return -1;
+  }
+  unsigned long stub = 0xcc050fUL;
+  ptracer::doPtrace(
+      PTRACE_POKETEXT, frozen, (void*)markerRegs.rip,
+      (void*)((savedInsn & ~0xffffffUL) | stub));
+  struct user_regs_struct regs = markerRegs;
+  regs.orig_rax = regs.rax = SYS_clone;
+  // Our child too, like the tracee was, once the tracee is gone.
+  regs.rdi = CLONE_PARENT | SIGCHLD;
+  regs.rsi = regs.rdx = regs.r10 = regs.r8 = 0;
+  ptracer::doPtrace(PTRACE_SETREGS, frozen, 0, &regs);
+
+  setLastPid(traceePid - 1);
+  pid_t copy = -1;
+  ptracer::doPtrace(PTRACE_CONT, frozen, 0, 0);
+  for (;;) {
+    int status;
+    if (waitpid(frozen, &status, __WALL) != frozen || !WIFSTOPPED(status)) {
+      break;
+    }
+    if (isEventStop(status, PTRACE_EVENT_SECCOMP)) {
+      ptracer::doPtrace(PTRACE_CONT, frozen, 0, 0);
+      continue;
+    }
+    if (isEventStop(status, PTRACE_EVENT_FORK)) {
+      unsigned long child;
+      ptracer::doPtrace(PTRACE_GETEVENTMSG, frozen, 0, &child);
+      copy = child;
+      ptracer::doPtrace(PTRACE_CONT, frozen, 0, 0);
+      continue;
+    }
+    // Stops left from leaveStopped(), it makes no other.
+    if (WSTOPSIG(status) == SIGSTOP) {
+      ptracer::doPtrace(PTRACE_CONT, frozen, 0, 0);
+      continue;
+    }
+    // The int3 after the system call.
+    break;
+  }
+  setLastPid(lastPid);
+  ptracer::doPtrace(
+      PTRACE_POKETEXT, frozen, (void*)markerRegs.rip, (void*)savedInsn);
+  leaveStopped(frozen);
+  if (copy == -1 || !waitForStop(copy)) {
+    return -1;
+  }
+  if (copy != traceePid) {
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(
+            Color::red, "Cannot restore: pid %d taken, got [%d] instead.\n"),
+        traceePid, copy);
+    kill(copy, SIGKILL);
+    waitpid(copy, nullptr, __WALL);
+    return -1;
+  }
+
+  // It inherited the stub, and the registers of the frozen copy's fork.
+  ptracer::doPtrace(
+      PTRACE_POKETEXT, copy, (void*)markerRegs.rip, (void*)savedInsn);
+  regs = atSystemCall(markerRegs);
+  ptracer::doPtrace(PTRACE_SETREGS, copy, 0, &regs);
+  leaveStopped(copy);
+  return copy;
+}
+// =======================================================================================
+void checkpoint::attachRestored(pid_t restoredPid) {
+  doWithCheck(
+      ptrace(PTRACE_SEIZE, restoredPid, 0, 0), "checkpoint PTRACE_SEIZE");
+  if (!waitForStop(restoredPid)) {
+    runtimeError("checkpoint: restored tracee did not stop.\n");
+  }
+  ptracer::setOptions(restoredPid);
+  runToSeccompStop(restoredPid);
+}
+// =======================================================================================
+void checkpoint::redirectStreams(pid_t restoredPid, const int* streams) {
+  if (scratch.ptr == nullptr) {
+    runtimeError("checkpoint: no tracee memory to give it its streams in.\n");
+  }
+  for (int target = 0; target < 3; target++) {
+    // Opened anew, the same file or pipe end as ours.
+    string path =
+        "/proc/" + to_string(getpid()) + "/fd/" + to_string(streams[target]);
+    vector<char> bytes(path.begin(), path.end());
+    bytes.resize((path.size() / sizeof(long) + 1) * sizeof(long), '\0');
+    for (size_t i = 0; i < bytes.size(); i += sizeof(long)) {
+      long word;
+      memcpy(&word, bytes.data() + i, sizeof(word));
+      ptracer::doPtrace(
+          PTRACE_POKEDATA, restoredPid, (char*)scratch.ptr + i, (void*)word);
+    }
+    int flags = fcntl(streams[target], F_GETFL);
+    flags = flags == -1 ? (target == 0 ? O_RDONLY : O_WRONLY)
+                        : flags & (O_ACCMODE | O_APPEND);
+    long fd = injectAtMarker(
+        restoredPid, SYS_open, (long)scratch.ptr, flags | O_CLOEXEC, 0);
+    if (fd < 0) {
+      runtimeError(
+          "checkpoint: restored tracee cannot open " + path + ": " +
+          strerror(-fd) + "\n");
+    }
+    injectAtMarker(restoredPid, SYS_dup2, fd, target, 0);
+    injectAtMarker(restoredPid, SYS_close, fd, 0, 0);
+  }
+}
+// =======================================================================================
+long checkpoint::injectAtMarker(
+    pid_t pid, long nr, long a0, long a1, long a2) {
+  struct user_regs_struct regs = markerRegs;
+  regs.orig_rax = nr;
+  regs.rdi = a0;
+  regs.rsi = a1;
+  regs.rdx = a2;
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  ptracer::doPtrace(PTRACE_SYSCALL, pid, 0, 0);
+  int status;
+  if (waitpid(pid, &status, __WALL) != pid || !WIFSTOPPED(status) ||
+      WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+    runtimeError(
+        "checkpoint: restored tracee did not get through " +
+        systemCallMappings[nr] + ".\n");
+  }
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
+  long ret = regs.rax;
+  regs = atSystemCall(markerRegs);
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  runToSeccompStop(pid);
+  return ret;
+}
+// =======================================================================================
+bool checkpoint::setLastPid(pid_t pid) {
+  string text = to_string(pid);
+  return pwrite(lastPidFd, text.c_str(), text.size(), 0) ==
+      (ssize_t)text.size();
+}
+// =======================================================================================
+pid_t checkpoint::forkInto(pid_t pid) {
+  setLastPid(pid - 1);
+  pid_t child = fork();
+  if (child != 0) {
+    setLastPid(lastPid);
+  }
+  if (child > 0 && child != pid) {
+    DETTRACE_LOG(
+        log, Importance::info, "Checkpoint process [%d] not at %d.\n", child,
+        pid);
+  }
+  return child;
+}
+// =======================================================================================
+void checkpoint::leaveStopped(pid_t pid) {
+  // Handled on the way back to user space, before any of its code runs. A
+  // signal given to PTRACE_DETACH would be dropped in an event stop.
+  kill(pid, SIGSTOP);
+  ptracer::doPtrace(PTRACE_DETACH, pid, 0, 0);
+}
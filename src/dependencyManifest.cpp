@@ -0,0 +1,95 @@
+#include "dependencyManifest.hpp"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "systemCallList.hpp"
+#include "util.hpp"
+#include "utilSystemCalls.hpp"
+
+// =======================================================================================
+dependencyManifest::dependencyManifest(const string& path, fileHasher& hashes)
+    : path(path), hashes(hashes) {
+  // Check now rather than lose the manifest at the end of the run.
+  ofstream out(path);
+  if (!out) {
+    runtimeError("Unable to open dependency manifest " + path);
+  }
+}
+// =======================================================================================
+dependencyManifest::~dependencyManifest() {
+  ofstream out(path);
+  out << "[";
+  const char* separator = "\n";
+  for (exec& e : execs) {
+    out << separator << "  {\"pid\": " << e.pid
+        << ", \"exe\": " << jsonString(e.exe) << ", \"argv\": [";
+    const char* comma = "";
+    for (const string& arg : e.argv) {
+      out << comma << jsonString(arg);
+      comma = ", ";
+    }
+    out << "],\n   \"reads\": {";
+    comma = "";
+    for (auto& read : e.reads) {
+      string hash = hashes.hashOf(read.first, read.second);
+      out << comma << "\n    " << jsonString(read.first) << ": "
+          << (hash.empty() ? "null" : jsonString(hash));
+      comma = ",";
+    }
+    out << "}}";
+    separator = ",\n";
+  }
+  out << "\n]\n";
+}
+// =======================================================================================
+void dependencyManifest::execed(pid_t pid) {
+  exec e;
+  e.pid = pid;
+  string procPath = "/proc/" + to_string(pid);
+  char buf[PATH_MAX];
+  ssize_t n = readlink((procPath + "/exe").c_str(), buf, sizeof(buf));
+  if (n > 0) {
+    e.exe = string(buf, n);
+  }
+  // The new image's argv, NUL separated.
+  ifstream cmdline(procPath + "/cmdline");
+  string arg;
+  while (getline(cmdline, arg, '\0')) {
+    e.argv.push_back(arg);
+  }
+  execOf[pid] = execs.size();
+  execs.push_back(move(e));
+}
+// =======================================================================================
+void dependencyManifest::spawned(pid_t parent, pid_t child) {
+  auto from = execOf.find(parent);
+  if (from != execOf.end()) {
+    execOf[child] = from->second;
+  }
+}
+// =======================================================================================
+void dependencyManifest::systemCall(state& s, ptracer& t, int syscallNum) {
+  auto of = execOf.find(s.traceePid);
+  if (of == execOf.end()) {
+    return;
+  }
+  int fd = fdOpenedForReading(s, t, syscallNum);
+  if (fd == -1) {
+    return;
+  }
+
+  string opened = traceeFdPath(s.traceePid, fd);
+  fileIdentity id;
+  if (opened.empty() || !fileHasher::identify(opened, id)) {
+    return;
+  }
+  // The first version read is the one the exec depends on.
+  if (execs[of->second].reads.emplace(opened, id).second) {
+    hashes.prefetch(opened, id);
+  }
+}
+// =======================================================================================
@@ -3,42 +3,54 @@
 #include <errno.h>
 #include <fcntl.h> /* Obtain O_* constant definitions */
 #include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/syscall.h>
 #include <sys/timerfd.h>
 #include <sys/times.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
 #include <limits>
 #include <optional>
+#include <set>
 
+#include <linux/close_range.h>
 #include <linux/fiemap.h>
 #include <linux/fs.h>
 #include <linux/futex.h>
+#include <linux/openat2.h>
 #include <linux/rtc.h>
 #include <sys/resource.h>
 #include <sys/sysinfo.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/uio.h>
 #include <utime.h>
 #include <unordered_map>
+#include <vector>
 
 #include <optional>
 
 #include "dettraceSystemCall.hpp"
 #include "execution.hpp"
+#include "ioUring.hpp"
 #include "ptracer.hpp"
 #include "utilSystemCalls.hpp"
 
@@ -50,6 +62,116 @@
 using namespace std;
 
 static bool fd_is_nonblocking(state& s, int fd);
+static void forgetFd(globalState& gs, state& s, int fd);
+static bool finishInPreHook(
+    globalState& gs, state& s, ptracer& t, int64_t returnValue);
+static void noteUnlink(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool directory);
+static uint64_t writeRestInTracer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int fd,
+    const vector<pair<uint64_t, uint64_t>>& rest);
+
+/**
+ * Log the path at addr a pre-hook creates, keeping it in s.createdPath for
+ * noteCreated.
+ */
+static void logCreatedPath(
+    globalState& gs, state& s, ptracer& t, uint64_t addr, string postFix);
+
+/**
+ * Give the file a successful call created at addr, relative to dirfd, a
+ * virtual inode and our mtime.
+ */
+static void noteCreated(
+    globalState& gs, state& s, ptracer& t, uint64_t addr, int dirfd);
+
+/**
+ * --fakeroot: stat the file a chown or chmod is about, path relative to dirfd,
+ * or dirfd itself for a null path.
+ * @return 0, or the -errno the system call fails with.
+ */
+static int statFakeFile(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool followLinks,
+    struct stat& statbuf);
+
+/** --fakeroot: record a chown, answered in the pre-hook. */
+static bool fakeChown(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool followLinks,
+    uid_t uid,
+    gid_t gid);
+
+/**
+ * --fakeroot: record a chmod, and keep the owner able to read, write and, for
+ * directories, search what the real chmod leaves, as fakeroot does. Otherwise
+ * a chmod 0 would leave files the host user can't read or remove. modeArg is
+ * the argument mode is in, 2 or 3.
+ */
+static void fakeChmod(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    mode_t mode,
+    int modeArg);
+
+/** File type of path, relative to dirfd, not following links, 0 if none. */
+static mode_t fileType(
+    globalState& gs, state& s, ptracer& t, traceePtr<char> path, int dirfd);
+
+/**
+ * Pre-hook of a rename from from to to, with exchange for RENAME_EXCHANGE,
+ * updating our caches, see globalState::pathUpdatesInPreHooks and
+ * globalState::missing.
+ * @return whether to call the post-hook.
+ */
+static bool preRename(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> from,
+    int fromDir,
+    traceePtr<char> to,
+    int toDir,
+    bool exchange);
+
+/**
+ * Make path, a host path, the one a tracee chrooted to rootPath sees.
+ * @return false if path is outside of rootPath.
+ */
+static bool belowRoot(const string& rootPath, string& path);
+
+/**
+ * Answer a readlink of path into buf from what we know, see
+ * readlinkSystemCall.
+ * @return whether it was answered, otherwise the kernel answers.
+ */
+static bool answerReadlink(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    uint64_t buf,
+    uint64_t bufsiz);
 
 // =======================================================================================
 bool accessSystemCall::handleDetPre(
@@ -64,8 +186,8 @@ void accessSystemCall::handleDetPost(
 // =======================================================================================
 bool arch_prctlSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "pre-hook for arch_prctl(%d, 0) == ARCH_SET_CPUID? %d\n", t.arg1(),
       t.arg1() == ARCH_SET_CPUID);
 
@@ -84,8 +206,8 @@ void arch_prctlSystemCall::handleDetPost(
     runtimeError("Got to arch_prctl post-hook without it being injected.");
   }
 
-  gs.log.writeToLog(
-      Importance::info, "post-hook for arch_prctl, returning %d\n",
+  DETTRACE_LOG(
+      gs.log, Importance::info, "post-hook for arch_prctl, returning %d\n",
       t.getReturnValue());
 
   if (s.CPUIDTrapSet) {
@@ -100,7 +222,7 @@ void arch_prctlSystemCall::handleDetPost(
     string errmsg("cpuid interception (cpuid_fault) via arch_prctl failed: ");
     errmsg += strerror(-t.getReturnValue());
     errmsg += "\nPlease check `cpuid_fault` flag from `cat /proc/cpuinfo`";
-    gs.log.writeToLog(Importance::inter, errmsg);
+    DETTRACE_LOG(gs.log, Importance::inter, errmsg);
     gs.allow_trapCPUID = false;
   } else {
     s.CPUIDTrapSet = true;
@@ -110,18 +232,24 @@ void arch_prctlSystemCall::handleDetPost(
   // I don't believe arch_prctl(ARCH_SET_CPUID) writes to tracee memory at all.
   t.setRegs(s.regSaver.popRegisterState());
 
-  gs.log.writeToLog(
-      Importance::info, "restored register state from arch_prctl post-hook\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "restored register state from arch_prctl post-hook\n");
   replaySystemCall(gs, t, t.getSystemCallNumber());
 }
 // =======================================================================================
 bool alarmSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info, "alarm pre-hook, requesting alarm in %u second(s)\n",
-      t.arg1());
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "alarm pre-hook, requesting alarm in %u second(s)\n", t.arg1());
+  timerSetting setting, old;
+  setting.value = chrono::seconds((unsigned int)t.arg1());
+  // A one-shot alarm has always gone off by the time the next one is set, the
+  // 0 seconds left it returns is right.
   // run post-hook if necessary
-  return sendTraceeSignalNow(SIGALRM, gs, s, t, sched);
+  return setSignalTimer(
+      gs, s, t, sched, {timerKind::real, 0}, SIGALRM, setting, &old);
 }
 
 void alarmSystemCall::handleDetPost(
@@ -129,35 +257,85 @@ void alarmSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+bool bindSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (!gs.missing.empty() && t.arg2() != 0 && t.arg3() > sizeof(sa_family_t)) {
+    // A named unix socket, its path relative to our cwd.
+    struct sockaddr_un addr = {};
+    size_t length = min<size_t>(t.arg3(), sizeof(addr) - 1);
+    t.readTraceeBatch(
+        {traceeIo(
+            traceePtr<struct sockaddr_un>((struct sockaddr_un*)t.arg2()), &addr,
+            length)},
+        s.traceePid);
+    if (addr.sun_family == AF_UNIX && addr.sun_path[0] != '\0') {
+      string path = addr.sun_path;
+      forgetMissing(gs, resolve_tracee_path(gs, s, path, AT_FDCWD));
+    }
+  }
+  return false;
+}
+
+void bindSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  runtimeError("bind post-hook should never be called.");
+}
+// =======================================================================================
 bool chdirSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  if (gs.pathUpdatesInPreHooks) {
+    // Failed or not, the next resolved path reads the cwd again.
+    s.paths.write().forgetCwd();
+    return gs.log.isEnabled(Importance::info);
+  }
 
-  return false;
+  return true;
+}
+
+void chdirSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[0], gs.log, s.traceePid, t);
 }
 
 void chdirSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  if (t.getReturnValue() == 0) {
+    s.paths.write().forgetCwd();
+  }
 }
 // =======================================================================================
 bool chmodSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  if (gs.fakeroot != nullptr) {
+    fakeChmod(
+        gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, t.arg2(), 2);
+  }
   return false;
 }
 
+void chmodSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[0], gs.log, s.traceePid, t);
+}
+
 void chmodSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return;
 }
 // =======================================================================================
-bool clock_gettimeSystemCall::handleDetPre(
-    globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+/**
+ * Clocks the kernel knows: others, like the clocks of other processes' CPU
+ * time, run for real so they fail as they would.
+ */
+static bool logicalClock(clockid_t clock) {
+  // 10, CLOCK_SGI_CYCLE, is gone.
+  return clock >= CLOCK_REALTIME && clock <= CLOCK_TAI && clock != 10;
 }
 
-void clock_gettimeSystemCall::handleDetPost(
+/** Writes tp from our logical clock, ticking it. */
+static void answerClockGettime(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   gs.timeCalls++;
   struct timespec* tp = (struct timespec*)t.arg2();
@@ -171,7 +349,25 @@ void clock_gettimeSystemCall::handleDetPost(
     // breaking any assumptions..
     sched.preemptAndScheduleNext();
   }
+}
+
+bool clock_gettimeSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // Answered from our logical clock alone, so skipped where we can skip system
+  // calls. Elsewhere time() would run in its place, no stop saved, so it runs
+  // and the post-hook overwrites what it wrote. A null tp is left to fail.
+  if (!gs.skipSystemCalls || !logicalClock((clockid_t)t.arg1()) ||
+      t.arg2() == 0) {
+    return true;
+  }
+  replaceSystemCallWithNoop(gs, s, t);
+  answerClockGettime(gs, s, t, sched);
+  return false;
+}
 
+void clock_gettimeSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  answerClockGettime(gs, s, t, sched);
   return;
 }
 // =======================================================================================
@@ -183,31 +379,60 @@ bool closeSystemCall::handleDetPre(
 void closeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int fd = (int)t.arg1();
-  gs.log.writeToLog(Importance::info, "close(%d)\n", fd);
-  // Remove entry from our dirEntries.
-  auto result = s.dirEntries.find(fd);
-  // Exists.
-  if (result != s.dirEntries.end()) {
-    gs.log.writeToLog(
-        Importance::info, "Removing directory entries for fd: %d!\n", fd);
-    s.dirEntries.erase(result);
-  }
+  DETTRACE_LOG(gs.log, Importance::info, "close(%d)\n", fd);
+  forgetFd(gs, s, fd);
+  // Closing the last end of a pipe unblocks the other end (EOF or EPIPE), we
+  // don't know which pipe this was anymore so wake them all.
+  wakePipeWaiters(sched);
+}
+// =======================================================================================
+bool close_rangeSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // Only marks them close on exec, execve forgets everything anyway.
+  return (t.arg3() & CLOSE_RANGE_CLOEXEC) == 0;
+}
 
-  // Remove entry from our fd set for pipes.
-  if (s.countFdStatus(fd) != 0) {
-    gs.log.writeToLog(Importance::info, "Removing pipe fd: %d!\n", fd);
-    s.fdStatus.get()->erase(fd);
+void close_rangeSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (t.getReturnValue() != 0) {
+    return;
   }
-
-  if (s.fd_is_remote(fd)) {
-    s.remote_sockfds->erase(fd);
+  // Usually 3 to ~0U, so go by the fds we know rather than the range.
+  const uint64_t maxFd = numeric_limits<int>::max();
+  int first = min<uint64_t>(t.arg1(), maxFd);
+  int last = min<uint64_t>(t.arg2(), maxFd);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "close_range(%d, %d)\n", first, last);
+
+  set<int> closed;
+  auto inRange = [&](int fd) {
+    if (first <= fd && fd <= last) {
+      closed.insert(fd);
+    }
+  };
+  for (int fd = first; fd <= last && fd < s.fds->size(); fd++) {
+    if (s.fdInfoOf(fd).known()) {
+      closed.insert(fd);
+    }
   }
-  if (s.fd_is_timerfd(fd)) {
-    s.timerfds->erase(fd);
+  for (auto& fd : *s.dirEntries) {
+    inRange(fd.first);
+  }
+  for (auto& fd : *s.dirStamps) {
+    inRange(fd.first);
+  }
+  for (auto& fd : *s.epollInterests) {
+    inRange(fd.first);
   }
-  if (s.fd_is_signalfd(fd)) {
-    s.signalfds->erase(fd);
+  for (int fd : closed) {
+    forgetFd(gs, s, fd);
   }
+  // Caches of fds we have no other record of.
+  s.readProbe->forget(first, last);
+  if (s.paths->cachesFds(first, last)) {
+    s.paths.write().forgetFds(first, last);
+  }
+  wakePipeWaiters(sched);
 }
 // =======================================================================================
 // TODO
@@ -237,7 +462,7 @@ bool connectSystemCall::handleDetPre(
         inet_ntop(AF_INET, &sockaddr.sin_addr, dst, 128),
         ntohs(sockaddr.sin_port));
   }
-  gs.log.writeToLog(Importance::info, buff);
+  DETTRACE_LOG(gs.log, Importance::info, buff);
   free(buff);
 
   return true;
@@ -251,6 +476,7 @@ void connectSystemCall::handleDetPost(
 bool creatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD);
   return true;
 }
 
@@ -267,8 +493,9 @@ void creatSystemCall::handleDetPost(
   // do not thin the POSIX semantics say this must happen, so we read the inode
   // here to be safe. (Not sure how we could use this information to optimze
   // anyways.)
-  auto inode = readInodeFor(gs.log, s.traceePid, t.getReturnValue());
-  gs.mtimeMap[inode] = s.getLogicalTime();
+  s.setFdType(t.getReturnValue(), fdType::regular);
+  auto inode = readInodeFor(gs.log, s, t.getReturnValue());
+  gs.setMtime(inode, s.getLogicalTime());
   gs.inodeMap.addRealValue(inode);
   s.incrementTime();
 
@@ -287,15 +514,9 @@ void dupSystemCall::handleDetPost(
   if (newfd < 0) {
     return;
   }
-
-  // dup succeeded.
-  if (s.countFdStatus(fd) != 0) { // Only for pipes
-    s.setFdStatus(newfd, s.getFdStatus(fd)); // copy over status.
-    if (s.fd_is_remote(fd)) {
-      s.remote_sockfds->insert(newfd);
-    }
-    gs.log.writeToLog(Importance::info, "%d = dup(%d)\n", newfd, fd);
-  }
+  // dup succeeded, same status as what it was duped from.
+  s.dupFd(fd, newfd);
+  DETTRACE_LOG(gs.log, Importance::info, "%d = dup(%d)\n", newfd, fd);
 }
 // =======================================================================================
 bool dup2SystemCall::handleDetPre(
@@ -307,29 +528,22 @@ void dup2SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int newfd = t.getReturnValue();
   int fd = t.arg1();
-  gs.log.writeToLog(Importance::info, "dup2(%d) returned %d\n", fd, newfd);
+  DETTRACE_LOG(gs.log, Importance::info, "dup2(%d) returned %d\n", fd, newfd);
   if (newfd < 0) {
     return;
   }
-
-  // dup2 succeeded.
-  if (s.countFdStatus(fd) != 0) { // Only for pipes
-
-    // Semantics of dup2 say old fd could be closed and overwritten, we do that
-    // implicitly here!
-    s.setFdStatus(newfd, s.getFdStatus(fd));
-    if (s.fd_is_remote(fd)) {
-      s.remote_sockfds->insert(newfd);
-    }
-    if (s.fd_is_timerfd(fd)) {
-      auto it = (*s.timerfds)[fd];
-      s.timerfds->insert({newfd, it});
-    }
-    if (s.fd_is_signalfd(fd)) {
-      s.signalfds->insert(newfd);
-    }
-    gs.log.writeToLog(Importance::info, "%d = dup2(%d)\n", newfd, fd);
+  // May have closed the old newfd, same as close.
+  s.readProbe->forget(newfd);
+  s.epollInterests.erase(newfd);
+  wakePipeWaiters(sched);
+  if (s.paths->cachesFd(newfd)) {
+    s.paths.write().forgetFd(newfd);
   }
+
+  // dup2 succeeded. Semantics of dup2 say old fd could be closed and
+  // overwritten, we do that implicitly here!
+  s.dupFd(fd, newfd);
+  DETTRACE_LOG(gs.log, Importance::info, "%d = dup2(%d)\n", newfd, fd);
 }
 
 static const char* epoll_op(int op) {
@@ -346,17 +560,19 @@ static const char* epoll_op(int op) {
 }
 
 // =======================================================================================
-bool epoll_ctlSystemCall::handleDetPre(
-    globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  struct epoll_event* traceeEvent = (struct epoll_event*)t.arg4();
+// Shared by the ptrace and seccomp notify paths, only inspects the event.
+// @return the events epoll_ctl asks for.
+static uint32_t checkEpollCtl(
+    globalState& gs, state& s, int epfd, int opNum, uint64_t eventAddr) {
+  struct epoll_event* traceeEvent = (struct epoll_event*)eventAddr;
   struct epoll_event epev = {
       0,
   };
 
-  string op = epoll_op((int)t.arg2());
+  string op = epoll_op(opNum);
 
-  gs.log.writeToLog(
-      Importance::info, "epoll_ctl(" + to_string(t.arg1()) + "..)\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "epoll_ctl(" + to_string(epfd) + "..)\n");
 
   readVmTraceeRaw(
       traceePtr<struct epoll_event>(traceeEvent), &epev, sizeof(epev),
@@ -365,28 +581,82 @@ bool epoll_ctlSystemCall::handleDetPre(
     runtimeError("epoll_ctl call used EPOLLONESHOT flag!");
   }
   if ((epev.events & EPOLLIN) == EPOLLIN) {
-    gs.log.writeToLog(
-        Importance::info, op + " EPOLLIN " + to_string(epev.data.u64) + "\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        op + " EPOLLIN " + to_string(epev.data.u64) + "\n");
   }
   if ((epev.events & EPOLLOUT) == EPOLLOUT) {
-    gs.log.writeToLog(
-        Importance::info, op + " EPOLLOUT " + to_string(epev.data.u64) + "\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        op + " EPOLLOUT " + to_string(epev.data.u64) + "\n");
   }
   if ((epev.events & EPOLLPRI) == EPOLLERR) {
-    gs.log.writeToLog(
-        Importance::info, op + " EPOLLERR " + to_string(epev.data.u64) + "\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        op + " EPOLLERR " + to_string(epev.data.u64) + "\n");
   }
   if ((epev.events & EPOLLPRI) == EPOLLPRI) {
-    gs.log.writeToLog(
-        Importance::info, op + " EPOLLPRI " + to_string(epev.data.u64) + "\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        op + " EPOLLPRI " + to_string(epev.data.u64) + "\n");
   }
+  return epev.events;
+}
 
-  return false;
+bool epoll_ctlSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  s.originalArg4 =
+      checkEpollCtl(gs, s, (int)t.arg1(), (int)t.arg2(), t.arg4());
+  return true;
+}
+
+void epoll_ctlSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  checkEpollCtl(gs, s, (int)n.args[0], (int)n.args[1], n.args[3]);
 }
 
 void epoll_ctlSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  if (t.getReturnValue() != 0) {
+    return;
+  }
+  int epfd = (int)t.arg1();
+  int fd = (int)t.arg3();
+  switch ((int)t.arg2()) {
+  case EPOLL_CTL_ADD:
+  case EPOLL_CTL_MOD:
+    s.epollInterests.write()[epfd][fd] = (uint32_t)s.originalArg4;
+    break;
+  case EPOLL_CTL_DEL:
+    s.epollInterests.write()[epfd].erase(fd);
+    break;
+  }
+}
+
+/**
+ * Events on the pipes in the interest set of epfd that could make it ready.
+ * allPipes is set if they are the only fds in there, so nothing we don't see
+ * could make an epoll_wait on it ready.
+ */
+static vector<waitReason> epollReadyReasons(
+    state& s, int epfd, bool& allPipes) {
+  vector<waitReason> reasons;
+  auto interests = s.epollInterests->find(epfd);
+  // Created before we traced it, or in a way we don't follow, like dup.
+  if (interests == s.epollInterests->end()) {
+    allPipes = false;
+    return reasons;
+  }
+
+  allPipes = !interests->second.empty();
+  for (auto& interest : interests->second) {
+    uint32_t events = interest.second;
+    if (!addPipeReadyReasons(
+            s, interest.first, events & EPOLLIN, events & EPOLLOUT, reasons)) {
+      allPipes = false;
+    }
+  }
+  return reasons;
 }
 
 static void epoll_log_event(globalState& gs, ptracer& t) {
@@ -406,20 +676,42 @@ static void epoll_log_event(globalState& gs, ptracer& t) {
         p + n, size - n, " (%s, %lu)", epoll_op(ev.events), ev.data.u64);
   }
   snprintf(p + n, size - n, "]\n");
-  gs.log.writeToLogNoFormat(Importance::extra, buffer);
+  DETTRACE_LOG_NO_FORMAT(gs.log, Importance::extra, buffer);
+}
+
+/**
+ * A poll with a zero timeout, e.g. Go's netpoller checking in between
+ * goroutines: let others run first rather than after it, so it gets no
+ * post-hook. The kernel runs it once we get back to the tracee. Only where
+ * system calls can go without a post-hook, see globalState::skipSystemCalls.
+ * @return whether the tracee was preempted.
+ */
+static bool preemptBeforeNonBlockingPoll(
+    globalState& gs, state& s, scheduler& sched, int timeout) {
+  if (timeout != 0 || !gs.skipSystemCalls) {
+    return false;
+  }
+  s.pollBackoff = 1;
+  sched.cancelTimer(s.traceePid);
+  sched.preemptAndScheduleNext();
+  return true;
 }
 
 // =======================================================================================
 bool epoll_waitSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (preemptBeforeNonBlockingPoll(gs, s, sched, (int)t.arg4())) {
+    return false;
+  }
   // Set the timeout to zero.
   s.originalArg4 = t.arg4();
   if ((int)s.originalArg4 != 0) {
     t.writeArg4(0);
   }
 
-  gs.log.writeToLog(
-      Importance::info, "epoll_wait on fd: " + to_string(t.arg1()) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "epoll_wait on fd: " + to_string(t.arg1()) + "\n");
   return true;
 }
 
@@ -429,14 +721,25 @@ void epoll_waitSystemCall::handleDetPost(
     epoll_log_event(gs, t);
   }
 
-  if ((int)s.originalArg4 < 0) {
-    gs.log.writeToLog(Importance::info, "Blocking epoll_wait found\n");
-    bool replay = replaySyscallIfBlocked(gs, s, t, sched, 0);
-    if (replay) {
+  if ((int)s.originalArg4 > 0 && t.getReturnValue() == 0) {
+    DETTRACE_LOG(gs.log, Importance::info, "Timed epoll_wait found\n");
+    bool allPipes;
+    auto reasons = epollReadyReasons(s, (int)t.arg1(), allPipes);
+    auto timeout = chrono::milliseconds((int)s.originalArg4);
+    if (replayUntilTimeout(gs, s, t, sched, timeout, reasons, !allPipes)) {
+      t.writeArg4(s.originalArg4);
+    }
+  } else if ((int)s.originalArg4 < 0) {
+    DETTRACE_LOG(gs.log, Importance::info, "Blocking epoll_wait found\n");
+    bool allPipes;
+    auto reasons = epollReadyReasons(s, (int)t.arg1(), allPipes);
+    if (replayPollWhenReady(gs, s, t, sched, reasons, !allPipes)) {
       t.writeArg4(s.originalArg4);
     }
   } else {
-    gs.log.writeToLog(Importance::info, "Non-blocking epoll found\n");
+    DETTRACE_LOG(gs.log, Importance::info, "Non-blocking epoll found\n");
+    s.pollBackoff = 1;
+    sched.cancelTimer(s.traceePid);
     sched.preemptAndScheduleNext();
   }
   return;
@@ -444,6 +747,9 @@ void epoll_waitSystemCall::handleDetPost(
 // =======================================================================================
 bool epoll_pwaitSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (preemptBeforeNonBlockingPoll(gs, s, sched, (int)t.arg4())) {
+    return false;
+  }
   // Set the timeout to zero.
   s.originalArg4 = t.arg4();
   if ((int)s.originalArg4 != 0) {
@@ -454,25 +760,74 @@ bool epoll_pwaitSystemCall::handleDetPre(
 
 void epoll_pwaitSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  if ((int)s.originalArg4 < 0) {
-    gs.log.writeToLog(Importance::info, "Blocking epoll_wait found\n");
-    bool replay = replaySyscallIfBlocked(gs, s, t, sched, 0);
-    if (replay) {
+  if ((int)s.originalArg4 > 0 && t.getReturnValue() == 0) {
+    DETTRACE_LOG(gs.log, Importance::info, "Timed epoll_wait found\n");
+    bool allPipes;
+    auto reasons = epollReadyReasons(s, (int)t.arg1(), allPipes);
+    auto timeout = chrono::milliseconds((int)s.originalArg4);
+    if (replayUntilTimeout(gs, s, t, sched, timeout, reasons, !allPipes)) {
+      t.writeArg4(s.originalArg4);
+    }
+  } else if ((int)s.originalArg4 < 0) {
+    DETTRACE_LOG(gs.log, Importance::info, "Blocking epoll_wait found\n");
+    bool allPipes;
+    auto reasons = epollReadyReasons(s, (int)t.arg1(), allPipes);
+    if (replayPollWhenReady(gs, s, t, sched, reasons, !allPipes)) {
       t.writeArg4(s.originalArg4);
     }
   } else {
-    gs.log.writeToLog(Importance::info, "Non-blocking epoll found\n");
+    DETTRACE_LOG(gs.log, Importance::info, "Non-blocking epoll found\n");
+    s.pollBackoff = 1;
+    sched.cancelTimer(s.traceePid);
     sched.preemptAndScheduleNext();
   }
   return;
 }
 // =======================================================================================
+/**
+ * An eventfd was created, take a duplicate of it for serveEventfdRead. The
+ * kernel still keeps the counter, the tracer reads it.
+ */
+static void eventfdCreated(globalState& gs, state& s, ptracer& t) {
+  int fd = t.getReturnValue();
+  if (fd < 0) {
+    return;
+  }
+  int ourFd = duplicateTraceeFd(s.traceePid, fd);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "eventfd(%u) = %d%s\n", (unsigned)t.arg1(), fd,
+      ourFd == -1 ? ", left to the kernel" : "");
+  if (ourFd != -1) {
+    s.fds.write().setEventfd(
+        fd, make_shared<eventfdInfo>(ourFd, ++gs.lastEventfd));
+  }
+}
+
+bool eventfdSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return gs.tracerEventfds;
+}
+
+void eventfdSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  eventfdCreated(gs, s, t);
+}
+// =======================================================================================
+bool eventfd2SystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return gs.tracerEventfds;
+}
+
+void eventfd2SystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  eventfdCreated(gs, s, t);
+}
+// =======================================================================================
 bool execveSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
 
-  auto tgNumber = gs.threadGroupNumber.at(s.traceePid);
-  if (gs.threadGroups.count(tgNumber) != 1) {
+  if (gs.processes.threadGroupSize(s.traceePid) != 1) {
     runtimeError("We do not support exec from threaded process groups!");
   }
 
@@ -482,7 +837,7 @@ bool execveSystemCall::handleDetPre(
   string execveEnvp{};
 
   // Print all arguments to execve!
-  if (gs.log.getDebugLevel() > 0) {
+  if (gs.log.isEnabled(Importance::info)) {
     // Remeber these are addresses in the tracee. We must explicitly read them
     // ourselves!
     if (argv != nullptr) {
@@ -515,10 +870,10 @@ bool execveSystemCall::handleDetPre(
 
     auto msg =
         "Args: " + gs.log.makeTextColored(Color::green, execveArgs) + "\n";
-    gs.log.writeToLogNoFormat(Importance::info, msg);
+    DETTRACE_LOG_NO_FORMAT(gs.log, Importance::info, msg);
     auto msg2 =
         "Envp: " + gs.log.makeTextColored(Color::green, execveEnvp) + "\n";
-    gs.log.writeToLogNoFormat(Importance::info, msg2);
+    DETTRACE_LOG_NO_FORMAT(gs.log, Importance::info, msg2);
   }
 
   // WARNING: Never change this, there is no execve post-hook event. You will
@@ -529,19 +884,31 @@ bool execveSystemCall::handleDetPre(
 // =======================================================================================
 bool exit_groupSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "Saw exit group!!\n");
+  DETTRACE_LOG(gs.log, Importance::info, "Saw exit group!!\n");
   s.isExitGroup = true;
   return false;
 }
 
 void exit_groupSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "Saw exit group post hook!!\n");
+  DETTRACE_LOG(gs.log, Importance::info, "Saw exit group post hook!!\n");
 }
 // =======================================================================================
 bool fchownatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t);
+  if (gs.fakeroot != nullptr) {
+    int flags = t.arg5();
+    traceePtr<char> path((char*)t.arg2());
+    // fchownat(fd, "", ..., AT_EMPTY_PATH) is fchown(fd, ...).
+    if ((flags & AT_EMPTY_PATH) && path.ptr != nullptr &&
+        t.readTraceeCString(path, s.traceePid).empty()) {
+      path.ptr = nullptr;
+    }
+    return fakeChown(
+        gs, s, t, path, t.arg1(), (flags & AT_SYMLINK_NOFOLLOW) == 0, t.arg3(),
+        t.arg4());
+  }
   if (t.arg3() != 0) {
     t.writeArg3(0);
   }
@@ -554,12 +921,16 @@ bool fchownatSystemCall::handleDetPre(
 
 void fchownatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  runtimeError("fchownat post hook shold never be called.");
+  // Only a --fakeroot answer still to set.
   return;
 }
 // =======================================================================================
 bool fchownSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (gs.fakeroot != nullptr) {
+    return fakeChown(
+        gs, s, t, traceePtr<char>(nullptr), t.arg1(), true, t.arg2(), t.arg3());
+  }
   if (t.arg2() != 0) {
     t.writeArg2(0);
   }
@@ -571,12 +942,16 @@ bool fchownSystemCall::handleDetPre(
 
 void fchownSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  runtimeError("fchownat post hook shold never be called.");
   return;
 }
 // =======================================================================================
 bool chownSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (gs.fakeroot != nullptr) {
+    return fakeChown(
+        gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, true, t.arg2(),
+        t.arg3());
+  }
   if (t.arg2() != 0) {
     t.writeArg2(0);
   }
@@ -588,12 +963,16 @@ bool chownSystemCall::handleDetPre(
 
 void chownSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  runtimeError("fchownat post hook shold never be called.");
   return;
 }
 // =======================================================================================
 bool lchownSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (gs.fakeroot != nullptr) {
+    return fakeChown(
+        gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, false, t.arg2(),
+        t.arg3());
+  }
   if (t.arg2() != 0) {
     t.writeArg2(0);
   }
@@ -605,7 +984,6 @@ bool lchownSystemCall::handleDetPre(
 
 void lchownSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  runtimeError("fchownat post hook shold never be called.");
   return;
 }
 // =======================================================================================
@@ -626,37 +1004,27 @@ void fcntlSystemCall::handleDetPost(
   int cmd = t.arg2();
   int arg = t.arg3();
 
-  gs.log.writeToLog(
-      Importance::extra, "fcntl(" + to_string(fd) + ", " + to_string(cmd) +
-                             "..) = " + to_string(retval) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::extra,
+      "fcntl(" + to_string(fd) + ", " + to_string(cmd) + "..) = " +
+          to_string(retval) + "\n");
 
   if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) {
     auto str = "found fcntl(%d, FDUPFD || F_DUPFD_CLOCEXEC) = %d\n";
     int newfd = retval;
-    gs.log.writeToLog(Importance::info, str, fd, newfd);
-    auto it = s.fdStatus.get()->find(fd);
-    auto end = s.fdStatus.get()->end();
-    if (it != end) {
+    DETTRACE_LOG(gs.log, Importance::info, str, fd, newfd);
+    if (newfd >= 0) {
       // Same status as what it was duped from.
-      (*s.fdStatus.get())[newfd] = s.getFdStatus(fd);
-      if (s.fd_is_remote(fd)) {
-        s.remote_sockfds->insert(newfd);
-      }
-      if (s.fd_is_timerfd(fd)) {
-        auto it = (*s.timerfds)[fd];
-        s.timerfds->insert({newfd, it});
-      }
-      if (s.fd_is_signalfd(fd)) {
-        s.signalfds->insert(newfd);
-      }
+      s.dupFd(fd, newfd);
     }
   }
 
   // User attempting to change blocked status.
   if (cmd == F_SETFL && ((arg & O_NONBLOCK) != 0)) {
-    gs.log.writeToLog(
-        Importance::info, "found fcntl setting %d to non blocking!\n", fd);
-    (*s.fdStatus.get())[fd] = descriptorType::nonBlocking;
+    DETTRACE_LOG(
+        gs.log, Importance::info, "found fcntl setting %d to non blocking!\n",
+        fd);
+    s.setFdStatus(fd, descriptorType::nonBlocking);
   }
 }
 // =======================================================================================
@@ -667,12 +1035,53 @@ bool faccessatSystemCall::handleDetPre(
   return false;
 }
 
+void faccessatSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[1], gs.log, s.traceePid, t);
+}
+
 void faccessatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   runtimeError("faccessat post hook shold never be called.");
   return;
 }
 // =======================================================================================
+bool fchdirSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return true;
+}
+
+void fchdirSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (t.getReturnValue() == 0) {
+    s.paths.write().forgetCwd();
+  }
+}
+// =======================================================================================
+bool fchmodSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  fakeChmod(gs, s, t, traceePtr<char>(nullptr), t.arg1(), t.arg2(), 2);
+  return false;
+}
+
+void fchmodSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return;
+}
+// =======================================================================================
+bool fchmodatSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  printInfoString(t.arg2(), gs.log, s.traceePid, t);
+  fakeChmod(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1(), t.arg3(), 3);
+  return false;
+}
+
+void fchmodatSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return;
+}
+// =======================================================================================
 bool fgetxattrSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return true;
@@ -699,7 +1108,7 @@ void flistxattrSystemCall::handleDetPost(
 // =======================================================================================
 bool fstatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "fstat(fd=%d)\n", t.arg1());
+  DETTRACE_LOG(gs.log, Importance::info, "fstat(fd=%d)\n", t.arg1());
   return true;
 }
 
@@ -734,7 +1143,7 @@ void fstatfsSystemCall::handleDetPost(
   struct statfs* statfsPtr = (struct statfs*)t.arg2();
 
   if (statfsPtr == nullptr) {
-    gs.log.writeToLog(Importance::info, "fstatfs: statfsbuf null.\n");
+    DETTRACE_LOG(gs.log, Importance::info, "fstatfs: statfsbuf null.\n");
     return;
   }
 
@@ -748,6 +1157,96 @@ void fstatfsSystemCall::handleDetPost(
 }
 
 // =======================================================================================
+/**
+ * The comparison half of a FUTEX_WAKE_OP, on the second word's old value.
+ * Same decoding as the kernel's futex_atomic_op_inuser.
+ */
+static bool futexWakeOpCompare(int oldValue, uint32_t encodedOp) {
+  int cmp = (encodedOp >> 24) & 0xf;
+  // Sign extended 12 bit argument.
+  int cmpArg = (int)(encodedOp << 20) >> 20;
+
+  switch (cmp) {
+  case FUTEX_OP_CMP_EQ:
+    return oldValue == cmpArg;
+  case FUTEX_OP_CMP_NE:
+    return oldValue != cmpArg;
+  case FUTEX_OP_CMP_LT:
+    return oldValue < cmpArg;
+  case FUTEX_OP_CMP_LE:
+    return oldValue <= cmpArg;
+  case FUTEX_OP_CMP_GT:
+    return oldValue > cmpArg;
+  case FUTEX_OP_CMP_GE:
+    return oldValue >= cmpArg;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Do what a successful private wake operation does to our futexQueues, after
+ * the kernel ran it.
+ * @return number of waiters woken (plus requeued, for FUTEX_CMP_REQUEUE),
+ * which the kernel adds to its own count.
+ */
+static int wakePrivateFutex(
+    globalState& gs, state& s, ptracer& t, scheduler& sched, int futexCmd) {
+  pid_t addressSpace = gs.processes.threadGroupOf(s.traceePid);
+  uint64_t uaddr = t.arg1();
+  int count = (int)t.arg3();
+  // The timeout argument is a count for these.
+  int count2 = (int)t.arg4();
+  uint64_t uaddr2 = t.arg5();
+  uint32_t val3 = (uint32_t)t.arg6();
+
+  vector<pid_t> woken;
+  int requeued = 0;
+  switch (futexCmd) {
+  case FUTEX_WAKE:
+    woken = gs.futexes.wake(addressSpace, uaddr, count);
+    break;
+  case FUTEX_WAKE_BITSET:
+    woken = gs.futexes.wake(addressSpace, uaddr, count, val3);
+    break;
+  case FUTEX_REQUEUE:
+  case FUTEX_CMP_REQUEUE:
+    woken = gs.futexes.wake(addressSpace, uaddr, count);
+    requeued = gs.futexes.requeue(addressSpace, uaddr, uaddr2, count2);
+    break;
+  case FUTEX_WAKE_OP: {
+    woken = gs.futexes.wake(addressSpace, uaddr, count);
+    if (futexWakeOpCompare((int)s.futexOldValue, val3)) {
+      auto woken2 = gs.futexes.wake(addressSpace, uaddr2, count2);
+      woken.insert(woken.end(), woken2.begin(), woken2.end());
+    }
+    break;
+  }
+  }
+
+  wakeFutexWaiters(gs, sched, woken);
+  // FUTEX_REQUEUE only counts the waiters it woke.
+  return woken.size() + (futexCmd == FUTEX_CMP_REQUEUE ? requeued : 0);
+}
+// =======================================================================================
+/**
+ * The relative timeout at timeoutPtr in pid as a logical duration.
+ * @return false if the kernel would reject it with EINVAL.
+ */
+static bool readRelativeTimeout(
+    ptracer& t,
+    pid_t pid,
+    timespec* timeoutPtr,
+    logical_clock::duration& timeout) {
+  timespec ts = t.readFromTracee(traceePtr<timespec>(timeoutPtr), pid);
+  if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000 * 1000 * 1000) {
+    return false;
+  }
+  timeout = chrono::duration_cast<logical_clock::duration>(
+      chrono::seconds(ts.tv_sec) + chrono::nanoseconds(ts.tv_nsec));
+  return true;
+}
+
 bool futexSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   // If operation is a FUTEX_WAIT, set timeout to zero for polling instead of
@@ -759,44 +1258,133 @@ bool futexSystemCall::handleDetPre(
   // See definitions of variables here.
   // https://github.com/spotify/linux/blob/master/include/linux/futex.h
   int futexCmd = futexOp & FUTEX_CMD_MASK;
-  gs.log.writeToLog(
-      Importance::info, "Operation: " + futexCommands.at(futexCmd) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "Operation: " + futexCommands.at(futexCmd) + "\n");
 
   if ((futexOp & FUTEX_PRIVATE_FLAG) != 0) {
-    gs.log.writeToLog(Importance::info, "with: FUTEX_PRIVATE_FLAG\n");
+    DETTRACE_LOG(gs.log, Importance::info, "with: FUTEX_PRIVATE_FLAG\n");
   }
   if ((futexOp & FUTEX_CLOCK_REALTIME) != 0) {
-    gs.log.writeToLog(Importance::info, "with: FUTEX_CLOCK_REALTIME\n");
+    DETTRACE_LOG(gs.log, Importance::info, "with: FUTEX_CLOCK_REALTIME\n");
   }
   if (timeoutPtr != NULL) {
-    gs.log.writeToLog(Importance::info, "with: user defined timeout.\n");
+    DETTRACE_LOG(gs.log, Importance::info, "with: user defined timeout.\n");
   }
 
+  bool isPrivate = (futexOp & FUTEX_PRIVATE_FLAG) != 0;
+
   // Handle wake operations by notifying scheduler of progress.
   if (futexCmd == FUTEX_WAKE || futexCmd == FUTEX_REQUEUE ||
       futexCmd == FUTEX_CMP_REQUEUE || futexCmd == FUTEX_WAKE_BITSET ||
       futexCmd == FUTEX_WAKE_OP) {
     traceePtr<int> rptr((int*)t.arg1());
     int val = t.readFromTracee(rptr, t.getPid());
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "Waking on address: %p = %x, my pid: %u, traceesPid: %u\n", t.arg1(),
         val, t.getPid(), s.traceePid);
-    gs.log.writeToLog(
-        Importance::info, "Trying to wake up to %d threads.\n", futexValue);
-
-    /*
-    auto waiters = futex_remove_waiters(s, t.arg1(), futexValue);
-    for (auto pidToWakeup: waiters) {
-      if (pidToWakeup != t.getPid()) {
-        gs.log.writeToLog(Importance::info, "Scheduling task %d.\n",
-    pidToWakeup); sched.addAndScheduleNext(pidToWakeup); } else {
-        gs.log.writeToLog(Importance::info, "Scheduling task %d ignored (already
-    running)\n", pidToWakeup);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Trying to wake up to %d threads.\n",
+        futexValue);
+
+    if (!isPrivate) {
+      // No need to go into the post hook.
+      return false;
+    }
+    // Our waiters never sleep in the kernel, so this wakes nobody there. Run
+    // it anyway: the kernel checks the arguments (and the value for
+    // FUTEX_CMP_REQUEUE), and does the atomic operation of FUTEX_WAKE_OP. Our
+    // queues are updated in the post-hook if it succeeds.
+    if (futexCmd == FUTEX_WAKE_OP) {
+      s.futexOldValue = t.readFromTracee(
+          traceePtr<uint32_t>((uint32_t*)t.arg5()), s.traceePid);
+    }
+    return true;
+  }
+
+  // Private FUTEX_WAIT without a timeout: wait in futexes instead of the
+  // kernel, see futexQueues.
+  if (isPrivate && timeoutPtr == nullptr &&
+      (futexCmd == FUTEX_WAIT || futexCmd == FUTEX_WAIT_BITSET)) {
+    if (s.futexWoken) {
+      DETTRACE_LOG(gs.log, Importance::info, "Woken up, returning 0.\n");
+      s.futexWoken = false;
+      if (!replaceSystemCallWithNoop(gs, s, t)) {
+        // time() would write to it otherwise.
+        t.writeArg1(0);
       }
+      return true;
+    }
+
+    uint32_t bitset = futexCmd == FUTEX_WAIT_BITSET ? (uint32_t)t.arg6()
+                                                    : futexQueues::matchAny;
+    int actualValue =
+        (int)t.readFromTracee(traceePtr<int>((int*)t.arg1()), s.traceePid);
+    if (actualValue != futexValue || bitset == 0) {
+      // The kernel fails it right away (EAGAIN, EINVAL).
+      gs.futexes.remove(s.traceePid);
+      return false;
+    }
+
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Parking until a wake on address: %p.\n",
+        t.arg1());
+    if (!gs.futexes.isWaiting(s.traceePid)) {
+      gs.futexes.wait(
+          gs.processes.threadGroupOf(s.traceePid), t.arg1(), s.traceePid,
+          bitset);
+      gs.futexWaitsParked++;
+    }
+    s.deferredPreHook = true;
+    sched.preemptAndWaitFor(
+        waitReason{waitKind::futexWord, (uint64_t)s.traceePid});
+    return false;
+  }
+
+  // Private FUTEX_WAIT with a timeout, Go's timed sleeps: park too, until a
+  // wake or until our logical timer goes off, rather than poll with a zero
+  // timeout. Skipped where we can't skip the system call to return from it.
+  logical_clock::duration timeout;
+  if (isPrivate && futexCmd == FUTEX_WAIT && timeoutPtr != nullptr &&
+      gs.skipSystemCalls &&
+      readRelativeTimeout(t, s.traceePid, timeoutPtr, timeout)) {
+    logical_clock::time_point deadline;
+    if (s.futexWoken) {
+      s.futexWoken = false;
+      sched.cancelTimer(s.traceePid);
+      replaceSystemCallWithNoop(gs, s, t);
+      return false;
+    }
+    if (sched.takeExpiredTimer(s.traceePid, &deadline)) {
+      DETTRACE_LOG(gs.log, Importance::info, "Timed out.\n");
+      gs.futexes.remove(s.traceePid);
+      s.advanceTimeTo(deadline);
+      replaceSystemCallWithNoop(gs, s, t, -ETIMEDOUT);
+      return false;
     }
-    */
-    // No need to go into the post hook.
+    int actualValue =
+        (int)t.readFromTracee(traceePtr<int>((int*)t.arg1()), s.traceePid);
+    if (actualValue != futexValue) {
+      gs.futexes.remove(s.traceePid);
+      sched.cancelTimer(s.traceePid);
+      return false;
+    }
+
+    if (!sched.timerArmed(s.traceePid)) {
+      sched.armTimer(s.traceePid, s.getLogicalTime() + timeout);
+    }
+    if (!gs.futexes.isWaiting(s.traceePid)) {
+      gs.futexes.wait(
+          gs.processes.threadGroupOf(s.traceePid), t.arg1(), s.traceePid,
+          futexQueues::matchAny);
+      gs.futexTimedWaitsParked++;
+    }
+    s.deferredPreHook = true;
+    sched.preemptAndWaitForAny(
+        {waitReason{waitKind::futexWord, (uint64_t)s.traceePid},
+         waitReason{waitKind::timer, (uint64_t)s.traceePid}},
+        0);
     return false;
   }
 
@@ -804,15 +1392,18 @@ bool futexSystemCall::handleDetPre(
   // runs out.
   if (futexCmd == FUTEX_WAIT || futexCmd == FUTEX_WAIT_BITSET ||
       futexCmd == FUTEX_WAIT_REQUEUE_PI) {
-    gs.log.writeToLog(
-        Importance::info, "Waiting on value at address: %p.\n", t.arg1());
-    gs.log.writeToLog(
-        Importance::info, "Against value: " + to_string(futexValue) + "\n");
-    if (gs.log.getDebugLevel() > 0) {
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Waiting on value at address: %p.\n",
+        t.arg1());
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "Against value: " + to_string(futexValue) + "\n");
+    if (gs.log.isEnabled(Importance::info)) {
       int actualValue =
           (int)t.readFromTracee(traceePtr<int>((int*)t.arg1()), t.getPid());
-      gs.log.writeToLog(
-          Importance::info, "Actual value: " + to_string(actualValue) + "\n");
+      DETTRACE_LOG(
+          gs.log, Importance::info,
+          "Actual value: " + to_string(actualValue) + "\n");
     }
 
     // Overwrite the current value with our value. Restore value in post hook.
@@ -821,21 +1412,22 @@ bool futexSystemCall::handleDetPre(
 
     timespec ourTimeout = {0};
     if (timeoutPtr == nullptr) {
-      gs.log.writeToLog(
-          Importance::extra,
+      DETTRACE_LOG(
+          gs.log, Importance::extra,
           "timeout null, writing our data to mmaped page...\n");
       timespec* newAddress = (timespec*)s.mmapMemory.getAddr().ptr;
-      t.writeToTracee(traceePtr<timespec>(newAddress), ourTimeout, s.traceePid);
+      s.mmapMemory.write(
+          t, traceePtr<timespec>(newAddress), ourTimeout, s.traceePid);
 
       // Point system call to new address.
       t.writeArg4((uint64_t)newAddress);
       s.userDefinedTimeout = false;
     } else {
-      if (gs.log.getDebugLevel() > 0) {
+      if (gs.log.isEnabled(Importance::info)) {
         timespec timeout =
             t.readFromTracee(traceePtr<timespec>(timeoutPtr), t.getPid());
-        gs.log.writeToLog(
-            Importance::info,
+        DETTRACE_LOG(
+            gs.log, Importance::info,
             "Using original timeout value: (s = %d, ns = %d)\n", timeout.tv_sec,
             timeout.tv_nsec);
       }
@@ -851,10 +1443,25 @@ void futexSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int futexOp = t.arg2();
   int futexCmd = futexOp & FUTEX_CMD_MASK;
+  if (futexCmd == FUTEX_WAKE || futexCmd == FUTEX_REQUEUE ||
+      futexCmd == FUTEX_CMP_REQUEUE || futexCmd == FUTEX_WAKE_BITSET ||
+      futexCmd == FUTEX_WAKE_OP) {
+    long ret = t.getReturnValue();
+    if (ret < 0) {
+      return;
+    }
+    int woken = wakePrivateFutex(gs, s, t, sched, futexCmd);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Woke up %d parked threads.\n", woken);
+    t.setReturnRegister(ret + woken);
+    return;
+  }
+
   if (futexCmd == FUTEX_WAIT || futexCmd == FUTEX_WAIT_BITSET ||
       futexCmd == FUTEX_WAIT_REQUEUE_PI) {
-    gs.log.writeToLog(
-        Importance::info, "Futex post-hook, handling wait operation.\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "Futex post-hook, handling wait operation.\n");
 
     // *uaddr != val
     if (t.getReturnValue() == -EAGAIN) {
@@ -870,9 +1477,15 @@ void futexSystemCall::handleDetPost(
       s.userDefinedTimeout = false;
       return;
     } else {
-      gs.log.writeToLog(Importance::info, "Replaying futex system call.\n");
+      DETTRACE_LOG(gs.log, Importance::info, "Replaying futex system call.\n");
       t.writeArg4(s.originalArg4);
-      replaySyscallIfBlocked(gs, s, t, sched, ETIMEDOUT);
+      // A private futex can only be woken by another thread of our group, so
+      // sleep until one of them does something.
+      waitReason reason{
+          waitKind::futex, (uint64_t)gs.processes.threadGroupOf(s.traceePid)};
+      bool isPrivate = (futexOp & FUTEX_PRIVATE_FLAG) != 0;
+      replaySyscallIfBlocked(
+          gs, s, t, sched, ETIMEDOUT, isPrivate ? &reason : nullptr);
     }
   }
 
@@ -881,7 +1494,38 @@ void futexSystemCall::handleDetPost(
 // =======================================================================================
 bool getcwdSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  stringId cwd = s.paths.write().cwd(gs.hostPaths, s.traceePid);
+  stringId root = s.paths.write().root(gs.hostPaths, s.traceePid);
+  if (cwd == stringInterner::noString || root == stringInterner::noString) {
+    return true;
+  }
+
+  // What the tracee sees, below its root. A cwd outside of it, or removed,
+  // has the kernel's own answer.
+  string path = gs.strings.str(cwd);
+  string rootPath = gs.strings.str(root);
+  const string deleted = " (deleted)";
+  if (path.size() >= deleted.size() &&
+      path.compare(path.size() - deleted.size(), deleted.size(), deleted) ==
+          0) {
+    return true;
+  }
+  if (!belowRoot(rootPath, path)) {
+    return true;
+  }
+
+  DETTRACE_LOG(
+      gs.log, Importance::info, "cwd from cache: %s\n", path.c_str());
+  if (path.size() + 1 > t.arg2()) {
+    return finishInPreHook(gs, s, t, -ERANGE);
+  }
+  t.writeTraceeBatch(
+      {traceeIo(
+          traceePtr<void>((void*)t.arg1()), (void*)path.c_str(),
+          path.size() + 1)},
+      s.traceePid);
+  // The raw system call returns the length, with the terminator.
+  return finishInPreHook(gs, s, t, path.size() + 1);
 }
 void getcwdSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -890,9 +1534,99 @@ void getcwdSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+bool stampDirectory(
+    globalState& gs, state& s, int fd, bool dirent64, directoryStamp& stamp) {
+  string procPath = "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(fd);
+  struct stat statbuf = {0};
+  if (stat(procPath.c_str(), &statbuf) != 0 || !S_ISDIR(statbuf.st_mode)) {
+    return false;
+  }
+
+  stamp.device = statbuf.st_dev;
+  stamp.inode = statbuf.st_ino;
+  stamp.dirent64 = dirent64;
+  stamp.mtime = statbuf.st_mtim;
+  stamp.ctime = statbuf.st_ctim;
+  stamp.logicalMtime =
+      get_with_default(gs.mtimeMap, statbuf.st_ino, gs.epoch);
+  return true;
+}
+// =======================================================================================
+bool readDirectoryInTracer(
+    globalState& gs,
+    state& s,
+    int fd,
+    bool dirent64,
+    directoryEntries<linux_dirent>& entries) {
+  int ourFd = duplicateTraceeFd(s.traceePid, fd);
+  if (ourFd == -1) {
+    return false;
+  }
+
+  // Large reads, each getdents here would be a round trip for the tracee.
+  const size_t chunkSize = 256 * 1024;
+  uint8_t* chunk = gs.scratch.allocate<uint8_t>(chunkSize);
+  long systemCall = dirent64 ? SYS_getdents64 : SYS_getdents;
+  long bytes;
+  bool readAny = false;
+  while ((bytes = syscall(systemCall, ourFd, chunk, chunkSize)) > 0) {
+    memcpy(entries.addChunk(bytes), chunk, bytes);
+    readAny = true;
+  }
+  int savedErrno = errno;
+  close(ourFd);
+
+  if (bytes < 0 && !readAny) {
+    // Let the tracee run into the same error.
+    return false;
+  }
+  if (bytes < 0) {
+    // The tracee's offset moved with ours, we can't hand this back to it.
+    runtimeError(
+        "Unable to read directory of fd " + to_string(fd) +
+        " for tracee: " + strerror(savedErrno) + "\n");
+  }
+  gs.tracerDirectoryReads++;
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Read directory of fd %d ourselves\n", fd);
+  return true;
+}
+// =======================================================================================
+vector<uint8_t> serveDirectoryEntries(
+    globalState& gs,
+    state& s,
+    int fd,
+    directoryEntries<linux_dirent>& entries,
+    size_t bytes,
+    bool fresh) {
+  // Shares the tracee's file offset. Without one we serve in order, as when
+  // the tracee never seeks.
+  int ourFd = entries.seekable ? duplicateTraceeFd(s.traceePid, fd) : -1;
+  if (ourFd != -1 && !fresh) {
+    off_t offset = lseek(ourFd, 0, SEEK_CUR);
+    if (offset >= 0 && (uint64_t)offset != entries.position()) {
+      DETTRACE_LOG(
+          gs.log, Importance::info,
+          "Tracee moved fd %d to entry %ld of its listing\n", fd, offset);
+      entries.seek(offset);
+      gs.directorySeeks++;
+    }
+  }
+  vector<uint8_t> filled = entries.getSortedEntries(bytes);
+  if (ourFd != -1) {
+    // A directory that can't be positioned like this is a listing we only
+    // serve in order.
+    if (lseek(ourFd, entries.position(), SEEK_SET) == -1) {
+      entries.seekable = false;
+    }
+    close(ourFd);
+  }
+  return filled;
+}
+// =======================================================================================
 bool getdentsSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  return handleDentsPre<linux_dirent>(gs, s, t, sched);
 }
 void getdentsSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -902,7 +1636,7 @@ void getdentsSystemCall::handleDetPost(
 // =======================================================================================
 bool getdents64SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  return handleDentsPre<linux_dirent64>(gs, s, t, sched);
 }
 void getdents64SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -934,8 +1668,24 @@ void getrandomSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   gs.getRandomCalls++;
 
+  // Only overwrite what the kernel claims it filled, getrandom may come up
+  // short, or fail.
+  if ((int64_t)t.getReturnValue() <= 0) {
+    return;
+  }
   char* buf = (char*)t.arg1();
-  size_t bufLength = (size_t)t.arg2();
+  size_t bufLength = (size_t)t.getReturnValue();
+  gs.getRandomBytes += bufLength;
+
+  if (!gs.prngCompat) {
+    uint8_t* bytes = gs.scratch.allocate<uint8_t>(bufLength);
+    s.getrandomStream(gs.prngSeed).read(bytes, bufLength);
+    gs.publishRandomPositions();
+    writeVmTraceeRaw(
+        bytes, traceePtr<uint8_t>{(uint8_t*)buf}, bufLength, t.getPid());
+    t.writeVmCalls++;
+    return;
+  }
 
   char prngValues[128];
 
@@ -951,9 +1701,8 @@ void getrandomSystemCall::handleDetPost(
     // Copy buffer contents to tracee
     size_t amountToWrite = min(sizeof(prngValues), bufLength - traceeByteIdx);
     auto traceeMem = traceePtr<char>{buf + traceeByteIdx};
-    writeVmTraceeRaw(prngValues, traceeMem, amountToWrite, t.getPid());
-    // Explicitly increase counter.
-    t.writeVmCalls++;
+    t.writeTraceeBatch(
+        {traceeIo(traceeMem, prngValues, amountToWrite)}, t.getPid());
   }
 
   return;
@@ -961,40 +1710,29 @@ void getrandomSystemCall::handleDetPost(
 // =======================================================================================
 bool getrlimitSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  // The real limits go through for now, see prlimit64SystemCall. Nothing for
+  // a post-hook to do.
+  return false;
 }
 
 void getrlimitSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  struct rlimit* rp = (struct rlimit*)t.arg2();
-  if (rp != nullptr) {
-    // struct rlimit noLimits = {};
-    // TODO See prlimit64SystemCall
-    // noLimits.rlim_cur = RLIM_INFINITY;
-    // noLimits.rlim_max = RLIM_INFINITY;
-
-    // t.writeToTracee(rp, noLimits, t.getPid());
-  }
-
   return;
 }
 // =======================================================================================
+// Nothing of the answer comes from the kernel, so we give it in the pre-hook
+// and skip the system call.
 bool getrusageSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
-}
-void getrusageSystemCall::handleDetPost(
-    globalState& gs, state& s, ptracer& t, scheduler& sched) {
   gs.timeCalls++;
   struct rusage* usagePtr = (struct rusage*)t.arg2();
 
   if (usagePtr == nullptr) {
-    gs.log.writeToLog(Importance::info, "getrusage pointer null.");
+    DETTRACE_LOG(gs.log, Importance::info, "getrusage pointer null.");
+    return finishInPreHook(gs, s, t, -EFAULT);
   } else {
-    // jld; initializing usage from tracee memory seems redundant, as all fields
-    // are overwritten below
-    struct rusage usage; // = t.readFromTracee(traceePtr<struct
-                         // rusage>(usagePtr), t.getPid());
+    // All fields are overwritten below.
+    struct rusage usage;
     const auto time = logical_clock::to_timeval(s.getLogicalTime());
 
     /* user CPU time used */
@@ -1021,18 +1759,19 @@ void getrusageSystemCall::handleDetPost(
   }
 
   s.incrementTime();
-  return;
+  return finishInPreHook(gs, s, t, 0);
 }
-// =======================================================================================
-bool gettimeofdaySystemCall::handleDetPre(
+void getrusageSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  return;
 }
-
-void gettimeofdaySystemCall::handleDetPost(
+// =======================================================================================
+/** Writes tv from our logical clock, ticking it. */
+static void answerGettimeofday(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info, "Inside gettimeofday post-hook, sending tv_sec=%d\n",
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "Inside gettimeofday post-hook, sending tv_sec=%d\n",
       s.getLogicalTime().time_since_epoch().count());
   gs.timeCalls++;
   struct timeval* tp = (struct timeval*)t.arg1();
@@ -1046,7 +1785,27 @@ void gettimeofdaySystemCall::handleDetPost(
     // breaking any assumptions..
     sched.preemptAndScheduleNext();
   }
+}
+
+bool gettimeofdaySystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (!gs.skipSystemCalls) {
+    return true;
+  }
+  struct timezone* tz = (struct timezone*)t.arg2();
+  if (tz != nullptr) {
+    // UTC, the kernel's own unless someone sets it with settimeofday.
+    struct timezone utc = {};
+    t.writeToTracee(traceePtr<struct timezone>(tz), utc, s.traceePid);
+  }
+  replaceSystemCallWithNoop(gs, s, t);
+  answerGettimeofday(gs, s, t, sched);
+  return false;
+}
 
+void gettimeofdaySystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  answerGettimeofday(gs, s, t, sched);
   return;
 }
 // =======================================================================================
@@ -1091,8 +1850,8 @@ void ioctlSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int fd = t.arg1();
   const uint64_t request = t.arg2();
-  gs.log.writeToLog(Importance::info, "File descriptor: %d\n", fd);
-  gs.log.writeToLog(Importance::info, "Request 0x%" PRIx64 "\n", request);
+  DETTRACE_LOG(gs.log, Importance::info, "File descriptor: %d\n", fd);
+  DETTRACE_LOG(gs.log, Importance::info, "Request 0x%" PRIx64 "\n", request);
 
   switch (request) {
   // Even though we don't particularly like TCGETS, we will let it through as we
@@ -1164,10 +1923,11 @@ void ioctlSystemCall::handleDetPost(
     auto blocking_flag =
         flag ? descriptorType::nonBlocking : descriptorType::blocking;
     auto blocking_msg = flag ? "non blocking" : "blocking";
-    gs.log.writeToLog(
-        Importance::info, "found ioctl(%d, FIONBIO, &%d), setting %d to %s!\n",
-        fd, flag, fd, blocking_msg);
-    (*s.fdStatus.get())[fd] = blocking_flag;
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "found ioctl(%d, FIONBIO, &%d), setting %d to %s!\n", fd, flag, fd,
+        blocking_msg);
+    s.setFdStatus(fd, blocking_flag);
   } break;
   default:
     runtimeError(
@@ -1178,6 +1938,133 @@ void ioctlSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+#ifdef SYS_io_uring_setup
+/** The flags of the io_uring_params at params in the tracee. */
+static traceePtr<uint32_t> setupFlagsAt(uint64_t params) {
+  return traceePtr<uint32_t>(
+      (uint32_t*)(params + offsetof(struct io_uring_params, flags)));
+}
+
+bool io_uring_setupSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  uint32_t flags = t.readFromTracee(setupFlagsAt(t.arg2()), s.traceePid);
+  if ((flags & ~ioUring::setupFlags) != 0) {
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "io_uring_setup flags 0x%x not supported, failing with ENOSYS\n",
+        flags);
+    failSystemCall(gs, s, t, ENOSYS);
+    return false;
+  }
+  s.ioUringFlags = flags;
+  t.writeToTracee(
+      setupFlagsAt(t.arg2()), ioUring::setupFlagsFor(flags), s.traceePid);
+  return true;
+}
+
+void io_uring_setupSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int fd = t.getReturnValue();
+  struct io_uring_params params;
+  if (fd >= 0) {
+    params = t.readFromTracee(
+        traceePtr<struct io_uring_params>((struct io_uring_params*)t.arg2()),
+        s.traceePid);
+  }
+  t.writeToTracee(setupFlagsAt(t.arg2()), s.ioUringFlags, s.traceePid);
+  if (fd < 0) {
+    return;
+  }
+
+  int ourFd = duplicateTraceeFd(s.traceePid, fd);
+  shared_ptr<ioUring> ring =
+      ourFd == -1 ? nullptr : ioUring::attach(ourFd, params);
+  // The tracee has the ring already, we can't let it run unrestricted.
+  if (ring == nullptr) {
+    runtimeError(
+        "io_uring_setup: unable to take over the ring of fd " +
+        to_string(fd) + " in tracee " + to_string(s.traceePid) + "\n");
+  }
+  s.fds.write().setRing(fd, ring);
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "io_uring_setup(%u) = %d, %u SQ and %u CQ entries\n",
+      (unsigned)t.arg1(), fd, params.sq_entries, params.cq_entries);
+}
+// =======================================================================================
+bool io_uring_enterSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (s.ioUringWaiting) {
+    return true;
+  }
+  // A registered ring's fd is no fd of ours, though rings can't register
+  // themselves under restrictions.
+  const shared_ptr<ioUring>& ring = s.fdInfoOf(t.arg1()).ring;
+  if (ring == nullptr || (t.arg4() & IORING_ENTER_REGISTERED_RING) != 0) {
+    return false;
+  }
+
+  uint64_t before = ring->submitted;
+  uint32_t refused = ring->prepareSubmission(
+      t.arg2(), [&s](int fd) { return s.getFdType(fd) == fdType::regular; });
+  gs.ioUringSqes += ring->submitted - before;
+  gs.ioUringSqesRefused += refused;
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "io_uring_enter: %" PRIu64 " SQEs, %u refused\n",
+      ring->submitted - before, refused);
+  return true;
+}
+
+void io_uring_enterSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  shared_ptr<ioUring> ring = s.fdInfoOf(t.arg1()).ring;
+  int result = t.getReturnValue();
+  if (!s.ioUringWaiting && ring != nullptr) {
+    ring->finishSubmission();
+  }
+
+  // Until what the tracee finds in its CQ ring no longer depends on the
+  // kernel's speed. Our waits only fail if interrupted.
+  bool wait = ring != nullptr && !ring->settled() &&
+      (!s.ioUringWaiting || result >= 0 || result == -EINTR);
+  if (wait) {
+    if (!s.ioUringWaiting) {
+      s.ioUringWaiting = true;
+      s.ioUringResult = result;
+      s.originalArg2 = t.arg2();
+      s.originalArg3 = t.arg3();
+      s.originalArg4 = t.arg4();
+      s.originalArg5 = t.arg5();
+      s.originalArg6 = t.arg6();
+    }
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "io_uring_enter: waiting for %u CQEs\n", ring->unsettled());
+    t.writeArg2(0);
+    t.writeArg3(ring->unsettled());
+    t.writeArg4(IORING_ENTER_GETEVENTS);
+    t.writeArg5(0);
+    t.writeArg6(0);
+    replaySystemCall(gs, t, SYS_io_uring_enter);
+    return;
+  }
+
+  if (ring != nullptr) {
+    ring->orderCompletions();
+  }
+  if (s.ioUringWaiting) {
+    s.ioUringWaiting = false;
+    t.writeArg2(s.originalArg2);
+    t.writeArg3(s.originalArg3);
+    t.writeArg4(s.originalArg4);
+    t.writeArg5(s.originalArg5);
+    t.writeArg6(s.originalArg6);
+    t.setReturnRegister(s.ioUringResult);
+  }
+}
+#endif
+// =======================================================================================
 // TODO
 bool llistxattrSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -1205,8 +2092,8 @@ void mmapSystemCall::handleDetPost(
   // This isn't a natural call mmap from the tracee we injected this call
   // ourselves!
   if (s.syscallInjected) {
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "This mmap was inject for use in pre and post hook purposes.\n");
 
     if (t.getRax().ptr == MAP_FAILED) {
@@ -1230,14 +2117,40 @@ void mmapSystemCall::handleDetPost(
 // =======================================================================================
 bool nanosleepSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Write 0 seconds to time. Required to skip waiting at all.
   struct timespec* req = (struct timespec*)t.arg1();
+  // A thread sleeping waits for the others, e.g. Go's sysmon: park it until
+  // its logical timer goes off, once they can't run, rather than let it spin.
+  // Where we can't skip the system call, and for processes, it returns
+  // right away.
+  logical_clock::duration duration;
+  if (req != nullptr && gs.skipSystemCalls &&
+      gs.processes.threadGroupSize(s.traceePid) > 1 &&
+      readRelativeTimeout(t, s.traceePid, req, duration) &&
+      duration != logical_clock::duration::zero()) {
+    logical_clock::time_point deadline;
+    if (sched.takeExpiredTimer(s.traceePid, &deadline)) {
+      s.advanceTimeTo(deadline);
+      replaceSystemCallWithNoop(gs, s, t);
+      return false;
+    }
+    if (!sched.timerArmed(s.traceePid)) {
+      sched.armTimer(s.traceePid, s.getLogicalTime() + duration);
+      gs.sleepsParked++;
+    }
+    s.deferredPreHook = true;
+    sched.preemptAndWaitFor(waitReason{waitKind::timer, (uint64_t)s.traceePid});
+    return false;
+  }
+
+  // Write 0 seconds to time. Required to skip waiting at all.
   if (req != nullptr) {
     struct timespec* myReq = (timespec*)s.mmapMemory.getAddr().ptr;
     struct timespec localReq = {0};
 
-    t.writeToTracee(traceePtr<struct timespec>(myReq), localReq, s.traceePid);
+    s.mmapMemory.write(
+        t, traceePtr<struct timespec>(myReq), localReq, s.traceePid);
     t.writeArg1((uint64_t)myReq);
+    t.restoreArgLater(1, (uint64_t)myReq, (uint64_t)req);
   }
   return false;
 }
@@ -1249,88 +2162,45 @@ void nanosleepSystemCall::handleDetPost(
 // =======================================================================================
 bool mkdirSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  logCreatedPath(gs, s, t, t.arg1(), " path: ");
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD);
 
   return true;
 }
 
 void mkdirSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Add/overwrite entry in our map.
-  if (t.getReturnValue() == 0 && (char*)t.arg1() != nullptr) {
-    string strPath =
-        t.readTraceeCString(traceePtr<char>((char*)t.arg1()), s.traceePid);
-    auto inode = inode_from_tracee(strPath, s.traceePid, gs.log, -1);
-    if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
-      s.incrementTime();
-    }
-  }
+  noteCreated(gs, s, t, t.arg1(), -1);
 }
 // =======================================================================================
 bool mkdiratSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  printInfoString(t.arg2(), gs.log, s.traceePid, t);
-  gs.log.writeToLog(Importance::info, "dirfd: %d\n", t.arg1());
+  logCreatedPath(gs, s, t, t.arg2(), " path: ");
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1());
+  DETTRACE_LOG(gs.log, Importance::info, "dirfd: %d\n", t.arg1());
   return true;
 }
 
 void mkdiratSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  char* path = (char*)t.arg2();
-  // Add/overwrite entry in our map.
-  if (t.getReturnValue() == 0 && path != nullptr) {
-    string strPath = t.readTraceeCString(traceePtr<char>(path), s.traceePid);
-    auto inode = inode_from_tracee(strPath, s.traceePid, gs.log, t.arg1());
-    if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
-      s.incrementTime();
-    }
-  }
+  noteCreated(gs, s, t, t.arg2(), t.arg1());
 }
 // =======================================================================================
 bool newfstatatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  if (s.syscallInjected) {
+    return true;
+  }
+  bool followLinks = (t.arg4() & AT_SYMLINK_NOFOLLOW) == 0;
+  return !statWillFail(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1(), followLinks);
 }
 
 void newfstatatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t);
 
-  // This newfstatat was injected to get the inode belonging to a file that was
-  // deleted through: unlink, unlinkat, or rmdir.
-  if (s.syscallInjected) {
-    gs.log.writeToLog(Importance::info, "This newfstatat was injected.\n");
-    s.syscallInjected = false;
-
-    if (t.getReturnValue() >= 0) {
-      struct stat* statbufPtr = (struct stat*)t.arg3();
-      struct stat statbuf =
-          t.readFromTracee(traceePtr<struct stat>(statbufPtr), s.traceePid);
-
-      gs.log.writeToLog(
-          Importance::extra,
-          "marking (device,inode) = (%lu,%lu) for deletion\n", statbuf.st_dev,
-          statbuf.st_ino);
-
-      s.inodeToDelete = statbuf.st_ino;
-    } else {
-      gs.log.writeToLog(Importance::info, "No such file, that's okay.\n");
-      s.inodeToDelete = -1;
-    }
-
-    // We got what we wanted. The inode that matches the file called from either
-    // unlink, unlinkat, or rmdir. Now replay that system call as we did not let
-    // it though.
-    t.setRegs(s.regSaver.popRegisterState());
-    replaySystemCall(gs, t, t.getSystemCallNumber());
-    s.firstTrySystemcall = false;
-  } else {
-    handleStatFamily(gs, s, t, "newfstatat");
-  }
+  handleStatFamily(gs, s, t, "newfstatat");
 
   return;
 }
@@ -1339,7 +2209,8 @@ bool lstatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
 
-  return true;
+  return !statWillFail(
+      gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, false);
 }
 
 void lstatSystemCall::handleDetPost(
@@ -1352,10 +2223,18 @@ bool linkSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " hardlinking path: ");
   printInfoString(t.arg1(), gs.log, s.traceePid, t, " to path: ");
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg2()), AT_FDCWD);
 
   return false;
 }
 
+void linkSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[1], gs.log, s.traceePid, t, " hardlinking path: ");
+  printInfoString(n.args[0], gs.log, s.traceePid, t, " to path: ");
+  gs.missing.clear();
+}
+
 void linkSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   runtimeError("link post-hook should never be called.");
@@ -1365,10 +2244,18 @@ bool linkatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg4(), gs.log, s.traceePid, t, " hardlinking path: ");
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " to path: ");
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg4()), t.arg3());
 
   return false;
 }
 
+void linkatSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[3], gs.log, s.traceePid, t, " hardlinking path: ");
+  printInfoString(n.args[1], gs.log, s.traceePid, t, " to path: ");
+  gs.missing.clear();
+}
+
 void linkatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   runtimeError("linkat post-hook should never be called.");
@@ -1377,7 +2264,13 @@ void linkatSystemCall::handleDetPost(
 bool openSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   if ((char*)t.arg1() != nullptr) {
-    handlePreOpens(gs, s, t, -1, traceePtr<char>{(char*)t.arg1()}, t.arg2());
+    uint64_t synthetic = handlePreOpens(
+        gs, s, t, AT_FDCWD, traceePtr<char>{(char*)t.arg1()}, t.arg2(), true);
+    if (synthetic != 0) {
+      s.openingSynthetic = true;
+      s.originalArg1 = t.arg1();
+      t.writeArg1(synthetic);
+    }
     return true;
   }
   return false;
@@ -1385,6 +2278,9 @@ bool openSystemCall::handleDetPre(
 
 void openSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (s.openingSynthetic) {
+    t.writeArg1(s.originalArg1);
+  }
   // Beware of unsigned numbers, can lead to wrong value if not casted!
   handlePostOpens(gs, s, t, (int)t.arg2());
 }
@@ -1392,8 +2288,13 @@ void openSystemCall::handleDetPost(
 bool openatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   if ((char*)t.arg2() != nullptr) {
-    handlePreOpens(
-        gs, s, t, t.arg1(), traceePtr<char>{(char*)t.arg2()}, t.arg3());
+    uint64_t synthetic = handlePreOpens(
+        gs, s, t, t.arg1(), traceePtr<char>{(char*)t.arg2()}, t.arg3(), true);
+    if (synthetic != 0) {
+      s.openingSynthetic = true;
+      s.originalArg2 = t.arg2();
+      t.writeArg2(synthetic);
+    }
     return true;
   }
   return false;
@@ -1401,36 +2302,63 @@ bool openatSystemCall::handleDetPre(
 
 void openatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (s.openingSynthetic) {
+    t.writeArg2(s.originalArg2);
+  }
   // Beware of sign, can lead to wrong value if not casted!
   handlePostOpens(gs, s, t, (int)t.arg3());
 }
 // =======================================================================================
+bool openat2SystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if ((char*)t.arg2() == nullptr || t.arg3() == 0) {
+    return false;
+  }
+  // Fails with EINVAL, ours is as small as open_how gets.
+  if (t.arg4() < sizeof(struct open_how)) {
+    return false;
+  }
+  struct open_how how = t.readFromTracee(
+      traceePtr<struct open_how>((struct open_how*)t.arg3()), s.traceePid);
+  uint64_t synthetic = handlePreOpens(
+      gs, s, t, t.arg1(), traceePtr<char>{(char*)t.arg2()}, (int)how.flags,
+      how.resolve == 0);
+  // Magic links like /proc/<tracer>/fd/ are refused by some resolve flags.
+  if (synthetic != 0 && how.resolve == 0) {
+    s.openingSynthetic = true;
+    s.originalArg2 = t.arg2();
+    t.writeArg2(synthetic);
+  }
+  return true;
+}
+
+void openat2SystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // The kernel only reads it, it holds the flags we saw in the pre-hook.
+  struct open_how how = t.readFromTracee(
+      traceePtr<struct open_how>((struct open_how*)t.arg3()), s.traceePid);
+  if (s.openingSynthetic) {
+    t.writeArg2(s.originalArg2);
+  }
+  handlePostOpens(gs, s, t, (int)how.flags);
+}
+// =======================================================================================
 bool pauseSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "pause pre-hook\n");
+  DETTRACE_LOG(gs.log, Importance::info, "pause pre-hook\n");
   return true;
 }
 
 void pauseSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "pause post-hook\n");
-  if (s.signalInjected) {
-    uint64_t retval = t.getReturnValue();
-    gs.log.writeToLog(Importance::info, "pause returned %lld\n", retval);
-
-    // ick: fake the return value for the call we hijacked.
-    // For alarm(), 0 means there was no previously scheduled alarm.
-    // For timer_settime() and setitimer(), 0 means it succeeded
-    s.signalInjected = false;
-    t.setReturnRegister(0);
-  }
+  DETTRACE_LOG(gs.log, Importance::info, "pause post-hook\n");
 }
 
 // =======================================================================================
 bool pipeSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info, "Making this pipe non-blocking via pipe2\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Making this pipe non-blocking via pipe2\n");
 
   s.syscallInjected = true;
   t.changeSystemCall(SYS_pipe2);
@@ -1450,8 +2378,8 @@ void pipeSystemCall::handleDetPost(
   // Restore original register state.
   // t.writeArg2(s.originalArg2);
   // auto p = getPipeFds(gs, s, t);
-  // s.fdStatus[p.first] = descriptorType::blocking;
-  // s.fdStatus[p.second] = descriptorType::blocking;
+  // s.setFdStatus(p.first, descriptorType::blocking);
+  // s.setFdStatus(p.second, descriptorType::blocking);
 }
 // =======================================================================================
 bool pipe2SystemCall::handleDetPre(
@@ -1459,34 +2387,68 @@ bool pipe2SystemCall::handleDetPre(
   // We only see this pre-hook if the call was originally a pipe2 and not a pipe
   // that was converted into a pipe2. That's why it's okay to set s.originalArg2
   // here.
-  gs.log.writeToLog(Importance::info, "Making this pipe2 non-blocking\n");
+  DETTRACE_LOG(gs.log, Importance::info, "Making this pipe2 non-blocking\n");
   // Convert pipe call to pipe2 to set O_NONBLOCK.
   s.originalArg2 = t.arg2();
   t.writeArg2(t.arg2() | O_NONBLOCK);
 
   return true;
 }
+// =======================================================================================
+/**
+ * Give the tracee's pipe read end fd room for gs.pipeSize bytes, through our
+ * duplicate of it. A pipe of any other size would leave when its writers
+ * block, and so the schedule, to the machine: better to stop.
+ */
+static void resizePipe(globalState& gs, state& s, int fd) {
+  int ourFd = duplicateTraceeFd(s.traceePid, fd);
+  if (ourFd == -1) {
+    string path = "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(fd);
+    ourFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+  int size = ourFd == -1 ? -1 : fcntl(ourFd, F_SETPIPE_SZ, gs.pipeSize);
+  int error = errno;
+  if (ourFd != -1) {
+    close(ourFd);
+  }
+  if (size == -1) {
+    runtimeError(
+        "Unable to resize pipe " + to_string(fd) + " of " +
+        to_string(s.traceePid) + " to " + to_string(gs.pipeSize) +
+        " bytes: " + strerror(error) +
+        ". Past /proc/sys/fs/pipe-user-pages-soft? See --pipe-size.\n");
+  }
+}
 
 void pipe2SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   // Restore original registers.
   t.writeArg2(s.originalArg2);
   auto p = getPipeFds(gs, s, t);
+  if (t.getReturnValue() == 0) {
+    s.setFdType(p.first, fdType::pipe);
+    s.setFdType(p.second, fdType::pipe);
+    if (gs.pipeSize != 0) {
+      resizePipe(gs, s, p.first);
+    }
+  }
 
   // Track this file descriptor:
   if (s.countFdStatus(p.first) != 0) {
-    runtimeError("Value already in map (fdStatus): " + to_string(p.first));
+    runtimeError("Value already in fd table: " + to_string(p.first));
   }
   if (s.countFdStatus(p.second) != 0) {
-    runtimeError("Value already in map (fdStatus): " + to_string(p.second));
+    runtimeError("Value already in fd table: " + to_string(p.second));
   }
 
   // This was a pipe that got converted to a pipe2.
   if (s.syscallInjected) {
     s.syscallInjected = false;
-    gs.log.writeToLog(Importance::info, "This used to a pipe()!\n");
-    gs.log.writeToLog(Importance::info, "Set pipe %d as blocking.\n", p.first);
-    gs.log.writeToLog(Importance::info, "Set pipe %d as blocking.\n", p.second);
+    DETTRACE_LOG(gs.log, Importance::info, "This used to a pipe()!\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Set pipe %d as blocking.\n", p.first);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Set pipe %d as blocking.\n", p.second);
     s.setFdStatus(p.first, descriptorType::blocking);
     s.setFdStatus(p.second, descriptorType::blocking);
   } else {
@@ -1495,26 +2457,219 @@ void pipe2SystemCall::handleDetPost(
 
     // Check if set as non=blocking.
     if ((flags & O_NONBLOCK) == 0) {
-      gs.log.writeToLog(
-          Importance::info, "Set pipe %d as blocking.\n", p.first);
-      gs.log.writeToLog(
-          Importance::info, "Set pipe %d as blocking.\n", p.second);
+      DETTRACE_LOG(
+          gs.log, Importance::info, "Set pipe %d as blocking.\n", p.first);
+      DETTRACE_LOG(
+          gs.log, Importance::info, "Set pipe %d as blocking.\n", p.second);
       s.setFdStatus(p.first, descriptorType::blocking);
       s.setFdStatus(p.second, descriptorType::blocking);
     } else {
-      gs.log.writeToLog(
-          Importance::info, "Set pipe %d as non-blocking.\n", p.first);
-      gs.log.writeToLog(
-          Importance::info, "Set pipe %d as non-blocking.\n", p.second);
+      DETTRACE_LOG(
+          gs.log, Importance::info, "Set pipe %d as non-blocking.\n", p.first);
+      DETTRACE_LOG(
+          gs.log, Importance::info, "Set pipe %d as non-blocking.\n", p.second);
       s.setFdStatus(p.first, descriptorType::nonBlocking);
       s.setFdStatus(p.second, descriptorType::nonBlocking);
     }
   }
 }
 // =======================================================================================
+/**
+ * What poll() would report for fd right now if the tracer can tell without
+ * the kernel, -1 if it can't. Regular files and our /dev/[u]random are always
+ * ready. A timerfd is readable once it went off in logical time: the kernel's
+ * timer never does, see timerfd_settime. Pipes and socketpairs between tracees
+ * are polled through our duplicate of the tracee's own end, see
+ * readinessProbe, eventfds through ours, see serveEventfdRead.
+ */
+static int eventsInTracer(state& s, int fd) {
+  const int always = POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+  if (s.fd_is_timerfd(fd)) {
+    logicalTimers::timerKey key{timerKind::timerfd, s.fdInfoOf(fd).timer.timer};
+    bool expired =
+        s.timers->armed(key) && s.timers->expiry(key) <= s.getLogicalTime();
+    return expired ? POLLIN | POLLRDNORM : 0;
+  }
+  switch (s.getFdType(fd)) {
+  case fdType::regular:
+  case fdType::procFile:
+  case fdType::devRandom:
+  case fdType::devUrandom:
+  case fdType::devNull:
+  case fdType::devZero:
+    return always;
+  case fdType::pipe:
+    return s.countFdStatus(fd) != 0 ? s.readProbe->pollEvents(s.traceePid, fd)
+                                    : -1;
+  case fdType::socket:
+    return s.countFdStatus(fd) != 0 && s.fdInfoOf(fd).socketPair.inode != 0
+        ? s.readProbe->pollEvents(s.traceePid, fd)
+        : -1;
+  case fdType::eventfd: {
+    struct pollfd pfd = {s.fdInfoOf(fd).eventfd->ourFd, POLLIN | POLLOUT, 0};
+    return poll(&pfd, 1, 0) < 0 ? -1 : pfd.revents;
+  }
+  default:
+    return -1;
+  }
+}
+
+/** The events select() files under readable and writable, as the kernel. */
+static const int selectReadable = POLLIN | POLLRDNORM | POLLRDBAND | POLLHUP |
+    POLLERR;
+static const int selectWritable = POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR;
+
+/**
+ * select() over the first nfds fds of sets from the tracer, a word of each
+ * set at a time, see eventsInTracer. The ready fds go in ready, in the order
+ * of sets. Pipes waited on are added to reasons.
+ * @return the fds ready, as select counts them, -1 if one we can't tell.
+ */
+static int selectInTracer(
+    state& s,
+    int nfds,
+    const selectFdSets& sets,
+    fd_set ready[3],
+    vector<waitReason>& reasons) {
+  if (nfds < 0 || nfds > FD_SETSIZE) {
+    return -1;
+  }
+  const int wordBits = 64;
+  const int words = FD_SETSIZE / wordBits;
+  uint64_t in[3][words], out[3][words] = {};
+  for (int set = 0; set < 3; set++) {
+    const fd_set* from = set == 0 ? &sets.origRdfs
+        : set == 1                ? &sets.origWrfs
+                                  : &sets.origExfs;
+    bool notNull = set == 0 ? sets.rdfsNotNull
+        : set == 1          ? sets.wrfsNotNull
+                            : sets.exfsNotNull;
+    if (notNull) {
+      memcpy(in[set], from, sizeof(fd_set));
+    } else {
+      memset(in[set], 0, sizeof(fd_set));
+    }
+  }
+
+  int count = 0;
+  for (int w = 0; w * wordBits < nfds; w++) {
+    int tail = nfds - w * wordBits;
+    uint64_t valid = tail >= wordBits ? ~0ULL : (1ULL << tail) - 1;
+    uint64_t any = (in[0][w] | in[1][w] | in[2][w]) & valid;
+    while (any != 0) {
+      int bit = __builtin_ctzll(any);
+      any &= any - 1;
+      int fd = w * wordBits + bit;
+      int events = eventsInTracer(s, fd);
+      if (events == -1) {
+        return -1;
+      }
+      uint64_t mask = 1ULL << bit;
+      bool readable = in[0][w] & mask && events & selectReadable;
+      bool writable = in[1][w] & mask && events & selectWritable;
+      // Exceptional conditions, out of band data, we model on none.
+      out[0][w] |= readable ? mask : 0;
+      out[1][w] |= writable ? mask : 0;
+      count += readable + writable;
+      addPipeReadyReasons(s, fd, in[0][w] & mask, in[1][w] & mask, reasons);
+    }
+  }
+  for (int set = 0; set < 3; set++) {
+    memcpy(&ready[set], out[set], sizeof(fd_set));
+  }
+  return count;
+}
+
+/**
+ * Answer the select() or pselect6() of s from the tracer, if selectInTracer
+ * can tell what is ready and either something is or the tracee doesn't want to
+ * wait. The result sets are written back and the system call turned into a
+ * noop. Otherwise, with waitForever, we hold the tracee here until one of the
+ * pipes it waits on changes, see state::deferredPreHook.
+ * @return whether the system call is taken care of, the pre-hook returns
+ * handledTrue from then on.
+ */
+static bool selectFromTracer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    const selectFdSets& sets,
+    bool zeroTimeout,
+    bool waitForever,
+    bool& handledTrue) {
+  fd_set ready[3];
+  vector<waitReason> reasons;
+  int count = selectInTracer(s, (int)t.arg1(), sets, ready, reasons);
+  if (count == -1) {
+    return false;
+  }
+  if (count > 0 || zeroTimeout) {
+    vector<traceeIo> fdSets;
+    if (sets.rdfsNotNull) {
+      fdSets.emplace_back(traceePtr<fd_set>((fd_set*)t.arg2()), &ready[0]);
+    }
+    if (sets.wrfsNotNull) {
+      fdSets.emplace_back(traceePtr<fd_set>((fd_set*)t.arg3()), &ready[1]);
+    }
+    if (sets.exfsNotNull) {
+      fdSets.emplace_back(traceePtr<fd_set>((fd_set*)t.arg4()), &ready[2]);
+    }
+    t.writeTraceeBatch(fdSets, s.traceePid);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "%d fds ready, answered by the tracer\n",
+        count);
+    gs.pollsInTracer++;
+    s.readDeferrals = 0;
+    handledTrue = finishInPreHook(gs, s, t, count);
+    return true;
+  }
+  if (!waitForever || reasons.empty() ||
+      s.readDeferrals >= state::maxReadDeferrals) {
+    s.readDeferrals = 0;
+    return false;
+  }
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "Nothing ready, holding the tracee until one of %zu events\n",
+      reasons.size());
+  s.readDeferrals++;
+  s.deferredPreHook = true;
+  gs.emptyPollRetries++;
+  handledTrue = false;
+  sched.preemptAndWaitForAny(reasons, 0);
+  return true;
+}
+// =======================================================================================
 bool pselect6SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  // Only answered here when it needn't wait: its signal mask only matters to a
+  // pselect6 that blocks, which the kernel still does.
+  selectFdSets& sets = s.selectSets.fresh();
+  vector<traceeIo> io;
+  if ((void*)t.arg2() != NULL) {
+    sets.rdfsNotNull = true;
+    io.emplace_back(traceePtr<fd_set>((fd_set*)t.arg2()), &sets.origRdfs);
+  }
+  if ((void*)t.arg3() != NULL) {
+    sets.wrfsNotNull = true;
+    io.emplace_back(traceePtr<fd_set>((fd_set*)t.arg3()), &sets.origWrfs);
+  }
+  if ((void*)t.arg4() != NULL) {
+    sets.exfsNotNull = true;
+    io.emplace_back(traceePtr<fd_set>((fd_set*)t.arg4()), &sets.origExfs);
+  }
+  timespec timeout = {1, 0};
+  if ((void*)t.arg5() != NULL) {
+    io.emplace_back(traceePtr<timespec>((timespec*)t.arg5()), &timeout);
+  }
+  t.readTraceeBatch(io, s.traceePid);
+
+  bool zeroTimeout = timeout.tv_sec == 0 && timeout.tv_nsec == 0;
+  bool handledTrue = true;
+  selectFromTracer(gs, s, t, sched, sets, zeroTimeout, false, handledTrue);
+  s.selectSets.release();
+  return handledTrue;
 }
 
 void pselect6SystemCall::handleDetPost(
@@ -1522,19 +2677,113 @@ void pselect6SystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+/**
+ * poll() from the tracer, see selectFromTracer. fds are read in one batch and
+ * their revents, eventsInTracer masked by what was asked for, written back.
+ * @return whether the system call is taken care of.
+ */
+static bool pollFromTracer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int timeout,
+    bool& handledTrue) {
+  auto ptr = traceePtr<struct pollfd>((struct pollfd*)t.arg1());
+  int nfds = (int)t.arg2();
+  if (ptr.ptr == nullptr || nfds <= 0 || nfds > FD_SETSIZE) {
+    return false;
+  }
+  vector<struct pollfd> fds(nfds);
+  vector<traceeIo> io{traceeIo(ptr, fds.data(), nfds * sizeof(fds[0]))};
+  t.readTraceeBatch(io, s.traceePid);
+
+  int count = 0;
+  vector<waitReason> reasons;
+  for (auto& pfd : fds) {
+    pfd.revents = 0;
+    if (pfd.fd < 0) {
+      continue;
+    }
+    int events = eventsInTracer(s, pfd.fd);
+    if (events == -1) {
+      return false;
+    }
+    // POLLHUP and POLLERR are reported whether asked for or not.
+    pfd.revents = events & (pfd.events | POLLHUP | POLLERR);
+    count += pfd.revents != 0;
+    addPipeReadyReasons(
+        s, pfd.fd, pfd.events & POLLIN, pfd.events & POLLOUT, reasons);
+  }
+
+  if (count > 0 || timeout == 0) {
+    t.writeTraceeBatch(io, s.traceePid);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "%d fds ready, answered by the tracer\n",
+        count);
+    gs.pollsInTracer++;
+    s.readDeferrals = 0;
+    s.originalArg3 = 0;
+    s.pollBackoff = 1;
+    sched.cancelTimer(s.traceePid);
+    handledTrue = finishInPreHook(gs, s, t, count);
+    return true;
+  }
+  // A finite timeout is left to the replays, which know when it is up.
+  if (timeout > 0 || reasons.empty() ||
+      s.readDeferrals >= state::maxReadDeferrals) {
+    s.readDeferrals = 0;
+    return false;
+  }
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "Nothing ready, holding the tracee until one of %zu events\n",
+      reasons.size());
+  s.readDeferrals++;
+  s.deferredPreHook = true;
+  gs.emptyPollRetries++;
+  handledTrue = false;
+  sched.preemptAndWaitForAny(reasons, 0);
+  return true;
+}
+
 bool pollSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // A replay has our zero timeout in arg3, the tracee's is kept.
+  int timeout = s.originalArg3 != 0 ? (int)s.originalArg3 : (int)t.arg3();
+  bool handledTrue;
+  if (pollFromTracer(gs, s, t, sched, timeout, handledTrue)) {
+    return handledTrue;
+  }
+
   if (!s.originalArg3 && t.arg3() != 0) s.originalArg3 = t.arg3();
 
   if ((int)s.originalArg3 != 0) {
     t.writeArg3(0);
     s.userDefinedTimeout = true;
 
-    if (s.originalArg3 > 0) s.poll_retry_maximum = s.originalArg3;
   }
   return true;
 }
 
+/**
+ * Events on the pipes among poll's nfds pollfds at fds that could make them
+ * ready, so a poll that found nothing is only retried after one of them.
+ */
+static vector<waitReason> pollReadyReasons(
+    state& s, ptracer& t, traceePtr<struct pollfd> fds, int nfds) {
+  vector<waitReason> reasons;
+  for (int i = 0; i < nfds; i++) {
+    auto pfd = t.readFromTracee(
+        traceePtr<struct pollfd>(fds.ptr + i), s.traceePid);
+    if (pfd.fd >= 0) {
+      addPipeReadyReasons(
+          s, pfd.fd, pfd.events & POLLIN, pfd.events & POLLOUT, reasons);
+    }
+  }
+  return reasons;
+}
+
 void pollSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int timeout = (int)s.originalArg3;
@@ -1544,16 +2793,26 @@ void pollSystemCall::handleDetPost(
 
   if (retval > 0 || rptr.ptr == NULL || nfds == 0 || timeout == 0) {
     s.originalArg3 = 0;
-    s.poll_retry_count = 0;
-    s.poll_retry_maximum = LONG_MAX;
+    s.pollBackoff = 1;
+    sched.cancelTimer(s.traceePid);
     return;
   }
 
-  if (s.poll_retry_count++ < s.poll_retry_maximum) {
-    bool replay = replaySyscallIfBlocked(gs, s, t, sched, 0);
-    if (replay) {
+  auto reasons = pollReadyReasons(s, t, rptr, nfds);
+  if (timeout > 0) {
+    auto duration = chrono::milliseconds(timeout);
+    if (replayUntilTimeout(gs, s, t, sched, duration, reasons)) {
       t.writeArg3(s.originalArg3);
+    } else {
+      s.originalArg3 = 0;
     }
+    return;
+  }
+
+  if (replayPollWhenReady(gs, s, t, sched, reasons)) {
+    t.writeArg3(s.originalArg3);
+  } else {
+    s.originalArg3 = 0;
   }
   return;
 }
@@ -1563,9 +2822,6 @@ void pollSystemCall::handleDetPost(
 // rlimit *old_limit);
 bool prlimit64SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  s.originalArg3 = t.arg3();
-  t.writeArg3(0 /*NULL*/); // suppress attempts to set new limits
-
   // Check if first argument (pid) is non-zero. If so fail.
   // TODO: could also always overwrite first argument with zero
   int pid = (pid_t)t.arg1();
@@ -1576,6 +2832,12 @@ bool prlimit64SystemCall::handleDetPre(
         to_string(pid));
   }
 
+  // Only reading the limits, e.g. getrlimit(3): nothing to put back after.
+  if (t.arg3() == 0) {
+    return false;
+  }
+  s.originalArg3 = t.arg3();
+  t.writeArg3(0 /*NULL*/); // suppress attempts to set new limits
   return true;
 }
 
@@ -1611,26 +2873,341 @@ void prlimit64SystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+/**
+ * Reads and writes on regular files never block, and only come up short at
+ * EOF or on errors, so they need none of the retrying our post-hooks do. Not
+ * while we are already retrying though, that post-hook must restore registers.
+ * The same goes for /dev/zero, and /dev/null where serveDevNull leaves it to
+ * the kernel.
+ */
+static bool isRegularFileIo(globalState& gs, state& s, int fd) {
+  if (!s.firstTrySystemcall || !neverBlocks(s.getFdType(fd))) {
+    return false;
+  }
+  gs.regularFileIo++;
+  return true;
+}
+
+/**
+ * Reads of /dev/null are at EOF and writes take everything: answer them in
+ * the pre-hook, the kernel has nothing to do. fds not open for it, and
+ * buffers outside the address space, get the kernel's EBADF and EFAULT.
+ * @return false if fd isn't /dev/null or the kernel must answer.
+ */
+static bool serveDevNull(
+    globalState& gs, state& s, ptracer& t, int fd, bool write) {
+  const fdInfo& info = s.fdInfoOf(fd);
+  if (!s.firstTrySystemcall || info.type != fdType::devNull ||
+      (info.accessMode != O_RDWR &&
+       info.accessMode != (write ? O_WRONLY : O_RDONLY))) {
+    return false;
+  }
+  // The kernel's access_ok() and MAX_RW_COUNT, on x86-64.
+  const uint64_t userSpaceEnd = 0x7ffffffff000;
+  const uint64_t maxCount = 0x7ffff000;
+  uint64_t buf = t.arg2();
+  uint64_t count = t.arg3();
+  if (count > userSpaceEnd || buf > userSpaceEnd - count) {
+    return false;
+  }
+  gs.devNullIo++;
+  finishInPreHook(gs, s, t, write ? min(count, maxCount) : 0);
+  return true;
+}
+
+/**
+ * Reads of our /dev/random and /dev/urandom never touch the fifos: the tracer
+ * writes the next bytes of gs.devRandomBytes or gs.devUrandomBytes into the
+ * tracee's buffer and the read becomes a noop returning how many it wrote.
+ * @return false if fd isn't one of them.
+ */
+static bool serveRandomRead(globalState& gs, state& s, ptracer& t, int fd) {
+  fdType type = s.getFdType(fd);
+  if (type != fdType::devRandom && type != fdType::devUrandom) {
+    return false;
+  }
+  randomByteStream& stream =
+      type == fdType::devRandom ? gs.devRandomBytes : gs.devUrandomBytes;
+
+  const size_t chunkSize = 256 * 1024;
+  uint8_t* traceeBuffer = (uint8_t*)t.arg2();
+  size_t count = t.arg3();
+  uint8_t* chunk = gs.scratch.allocate<uint8_t>(std::min(count, chunkSize));
+  size_t written = 0;
+  while (written < count) {
+    size_t bytes = std::min(count - written, chunkSize);
+    stream.read(chunk, bytes);
+    iovec local = {chunk, bytes};
+    iovec remote = {traceeBuffer + written, bytes};
+    ssize_t done = process_vm_writev(t.getPid(), &local, 1, &remote, 1, 0);
+    t.writeVmCalls++;
+    if (done > 0) {
+      written += done;
+    }
+    if (done != (ssize_t)bytes) {
+      break;
+    }
+  }
+
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Served %zu bytes of /dev/[u]random\n",
+      written);
+  gs.devRandomReads++;
+  gs.devRandomBytesRead += written;
+  gs.publishRandomPositions();
+  replaceSystemCallWithNoop(
+      gs, s, t, written == 0 && count != 0 ? -EFAULT : (int64_t)written);
+  return true;
+}
+
+/**
+ * Reads of eventfds we hold a duplicate of are done by the tracer. A set
+ * counter is read through our duplicate and its value written into the
+ * tracee's buffer, the read becoming a noop. Otherwise a non blocking read
+ * fails with EAGAIN, and a blocking one keeps the tracee parked in its
+ * pre-hook until a write to the eventfd wakes it, see writeSystemCall: workers
+ * of a thread pool waiting for work wake in the order it is posted, and no
+ * read runs just to be replayed.
+ * @return false if the kernel should do the read: fd isn't one of them, or
+ * the buffer is too short for the counter. s.deferredPreHook is set if the
+ * tracee was parked.
+ */
+static bool serveEventfdRead(
+    globalState& gs, state& s, ptracer& t, scheduler& sched, int fd) {
+  const shared_ptr<eventfdInfo>& eventfd = s.fdInfoOf(fd).eventfd;
+  if (eventfd == nullptr || t.arg3() < sizeof(uint64_t)) {
+    return false;
+  }
+
+  struct pollfd pfd = {eventfd->ourFd, POLLIN, 0};
+  if (poll(&pfd, 1, 0) > 0) {
+    // EFD_SEMAPHORE is on the open file description, our read honours it.
+    uint64_t value;
+    if (read(eventfd->ourFd, &value, sizeof(value)) != sizeof(value)) {
+      return false;
+    }
+    iovec local = {&value, sizeof(value)};
+    iovec remote = {(void*)t.arg2(), sizeof(value)};
+    ssize_t done = process_vm_writev(t.getPid(), &local, 1, &remote, 1, 0);
+    t.writeVmCalls++;
+    if (done != sizeof(value)) {
+      // Nobody else could read it meanwhile, putting it back never blocks.
+      (void)!write(eventfd->ourFd, &value, sizeof(value));
+      replaceSystemCallWithNoop(gs, s, t, -EFAULT);
+      return true;
+    }
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Served %" PRIu64 " of eventfd %d\n", value,
+        fd);
+    gs.eventfdReads++;
+    // Room for writers waiting in poll.
+    if (sched.hasWaiters(waitKind::eventfd)) {
+      sched.wake(waitKind::eventfd, eventfd->id);
+    }
+    replaceSystemCallWithNoop(gs, s, t, sizeof(value));
+    return true;
+  }
+
+  // The tracee's own flags: we share its open file description.
+  int flags = fcntl(eventfd->ourFd, F_GETFL);
+  if (flags == -1) {
+    return false;
+  }
+  if ((flags & O_NONBLOCK) != 0) {
+    replaceSystemCallWithNoop(gs, s, t, -EAGAIN);
+    return true;
+  }
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Eventfd %d is empty, waiting for a write\n",
+      fd);
+  gs.eventfdWaits++;
+  s.deferredPreHook = true;
+  sched.preemptAndWaitFor(waitReason{waitKind::eventfd, eventfd->id});
+  return true;
+}
+
+/** Most bytes one read of a remote socket gets from serveSocketRead. */
+static const size_t socketReadLimit = 1024 * 1024;
+
+/**
+ * Read a blocking read or recvfrom of a remote stream socket from the tracer,
+ * through our duplicate of the socket, straight into the tracee's buffer,
+ * instead of letting the kernel hand out whatever arrived and replaying for
+ * the rest. The tracee gets min(count, socketReadLimit) bytes, fewer only at
+ * EOF or on an error, however the data trickles in. The limit bounds how long
+ * one read keeps everybody waiting and how much we push at a tracee that
+ * asked for a lot; the kernel's socket buffer holds the rest, so the peer is
+ * slowed down by TCP as usual and poll keeps seeing the socket readable.
+ *
+ * The system call itself is turned into one failing with EBADF, its post-hook
+ * returns what we read, see finishSocketRead.
+ * @return false if the kernel should do the read, e.g. we can't duplicate the
+ * socket.
+ */
+static bool serveSocketRead(
+    globalState& gs, state& s, ptracer& t, int fd, char* buffer, size_t count) {
+  if (!gs.tracerSocketReads || !s.fd_is_remote(fd) ||
+      fd_is_nonblocking(s, fd) || count == 0) {
+    return false;
+  }
+
+  const size_t chunkSize = 256 * 1024;
+  size_t wanted = std::min(count, socketReadLimit);
+  char* chunk = gs.scratch.allocate<char>(std::min(wanted, chunkSize));
+  size_t got = 0;
+  int64_t result = 0;
+  while (got < wanted) {
+    ssize_t bytes = s.readProbe->receive(
+        s.traceePid, fd, chunk, std::min(wanted - got, chunkSize));
+    if (bytes == -1 && errno == EBADF && got == 0) {
+      return false;
+    }
+    if (bytes <= 0) {
+      result = bytes == 0 ? 0 : -errno;
+      break;
+    }
+    t.writeTraceeBatch(
+        {traceeIo(traceePtr<char>(buffer + got), chunk, bytes)}, s.traceePid);
+    got += bytes;
+  }
+
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Read %zu bytes of remote socket %d\n", got,
+      fd);
+  gs.tracerSocketBytes += got;
+  s.socketReadServed = true;
+  // An error after some bytes is for the next read, like the kernel does.
+  s.socketReadResult = got > 0 ? (int64_t)got : result;
+  s.originalArg1 = t.arg1();
+  t.writeArg1((uint64_t)-1);
+  return true;
+}
+
+/** Post-hook of a read serveSocketRead did. */
+static void finishSocketRead(ptracer& t, state& s) {
+  s.socketReadServed = false;
+  t.writeArg1(s.originalArg1);
+  t.setReturnRegister(s.socketReadResult);
+}
+
 bool readSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int fd = t.arg1();
 
-  gs.log.writeToLog(Importance::info, "File descriptor: %d\n", t.arg1());
-  gs.log.writeToLog(
-      Importance::info, "non-blocking: %d\n", (int)fd_is_nonblocking(s, fd));
-  gs.log.writeToLog(Importance::info, "Bytes to read %d\n", t.arg3());
+  DETTRACE_LOG(gs.log, Importance::info, "File descriptor: %d\n", t.arg1());
+  DETTRACE_LOG(
+      gs.log, Importance::info, "non-blocking: %d\n",
+      (int)fd_is_nonblocking(s, fd));
+  DETTRACE_LOG(gs.log, Importance::info, "Bytes to read %d\n", t.arg3());
+
+  if (serveDevNull(gs, s, t, fd, false)) {
+    return true;
+  }
+  if (isRegularFileIo(gs, s, fd)) {
+    return false;
+  }
+  if (s.firstTrySystemcall && serveRandomRead(gs, s, t, fd)) {
+    return true;
+  }
+  if (gs.lite) {
+    return false;
+  }
+  if (s.firstTrySystemcall && serveEventfdRead(gs, s, t, sched, fd)) {
+    return !s.deferredPreHook;
+  }
+  if (s.firstTrySystemcall &&
+      serveSocketRead(gs, s, t, fd, (char*)t.arg2(), t.arg3())) {
+    return true;
+  }
+
+  // Blocking read on one of our (secretly non blocking) pipes. If there is
+  // nothing to read, don't bother running it just to replay it: keep the tracee
+  // stopped here and try again when it is scheduled next.
+  if (s.countFdStatus(fd) != 0 &&
+      s.getFdStatus(fd) == descriptorType::blocking &&
+      s.readDeferrals < state::maxReadDeferrals &&
+      s.readProbe->probe(s.traceePid, fd) == readinessProbe::result::empty) {
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Pipe is empty, read would block.\n");
+    s.readDeferrals++;
+    s.deferredPreHook = true;
+    gs.readRetryEvents++;
+    gs.readProbeDeferrals++;
+    sched.preemptAndWaitFor(
+        waitReason{waitKind::pipeReadable, pipeKeyFor(s, fd)});
+    return false;
+  }
+  s.readDeferrals = 0;
+
+  return true;
+}
+
+/**
+ * Finish a short read on one of our secretly non blocking pipes from the
+ * tracer: read what the pipe holds through our duplicate and put it straight
+ * into the tracee's buffer, instead of one replay per pipe buffer. The tracee
+ * still sees one read of the full count, or up to EOF.
+ * @return true if the read is complete, otherwise s.totalBytes counts what we
+ * did read and the tracee has to replay for the rest.
+ */
+static bool completeReadInTracer(
+    globalState& gs, state& s, ptracer& t, scheduler& sched, int fd) {
+  if (s.countFdStatus(fd) == 0 ||
+      s.getFdStatus(fd) != descriptorType::blocking) {
+    return false;
+  }
 
-  return true;
+  const struct user_regs_struct& beforeRetry = s.beforeRetry.get();
+  const size_t chunkSize = 256 * 1024;
+  char* chunk = gs.scratch.allocate<char>(
+      std::min<size_t>(beforeRetry.rdx - s.totalBytes, chunkSize));
+  size_t drained = 0;
+  bool complete = false;
+  while (s.totalBytes < beforeRetry.rdx) {
+    size_t wanted =
+        std::min<size_t>(beforeRetry.rdx - s.totalBytes, chunkSize);
+    ssize_t bytes = s.readProbe->drain(s.traceePid, fd, chunk, wanted);
+    if (bytes <= 0) {
+      // EOF completes the read too, anything else is left to the tracee.
+      complete = bytes == 0;
+      break;
+    }
+    char* destination = (char*)beforeRetry.rsi + s.totalBytes;
+    t.writeTraceeBatch(
+        {traceeIo(traceePtr<char>(destination), chunk, bytes)},
+        s.traceePid);
+    s.totalBytes += bytes;
+    drained += bytes;
+  }
+
+  if (drained > 0) {
+    gs.tracerPipeBytes += drained;
+    if (sched.hasWaiters(waitKind::pipeWritable)) {
+      ino_t inode = pipeKeyFor(s, fd);
+      if (inode != 0) {
+        sched.wake(waitKind::pipeWritable, inode);
+      }
+    }
+    pipeReceived(gs, s, sched, fd, pipeKeyFor(s, fd));
+  }
+  return complete || s.totalBytes == beforeRetry.rdx;
 }
 
 void readSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (s.socketReadServed) {
+    finishSocketRead(t, s);
+    return;
+  }
   int fd = t.arg1();
   auto resetState = [&]() {
     // Restore user regs so that it appears as if only one syscall occurred
     t.setReturnRegister(s.totalBytes);
-    t.writeArg2(s.beforeRetry.rsi);
-    t.writeArg3(s.beforeRetry.rdx);
+    if (s.beforeRetry.active()) {
+      t.writeArg2(s.beforeRetry.get().rsi);
+      t.writeArg3(s.beforeRetry.get().rdx);
+      s.beforeRetry.release();
+    }
 
     // reset for next syscall that we may have to retry
     s.firstTrySystemcall = true;
@@ -1638,17 +3215,39 @@ void readSystemCall::handleDetPost(
   };
 
   if (s.fd_is_timerfd(fd)) {
+    // The kernel's timer never goes off, see timerfd_settime: anything but
+    // EAGAIN is for bad arguments.
+    if ((int64_t)t.getReturnValue() != -EAGAIN) {
+      resetState();
+      return;
+    }
+    timerfdInfo info = s.fdInfoOf(fd).timer;
+    logicalTimers::timerKey key{timerKind::timerfd, info.timer};
+    uint64_t expirations = s.timers.write().expire(key, s.getLogicalTime());
+    if (expirations == 0 && !info.nonBlocking && s.timers->armed(key)) {
+      // Wait for it in logical time, with whoever else nothing wakes.
+      auto timeout = s.timers->expiry(key) - s.getLogicalTime();
+      if (replayUntilTimeout(gs, s, t, sched, timeout, {}, false)) {
+        return;
+      }
+      expirations = s.timers.write().expire(key, s.getLogicalTime());
+    }
+    if (expirations == 0) {
+      resetState();
+      t.setReturnRegister((uint64_t)-EAGAIN);
+      return;
+    }
     t.writeToTracee(
-        traceePtr<unsigned long>((unsigned long*)t.arg2()), 1UL, s.traceePid);
-    s.totalBytes = sizeof(unsigned long);
+        traceePtr<uint64_t>((uint64_t*)t.arg2()), expirations, s.traceePid);
+    s.totalBytes = sizeof(uint64_t);
     resetState();
-    sched.preemptAndScheduleNext();
     return;
   } else if (
       s.countFdStatus(fd) != 0 &&
       s.getFdStatus(fd) == descriptorType::nonBlocking) {
     // Pipe exists in our map and it's set to non blocking.
-    gs.log.writeToLog(Importance::info, "read found with non blocking pipe!\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info, "read found with non blocking pipe!\n");
     int retval = t.getReturnValue();
 
     // for non-blocking io, if it returns -EAGAIN on the 1st try, let it through
@@ -1666,7 +3265,13 @@ void readSystemCall::handleDetPost(
       return;
     }
   } else {
-    bool preemptAndTryLater = replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
+    // Nothing to read until someone writes to this pipe.
+    waitReason reason{waitKind::pipeReadable, 0};
+    if (t.getReturnValue() == -EAGAIN) {
+      reason.key = pipeKeyFor(s, fd);
+    }
+    bool preemptAndTryLater = replaySyscallIfBlocked(
+        gs, s, t, sched, EAGAIN, reason.key != 0 ? &reason : nullptr);
     if (preemptAndTryLater) {
       gs.readRetryEvents++;
       return;
@@ -1675,10 +3280,22 @@ void readSystemCall::handleDetPost(
 
   ssize_t bytes_read = t.getReturnValue();
   if (bytes_read < 0) {
-    gs.log.writeToLog(Importance::info, "Returned negative: %d.", bytes_read);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Returned negative: %d.", bytes_read);
     return;
   }
 
+  // We made room in the pipe, writers waiting on it may go ahead.
+  if (bytes_read > 0 && sched.hasWaiters(waitKind::pipeWritable)) {
+    ino_t inode = pipeKeyFor(s, fd);
+    if (inode != 0) {
+      sched.wake(waitKind::pipeWritable, inode);
+    }
+  }
+  if (bytes_read > 0) {
+    pipeReceived(gs, s, sched, fd, 0);
+  }
+
   if (bytes_read > 0) {
     // This operation is very expensive!
     // char buffer[bytes_read];
@@ -1694,20 +3311,24 @@ void readSystemCall::handleDetPost(
   s.totalBytes += bytes_read;
 
   if (s.firstTrySystemcall) {
-    gs.log.writeToLog(Importance::info, "First time seeing this read!\n");
+    DETTRACE_LOG(gs.log, Importance::info, "First time seeing this read!\n");
     s.firstTrySystemcall = false;
-    s.beforeRetry = t.getRegs();
+    s.beforeRetry.get() = t.getRegs();
   }
 
   // EOF, or read returned everything we asked for.
+  const struct user_regs_struct beforeRetry = s.beforeRetry.get();
   if (bytes_read == 0 || // EOF
-      s.totalBytes == s.beforeRetry.rdx) { // original bytes requested
-    gs.log.writeToLog(Importance::info, "EOF or read all bytes.\n");
+      s.totalBytes == beforeRetry.rdx) { // original bytes requested
+    DETTRACE_LOG(gs.log, Importance::info, "EOF or read all bytes.\n");
+    resetState();
+  } else if (completeReadInTracer(gs, s, t, sched, fd)) {
+    DETTRACE_LOG(gs.log, Importance::info, "Read the rest ourselves.\n");
     resetState();
   } else {
-    gs.log.writeToLog(Importance::info, "Got less bytes than requested.\n");
-    t.writeArg2(t.arg2() + bytes_read);
-    t.writeArg3(t.arg3() - bytes_read);
+    DETTRACE_LOG(gs.log, Importance::info, "Got less bytes than requested.\n");
+    t.writeArg2(beforeRetry.rsi + s.totalBytes);
+    t.writeArg3(beforeRetry.rdx - s.totalBytes);
 
     replaySystemCall(gs, t, t.getSystemCallNumber());
   }
@@ -1729,35 +3350,283 @@ bool readlinkSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
 
-  return false;
+  return answerReadlink(
+      gs, s, t, traceePtr<char>((char*)t.arg1()), t.arg2(), t.arg3());
+}
+
+void readlinkSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[0], gs.log, s.traceePid, t);
 }
 
 void readlinkSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  runtimeError("readlink post-hook should never be called.");
+  return;
 }
 // =======================================================================================
 bool readlinkatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t);
 
-  return false;
+  // Only absolute paths are answered, dirfd doesn't matter.
+  return answerReadlink(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg3(), t.arg4());
+}
+
+void readlinkatSystemCall::handleNotify(
+    globalState& gs, state& s, ptracer& t, seccompNotification& n) {
+  printInfoString(n.args[1], gs.log, s.traceePid, t);
 }
 
 void readlinkatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  runtimeError("readlinkat post-hook should never be called.");
+  return;
 }
+// =======================================================================================
+/** fd was closed, drop what we keep about it. */
+static void forgetFd(globalState& gs, state& s, int fd) {
+  s.readProbe->forget(fd);
+  // Remove entry from our dirEntries.
+  s.dirStamps.erase(fd);
+  // Exists.
+  if (s.dirEntries->count(fd) != 0) {
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Removing directory entries for fd: %d!\n",
+        fd);
+    s.dirEntries.erase(fd);
+  }
+
+  if (s.paths->cachesFd(fd)) {
+    s.paths.write().forgetFd(fd);
+  }
 
+  // Remove its slot in our fd table.
+  const fdInfo& info = s.fdInfoOf(fd);
+  if (info.known()) {
+    if (info.tracksBlocking) {
+      DETTRACE_LOG(gs.log, Importance::info, "Removing pipe fd: %d!\n", fd);
+    }
+    bool timerfd = info.timerfd;
+    uint64_t timer = info.timer.timer;
+    s.fds.write().close(fd);
+    // The timer goes with the last of its dups.
+    if (timerfd && !s.fds->timerHeld(timer)) {
+      s.timers.erase(logicalTimers::timerKey{timerKind::timerfd, timer});
+    }
+  }
+  // Fds closed while in an interest set stay there: they no longer count as
+  // pipes, so epoll_wait on it falls back to retrying.
+  s.epollInterests.erase(fd);
+}
+// =======================================================================================
 static bool fd_is_nonblocking(state& s, int fd) {
-  auto it = s.fdStatus.get()->find(fd);
-  auto end = s.fdStatus.get()->end();
-  if (it != end) {
-    return it->second == descriptorType::nonBlocking;
+  const fdInfo& info = s.fdInfoOf(fd);
+  return info.tracksBlocking && info.blocking == descriptorType::nonBlocking;
+}
+
+// =======================================================================================
+/** Whether fd is one of our secretly non blocking pipes or socketpairs. */
+static bool fd_is_blocking_pipe(state& s, int fd) {
+  return s.countFdStatus(fd) != 0 &&
+      s.getFdStatus(fd) == descriptorType::blocking;
+}
+
+/**
+ * The fds the SCM_RIGHTS messages in the control data of msg, a msghdr of the
+ * tracee's, pass. Empty if there are none, or too much control data to look.
+ */
+static vector<int> rightsOf(
+    globalState& gs, state& s, ptracer& t, const struct msghdr& msg) {
+  const size_t maxControl = 64 * 1024;
+  vector<int> fds;
+  if (msg.msg_control == nullptr ||
+      msg.msg_controllen < sizeof(struct cmsghdr) ||
+      msg.msg_controllen > maxControl) {
+    return fds;
+  }
+  char* control = gs.scratch.allocate<char>(msg.msg_controllen);
+  t.readTraceeBatch(
+      {traceeIo(
+          traceePtr<char>((char*)msg.msg_control), control,
+          msg.msg_controllen)},
+      s.traceePid);
+
+  struct msghdr local = msg;
+  local.msg_control = control;
+  char* end = control + msg.msg_controllen;
+  for (struct cmsghdr* c = CMSG_FIRSTHDR(&local); c != nullptr;
+       c = CMSG_NXTHDR(&local, c)) {
+    if (c->cmsg_len > (size_t)(end - (char*)c)) {
+      break;
+    }
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      const int* passed = (const int*)CMSG_DATA(c);
+      fds.insert(
+          fds.end(), passed,
+          passed + (c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    }
+  }
+  return fds;
+}
+
+/**
+ * Post-hook of a send of fd that sent something: readers of the socketpair
+ * it is an end of may go ahead, and what we know of the fds its SCM_RIGHTS
+ * messages pass waits in gs.fdsInFlight for the other end's recvmsg.
+ */
+static void pairSent(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int fd,
+    const struct msghdr* msg) {
+  socketPairEnd end = s.fdInfoOf(fd).socketPair;
+  if (end.inode == 0) {
+    return;
+  }
+  if (sched.hasWaiters(waitKind::pipeReadable)) {
+    sched.wake(waitKind::pipeReadable, end.key());
+  }
+  pipeSent(gs, s, fd, end.key());
+
+  vector<int> fds;
+  if (msg != nullptr && !(fds = rightsOf(gs, s, t, *msg)).empty()) {
+    vector<fdInfo> passed;
+    for (int passedFd : fds) {
+      fdInfo info = s.fdInfoOf(passedFd);
+      // Its timer is in our timers, it goes to the kernel over there.
+      info.timerfd = false;
+      info.timer = timerfdInfo();
+      passed.push_back(info);
+    }
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Passing %zu fds over socketpair %lu\n",
+        fds.size(), (unsigned long)end.key());
+    gs.fdsInFlight[end.peer].push_back(passed);
+  }
+}
+
+/**
+ * A send on fd, if it is one of our secretly non blocking socketpairs and the
+ * tracee asked to block, works like a write on a pipe: it waits for room and
+ * replays if it found none, and one that came up short is finished from the
+ * tracer, see writeRestInTracer. sent is what was to be sent, in order.
+ * @return whether the send is replayed.
+ */
+static bool finishPairSend(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int fd,
+    int flags,
+    const vector<pair<uint64_t, uint64_t>>& sent) {
+  if (!fd_is_blocking_pipe(s, fd) || (flags & MSG_DONTWAIT) != 0) {
+    return false;
+  }
+  waitReason reason{waitKind::pipeWritable, pipeKeyFor(s, fd)};
+  if (replaySyscallIfBlocked(
+          gs, s, t, sched, EAGAIN, reason.key != 0 ? &reason : nullptr)) {
+    gs.writeRetryEvents++;
+    return true;
+  }
+
+  int64_t written = t.getReturnValue();
+  if (written <= 0) {
+    return false;
+  }
+  vector<pair<uint64_t, uint64_t>> rest;
+  uint64_t skip = written;
+  for (auto& buffer : sent) {
+    if (skip >= buffer.second) {
+      skip -= buffer.second;
+      continue;
+    }
+    rest.emplace_back(buffer.first + skip, buffer.second - skip);
+    skip = 0;
+  }
+  if (!rest.empty()) {
+    uint64_t more = writeRestInTracer(gs, s, t, sched, fd, rest);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Sent %lu more bytes ourselves.\n", more);
+    t.setReturnRegister(written + more);
+  }
+  return false;
+}
+
+/**
+ * A receive on fd, if it is one of our secretly non blocking socketpairs and
+ * the tracee asked to block, waits for data and replays if it found none.
+ * @return whether the receive is replayed.
+ */
+static bool waitPairReceive(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int fd,
+    int flags) {
+  if (!fd_is_blocking_pipe(s, fd) || (flags & MSG_DONTWAIT) != 0) {
+    return false;
+  }
+  waitReason reason{waitKind::pipeReadable, pipeKeyFor(s, fd)};
+  if (replaySyscallIfBlocked(
+          gs, s, t, sched, EAGAIN, reason.key != 0 ? &reason : nullptr)) {
+    gs.readRetryEvents++;
+    return true;
   }
   return false;
 }
 
+/**
+ * Post-hook of a receive of fd that got something: writers of the socketpair
+ * it is an end of may go ahead, and the fds msg's SCM_RIGHTS messages got, if
+ * any, take what the sender knew of them, see pairSent.
+ */
+static void pairReceived(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int fd,
+    const struct msghdr* msg,
+    int flags) {
+  socketPairEnd end = s.fdInfoOf(fd).socketPair;
+  if (end.inode == 0) {
+    return;
+  }
+  if (sched.hasWaiters(waitKind::pipeWritable)) {
+    sched.wake(waitKind::pipeWritable, end.key());
+  }
+  pipeReceived(gs, s, sched, fd, end.key());
+
+  vector<int> fds;
+  if (msg == nullptr || (fds = rightsOf(gs, s, t, *msg)).empty()) {
+    return;
+  }
+  auto inFlight = gs.fdsInFlight.find(end.inode);
+  if (inFlight == gs.fdsInFlight.end()) {
+    return;
+  }
+  // Fds that didn't fit (MSG_CTRUNC) were closed.
+  const vector<fdInfo>& passed = inFlight->second.front();
+  for (size_t i = 0; i < fds.size() && i < passed.size(); i++) {
+    s.readProbe->forget(fds[i]);
+    s.fds.write().received(fds[i], passed[i]);
+  }
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Received %zu fds over socketpair %lu\n",
+      fds.size(), (unsigned long)end.key());
+  // A peek gets them too, and leaves them for the next receive.
+  if ((flags & MSG_PEEK) == 0) {
+    inFlight->second.pop_front();
+    if (inFlight->second.empty()) {
+      gs.fdsInFlight.erase(inFlight);
+    }
+  }
+}
+
 // =======================================================================================
 bool recvmsgSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -1765,16 +3634,29 @@ bool recvmsgSystemCall::handleDetPre(
   int fd = (int)t.arg1();
   bool nonblock =
       (flags & MSG_DONTWAIT) == MSG_DONTWAIT || fd_is_nonblocking(s, fd);
-  gs.log.writeToLog(
-      Importance::info, "recvmsg from fd " + to_string(t.arg1()) +
-                            ", nonblock: " + to_string(nonblock) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "recvmsg from fd " + to_string(t.arg1()) +
+          ", nonblock: " + to_string(nonblock) + "\n");
   return true;
 }
 
 void recvmsgSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  if (!fd_is_nonblocking(s, (int)t.arg1())) {
+  int fd = (int)t.arg1();
+  int flags = (int)t.arg3();
+  if (s.fdInfoOf(fd).socketPair.inode != 0) {
+    if (waitPairReceive(gs, s, t, sched, fd, flags)) {
+      return;
+    }
+  } else if (!fd_is_nonblocking(s, fd)) {
     replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
+    return;
+  }
+  if ((int64_t)t.getReturnValue() >= 0) {
+    struct msghdr msg = t.readFromTracee(
+        traceePtr<struct msghdr>((struct msghdr*)t.arg2()), s.traceePid);
+    pairReceived(gs, s, t, sched, fd, &msg, flags);
   }
 }
 
@@ -1783,13 +3665,16 @@ bool renameSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t, " old path: ");
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " new path: ");
-  return true;
+  return preRename(
+      gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD,
+      traceePtr<char>((char*)t.arg2()), AT_FDCWD, false);
 }
 
 void renameSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  if (t.getReturnValue() == 0) {
+    gs.hostPaths.invalidateAll();
+  }
   return;
 }
 // =======================================================================================
@@ -1797,43 +3682,61 @@ bool renameatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " renaming-ing path: ");
   printInfoString(t.arg4(), gs.log, s.traceePid, t, " to path: ");
-  return true;
+  return preRename(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1(),
+      traceePtr<char>((char*)t.arg4()), t.arg3(), false);
 }
 
 void renameatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  if (t.getReturnValue() == 0) {
+    gs.hostPaths.invalidateAll();
+  }
 }
 // =======================================================================================
 bool renameat2SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " renaming-ing path: ");
   printInfoString(t.arg4(), gs.log, s.traceePid, t, " to path: ");
-  return true;
+  return preRename(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1(),
+      traceePtr<char>((char*)t.arg4()), t.arg3(),
+      (t.arg5() & RENAME_EXCHANGE) != 0);
 }
 
 void renameat2SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  if (t.getReturnValue() == 0) {
+    gs.hostPaths.invalidateAll();
+  }
 }
 // =======================================================================================
 bool rmdirSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  noteUnlink(gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, true);
+  // A directory made again at its path is another one.
+  gs.missing.clear();
+  if (gs.pathUpdatesInPreHooks) {
+    gs.hostPaths.invalidateAll();
+    return gs.log.isEnabled(Importance::info);
+  }
   return true;
 }
 
 void rmdirSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  if (t.getReturnValue() == 0) {
+    gs.hostPaths.invalidateAll();
+  }
 }
 
 bool rt_sigprocmaskSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  // The kernel keeps the mask and we read it back from /proc when we need it,
+  // so only the unmask rt_sigsuspend injected has anything left to do: putting
+  // the old mask back.
+  return s.syscallInjected;
 }
 
 void rt_sigprocmaskSystemCall::handleDetPost(
@@ -1864,8 +3767,8 @@ struct kernel_sigaction {
 };
 bool rt_sigactionSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "rt_sigaction pre-hook for signal " + to_string(t.arg1()) + "\n");
   const uint64_t signum = t.arg1();
   s.requestedSignalToHandle = signum;
@@ -1879,12 +3782,12 @@ bool rt_sigactionSystemCall::handleDetPre(
   struct kernel_sigaction sa = t.readFromTracee(
       traceePtr<struct kernel_sigaction>((struct kernel_sigaction*)t.arg2()),
       t.getPid());
-  gs.log.writeToLog(Importance::info, "struct sigaction*: %p\n", t.arg2());
-  gs.log.writeToLog(
-      Importance::info, "sa_flags: " + to_string(sa.sa_flags) + " " +
-                            to_string(SA_RESETHAND) + " \n");
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(gs.log, Importance::info, "struct sigaction*: %p\n", t.arg2());
+  DETTRACE_LOG(
+      gs.log, Importance::info, "sa_flags: " + to_string(sa.sa_flags) + " " +
+                                    to_string(SA_RESETHAND) + " \n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "sa_handler: " + to_string((uint64_t)sa.sa_handler__) + "\n");
 
   if (((unsigned long)SIG_IGN) == sa.sa_handler__) {
@@ -1900,9 +3803,10 @@ bool rt_sigactionSystemCall::handleDetPre(
       s.requestedSignalHandler = SIGHANDLER_CUSTOM;
     }
   }
-  gs.log.writeToLog(
-      Importance::info, "signal " + to_string(signum) + " handler requested: " +
-                            to_string(s.requestedSignalHandler) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "signal " + to_string(signum) + " handler requested: " +
+          to_string(s.requestedSignalHandler) + "\n");
 
   // run the post-hook to see if signal handler installation was successful
   return true;
@@ -1910,14 +3814,14 @@ bool rt_sigactionSystemCall::handleDetPre(
 
 void rt_sigactionSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "rt_sigaction post-hook\n");
+  DETTRACE_LOG(gs.log, Importance::info, "rt_sigaction post-hook\n");
   if (0 == t.getReturnValue()) {
     // signal handler installation was successful
-    s.currentSignalHandlers.get()->insert(
+    s.currentSignalHandlers.write().insert(
         {s.requestedSignalToHandle, s.requestedSignalHandler});
 
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "signal " + to_string(s.requestedSignalToHandle) + " handler of type " +
             to_string(s.requestedSignalHandler) + " installed\n");
 
@@ -1978,8 +3882,8 @@ bool rt_sigtimedwaitSystemCall::handleDetPre(
   if (timeoutPtr == nullptr) {
     // Has to be created in memory.
     struct timespec* newAddr = (struct timespec*)s.mmapMemory.getAddr().ptr;
-    t.writeToTracee(
-        traceePtr<struct timespec>(newAddr), ourTimeout, s.traceePid);
+    s.mmapMemory.write(
+        t, traceePtr<struct timespec>(newAddr), ourTimeout, s.traceePid);
 
     t.writeArg3((uint64_t)newAddr);
   } else {
@@ -2002,11 +3906,11 @@ void rt_sigtimedwaitSystemCall::handleDetPost(
 
   replay = replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
   if (replay) {
-    gs.log.writeToLog(Importance::info, "replay rt_sigtimedwait\n");
+    DETTRACE_LOG(gs.log, Importance::info, "replay rt_sigtimedwait\n");
     t.writeArg3(s.originalArg3);
   } else {
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "rt_sigtimedwait returned: " + to_string(retval) + "\n");
     if (s.syscallInjected) {
       if (retval > 0) {
@@ -2028,7 +3932,7 @@ bool rt_sigsuspendSystemCall::handleDetPre(
   traceePtr<unsigned long> rptr =
       traceePtr<unsigned long>((unsigned long*)t.arg1());
   mask = t.readFromTracee(rptr, t.getPid());
-  gs.log.writeToLog(Importance::info, "rt_sigsuspend, mask = 0x%lx\n", mask);
+  DETTRACE_LOG(gs.log, Importance::info, "rt_sigsuspend, mask = 0x%lx\n", mask);
 
   struct PendingSignalInfo info = {
       0,
@@ -2047,7 +3951,7 @@ bool rt_sigsuspendSystemCall::handleDetPre(
         traceePtr<unsigned long>((unsigned long*)(s.mmapMemory.getAddr().ptr));
     traceePtr<unsigned long> oldset = traceePtr<unsigned long>(
         (unsigned long*)(s.mmapMemory.getAddr().ptr) + 1);
-    t.writeToTracee(set, unmask, t.getPid());
+    s.mmapMemory.write(t, set, unmask, t.getPid());
     t.writeArg1(SIG_UNBLOCK);
     t.writeArg2((uint64_t)set.ptr);
     t.writeArg3((uint64_t)oldset.ptr);
@@ -2074,7 +3978,6 @@ void rt_sigpendingSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {}
 
 // =======================================================================================
-// TODO
 bool sendtoSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return true;
@@ -2082,26 +3985,56 @@ bool sendtoSystemCall::handleDetPre(
 
 void sendtoSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  int fd = (int)t.arg1();
+  if (s.fdInfoOf(fd).socketPair.inode == 0 ||
+      finishPairSend(
+          gs, s, t, sched, fd, (int)t.arg4(), {{t.arg2(), t.arg3()}})) {
+    return;
+  }
+  if ((int64_t)t.getReturnValue() > 0) {
+    pairSent(gs, s, t, sched, fd, nullptr);
+  }
 }
 // =======================================================================================
-// TODO
 bool sendmsgSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info, "sendmsg to fd " + to_string(t.arg1()) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "sendmsg to fd " + to_string(t.arg1()) + "\n");
   return true;
 }
 
 void sendmsgSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  int fd = (int)t.arg1();
+  if (s.fdInfoOf(fd).socketPair.inode == 0) {
+    return;
+  }
+  struct msghdr msg = t.readFromTracee(
+      traceePtr<struct msghdr>((struct msghdr*)t.arg2()), s.traceePid);
+  vector<pair<uint64_t, uint64_t>> sent;
+  if (msg.msg_iovlen > 0 && msg.msg_iovlen <= IOV_MAX) {
+    struct iovec* iov = gs.scratch.allocate<struct iovec>(msg.msg_iovlen);
+    t.readTraceeBatch(
+        {traceeIo(
+            traceePtr<struct iovec>(msg.msg_iov), iov,
+            msg.msg_iovlen * sizeof(struct iovec))},
+        s.traceePid);
+    for (size_t i = 0; i < msg.msg_iovlen; i++) {
+      sent.emplace_back((uint64_t)iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+  if (finishPairSend(gs, s, t, sched, fd, (int)t.arg3(), sent)) {
+    return;
+  }
+  if ((int64_t)t.getReturnValue() > 0) {
+    pairSent(gs, s, t, sched, fd, &msg);
+  }
 }
 
 bool sendmmsgSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info, "sendmmsg to fd " + to_string(t.arg1()) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "sendmmsg to fd " + to_string(t.arg1()) + "\n");
   return true;
 }
 
@@ -2112,35 +4045,115 @@ void sendmmsgSystemCall::handleDetPost(
 
 bool recvfromSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info, "recvfrom fd " + to_string(t.arg1()) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "recvfrom fd " + to_string(t.arg1()) + "\n");
+  // A plain recv of a connected socket is a read.
+  if (!gs.lite && t.arg4() == 0 && t.arg5() == 0) {
+    serveSocketRead(gs, s, t, (int)t.arg1(), (char*)t.arg2(), t.arg3());
+  }
   return true;
 }
 
 void recvfromSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (s.socketReadServed) {
+    finishSocketRead(t, s);
+    return;
+  }
+  int fd = (int)t.arg1();
+  if (s.fdInfoOf(fd).socketPair.inode == 0 ||
+      waitPairReceive(gs, s, t, sched, fd, (int)t.arg4())) {
+    return;
+  }
+  if ((int64_t)t.getReturnValue() > 0) {
+    pairReceived(gs, s, t, sched, fd, nullptr, 0);
+  }
+}
+
+// =======================================================================================
+bool sched_getaffinitySystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  size_t size = t.arg2();
+  traceePtr<unsigned char> maskPtr((unsigned char*)t.arg3());
+  // Like the kernel: the mask must fit every CPU, in whole longs.
+  if (size * 8 < gs.cpus || size % sizeof(long) != 0) {
+    return finishInPreHook(gs, s, t, -EINVAL);
+  }
+  if (maskPtr.ptr == nullptr) {
+    return finishInPreHook(gs, s, t, -EFAULT);
+  }
+  const size_t longBits = 8 * sizeof(long);
+  size_t bytes =
+      min(size, (gs.cpus + longBits - 1) / longBits * sizeof(long));
+  vector<unsigned char> mask(bytes, 0);
+  for (unsigned cpu = 0; cpu < gs.cpus; cpu++) {
+    mask[cpu / 8] |= 1 << (cpu % 8);
+  }
+  t.writeTraceeBatch({traceeIo(maskPtr, mask.data(), bytes)}, s.traceePid);
+  return finishInPreHook(gs, s, t, bytes);
+}
+
+void sched_getaffinitySystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return;
 }
+// =======================================================================================
+bool sched_setaffinitySystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  traceePtr<unsigned char> maskPtr((unsigned char*)t.arg3());
+  if (maskPtr.ptr == nullptr) {
+    return finishInPreHook(gs, s, t, -EFAULT);
+  }
+  // Bits past the CPUs we show don't count, like offline CPUs.
+  size_t bytes = min<size_t>(t.arg2(), (gs.cpus + 7) / 8);
+  vector<unsigned char> mask(bytes, 0);
+  if (bytes != 0) {
+    t.readTraceeBatch({traceeIo(maskPtr, mask.data(), bytes)}, s.traceePid);
+  }
+  for (unsigned cpu = 0; cpu < min<size_t>(gs.cpus, 8 * bytes); cpu++) {
+    if (mask[cpu / 8] & (1 << (cpu % 8))) {
+      return finishInPreHook(gs, s, t, 0);
+    }
+  }
+  return finishInPreHook(gs, s, t, -EINVAL);
+}
 
+void sched_setaffinitySystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return;
+}
 // =======================================================================================
 bool selectSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   // Get the original set structs.
-  // Set them in the state class.
+  // Set them in the state class. All sets are fetched in one batch.
+  selectFdSets& sets = s.selectSets.fresh();
+  vector<traceeIo> fdSets;
   if ((void*)t.arg2() != NULL) {
-    s.rdfsNotNull = true;
-    s.origRdfs =
-        t.readFromTracee(traceePtr<fd_set>((fd_set*)t.arg2()), t.getPid());
+    sets.rdfsNotNull = true;
+    fdSets.emplace_back(traceePtr<fd_set>((fd_set*)t.arg2()), &sets.origRdfs);
   }
   if ((void*)t.arg3() != NULL) {
-    s.wrfsNotNull = true;
-    s.origWrfs =
-        t.readFromTracee(traceePtr<fd_set>((fd_set*)t.arg3()), t.getPid());
+    sets.wrfsNotNull = true;
+    fdSets.emplace_back(traceePtr<fd_set>((fd_set*)t.arg3()), &sets.origWrfs);
   }
   if ((void*)t.arg4() != NULL) {
-    s.exfsNotNull = true;
-    s.origExfs =
-        t.readFromTracee(traceePtr<fd_set>((fd_set*)t.arg4()), t.getPid());
+    sets.exfsNotNull = true;
+    fdSets.emplace_back(traceePtr<fd_set>((fd_set*)t.arg4()), &sets.origExfs);
+  }
+  timeval timeout = {1, 0};
+  if ((void*)t.arg5() != NULL) {
+    fdSets.emplace_back(traceePtr<timeval>((timeval*)t.arg5()), &timeout);
+  }
+  t.readTraceeBatch(fdSets, t.getPid());
+
+  bool zeroTimeout = timeout.tv_sec == 0 && timeout.tv_usec == 0;
+  bool handledTrue;
+  if (selectFromTracer(
+          gs, s, t, sched, sets, zeroTimeout, (void*)t.arg5() == NULL,
+          handledTrue)) {
+    s.selectSets.release();
+    return handledTrue;
   }
 
   // Set the timeout to zero.
@@ -2152,7 +4165,7 @@ bool selectSystemCall::handleDetPre(
   if (timeoutPtr == nullptr) {
     // Has to be created in memory.
     timeval* newAddr = (timeval*)s.mmapMemory.getAddr().ptr;
-    t.writeToTracee(traceePtr<timeval>(newAddr), ourTimeout, s.traceePid);
+    s.mmapMemory.write(t, traceePtr<timeval>(newAddr), ourTimeout, s.traceePid);
 
     t.writeArg5((uint64_t)newAddr);
   } else {
@@ -2169,6 +4182,7 @@ bool selectSystemCall::handleDetPre(
 
 void selectSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  selectFdSets& sets = s.selectSets.get();
   if (s.userDefinedTimeout) {
     s.userDefinedTimeout = false;
     if (t.getReturnValue() == 0) {
@@ -2178,30 +4192,108 @@ void selectSystemCall::handleDetPost(
       sched.preemptAndScheduleNext();
     }
   } else {
-    bool replayed = replaySyscallIfBlocked(gs, s, t, sched, 0);
+    vector<waitReason> reasons;
+    int nfds = (int)t.arg1();
+    for (int fd = 0; fd < nfds && fd < FD_SETSIZE; fd++) {
+      bool readable = sets.rdfsNotNull && FD_ISSET(fd, &sets.origRdfs);
+      bool writable = sets.wrfsNotNull && FD_ISSET(fd, &sets.origWrfs);
+      if (readable || writable) {
+        addPipeReadyReasons(s, fd, readable, writable, reasons);
+      }
+    }
+    bool replayed = replayPollWhenReady(gs, s, t, sched, reasons);
 
     if (replayed) {
-      if (s.rdfsNotNull) {
-        t.writeToTracee(
-            traceePtr<fd_set>((fd_set*)t.arg2()), s.origRdfs, t.getPid());
+      vector<traceeIo> fdSets;
+      if (sets.rdfsNotNull) {
+        fdSets.emplace_back(
+            traceePtr<fd_set>((fd_set*)t.arg2()), &sets.origRdfs);
       }
-      if (s.wrfsNotNull) {
-        t.writeToTracee(
-            traceePtr<fd_set>((fd_set*)t.arg3()), s.origWrfs, t.getPid());
+      if (sets.wrfsNotNull) {
+        fdSets.emplace_back(
+            traceePtr<fd_set>((fd_set*)t.arg3()), &sets.origWrfs);
       }
-      if (s.exfsNotNull) {
-        t.writeToTracee(
-            traceePtr<fd_set>((fd_set*)t.arg4()), s.origExfs, t.getPid());
+      if (sets.exfsNotNull) {
+        fdSets.emplace_back(
+            traceePtr<fd_set>((fd_set*)t.arg4()), &sets.origExfs);
       }
-      s.rdfsNotNull = false;
-      s.wrfsNotNull = false;
-      s.exfsNotNull = false;
+      t.writeTraceeBatch(fdSets, t.getPid());
       t.writeArg5((uint64_t)s.originalArg5);
     }
   }
+  // A replay runs the pre-hook again, which reads the sets again.
+  s.selectSets.release();
   return;
 }
 // =======================================================================================
+/**
+ * Whether fd is one of our secretly non blocking pipes the tracee thinks
+ * blocks, where an in-kernel copy would fail with EAGAIN instead of waiting.
+ */
+static bool blocksForTracee(state& s, int fd) {
+  return s.getFdType(fd) == fdType::pipe && s.countFdStatus(fd) != 0 &&
+      s.getFdStatus(fd) == descriptorType::blocking;
+}
+
+/**
+ * Post-hook of sendfile and splice from in to out: wait for the pipe in the
+ * way when it would have blocked, wake the other side when it copied.
+ */
+static void inKernelCopyPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched, int in, int out) {
+  int64_t copied = t.getReturnValue();
+  if (copied == -EAGAIN) {
+    // Which one is in the way we can't tell when both are pipes, retry then.
+    waitReason reason{waitKind::pipeWritable, 0};
+    if (!blocksForTracee(s, in)) {
+      reason.key = pipeKeyFor(s, out);
+    } else if (!blocksForTracee(s, out)) {
+      reason = {waitKind::pipeReadable, pipeKeyFor(s, in)};
+    }
+    replaySyscallIfBlocked(
+        gs, s, t, sched, EAGAIN, reason.key != 0 ? &reason : nullptr);
+    return;
+  }
+  if (copied <= 0) {
+    return;
+  }
+  if (sched.hasWaiters(waitKind::pipeReadable)) {
+    ino_t inode = pipeKeyFor(s, out);
+    if (inode != 0) {
+      sched.wake(waitKind::pipeReadable, inode);
+    }
+  }
+  if (sched.hasWaiters(waitKind::pipeWritable)) {
+    ino_t inode = pipeKeyFor(s, in);
+    if (inode != 0) {
+      sched.wake(waitKind::pipeWritable, inode);
+    }
+  }
+}
+// =======================================================================================
+bool sendfileSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return blocksForTracee(s, t.arg1()) || blocksForTracee(s, t.arg2());
+}
+
+void sendfileSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  inKernelCopyPost(gs, s, t, sched, t.arg2(), t.arg1());
+}
+// =======================================================================================
+bool spliceSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (t.arg6() & SPLICE_F_NONBLOCK) {
+    return false;
+  }
+  return blocksForTracee(s, t.arg1()) || blocksForTracee(s, t.arg3());
+}
+
+void spliceSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  inKernelCopyPost(gs, s, t, sched, t.arg1(), t.arg3());
+}
+// =======================================================================================
 // TODO
 
 bool set_robust_listSystemCall::handleDetPre(
@@ -2218,7 +4310,8 @@ bool statSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
 
-  return true;
+  return !statWillFail(
+      gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, true);
 }
 
 void statSystemCall::handleDetPost(
@@ -2227,38 +4320,121 @@ void statSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
-bool statfsSystemCall::handleDetPre(
+bool statxSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  printInfoString(t.arg2(), gs.log, s.traceePid, t);
+
+  bool followLinks = (t.arg3() & AT_SYMLINK_NOFOLLOW) == 0;
+  return !statWillFail(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1(), followLinks);
 }
 
-void statfsSystemCall::handleDetPost(
+void statxSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  struct statfs* statfsPtr = (struct statfs*)t.arg2();
-  if (statfsPtr == nullptr) {
-    gs.log.writeToLog(Importance::info, "statfs: statbuf null.\n");
+  struct statx* statxPtr = (struct statx*)t.arg5();
+  if (t.getReturnValue() != 0 || statxPtr == nullptr) {
     return;
   }
 
-  if (t.getReturnValue() == 0) {
-    interceptStatfs(traceePtr<struct statfs>(statfsPtr), t);
+  traceePtr<struct statx> buf(statxPtr);
+  struct statx stx = t.readFromTracee(buf, s.traceePid);
+  // Only what the kernel filled in, the rest of the struct is the tracee's.
+  uint32_t mask = stx.stx_mask;
+  auto toStatx = [](struct timespec ts) {
+    struct statx_timestamp stamp;
+    memset(&stamp, 0, sizeof(stamp));
+    stamp.tv_sec = ts.tv_sec;
+    stamp.tv_nsec = ts.tv_nsec;
+    return stamp;
+  };
+  struct statx_timestamp epoch =
+      toStatx(logical_clock::to_timespec(gs.epoch));
+
+  ino_t realinode = stx.stx_ino;
+  DETTRACE_LOG(
+      gs.log, Importance::extra, "(device,realinode) = (%u:%u,%lu)\n",
+      stx.stx_dev_major, stx.stx_dev_minor, realinode);
+  if (gs.fakeroot != nullptr && (mask & STATX_INO)) {
+    uid_t uid = stx.stx_uid;
+    gid_t gid = stx.stx_gid;
+    mode_t mode = stx.stx_mode;
+    gs.fakeroot->apply(
+        makedev(stx.stx_dev_major, stx.stx_dev_minor), realinode, uid, gid,
+        mode);
+    if (mask & STATX_UID) {
+      stx.stx_uid = uid;
+    }
+    if (mask & STATX_GID) {
+      stx.stx_gid = gid;
+    }
+    if (mask & STATX_MODE) {
+      stx.stx_mode = mode;
+    }
+  }
+  // st_dev 1, as handleStatFamily reports.
+  stx.stx_dev_major = 0;
+  stx.stx_dev_minor = 1;
+  stx.stx_blksize = 512;
+  if (mask & STATX_INO) {
+    stx.stx_ino = virtualInode(gs, realinode);
+  }
+  if (mask & STATX_MTIME) {
+    stx.stx_mtime = toStatx(virtualMtime(gs, realinode));
+  }
+  if (mask & STATX_ATIME) {
+    stx.stx_atime = epoch;
+  }
+  if (mask & STATX_CTIME) {
+    stx.stx_ctime = epoch;
+  }
+  if (mask & STATX_BTIME) {
+    stx.stx_btime = epoch;
+  }
+  if (mask & STATX_NLINK) {
+    stx.stx_nlink = 1;
   }
+  if (mask & STATX_BLOCKS) {
+    stx.stx_blocks = 1;
+  }
+  if ((mask & STATX_SIZE) && (mask & STATX_TYPE)) {
+    stx.stx_size = virtualSize(stx.stx_mode, stx.stx_size);
+  }
+#ifdef STATX_MNT_ID
+  if (mask & STATX_MNT_ID) {
+    // stx_mnt_id follows stx_dev_minor, older struct statx lack it.
+    memset(
+        (char*)&stx + offsetof(struct statx, stx_dev_minor) +
+            sizeof(stx.stx_dev_minor),
+        0, sizeof(uint64_t));
+  }
+#endif
 
-  return;
+  // One write for everything, as handleStatFamily does.
+  t.writeToTracee(buf, stx, s.traceePid);
 }
 // =======================================================================================
-bool sysinfoSystemCall::handleDetPre(
+bool statfsSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return true;
 }
 
-void sysinfoSystemCall::handleDetPost(
+void statfsSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  struct sysinfo* infoPtr = (struct sysinfo*)t.arg1();
-  if (infoPtr == nullptr) {
+  struct statfs* statfsPtr = (struct statfs*)t.arg2();
+  if (statfsPtr == nullptr) {
+    DETTRACE_LOG(gs.log, Importance::info, "statfs: statbuf null.\n");
     return;
   }
 
+  if (t.getReturnValue() == 0) {
+    interceptStatfs(traceePtr<struct statfs>(statfsPtr), t);
+  }
+
+  return;
+}
+// =======================================================================================
+/** What sysinfo returns, the same for every call. */
+static struct sysinfo deterministicSysinfo() {
   struct sysinfo info = {};
   info.uptime = 365LL * 24 * 3600;
   // total = used + free + buff/cache
@@ -2277,57 +4453,57 @@ void sysinfoSystemCall::handleDetPost(
   info.loads[0] = 65536;
   info.loads[1] = 65536;
   info.loads[2] = 65536;
+  return info;
+}
+
+static const struct sysinfo ourSysinfo = deterministicSysinfo();
+
+bool sysinfoSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  struct sysinfo* infoPtr = (struct sysinfo*)t.arg1();
+  if (infoPtr == nullptr) {
+    return finishInPreHook(gs, s, t, -EFAULT);
+  }
+  t.writeToTracee(traceePtr<struct sysinfo>(infoPtr), ourSysinfo, t.getPid());
+  return finishInPreHook(gs, s, t, 0);
+}
 
-  t.writeToTracee(traceePtr<struct sysinfo>(infoPtr), info, t.getPid());
+void sysinfoSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return;
 }
 // =======================================================================================
 bool symlinkSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t, " target: ");
-  printInfoString(t.arg2(), gs.log, s.traceePid, t, " linkpath: ");
+  logCreatedPath(gs, s, t, t.arg2(), " linkpath: ");
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg2()), AT_FDCWD);
   return true;
 }
 
 void symlinkSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  if (t.getReturnValue() == 0 && (char*)t.arg2() != nullptr) {
-    string linkpath =
-        t.readTraceeCString(traceePtr<char>((char*)t.arg2()), s.traceePid);
-    auto inode = inode_from_tracee(linkpath, s.traceePid, gs.log, -1);
-    if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
-      s.incrementTime();
-    }
-  }
+  noteCreated(gs, s, t, t.arg2(), -1);
 }
 // =======================================================================================
 bool symlinkatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t, " target: ");
   // TODO Add newdirfd
-  printInfoString(t.arg3(), gs.log, s.traceePid, t, " linkpath: ");
+  logCreatedPath(gs, s, t, t.arg3(), " linkpath: ");
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg3()), t.arg2());
   return true;
 }
 
 void symlinkatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  if (t.getReturnValue() == 0 && (char*)t.arg3() != nullptr) {
-    string linkpath =
-        t.readTraceeCString(traceePtr<char>((char*)t.arg3()), s.traceePid);
-    auto inode = inode_from_tracee(linkpath, s.traceePid, gs.log, t.arg2());
-    if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
-      s.incrementTime();
-    }
-  }
+  noteCreated(gs, s, t, t.arg3(), t.arg2());
 }
 // =======================================================================================
 bool mknodSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD);
   return true;
 }
 
@@ -2336,9 +4512,9 @@ void mknodSystemCall::handleDetPost(
   if (t.getReturnValue() == 0 && (char*)t.arg1() != nullptr) {
     string path =
         t.readTraceeCString(traceePtr<char>((char*)t.arg1()), s.traceePid);
-    auto inode = inode_from_tracee(path, s.traceePid, gs.log, -1);
+    auto inode = inode_from_tracee(gs, s, path, -1);
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
+      gs.setMtime(inode, s.getLogicalTime());
       gs.inodeMap.addRealValue(inode);
       s.incrementTime();
     }
@@ -2348,6 +4524,7 @@ void mknodSystemCall::handleDetPost(
 bool mknodatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t);
+  forgetMissing(gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1());
   return true;
 }
 
@@ -2356,9 +4533,9 @@ void mknodatSystemCall::handleDetPost(
   if (t.getReturnValue() == 0 && (char*)t.arg2() != nullptr) {
     string path =
         t.readTraceeCString(traceePtr<char>((char*)t.arg2()), s.traceePid);
-    auto inode = inode_from_tracee(path, s.traceePid, gs.log, t.arg1());
+    auto inode = inode_from_tracee(gs, s, path, t.arg1());
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
+      gs.setMtime(inode, s.getLogicalTime());
       gs.inodeMap.addRealValue(inode);
       s.incrementTime();
     }
@@ -2370,16 +4547,22 @@ bool tgkillSystemCall::handleDetPre(
   int tgid = (int)t.arg1();
   int tid = (int)t.arg2();
   int signal = (int)t.arg3();
-  gs.log.writeToLog(
-      Importance::info, "tgkill(tgid = %d, tid = %d, signal = %d)\n", tgid, tid,
-      signal);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "tgkill(tgid = %d, tid = %d, signal = %d)\n",
+      tgid, tid, signal);
 
+  // Go preempts goroutines with SIGURG to another of its threads. The kernel
+  // sends it, the target is stopped and gets it as it is resumed, nothing for
+  // a post-hook to do.
   if (signal == SIGABRT && tgid == s.traceePid &&
       tgid == tid /* TODO: when we support threads, we should also compare against tracee's tid (from gettid) */) {
     // ok
+  } else if (
+      signal == SIGURG && tgid == gs.processes.threadGroupOf(s.traceePid)) {
+    // ok
   } else {
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "tgkillSystemCall::handleDetPre: tracee vtgid=" + to_string(tgid) +
             " vtid=" + to_string(tid) + " ptgid=" + to_string(s.traceePid) +
             " trying to send unsupported signal=" + to_string(signal));
@@ -2387,28 +4570,41 @@ bool tgkillSystemCall::handleDetPre(
     // unsupported signal");
   }
 
-  return true;
+  return false;
 }
 
 void tgkillSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  runtimeError("tgkill post-hook should never be called.");
 }
 // =======================================================================================
 bool timeSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  if (!gs.skipSystemCalls) {
+    return true;
+  }
+  gs.timeCalls++;
+  time_t* timePtr = (time_t*)t.arg1();
+  time_t secs_since_epoch = logical_clock::to_time_t(s.getLogicalTime());
+  if (timePtr != nullptr) {
+    t.writeToTracee(traceePtr<time_t>(timePtr), secs_since_epoch, s.traceePid);
+  }
+  replaceSystemCallWithNoop(gs, s, t, secs_since_epoch);
+  s.incrementTime();
+  sched.preemptAndScheduleNext();
+  return false;
 }
 
 void timeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   if (s.noopSystemCall) {
-    gs.log.writeToLog(
-        Importance::info,
-        "NOOP system call (getpid) setting return value to 0\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "NOOP system call (time) setting return value to %ld\n",
+        s.noopReturnValue);
     s.noopSystemCall = false;
-    t.setReturnRegister(
-        0); // pretend like the system call (that we replaced) has succeeded
+    // pretend like the system call (that we replaced) has succeeded
+    t.setReturnRegister(s.noopReturnValue);
   }
   // This should be rare this is a vdso system call. It is unlikely someone will
   // call it directly.
@@ -2416,15 +4612,16 @@ void timeSystemCall::handleDetPost(
     gs.timeCalls++;
     int retVal = t.getReturnValue();
     if (retVal < 0) {
-      gs.log.writeToLog(
-          Importance::info, "Time call failed: \n" + string{strerror(-retVal)});
+      DETTRACE_LOG(
+          gs.log, Importance::info,
+          "Time call failed: \n" + string{strerror(-retVal)});
       return;
     }
 
     time_t* timePtr = (time_t*)t.arg1();
     time_t secs_since_epoch = logical_clock::to_time_t(s.getLogicalTime());
-    gs.log.writeToLog(
-        Importance::info, "time: tloc is null, returning %d\n",
+    DETTRACE_LOG(
+        gs.log, Importance::info, "time: tloc is null, returning %d\n",
         secs_since_epoch);
     t.writeRax(secs_since_epoch);
     if (timePtr != nullptr) {
@@ -2443,7 +4640,7 @@ void timeSystemCall::handleDetPost(
 // =======================================================================================
 bool timer_createSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "timer_create syscall pre-hook\n");
+  DETTRACE_LOG(gs.log, Importance::info, "timer_create syscall pre-hook\n");
 
   // we support any clockid, but only notification via certain signals
   // delivered to the process
@@ -2492,14 +4689,15 @@ bool timer_createSystemCall::handleDetPre(
     ti.signalHandlerData = ti.sendSignal ? se.sigev_value.sival_ptr : nullptr;
   }
 
-  timerID_t timerid = s.timerCreateTimers.get()->size() + 11000;
-  s.timerCreateTimers.get()->insert({timerid, ti});
+  timerID_t timerid = s.timerCreateTimers->size() + 11000;
+  s.timerCreateTimers.write().insert({timerid, ti});
 
-  gs.log.writeToLog(
-      Importance::info, "created new timer " + to_string(timerid) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "created new timer " + to_string(timerid) + "\n");
 
   // write timerid into tracee memory
-  gs.log.writeToLog(Importance::info, "writing timerid to %p\n", t.arg3());
+  DETTRACE_LOG(gs.log, Importance::info, "writing timerid to %p\n", t.arg3());
   t.writeToTracee(
       traceePtr<uint64_t>((uint64_t*)t.arg3()), timerid, s.traceePid);
 
@@ -2520,13 +4718,14 @@ void timer_createSystemCall::handleDetPost(
 bool timer_deleteSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   timerID_t timerid = t.arg1();
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "timer_delete pre-hook for timer " + to_string(timerid) + "\n");
 
-  if (!s.timerCreateTimers.get()->count(timerid)) {
+  if (!s.timerCreateTimers->count(timerid)) {
     runtimeError("invalid timerid " + to_string(timerid));
   }
+  s.timers.erase(logicalTimers::timerKey{timerKind::posix, timerid});
   return true;
 }
 
@@ -2538,38 +4737,41 @@ void timer_deleteSystemCall::handleDetPost(
 bool timer_getoverrunSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   timerID_t timerid = t.arg1();
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "timer_getoverrun pre-hook for timer " + to_string(timerid) + "\n");
-  if (!s.timerCreateTimers.get()->count(timerid)) {
+  if (!s.timerCreateTimers->count(timerid)) {
     runtimeError("invalid timerid " + to_string(timerid));
   }
+  uint64_t overrun =
+      s.timers->overrun(logicalTimers::timerKey{timerKind::posix, timerid});
+  replaceSystemCallWithNoop(
+      gs, s, t, (int64_t)min<uint64_t>(overrun, DELAYTIMER_MAX));
   return true;
 }
 
 void timer_getoverrunSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  t.setReturnRegister(0);
+  runtimeError("timer_getoverrun post-hook should never be called.");
 }
 
 // =======================================================================================
 bool timer_gettimeSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   timerID_t timerid = t.arg1();
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "timer_gettime pre-hook for timer " + to_string(timerid) + "\n");
 
-  if (!s.timerCreateTimers.get()->count(timerid)) {
+  if (!s.timerCreateTimers->count(timerid)) {
     runtimeError("invalid timerid " + to_string(timerid));
   }
 
   struct itimerspec* isp = (struct itimerspec*)t.arg2();
   if (isp != nullptr) {
-    // timer has expired
-    struct itimerspec is;
-    is.it_interval.tv_sec = is.it_interval.tv_nsec = 0;
-    is.it_value.tv_sec = is.it_value.tv_nsec = 0;
+    logicalTimers::timerKey key{timerKind::posix, timerid};
+    struct itimerspec is =
+        s.timers->getTimer(key, s.getLogicalTime()).toItimerspec();
     t.writeToTracee(traceePtr<struct itimerspec>(isp), is, s.traceePid);
   }
 
@@ -2589,41 +4791,58 @@ void timer_gettimeSystemCall::handleDetPost(
 // =======================================================================================
 bool timer_settimeSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "timer_settime pre-hook for timer " + to_string(t.arg1()) + "\n");
 
   timerID_t timerid = t.arg1();
 
-  if (!s.timerCreateTimers.get()->count(timerid)) {
+  if (!s.timerCreateTimers->count(timerid)) {
     runtimeError("invalid timerid " + to_string(timerid));
   }
 
-  timerInfo tinfo = s.timerCreateTimers.get()->at(timerid);
-  if (!tinfo.sendSignal) {
-    replaceSystemCallWithNoop(gs, s, t);
-    return true; // run getpid post-hook
-  } else {
-    // run post-hook if necessary
-    return sendTraceeSignalNow(tinfo.signum, gs, s, t, sched);
+  timerInfo tinfo = s.timerCreateTimers->at(timerid);
+  auto spec = t.readFromTracee(
+      traceePtr<struct itimerspec>((struct itimerspec*)t.arg3()), s.traceePid);
+  timerSetting setting =
+      timerSettingAt(spec, t.arg2() & TIMER_ABSTIME, s.getLogicalTime());
+  timerSetting old;
+  // run post-hook if necessary
+  bool postHook = setSignalTimer(
+      gs, s, t, sched, {timerKind::posix, timerid},
+      tinfo.sendSignal ? tinfo.signum : 0, setting, &old);
+  if (t.arg4() != 0) {
+    t.writeToTracee(
+        traceePtr<struct itimerspec>((struct itimerspec*)t.arg4()),
+        old.toItimerspec(), s.traceePid);
   }
-
-  return true;
+  return postHook;
 }
 
 void timer_settimeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {}
 // =======================================================================================
+/** The interval timer which of getitimer and setitimer is. */
+static logicalTimers::timerKey itimerOf(int which) {
+  switch (which) {
+  case ITIMER_VIRTUAL:
+    return {timerKind::virtualTime, 0};
+  case ITIMER_PROF:
+    return {timerKind::prof, 0};
+  default:
+    return {timerKind::real, 0};
+  }
+}
+
 bool getitimerSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "getitimer pre-hook\n");
+  DETTRACE_LOG(gs.log, Importance::info, "getitimer pre-hook\n");
 
   struct itimerval* ivp = (struct itimerval*)t.arg2();
   if (ivp != nullptr) {
-    // say that timer has expired
-    struct itimerval iv;
-    iv.it_interval.tv_sec = iv.it_interval.tv_usec = 0;
-    iv.it_value.tv_sec = iv.it_value.tv_usec = 0;
+    struct itimerval iv =
+        s.timers->getTimer(itimerOf(t.arg1()), s.getLogicalTime())
+            .toItimerval();
     t.writeToTracee(traceePtr<struct itimerval>(ivp), iv, s.traceePid);
   }
 
@@ -2642,21 +4861,39 @@ void getitimerSystemCall::handleDetPost(
 // =======================================================================================
 bool setitimerSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "setitimer pre-hook\n");
+  DETTRACE_LOG(gs.log, Importance::info, "setitimer pre-hook\n");
 
   int whichTimer = t.arg1();
+  int signum = 0;
   switch (whichTimer) {
   case ITIMER_REAL:
-    return sendTraceeSignalNow(SIGALRM, gs, s, t, sched);
+    signum = SIGALRM;
+    break;
   case ITIMER_VIRTUAL:
-    return sendTraceeSignalNow(SIGVTALRM, gs, s, t, sched);
+    signum = SIGVTALRM;
+    break;
   case ITIMER_PROF:
-    return sendTraceeSignalNow(SIGPROF, gs, s, t, sched);
+    signum = SIGPROF;
+    break;
   default:
     runtimeError("invalid timer for setitimer " + to_string(whichTimer));
   }
 
-  return true;
+  timerSetting setting, old;
+  if (t.arg2() != 0) {
+    setting = timerSetting::fromItimerval(t.readFromTracee(
+        traceePtr<struct itimerval>((struct itimerval*)t.arg2()),
+        s.traceePid));
+  }
+  // run post-hook if necessary
+  bool postHook = setSignalTimer(
+      gs, s, t, sched, itimerOf(whichTimer), signum, setting, &old);
+  if (t.arg3() != 0) {
+    t.writeToTracee(
+        traceePtr<struct itimerval>((struct itimerval*)t.arg3()),
+        old.toItimerval(), s.traceePid);
+  }
+  return postHook;
 }
 
 void setitimerSystemCall::handleDetPost(
@@ -2664,7 +4901,7 @@ void setitimerSystemCall::handleDetPost(
 
 bool timerfd_createSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "timerfd_create syscall pre-hook\n");
+  DETTRACE_LOG(gs.log, Importance::info, "timerfd_create syscall pre-hook\n");
 
   int flags = t.arg2();
   s.originalArg2 = (unsigned long)flags;
@@ -2684,23 +4921,23 @@ void timerfd_createSystemCall::handleDetPost(
   t.writeArg2(s.originalArg2);
 
   if (fd >= 0) {
-    struct itimerspec it = {
-        {0, 0},
-        {0, 0},
-    };
-    s.timerfds->insert({fd, it});
-    gs.log.writeToLog(
-        Importance::info, "timerfd_create(%d, %d) = %d\n", clockid, flags, fd);
+    timerfdInfo info;
+    info.timer = s.timers.write().newTimerfd();
+    info.nonBlocking = s.originalArg2 & TFD_NONBLOCK;
+    s.fds.write().setTimerfd(fd, info);
+    s.setFdType(fd, fdType::timerfd);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "timerfd_create(%d, %d) = %d\n", clockid,
+        flags, fd);
   }
 }
 
 bool timerfd_settimeSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  int fd = t.arg1();
   struct itimerspec* spec = (itimerspec*)s.mmapMemory.getAddr().ptr;
   auto value = t.readFromTracee(
       traceePtr<struct itimerspec>((struct itimerspec*)t.arg3()), s.traceePid);
-  (*s.timerfds)[fd] = value;
+  // Armed for ever: the fd never reads ready before we say, see read.
   struct itimerspec timer = {
       {0, 0},
       {0, 0},
@@ -2714,7 +4951,7 @@ bool timerfd_settimeSystemCall::handleDetPre(
     timer.it_value.tv_nsec = 0;
   }
 
-  t.writeToTracee(traceePtr<itimerspec>(spec), timer, s.traceePid);
+  s.mmapMemory.write(t, traceePtr<itimerspec>(spec), timer, s.traceePid);
   s.originalArg3 = t.arg3();
   t.writeArg3((unsigned long)spec);
 
@@ -2725,17 +4962,25 @@ void timerfd_settimeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int fd = t.arg1();
   int retval = t.getReturnValue();
-  gs.log.writeToLog(Importance::info, "timerfd_setttime returned %d\n", retval);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "timerfd_setttime returned %d\n", retval);
   t.writeArg3(s.originalArg3);
 
+  if (retval != 0 || !s.fd_is_timerfd(fd)) {
+    return;
+  }
+  auto value = t.readFromTracee(
+      traceePtr<struct itimerspec>((struct itimerspec*)t.arg3()), s.traceePid);
+  timerSetting setting = timerSettingAt(
+      value, t.arg2() & TFD_TIMER_ABSTIME, s.getLogicalTime());
+  timerSetting old = s.timers.write().setTimer(
+      {timerKind::timerfd, s.fdInfoOf(fd).timer.timer}, 0, s.getLogicalTime(),
+      setting);
   // restore old_value.
-  if (retval == 0 && t.arg4() != 0) {
-    auto it = s.timerfds->find(fd);
-    if (it != s.timerfds->end()) {
-      t.writeToTracee(
-          traceePtr<struct itimerspec>((struct itimerspec*)t.arg4()),
-          it->second, s.traceePid);
-    }
+  if (t.arg4() != 0) {
+    t.writeToTracee(
+        traceePtr<struct itimerspec>((struct itimerspec*)t.arg4()),
+        old.toItimerspec(), s.traceePid);
   }
 }
 
@@ -2750,16 +4995,10 @@ void timerfd_gettimeSystemCall::handleDetPost(
   int retval = t.getReturnValue();
   if (retval == 0 && t.arg2() != 0) {
     auto rptr = traceePtr<struct itimerspec>((struct itimerspec*)t.arg2());
-    auto it = s.timerfds->find(fd);
-    if (it != s.timerfds->end()) {
-      auto timer = it->second;
-      if (timer.it_value.tv_sec != 0 || timer.it_value.tv_nsec != 0) {
-        // timer is active.
-        // cannot be 0 otherwise timer is disarmed.
-        timer.it_value.tv_sec = 0;
-        timer.it_value.tv_nsec = 1;
-      }
-      t.writeToTracee(rptr, timer, s.traceePid);
+    if (s.fd_is_timerfd(fd)) {
+      timerSetting setting = s.timers->getTimer(
+          {timerKind::timerfd, s.fdInfoOf(fd).timer.timer}, s.getLogicalTime());
+      t.writeToTracee(rptr, setting.toItimerspec(), s.traceePid);
     }
   }
 }
@@ -2767,15 +5006,6 @@ void timerfd_gettimeSystemCall::handleDetPost(
 // =======================================================================================
 bool timesSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
-}
-void timesSystemCall::handleDetPost(
-    globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Failure nothing for us to do.
-  if ((clock_t)t.getReturnValue() == -1) {
-    return;
-  }
-
   tms* bufPtr = (tms*)t.arg1();
   if (bufPtr != nullptr) {
     tms myTms = {
@@ -2788,15 +5018,37 @@ void timesSystemCall::handleDetPost(
     t.writeToTracee(traceePtr<tms>(bufPtr), myTms, s.traceePid);
   }
 
-  t.setReturnRegister(s.getLogicalTime().time_since_epoch().count());
+  int64_t ticks = s.getLogicalTime().time_since_epoch().count();
   s.incrementTime();
+  return finishInPreHook(gs, s, t, ticks);
 }
-// =======================================================================================
-bool unameSystemCall::handleDetPre(
+void timesSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  return;
 }
-void unameSystemCall::handleDetPost(
+// =======================================================================================
+// NB: this is our standard environment
+static struct utsname deterministicUname() {
+  struct utsname uts = {}; // initializes to all zeroes
+
+  const uint32_t MEMBER_LENGTH = 60;
+  static_assert(
+      sizeof(uts.sysname) >= MEMBER_LENGTH &&
+          sizeof(uts.release) >= MEMBER_LENGTH &&
+          sizeof(uts.version) >= MEMBER_LENGTH &&
+          sizeof(uts.machine) >= MEMBER_LENGTH,
+      "struct utsname members too small!");
+
+  strncpy(uts.sysname, "Linux", MEMBER_LENGTH);
+  strncpy(uts.release, "4.0", MEMBER_LENGTH);
+  strncpy(uts.version, "#1", MEMBER_LENGTH);
+  strncpy(uts.machine, "x86_64", MEMBER_LENGTH);
+  return uts;
+}
+
+static const struct utsname ourUtsname = deterministicUname();
+
+bool unameSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   // Populate the utsname struct with our own generic data.
   struct utsname* utsnamePtr = (struct utsname*)t.arg1();
@@ -2805,36 +5057,24 @@ void unameSystemCall::handleDetPost(
   // uname({sysname="Linux", nodename="acggrid28", release="4.4.114-42-default",
   // version="#1 SMP Tue Feb 6 10:58:10 UTC 2018 (b6ee9ae)", machine="x86_64",
   // domainname="(none)"}
-  if (utsnamePtr != nullptr) {
-    struct utsname myUts = {}; // initializes to all zeroes
-
-    // compiler-time check to ensure that each member is large enough
-    // magic due to
-    // https://stackoverflow.com/questions/3553296/c-sizeof-single-struct-member
-    const uint32_t MEMBER_LENGTH = 60;
-    if (sizeof(((struct utsname*)0)->sysname) < MEMBER_LENGTH ||
-        sizeof(((struct utsname*)0)->release) < MEMBER_LENGTH ||
-        sizeof(((struct utsname*)0)->version) < MEMBER_LENGTH ||
-        sizeof(((struct utsname*)0)->machine) < MEMBER_LENGTH) {
-      runtimeError(
-          "unameSystemCall::handleDetPost: struct utsname members too small!");
-    }
-
-    // NB: this is our standard environment
-    strncpy(myUts.sysname, "Linux", MEMBER_LENGTH);
-    strncpy(myUts.release, "4.0", MEMBER_LENGTH);
-    strncpy(myUts.version, "#1", MEMBER_LENGTH);
-    strncpy(myUts.machine, "x86_64", MEMBER_LENGTH);
-
-    t.writeToTracee(traceePtr<struct utsname>(utsnamePtr), myUts, t.getPid());
+  if (utsnamePtr == nullptr) {
+    return finishInPreHook(gs, s, t, -EFAULT);
   }
+  t.writeToTracee(
+      traceePtr<struct utsname>(utsnamePtr), ourUtsname, t.getPid());
+  return finishInPreHook(gs, s, t, 0);
+}
+void unameSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return;
 }
 // =======================================================================================
 bool unlinkSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
-  return true;
+  noteUnlink(gs, s, t, traceePtr<char>((char*)t.arg1()), AT_FDCWD, false);
+  // Only to log what it returned, or for --exec-cache to see it.
+  return !gs.pathUpdatesInPreHooks || gs.log.isEnabled(Importance::info);
 }
 
 void unlinkSystemCall::handleDetPost(
@@ -2847,13 +5087,26 @@ void unlinkSystemCall::handleDetPost(
 bool unlinkatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t);
+  noteUnlink(
+      gs, s, t, traceePtr<char>((char*)t.arg2()), t.arg1(),
+      (t.arg3() & AT_REMOVEDIR) != 0);
+  if ((t.arg3() & AT_REMOVEDIR) != 0) {
+    gs.missing.clear();
+  }
+  if (gs.pathUpdatesInPreHooks) {
+    if ((t.arg3() & AT_REMOVEDIR) != 0) {
+      gs.hostPaths.invalidateAll();
+    }
+    return gs.log.isEnabled(Importance::info);
+  }
   return true;
 }
 
 void unlinkatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  if (t.getReturnValue() == 0 && (t.arg3() & AT_REMOVEDIR) != 0) {
+    gs.hostPaths.invalidateAll();
+  }
   return;
 }
 
@@ -2881,20 +5134,19 @@ bool utimeSystemCall::handleDetPre(
   };
 
   // Write our struct to the tracee's memory.
-  t.writeToTracee(traceePtr<utimbuf>(ourUtimbuf), clockTime, s.traceePid);
+  s.mmapMemory.write(t, traceePtr<utimbuf>(ourUtimbuf), clockTime, s.traceePid);
 
-  // Point system call to new address.
+  // Point system call to new address, no post-hook stop to point it back.
   t.writeArg2((uint64_t)ourUtimbuf);
+  t.restoreArgLater(2, (uint64_t)ourUtimbuf, s.originalArg2);
   s.incrementTime();
 
-  // Needed to restore the original value in register.
-  return true;
+  return false;
 }
 
 void utimeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Restore value of register.
-  t.writeArg2(s.originalArg2);
+  runtimeError("utime post-hook should never be called.");
 }
 // =======================================================================================
 bool utimesSystemCall::handleDetPre(
@@ -2919,21 +5171,21 @@ bool utimesSystemCall::handleDetPre(
   const auto clockTime = logical_clock::to_timeval(gs.epoch);
 
   // Write our struct to the tracee's memory.
-  t.writeToTracee(traceePtr<timeval>(&(ourTimeval[0])), clockTime, s.traceePid);
-  t.writeToTracee(traceePtr<timeval>(&(ourTimeval[1])), clockTime, s.traceePid);
+  timeval times[2] = {clockTime, clockTime};
+  s.mmapMemory.writeBytes(
+      t, traceePtr<void>(ourTimeval), times, sizeof(times), s.traceePid);
 
-  // Point system call to new address.
+  // Point system call to new address, no post-hook stop to point it back.
   t.writeArg2((uint64_t)ourTimeval);
+  t.restoreArgLater(2, (uint64_t)ourTimeval, s.originalArg2);
   s.incrementTime();
 
-  // Needed to restore the original value in register.
-  return true;
+  return false;
 }
 
 void utimesSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Restore value of register.
-  t.writeArg2(s.originalArg2);
+  runtimeError("utimes post-hook should never be called.");
 }
 // =======================================================================================
 bool utimensatSystemCall::handleDetPre(
@@ -2943,14 +5195,14 @@ bool utimensatSystemCall::handleDetPre(
   const struct timespec* origTimespec = (const struct timespec*)t.arg3();
   if (origTimespec != nullptr) {
     // user specified his/her own time which should be deterministic.
-    if (gs.log.getDebugLevel() > 0) {
+    if (gs.log.isEnabled(Importance::info)) {
       // log tracee-specified struct timespec for validation
       struct timespec times[2];
       readVmTraceeRaw(
           traceePtr<struct timespec>((struct timespec*)origTimespec), times,
           sizeof(times), s.traceePid);
-      gs.log.writeToLog(
-          Importance::info,
+      DETTRACE_LOG(
+          gs.log, Importance::info,
           "atime.tv_sec:%lu atime.tv_nsec:%ld mtime.tv_sec:%lu "
           "mtime.tv_nsec:%ld \n",
           times[0].tv_sec, times[0].tv_nsec, times[1].tv_sec, times[1].tv_nsec);
@@ -2970,23 +5222,21 @@ bool utimensatSystemCall::handleDetPre(
   const auto clockTime = logical_clock::to_timespec(gs.epoch);
 
   // Write our struct to the tracee's memory.
-  t.writeToTracee(
-      traceePtr<struct timespec>(&(ourTimespec[0])), clockTime, s.traceePid);
-  t.writeToTracee(
-      traceePtr<struct timespec>(&(ourTimespec[1])), clockTime, s.traceePid);
+  struct timespec times[2] = {clockTime, clockTime};
+  s.mmapMemory.writeBytes(
+      t, traceePtr<void>(ourTimespec), times, sizeof(times), s.traceePid);
 
-  // Point system call to new address.
+  // Point system call to new address, no post-hook stop to point it back.
   t.writeArg3((uint64_t)ourTimespec);
+  t.restoreArgLater(3, (uint64_t)ourTimespec, s.originalArg3);
   s.incrementTime();
 
-  // Needed to restore the original value in register.
-  return true;
+  return false;
 }
 
 void utimensatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Restore value of register.
-  t.writeArg3(s.originalArg3);
+  runtimeError("utimensat post-hook should never be called.");
 }
 // =======================================================================================
 bool futimesatSystemCall::handleDetPre(
@@ -3009,26 +5259,113 @@ void futimesatSystemCall::handleDetPost(
   t.writeArg4(s.originalArg4);
 }
 // =======================================================================================
+/**
+ * Write what a short write on one of our secretly non blocking pipes left
+ * over from the tracer: copy it out of the tracee with process_vm_readv and
+ * into the pipe through our duplicate, as much as fits, instead of one replay
+ * per pipe buffer.
+ * @param rest (tracee address, size) of the bytes left to write, in order.
+ * @return bytes written, stopping at the first one that didn't fit.
+ */
+static uint64_t writeRestInTracer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int fd,
+    const vector<pair<uint64_t, uint64_t>>& rest) {
+  if (s.countFdStatus(fd) == 0 ||
+      s.getFdStatus(fd) != descriptorType::blocking) {
+    return 0;
+  }
+
+  const uint64_t chunkSize = 256 * 1024;
+  char* chunk = gs.scratch.allocate<char>(chunkSize);
+  uint64_t written = 0;
+  auto range = rest.begin();
+  uint64_t done = 0; // Of *range.
+  vector<traceeIo> reads;
+  while (range != rest.end()) {
+    // A chunk's worth of the ranges left, gathered with one process_vm_readv
+    // however many sendmsg buffers it spans.
+    reads.clear();
+    uint64_t wanted = 0;
+    while (range != rest.end() && wanted < chunkSize) {
+      uint64_t bytes = std::min(range->second - done, chunkSize - wanted);
+      if (bytes != 0) {
+        reads.emplace_back(
+            traceePtr<char>((char*)(range->first + done)), chunk + wanted,
+            bytes);
+      }
+      wanted += bytes;
+      done += bytes;
+      if (done == range->second) {
+        ++range;
+        done = 0;
+      }
+    }
+    if (wanted == 0) {
+      break;
+    }
+    t.readTraceeBatch(reads, s.traceePid);
+    ssize_t bytes = s.readProbe->fill(s.traceePid, fd, chunk, wanted);
+    if (bytes > 0) {
+      written += bytes;
+    }
+    if (bytes < (ssize_t)wanted) {
+      // The pipe is full.
+      break;
+    }
+  }
+
+  if (written > 0) {
+    gs.tracerPipeBytes += written;
+    if (sched.hasWaiters(waitKind::pipeReadable)) {
+      ino_t inode = pipeKeyFor(s, fd);
+      if (inode != 0) {
+        sched.wake(waitKind::pipeReadable, inode);
+      }
+    }
+  }
+  return written;
+}
+
 bool writeSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "File descriptor: %d\n", t.arg1());
-  gs.log.writeToLog(Importance::info, "Bytes to write %d\n", t.arg3());
+  DETTRACE_LOG(gs.log, Importance::info, "File descriptor: %d\n", t.arg1());
+  DETTRACE_LOG(gs.log, Importance::info, "Bytes to write %d\n", t.arg3());
 
-  return true;
+  // The post-hook hashes what was written.
+  if (!gs.hashOutputs && serveDevNull(gs, s, t, t.arg1(), true)) {
+    return true;
+  }
+  return gs.hashOutputs || (!gs.lite && !isRegularFileIo(gs, s, t.arg1()));
 }
 
 void writeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int fd = t.arg1();
+  const shared_ptr<eventfdInfo>& eventfd = s.fdInfoOf(fd).eventfd;
+  if (eventfd != nullptr) {
+    // Readers parked on it by serveEventfdRead.
+    if ((int64_t)t.getReturnValue() > 0 &&
+        sched.hasWaiters(waitKind::eventfd)) {
+      sched.wake(waitKind::eventfd, eventfd->id);
+    }
+    return;
+  }
   bool preemptAndTryLater = false;
 
   auto resetState = [&]() {
     // Nothing left to write.
-    gs.log.writeToLog(Importance::info, "All bytes written.\n");
+    DETTRACE_LOG(gs.log, Importance::info, "All bytes written.\n");
     t.setReturnRegister(s.totalBytes);
 
-    t.writeArg2(s.beforeRetry.rsi);
-    t.writeArg3(s.beforeRetry.rdx);
+    if (s.beforeRetry.active()) {
+      t.writeArg2(s.beforeRetry.get().rsi);
+      t.writeArg3(s.beforeRetry.get().rdx);
+      s.beforeRetry.release();
+    }
 
     s.firstTrySystemcall = true;
     s.totalBytes = 0;
@@ -3037,8 +5374,8 @@ void writeSystemCall::handleDetPost(
   // Pipe exists in our map and it's set to non blocking.
   if (s.countFdStatus(fd) != 0 &&
       s.getFdStatus(fd) == descriptorType::nonBlocking) {
-    gs.log.writeToLog(
-        Importance::info, "write found with non-blocking pipe!\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info, "write found with non-blocking pipe!\n");
     int retval = t.getReturnValue();
     // for non-blocking io, if it returns -EAGAIN on the 1st try, let it through
     // if it returns -EAGAIN after the retry logic, return bytes already
@@ -3055,7 +5392,13 @@ void writeSystemCall::handleDetPost(
       return;
     }
   } else {
-    preemptAndTryLater = replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
+    // No room left until someone reads from this pipe.
+    waitReason reason{waitKind::pipeWritable, 0};
+    if (t.getReturnValue() == -EAGAIN) {
+      reason.key = pipeKeyFor(s, fd);
+    }
+    preemptAndTryLater = replaySyscallIfBlocked(
+        gs, s, t, sched, EAGAIN, reason.key != 0 ? &reason : nullptr);
     // We have not read all bytes, but pipe has nothing, set ourselves as
     // blocked and we will retry later.
     if (preemptAndTryLater) {
@@ -3065,46 +5408,143 @@ void writeSystemCall::handleDetPost(
   }
 
   size_t bytes_written = t.getReturnValue();
-  gs.log.writeToLog(Importance::info, "bytesWritten: %d.\n", bytes_written);
+  DETTRACE_LOG(gs.log, Importance::info, "bytesWritten: %d.\n", bytes_written);
 
   if ((int)bytes_written < 0) {
-    gs.log.writeToLog(
-        Importance::info, "Returned negative: %d.\n", bytes_written);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Returned negative: %d.\n", bytes_written);
     return;
   }
 
+  // Readers waiting on this pipe have something to read now.
+  if (bytes_written > 0 && sched.hasWaiters(waitKind::pipeReadable)) {
+    ino_t inode = pipeKeyFor(s, fd);
+    if (inode != 0) {
+      sched.wake(waitKind::pipeReadable, inode);
+    }
+  }
+  if (bytes_written > 0) {
+    pipeSent(gs, s, fd, 0);
+  }
+
   s.totalBytes += bytes_written;
   if (s.firstTrySystemcall) {
     s.firstTrySystemcall = false;
-    s.beforeRetry = t.getRegs();
+    s.beforeRetry.get() = t.getRegs();
   }
-  gs.log.writeToLog(Importance::info, "total bytes: %d.\n", bytes_written);
-  gs.log.writeToLog(
-      Importance::info, "before retry rdx: %d.\n", s.beforeRetry.rdx);
+  DETTRACE_LOG(gs.log, Importance::info, "total bytes: %d.\n", bytes_written);
+  // Copied, resetState gives beforeRetry back.
+  const struct user_regs_struct beforeRetry = s.beforeRetry.get();
+  DETTRACE_LOG(
+      gs.log, Importance::info, "before retry rdx: %d.\n", beforeRetry.rdx);
 
   // Finally wrote all bytes user wanted.
 
   // The zero case should not really happen. But our fuse tests allow for this
   // behavior so we catch it here. Otherwise we forever try to read 0 bytes.
   // https://stackoverflow.com/questions/41904221/can-write2-return-0-bytes-written-and-what-to-do-if-it-does?utm_medium=organic&utm_source=google_rich_qa&utm_campaign=google_rich_qa
-  if (s.totalBytes == s.beforeRetry.rdx || bytes_written == 0) {
+  if (s.totalBytes == beforeRetry.rdx || bytes_written == 0) {
     resetState();
   } else {
-    gs.log.writeToLog(
-        Importance::info, "Not all bytes written: Replaying system call!\n");
-    t.writeArg2(t.arg2() + bytes_written);
-    t.writeArg3(t.arg3() - bytes_written);
+    s.totalBytes += writeRestInTracer(
+        gs, s, t, sched, fd,
+        {{beforeRetry.rsi + s.totalBytes, beforeRetry.rdx - s.totalBytes}});
+    if (s.totalBytes == beforeRetry.rdx) {
+      DETTRACE_LOG(gs.log, Importance::info, "Wrote the rest ourselves.\n");
+      resetState();
+      return;
+    }
+
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "Not all bytes written: Replaying system call!\n");
+    t.writeArg2(beforeRetry.rsi + s.totalBytes);
+    t.writeArg3(beforeRetry.rdx - s.totalBytes);
     replaySystemCall(gs, t, t.getSystemCallNumber());
   }
 
   return;
 }
 // =======================================================================================
+/**
+ * A wait for child that only watches exits finds nothing: a matching child
+ * process is alive and none exited unreaped. The kernel agrees, a traced
+ * child is only reapable once we saw its exit.
+ */
+static bool waitFindsNothing(
+    globalState& gs, state& s, pid_t child, bool exitsOnly, int options) {
+  if (!exitsOnly || (options & (__WCLONE | __WALL)) != 0 ||
+      (child != -1 && child <= 0)) {
+    return false;
+  }
+  pid_t parent = gs.processes.threadGroupOf(s.traceePid);
+  return !gs.processes.hasUnreaped(parent, child) &&
+      gs.processes.hasChildProcess(parent, child);
+}
+
+/**
+ * Hold back a blocking wait for child, as wait4 takes it, until a child exits
+ * if we know it would find nothing to reap: it only waits for exits, a child
+ * it waits for is alive and none of them exited unreaped. Saves running the
+ * wait just to find nothing and replay it. Waits for process groups or clones
+ * are left to the kernel.
+ * @return whether the tracee was parked, its pre-hook runs again once woken.
+ */
+static bool deferWaitForExit(
+    globalState& gs,
+    state& s,
+    scheduler& sched,
+    pid_t child,
+    bool exitsOnly,
+    int options) {
+  if (!waitFindsNothing(gs, s, child, exitsOnly, options)) {
+    return false;
+  }
+  pid_t parent = gs.processes.threadGroupOf(s.traceePid);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "No child to reap, waiting for an exit.\n");
+  s.deferredPreHook = true;
+  gs.waitDeferrals++;
+  sched.preemptAndWaitFor(waitReason{waitKind::childExit, (uint64_t)parent});
+  return true;
+}
+
+/**
+ * s's wait reaped child: forget it, and with --vector-clocks hear of
+ * everything it heard of before exiting.
+ */
+static void childReaped(
+    globalState& gs, state& s, scheduler& sched, pid_t child) {
+  gs.processes.reaped(s.traceePid, child);
+  auto sent = gs.exitClocks.find(child);
+  if (sent == gs.exitClocks.end()) {
+    return;
+  }
+  if (gs.causalReceive(s, sent->second) && sched.events != nullptr) {
+    sched.events->instant(s.traceePid, "heard of " + s.causality->str());
+  }
+  gs.exitClocks.erase(sent);
+}
+
 bool wait4SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   s.wait4Blocking = (t.arg3() & WNOHANG) == 0;
-  gs.log.writeToLog(Importance::info, "wait4(%d)\n", (int)t.arg1());
-  gs.log.writeToLog(Importance::info, "Making this a non-blocking wait4\n");
+  DETTRACE_LOG(gs.log, Importance::info, "wait4(%d)\n", (int)t.arg1());
+  bool exitsOnly = (t.arg3() & (WUNTRACED | WCONTINUED)) == 0;
+  if (s.wait4Blocking &&
+      deferWaitForExit(
+          gs, s, sched, (pid_t)t.arg1(), exitsOnly, (int)t.arg3())) {
+    return false;
+  }
+  // Status and rusage are only written for a reaped child.
+  if (!s.wait4Blocking &&
+      waitFindsNothing(gs, s, (pid_t)t.arg1(), exitsOnly, (int)t.arg3())) {
+    DETTRACE_LOG(
+        gs.log, Importance::info, "No child to reap, answering the poll.\n");
+    gs.waitPollsAnswered++;
+    return finishInPreHook(gs, s, t, 0);
+  }
+  DETTRACE_LOG(gs.log, Importance::info, "Making this a non-blocking wait4\n");
 
   // Make this a non blocking hang!
   s.originalArg3 = t.arg3();
@@ -3114,14 +5554,23 @@ bool wait4SystemCall::handleDetPre(
 void wait4SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   if (s.wait4Blocking) {
-    gs.log.writeToLog(Importance::info, "Blocking wait4 found\n");
-    replaySyscallIfBlocked(gs, s, t, sched, 0);
+    DETTRACE_LOG(gs.log, Importance::info, "Blocking wait4 found\n");
+    // Only exits wake us up, stop/continue notifications are polled for.
+    waitReason reason{
+        waitKind::childExit,
+        (uint64_t)gs.processes.threadGroupOf(s.traceePid)};
+    bool exitsOnly = (s.originalArg3 & (WUNTRACED | WCONTINUED)) == 0;
+    replaySyscallIfBlocked(
+        gs, s, t, sched, 0, exitsOnly ? &reason : nullptr);
   } else {
-    gs.log.writeToLog(Importance::info, "Non-blocking wait4 found\n");
+    DETTRACE_LOG(gs.log, Importance::info, "Non-blocking wait4 found\n");
     preemptIfBlocked(gs, s, t, sched, EAGAIN);
   }
   // Reset.
   t.writeArg3(s.originalArg3);
+  if (t.getReturnValue() > 0) {
+    childReaped(gs, s, sched, t.getReturnValue());
+  }
 
   return;
 }
@@ -3129,8 +5578,16 @@ void wait4SystemCall::handleDetPost(
 bool waitidSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   s.wait4Blocking = (t.arg4() & WNOHANG) == 0;
-  gs.log.writeToLog(Importance::info, "waitid(%d)\n", (int)t.arg1());
-  gs.log.writeToLog(Importance::info, "Making this a non-blocking waitid\n");
+  DETTRACE_LOG(gs.log, Importance::info, "waitid(%d)\n", (int)t.arg1());
+  idtype_t idtype = (idtype_t)t.arg1();
+  if (s.wait4Blocking && (idtype == P_ALL || idtype == P_PID) &&
+      deferWaitForExit(
+          gs, s, sched, idtype == P_ALL ? -1 : (pid_t)t.arg2(),
+          (t.arg4() & (WEXITED | WSTOPPED | WCONTINUED)) == WEXITED,
+          (int)t.arg4())) {
+    return false;
+  }
+  DETTRACE_LOG(gs.log, Importance::info, "Making this a non-blocking waitid\n");
 
   // Make this a non blocking hang!
   s.originalArg4 = t.arg4();
@@ -3140,14 +5597,28 @@ bool waitidSystemCall::handleDetPre(
 void waitidSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   if (s.wait4Blocking) {
-    gs.log.writeToLog(Importance::info, "Blocking waitid found\n");
-    replaySyscallIfBlocked(gs, s, t, sched, 0);
+    DETTRACE_LOG(gs.log, Importance::info, "Blocking waitid found\n");
+    // Only exits wake us up, stop/continue notifications are polled for.
+    waitReason reason{
+        waitKind::childExit,
+        (uint64_t)gs.processes.threadGroupOf(s.traceePid)};
+    bool exitsOnly = (s.originalArg4 & (WSTOPPED | WCONTINUED)) == 0;
+    replaySyscallIfBlocked(
+        gs, s, t, sched, 0, exitsOnly ? &reason : nullptr);
   } else {
-    gs.log.writeToLog(Importance::info, "Non-blocking waitid found\n");
+    DETTRACE_LOG(gs.log, Importance::info, "Non-blocking waitid found\n");
     preemptIfBlocked(gs, s, t, sched, EAGAIN);
   }
   // Reset.
   t.writeArg4(s.originalArg4);
+  if (t.getReturnValue() == 0 && (void*)t.arg3() != nullptr &&
+      (s.originalArg4 & (WEXITED | WNOWAIT)) == WEXITED) {
+    siginfo_t info = t.readFromTracee(
+        traceePtr<siginfo_t>((siginfo_t*)t.arg3()), s.traceePid);
+    if (info.si_pid != 0) {
+      childReaped(gs, s, sched, info.si_pid);
+    }
+  }
 
   return;
 }
@@ -3159,8 +5630,11 @@ bool writevSystemCall::handleDetPre(
 
 void writevSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // TODO: Handle bytes written.
-  return;
+  // Only stops with --hash-outputs, so a short writev to a blocking pipe is
+  // not finished from the tracer like a write is.
+  if (t.getReturnValue() > 0) {
+    pipeSent(gs, s, t.arg1(), 0);
+  }
 }
 // =======================================================================================
 
@@ -3171,12 +5645,11 @@ bool socketSystemCall::handleDetPre(
 
   if (domain == AF_INET || domain == AF_INET6) {
     if (!gs.allow_network) {
-      gs.log.writeToLog(
-          Importance::inter,
+      DETTRACE_LOG(
+          gs.log, Importance::inter,
           "socket syscall disabled, add `--allow-network` to enable socket "
           "syscall\n");
-      cancelSystemCall(gs, s, t);
-      t.setReturnRegister(-ENOSYS);
+      failSystemCall(gs, s, t, ENOSYS);
       return false;
     }
   }
@@ -3193,17 +5666,65 @@ void socketSystemCall::handleDetPost(
 
   int domain = t.arg1();
   int type = t.arg2();
+  s.setFdType(fd, fdType::socket);
 
   if (domain == AF_INET || domain == AF_INET6) {
-    s.remote_sockfds->insert(fd);
+    s.fds.write().setRemote(fd, true);
   }
 
   if (type & SOCK_NONBLOCK) {
-    (*s.fdStatus)[fd] = descriptorType::nonBlocking;
+    s.setFdStatus(fd, descriptorType::nonBlocking);
+  }
+
+  DETTRACE_LOG(
+      gs.log, Importance::info, "socket returned " + to_string(fd) + "\n");
+}
+// =======================================================================================
+bool socketpairSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if ((int)t.arg1() != AF_UNIX) {
+    return false;
+  }
+  int type = t.arg2();
+  s.originalArg2 = type;
+  // Stream sockets read and write like pipes, see pipe2.
+  if ((type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == SOCK_STREAM) {
+    t.writeArg2(type | SOCK_NONBLOCK);
+  }
+  return true;
+}
+
+void socketpairSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int type = s.originalArg2;
+  t.writeArg2(type);
+  if (t.getReturnValue() != 0) {
+    return;
   }
 
-  gs.log.writeToLog(
-      Importance::info, "socket returned " + to_string(fd) + "\n");
+  int sv[2];
+  t.readTraceeBatch(
+      {traceeIo(traceePtr<int>((int*)t.arg4()), sv, sizeof(sv))},
+      s.traceePid);
+  ino_t inodes[2] = {
+      socketInodeFor(s.traceePid, sv[0]), socketInodeFor(s.traceePid, sv[1])};
+  bool stream = (type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == SOCK_STREAM;
+  for (int i = 0; i < 2; i++) {
+    if (inodes[0] != 0 && inodes[1] != 0) {
+      s.fds.write().setSocketPair(sv[i], {inodes[i], inodes[1 - i]});
+    } else {
+      s.setFdType(sv[i], fdType::socket);
+    }
+    if (stream) {
+      s.setFdStatus(
+          sv[i],
+          (type & SOCK_NONBLOCK) != 0 ? descriptorType::nonBlocking
+                                      : descriptorType::blocking);
+    }
+  }
+  DETTRACE_LOG(
+      gs.log, Importance::info, "socketpair returned %d and %d\n", sv[0],
+      sv[1]);
 }
 // =======================================================================================
 
@@ -3217,8 +5738,8 @@ void listenSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int retval = (int)t.getReturnValue();
 
-  gs.log.writeToLog(
-      Importance::info, "listen returned " + to_string(retval) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "listen returned " + to_string(retval) + "\n");
 
   return;
 }
@@ -3231,7 +5752,7 @@ bool acceptSystemCall::handleDetPre(
   t.writeArg4(0);
   replaySystemCall(gs, t, SYS_accept4);
 
-  gs.log.writeToLog(Importance::info, "change syscall accept => accept4\n");
+  DETTRACE_LOG(gs.log, Importance::info, "change syscall accept => accept4\n");
   return false;
 }
 
@@ -3292,22 +5813,20 @@ bool accept4SystemCall::handleDetPre(
   int fd = t.arg1();
   int flags = t.arg4();
 
-  gs.log.writeToLog(Importance::info, "accept4(%d), flags = %d\n", fd, flags);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "accept4(%d), flags = %d\n", fd, flags);
 
-  auto it = s.fdStatus.get()->find(fd);
-  if (it != s.fdStatus.get()->end()) {
-    if (it->second == descriptorType::nonBlocking) {
-      return true;
-    }
+  if (fd_is_nonblocking(s, fd)) {
+    return true;
   }
 
   int fd_flags = get_proc_fd_flags(t.getPid(), fd);
   /* blocking accept4, simulating nonblocking io */
   s.userDefinedTimeout = true; // XXX: we have no timeout, borrow a variable
   s.originalArg1 = fd_flags;
-  gs.log.writeToLog(
-      Importance::info, "fd %d flags = 0x%x, nonblocking?: %d\n", fd, fd_flags,
-      (fd_flags & O_NONBLOCK) == O_NONBLOCK);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "fd %d flags = 0x%x, nonblocking?: %d\n", fd,
+      fd_flags, (fd_flags & O_NONBLOCK) == O_NONBLOCK);
 
   return true;
 }
@@ -3319,21 +5838,23 @@ void accept4SystemCall::handleDetPost(
   int retval = (int)t.getReturnValue();
 
   if (retval >= 0) {
+    s.setFdType(retval, fdType::socket);
     if ((flags & SOCK_NONBLOCK) == SOCK_NONBLOCK) {
-      (*s.fdStatus.get())[retval] = descriptorType::nonBlocking;
+      s.setFdStatus(retval, descriptorType::nonBlocking);
     } else {
-      (*s.fdStatus.get())[retval] = descriptorType::blocking;
+      s.setFdStatus(retval, descriptorType::blocking);
     }
-    gs.log.writeToLog(
-        Importance::info, "accept4(%d) returned new fd %d\n", fd, retval);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "accept4(%d) returned new fd %d\n", fd,
+        retval);
     return;
   }
 
   if (s.userDefinedTimeout) {
     /* both EAGAIN/EWOULDBLOCK are valid return values for nonblocking mode */
     if (retval == -EAGAIN || retval == -EWOULDBLOCK) {
-      gs.log.writeToLog(
-          Importance::info, "accetp4 would have blocked! Replaying\n");
+      DETTRACE_LOG(
+          gs.log, Importance::info, "accetp4 would have blocked! Replaying\n");
       gs.replayDueToBlocking++;
       sched.preemptAndScheduleNext();
       replaySystemCall(gs, t, t.getSystemCallNumber());
@@ -3346,7 +5867,8 @@ void accept4SystemCall::handleDetPost(
 // =======================================================================================
 bool shutdownSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  gs.log.writeToLog(Importance::info, "shutdown(%d, %d)\n", t.arg1(), t.arg2());
+  DETTRACE_LOG(
+      gs.log, Importance::info, "shutdown(%d, %d)\n", t.arg1(), t.arg2());
 
   return true;
 }
@@ -3355,16 +5877,324 @@ void shutdownSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int retval = (int)t.getReturnValue();
 
-  gs.log.writeToLog(
-      Importance::info, "shutdown returned " + to_string(retval) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info,
+      "shutdown returned " + to_string(retval) + "\n");
 
   if (retval == 0) {
     int fd = t.arg1();
     int how = t.arg2();
-    if (how == SHUT_RDWR) {
-      s.remote_sockfds->erase(fd);
+    if (how == SHUT_RDWR && s.fd_is_remote(fd)) {
+      s.fds.write().setRemote(fd, false);
     }
   }
 
   return;
 }
+// =======================================================================================
+/**
+ * For system calls we answer entirely ourselves: skip the call, the tracee
+ * sees returnValue. Where it can't be skipped it becomes a time(), whose
+ * post-hook sets returnValue.
+ * @return what the pre-hook returns.
+ */
+static bool finishInPreHook(
+    globalState& gs, state& s, ptracer& t, int64_t returnValue) {
+  if (!replaceSystemCallWithNoop(gs, s, t, returnValue)) {
+    // time() would write to it otherwise.
+    t.writeArg1(0);
+  }
+  return true;
+}
+// =======================================================================================
+static bool belowRoot(const string& rootPath, string& path) {
+  if (rootPath == "/") {
+    return true;
+  }
+  if (path == rootPath) {
+    path = "/";
+  } else if (path.compare(0, rootPath.size() + 1, rootPath + "/") == 0) {
+    path = path.substr(rootPath.size());
+  } else {
+    return false;
+  }
+  return true;
+}
+// =======================================================================================
+/**
+ * What readlink of path gives the tracee, for the links of /proc/self and
+ * /proc/thread-self we model: exe and fd/N. The rest of procfs, other pids
+ * (the tracee's are in its pid namespace, not ours) and relative paths are
+ * left to the kernel, "".
+ */
+static string modeledProcLink(globalState& gs, state& s, const string& path) {
+  string rest;
+  for (const string prefix : {"/proc/self/", "/proc/thread-self/"}) {
+    if (path.compare(0, prefix.size(), prefix) == 0) {
+      rest = path.substr(prefix.size());
+      break;
+    }
+  }
+  if (rest != "exe") {
+    const string fdPrefix = "fd/";
+    if (rest.compare(0, fdPrefix.size(), fdPrefix) != 0) {
+      return "";
+    }
+    string number = rest.substr(fdPrefix.size());
+    if (number.empty() || number.size() > 9 ||
+        number.find_first_not_of("0123456789") != string::npos) {
+      return "";
+    }
+    // Socket pairs we know without asking.
+    ino_t pair = s.fdInfoOf(stoi(number)).socketPair.inode;
+    if (pair != 0) {
+      return "socket:[" + to_string(virtualInode(gs, pair)) + "]";
+    }
+  }
+
+  string procPath = "/proc/" + to_string(s.traceePid) + "/" + rest;
+  char buf[PATH_MAX];
+  ssize_t n = readlink(procPath.c_str(), buf, sizeof(buf));
+  if (n <= 0 || n == sizeof(buf)) {
+    return "";
+  }
+  string link(buf, n);
+  // Pipes and sockets have their inodes in their names, make them the ones
+  // their stat gives.
+  for (const string kind : {"pipe:[", "socket:["}) {
+    if (link.compare(0, kind.size(), kind) == 0 && link.back() == ']') {
+      ino_t real = strtoul(link.c_str() + kind.size(), nullptr, 10);
+      return kind + to_string(virtualInode(gs, real)) + "]";
+    }
+  }
+  // Like anon_inode:[eventfd], the same on every run.
+  if (link[0] != '/') {
+    return link;
+  }
+  // We read it from outside the tracee's root.
+  stringId root = s.paths.write().root(gs.hostPaths, s.traceePid);
+  if (root == stringInterner::noString ||
+      !belowRoot(gs.strings.str(root), link)) {
+    return "";
+  }
+  return link;
+}
+// =======================================================================================
+static bool answerReadlink(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    uint64_t buf,
+    uint64_t bufsiz) {
+  // The kernel has the errors.
+  if (path.ptr == nullptr || (int64_t)bufsiz <= 0) {
+    return false;
+  }
+  string link = modeledProcLink(gs, s, t.readTraceeCString(path, s.traceePid));
+  if (link.empty()) {
+    return false;
+  }
+
+  DETTRACE_LOG(
+      gs.log, Importance::info, "readlink answered: %s\n", link.c_str());
+  // Cut to bufsiz, and not terminated, like the kernel's.
+  size_t length = min(link.size(), (size_t)bufsiz);
+  t.writeTraceeBatch(
+      {traceeIo(traceePtr<void>((void*)buf), (void*)link.c_str(), length)},
+      s.traceePid);
+  return finishInPreHook(gs, s, t, length);
+}
+// =======================================================================================
+static int statFakeFile(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool followLinks,
+    struct stat& statbuf) {
+  string hostPath;
+  if (path.ptr == nullptr) {
+    hostPath = "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(dirfd);
+    followLinks = true;
+  } else {
+    string traceePath = t.readTraceeCString(path, s.traceePid);
+    if (traceePath.empty()) {
+      return -ENOENT;
+    }
+    hostPath = resolve_tracee_path(gs, s, traceePath, dirfd);
+  }
+  int ret = followLinks ? stat(hostPath.c_str(), &statbuf)
+                        : lstat(hostPath.c_str(), &statbuf);
+  if (ret == -1) {
+    // Not an fd of the tracee's.
+    return path.ptr == nullptr && errno == ENOENT ? -EBADF : -errno;
+  }
+  return 0;
+}
+// =======================================================================================
+static bool fakeChown(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool followLinks,
+    uid_t uid,
+    gid_t gid) {
+  struct stat statbuf;
+  int ret = statFakeFile(gs, s, t, path, dirfd, followLinks, statbuf);
+  if (ret == 0) {
+    gs.fakeroot->chown(statbuf, uid, gid);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "fakeroot: owner %d:%d for inode %lu\n",
+        (int)uid, (int)gid, statbuf.st_ino);
+  }
+  return finishInPreHook(gs, s, t, ret);
+}
+// =======================================================================================
+static void fakeChmod(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    mode_t mode,
+    int modeArg) {
+  struct stat statbuf;
+  // Left to fail as it would, the real chmod does.
+  if (statFakeFile(gs, s, t, path, dirfd, true, statbuf) != 0) {
+    return;
+  }
+  gs.fakeroot->chmod(statbuf, mode);
+  mode_t ownerBits =
+      S_IRUSR | S_IWUSR | (S_ISDIR(statbuf.st_mode) ? S_IXUSR : 0);
+  if ((mode & ownerBits) != ownerBits) {
+    if (modeArg == 2) {
+      t.writeArg2(mode | ownerBits);
+    } else {
+      t.writeArg3(mode | ownerBits);
+    }
+  }
+}
+// =======================================================================================
+/**
+ * Before a tracee removes path: if it is the last name of a file we have a
+ * virtual inode or mtime for, have its inode forgotten once the file is gone.
+ */
+static void noteUnlink(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool directory) {
+  if (path.ptr == nullptr) {
+    return;
+  }
+  string traceePath = t.readTraceeCString(path, s.traceePid);
+  if (traceePath.empty()) {
+    return;
+  }
+  string hostPath = resolve_tracee_path(gs, s, traceePath, dirfd);
+  struct stat statbuf;
+  if (hostPath.empty() || lstat(hostPath.c_str(), &statbuf) != 0) {
+    return;
+  }
+  // Paths below a link point elsewhere once it is made again.
+  if (S_ISLNK(statbuf.st_mode)) {
+    gs.missing.clear();
+  }
+  // Other names keep a file alive, a directory has only the one.
+  if (!directory && statbuf.st_nlink > 1) {
+    return;
+  }
+  if (gs.fakeroot != nullptr) {
+    gs.fakeroot->forget(statbuf.st_dev, statbuf.st_ino);
+  }
+  if (gs.inodeMap.mappings().find(statbuf.st_ino) != nullptr ||
+      gs.mtimeMap.count(statbuf.st_ino) != 0) {
+    gs.unlinking(statbuf.st_ino, hostPath);
+  }
+}
+// =======================================================================================
+static void logCreatedPath(
+    globalState& gs, state& s, ptracer& t, uint64_t addr, string postFix) {
+  s.createdPath.clear();
+  if ((char*)addr != nullptr && gs.log.isEnabled(Importance::info)) {
+    s.createdPath =
+        t.readTraceeCString(traceePtr<char>((char*)addr), s.traceePid);
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        postFix + gs.log.makeTextColored(Color::green, s.createdPath) + "\n");
+  }
+}
+// =======================================================================================
+static void noteCreated(
+    globalState& gs, state& s, ptracer& t, uint64_t addr, int dirfd) {
+  string path = move(s.createdPath);
+  s.createdPath.clear();
+  if (t.getReturnValue() != 0 || (char*)addr == nullptr) {
+    return;
+  }
+  if (path.empty()) {
+    path = t.readTraceeCString(traceePtr<char>((char*)addr), s.traceePid);
+  }
+  // Add/overwrite entry in our map.
+  auto inode = inode_from_tracee(gs, s, path, dirfd);
+  if (inode != -1UL) {
+    gs.setMtime(inode, s.getLogicalTime());
+    gs.inodeMap.addRealValue(inode);
+    s.incrementTime();
+  }
+}
+// =======================================================================================
+static mode_t fileType(
+    globalState& gs, state& s, ptracer& t, traceePtr<char> path, int dirfd) {
+  if (path.ptr == nullptr) {
+    return 0;
+  }
+  string traceePath = t.readTraceeCString(path, s.traceePid);
+  if (traceePath.empty()) {
+    return 0;
+  }
+  string hostPath = resolve_tracee_path(gs, s, traceePath, dirfd);
+  struct stat statbuf;
+  if (hostPath.empty() || lstat(hostPath.c_str(), &statbuf) != 0) {
+    return 0;
+  }
+  return statbuf.st_mode & S_IFMT;
+}
+// =======================================================================================
+static bool preRename(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> from,
+    int fromDir,
+    traceePtr<char> to,
+    int toDir,
+    bool exchange) {
+  if (!gs.pathUpdatesInPreHooks && gs.missing.empty()) {
+    return true;
+  }
+  mode_t moved = fileType(gs, s, t, from, fromDir);
+  mode_t swapped = exchange ? fileType(gs, s, t, to, toDir) : 0;
+  bool directory = S_ISDIR(moved) || S_ISDIR(swapped);
+  // Moving a directory or a link moves everything below it, anything else
+  // only appears at to.
+  if (directory || S_ISLNK(moved) || S_ISLNK(swapped)) {
+    gs.missing.clear();
+  } else {
+    forgetMissing(gs, s, t, to, toDir);
+  }
+  if (!gs.pathUpdatesInPreHooks) {
+    return true;
+  }
+  // Only moving a directory moves cached paths.
+  if (directory) {
+    gs.hostPaths.invalidateAll();
+  }
+  return gs.log.isEnabled(Importance::info);
+}
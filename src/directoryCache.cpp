@@ -0,0 +1,41 @@
+#include "directoryCache.hpp"
+
+static bool operator!=(const struct timespec& a, const struct timespec& b) {
+  return a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec;
+}
+// =======================================================================================
+shared_ptr<const vector<uint8_t>> directoryCache::find(
+    const directoryStamp& stamp) const {
+  auto it =
+      listings.find(make_tuple(stamp.device, stamp.inode, stamp.dirent64));
+  if (it == listings.end()) {
+    return nullptr;
+  }
+
+  const directoryStamp& cached = it->second.stamp;
+  if (cached.mtime != stamp.mtime || cached.ctime != stamp.ctime ||
+      cached.logicalMtime != stamp.logicalMtime) {
+    return nullptr;
+  }
+  return it->second.entries;
+}
+// =======================================================================================
+void directoryCache::insert(
+    const directoryStamp& stamp, vector<uint8_t> entries) {
+  auto key = make_tuple(stamp.device, stamp.inode, stamp.dirent64);
+  auto old = listings.find(key);
+  if (old != listings.end()) {
+    cachedBytes -= old->second.entries->size();
+    listings.erase(old);
+  }
+
+  if (cachedBytes + entries.size() > maxBytes) {
+    listings.clear();
+    cachedBytes = 0;
+  }
+  cachedBytes += entries.size();
+  listings.emplace(
+      key,
+      listing{stamp, make_shared<const vector<uint8_t>>(std::move(entries))});
+}
+// =======================================================================================
@@ -0,0 +1,761 @@
+#include "execCache.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+
+#include "systemCallList.hpp"
+#include "util.hpp"
+#include "utilSystemCalls.hpp"
+
+/** Bump when the layout of entries changes, older ones are ignored. */
+static const char* entryHeader = "dettrace-exec-cache 1";
+
+/**
+ * Write contents to path through a temporary file, so readers never see half
+ * of it.
+ */
+static bool writeFileAtomically(
+    const string& path, const char* data, size_t size, mode_t mode) {
+  string temporary = path + ".dettrace-" + to_string(getpid());
+  int fd = open(
+      temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      mode & 07777);
+  if (fd == -1) {
+    return false;
+  }
+  size_t left = size;
+  while (left > 0) {
+    ssize_t n = write(fd, data, left);
+    if (n <= 0) {
+      close(fd);
+      unlink(temporary.c_str());
+      return false;
+    }
+    data += n;
+    left -= n;
+  }
+  // The umask may have taken bits away.
+  fchmod(fd, mode & 07777);
+  close(fd);
+  if (rename(temporary.c_str(), path.c_str()) == -1) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool writeFileAtomically(
+    const string& path, const string& contents, mode_t mode) {
+  return writeFileAtomically(path, contents.data(), contents.size(), mode);
+}
+
+/** Write the blob at blobPath to path, straight from a mapping of it. */
+static bool copyBlob(const string& blobPath, const string& path, mode_t mode) {
+  int fd = open(blobPath.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return writeFileAtomically(path, "", 0, mode);
+  }
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  bool written =
+      writeFileAtomically(path, (const char*)data, st.st_size, mode);
+  munmap(data, st.st_size);
+  return written;
+}
+
+/** Whether an inputHash is of contents, rather than "-" or "=" and a type. */
+static bool isContentHash(const string& hash) {
+  return !hash.empty() && hash != "-" && hash[0] != '=';
+}
+
+static char typeOf(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return 'f';
+  }
+  if (S_ISDIR(mode)) {
+    return 'd';
+  }
+  return 'o';
+}
+
+/** Split line at its first fields - 1 spaces, the last field is the rest. */
+static bool splitEntryLine(
+    const string& line, size_t fields, vector<string>& out) {
+  out.clear();
+  size_t at = 0;
+  for (size_t i = 0; i + 1 < fields; i++) {
+    size_t space = line.find(' ', at);
+    if (space == string::npos) {
+      return false;
+    }
+    out.push_back(line.substr(at, space - at));
+    at = space + 1;
+  }
+  out.push_back(line.substr(at));
+  return true;
+}
+// =======================================================================================
+execCache::execCache(
+    const string& dir,
+    fileHasher& hashes,
+    const string& salt,
+    const string& remoteCommand,
+    remoteCache* remote)
+    : dir(dir),
+      hashes(hashes),
+      salt(salt),
+      remoteCommand(remoteCommand),
+      remote(remote) {
+  vector<string> subs = {"", "/entries", "/blobs"};
+  if (!remoteCommand.empty()) {
+    subs.push_back("/remote");
+  }
+  for (const string& sub : subs) {
+    if (mkdir((dir + sub).c_str(), 0777) == -1 && errno != EEXIST) {
+      runtimeError(
+          "Unable to create exec cache directory " + dir + sub + ": " +
+          strerror(errno));
+    }
+  }
+}
+// =======================================================================================
+string execCache::inputHash(const string& path, bool contentToo) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    return errno == ENOENT || errno == ENOTDIR ? "-" : "";
+  }
+  if (!S_ISREG(st.st_mode) || !contentToo) {
+    return string("=") + typeOf(st.st_mode);
+  }
+  return hashes.hash(path);
+}
+// =======================================================================================
+void execCache::input(
+    pid_t pid, const string& path, bool contentToo, const string& known) {
+  auto records = recordsOf.find(pid);
+  if (records == recordsOf.end()) {
+    return;
+  }
+  if (path.empty()) {
+    poison(pid);
+    return;
+  }
+  string hash = known;
+  for (auto& r : records->second) {
+    if (r->poisoned || r->outputs.count(path) != 0) {
+      continue;
+    }
+    auto recorded = r->inputs.find(path);
+    // A stat followed by an open still needs the contents.
+    if (recorded != r->inputs.end() &&
+        !(contentToo && !isContentHash(recorded->second))) {
+      continue;
+    }
+    if (hash.empty()) {
+      hash = inputHash(path, contentToo);
+    }
+    if (hash.empty() || path.find('\n') != string::npos) {
+      r->poisoned = true;
+      continue;
+    }
+    r->inputs[path] = hash;
+  }
+}
+// =======================================================================================
+void execCache::output(pid_t pid, const string& path) {
+  auto records = recordsOf.find(pid);
+  if (records == recordsOf.end()) {
+    return;
+  }
+  for (auto& r : records->second) {
+    if (path.empty() || path.find('\n') != string::npos) {
+      r->poisoned = true;
+    } else {
+      r->outputs.insert(path);
+    }
+  }
+}
+// =======================================================================================
+void execCache::poison(pid_t pid) {
+  auto records = recordsOf.find(pid);
+  if (records == recordsOf.end()) {
+    return;
+  }
+  for (auto& r : records->second) {
+    r->poisoned = true;
+  }
+}
+// =======================================================================================
+string execCache::hostPath(
+    globalState& gs, state& s, ptracer& t, uint64_t path, int dirfd) {
+  if (path == 0) {
+    return "";
+  }
+  string traceePath =
+      t.readTraceeCString(traceePtr<char>((char*)path), s.traceePid);
+  if (traceePath.empty()) {
+    return "";
+  }
+  return resolve_tracee_path(gs, s, traceePath, dirfd);
+}
+// =======================================================================================
+bool execCache::restore(globalState& gs, state& s, ptracer& t) {
+  pid_t pid = s.traceePid;
+  pendingKeys.erase(pid);
+  string exe = hostPath(gs, s, t, t.arg1(), AT_FDCWD);
+  string exeHash = exe.empty() ? "" : inputHash(exe, true);
+  if (!isContentHash(exeHash)) {
+    return false;
+  }
+  // What an ancestor ran is an input of its subtree either way.
+  input(pid, exe, true);
+  // The kernel opens the interpreter of scripts, we wouldn't see it.
+  char magic[2] = {0, 0};
+  int fd = open(exe.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    if (read(fd, magic, sizeof(magic)) != sizeof(magic)) {
+      magic[0] = 0;
+    }
+    close(fd);
+  }
+  if (magic[0] == '#' && magic[1] == '!') {
+    return false;
+  }
+
+  contentHasher key;
+  key.add(salt);
+  key.add(exe);
+  key.add(exeHash);
+  vector<string> lists[2];
+  for (int l = 0; l < 2; l++) {
+    char** strings = (char**)(l == 0 ? t.arg2() : t.arg3());
+    for (int i = 0; strings != nullptr; i++) {
+      char* address = t.readFromTracee(traceePtr<char*>(&strings[i]), pid);
+      if (address == nullptr) {
+        break;
+      }
+      lists[l].push_back(t.readTraceeCString(traceePtr<char>(address), pid));
+      key.add(lists[l].back());
+    }
+    key.add("\1", 1);
+  }
+  stringId cwd = s.paths.write().cwd(gs.hostPaths, pid);
+  if (cwd == stringInterner::noString) {
+    return false;
+  }
+  key.add(gs.strings.str(cwd));
+  string keyHex = key.hex();
+  pendingKeys[pid] = keyHex;
+
+  if (restoreEntry(gs, s, keyHex, exe)) {
+    return true;
+  }
+  if (remoteCommand.empty() ||
+      !runRemotely(keyHex, exe, gs.strings.str(cwd), lists[0], lists[1])) {
+    return false;
+  }
+  if (!restoreEntry(gs, s, keyHex, exe)) {
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "--remote-exec left no entry that holds for %s, running it here.\n",
+        keyHex.c_str());
+    return false;
+  }
+  remoteHits++;
+  return true;
+}
+// =======================================================================================
+bool execCache::restoreEntry(
+    globalState& gs, state& s, const string& keyHex, const string& exe) {
+  pid_t pid = s.traceePid;
+  string entryPath = dir + "/entries/" + keyHex;
+  if (remote != nullptr && access(entryPath.c_str(), F_OK) != 0) {
+    fetchRemote(keyHex);
+  }
+  ifstream entry(entryPath);
+  string line;
+  if (!entry || !getline(entry, line) || line != entryHeader) {
+    return false;
+  }
+  vector<pair<string, string>> inputs;
+  vector<tuple<string, mode_t, string>> outputs;
+  vector<string> fields;
+  while (getline(entry, line)) {
+    if (line.compare(0, 3, "in ") == 0 && splitEntryLine(line, 3, fields)) {
+      const string& hash = fields[1];
+      if (inputHash(fields[2], isContentHash(hash)) != hash) {
+        return false;
+      }
+      inputs.emplace_back(fields[2], hash);
+    } else if (
+        line.compare(0, 4, "out ") == 0 && splitEntryLine(line, 4, fields)) {
+      const string& hash = fields[1];
+      if (hash != "-" && access((dir + "/blobs/" + hash).c_str(), R_OK) != 0) {
+        return false;
+      }
+      outputs.emplace_back(
+          fields[3], (mode_t)strtoul(fields[2].c_str(), nullptr, 8), hash);
+    } else {
+      return false;
+    }
+  }
+
+  // Ancestors depend on what the cached run did, as if it had run.
+  for (auto& in : inputs) {
+    input(pid, in.first, isContentHash(in.second), in.second);
+  }
+  for (auto& out : outputs) {
+    output(pid, get<0>(out));
+  }
+
+  for (auto& out : outputs) {
+    const string& path = get<0>(out);
+    const string& hash = get<2>(out);
+    if (hash == "-") {
+      unlink(path.c_str());
+    } else if (!copyBlob(dir + "/blobs/" + hash, path, get<1>(out))) {
+      runtimeError(
+          "--exec-cache: unable to restore " + path + ": " + strerror(errno));
+    } else {
+      // To the tracees this is a file just created by the cached run.
+      struct stat st;
+      if (stat(path.c_str(), &st) == 0) {
+        gs.setMtime(st.st_ino, s.getLogicalTime());
+        gs.inodeMap.addRealValue(st.st_ino);
+        s.incrementTime();
+      }
+    }
+  }
+  pendingKeys.erase(pid);
+  hits++;
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Exec of %s restored from the cache: %s\n",
+      exe.c_str(), keyHex.c_str());
+  return true;
+}
+// =======================================================================================
+bool execCache::runRemotely(
+    const string& keyHex,
+    const string& exe,
+    const string& cwd,
+    const vector<string>& argv,
+    const vector<string>& envp) {
+  string job = "dettrace-remote-job 1\nkey " + keyHex + "\nexe " + exe +
+      "\ncwd " + cwd + "\n";
+  for (const string& arg : argv) {
+    job += "arg " + arg + "\n";
+  }
+  for (const string& var : envp) {
+    job += "env " + var + "\n";
+  }
+  // A string with a newline would read as more lines.
+  size_t lines = 4 + argv.size() + envp.size();
+  if (count(job.begin(), job.end(), '\n') != (ptrdiff_t)lines) {
+    return false;
+  }
+  // Lines of a stale entry, what to ship if it reads the same files again.
+  ifstream stale(dir + "/entries/" + keyHex);
+  string line;
+  if (stale && getline(stale, line) && line == entryHeader) {
+    while (getline(stale, line)) {
+      if (line.compare(0, 3, "in ") == 0) {
+        job += line + "\n";
+      }
+    }
+  }
+  string jobFile = dir + "/remote/" + keyHex + ".job";
+  if (!writeFileAtomically(jobFile, job, 0644)) {
+    return false;
+  }
+
+  remoteJobs++;
+  // Its own pid namespace where it can have one, so whatever it leaves
+  // behind is not reparented to us when we are pid 1.
+  pid_t child = syscall(SYS_clone, CLONE_NEWPID | SIGCHLD, 0, 0, 0, 0);
+  if (child == -1) {
+    child = fork();
+  }
+  if (child == 0) {
+    execl(
+        "/bin/sh", "sh", "-c", remoteCommand.c_str(), "dettrace-remote-exec",
+        jobFile.c_str(), dir.c_str(), (char*)nullptr);
+    _exit(127);
+  }
+  int status = -1;
+  if (child == -1 || waitpid(child, &status, 0) != child) {
+    return false;
+  }
+  unlink(jobFile.c_str());
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+// =======================================================================================
+void execCache::execed(pid_t pid) {
+  auto pending = pendingKeys.find(pid);
+  if (pending == pendingKeys.end()) {
+    return;
+  }
+  auto r = make_shared<record>();
+  r->key = pending->second;
+  r->root = pid;
+  r->members.insert(pid);
+  pendingKeys.erase(pending);
+  recordsOf[pid].push_back(r);
+}
+// =======================================================================================
+void execCache::spawned(pid_t parent, pid_t child, bool isThread) {
+  auto records = recordsOf.find(parent);
+  if (records == recordsOf.end()) {
+    return;
+  }
+  vector<shared_ptr<record>> inherited = records->second;
+  // Threads exit with their process, only processes can be left behind.
+  for (auto& r : inherited) {
+    if (!isThread) {
+      r->members.insert(child);
+    }
+  }
+  recordsOf[child] = move(inherited);
+}
+// =======================================================================================
+void execCache::systemCall(
+    globalState& gs, state& s, ptracer& t, int syscallNum) {
+  pid_t pid = s.traceePid;
+  if (recordsOf.find(pid) == recordsOf.end()) {
+    return;
+  }
+  int ret = t.getReturnValue();
+  bool missing = ret == -ENOENT || ret == -ENOTDIR;
+
+  int dirfd = AT_FDCWD;
+  uint64_t path = 0;
+  int flags = 0;
+  switch (syscallNum) {
+  case SYS_openat:
+    dirfd = t.arg1();
+    path = t.arg2();
+    flags = t.arg3();
+    break;
+#ifdef SYS_openat2
+  case SYS_openat2:
+    dirfd = t.arg1();
+    path = t.arg2();
+    flags = t.readFromTracee(
+                 traceePtr<struct open_how>((struct open_how*)t.arg3()), pid)
+                .flags;
+    break;
+#endif
+  case SYS_open:
+    path = t.arg1();
+    flags = t.arg2();
+    break;
+  case SYS_creat:
+    path = t.arg1();
+    flags = O_CREAT | O_WRONLY | O_TRUNC;
+    break;
+  }
+
+  switch (syscallNum) {
+  case SYS_open:
+  case SYS_openat:
+#ifdef SYS_openat2
+  case SYS_openat2:
+#endif
+  case SYS_creat: {
+    if (ret >= 0) {
+      string opened = traceeFdPath(pid, ret);
+      int mode = flags & O_ACCMODE;
+      if (opened.empty()) {
+        poison(pid);
+        break;
+      }
+      if (mode != O_WRONLY && (flags & O_TRUNC) == 0) {
+        input(pid, opened, true);
+      }
+      if (mode != O_RDONLY || (flags & (O_TRUNC | O_CREAT)) != 0) {
+        output(pid, opened);
+      }
+    } else if (missing || ret == -EEXIST || ret == -EISDIR) {
+      input(pid, hostPath(gs, s, t, path, dirfd), false);
+    } else {
+      poison(pid);
+    }
+    break;
+  }
+  case SYS_stat:
+  case SYS_lstat:
+  case SYS_access:
+  case SYS_newfstatat:
+#ifdef SYS_statx
+  case SYS_statx:
+#endif
+  {
+    bool at = syscallNum != SYS_stat && syscallNum != SYS_lstat &&
+        syscallNum != SYS_access;
+    if (at) {
+      dirfd = t.arg1();
+      path = t.arg2();
+    } else {
+      path = t.arg1();
+    }
+    // fstatat(fd, "", AT_EMPTY_PATH) is an fstat, of a file we know.
+    if (at &&
+        t.readFromTracee(traceePtr<char>((char*)path), pid) == '\0') {
+      break;
+    }
+    if (ret == 0 || missing) {
+      input(pid, hostPath(gs, s, t, path, dirfd), false);
+    } else {
+      poison(pid);
+    }
+    break;
+  }
+  case SYS_rename:
+  case SYS_renameat:
+  case SYS_renameat2: {
+    bool at = syscallNum != SYS_rename;
+    if (ret != 0) {
+      poison(pid);
+      break;
+    }
+    int fromDir = at ? t.arg1() : AT_FDCWD;
+    int toDir = at ? t.arg3() : AT_FDCWD;
+    output(pid, hostPath(gs, s, t, at ? t.arg2() : t.arg1(), fromDir));
+    output(pid, hostPath(gs, s, t, at ? t.arg4() : t.arg2(), toDir));
+    break;
+  }
+  case SYS_unlink:
+  case SYS_unlinkat: {
+    bool at = syscallNum == SYS_unlinkat;
+    if (at && (t.arg3() & AT_REMOVEDIR) != 0) {
+      poison(pid);
+      break;
+    }
+    int dir = at ? t.arg1() : AT_FDCWD;
+    string removed = hostPath(gs, s, t, at ? t.arg2() : t.arg1(), dir);
+    if (ret == 0) {
+      output(pid, removed);
+    } else if (missing) {
+      input(pid, removed, false);
+    } else {
+      poison(pid);
+    }
+    break;
+  }
+  case SYS_read:
+    if (ret >= 0 && s.getFdType(t.arg1()) != fdType::regular) {
+      poison(pid);
+    }
+    break;
+  case SYS_write: {
+    if (ret < 0) {
+      break;
+    }
+    if (s.getFdType(t.arg1()) != fdType::regular) {
+      poison(pid);
+      break;
+    }
+    // Writes to files the subtree didn't open, e.g. a redirected stdout.
+    string written = traceeFdPath(pid, t.arg1());
+    for (auto& r : recordsOf[pid]) {
+      if (r->outputs.count(written) == 0) {
+        r->poisoned = true;
+      }
+    }
+    break;
+  }
+  case SYS_getdents:
+  case SYS_getdents64:
+  case SYS_mkdir:
+  case SYS_mkdirat:
+  case SYS_rmdir:
+  case SYS_symlink:
+  case SYS_symlinkat:
+  case SYS_link:
+  case SYS_linkat:
+  case SYS_mknod:
+  case SYS_mknodat:
+  case SYS_chown:
+  case SYS_fchown:
+  case SYS_lchown:
+  case SYS_fchownat:
+  case SYS_utime:
+  case SYS_utimes:
+  case SYS_utimensat:
+  case SYS_futimesat:
+  case SYS_socket:
+  case SYS_connect:
+  case SYS_sendto:
+  case SYS_sendmsg:
+  case SYS_sendmmsg:
+  case SYS_recvfrom:
+  case SYS_recvmsg:
+  case SYS_kill:
+  case SYS_tgkill:
+    poison(pid);
+    break;
+  }
+}
+// =======================================================================================
+void execCache::exitGroup(pid_t pid, int status) {
+  auto records = recordsOf.find(pid);
+  if (records == recordsOf.end() || records->second.back()->root != pid) {
+    return;
+  }
+  // Every other process of the subtree must be gone, or its effects would be
+  // missing from the outputs.
+  record& r = *records->second.back();
+  r.finished = true;
+  if (r.members.size() != 1) {
+    r.poisoned = true;
+  }
+  if (status == 0 && !r.poisoned && store(r)) {
+    stored++;
+  }
+}
+// =======================================================================================
+void execCache::exited(pid_t pid) {
+  auto records = recordsOf.find(pid);
+  if (records == recordsOf.end()) {
+    return;
+  }
+  for (auto& r : records->second) {
+    r->members.erase(pid);
+    if (r->root == pid && !r->finished) {
+      r->poisoned = true;
+    }
+  }
+  recordsOf.erase(records);
+}
+// =======================================================================================
+bool execCache::store(record& r) {
+  string entry = string(entryHeader) + "\n";
+  for (auto& in : r.inputs) {
+    entry += "in " + in.second + " " + in.first + "\n";
+  }
+  for (const string& path : r.outputs) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+      if (errno != ENOENT) {
+        return false;
+      }
+      entry += "out - 0 " + path + "\n";
+      continue;
+    }
+    if (!S_ISREG(st.st_mode)) {
+      return false;
+    }
+    string contents;
+    string hash = fileHasher::hashFile(path, &contents);
+    if (hash.empty()) {
+      return false;
+    }
+    string blob = dir + "/blobs/" + hash;
+    if (access(blob.c_str(), F_OK) != 0 &&
+        !writeFileAtomically(blob, contents, 0644)) {
+      return false;
+    }
+    char mode[16];
+    snprintf(mode, sizeof(mode), "%o", st.st_mode & 07777);
+    entry += "out " + hash + " " + mode + " " + path + "\n";
+  }
+  if (!writeFileAtomically(dir + "/entries/" + r.key, entry, 0644)) {
+    return false;
+  }
+  if (remote != nullptr) {
+    storeRemote(r.key, entry);
+  }
+  return true;
+}
+// =======================================================================================
+void execCache::fetchRemote(const string& keyHex) {
+  vector<pair<bool, string>> found;
+  if (!remote->enabled() ||
+      !remote->fetch({"entries/" + keyHex}, found) || !found[0].first) {
+    return;
+  }
+  const string& entry = found[0].second;
+  if (entry.compare(0, strlen(entryHeader), entryHeader) != 0) {
+    return;
+  }
+  // The blobs we don't have yet, all in one go.
+  vector<string> blobs;
+  istringstream lines(entry);
+  string line;
+  vector<string> fields;
+  while (getline(lines, line)) {
+    if (line.compare(0, 4, "out ") == 0 && splitEntryLine(line, 4, fields) &&
+        fields[1] != "-" &&
+        access((dir + "/blobs/" + fields[1]).c_str(), F_OK) != 0) {
+      blobs.push_back("blobs/" + fields[1]);
+    }
+  }
+  if (!blobs.empty() && !remote->fetch(blobs, found)) {
+    return;
+  }
+  for (size_t i = 0; i < blobs.size(); i++) {
+    // Content addressed: what doesn't hash to its name is not what we want.
+    contentHasher hash;
+    hash.add(found[i].second.data(), found[i].second.size());
+    if (!found[i].first || "blobs/" + hash.hex() != blobs[i] ||
+        !writeFileAtomically(dir + "/" + blobs[i], found[i].second, 0644)) {
+      return;
+    }
+  }
+  // Blobs first, an entry is only there once all of it is.
+  if (writeFileAtomically(dir + "/entries/" + keyHex, entry, 0644)) {
+    remoteFetches++;
+  }
+}
+// =======================================================================================
+void execCache::storeRemote(const string& keyHex, const string& entry) {
+  vector<string> blobs;
+  istringstream lines(entry);
+  string line;
+  vector<string> fields;
+  while (getline(lines, line)) {
+    if (line.compare(0, 4, "out ") == 0 && splitEntryLine(line, 4, fields) &&
+        fields[1] != "-") {
+      blobs.push_back("blobs/" + fields[1]);
+    }
+  }
+  vector<bool> has;
+  if (!remote->enabled() || (!blobs.empty() && !remote->has(blobs, has))) {
+    return;
+  }
+  for (size_t i = 0; i < blobs.size(); i++) {
+    string contents;
+    if (!has[i] &&
+        (fileHasher::hashFile(dir + "/" + blobs[i], &contents).empty() ||
+         !remote->store(blobs[i], contents))) {
+      return;
+    }
+  }
+  remote->store("entries/" + keyHex, entry);
+}
+// =======================================================================================
@@ -0,0 +1,110 @@
+#include "execSetup.hpp"
+
+#include <string.h>
+
+// Register numbers, as encoded in ModRM and REX.
+static const uint8_t argRegs[] = {7 /* rdi */, 6 /* rsi */, 2 /* rdx */,
+                                  10 /* r10 */, 8 /* r8 */, 9 /* r9 */};
+static const uint8_t resultRegs[] = {12, 13, 14, 15, 3 /* rbx */, 5 /* rbp */};
+
+static void append(vector<uint8_t>& code, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    code.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+/** rex prefix for a 64 bit operation on reg (ModRM reg) and rm (ModRM rm). */
+static uint8_t rexW(uint8_t reg, uint8_t rm) {
+  return 0x48 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0);
+}
+
+static void loadImmediate(vector<uint8_t>& code, uint8_t reg, uint64_t value) {
+  if (value <= UINT32_MAX) {
+    // mov $imm32, %r32, zero extended.
+    if (reg >= 8) {
+      code.push_back(0x41);
+    }
+    code.push_back(0xb8 + (reg & 7));
+    append(code, value, 4);
+  } else if ((int64_t)value >= INT32_MIN && (int64_t)value < 0) {
+    // mov $imm32, %r64, sign extended.
+    code.insert(code.end(), {rexW(0, reg), 0xc7, (uint8_t)(0xc0 | (reg & 7))});
+    append(code, value, 4);
+  } else {
+    // movabs $imm64, %r64
+    code.insert(code.end(), {rexW(0, reg), (uint8_t)(0xb8 + (reg & 7))});
+    append(code, value, 8);
+  }
+}
+
+/** mov %from, %to */
+static void move(vector<uint8_t>& code, uint8_t from, uint8_t to) {
+  code.insert(
+      code.end(),
+      {rexW(from, to), 0x89, (uint8_t)(0xc0 | ((from & 7) << 3) | (to & 7))});
+}
+// =======================================================================================
+void setupProgram::call(
+    long systemCall, resultReg into, const vector<arg>& args) {
+  calls.push_back({systemCall, into, args});
+}
+// =======================================================================================
+vector<uint8_t> setupProgram::code() const {
+  vector<uint8_t> code;
+  // Where each lea of a string wants its displacement, and which string.
+  vector<pair<size_t, const std::string*>> strings;
+
+  for (const systemCall& c : calls) {
+    for (size_t i = 0; i < c.args.size(); i++) {
+      uint8_t reg = argRegs[i];
+      const arg& a = c.args[i];
+      if (a.kind == arg::immediate) {
+        loadImmediate(code, reg, a.value);
+      } else if (a.kind == arg::result) {
+        move(code, resultRegs[a.reg], reg);
+      } else {
+        // lea disp32(%rip), %reg
+        code.insert(
+            code.end(), {rexW(reg, 0), 0x8d, (uint8_t)(((reg & 7) << 3) | 5)});
+        strings.push_back({code.size(), &a.str});
+        append(code, 0, 4);
+      }
+    }
+    // mov $number, %eax; syscall
+    loadImmediate(code, 0, c.number);
+    code.insert(code.end(), {0x0f, 0x05});
+    if (c.into != noResult) {
+      move(code, 0, resultRegs[c.into]);
+    }
+  }
+  code.push_back(0xcc);
+
+  for (auto& s : strings) {
+    uint32_t disp = code.size() - (s.first + 4);
+    memcpy(&code[s.first], &disp, sizeof(disp));
+    code.insert(code.end(), s.second->begin(), s.second->end());
+    code.push_back('\0');
+  }
+  return code;
+}
+// =======================================================================================
+long setupProgram::result(
+    const struct user_regs_struct& regs, resultReg reg) {
+  switch (reg) {
+  case r12:
+    return regs.r12;
+  case r13:
+    return regs.r13;
+  case r14:
+    return regs.r14;
+  case r15:
+    return regs.r15;
+  case rbx:
+    return regs.rbx;
+  case rbp:
+    return regs.rbp;
+  default:
+    return 0;
+  }
+}
+// =======================================================================================
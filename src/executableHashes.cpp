@@ -0,0 +1,139 @@
+#include "executableHashes.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <vector>
+
+#include "util.hpp"
+
+/** First line of a saved memo, bump the number when lines change. */
+static const string memoHeader = "dettrace-executables 1";
+
+// =======================================================================================
+executableHashes::~executableHashes() {
+  // Their fds are ours to close.
+  for (auto& p : pending) {
+    p.second.get();
+  }
+}
+// =======================================================================================
+fileIdentity executableHashes::keyOf(const fileIdentity& id) {
+  fileIdentity key = id;
+  key.ctime = 0;
+  return key;
+}
+// =======================================================================================
+bool executableHashes::load(const string& path) {
+  ifstream in(path);
+  string header;
+  if (!getline(in, header) || header != memoHeader) {
+    return false;
+  }
+  fileIdentity key;
+  string hash;
+  while (in >> key.device >> key.inode >> key.size >> key.mtime >> hash) {
+    memo.emplace(key, hash);
+  }
+  return true;
+}
+// =======================================================================================
+void executableHashes::save(const string& path) {
+  vector<fileIdentity> keys;
+  for (auto& p : pending) {
+    keys.push_back(p.first);
+  }
+  for (auto& key : keys) {
+    settle(key);
+  }
+
+  string tmpPath = path + ".tmp";
+  {
+    ofstream out(tmpPath, ios::trunc);
+    if (!out) {
+      runtimeError("Unable to open executable hashes " + tmpPath);
+    }
+    out << memoHeader << "\n";
+    for (auto& known : memo) {
+      const fileIdentity& key = known.first;
+      out << key.device << " " << key.inode << " " << key.size << " "
+          << key.mtime << " " << known.second << "\n";
+    }
+  }
+  doWithCheck(
+      rename(tmpPath.c_str(), path.c_str()),
+      "Unable to replace executable hashes " + path);
+}
+// =======================================================================================
+void executableHashes::execed(pid_t pid) {
+  running.erase(pid);
+  // Opened now, the helper reads it whether or not pid is still around.
+  string exe = "/proc/" + to_string(pid) + "/exe";
+  int fd = open(exe.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return;
+  }
+  fileIdentity id;
+  id.device = st.st_dev;
+  id.inode = st.st_ino;
+  id.size = st.st_size;
+  id.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  fileIdentity key = keyOf(id);
+  running[pid] = key;
+
+  if (memo.count(key) != 0 || pending.count(key) != 0) {
+    memoHits++;
+    close(fd);
+    return;
+  }
+  pending.emplace(key, tasks.run([fd]() {
+    string hash =
+        fileHasher::hashFile("/proc/self/fd/" + to_string(fd), nullptr);
+    close(fd);
+    return hash;
+  }));
+}
+// =======================================================================================
+void executableHashes::spawned(pid_t parent, pid_t child) {
+  auto from = running.find(parent);
+  if (from != running.end()) {
+    running[child] = from->second;
+  }
+}
+// =======================================================================================
+void executableHashes::exited(pid_t pid) {
+  running.erase(pid);
+}
+// =======================================================================================
+string executableHashes::hashOf(pid_t pid) {
+  auto runs = running.find(pid);
+  if (runs == running.end()) {
+    return "";
+  }
+  settle(runs->second);
+  auto known = memo.find(runs->second);
+  return known == memo.end() ? "" : known->second;
+}
+// =======================================================================================
+void executableHashes::settle(const fileIdentity& key) {
+  auto hashing = pending.find(key);
+  if (hashing == pending.end()) {
+    return;
+  }
+  string hash = hashing->second.get();
+  pending.erase(hashing);
+  // Unreadable, it is asked for again on its next exec.
+  if (!hash.empty()) {
+    memo[key] = hash;
+    executablesHashed++;
+  }
+}
+// =======================================================================================
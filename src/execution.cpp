@@ -1,27 +1,77 @@
 #include "execution.hpp"
 #include "dettraceSystemCall.hpp"
+#include "execSetup.hpp"
+#include "inodeSnapshot.hpp"
+#include "jobServer.hpp"
 #include "logger.hpp"
+#include "probes.hpp"
 #include "ptracer.hpp"
 #include "rnr_loader.hpp"
 #include "scheduler.hpp"
+#include "seccomp.hpp"
+#include "startupTimes.hpp"
 #include "state.hpp"
 #include "systemCallList.hpp"
 #include "util.hpp"
+#include "utilSystemCalls.hpp"
 #include "vdso.hpp"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/utsname.h>
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <stack>
 #include <tuple>
+#include <unordered_set>
 
 #define MAKE_KERNEL_VERSION(x, y, z) ((x) << 16 | (y) << 8 | (z))
 
-void deleteMultimapEntry(
-    unordered_multimap<pid_t, pid_t>& mymap, pid_t key, pid_t value);
-pid_t eraseChildEntry(multimap<pid_t, pid_t>& map, pid_t process);
+// Older glibc headers do not define memfd flags.
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+#ifndef SECCOMP_USER_NOTIF_FLAG_CONTINUE
+#define SECCOMP_USER_NOTIF_FLAG_CONTINUE (1UL << 0)
+#endif
+
+// The tracee cannot be both stopped and blocked on the seccomp notify fd, so we
+// poll for either. SIGCHLD tells us about ptrace stops; the handler writes to
+// this pipe so it can be polled alongside the notify fd.
+static int sigchldPipe[2] = {-1, -1};
+
+static void sigchldHandler(int signum) {
+  int savedErrno = errno;
+  char byte = 0;
+  if (write(sigchldPipe[1], &byte, 1) < 0) {
+    // Pipe is full, there is already a wakeup pending.
+  }
+  errno = savedErrno;
+}
+
 bool kernelCheck(int a, int b, int c);
 void trapCPUID(globalState& gs, state& s, ptracer& t);
 
+/**
+ * System calls we had tracees run and the stops that took, for
+ * --print-statistics. Kept here as the injecting functions are all static.
+ */
+static uint64_t injectedSystemCalls = 0;
+static uint64_t injectedStops = 0;
+
 bool kernelCheck(int a, int b, int c) {
   struct utsname utsname = {};
   long x, y, z;
@@ -55,43 +105,347 @@ execution::execution(
     string logFile,
     bool printStatistics,
     pthread_t devRandomPthread,
-    pthread_t devUrandomPthread,
     map<string, tuple<unsigned long, unsigned long, unsigned long>> vdsoFuncs,
     unsigned prngSeed,
     bool allow_network,
     logical_clock::time_point epoch,
-    logical_clock::duration clock_step)
+    logical_clock::duration clock_step,
+    size_t scratchSize,
+    bool useSeccompNotify,
+    string traceFile,
+    bool parallel,
+    bool lite,
+    uint64_t preemptBranches,
+    string inodeSnapshotFile,
+    uint64_t snapshotFingerprint,
+    bool virtualDevRandom,
+    bool prngCompat,
+    string statsJsonFile,
+    string timelineFile,
+    string trapProfileFile,
+    uint32_t trapProfilePeriod,
+    string inputLogFile,
+    bool replayInputs,
+    string scheduleFile,
+    bool useSchedule,
+    string execCacheDir,
+    string dependenciesFile,
+    string hashOutputsFile,
+    int traceStreamFd,
+    string suggestProfileFile,
+    map<string, string> syntheticFileSources,
+    int pinTracerCpu,
+    int pinTraceeCpu,
+    uint32_t spinWaitMicros,
+    bool clockOrder,
+    bool vectorClocks,
+    string logFilterText,
+    string liveStatsFile,
+    uint32_t watchdogRounds,
+    bool countHardware,
+    unsigned helperThreads,
+    bool producerFirst,
+    string checkpointAt,
+    unsigned checkpointRuns,
+    string remoteExecCommand,
+    string execCacheRemote,
+    int pipeSize,
+    unsigned cpus,
+    bool fakeroot,
+    bool logShards)
     : kernelPre4_8{kernelCheck(4, 8, 0)},
+      kernelPre5_3{kernelCheck(5, 3, 0)},
       log{logFile, debugLevel, useColor},
       silentLogger{"", 0},
       printStatistics{printStatistics},
       devRandomPthread{devRandomPthread},
-      devUrandomPthread{devUrandomPthread},
       // Waits for first process to be ready!
       tracer{startingPid},
+      // Started before we pin ourselves, they may run anywhere.
+      helpers{helperThreads},
       // Create our global state once, share across class.
       myGlobalState{
-          log,          ValueMapper<ino_t, ino_t>{log, "inode map", 1},
-          ModTimeMap{}, kernelCheck(4, 12, 0),
-          prngSeed,     epoch,
+          log,
+          processes,
+          ValueMapper<ino_t, ino_t>{log, "inode map", 1},
+          ModTimeMap{},
+          kernelCheck(4, 12, 0),
+          prngSeed,
+          epoch,
           allow_network},
       myScheduler{startingPid, log},
       debugLevel{debugLevel},
+      pinTraceeCpu(pinTraceeCpu),
+      spinWaitMicros(spinWaitMicros),
       vdsoFuncs(vdsoFuncs),
+      vvar(vdsoGetVvarLayout(getpid())),
       epoch(epoch),
       clock_step(clock_step),
-      prngSeed(prngSeed) {
+      prngSeed(prngSeed),
+      scratchSize(scratchSize),
+      useSeccompNotify(useSeccompNotify),
+      parallel(parallel),
+      branches(preemptBranches, log),
+      hardware(countHardware, log),
+      checkpointRuns(checkpointRuns),
+      inodeSnapshotFile(inodeSnapshotFile),
+      snapshotFingerprint(snapshotFingerprint),
+      statsJsonFile(statsJsonFile) {
   // Set state for first process.
-  states.emplace(
+  processes.addRoot(
       startingPid, state{startingPid, debugLevel, epoch, clock_step});
-  myGlobalState.threadGroups.insert({startingPid, startingPid});
-  myGlobalState.threadGroupNumber.insert({startingPid, startingPid});
+  branches.attach(startingPid);
+  hardware.attach(startingPid);
+
+  if (lite) {
+    order.commitInArrivalOrder();
+  }
+  if (parallel) {
+    order.add(startingPid, startingPid, 0);
+  }
+  myGlobalState.lite = lite;
+  myGlobalState.vectorClocks = vectorClocks;
+  myGlobalState.devRandomBytes.generateOn(helpers);
+  myGlobalState.devUrandomBytes.generateOn(helpers);
+  if (producerFirst) {
+    myScheduler.preferProducers();
+  }
+  if (clockOrder) {
+    myScheduler.orderByClock([this](pid_t pid) {
+      logical_clock::time_point clock;
+      if (processes.contains(pid)) {
+        clock = processes.at(pid).getLogicalTime();
+      }
+      return logicalStamp{clock, pid};
+    });
+  }
+
+  myGlobalState.virtualDevRandom = virtualDevRandom;
+  myGlobalState.prngCompat = prngCompat;
+  tracer.useSyscallInfo = !kernelPre5_3;
+  tracer.verifyWrites = NULL != getenv("DETTRACE_VERIFY_WRITES");
+  sitePatching = NULL == getenv("DETTRACE_NO_SITE_PATCHING");
+
+  if (useSeccompNotify) {
+    doWithCheck(pipe2(sigchldPipe, O_CLOEXEC | O_NONBLOCK), "pipe2");
+    struct sigaction sa = {};
+    sa.sa_handler = sigchldHandler;
+    doWithCheck(sigemptyset(&sa.sa_mask), "sigemptyset");
+    sa.sa_flags = SA_RESTART;
+    doWithCheck(sigaction(SIGCHLD, &sa, NULL), "sigaction(SIGCHLD)");
+  }
+
+  if (!checkpointAt.empty()) {
+    checkpointer = make_unique<checkpoint>(
+        checkpoint::parseMarker(checkpointAt), log);
+  }
+
+  if (!traceFile.empty()) {
+    traceOutput = make_unique<traceWriter>(traceFile);
+  }
+  if (traceStreamFd != -1) {
+    traceStreamOutput = make_unique<traceStream>(traceStreamFd);
+  }
+
+  if (!statsJsonFile.empty() || printStatistics || !liveStatsFile.empty()) {
+    statsOutput = make_unique<syscallStats>();
+  }
+  if (!liveStatsFile.empty()) {
+    live = make_unique<liveStatsWriter>(liveStatsFile);
+  }
+
+  if (!timelineFile.empty()) {
+    timelineOutput = make_unique<timeline>(timelineFile);
+    myScheduler.events = timelineOutput.get();
+  }
+
+  if (!trapProfileFile.empty()) {
+    trapProfileOutput =
+        make_unique<trapProfile>(trapProfileFile, trapProfilePeriod);
+  }
+
+  if (!inputLogFile.empty()) {
+    inputs = make_unique<inputLog>(inputLogFile, replayInputs);
+    myGlobalState.logProcReads = true;
+  }
+
+  if (!scheduleFile.empty()) {
+    schedule = make_unique<scheduleLog>(scheduleFile, useSchedule);
+    myScheduler.schedule = schedule.get();
+  }
+
+  if (!execCacheDir.empty() || !dependenciesFile.empty()) {
+    fileHashes = make_unique<fileHasher>(helpers);
+  }
+  if (fileHashes || !inodeSnapshotFile.empty()) {
+    exeHashes = make_unique<executableHashes>(helpers);
+  }
+  if (sitePatching) {
+    knownSites = make_unique<patchSiteCache>();
+  }
+  if (helperThreads != 0) {
+    startups = make_unique<startupReads>(helpers);
+  }
+  if (!execCacheDir.empty()) {
+    if (!execCacheRemote.empty()) {
+      sharedCache = make_unique<remoteCache>(execCacheRemote, log);
+    }
+    // Logical time and random numbers the exec saw change what it wrote.
+    string salt = string(APP_VERSION) + " " +
+        to_string(epoch.time_since_epoch().count()) + " " +
+        to_string(clock_step.count()) + " " + to_string(prngSeed);
+    execs = make_unique<execCache>(
+        execCacheDir, *fileHashes, salt, remoteExecCommand, sharedCache.get());
+  }
+  if (!dependenciesFile.empty()) {
+    dependencies =
+        make_unique<dependencyManifest>(dependenciesFile, *fileHashes);
+  }
+  if (!hashOutputsFile.empty()) {
+    outputs = make_unique<outputHasher>(hashOutputsFile);
+    myGlobalState.hashOutputs = true;
+  }
+  if (!suggestProfileFile.empty()) {
+    suggestion = make_unique<profileSuggestion>(suggestProfileFile);
+  }
+  for (auto& file : syntheticFileSources) {
+    synthetic.add(file.first, file.second);
+  }
+  if (cpus != 0) {
+    synthetic.addMachine(cpus);
+  }
+  if (!synthetic.empty()) {
+    myGlobalState.synthetic = &synthetic;
+  }
+  if (!logFilterText.empty()) {
+    log.filterBy(logFilter::parse(logFilterText));
+  }
+  if (logShards) {
+    log.shardByThreadGroup();
+  }
+  if (watchdogRounds != 0) {
+    myScheduler.watchForStalls(watchdogRounds);
+  }
+  if (pinTracerCpu != -1) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(pinTracerCpu, &cpus);
+    doWithCheck(
+        sched_setaffinity(0, sizeof(cpus), &cpus),
+        [&]() {
+          return "Unable to pin tracer to cpu " + to_string(pinTracerCpu);
+        });
+  }
+  myGlobalState.predictMissingFiles = !parallel && !execs && !rnr::loaded();
+  myGlobalState.pathUpdatesInPreHooks = !parallel && !execs && !rnr::loaded();
+  myGlobalState.tracerSocketReads = allow_network && !parallel;
+  myGlobalState.tracerEventfds = !parallel;
+  myGlobalState.pipeSize = pipeSize;
+  myGlobalState.cpus = cpus;
+  if (fakeroot) {
+    myGlobalState.fakeroot = &fakeOwners;
+  }
+  myGlobalState.skipSystemCalls = !kernelPre4_8 && !rnr::loaded();
+  // Plugins see every system call, and --hash-outputs every write: those let
+  // through go in the side effect ring, but --lite tracees sharing one may run
+  // at the same time.
+  if (sitePatching && !rnr::loaded()) {
+    bufferedSystemCalls = (uint64_t)1 << SYS_read;
+    if (!myGlobalState.hashOutputs || !lite) {
+      bufferedSystemCalls |= (uint64_t)1 << SYS_write;
+    }
+    if (myGlobalState.hashOutputs && !lite) {
+      recordedSystemCalls = (uint64_t)1 << SYS_write;
+    }
+  }
+
+  if (!inodeSnapshotFile.empty()) {
+    snapshotInodes = loadInodeSnapshot(
+        inodeSnapshotFile, snapshotFingerprint, myGlobalState.inodeMap,
+        myGlobalState.mtimeMap, log);
+    exeHashes->load(inodeSnapshotFile + ".executables");
+    if (knownSites) {
+      knownSites->load(inodeSnapshotFile + ".patch-sites");
+    }
+    if (startups) {
+      startups->load(inodeSnapshotFile + ".startup-reads");
+    }
+  }
+  exportTables();
 
   // First process is special and we must set the options ourselves.
   // This is done everytime a new process is spawned.
   ptracer::setOptions(startingPid);
 }
 // =======================================================================================
+void execution::exportTables() {
+  if (!tables.valid()) {
+    DETTRACE_LOG(
+        log, Importance::info, "Unable to create shared tables: %s\n",
+        strerror(errno));
+    return;
+  }
+  myGlobalState.inodeMap.mappings().forEach([this](ino_t real, ino_t virt) {
+    tables.publishInode(real, virt);
+  });
+  for (auto& mtime : myGlobalState.mtimeMap) {
+    tables.publishMtime(
+        mtime.first, chrono::duration_cast<chrono::microseconds>(
+                         mtime.second.time_since_epoch())
+                         .count());
+  }
+  tables.publishEpoch(chrono::duration_cast<chrono::microseconds>(
+                          myGlobalState.epoch.time_since_epoch())
+                          .count());
+  myGlobalState.publishRandomPositions();
+  myGlobalState.tables = &tables;
+  sharedTables* exported = &tables;
+  myGlobalState.inodeMap.onMapping = [exported](ino_t real, ino_t virt) {
+    exported->publishInode(real, virt);
+  };
+}
+// =======================================================================================
+void execution::recordTrace(
+    traceEvent event,
+    pid_t pid,
+    int64_t number,
+    const uint64_t* args,
+    int64_t returnValue) {
+  if (!traceOutput && !traceStreamOutput) {
+    return;
+  }
+
+  traceRecord r = {};
+  r.pid = pid;
+  r.event = event;
+  r.number = number;
+  if (args != nullptr) {
+    memcpy(r.args, args, sizeof(r.args));
+  }
+  r.returnValue = returnValue;
+  state* s = processes.find(pid);
+  if (s != nullptr) {
+    r.logicalTime = s->getLogicalTime().time_since_epoch().count();
+  }
+  if (traceOutput) {
+    traceOutput->append(r);
+  }
+  if (traceStreamOutput) {
+    traceStreamOutput->append(r);
+  }
+}
+// =======================================================================================
+void execution::recordSystemCallTrace(
+    traceEvent event, pid_t pid, int64_t returnValue) {
+  if (!traceOutput && !traceStreamOutput) {
+    return;
+  }
+
+  const uint64_t args[6] = {tracer.arg1(), tracer.arg2(), tracer.arg3(),
+                            tracer.arg4(), tracer.arg5(), tracer.arg6()};
+  recordTrace(event, pid, tracer.getSystemCallNumber(), args, returnValue);
+}
+// =======================================================================================
 // We only call this function on a ptrace::nonEventExit.
 
 // Notice it's the last-child-alive's job to schedule a finished parent to exit.
@@ -104,44 +458,62 @@ execution::execution(
 // with live children will never get a nonEventExit.
 bool execution::handleNonEventExit(const pid_t traceesPid) {
   // We are done. Erase ourselves from our parent's list of children.
-  pid_t parent = eraseChildEntry(processTree, traceesPid);
-  auto tgNumber = myGlobalState.threadGroupNumber.at(traceesPid);
-
-  // Erase tracee from our state.
-  if (states.erase(traceesPid) != 1) {
-    runtimeError("Not such tracee to delete: " + to_string(traceesPid));
+  // Also unlinks us from our thread group.
+  pid_t threadGroup = processes.threadGroupOf(traceesPid);
+  // Whoever reaps us hears of all we did, see childReaped.
+  if (myGlobalState.vectorClocks && traceesPid == threadGroup) {
+    myGlobalState.exitClocks[traceesPid] =
+        myGlobalState.causalSend(processes.at(traceesPid));
   }
-
-  // if this is a thread, clean up the thread specific state that we save.
-  if (myGlobalState.liveThreads.count(traceesPid) != 0) {
-    if (myGlobalState.liveThreads.erase(traceesPid) != 1) {
-      runtimeError(
-          "Not such thread to delete from liveThreads: " +
-          to_string(traceesPid));
-    }
-    if (myGlobalState.threadGroupNumber.erase(traceesPid) != 1) {
-      runtimeError(
-          "Not such thread to delete from threadGroupNumber: " +
-          to_string(traceesPid));
-    }
+  pid_t parent = processes.remove(traceesPid);
+  if (execs) {
+    execs->exited(traceesPid);
   }
-
-  // If thread, we should always be able to delete this entry.
-  // If process, then it should have their own thread group as well.
-  deleteMultimapEntry(myGlobalState.threadGroups, tgNumber, traceesPid);
+  if (exeHashes) {
+    exeHashes->exited(traceesPid);
+  }
+  if (startups) {
+    startups->exited(traceesPid);
+  }
+  if (dependencies) {
+    dependencies->exited(traceesPid);
+  }
+  if (statsOutput) {
+    statsOutput->exited(traceesPid);
+  }
+  branches.detach(traceesPid);
+  hardware.detach(traceesPid);
+  order.remove(traceesPid);
+  collectedStops.erase(traceesPid);
+  myGlobalState.futexes.remove(traceesPid);
+
+  // Whoever was waiting on us can try again: our parent in wait4/waitid, our
+  // thread group on the futex the kernel wakes as a thread exits, and anyone on
+  // the other end of our pipes.
+  if (parent != -1) {
+    myScheduler.wake(waitKind::childExit, parent);
+  }
+  myScheduler.wake(waitKind::futex, threadGroup);
+  // We don't know the address the kernel wakes (CLONE_CHILD_CLEARTID), all
+  // futexes of our thread group get a spurious wake up.
+  wakeFutexWaiters(
+      myGlobalState, myScheduler, myGlobalState.futexes.wakeAll(threadGroup));
+  wakePipeWaiters(myScheduler);
 
   // Parent has no childrent left, and want's to exit! Schedule for exit as it
   // is no longer in our scheduler's heaps.
   if (parent != -1 && // We have no parent, we're root.
       myScheduler.isFinished(
           parent) && // Check if our parent is marked as finished.
-      processTree.count(parent) == 0) { // Parent has no children left.
-    log.writeToLog(
-        Importance::info,
+      !processes.hasChildren(parent)) { // Parent has no children left.
+    DETTRACE_LOG(
+        log, Importance::info,
         "All children of finished parent %d have exited"
         ", scheduling parent for exiting.\n",
         parent);
     myScheduler.removeAndScheduleParent(traceesPid, parent);
+    // With --parallel there is no next getNextEvent, commitParallel takes it.
+    exitingParent = parent;
     return false;
   }
   // This is the base case for any process, we have no children, and no parent
@@ -158,32 +530,76 @@ bool execution::handleNonEventExit(const pid_t traceesPid) {
   }
 }
 // =======================================================================================
+bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
+  return kernelPre4_8
+      ? handlePreSystemCall<legacyKernel>(currState, traceesPid)
+      : handlePreSystemCall<modernKernel>(currState, traceesPid);
+}
+// =======================================================================================
 // Despite what the name will imply, this function is actually called during a
 // ptrace seccomp event. Not a pre-system call event. In newer kernel version
 // there is no need to deal with ptrace pre-system call events. So the only
 // reason we refer to it here is for backward compatibility reasons.
+template <typename Kernel>
 bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
   int syscallNum = tracer.getSystemCallNumber();
 
-  if (syscallNum < 0 || syscallNum > SYSTEM_CALL_COUNT) {
+  if (syscallNum < 0 || syscallNum >= SYSTEM_CALL_COUNT) {
     runtimeError("Unkown system call number: " + to_string(syscallNum));
   }
+  logAbout(traceesPid, syscallNum);
 
   // Print!
-  string systemCall = systemCallMappings[syscallNum];
-  string redColoredSyscall = log.makeTextColored(Color::red, systemCall);
-  log.writeToLog(
-      Importance::inter, "[Pid %d] Intercepted %s\n", traceesPid,
-      redColoredSyscall.c_str());
+  DETTRACE_LOG(
+      log, Importance::inter, "[Pid %d] Intercepted %s\n", traceesPid,
+      log.makeTextColored(Color::red, systemCallMappings[syscallNum]).c_str());
   log.setPadding();
-
-  bool callPostHook =
+  recordSystemCallTrace(traceEvent::syscallPre, traceesPid, 0);
+  profileTrap(traceesPid, systemCallMappings[syscallNum]);
+  currState.systemCallSinceOverflow = true;
+
+  myGlobalState.scratch.reset();
+  if (execs && syscallNum == SYS_execve &&
+      execs->restore(myGlobalState, currState, tracer)) {
+    // The outputs are in place, exit like the cached run did without running.
+    tracer.changeSystemCall(SYS_exit_group);
+    tracer.writeArg1(0);
+    syscallNum = SYS_exit_group;
+  }
+  if (execs && syscallNum == SYS_exit_group) {
+    execs->exitGroup(traceesPid, (int)tracer.arg1());
+  }
+  hookCounts before = hookCountsNow();
+  bool callPostHook = replayInput(currState, syscallNum) ||
       callPreHook(syscallNum, myGlobalState, currState, tracer, myScheduler);
+  // The handler held the system call back, it has not happened yet.
+  if (currState.deferredPreHook) {
+    countHook(traceesPid, syscallNum, false, before);
+    return false;
+  }
   if (syscallNum != SYS_arch_prctl) {
     rnr::callPreHook(syscallNum, myGlobalState, currState, tracer, myScheduler);
   }
+  countHook(traceesPid, syscallNum, false, before);
+  // Reads and writes we let through, or answered like those of /dev/null.
+  if (sitePatching &&
+      (((syscallNum == SYS_read || syscallNum == SYS_write) &&
+        (!callPostHook || currState.systemCallSkipped)) ||
+       syscallNum == SYS_clock_gettime || syscallNum == SYS_gettimeofday ||
+       syscallNum == SYS_time)) {
+    bufferSystemCallSite(currState, syscallNum);
+  }
+  // Emulated in this stop, the kernel skips it.
+  if (currState.systemCallSkipped) {
+    currState.systemCallSkipped = false;
+    callPostHook = false;
+    skippedSystemCalls++;
+    myScheduler.madeProgress();
+  } else if (!callPostHook) {
+    myScheduler.ranSystemCall();
+  }
 
-  if (kernelPre4_8) {
+  if (Kernel::doubleSyscallEvents) {
     // Next event will be a sytem call pre-exit event as older kernels make us
     // catch the seccomp event and the ptrace pre-system call event.
     currState.onPreExitEvent = true;
@@ -194,13 +610,14 @@ bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
   // See:
   // https://stackoverflow.com/questions/29997244/
   // occasionally-missing-ptrace-event-vfork-when-running-ptrace
-  if (systemCall == "fork" || systemCall == "vfork" || systemCall == "clone") {
+  if (syscallNum == SYS_fork || syscallNum == SYS_vfork ||
+      syscallNum == SYS_clone) {
     processSpawnEvents++;
     int status;
     ptraceEvent e;
     pid_t newPid;
 
-    if (kernelPre4_8) {
+    if (Kernel::doubleSyscallEvents) {
       // fork/vfork/clone pre system call.
       // On older version of the kernel, we would need to catch the pre-system
       // call event to forking system calls. This is event needs to be taken off
@@ -214,7 +631,7 @@ bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
     }
   }
 
-  if (kernelPre4_8) {
+  if (Kernel::doubleSyscallEvents) {
     // This is the seccomp event where we do the work for the pre-system call
     // hook. In older versions of seccomp, we must also do the pre-exit ptrace
     // event, as we have to. This is dictated by this variable.
@@ -228,1451 +645,2617 @@ void execution::handlePostSystemCall(state& currState) {
   int syscallNum = tracer.getSystemCallNumber();
 
   // No idea what this system call is! error out.
-  if (syscallNum < 0 || syscallNum > SYSTEM_CALL_COUNT) {
+  if (syscallNum < 0 || syscallNum >= SYSTEM_CALL_COUNT) {
     runtimeError("Unkown system call number: " + to_string(syscallNum));
   }
+  logAbout(currState.traceePid, syscallNum);
 
-  string syscallName = systemCallMappings[syscallNum];
-  log.writeToLog(
-      Importance::info, "Calling post hook for: " + syscallName + "\n");
+  DETTRACE_LOG(
+      log, Importance::info, "Calling post hook for: %s\n",
+      systemCallMappings[syscallNum].c_str());
 
   if (SYS_times == syscallNum || SYS_time == syscallNum) {
     // for syscalls with a nondet return value, print it at Importance::extra
-    log.writeToLog(
-        Importance::extra, "(nondet) Value before handler: %d\n",
+    DETTRACE_LOG(
+        log, Importance::extra, "(nondet) Value before handler: %d\n",
         tracer.getReturnValue());
   } else {
-    log.writeToLog(
-        Importance::info, "Value before handler: %d\n",
+    DETTRACE_LOG(
+        log, Importance::info, "Value before handler: %d\n",
         tracer.getReturnValue());
   }
 
+  myGlobalState.scratch.reset();
+  hookCounts before = hookCountsNow();
+  uint64_t replaysBefore = myGlobalState.totalReplays;
   callPostHook(syscallNum, myGlobalState, currState, tracer, myScheduler);
+  // Replayed calls only return to the tracee later.
+  if (myGlobalState.totalReplays == replaysBefore) {
+    recordInput(currState, syscallNum);
+    myScheduler.madeProgress();
+    if (execs) {
+      execs->systemCall(myGlobalState, currState, tracer, syscallNum);
+    }
+    if (dependencies) {
+      dependencies->systemCall(currState, tracer, syscallNum);
+    }
+    if (startups) {
+      startups->systemCall(currState, tracer, syscallNum);
+    }
+    if (outputs) {
+      outputs->systemCall(currState, tracer, syscallNum);
+    }
+  } else {
+    myScheduler.replayed(currState.traceePid);
+    currState.replayedSystemCall = syscallNum;
+    currState.replayedArg1 = tracer.arg1();
+  }
   if (syscallNum != SYS_arch_prctl) {
     rnr::callPostHook(
         syscallNum, myGlobalState, currState, tracer, myScheduler);
   }
+  countHook(currState.traceePid, syscallNum, true, before);
 
-  log.writeToLog(
-      Importance::info, "Value after handler: %d\n", tracer.getReturnValue());
+  DETTRACE_LOG(
+      log, Importance::info, "Value after handler: %d\n",
+      tracer.getReturnValue());
+  recordSystemCallTrace(
+      traceEvent::syscallPost, currState.traceePid, tracer.getReturnValue());
 
   log.unsetPadding();
   return;
 }
 
 // =======================================================================================
-int execution::runProgram() {
-  // When using seccomp, we run with PTRACE_CONT, but seccomp only reports
-  // pre-hook events. To get post hook events we must call ptrace with
-  // PTRACE_SYSCALL intead. This happens in @getNextEvent.
-
-  log.writeToLog(Importance::inter, "dettrace starting up\n");
-
-  // Once all process' have ended. We exit.
-  bool exitLoop = false;
-
-  // Iterate over entire process' and all subprocess' execution.
-  while (!exitLoop) {
-    int status;
-    pid_t traceesPid;
-    ptraceEvent ret;
-
-    pid_t nextPid = myScheduler.getNext();
-    bool post = states.at(nextPid).callPostHook;
-    tie(ret, traceesPid, status) = getNextEvent(nextPid, post);
-
-    // Most common event. We handle the pre-hook for system calls here.
-    if (ret == ptraceEvent::seccomp) {
-      log.writeToLog(Importance::extra, "Is seccomp event!\n");
-      systemCallsEvents++;
-      states.at(traceesPid).callPostHook = handleSeccomp(traceesPid);
-      continue;
-    }
-
-    // We still need this case even though we use seccomp + bpf. Since we do
-    // post-hook interception of system calls through PTRACE_SYSCALL. Only post
-    // system call events come here.
-    if (ret == ptraceEvent::syscall) {
-      // For older kernels, we see a system call event and we also see a handle
-      // seccomp event. I chose to always handle the pre-system call on the
-      // ptracer seccomp event. So we skip the pre-system call event here on
-      // older kernels.
-      state& currentState = states.at(traceesPid);
-
-      // old-kernel-only ptrace system call event for pre exit hook.
-      if (kernelPre4_8 && currentState.onPreExitEvent) {
-        states.at(traceesPid).callPostHook = true;
-        currentState.onPreExitEvent = false;
-      } else {
-        // Only count here due to comment above (we see this event twice in
-        // older kernels).
-        systemCallsEvents++;
-        tracer.updateState(traceesPid);
-        handlePostSystemCall(currentState);
-        // set callPostHook to default value for next iteration.
-        states.at(traceesPid).callPostHook = false;
-      }
+/** One open file of a tracee, see openFiles. */
+struct openFile {
+  pid_t pid;
+  int fd;
+  bool writable;
+  bool readable;
+};
 
-      continue;
+/**
+ * Which tracee holds what open, by the /proc/pid/fd link, "pipe:[1234]".
+ * Threads mostly share their leader's fds and are left out.
+ */
+static map<string, vector<openFile>> openFiles(processTable& processes) {
+  map<string, vector<openFile>> files;
+  processes.forEach([&](pid_t pid, state&) {
+    if (processes.isThread(pid)) {
+      return;
     }
-
-    // Current process was ended by signal.
-    if (ret == ptraceEvent::terminatedBySignal) {
-      auto msg = log.makeTextColored(
-          Color::blue, "Process [%d] ended by signal %d.\n");
-      log.writeToLog(Importance::inter, msg, traceesPid, WTERMSIG(status));
-      exitLoop = handleNonEventExit(traceesPid);
-      continue;
+    string fdDir = "/proc/" + to_string(pid) + "/fd";
+    DIR* dir = opendir(fdDir.c_str());
+    if (dir == nullptr) {
+      return;
     }
-
-    /**
-       A process needs to do two things before dying:
-       1) eventExit through ptrace. This process is not truly done, it is
-       stopped until we let it continue and all it's children have also
-       finished. 2) A nonEventExit at this point the process is done and can no
-       longer be peeked or poked.
-
-       If the process has remaining children, we will get an eventExit but the
-       nonEventExit will never arrive. Therefore we set process as exited.
-       Only when all children have exited do we get a the nonEvent exit.
-
-       Therefore we keep track of the process hierarchy and only wait for the
-       evenExit when our children have exited.
-    */
-    if (ret == ptraceEvent::eventExit) {
-      auto msg = log.makeTextColored(
-          Color::blue,
-          "Process [%d] has finished. "
-          "With ptraceEventExit, exit_code: %d.");
-      log.writeToLog(Importance::inter, msg, traceesPid, exit_code);
-      states.at(traceesPid).callPostHook = false;
-
-      bool isExitGroup = states.at(traceesPid).isExitGroup;
-      pid_t threadGroup = myGlobalState.threadGroupNumber.at(traceesPid);
-
-      // there is two reasons this is necessary
-      // 1) case where a thread called exit group: this process goes on to
-      // exit like a normal non-threaded non-exit grouped process would, and we
-      // don't want the check in ptraceEvent::nonEventExit to kill it.
-      // 2) in the event where this process is the only process in the process
-      // group, it will do the same as #1. Only when we have a non-main thread
-      // call exit group, do we not need to set this flag, and that's only
-      // because this flag is per process/thread!
-      states.at(traceesPid).isExitGroup = false;
-      // We state that the main process in a thread group was killed by an exit
-      // group, this way, the main process ever stops responding, we know why.
-      // This is needed as this process may get stuck in getNextEvent
-      // otherwise... states.at(threadGroup).killedByExitGroup = true;
-
-      // Iterate through all threads in this exit group exiting them.
-      // Only go in here for exit groups where there is threads. By default,
-      // there is at least 1 (the process)
-      log.writeToLog(
-          Importance::info, "thread group #%d\n",
-          myGlobalState.threadGroups.count(threadGroup));
-
-      if (isExitGroup && myGlobalState.threadGroups.count(threadGroup) != 1) {
-        auto msg =
-            "Caught exit group! Ending all thread in our process group %d.\n";
-        log.writeToLog(Importance::info, msg, threadGroup);
-
-        // Mark as finished so that handleNonEventExit function takes care of
-        // eventually deleting parent process.
-        myScheduler.markFinishedAndScheduleNext(threadGroup);
-
-        // Make a copy to avoid deleting entries in original (done in
-        // handleTraceeExit) while iterating through it.
-        auto copyThreadGroups = myGlobalState.threadGroups;
-        auto iterpair = copyThreadGroups.equal_range(threadGroup);
-        auto it = iterpair.first;
-
-        for (; it != iterpair.second; ++it) {
-          pid_t thread = it->second;
-
-          if (threadGroup == thread) {
-            // This is not a thread! This is the thread group leader (process),
-            // skip.
-            continue;
-          }
-
-          auto msg = "Manually exiting thread %d after exit_group.\n";
-          log.writeToLog(Importance::info, msg, thread);
-
-          ptraceEvent event;
-          int ret = ptrace(PTRACE_CONT, thread, 0, 0);
-
-          if (ret == -1 && errno == ESRCH) {
-            event = handleExitedThread(thread);
-          } else if (ret == -1) {
-            runtimeError("Unexpected error from ptrace(CONT) on thread exit.");
-            exit(1); // we will never get here.
-          } else {
-            // Great, thread is still responding, let if continue to it's
-            // nonEventExit.
-            doWithCheck(
-                waitpid(thread, &status, 0),
-                "waitpid for nonEventExit failed.");
-            event = getPtraceEvent(status);
-          }
-
-          if (event != ptraceEvent::nonEventExit) {
-            runtimeError(
-                "Unexpected ptrace event!" + to_string(int(event)) + "\n");
-          }
-          // We have allowed to process to exit through the OS. Now, clean up
-          // our state for this thread.
-          handleNonEventExit(thread);
-        }
+    while (dirent* entry = readdir(dir)) {
+      if (entry->d_name[0] == '.') {
         continue;
       }
-
-      // We have children still, we cannot exit.
-      if (processTree.count(traceesPid) != 0) {
-        myScheduler.markFinishedAndScheduleNext(traceesPid);
-      } else {
-        // We have no more children, nothing stops us from exiting, we continue
-        // to the next event, which we expect to be a nonEventExit
-      }
-      continue;
-    }
-
-    // Current process is finally truly done (unlike eventExit).
-    if (ret == ptraceEvent::nonEventExit) {
-      if (states.at(traceesPid).isExitGroup) {
-        // never seen this, don't know how to handle.
-        runtimeError(
-            "We should not see nonEventExit from a exitGroup event.\n");
+      char link[PATH_MAX];
+      string path = fdDir + "/" + entry->d_name;
+      ssize_t n = readlink(path.c_str(), link, sizeof(link));
+      if (n <= 0) {
+        continue;
       }
-
-      auto msg = log.makeTextColored(
-          Color::blue,
-          "Process [%d] has finished. "
-          "With ptraceNonEventExit.\n");
-      log.writeToLog(Importance::inter, msg, traceesPid);
-
-      states.at(traceesPid).callPostHook = false;
-      if (processTree.count(traceesPid) != 0) {
-        runtimeError(
-            "We receieved a nonEventExit with children left."
-            "This should be impossible!");
-      } else {
-        exitLoop = handleNonEventExit(traceesPid);
+      openFile file{pid, atoi(entry->d_name), false, false};
+      // The access mode is in the flags line of fdinfo, in octal.
+      ifstream info(
+          "/proc/" + to_string(pid) + "/fdinfo/" + entry->d_name);
+      string key;
+      int flags = 0;
+      while (info >> key) {
+        if (key == "flags:") {
+          info >> oct >> flags;
+          break;
+        }
       }
-      continue;
+      file.readable = (flags & O_ACCMODE) != O_WRONLY;
+      file.writable = (flags & O_ACCMODE) != O_RDONLY;
+      files[string(link, n)].push_back(file);
     }
-
-    // We have encountered a call to fork, vfork, clone.
-    if (ret == ptraceEvent::fork || ret == ptraceEvent::vfork ||
-        ret == ptraceEvent::clone) {
-      tracer.updateState(traceesPid);
-      int syscallNumber = (int)tracer.getSystemCallNumber();
-      string msg = "none";
-      bool isThread = false;
-
-      // Per ptrace man page: we cannot reliably tell a clone syscall from it's
-      // event, so we check explicitly.
-      switch (syscallNumber) {
-      case SYS_fork:
-        msg = "fork";
-        break;
-      case SYS_vfork:
-        msg = "vfork";
-        break;
-      case SYS_clone: {
-        msg = "clone";
-        unsigned long flags = (unsigned long)tracer.arg1();
-        isThread = (flags & CLONE_THREAD) != 0;
-        // if((flags & CLONE_FILES) != 0){
-        // runtimeError("We do not support CLONE_FILES\n");
-        // }
-        break;
-      }
-      default:
-        runtimeError(
-            "Uknown syscall number from fork/clone event: " +
-            to_string(syscallNumber));
-      }
-
-      log.writeToLog(
-          Importance::inter,
-          log.makeTextColored(Color::blue, "[%d] caught %s event!\n"),
-          traceesPid, msg.c_str());
-
-      handleForkEvent(traceesPid, isThread);
-      states.at(traceesPid).callPostHook = false;
+    closedir(dir);
+  });
+  return files;
+}
+// =======================================================================================
+void execution::reportStall() {
+  const scheduler::stallReport& stall = myScheduler.lastStall();
+  string report = "[dettrace] watchdog: in the last " +
+      to_string(stall.rounds) + " rounds of retries, " +
+      to_string(stall.progress) + " system calls made progress and " +
+      to_string(stall.replays) + " were replayed.\n";
+  report += "  Scheduler:\n" + myScheduler.describeQueues("    ");
+
+  // Most replayed first.
+  vector<pair<uint64_t, pid_t>> replayed;
+  for (auto& r : stall.replaysOf) {
+    replayed.push_back({r.second, r.first});
+  }
+  sort(replayed.rbegin(), replayed.rend());
+  map<string, vector<openFile>> files = openFiles(processes);
+  report += "  Replayed:\n";
+  for (auto& r : replayed) {
+    pid_t pid = r.second;
+    report += "    [" + to_string(pid) + "] " + to_string(r.first) +
+        " replays";
+    state* s = processes.find(pid);
+    if (s == nullptr || s->replayedSystemCall == -1) {
+      report += ", since exited\n";
       continue;
     }
-
-    if (ret == ptraceEvent::exec) {
-      log.writeToLog(
-          Importance::inter,
-          log.makeTextColored(Color::blue, "[%d] Caught execve event!\n"),
-          traceesPid);
-      // reset CPUID trap flag
-      states.at(traceesPid).CPUIDTrapSet = false;
-
-      handleExecEvent(traceesPid);
+    int fd = (int)s->replayedArg1;
+    report += " of " + systemCallMappings[s->replayedSystemCall] + ", arg1 " +
+        to_string(s->replayedArg1);
+    // Who holds the other end of what it waits on, if arg1 is an fd.
+    char link[PATH_MAX];
+    string path = "/proc/" + to_string(processes.threadGroupOf(pid)) +
+        "/fd/" + to_string(fd);
+    ssize_t n = readlink(path.c_str(), link, sizeof(link));
+    if (n <= 0) {
+      report += "\n";
       continue;
     }
-
-    if (ret == ptraceEvent::signal) {
-      int signalNum = WSTOPSIG(status);
-      handleSignal(signalNum, traceesPid);
+    string file(link, n);
+    report += ", fd " + to_string(fd) + " is " + file + "\n";
+    if (file.compare(0, 5, "pipe:") != 0 &&
+        file.compare(0, 7, "socket:") != 0) {
       continue;
     }
-
-    runtimeError(
-        to_string(traceesPid) +
-        " Uknown return value for ptracer::getNextEvent()\n");
+    for (const openFile& holder : files[file]) {
+      report += "      also open in [" + to_string(holder.pid) + "] fd " +
+          to_string(holder.fd) +
+          (holder.readable ? holder.writable ? ", read and write" : ", read"
+                           : ", write") +
+          "\n";
+    }
   }
 
-  // DEVRAND STEP 5: clean up /dev/[u]random fifo threads
-  doWithCheck(
-      pthread_cancel(devRandomPthread), "pthread_cancel /dev/random pthread");
-  doWithCheck(
-      pthread_cancel(devUrandomPthread), "pthread_cancel /dev/urandom pthread");
-
-  auto msg = log.makeTextColored(
-      Color::blue, "All processes done. Finished successfully!\n");
-  log.writeToLog(Importance::info, msg);
-
-  if (printStatistics) {
-    auto printStat = [&](string type, uint32_t value) {
-      string preStr = "dettrace Statistic. ";
-      cerr << preStr + type + to_string(value) << endl;
-    };
-
-    cerr << endl;
-    printStat("System Call Events: ", systemCallsEvents);
-    printStat("rdtsc instructions: ", rdtscEvents);
-    printStat("rdtscp instructions: ", rdtscpEvents);
-    printStat("read retries: ", myGlobalState.readRetryEvents);
-    printStat("write retries: ", myGlobalState.writeRetryEvents);
-    printStat("getRandom() calls: ", myGlobalState.getRandomCalls);
-    printStat("/dev/urandom opens: ", myGlobalState.devUrandomOpens);
-    printStat("/dev/random opens: ", myGlobalState.devRandomOpens);
-    printStat("Time Related Sytem Calls: ", myGlobalState.timeCalls);
-    printStat("Process spawn events: ", processSpawnEvents);
-    printStat(
-        "Calls for scheduling next process: ",
-        myScheduler.callsToScheduleNextProcess);
-    printStat(
-        "Replays due to blocking system call: ",
-        myGlobalState.replayDueToBlocking);
-    printStat("Total replays: ", myGlobalState.totalReplays);
-    printStat("ptrace peeks: ", tracer.ptracePeeks);
-    printStat("process_vm_reads: ", tracer.readVmCalls);
-    printStat("process_vm_writes: ", tracer.writeVmCalls);
-  }
-
-  if (!myGlobalState.liveThreads.empty()) {
-    cerr << "Live thread set is not empty! We miss counted the threads "
-            "somewhere..."
-         << endl;
-    exit(1);
+  cerr << report << flush;
+  DETTRACE_LOG_NO_FORMAT(log, Importance::inter, report);
+}
+// =======================================================================================
+void execution::logAbout(pid_t pid, int syscallNum) {
+  if (log.getFilter() == nullptr && !log.isSharded()) {
+    return;
   }
-
-  if (!myGlobalState.threadGroups.empty()) {
-    cerr
-        << "threadGroups is not empty! We miss counted the threads somewhere..."
-        << endl;
-    exit(1);
+  pid_t threadGroup = pid;
+  int64_t time = 0;
+  if (processes.contains(pid)) {
+    threadGroup = processes.threadGroupOf(pid);
+    time = (processes.at(pid).getLogicalTime() - epoch).count();
   }
-
-  return exit_code;
-  // Add a check for states.empty(). Not adding it now since I don't want a
-  // bunch of packages. to fail over this :b
+  log.setContext(pid, threadGroup, syscallNum, time);
 }
 // =======================================================================================
-pid_t execution::handleForkEvent(const pid_t traceesPid, bool isThread) {
-  processSpawnEvents++;
-
-  pid_t newChildPid = ptracer::getEventMessage(traceesPid);
-  auto threadGroup = myGlobalState.threadGroupNumber.at(traceesPid);
-
-  if (isThread) {
-    myGlobalState.liveThreads.insert(newChildPid);
-    auto msg = log.makeTextColored(
-        Color::blue, "Adding thread %d to thread group %d\n");
-    log.writeToLog(Importance::info, msg, newChildPid, threadGroup);
-
-    // Careful here, the thread group is not necessarily traceesPid, as
-    // traceesPid may be a thread, fetch the actual threadGroup by querying our
-    // (traceesPid) thread group number.
-    myGlobalState.threadGroups.insert({threadGroup, newChildPid});
-    myGlobalState.threadGroupNumber.insert({newChildPid, threadGroup});
-  } else {
-    auto msg =
-        log.makeTextColored(Color::blue, "Creating new thread group: %d\n");
-    log.writeToLog(Importance::info, msg, newChildPid);
-
-    // This should not happen! (Pid recycling?)
-    if (myGlobalState.threadGroups.count(newChildPid) != 0) {
-      runtimeError("Thread group already existed.\n");
-    }
-
-    // This is a process it owns it's own process group, create it.
-    myGlobalState.threadGroups.insert({newChildPid, newChildPid});
-    myGlobalState.threadGroupNumber.insert({newChildPid, newChildPid});
-  }
-
-  // If a thread T1 spawns thread T2, then T1 is NOT the parent of T2. The
-  // parent is always the process (the thread group leader) that T1 belongs to.
-  // This is where we add new children to the thread group leader.
-  processTree.insert(make_pair(threadGroup, newChildPid));
-
-  state& parent_state = states.at(traceesPid);
-  // Share fdStatus. Processes get their own, threads share with thread group.
-  if (isThread) {
-    states.emplace(newChildPid, parent_state.cloned(newChildPid));
-  } else {
-    // Deep Copy!
-    states.emplace(newChildPid, parent_state.forked(newChildPid));
+void execution::profileTrap(pid_t pid, const string& trap) {
+  if (!trapProfileOutput) {
+    return;
   }
-  // Add this new process to our states.
-
-  log.writeToLog(
-      Importance::info,
-      log.makeTextColored(Color::blue, "Added process [%d] to states map.\n"),
-      newChildPid);
-
-  // Let child run instead of the parent, inform scheduler of new process.
-  myScheduler.addAndScheduleNext(newChildPid);
-
-  // during fork, the parent's mmaped memory are COWed, as we set the mapping
-  // attributes to MAP_PRIVATE. new child's `mmapMemory` hence must be inherited
-  // from parent process, to be consistent with fork() semantic.
-  // TODO for threads we may not need to do this?!
-  // states.at(newChildPid).mmapMemory.doesExist = true;
-  // states.at(newChildPid).mmapMemory.setAddr(states.at(traceesPid).mmapMemory.getAddr());
-
-  // Wait for child to be ready.
-  log.writeToLog(
-      Importance::info,
-      log.makeTextColored(
-          Color::blue, "Waiting for child to be ready for tracing...\n"));
-  int status;
-  int retPid = doWithCheck(waitpid(newChildPid, &status, 0), "waitpid");
-  // This should never happen.
-  if (retPid != newChildPid) {
-    runtimeError("wait call return pid does not match new child's pid.");
+  struct user_regs_struct regs = tracer.getRegs();
+  trapProfileOutput->trapped(pid, trap, regs.rip, regs.rbp);
+}
+// =======================================================================================
+/**
+ * Tracee buffers an input fills in: the first is the data, the second
+ * recvfrom's address, whose size goes to the socklen_t at arg 6.
+ */
+static void inputBuffers(
+    int syscallNum, ptracer& t, void* buffers[INPUT_BUFFERS]) {
+  buffers[0] = buffers[1] = nullptr;
+  switch (syscallNum) {
+  case SYS_read:
+    buffers[0] = (void*)t.arg2();
+    break;
+  case SYS_recvfrom:
+    buffers[0] = (void*)t.arg2();
+    buffers[1] = (void*)t.arg5();
+    break;
+  case SYS_poll:
+    buffers[0] = (void*)t.arg1();
+    break;
   }
-  log.writeToLog(
-      Importance::info, log.makeTextColored(Color::blue, "Child ready!\n"));
-  return newChildPid;
 }
 
-static inline unsigned long alignUp(unsigned long size, int align) {
-  return (size + align - 1) & ~(align - 1);
+/** The fd an input is logged under, poll has none. */
+static int inputFd(int syscallNum, ptracer& t) {
+  return syscallNum == SYS_poll ? -1 : (int)t.arg1();
 }
 
-void execution::disableVdso(pid_t pid) {
-  struct ProcMapEntry vdsoMap, vvarMap;
-  auto procMaps = parseProcMapEntries(pid);
-  // procMaps = parseProcMapEntries(pid);
-
-  memset(&vdsoMap, 0, sizeof(vdsoMap));
-  memset(&vvarMap, 0, sizeof(vvarMap));
-
-  for (auto ent : procMaps) {
-    if (ent.procMapName == "[vdso]") {
-      vdsoMap = ent;
-    } else if (ent.procMapName == "[vvar]") {
-      vvarMap = ent;
-    } else {
+bool execution::isInput(state& s, int syscallNum) {
+  int fd = (int)tracer.arg1();
+  switch (syscallNum) {
+  case SYS_read:
+    return s.fd_is_remote(fd) || s.getFdType(fd) == fdType::procFile;
+  case SYS_recvfrom:
+  case SYS_connect:
+  case SYS_write:
+  case SYS_sendto:
+    return s.fd_is_remote(fd);
+  case SYS_poll: {
+    if (!s.fds->anyRemote() || tracer.arg1() == 0) {
+      return false;
+    }
+    size_t count = tracer.arg2();
+    struct pollfd* fds = myGlobalState.scratch.allocate<struct pollfd>(count);
+    tracer.readTraceeBatch(
+        {traceeIo(
+            traceePtr<struct pollfd>((struct pollfd*)tracer.arg1()), fds,
+            count * sizeof(struct pollfd))},
+        s.traceePid);
+    for (size_t i = 0; i < count; i++) {
+      if (s.fd_is_remote(fds[i].fd)) {
+        return true;
+      }
     }
+    return false;
   }
-
-  // vdso is enabled by kernel command line.
-  if (vdsoMap.procMapBase != 0) {
-    auto data = vdsoGetCandidateData();
-
-    for (auto func : vdsoFuncs) {
-      unsigned long offset, oldVdsoSize, vdsoAlignment;
-      tie(offset, oldVdsoSize, vdsoAlignment) = func.second;
-      unsigned long target = vdsoMap.procMapBase + offset;
-      unsigned long nbUpper = alignUp(oldVdsoSize, vdsoAlignment);
-      unsigned long nb = alignUp(data[func.first].size(), vdsoAlignment);
-      assert(nb <= nbUpper);
-
-      for (auto i = 0; i < nb / sizeof(long); i++) {
-        uint64_t val;
-        const unsigned char* z = data[func.first].c_str();
-        unsigned long to = target + 8 * i;
-        memcpy(&val, &z[8 * i], sizeof(val));
-        ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)to, (void*)val);
-      }
-
-      unsigned long off = target + nb;
-      unsigned long val = 0xccccccccccccccccUL;
-      while (nb < nbUpper) {
-        ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)off, (void*)val);
-        off += sizeof(long);
-        nb += sizeof(long);
-      }
-      assert(nb == nbUpper);
+  default:
+    return false;
+  }
+}
+// =======================================================================================
+bool execution::replayInput(state& s, int syscallNum) {
+  if (!inputs || !inputs->replaying() || !isInput(s, syscallNum)) {
+    return false;
+  }
+  const char* bytes[INPUT_BUFFERS];
+  const inputRecord& input =
+      inputs->next(syscallNum, inputFd(syscallNum, tracer), bytes);
+  void* buffers[INPUT_BUFFERS];
+  inputBuffers(syscallNum, tracer, buffers);
+
+  vector<traceeIo> writes;
+  for (int i = 0; i < INPUT_BUFFERS; i++) {
+    if (buffers[i] != nullptr && input.bufferBytes[i] > 0) {
+      writes.emplace_back(
+          traceePtr<char>((char*)buffers[i]), (char*)bytes[i],
+          input.bufferBytes[i]);
     }
   }
+  tracer.writeTraceeBatch(writes, s.traceePid);
+  if (syscallNum == SYS_recvfrom && buffers[1] != nullptr) {
+    tracer.writeToTracee(
+        traceePtr<socklen_t>((socklen_t*)tracer.arg6()),
+        (socklen_t)input.bufferBytes[1], s.traceePid);
+  }
 
-  if (vvarMap.procMapBase != 0) {
-    struct user_regs_struct regs;
-    ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-    auto oldRegs = regs;
-
-    regs.orig_rax = SYS_mprotect;
-    regs.rax = SYS_mprotect;
-    regs.rdi = vvarMap.procMapBase;
-    regs.rsi = vvarMap.procMapSize;
-    regs.rdx = PROT_NONE;
-    regs.r10 = 0;
-    regs.r8 = 0;
-    regs.r9 = 0;
-    regs.rip += 1; /* 0xcc; syscall(0x0f05); 0xcc */
-
-    int status;
+  DETTRACE_LOG(
+      log, Importance::info, "Replaying input %s = %ld\n",
+      systemCallMappings[syscallNum].c_str(), (long)input.returnValue);
+  replaceSystemCallWithNoop(myGlobalState, s, tracer, input.returnValue);
+  return true;
+}
+// =======================================================================================
+void execution::recordInput(state& s, int syscallNum) {
+  if (!inputs || inputs->replaying() || !isInput(s, syscallNum)) {
+    return;
+  }
+  inputRecord input = {};
+  input.systemCall = syscallNum;
+  input.fd = inputFd(syscallNum, tracer);
+  input.returnValue = (int64_t)tracer.getRegs().rax;
+
+  void* buffers[INPUT_BUFFERS];
+  inputBuffers(syscallNum, tracer, buffers);
+  uint32_t sizes[INPUT_BUFFERS] = {0, 0};
+  if (syscallNum == SYS_poll) {
+    sizes[0] = tracer.arg2() * sizeof(struct pollfd);
+  } else if (input.returnValue > 0) {
+    sizes[0] = input.returnValue;
+  }
+  if (buffers[1] != nullptr && input.returnValue >= 0) {
+    // The kernel put the full size of the address here, it may have written
+    // fewer bytes.
+    socklen_t written = tracer.readFromTracee(
+        traceePtr<socklen_t>((socklen_t*)tracer.arg6()), s.traceePid);
+    sizes[1] = min<uint32_t>(written, sizeof(struct sockaddr_storage));
+  }
 
-    ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
-    ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
-    assert(waitpid(pid, &status, 0) == pid);
-    assert(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
-    ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-    if ((long)regs.rax < 0) {
-      string err = "unable to inject mprotect, error: \n";
-      runtimeError(err + strerror((long)-regs.rax));
+  vector<traceeIo> reads;
+  char* bytes[INPUT_BUFFERS] = {nullptr, nullptr};
+  for (int i = 0; i < INPUT_BUFFERS; i++) {
+    if (buffers[i] == nullptr) {
+      sizes[i] = 0;
+    }
+    input.bufferBytes[i] = sizes[i];
+    bytes[i] = myGlobalState.scratch.allocate<char>(sizes[i]);
+    if (sizes[i] > 0) {
+      reads.emplace_back(
+          traceePtr<char>((char*)buffers[i]), bytes[i], sizes[i]);
     }
-    ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &oldRegs);
   }
+  tracer.readTraceeBatch(reads, s.traceePid);
+  inputs->record(input, bytes);
 }
-
-static unsigned long traceePreinitMmap(pid_t pid, ptracer& t) {
-  struct user_regs_struct regs;
-  unsigned long ret;
-
-  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-  auto oldRegs = regs;
-
-  regs.orig_rax = SYS_mmap;
-  regs.rax = SYS_mmap;
-  regs.rdi = 0;
-  regs.rsi = 0x10000;
-  regs.rdx = PROT_READ | PROT_WRITE | PROT_EXEC;
-  regs.r10 = MAP_PRIVATE | MAP_ANONYMOUS;
-  regs.r8 = -1;
-  regs.r9 = 0;
-
-  int status;
-  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
-  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
-  assert(waitpid(pid, &status, 0) == pid);
-  assert(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
-  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-  if ((long)regs.rax < 0) {
-    string err = "unable to inject syscall page, error: \n";
-    runtimeError(err + strerror((long)-regs.rax));
+// =======================================================================================
+/**
+ * Most memory the tracer ever had resident, in KiB. Per tracee state is most of
+ * what grows with a run, see benchmarking/threads.
+ */
+static uint64_t tracerPeakMemory() {
+  struct rusage usage;
+  doWithCheck(getrusage(RUSAGE_SELF, &usage), "getrusage");
+  return usage.ru_maxrss;
+}
+// =======================================================================================
+vector<pair<string, uint64_t>> execution::statisticTotals() {
+  vector<pair<string, uint64_t>> totals = {
+      {"System Call Events: ", systemCallsEvents},
+      {"rdtsc instructions: ", rdtscEvents},
+      {"rdtscp instructions: ", rdtscpEvents},
+      {"rdtsc/rdtscp sites patched: ", tscSitesPatched},
+      {"cpuid sites patched: ", cpuidSitesPatched},
+      {"system call sites patched: ", syscallSitesPatched},
+      {"sites patched before trapping: ", knownSitesPatched},
+      {"Spinning tracees preempted: ", branchPreemptions},
+      {"read retries: ", myGlobalState.readRetryEvents},
+      {"read retries skipped by probing: ", myGlobalState.readProbeDeferrals},
+      {"waits held back until a child exit: ", myGlobalState.waitDeferrals},
+      {"WNOHANG wait4s answered without running: ",
+       myGlobalState.waitPollsAnswered},
+      {"pipe reads and reaps that heard of new sends: ",
+       myGlobalState.causalReceives},
+      {"write retries: ", myGlobalState.writeRetryEvents},
+      {"getRandom() calls: ", myGlobalState.getRandomCalls},
+      {"getRandom() bytes: ", myGlobalState.getRandomBytes},
+      {"/dev/urandom opens: ", myGlobalState.devUrandomOpens},
+      {"/dev/random opens: ", myGlobalState.devRandomOpens},
+      {"/dev/[u]random reads served: ", myGlobalState.devRandomReads},
+      {"/dev/[u]random bytes served: ", myGlobalState.devRandomBytesRead},
+      {"/proc and /etc files opened from memory: ",
+       myGlobalState.syntheticOpens},
+      {"Time Related Sytem Calls: ", myGlobalState.timeCalls},
+      {"Process spawn events: ", processSpawnEvents},
+      {"peak live threads: ", processes.peakThreadCount()},
+      {"tracer peak memory (KiB): ", tracerPeakMemory()},
+      {"exec events: ", execEvents},
+      {"ptrace stops: ", ptraceStops},
+      {"mean stop to resume (ns): ", statsOutput->meanStopToResume()},
+      {"ptrace stops caught spinning: ", spunStops},
+      {"ptrace stops queued for later: ", queuedStops},
+      {"injected system calls: ", injectedSystemCalls},
+      {"injected code stops: ", injectedStops},
+      {"Calls for scheduling next process: ",
+       myScheduler.callsToScheduleNextProcess},
+      {"Replays due to blocking system call: ",
+       myGlobalState.replayDueToBlocking},
+      {"Waiting processes woken up: ", myScheduler.waitWakeups},
+      {"Producers run ahead of their turn: ", myScheduler.producersPreferred},
+      {"Timers fired: ", myScheduler.timersFired},
+      {"futex waits parked: ", myGlobalState.futexWaitsParked},
+      {"timed futex waits parked: ", myGlobalState.futexTimedWaitsParked},
+      {"thread sleeps parked: ", myGlobalState.sleepsParked},
+      {"empty poll retries: ", myGlobalState.emptyPollRetries},
+      {"polls and selects answered by the tracer: ",
+       myGlobalState.pollsInTracer},
+      {"Stat post-hooks skipped for missing files: ",
+       myGlobalState.missingStatsPredicted},
+      {"Opens of missing files skipped: ", myGlobalState.missingOpensSkipped},
+      {"Missing path cache hits: ", myGlobalState.missing.hits},
+      {"io_uring SQEs submitted: ", myGlobalState.ioUringSqes},
+      {"io_uring SQEs refused: ", myGlobalState.ioUringSqesRefused},
+      {"Eventfd reads served by the tracer: ", myGlobalState.eventfdReads},
+      {"Eventfd reads waiting for a write: ", myGlobalState.eventfdWaits},
+      {"Directory listing cache hits: ", myGlobalState.dirCacheHits},
+      {"Path prefix cache hits: ", myGlobalState.hostPaths.hits},
+      {"Directories read by the tracer: ",
+       myGlobalState.tracerDirectoryReads},
+      {"Directory listing seeks: ", myGlobalState.directorySeeks},
+      {"Inodes loaded from snapshot: ", snapshotInodes},
+      {"Inodes reclaimed after unlink: ", myGlobalState.inodesReclaimed},
+      {"Regular file reads and writes: ", myGlobalState.regularFileIo},
+      {"/dev/null reads and writes answered: ", myGlobalState.devNullIo},
+      {"Pipe bytes moved by the tracer: ", myGlobalState.tracerPipeBytes},
+      {"Socket bytes read by the tracer: ", myGlobalState.tracerSocketBytes},
+      {"Total replays: ", myGlobalState.totalReplays},
+      {"ptrace peeks: ", tracer.ptracePeeks},
+      {"Arguments restored at the next stop: ", tracer.lazyRestores},
+      {"process_vm_reads: ", tracer.readVmCalls},
+      {"process_vm_writes: ", tracer.writeVmCalls},
+      {"tracee read cache hits: ", tracer.readCacheHits},
+      {"seccomp notify events: ", notifyEvents},
+      {"System calls skipped in their seccomp stop: ", skippedSystemCalls},
+      {"Side effects drained without a stop: ", sideEffectsDrained},
+      {"Inputs recorded or replayed: ", inputs ? inputs->inputs : 0},
+      {"Input log bytes, uncompressed: ", inputs ? inputs->rawBytes : 0},
+      {"Input log bytes, compressed: ",
+       inputs ? inputs->compressedBytes : 0},
+      {"Futile retries recorded or skipped: ",
+       schedule ? schedule->futileDecisions : 0},
+      {"Execs restored from the exec cache: ", execs ? execs->hits : 0},
+      {"Execs stored in the exec cache: ", execs ? execs->stored : 0},
+      {"Exec cache misses run remotely: ", execs ? execs->remoteJobs : 0},
+      {"Execs restored from remote runs: ", execs ? execs->remoteHits : 0},
+      {"Exec cache entries fetched from the shared store: ",
+       execs ? execs->remoteFetches : 0},
+      {"Objects stored to the shared exec cache: ",
+       sharedCache ? sharedCache->stored : 0},
+      {"Output bytes hashed: ", outputs ? outputs->bytesHashed : 0},
+  };
+  for (auto& held : memoryPeak.named()) {
+    totals.push_back(
+        {"peak bytes held by the " + held.first + ": ", held.second});
   }
-  ret = regs.rax;
-  oldRegs.rip = regs.rip - 4; /* 0xcc, syscall, 0xcc = 4 bytes */
-  memcpy(&regs, &oldRegs, sizeof(regs));
-  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
-
-  return ret;
+  totals.push_back({"Tasks for helper threads: ", helpers.submitted});
+  totals.push_back({"Tasks run by helper threads: ", helpers.ranByHelpers});
+  if (hardware.enabled()) {
+    for (auto& total : hardware.totals()) {
+      totals.push_back(total);
+    }
+  }
+  return totals;
 }
-
-void execution::handleExecEvent(pid_t pid) {
-  struct user_regs_struct regs;
-
-  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-  auto rip = regs.rip;
-  unsigned long stub = 0xcc050fccUL;
-  errno = 0;
-
-  auto saved_insn = tracer.doPtrace(PTRACE_PEEKTEXT, pid, (void*)rip, 0);
-  ptracer::doPtrace(
-      PTRACE_POKETEXT, pid, (void*)rip,
-      (void*)((saved_insn & ~0xffffffffUL) | stub));
-  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
-
-  int status;
-  assert(waitpid(pid, &status, 0) == pid);
-  assert(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
-
-  unsigned long mmapAddr = traceePreinitMmap(pid, tracer);
-
-  disableVdso(pid);
-
-  // TODO When does this ever happen?
-  if (states.find(pid) == states.end()) {
-    states.emplace(pid, state{pid, debugLevel, epoch, clock_step});
+// =======================================================================================
+void execution::publishLiveStats() {
+  memoryUsage now = memoryNow();
+  memoryPeak.keepPeak(now);
+  vector<pair<string, uint64_t>> totals = statisticTotals();
+  totals.push_back({"live threads: ", processes.liveThreadCount()});
+  for (auto& held : now.named()) {
+    totals.push_back({"bytes held by the " + held.first + ": ", held.second});
   }
-  // Reset file descriptor state, it is wiped after execve.
-  states.at(pid).fdStatus = make_shared<unordered_map<int, descriptorType>>();
-
-  states.at(pid).mmapMemory.doesExist = true;
-  states.at(pid).mmapMemory.setAddr(traceePtr<void>((void*)mmapAddr));
-
-  ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)rip, (void*)saved_insn);
+  live->publish(totals, statsOutput.get(), nanosSinceStart(), false);
 }
-
 // =======================================================================================
-bool execution::handleSeccomp(const pid_t traceesPid) {
-  long syscallNum;
-  ptracer::doPtrace(PTRACE_GETEVENTMSG, traceesPid, nullptr, &syscallNum);
-
-  // TODO This might be totally unnecessary
-  // INT16_MAX is sent by seccomp by convention as for system calls with no
-  // rules.
-  if (syscallNum == INT16_MAX) {
-    // Fetch real system call from register.
-    tracer.updateState(traceesPid);
-    syscallNum = tracer.getSystemCallNumber();
-    if (0 <= syscallNum && syscallNum < SYSTEM_CALL_COUNT) {
-      runtimeError(
-          "No filter rule for system call: " + systemCallMappings[syscallNum]);
-    } else {
-      runtimeError(
-          "No filter rule for system call with unknown number: " +
-          to_string(syscallNum));
-    }
+uint64_t execution::nanosSinceStart() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now() - started)
+      .count();
+}
+// =======================================================================================
+execution::hookCounts execution::hookCountsNow() {
+  if (!statsOutput && !timelineOutput && !suggestion) {
+    return hookCounts{};
   }
-
-  // TODO: Right now we update this information on every exit and entrance, as a
-  // small optimization we might not want to...
-  // Get registers from tracee.
-  tracer.updateState(traceesPid);
-
-  if (myGlobalState.allow_trapCPUID) {
-    if (!states.at(traceesPid).CPUIDTrapSet && !myGlobalState.kernelPre4_12 &&
-        NULL == getenv("DETTRACE_NO_CPUID_INTERCEPTION")) {
-      // check if CPUID needs to be set, if it does, set trap
-      trapCPUID(myGlobalState, states.at(traceesPid), tracer);
+  return hookCounts{
+      myGlobalState.totalReplays,
+      myGlobalState.injectedSystemCalls + injectedSystemCalls,
+      tracer.traceeChanges, chrono::steady_clock::now()};
+}
+// =======================================================================================
+void execution::countHook(
+    pid_t pid, int syscallNum, bool post, const hookCounts& before) {
+  if (!statsOutput && !timelineOutput && !suggestion) {
+    return;
+  }
+  hookCounts after = hookCountsNow();
+  uint64_t replays = after.replays - before.replays;
+  uint64_t injected = after.injected - before.injected;
+  if (suggestion) {
+    // Holding a system call back changes when it runs.
+    bool deferred =
+        !post && processes.contains(pid) && processes.at(pid).deferredPreHook;
+    suggestion->hooked(
+        syscallNum,
+        replays != 0 || injected != 0 || after.changes != before.changes ||
+            deferred);
+  }
+  if (statsOutput) {
+    statsOutput->recordHook(
+        pid, syscallNum, post, replays, injected,
+        chrono::duration_cast<chrono::nanoseconds>(after.time - before.time)
+            .count());
+  }
+  if (timelineOutput) {
+    const string& name = systemCallMappings[syscallNum];
+    timelineOutput->hook(pid, (post ? "post " : "pre ") + name, before.time);
+    if (replays != 0) {
+      timelineOutput->instant(pid, "replay " + name);
+    }
+    if (injected != 0) {
+      timelineOutput->instant(pid, "injected " + to_string(injected));
+    }
+    if (processes.contains(pid)) {
+      auto clock = processes.at(pid).getLogicalTime().time_since_epoch();
+      timelineOutput->logicalTime(
+          pid, chrono::duration_cast<chrono::microseconds>(clock).count());
     }
   }
-
-  auto callPostHook = handlePreSystemCall(states.at(traceesPid), traceesPid);
-  return callPostHook;
 }
-
-struct CPUIDRegs {
-  unsigned eax;
-  unsigned ebx;
-  unsigned ecx;
-  unsigned edx;
-};
-
-// clang-format off
-static const struct CPUIDRegs cpuids[] =
-  {
-   { 0x0000000D, 0x756E6547, 0x6C65746E, 0x49656E69, },
-   { 0x00000663, 0x00000800, 0x80202001, 0x078BFBFD, },
-   { 0x00000001, 0x00000000, 0x0000004D, 0x002C307D, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000120, 0x01C0003F, 0x0000003F, 0x00000001, },
-   { 0x00000000, 0x00000000, 0x00000003, 0x00000000, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000000, 0x00000001, 0x00000100, 0x00000001, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
-  };
-
-static const struct CPUIDRegs extended_cpuids[] =
-  {
-   { 0x8000000A, 0x756E6547,0x6C65746E,0x49656E69, },
-   { 0x00000663, 0x00000000,0x00000001,0x20100800, },
-   { 0x554D4551, 0x72695620,0x6C617574,0x55504320, },
-   { 0x72657620, 0x6E6F6973,0x352E3220,0x0000002B, },
-   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
-   { 0x01FF01FF, 0x01FF01FF,0x40020140,0x40020140, },
-   { 0x00000000, 0x42004200,0x02008140,0x00808140, },
-   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
-   { 0x00003028, 0x00000000,0x00000000,0x00000000, },
-   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
-   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
-};
-// clang-format on
-
 // =======================================================================================
-void execution::handleSignal(int sigNum, const pid_t traceesPid) {
-  if (sigNum == SIGSEGV) {
-    tracer.updateState(traceesPid);
-    uint32_t curr_insn32;
-    ssize_t ret = readVmTraceeRaw(
-        traceePtr<uint32_t>((uint32_t*)tracer.getRip().ptr), &curr_insn32,
-        sizeof(uint32_t), traceesPid);
-
-    if (ret == -1) {
-      runtimeError(
-          "Unable to read RIP for segfault. Cannot determine if rdtsc.\n");
+memoryUsage execution::memoryNow() {
+  memoryUsage now;
+  now.processTable = processes.bytesHeld();
+  now.inodeMap = myGlobalState.inodeMap.bytesHeld();
+  now.mtimeMap = unorderedMapBytes(myGlobalState.mtimeMap);
+  now.directoryCache = myGlobalState.dirCache.bytesHeld();
+
+  // Processes share these until one of them changes it, count each once.
+  unordered_set<const void*> seen;
+  processes.forEach([&](pid_t pid, state& s) {
+    if (seen.insert(&*s.fds).second) {
+      now.fdTables += s.fds->bytesHeld();
     }
-
-    if ((curr_insn32 << 16) == 0x310F0000 || (curr_insn32 << 8) == 0xF9010F00) {
-      auto msg = "[%d] Tracer: Received rdtsc: Reading next instruction.\n";
-      int ip_step = 2;
-
-      if ((curr_insn32 << 8) == 0xF9010F00) {
-        rdtscpEvents++;
-        tracer.writeRcx(tscpCounter);
-        tscpCounter += RDTSC_STEPPING;
-        ip_step = 3;
-        msg = "[%d] Tracer: Received rdtscp: Reading next instruction.\n";
-      } else {
-        rdtscEvents++;
+    if (seen.insert(&*s.dirEntries).second) {
+      now.directoryEntries += unorderedMapBytes(*s.dirEntries);
+      for (auto& fd : *s.dirEntries) {
+        now.directoryEntries += fd.second.bytesHeld();
       }
-
-      tracer.writeRax(tscCounter);
-      tracer.writeRdx(0);
-      tscCounter += RDTSC_STEPPING;
-      tracer.writeIp((uint64_t)tracer.getRip().ptr + ip_step);
-
-      // Signal is now suppressed.
-      states.at(traceesPid).signalToDeliver = 0;
-
-      auto coloredMsg = log.makeTextColored(Color::blue, msg);
-
-      // force a preemption to avoid possible busy reading TSCs.
-      // myScheduler.preemptAndScheduleNext();
-      log.writeToLog(Importance::inter, coloredMsg, traceesPid, sigNum);
-      return;
-    } else if ((curr_insn32 << 16) == 0xA20F0000) {
-      struct user_regs_struct regs = tracer.getRegs();
-
-      auto msg =
-          "[%d] Tracer: intercepted cpuid instruction at %p. %rax == %p, %rcx "
-          "== %p\n";
-      auto coloredMsg = log.makeTextColored(Color::blue, msg);
-      log.writeToLog(
-          Importance::inter, coloredMsg, traceesPid, regs.rip, regs.rax,
-          regs.rcx);
-
-      // step over cpuid insn
-      tracer.writeIp((uint64_t)tracer.getRip().ptr + 2);
-
-      // suppress SIGSEGV from reaching the tracee
-      states.at(traceesPid).signalToDeliver = 0;
-
-      // fill in canonical cpuid return values
-
-      const unsigned long nleafs = sizeof(cpuids) / sizeof(cpuids[0]);
-      assert(nleafs == 1 + cpuids[0].eax);
-
-      const unsigned long nleafs_ext =
-          0x80000000ul + sizeof(extended_cpuids) / sizeof(extended_cpuids[0]);
-      assert(nleafs_ext == 1 + extended_cpuids[0].eax);
-
-      switch (regs.rax) {
-      case 0x0 ... nleafs: {
-        long leaf = regs.rax;
-        const struct CPUIDRegs& cpuid = cpuids[leaf];
-        tracer.writeRax(cpuid.eax);
-        tracer.writeRbx(cpuid.ebx);
-        tracer.writeRcx(cpuid.ecx);
-        tracer.writeRdx(cpuid.edx);
-      } break;
-      case 0x80000000ul ... nleafs_ext: {
-        long leaf = regs.rax - 0x80000000ul;
-        const struct CPUIDRegs& cpuid_ext = extended_cpuids[leaf];
-        tracer.writeRax(cpuid_ext.eax);
-        tracer.writeRbx(cpuid_ext.ebx);
-        tracer.writeRcx(cpuid_ext.ecx);
-        tracer.writeRdx(cpuid_ext.edx);
-      } break;
-      default:
-        runtimeError("CPUID unsupported %eax = " + to_string(regs.rax));
-      }
-
-      return;
     }
-  }
-
-  // Remember to deliver this signal to the tracee for next event! Happens in
-  // getNextEvent.
-  states.at(traceesPid).signalToDeliver = sigNum;
-
-  auto msg = "[%d] Tracer: Received signal: %d. Forwarding signal to tracee.\n";
-  auto coloredMsg = log.makeTextColored(Color::blue, msg);
-  log.writeToLog(Importance::inter, coloredMsg, traceesPid, sigNum);
-  return;
+  });
+  return now;
 }
 // =======================================================================================
-bool execution::callPreHook(
-    int syscallNumber,
-    globalState& gs,
-    state& s,
-    ptracer& t,
-    scheduler& sched) {
-  switch (syscallNumber) {
-  case SYS_access:
-    return accessSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_alarm:
-    return alarmSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_arch_prctl:
-    return arch_prctlSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_chdir:
-    return chdirSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_chmod:
-    return chmodSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_clock_gettime:
-    return clock_gettimeSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_close:
-    return closeSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_connect:
-    return connectSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_creat:
-    return creatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_dup:
-    return dupSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_dup2:
-    return dup2SystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_exit_group:
-    return exit_groupSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_epoll_ctl:
-    return epoll_ctlSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_epoll_wait:
-    return epoll_waitSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_epoll_pwait:
-    return epoll_pwaitSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_execve:
-    return execveSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_faccessat:
-    return faccessatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_fgetxattr:
-    return fgetxattrSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_flistxattr:
-    return flistxattrSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_fchownat:
-    return fchownatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_fchown:
-    return fchownSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_chown:
-    return chownSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_lchown:
-    return lchownSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_fcntl:
-    return fcntlSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_fstat:
-    return fstatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_newfstatat:
-    return newfstatatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_fstatfs:
-    return fstatfsSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_futex:
-    return futexSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_getcwd:
-    return getcwdSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_getdents:
-    return getdentsSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_getdents64:
-    return getdents64SystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_getitimer:
-    return getitimerSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_getpeername:
-    return getpeernameSystemCall::handleDetPre(gs, s, t, sched);
-
-    // Some older systems do not have this  system call.
-#ifdef SYS_getrandom
-  case SYS_getrandom:
-    return getrandomSystemCall::handleDetPre(gs, s, t, sched);
-#endif
-
-  case SYS_getrlimit:
-    return getrlimitSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_getrusage:
-    return getrusageSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_gettimeofday:
-    return gettimeofdaySystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_ioctl:
-    return ioctlSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_llistxattr:
-    return llistxattrSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_lgetxattr:
-    return lgetxattrSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_nanosleep:
-    return nanosleepSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_mkdir:
-    return mkdirSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_mkdirat:
-    return mkdiratSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_lstat:
-    return lstatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_link:
-    return linkSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_linkat:
-    return linkatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_mmap:
-    return mmapSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_open:
-    return openSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_openat:
-    return openatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_pause:
-    return pauseSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_pipe:
-    return pipeSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_pipe2:
-    return pipe2SystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_pselect6:
-    return pselect6SystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_poll:
-    return pollSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_prlimit64:
-    return prlimit64SystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_read:
-    return readSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_readlink:
-    return readlinkSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_readlinkat:
-    return readlinkatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_recvmsg:
-    return recvmsgSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rename:
-    return renameSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_renameat:
-    return renameatSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_renameat2:
-    return renameat2SystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rmdir:
-    return rmdirSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rt_sigprocmask:
-    return rt_sigprocmaskSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rt_sigaction:
-    return rt_sigactionSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rt_sigtimedwait:
-    return rt_sigtimedwaitSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rt_sigsuspend:
-    return rt_sigsuspendSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_rt_sigpending:
-    return rt_sigpendingSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_sendto:
-    return sendtoSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_sendmsg:
-    return sendmsgSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_sendmmsg:
-    return sendmmsgSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_recvfrom:
-    return recvfromSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_select:
-    return selectSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_setitimer:
-    return setitimerSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_set_robust_list:
-    return set_robust_listSystemCall::handleDetPre(gs, s, t, sched);
+template <typename Kernel>
+void execution::eventLoop() {
+  // Once all process' have ended. We exit.
+  bool exitLoop = false;
 
-  case SYS_statfs:
-    return statfsSystemCall::handleDetPre(gs, s, t, sched);
+  // Iterate over entire process' and all subprocess' execution.
+  while (!exitLoop) {
+    if (parallel) {
+      exitLoop = stepParallel();
+      continue;
+    }
 
-  case SYS_stat:
-    return statSystemCall::handleDetPre(gs, s, t, sched);
+    int status;
+    pid_t traceesPid;
+    ptraceEvent ret;
 
-  case SYS_sysinfo:
-    return sysinfoSystemCall::handleDetPre(gs, s, t, sched);
+    pid_t nextPid = myScheduler.getNext();
+    state& nextState = processes.at(nextPid);
+
+    // Still at the seccomp stop of a system call its pre-hook held back, run
+    // the pre-hook again without resuming the tracee.
+    if (nextState.deferredPreHook) {
+      nextState.deferredPreHook = false;
+      tracer.updateStateSeccomp(nextPid);
+      logAbout(nextPid, -1);
+      nextState.callPostHook =
+          handlePreSystemCall<Kernel>(nextState, nextPid);
+      continue;
+    }
 
-  case SYS_symlink:
-    return symlinkSystemCall::handleDetPre(gs, s, t, sched);
+    bool post = nextState.callPostHook;
+    tie(ret, traceesPid, status) = getNextEvent(nextPid, post);
+    exitLoop = handleEvent<Kernel>(ret, traceesPid, status);
+    if (myScheduler.takeStall()) {
+      reportStall();
+    }
+  }
+}
+// =======================================================================================
+int execution::runProgram() {
+  // When using seccomp, we run with PTRACE_CONT, but seccomp only reports
+  // pre-hook events. To get post hook events we must call ptrace with
+  // PTRACE_SYSCALL intead. This happens in @getNextEvent.
 
-  case SYS_symlinkat:
-    return symlinkatSystemCall::handleDetPre(gs, s, t, sched);
+  DETTRACE_LOG(log, Importance::inter, "dettrace starting up\n");
 
-  case SYS_mknod:
-    return mknodSystemCall::handleDetPre(gs, s, t, sched);
+  if (kernelPre4_8) {
+    eventLoop<legacyKernel>();
+  } else {
+    eventLoop<modernKernel>();
+  }
 
-  case SYS_mknodat:
-    return mknodatSystemCall::handleDetPre(gs, s, t, sched);
+  if (restoredRun) {
+    // Forked without the /dev/[u]random thread, the original run owns it.
+    DETTRACE_LOG(
+        log, Importance::info, "Restored run done, exit code %d.\n",
+        exit_code);
+    return exit_code;
+  }
+  if (checkpointer != nullptr && checkpointer->taken()) {
+    runRestores();
+  }
 
-  case SYS_tgkill:
-    return tgkillSystemCall::handleDetPre(gs, s, t, sched);
+  // DEVRAND STEP 5: clean up the /dev/[u]random fifo thread
+  doWithCheck(
+      pthread_cancel(devRandomPthread),
+      "pthread_cancel /dev/[u]random pthread");
 
-  case SYS_time:
-    return timeSystemCall::handleDetPre(gs, s, t, sched);
+  auto msg = log.makeTextColored(
+      Color::blue, "All processes done. Finished successfully!\n");
+  DETTRACE_LOG(log, Importance::info, msg);
+
+  if (!inodeSnapshotFile.empty()) {
+    saveInodeSnapshot(
+        inodeSnapshotFile, snapshotFingerprint, myGlobalState.inodeMap,
+        myGlobalState.mtimeMap);
+    exeHashes->save(inodeSnapshotFile + ".executables");
+    if (knownSites) {
+      knownSites->save(inodeSnapshotFile + ".patch-sites");
+    }
+    if (startups) {
+      startups->save(inodeSnapshotFile + ".startup-reads");
+    }
+  }
 
-  case SYS_timer_create:
-    return timer_createSystemCall::handleDetPre(gs, s, t, sched);
+  if (printStatistics || statsOutput) {
+    memoryPeak.keepPeak(memoryNow());
+    vector<pair<string, uint64_t>> totals = statisticTotals();
+    if (live) {
+      live->publish(totals, statsOutput.get(), nanosSinceStart(), true);
+    }
+    if (printStatistics) {
+      string preStr = "dettrace Statistic. ";
+      cerr << endl;
+      for (auto& total : totals) {
+        cerr << preStr + total.first + to_string(total.second) << endl;
+      }
+      statsOutput->printLatencies(cerr);
+      statsOutput->printStops(cerr);
+      statsOutput->printExecutables(cerr, 20);
+      if (hardware.enabled()) {
+        cerr << preStr + hardware.split() << endl;
+      }
+    }
+    if (!statsJsonFile.empty()) {
+      statsOutput->writeJson(statsJsonFile, totals);
+    }
+  }
+  // Completes the files.
+  myScheduler.events = nullptr;
+  myScheduler.schedule = nullptr;
+  timelineOutput.reset();
+  trapProfileOutput.reset();
+  traceStreamOutput.reset();
+  rnr::finish();
+  inputs.reset();
+  if (schedule && schedule->divergedAt != -1) {
+    cerr << "[dettrace] --use-schedule: the run diverged from the schedule at "
+            "decision "
+         << schedule->divergedAt << ", scheduled as usual from there." << endl;
+  }
+  schedule.reset();
+  execs.reset();
+  dependencies.reset();
+  outputs.reset();
+  suggestion.reset();
+  if (fileHashes && printStatistics) {
+    cerr << "dettrace Statistic. Files hashed: " << fileHashes->filesHashed
+         << ", from memo: " << fileHashes->memoHits << endl;
+  }
+  fileHashes.reset();
+  if (exeHashes && printStatistics) {
+    cerr << "dettrace Statistic. Executables hashed: "
+         << exeHashes->executablesHashed
+         << ", from memo: " << exeHashes->memoHits << endl;
+  }
+  exeHashes.reset();
+  if (startups && printStatistics) {
+    cerr << "dettrace Statistic. Execs with their startup files read ahead: "
+         << startups->execsReadAhead
+         << ", files: " << startups->filesReadAhead << endl;
+  }
+  startups.reset();
 
-  case SYS_timer_delete:
-    return timer_deleteSystemCall::handleDetPre(gs, s, t, sched);
+  if (processes.liveThreadCount() != 0) {
+    cerr << "Live thread set is not empty! We miss counted the threads "
+            "somewhere..."
+         << endl;
+    exit(1);
+  }
 
-  case SYS_timer_getoverrun:
-    return timer_getoverrunSystemCall::handleDetPre(gs, s, t, sched);
+  // Every live tracee is in a thread group, so this is the old threadGroups
+  // check and a check for leftover states in one.
+  if (!processes.empty()) {
+    cerr << "Process table is not empty! We miss counted the threads "
+            "somewhere..."
+         << endl;
+    exit(1);
+  }
 
-  case SYS_timer_gettime:
-    return timer_gettimeSystemCall::handleDetPre(gs, s, t, sched);
+  return exit_code;
+}
+// =======================================================================================
+void execution::runRestores() {
+  for (unsigned i = 1; i <= checkpointRuns; i++) {
+    auto begin = chrono::steady_clock::now();
+    int code = checkpointer->restore();
+    uint64_t millis = chrono::duration_cast<chrono::milliseconds>(
+                          chrono::steady_clock::now() - begin)
+                          .count();
+    if (printStatistics) {
+      cerr << "dettrace Statistic. Run " << i
+           << " restored from the checkpoint: exit code " << code << ", "
+           << millis << " ms" << endl;
+    }
+    if (code != exit_code) {
+      cerr << "[dettrace] --checkpoint-runs: run " << i << " exited with "
+           << code << ", the original run with " << exit_code << "." << endl;
+    }
+  }
+}
+// =======================================================================================
+void execution::serveRestores(int listener, const vector<string>& program) {
+  if (checkpointer == nullptr || !checkpointer->taken()) {
+    cerr << "[dettrace] --fork-server: the run never got to the checkpoint, "
+            "nothing to serve."
+         << endl;
+    return;
+  }
+  for (;;) {
+    int client = acceptClient(listener);
+    if (client == -1) {
+      if (errno == EINTR || errno == EPERM) {
+        continue;
+      }
+      doWithCheck(-1, "fork server accept4");
+    }
+    dettraceJob job;
+    if (receiveJob(client, job)) {
+      int32_t code = 1;
+      if (job.program == program) {
+        code = checkpointer->restore(job.fds);
+        DETTRACE_LOG(
+            log, Importance::info, "Fork server run done, exit code %d.\n",
+            code);
+      } else {
+        dprintf(
+            job.fds[2],
+            "dettrace fork server at the checkpoint of %s runs only that, with "
+            "the same arguments.\n",
+            program[0].c_str());
+      }
+      sendJobStatus(client, code);
+      for (int fd : job.fds) {
+        if (fd != -1) {
+          close(fd);
+        }
+      }
+    }
+    close(client);
+  }
+}
+// =======================================================================================
+bool execution::handleEvent(ptraceEvent ret, pid_t traceesPid, int status) {
+  return kernelPre4_8 ? handleEvent<legacyKernel>(ret, traceesPid, status)
+                      : handleEvent<modernKernel>(ret, traceesPid, status);
+}
+// =======================================================================================
+template <typename Kernel>
+bool execution::handleEvent(ptraceEvent ret, pid_t traceesPid, int status) {
+  logAbout(traceesPid, -1);
+
+  // We don't see every futex wake (e.g. the kernel's on thread exit), so any
+  // sign of life from a thread may unblock its siblings.
+  if (myScheduler.hasWaiters(waitKind::futex) &&
+      processes.contains(traceesPid)) {
+    myScheduler.wake(waitKind::futex, processes.threadGroupOf(traceesPid));
+  }
 
-  case SYS_timer_settime:
-    return timer_settimeSystemCall::handleDetPre(gs, s, t, sched);
+  // Most common event. We handle the pre-hook for system calls here.
+  if (ret == ptraceEvent::seccomp) {
+    DETTRACE_LOG(log, Importance::extra, "Is seccomp event!\n");
+    systemCallsEvents++;
+    processes.at(traceesPid).callPostHook =
+        handleSeccomp<Kernel>(traceesPid);
+    return false;
+  }
 
-  case SYS_timerfd_create:
-    return timerfd_createSystemCall::handleDetPre(gs, s, t, sched);
+  // We still need this case even though we use seccomp + bpf. Since we do
+  // post-hook interception of system calls through PTRACE_SYSCALL. Only post
+  // system call events come here.
+  if (ret == ptraceEvent::syscall) {
+    // For older kernels, we see a system call event and we also see a handle
+    // seccomp event. I chose to always handle the pre-system call on the
+    // ptracer seccomp event. So we skip the pre-system call event here on
+    // older kernels.
+    state& currentState = processes.at(traceesPid);
+
+    // old-kernel-only ptrace system call event for pre exit hook.
+    if (Kernel::doubleSyscallEvents && currentState.onPreExitEvent) {
+      processes.at(traceesPid).callPostHook = true;
+      currentState.onPreExitEvent = false;
+    } else {
+      // Only count here due to comment above (we see this event twice in
+      // older kernels).
+      systemCallsEvents++;
+      tracer.updateState(traceesPid);
+      handlePostSystemCall(currentState);
+      // set callPostHook to default value for next iteration.
+      processes.at(traceesPid).callPostHook = false;
+    }
 
-  case SYS_timerfd_settime:
-    return timerfd_settimeSystemCall::handleDetPre(gs, s, t, sched);
+    return false;
+  }
 
-  case SYS_timerfd_gettime:
-    return timerfd_gettimeSystemCall::handleDetPre(gs, s, t, sched);
+  // Current process was ended by signal.
+  if (ret == ptraceEvent::terminatedBySignal) {
+    auto msg = log.makeTextColored(
+        Color::blue, "Process [%d] ended by signal %d.\n");
+    DETTRACE_LOG(log, Importance::inter, msg, traceesPid, WTERMSIG(status));
+    recordTrace(
+        traceEvent::exit, traceesPid, WTERMSIG(status), nullptr, exit_code);
+    return handleNonEventExit(traceesPid);
+  }
 
-  case SYS_times:
-    return timesSystemCall::handleDetPre(gs, s, t, sched);
+  /**
+     A process needs to do two things before dying:
+     1) eventExit through ptrace. This process is not truly done, it is
+     stopped until we let it continue and all it's children have also
+     finished. 2) A nonEventExit at this point the process is done and can no
+     longer be peeked or poked.
+
+     If the process has remaining children, we will get an eventExit but the
+     nonEventExit will never arrive. Therefore we set process as exited.
+     Only when all children have exited do we get a the nonEvent exit.
+
+     Therefore we keep track of the process hierarchy and only wait for the
+     evenExit when our children have exited.
+  */
+  if (ret == ptraceEvent::eventExit) {
+    auto msg = log.makeTextColored(
+        Color::blue,
+        "Process [%d] has finished. "
+        "With ptraceEventExit, exit_code: %d.");
+    DETTRACE_LOG(log, Importance::inter, msg, traceesPid, exit_code);
+    recordTrace(traceEvent::exit, traceesPid, 0, nullptr, exit_code);
+    DETTRACE_PROBE2(exit, traceesPid, exit_code);
+    processes.at(traceesPid).callPostHook = false;
+
+    bool isExitGroup = processes.at(traceesPid).isExitGroup;
+    pid_t threadGroup = processes.threadGroupOf(traceesPid);
+
+    // there is two reasons this is necessary
+    // 1) case where a thread called exit group: this process goes on to
+    // exit like a normal non-threaded non-exit grouped process would, and we
+    // don't want the check in ptraceEvent::nonEventExit to kill it.
+    // 2) in the event where this process is the only process in the process
+    // group, it will do the same as #1. Only when we have a non-main thread
+    // call exit group, do we not need to set this flag, and that's only
+    // because this flag is per process/thread!
+    processes.at(traceesPid).isExitGroup = false;
+    // We state that the main process in a thread group was killed by an exit
+    // group, this way, the main process ever stops responding, we know why.
+    // This is needed as this process may get stuck in getNextEvent
+    // otherwise... processes.at(threadGroup).killedByExitGroup = true;
+
+    // Iterate through all threads in this exit group exiting them.
+    // Only go in here for exit groups where there is threads. By default,
+    // there is at least 1 (the process)
+    DETTRACE_LOG(
+        log, Importance::info, "thread group #%d\n",
+        processes.threadGroupSize(threadGroup));
+
+    if (isExitGroup && processes.threadGroupSize(threadGroup) != 1) {
+      auto msg =
+          "Caught exit group! Ending all thread in our process group %d.\n";
+      DETTRACE_LOG(log, Importance::info, msg, threadGroup);
+
+      // Mark as finished so that handleNonEventExit function takes care of
+      // eventually deleting parent process.
+      myScheduler.markFinishedAndScheduleNext(threadGroup);
+      order.remove(threadGroup);
+
+      // Take the threads (not the thread group leader, the process) off
+      // the group first, handleNonEventExit removes each from the table as
+      // we go.
+      processes.detachThreads(threadGroup);
+      exitThreads(threadGroup);
+      return false;
+    }
 
-  case SYS_uname:
-    return unameSystemCall::handleDetPre(gs, s, t, sched);
+    // We have children still, we cannot exit.
+    if (processes.hasChildren(traceesPid)) {
+      myScheduler.markFinishedAndScheduleNext(traceesPid);
+      order.remove(traceesPid);
+    } else {
+      // We have no more children, nothing stops us from exiting, we continue
+      // to the next event, which we expect to be a nonEventExit
+    }
+    return false;
+  }
 
-  case SYS_unlink:
-    return unlinkSystemCall::handleDetPre(gs, s, t, sched);
+  // Current process is finally truly done (unlike eventExit).
+  if (ret == ptraceEvent::nonEventExit) {
+    if (processes.at(traceesPid).isExitGroup) {
+      // never seen this, don't know how to handle.
+      runtimeError(
+          "We should not see nonEventExit from a exitGroup event.\n");
+    }
 
-  case SYS_unlinkat:
-    return unlinkatSystemCall::handleDetPre(gs, s, t, sched);
+    auto msg = log.makeTextColored(
+        Color::blue,
+        "Process [%d] has finished. "
+        "With ptraceNonEventExit.\n");
+    DETTRACE_LOG(log, Importance::inter, msg, traceesPid);
 
-  case SYS_utime:
-    return utimeSystemCall::handleDetPre(gs, s, t, sched);
+    processes.at(traceesPid).callPostHook = false;
+    if (processes.hasChildren(traceesPid)) {
+      runtimeError(
+          "We receieved a nonEventExit with children left."
+          "This should be impossible!");
+    } else {
+      return handleNonEventExit(traceesPid);
+    }
+  }
 
-  case SYS_utimes:
-    return utimesSystemCall::handleDetPre(gs, s, t, sched);
+  // We have encountered a call to fork, vfork, clone.
+  if (ret == ptraceEvent::fork || ret == ptraceEvent::vfork ||
+      ret == ptraceEvent::clone) {
+    tracer.updateState(traceesPid);
+    int syscallNumber = (int)tracer.getSystemCallNumber();
+    string msg = "none";
+    bool isThread = false;
+
+    // Per ptrace man page: we cannot reliably tell a clone syscall from it's
+    // event, so we check explicitly.
+    switch (syscallNumber) {
+    case SYS_fork:
+      msg = "fork";
+      break;
+    case SYS_vfork:
+      msg = "vfork";
+      break;
+    case SYS_clone: {
+      msg = "clone";
+      unsigned long flags = (unsigned long)tracer.arg1();
+      isThread = (flags & CLONE_THREAD) != 0;
+      // if((flags & CLONE_FILES) != 0){
+      // runtimeError("We do not support CLONE_FILES\n");
+      // }
+      break;
+    }
+    default:
+      runtimeError(
+          "Uknown syscall number from fork/clone event: " +
+          to_string(syscallNumber));
+    }
 
-  case SYS_utimensat:
-    return utimensatSystemCall::handleDetPre(gs, s, t, sched);
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(Color::blue, "[%d] caught %s event!\n"),
+        traceesPid, msg.c_str());
 
-  case SYS_futimesat:
-    return futimesatSystemCall::handleDetPre(gs, s, t, sched);
+    handleForkEvent(traceesPid, isThread, ret == ptraceEvent::vfork);
+    processes.at(traceesPid).callPostHook = false;
+    return false;
+  }
 
-  case SYS_wait4:
-    return wait4SystemCall::handleDetPre(gs, s, t, sched);
+  if (ret == ptraceEvent::exec) {
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(Color::blue, "[%d] Caught execve event!\n"),
+        traceesPid);
+    // reset CPUID trap flag
+    processes.at(traceesPid).CPUIDTrapSet = false;
+    startupTimes& times = startupTimes::get();
+    startupTimes::finish(times.firstExec, times.execStarted);
+
+    handleExecEvent(traceesPid);
+    return false;
+  }
 
-  case SYS_waitid:
-    return waitidSystemCall::handleDetPre(gs, s, t, sched);
+  if (ret == ptraceEvent::signal) {
+    int signalNum = WSTOPSIG(status);
+    handleSignal(signalNum, traceesPid);
+    return false;
+  }
 
-  case SYS_write:
-    return writeSystemCall::handleDetPre(gs, s, t, sched);
-
-  case SYS_writev:
-    return writevSystemCall::handleDetPre(gs, s, t, sched);
-  case SYS_socket:
-    return socketSystemCall::handleDetPre(gs, s, t, sched);
-  case SYS_listen:
-    return listenSystemCall::handleDetPre(gs, s, t, sched);
-  case SYS_accept:
-    return acceptSystemCall::handleDetPre(gs, s, t, sched);
-  case SYS_accept4:
-    return accept4SystemCall::handleDetPre(gs, s, t, sched);
-  case SYS_shutdown:
-    return shutdownSystemCall::handleDetPre(gs, s, t, sched);
-  }
-
-  // Generic system call. Throws error.
   runtimeError(
-      "This is a bug. Missing case for system call: " +
-      to_string(syscallNumber));
-  // Can never happen, here to avoid spurious warning.
+      to_string(traceesPid) +
+      " Uknown return value for ptracer::getNextEvent()\n");
   return false;
 }
 // =======================================================================================
-void execution::callPostHook(
-    int syscallNumber,
-    globalState& gs,
-    state& s,
-    ptracer& t,
-    scheduler& sched) {
-  switch (syscallNumber) {
-  case SYS_access:
-    return accessSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_alarm:
-    return alarmSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_arch_prctl:
-    return arch_prctlSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_chdir:
-    return chdirSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_chown:
-    return chownSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_lchown:
-    return lchownSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_chmod:
-    return chmodSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::stepParallel() {
+  for (pid_t pid : order.takeResumable()) {
+    state& s = processes.at(pid);
+    if (s.deferredPreHook) {
+      // Never left its seccomp stop, it is ready to commit again right away.
+      order.stopped(pid, false);
+    } else {
+      resumeTracee(pid, s.callPostHook);
+    }
+  }
 
-  case SYS_clock_gettime:
-    return clock_gettimeSystemCall::handleDetPost(gs, s, t, sched);
+  pid_t pid = order.nextCommit();
+  if (pid == -1) {
+    collectStop();
+    return false;
+  }
+  return commitParallel(pid);
+}
+// =======================================================================================
+void execution::collectStop() {
+  int status;
+  pid_t pid = doWithCheck(waitpid(-1, &status, __WALL), "waitpid");
+  if (statsOutput) {
+    statsOutput->stopped(pid);
+  }
+  if (timelineOutput) {
+    timelineOutput->stopped(pid);
+  }
+  ptraceStops++;
+  DETTRACE_LOG(log, Importance::extra, "Collected stop of [%d]\n", pid);
+
+  // A tracee that already had a stop here was killed, the older stop is moot.
+  collectedStops[pid] = status;
+  // Otherwise this is a new child whose fork event we haven't committed yet,
+  // handleForkEvent picks its stop up from collectedStops.
+  if (order.contains(pid)) {
+    order.stopped(pid, isBarrier(pid, status));
+  }
+}
+// =======================================================================================
+bool execution::isBarrier(pid_t pid, int status) {
+  switch (getPtraceEvent(status)) {
+  case ptraceEvent::eventExit:
+  case ptraceEvent::nonEventExit:
+  case ptraceEvent::terminatedBySignal:
+    return true;
+  case ptraceEvent::seccomp:
+    break;
+  default:
+    return false;
+  }
 
-  case SYS_close:
-    return closeSystemCall::handleDetPost(gs, s, t, sched);
+  long syscallNum;
+  ptracer::doPtrace(PTRACE_GETEVENTMSG, pid, nullptr, &syscallNum);
+  if (syscallNum == INT16_MAX) {
+    errno = 0;
+    syscallNum = ptrace(PTRACE_PEEKUSER, pid, 8 * ORIG_RAX, 0);
+  }
 
-    // case SYS_clone:
-    //   return cloneSystemCall::handleDetPost(gs, s, t, sched);
+  switch (syscallNum) {
+  // Signals to other tracees, exits and waits: the kernel acts on others
+  // without us seeing it, so make sure they're all stopped.
+  case SYS_kill:
+  case SYS_tkill:
+  case SYS_tgkill:
+  case SYS_rt_sigqueueinfo:
+  case SYS_rt_tgsigqueueinfo:
+  case SYS_exit:
+  case SYS_exit_group:
+  case SYS_wait4:
+  case SYS_waitid:
+    return true;
+  default:
+    return false;
+  }
+}
+// =======================================================================================
+bool execution::commitParallel(pid_t pid) {
+  state& s = processes.at(pid);
+  ptraceEvent event;
+  bool exitLoop = false;
 
-  case SYS_connect:
-    return connectSystemCall::handleDetPost(gs, s, t, sched);
+  if (s.deferredPreHook) {
+    s.deferredPreHook = false;
+    tracer.updateStateSeccomp(pid);
+    s.callPostHook = handlePreSystemCall(s, pid);
+    event = ptraceEvent::seccomp;
+  } else {
+    int status = collectedStops.at(pid);
+    collectedStops.erase(pid);
+    event = getPtraceEvent(status);
+    exitLoop = handleEvent(event, pid, status);
+  }
 
-  case SYS_creat:
-    return creatSystemCall::handleDetPost(gs, s, t, sched);
+  if (!exitLoop) {
+    exitLoop = finishCommit(pid, event);
+  }
+  // A finished parent whose last child just exited, see handleNonEventExit.
+  while (!exitLoop && exitingParent != -1) {
+    pid_t parent = exitingParent;
+    exitingParent = -1;
+    while (!exitLoop && processes.contains(parent)) {
+      int status;
+      resumeTracee(parent, false);
+      waitForTracee(parent, &status);
+      exitLoop = handleEvent(getPtraceEvent(status), parent, status);
+    }
+  }
 
-  case SYS_dup:
-    return dupSystemCall::handleDetPost(gs, s, t, sched);
+  if (order.contains(pid)) {
+    order.committed(pid);
+    // The last thing we did was run into its next stop, see finishCommit.
+    if (collectedStops.count(pid) != 0) {
+      order.stopped(pid, isBarrier(pid, collectedStops.at(pid)));
+    }
+  }
+  return exitLoop;
+}
+// =======================================================================================
+bool execution::finishCommit(pid_t pid, ptraceEvent event) {
+  // The system call we just let through is yet to run, or the tracee is on its
+  // way out. Either way, see it through before the next commit.
+  bool inSystemCall = event == ptraceEvent::seccomp;
+  bool exiting = event == ptraceEvent::eventExit;
+
+  while ((inSystemCall || exiting) && processes.contains(pid) &&
+         !myScheduler.isFinished(pid)) {
+    state& s = processes.at(pid);
+    if (s.deferredPreHook) {
+      // Held back by its pre-hook, nothing ran.
+      return false;
+    }
 
-  case SYS_dup2:
-    return dup2SystemCall::handleDetPost(gs, s, t, sched);
+    bool wantPost = s.callPostHook;
+    int status;
+    // Stop at the system call exit even when the handler doesn't care for it,
+    // so we know the system call is done.
+    resumeTracee(pid, inSystemCall);
+    waitForTracee(pid, &status);
+    event = getPtraceEvent(status);
+
+    if (event == ptraceEvent::seccomp) {
+      // vsyscall, emulated in resumeTracee. This is the next system call.
+      collectedStops[pid] = status;
+      return false;
+    }
+    if (event == ptraceEvent::syscall) {
+      inSystemCall = false;
+      if (!wantPost) {
+        continue;
+      }
+    }
+    if (event == ptraceEvent::eventExit) {
+      exiting = true;
+    }
+    if (handleEvent(event, pid, status)) {
+      return true;
+    }
+  }
+  return false;
+}
+// =======================================================================================
+pid_t execution::handleForkEvent(
+    const pid_t traceesPid, bool isThread, bool isVfork) {
+  processSpawnEvents++;
 
-  case SYS_epoll_ctl:
-    return epoll_ctlSystemCall::handleDetPost(gs, s, t, sched);
+  pid_t newChildPid = ptracer::getEventMessage(traceesPid);
+  recordTrace(traceEvent::fork, traceesPid, isThread, nullptr, newChildPid);
+  DETTRACE_PROBE3(fork, traceesPid, newChildPid, isThread);
+  auto threadGroup = processes.threadGroupOf(traceesPid);
+  state& parentState = processes.at(traceesPid);
 
-  case SYS_epoll_wait:
-    return epoll_waitSystemCall::handleDetPost(gs, s, t, sched);
+  // If a thread T1 spawns thread T2, then T1 is NOT the parent of T2. The
+  // parent is always the process (the thread group leader) that T1 belongs to.
+  // processTable takes care of adding new children to the thread group leader.
+  // Processes copy fds on write, threads share it with the thread group.
+  if (isThread) {
+    auto msg = log.makeTextColored(
+        Color::blue, "Adding thread %d to thread group %d\n");
+    DETTRACE_LOG(log, Importance::info, msg, newChildPid, threadGroup);
 
-  case SYS_epoll_pwait:
-    return epoll_pwaitSystemCall::handleDetPost(gs, s, t, sched);
+    // Careful here, the thread group is not necessarily traceesPid, as
+    // traceesPid may be a thread, processTable uses traceesPid's thread group.
+    state childState = parentState.cloned(newChildPid);
+    childState.forkPath = parentState.childForkPath();
+    processes.addThread(traceesPid, newChildPid, std::move(childState));
+  } else {
+    auto msg =
+        log.makeTextColored(Color::blue, "Creating new thread group: %d\n");
+    DETTRACE_LOG(log, Importance::info, msg, newChildPid);
 
-  case SYS_faccessat:
-    return faccessatSystemCall::handleDetPost(gs, s, t, sched);
+    // This is a process it owns it's own process group. Deep Copy!
+    // The child starts out knowing everything its parent did.
+    if (myGlobalState.vectorClocks) {
+      myGlobalState.causalSend(parentState);
+    }
+    state childState = parentState.forked(newChildPid);
+    childState.forkPath = parentState.childForkPath();
+    processes.addProcess(traceesPid, newChildPid, std::move(childState));
+  }
 
-  case SYS_fgetxattr:
-    return fgetxattrSystemCall::handleDetPost(gs, s, t, sched);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(
+          Color::blue, "Added process [%d] to process table.\n"),
+      newChildPid);
+  if (isVfork) {
+    processes.at(newChildPid).vforkChild = true;
+  } else {
+    branches.attach(newChildPid);
+  }
+  // Counting raises no signals, vfork children are counted right away.
+  hardware.attach(newChildPid);
+  if (execs) {
+    execs->spawned(traceesPid, newChildPid, isThread);
+  }
+  if (exeHashes) {
+    exeHashes->spawned(traceesPid, newChildPid);
+  }
+  if (dependencies) {
+    dependencies->spawned(traceesPid, newChildPid);
+  }
+  if (!isThread && log.getFilter() != nullptr) {
+    log.getFilter()->forked(threadGroup, newChildPid);
+  }
+  if (statsOutput) {
+    statsOutput->spawned(traceesPid, newChildPid, isThread);
+  }
 
-  case SYS_flistxattr:
-    return flistxattrSystemCall::handleDetPost(gs, s, t, sched);
+  // Let child run instead of the parent, inform scheduler of new process.
+  myScheduler.addAndScheduleNext(newChildPid);
+  if (parallel) {
+    order.add(
+        newChildPid, processes.threadGroupOf(newChildPid),
+        order.ticksOf(traceesPid));
+  }
 
-  case SYS_fchownat:
-    return fchownatSystemCall::handleDetPost(gs, s, t, sched);
+  // during fork, the parent's mmaped memory are COWed, as we set the mapping
+  // attributes to MAP_PRIVATE. new child's `mmapMemory` hence must be inherited
+  // from parent process, to be consistent with fork() semantic.
+  // TODO for threads we may not need to do this?!
+  // processes.at(newChildPid).mmapMemory.doesExist = true;
+  // processes.at(newChildPid).mmapMemory.setAddr(processes.at(traceesPid).mmapMemory.getAddr());
+
+  // Wait for child to be ready. A thread pool starting up spawns threads back
+  // to back, a new thread's stop is waited for only once we resume it, as is
+  // a vfork child's, whose parent can't do anything until it execs. With
+  // --parallel, collectStop could take it for a commit first.
+  processes.at(newChildPid).initialStopPending = true;
+  if (!(isThread || isVfork) || parallel) {
+    takeInitialStop(processes.at(newChildPid));
+  }
+  return newChildPid;
+}
+// =======================================================================================
+void execution::takeInitialStop(state& s) {
+  if (!s.initialStopPending) {
+    return;
+  }
+  s.initialStopPending = false;
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(
+          Color::blue, "Waiting for child to be ready for tracing...\n"));
+  int status;
+  int retPid = waitForTracee(s.traceePid, &status);
+  // This should never happen.
+  if (retPid != s.traceePid) {
+    runtimeError("wait call return pid does not match new child's pid.");
+  }
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(Color::blue, "Child ready!\n"));
+}
 
-  case SYS_fchown:
-    return fchownSystemCall::handleDetPost(gs, s, t, sched);
+static inline unsigned long alignUp(unsigned long size, int align) {
+  return (size + align - 1) & ~(align - 1);
+}
 
-  case SYS_fcntl:
-    return fcntlSystemCall::handleDetPost(gs, s, t, sched);
+void execution::disableVdso(
+    pid_t pid,
+    unsigned long vdsoBase,
+    unsigned long clockAddr,
+    logicalClockPage* clockPage) {
 
-  case SYS_fstat:
-    return fstatSystemCall::handleDetPost(gs, s, t, sched);
+  // vdso is enabled by kernel command line.
+  if (vdsoBase != 0) {
+    auto data = vdsoGetCandidateData();
 
-  case SYS_newfstatat:
-    return newfstatatSystemCall::handleDetPost(gs, s, t, sched);
+    if (clockPage != nullptr) {
+      // Jump to the logical clock functions in the page.
+      for (auto func : vdsoGetLogicalClockData()) {
+        data[func.first] = vdsoLogicalClockTrampoline(
+            clockAddr + logicalClockFunctionOffset(func.first));
+      }
+    }
 
-  case SYS_fstatfs:
-    return fstatfsSystemCall::handleDetPost(gs, s, t, sched);
+    for (auto func : vdsoFuncs) {
+      unsigned long offset, oldVdsoSize, vdsoAlignment;
+      tie(offset, oldVdsoSize, vdsoAlignment) = func.second;
+      unsigned long target = vdsoBase + offset;
+      unsigned long nbUpper = alignUp(oldVdsoSize, vdsoAlignment);
+      unsigned long nb = alignUp(data[func.first].size(), vdsoAlignment);
+      assert(nb <= nbUpper);
 
-  case SYS_futex:
-    return futexSystemCall::handleDetPost(gs, s, t, sched);
+      for (auto i = 0; i < nb / sizeof(long); i++) {
+        uint64_t val;
+        const unsigned char* z = data[func.first].c_str();
+        unsigned long to = target + 8 * i;
+        memcpy(&val, &z[8 * i], sizeof(val));
+        ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)to, (void*)val);
+      }
 
-  case SYS_getcwd:
-    return getcwdSystemCall::handleDetPost(gs, s, t, sched);
+      unsigned long off = target + nb;
+      unsigned long val = 0xccccccccccccccccUL;
+      while (nb < nbUpper) {
+        ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)off, (void*)val);
+        off += sizeof(long);
+        nb += sizeof(long);
+      }
+      assert(nb == nbUpper);
+    }
+  }
+}
 
-  case SYS_getdents:
-    return getdentsSystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * Wait for pid to reach the int3 ending code we injected. System calls our
+ * seccomp filter traces stop at their seccomp event first, and only run once
+ * we resume them.
+ */
+static void waitForInjectedTrap(pid_t pid) {
+  while (true) {
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) {
+      runtimeError("tracee did not stop running injected code.\n");
+    }
+    injectedStops++;
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))) {
+      ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
+      continue;
+    }
+    if (WSTOPSIG(status) != SIGTRAP) {
+      runtimeError(
+          "tracee got signal " + to_string(WSTOPSIG(status)) +
+          " running injected code.\n");
+    }
+    return;
+  }
+}
 
-  case SYS_getdents64:
-    return getdents64SystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * Run a system call in the tracee through our `0xcc; syscall; 0xcc` stub, which
+ * must be at the current rip. Every register is restored afterwards.
+ * @return raw return value of the system call.
+ */
+static long injectStubSystemCall(
+    pid_t pid,
+    long syscallNumber,
+    unsigned long arg1 = 0,
+    unsigned long arg2 = 0,
+    unsigned long arg3 = 0,
+    unsigned long arg4 = 0,
+    unsigned long arg5 = 0,
+    unsigned long arg6 = 0) {
+  struct user_regs_struct regs;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
+  auto oldRegs = regs;
 
-  case SYS_getitimer:
-    return getitimerSystemCall::handleDetPost(gs, s, t, sched);
+  regs.orig_rax = syscallNumber;
+  regs.rax = syscallNumber;
+  regs.rdi = arg1;
+  regs.rsi = arg2;
+  regs.rdx = arg3;
+  regs.r10 = arg4;
+  regs.r8 = arg5;
+  regs.r9 = arg6;
+  regs.rip += 1; /* 0xcc; syscall(0x0f05); 0xcc */
 
-  case SYS_getpeername:
-    return getpeernameSystemCall::handleDetPost(gs, s, t, sched);
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
+  waitForInjectedTrap(pid);
+  injectedSystemCalls++;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &oldRegs);
 
-    // Some older systems do not have this  system call.
-#ifdef SYS_getrandom
-  case SYS_getrandom:
-    return getrandomSystemCall::handleDetPost(gs, s, t, sched);
-#endif
+  return (long)regs.rax;
+}
 
-  case SYS_getrlimit:
-    return getrlimitSystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * A memfd of length bytes, and our MAP_SHARED mapping of it, for a tracee to
+ * map too. The tracee opens the memfd through /proc/<tracer>/fd/.
+ * @return our mapping, or nullptr if the memory could not be shared.
+ */
+static shared_ptr<void> createSharedMemory(
+    size_t length, int& memfd, logger& log) {
+  memfd = syscall(SYS_memfd_create, "dettrace-scratch", MFD_CLOEXEC);
+  if (memfd == -1 || ftruncate(memfd, length) == -1) {
+    DETTRACE_LOG(
+        log, Importance::info, "Unable to create scratch memfd: %s\n",
+        strerror(errno));
+    if (memfd != -1) {
+      close(memfd);
+    }
+    return nullptr;
+  }
 
-  case SYS_getrusage:
-    return getrusageSystemCall::handleDetPost(gs, s, t, sched);
+  void* local =
+      mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (local == MAP_FAILED) {
+    close(memfd);
+    return nullptr;
+  }
+  return shared_ptr<void>(local, [length](void* p) { munmap(p, length); });
+}
 
-  case SYS_gettimeofday:
-    return gettimeofdaySystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * Run program in pid from address at, borrowing the code there.
+ * @return pid's registers at the program's final int3. They are left that way,
+ * callers restore their own.
+ */
+static struct user_regs_struct runSetupProgram(
+    pid_t pid, const setupProgram& program, uint64_t at) {
+  vector<uint8_t> code = program.code();
+  code.resize((code.size() + sizeof(long) - 1) / sizeof(long) * sizeof(long));
+  size_t words = code.size() / sizeof(long);
+
+  // The code is mapped read only, ptrace may write it anyway, a word at a time.
+  vector<long> saved(words);
+  for (size_t i = 0; i < words; i++) {
+    errno = 0;
+    saved[i] = ptrace(PTRACE_PEEKTEXT, pid, (void*)(at + 8 * i), 0);
+    if (errno != 0) {
+      runtimeError("unable to borrow tracee code for exec setup.\n");
+    }
+  }
+  for (size_t i = 0; i < words; i++) {
+    long word;
+    memcpy(&word, &code[8 * i], sizeof(word));
+    ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)(at + 8 * i), (void*)word);
+  }
 
-  case SYS_ioctl:
-    return ioctlSystemCall::handleDetPost(gs, s, t, sched);
+  struct user_regs_struct regs;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
+  regs.rip = at;
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
+  waitForInjectedTrap(pid);
+  injectedSystemCalls += program.size();
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
 
-  case SYS_llistxattr:
-    return llistxattrSystemCall::handleDetPost(gs, s, t, sched);
+  for (size_t i = 0; i < words; i++) {
+    ptracer::doPtrace(
+        PTRACE_POKETEXT, pid, (void*)(at + 8 * i), (void*)saved[i]);
+  }
+  return regs;
+}
 
-  case SYS_lgetxattr:
-    return lgetxattrSystemCall::handleDetPost(gs, s, t, sched);
+/** What pid execed, "" if we can't tell. */
+static string executablePath(pid_t pid) {
+  char exe[PATH_MAX];
+  string procExe = "/proc/" + to_string(pid) + "/exe";
+  ssize_t n = readlink(procExe.c_str(), exe, sizeof(exe));
+  return n > 0 ? string(exe, n) : "";
+}
+// =======================================================================================
+void execution::handleExecEvent(pid_t pid) {
+  recordTrace(traceEvent::exec, pid, 0, nullptr, 0);
+  DETTRACE_PROBE1(exec, pid);
+  if (trapProfileOutput) {
+    trapProfileOutput->forget(pid);
+  }
+  execEvents++;
+  if (exeHashes) {
+    exeHashes->execed(pid);
+  }
+  if (startups) {
+    startups->execed(pid);
+  }
+  if (execs) {
+    execs->execed(pid);
+  }
+  if (dependencies) {
+    dependencies->execed(pid);
+  }
+  bool filterExecs =
+      log.getFilter() != nullptr && log.getFilter()->matchesExecs();
+  if (filterExecs || statsOutput) {
+    string exe = executablePath(pid);
+    if (filterExecs) {
+      log.getFilter()->execed(pid, exe);
+      logAbout(pid, -1);
+    }
+    if (statsOutput) {
+      statsOutput->execed(pid, exe);
+    }
+  }
+  if (processes.contains(pid) && processes.at(pid).vforkChild) {
+    processes.at(pid).vforkChild = false;
+    branches.attach(pid);
+  }
 
-  case SYS_nanosleep:
-    return nanosleepSystemCall::handleDetPost(gs, s, t, sched);
+  // We are about to poke at registers and memory directly.
+  tracer.flushRegs();
+  tracer.flushTraceeWrites();
+  tracer.clearReadCache();
+
+  // What the new image starts with, once the execve returns 0.
+  struct user_regs_struct entryRegs;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &entryRegs);
+  entryRegs.rax = 0;
+  entryRegs.orig_rax = -1;
+
+  // One memfd holds the scratch memory and after it the logical clock page.
+  // No clock with --parallel: a forked child shares the page with its parent,
+  // and they may run at the same time.
+  size_t clockSize = parallel ? 0 : logicalClockPageSize + sideEffectRingSize;
+  int memfd = -1;
+  auto localScratch = createSharedMemory(scratchSize + clockSize, memfd, log);
+  unsigned long vdsoBase = vdsoGetBase(pid);
+  bool trapCpuid = myGlobalState.allow_trapCPUID &&
+      !myGlobalState.kernelPre4_12 &&
+      NULL == getenv("DETTRACE_NO_CPUID_INTERCEPTION");
+
+  // Everything the new image needs from us, in one run of the tracee.
+  typedef setupProgram sp;
+  sp program;
+  if (localScratch != nullptr) {
+    string path = "/proc/" + to_string(getpid()) + "/fd/" + to_string(memfd);
+    program.call(
+        SYS_open, sp::r12,
+        {sp::stringAt(path), sp::imm(O_RDWR | O_CLOEXEC), sp::imm(0)});
+    // The clock page where the seccomp filter expects its gate, if it's free.
+    uint64_t hint = clockSize != 0 ? logicalClockPageAddr - scratchSize : 0;
+    program.call(
+        SYS_mmap, sp::r13,
+        {sp::imm(hint), sp::imm(scratchSize + clockSize),
+         sp::imm(PROT_READ | PROT_WRITE | PROT_EXEC), sp::imm(MAP_SHARED),
+         sp::resultOf(sp::r12), sp::imm(0)});
+    program.call(SYS_close, sp::noResult, {sp::resultOf(sp::r12)});
+  }
+  if (tables.valid()) {
+    string path = "/proc/" + to_string(getpid()) + "/fd/" +
+        to_string(tables.fd());
+    program.call(
+        SYS_open, sp::rbx,
+        {sp::stringAt(path), sp::imm(O_RDONLY | O_CLOEXEC), sp::imm(0)});
+    program.call(
+        SYS_mmap, sp::rbp,
+        {sp::imm(0), sp::imm(sharedTablesSize), sp::imm(PROT_READ),
+         sp::imm(MAP_SHARED), sp::resultOf(sp::rbx), sp::imm(0)});
+    program.call(SYS_close, sp::noResult, {sp::resultOf(sp::rbx)});
+  }
+  // vdso is enabled by kernel command line.
+  if (vdsoBase != 0 && vvar.size != 0) {
+    program.call(
+        SYS_mprotect, sp::r14,
+        {sp::imm(vdsoBase + vvar.offset), sp::imm(vvar.size),
+         sp::imm(PROT_NONE)});
+  }
+  if (trapCpuid) {
+    program.call(
+        SYS_arch_prctl, sp::r15, {sp::imm(ARCH_SET_CPUID), sp::imm(0)});
+  }
+  // We are about to overwrite the vdso functions anyway.
+  uint64_t programAddr = vdsoBase != 0 ? vdsoBase : entryRegs.rip;
+  auto results = runSetupProgram(pid, program, programAddr);
+  if (memfd != -1) {
+    close(memfd);
+  }
 
-  case SYS_mkdir:
-    return mkdirSystemCall::handleDetPost(gs, s, t, sched);
+  long mmapAddr = -ENOMEM;
+  if (localScratch != nullptr) {
+    mmapAddr = sp::result(results, sp::r13);
+    if ((unsigned long)mmapAddr >= -4096UL) {
+      long err = sp::result(results, sp::r12) < 0
+          ? sp::result(results, sp::r12)
+          : mmapAddr;
+      DETTRACE_LOG(
+          log, Importance::info,
+          "Tracee unable to map shared scratch memory: %s\n", strerror(-err));
+      localScratch = nullptr;
+    }
+  }
+  if (localScratch == nullptr) {
+    // Keep a private page, the tracer writes it through process_vm_writev.
+    sp fallback;
+    fallback.call(
+        SYS_mmap, sp::r13,
+        {sp::imm(0), sp::imm(scratchSize),
+         sp::imm(PROT_READ | PROT_WRITE | PROT_EXEC),
+         sp::imm(MAP_PRIVATE | MAP_ANONYMOUS), sp::imm(-1), sp::imm(0)});
+    mmapAddr = sp::result(runSetupProgram(pid, fallback, programAddr), sp::r13);
+    if ((unsigned long)mmapAddr >= -4096UL) {
+      string err = "unable to inject syscall page, error: \n";
+      runtimeError(err + strerror(-mmapAddr));
+    }
+  }
+  if (vdsoBase != 0 && vvar.size != 0 && sp::result(results, sp::r14) < 0) {
+    string err = "unable to inject mprotect, error: \n";
+    runtimeError(err + strerror(-sp::result(results, sp::r14)));
+  }
 
-  case SYS_mkdirat:
-    return mkdiratSystemCall::handleDetPost(gs, s, t, sched);
+  unsigned long clockAddr = 0;
+  shared_ptr<logicalClockPage> clockPage;
+  if (localScratch != nullptr && clockSize != 0) {
+    clockAddr = mmapAddr + scratchSize;
+    clockPage = shared_ptr<logicalClockPage>(
+        localScratch,
+        (logicalClockPage*)((char*)localScratch.get() + scratchSize));
+    vector<uint8_t> gate = bufferedSystemCallGate();
+    memcpy(
+        (char*)clockPage.get() + logicalClockGateOffset, gate.data(),
+        gate.size());
+    clockPage->bufferedSystemCalls =
+        clockAddr == logicalClockPageAddr ? bufferedSystemCalls : 0;
+    clockPage->recordedSystemCalls = recordedSystemCalls;
+    // For the vdso, and for patched sites of static binaries.
+    layOutLogicalClock(clockPage.get());
+  }
+  disableVdso(pid, vdsoBase, clockAddr, clockPage.get());
 
-  case SYS_lstat:
-    return lstatSystemCall::handleDetPost(gs, s, t, sched);
+  // TODO When does this ever happen?
+  if (!processes.contains(pid)) {
+    processes.addRoot(pid, state{pid, debugLevel, epoch, clock_step});
+    branches.attach(pid);
+    hardware.attach(pid);
+  }
+  // O_CLOEXEC pipe ends are gone now.
+  wakePipeWaiters(myScheduler);
+  processes.at(pid).readProbe->forgetAll();
 
-  case SYS_link:
-    return linkSystemCall::handleDetPost(gs, s, t, sched);
+  // Reset file descriptor state, it is wiped after execve.
+  if (processes.at(pid).fds->size() != 0) {
+    processes.at(pid).fds.write().execed();
+  }
+  processes.at(pid).paths.write().forgetFds();
+
+  processes.at(pid).mmapMemory.doesExist = true;
+  processes.at(pid).mmapMemory.setAddr(traceePtr<void>((void*)mmapAddr));
+  processes.at(pid).mmapMemory.setLocalMapping(localScratch, scratchSize);
+  processes.at(pid).clockPage = clockPage;
+  processes.at(pid).clockPageAddr = clockAddr;
+  processes.at(pid).sitePatches.reset();
+  processes.at(pid).sharedTablesAddr = 0;
+  if (tables.valid()) {
+    unsigned long tablesAddr = sp::result(results, sp::rbp);
+    if (tablesAddr < -4096UL) {
+      processes.at(pid).sharedTablesAddr = tablesAddr;
+    } else {
+      DETTRACE_LOG(
+          log, Importance::info, "Tracee unable to map shared tables: %s\n",
+          strerror(-(long)tablesAddr));
+    }
+  }
 
-  case SYS_linkat:
-    return linkatSystemCall::handleDetPost(gs, s, t, sched);
+  if (trapCpuid) {
+    // Like arch_prctl's post-hook, when the call is injected there.
+    long ret = sp::result(results, sp::r15);
+    if (ret == 0) {
+      processes.at(pid).CPUIDTrapSet = true;
+    } else {
+      DETTRACE_LOG(
+          log, Importance::inter,
+          "cpuid interception (cpuid_fault) via arch_prctl failed: %s\n"
+          "Please check `cpuid_fault` flag from `cat /proc/cpuinfo`\n",
+          strerror(-ret));
+      myGlobalState.allow_trapCPUID = false;
+    }
+  }
 
-  case SYS_mmap:
-    return mmapSystemCall::handleDetPost(gs, s, t, sched);
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &entryRegs);
+  if (sitePatching) {
+    patchKnownSitesAtExec(pid);
+  }
+}
 
-  case SYS_open:
-    return openSystemCall::handleDetPost(gs, s, t, sched);
+// =======================================================================================
+/**
+ * Run f, which injects system calls with injectStubSystemCall, after borrowing
+ * the bytes at pid's rip for the stub.
+ * @return false if we couldn't borrow them, f didn't run.
+ */
+template <typename F>
+static bool withStubAtRip(pid_t pid, F f) {
+  struct user_regs_struct regs;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
+  errno = 0;
+  long savedInsn = ptrace(PTRACE_PEEKTEXT, pid, (void*)regs.rip, 0);
+  if (errno != 0) {
+    return false;
+  }
+  unsigned long stub = 0xcc050fccUL;
+  ptracer::doPtrace(
+      PTRACE_POKETEXT, pid, (void*)regs.rip,
+      (void*)((savedInsn & ~0xffffffffUL) | stub));
+  f();
+  ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)regs.rip, (void*)savedInsn);
+  return true;
+}
 
-  case SYS_openat:
-    return openatSystemCall::handleDetPost(gs, s, t, sched);
+uint64_t execution::mapPatchRegion(pid_t pid, uint64_t site) {
+  long addr = 0;
+  withStubAtRip(pid, [pid, site, &addr]() {
+    // Ask for somewhere just below the code, the kernel picks another spot if
+    // that's taken, which may be too far away.
+    const uint64_t size = patchSites::regionSize;
+    uint64_t hint = (site & ~(size - 1)) - 16 * size;
+    addr = injectStubSystemCall(
+        pid, SYS_mmap, hint, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((unsigned long)addr >= -4096UL) {
+      addr = 0;
+    } else if (!inJumpReach(site, addr) || !inJumpReach(site, addr + size)) {
+      injectStubSystemCall(pid, SYS_munmap, addr, size);
+      addr = 0;
+    }
+  });
+  if (addr != 0 && trapProfileOutput) {
+    trapProfileOutput->mapped(
+        pid,
+        vma{(uint64_t)addr, addr + patchSites::regionSize,
+            ProcMapPermRead | ProcMapPermWrite | ProcMapPermExec |
+                ProcMapPermPrivate,
+            0, "[dettrace-patch]"});
+  }
+  return addr;
+}
 
-  case SYS_pause:
-    return pauseSystemCall::handleDetPost(gs, s, t, sched);
+uint64_t execution::patchSite(
+    pid_t pid,
+    uint64_t site,
+    size_t insnLength,
+    const char* insnName,
+    const function<vector<uint8_t>(
+        const uint8_t* relocated,
+        size_t relocatedLength,
+        uint64_t trampolineAddr,
+        uint64_t returnAddr)>& makeTrampoline) {
+  state& s = processes.at(pid);
+  patchSites& sites = s.sitePatches.write();
+
+  // We are about to poke at registers and memory directly.
+  tracer.flushRegs();
+  tracer.flushTraceeWrites();
+  tracer.clearReadCache();
+
+  uint8_t code[16];
+  size_t patchLength = 0;
+  if (readVmTraceeRaw(traceePtr<uint8_t>((uint8_t*)site), code, 16, pid) ==
+      16) {
+    patchLength = sitePatchLength(code, sizeof(code), insnLength);
+  }
+  if (patchLength == 0) {
+    DETTRACE_LOG(
+        log, Importance::info,
+        "[%d] Unable to relocate the instructions after %s at %p\n", pid,
+        insnName, (void*)site);
+    sites.giveUp(site);
+    return 0;
+  }
 
-  case SYS_pipe:
-    return pipeSystemCall::handleDetPost(gs, s, t, sched);
+  // Every jump in a trampoline is the same size wherever it is placed.
+  const uint8_t* relocated = code + insnLength;
+  size_t relocatedLength = patchLength - insnLength;
+  size_t trampolineSize =
+      makeTrampoline(relocated, relocatedLength, site, site).size();
+  uint64_t trampoline = sites.reserve(site, trampolineSize);
+  if (trampoline == 0) {
+    uint64_t region = mapPatchRegion(pid, site);
+    if (region == 0) {
+      sites.giveUp(site);
+      return 0;
+    }
+    sites.addRegion(region);
+    trampoline = sites.reserve(site, trampolineSize);
+  }
 
-  case SYS_pipe2:
-    return pipe2SystemCall::handleDetPost(gs, s, t, sched);
+  vector<uint8_t> trampolineCode = makeTrampoline(
+      relocated, relocatedLength, trampoline, site + patchLength);
+  writeVmTraceeRaw(
+      trampolineCode.data(), traceePtr<uint8_t>((uint8_t*)trampoline),
+      trampolineCode.size(), pid);
+
+  // The code is mapped read only, ptrace may write it anyway, a word at a time.
+  vector<uint8_t> patch = sitePatchJump(site, patchLength, trampoline);
+  for (size_t done = 0; done < patch.size(); done += sizeof(long)) {
+    uint64_t word = site + done;
+    long value = tracer.doPtrace(PTRACE_PEEKTEXT, pid, (void*)word, 0);
+    memcpy(&value, &patch[done], min(sizeof(long), patch.size() - done));
+    ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)word, (void*)value);
+  }
 
-  case SYS_pselect6:
-    return pselect6SystemCall::handleDetPost(gs, s, t, sched);
+  DETTRACE_LOG(
+      log, Importance::info, "[%d] Patched %s at %p, trampoline at %p\n", pid,
+      insnName, (void*)site, (void*)trampoline);
+  return trampoline;
+}
 
-  case SYS_poll:
-    return pollSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::patchTscSite(
+    pid_t pid, uint64_t site, tscInstruction insn, bool trapped) {
+  uint64_t counters =
+      processes.at(pid).clockPageAddr + offsetof(logicalClockPage, tsc);
+  uint64_t trampoline = patchSite(
+      pid, site, insn == tscInstruction::rdtscp ? 3 : 2,
+      insn == tscInstruction::rdtscp ? "rdtscp" : "rdtsc",
+      [insn, counters](
+          const uint8_t* relocated, size_t relocatedLength,
+          uint64_t trampolineAddr, uint64_t returnAddr) {
+        return tscTrampoline(
+            insn, counters, RDTSC_STEPPING, relocated, relocatedLength,
+            trampolineAddr, returnAddr);
+      });
+  if (trampoline == 0) {
+    return false;
+  }
+  tscSitesPatched++;
+  if (trapped) {
+    // Run the trampoline for this instruction too.
+    tracer.writeIp(trampoline);
+    learnSite(
+        pid, site,
+        insn == tscInstruction::rdtscp ? patchKind::rdtscp : patchKind::rdtsc);
+  }
+  return true;
+}
+// =======================================================================================
+void execution::takeCheckpoint(pid_t pid) {
+  if (processes.size() != 1) {
+    DETTRACE_LOG(
+        log, Importance::inter,
+        "[%d] at the checkpoint marker with %zu tracees, only one can be "
+        "checkpointed: waiting for the next time.\n",
+        pid, processes.size());
+    return;
+  }
+  // Only this thread is forked: the others must not hold locks, or be needed
+  // by the holder and restores.
+  state& s = processes.at(pid);
+  traceePtr<void> scratch{nullptr};
+  if (s.mmapMemory.doesExist) {
+    scratch = s.mmapMemory.getAddr();
+  }
+  // Shared with the tracee, and so with every copy of it: put back what it
+  // held at the marker in restores.
+  vector<char> clockPage;
+  if (s.clockPage != nullptr) {
+    char* page = (char*)s.clockPage.get();
+    clockPage.assign(page, page + logicalClockPageSize);
+  }
+  log.pauseWriter();
+  helpers.pause();
+  checkpoint::role r = checkpointer->take(pid, scratch);
+  helpers.resume();
+  log.resumeWriter();
+
+  if (r == checkpoint::role::restored) {
+    restoredRun = true;
+    // Runs restored before may have created them.
+    myGlobalState.missing.clear();
+    if (!clockPage.empty()) {
+      memcpy(s.clockPage.get(), clockPage.data(), clockPage.size());
+    }
+    DETTRACE_LOG(
+        log, Importance::inter, "[%d] restored from the checkpoint.\n", pid);
+  }
+  // Whoever we are, pid is in the marker's stop again, maybe a new one.
+  tracer.updateStateSeccomp(pid);
+}
+// =======================================================================================
+template <typename Kernel>
+bool execution::handleSeccomp(const pid_t traceesPid) {
+  long syscallNum;
+  ptracer::doPtrace(PTRACE_GETEVENTMSG, traceesPid, nullptr, &syscallNum);
+  DETTRACE_PROBE2(seccomp_stop, traceesPid, syscallNum);
 
-  case SYS_prlimit64:
-    return prlimit64SystemCall::handleDetPost(gs, s, t, sched);
+  // The first seccomp event is the initial execve, our last chance to grab the
+  // notify fd before it is closed on exec.
+  if (useSeccompNotify && !notifyFdAcquired) {
+    acquireNotifyFd(traceesPid);
+  }
 
-  case SYS_read:
-    return readSystemCall::handleDetPost(gs, s, t, sched);
+  // INT16_MAX is sent by seccomp by convention as for system calls with no
+  // rules. System calls only let through for some of their arguments land here
+  // for all the others, and are handled as usual.
+  if (syscallNum == INT16_MAX) {
+    // Fetch real system call from register.
+    tracer.updateState(traceesPid);
+    syscallNum = tracer.getSystemCallNumber();
+    if (seccomp::isArgumentFiltered(syscallNum)) {
+      // Fall through to the regular handler below.
+    } else if (0 <= syscallNum && syscallNum < SYSTEM_CALL_COUNT) {
+      runtimeError(
+          "No filter rule for system call: " + systemCallMappings[syscallNum]);
+    } else {
+      runtimeError(
+          "No filter rule for system call with unknown number: " +
+          to_string(syscallNum));
+    }
+  }
 
-  case SYS_readlink:
-    return readlinkSystemCall::handleDetPost(gs, s, t, sched);
+  // Get system call number and arguments from tracee, the rest of the
+  // registers are only fetched if a handler needs them.
+  tracer.updateStateSeccomp(traceesPid);
+
+  if (checkpointer != nullptr) {
+    string path;
+    if (syscallNum == SYS_open || syscallNum == SYS_creat) {
+      path = tracer.readTraceeCString(
+          traceePtr<char>((char*)tracer.arg1()), traceesPid);
+    } else if (syscallNum == SYS_openat) {
+      path = tracer.readTraceeCString(
+          traceePtr<char>((char*)tracer.arg2()), traceesPid);
+    }
+    if (checkpointer->isMarker(syscallNum, path)) {
+      takeCheckpoint(traceesPid);
+    }
+  }
 
-  case SYS_readlinkat:
-    return readlinkatSystemCall::handleDetPost(gs, s, t, sched);
+  if (myGlobalState.allow_trapCPUID) {
+    if (!processes.at(traceesPid).CPUIDTrapSet &&
+        !myGlobalState.kernelPre4_12 &&
+        NULL == getenv("DETTRACE_NO_CPUID_INTERCEPTION")) {
+      // check if CPUID needs to be set, if it does, set trap
+      trapCPUID(myGlobalState, processes.at(traceesPid), tracer);
+    }
+  }
 
-  case SYS_recvmsg:
-    return recvmsgSystemCall::handleDetPost(gs, s, t, sched);
+  auto callPostHook =
+      handlePreSystemCall<Kernel>(processes.at(traceesPid), traceesPid);
+  return callPostHook;
+}
 
-  case SYS_rename:
-    return renameSystemCall::handleDetPost(gs, s, t, sched);
+struct CPUIDRegs {
+  unsigned eax;
+  unsigned ebx;
+  unsigned ecx;
+  unsigned edx;
+};
 
-  case SYS_renameat:
-    return renameatSystemCall::handleDetPost(gs, s, t, sched);
+// clang-format off
+static const struct CPUIDRegs cpuids[] =
+  {
+   { 0x0000000D, 0x756E6547, 0x6C65746E, 0x49656E69, },
+   { 0x00000663, 0x00000800, 0x80202001, 0x078BFBFD, },
+   { 0x00000001, 0x00000000, 0x0000004D, 0x002C307D, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000120, 0x01C0003F, 0x0000003F, 0x00000001, },
+   { 0x00000000, 0x00000000, 0x00000003, 0x00000000, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000000, 0x00000001, 0x00000100, 0x00000001, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+   { 0x00000000, 0x00000000, 0x00000000, 0x00000000, },
+  };
 
-  case SYS_renameat2:
-    return renameat2SystemCall::handleDetPost(gs, s, t, sched);
+static const struct CPUIDRegs extended_cpuids[] =
+  {
+   { 0x8000000A, 0x756E6547,0x6C65746E,0x49656E69, },
+   { 0x00000663, 0x00000000,0x00000001,0x20100800, },
+   { 0x554D4551, 0x72695620,0x6C617574,0x55504320, },
+   { 0x72657620, 0x6E6F6973,0x352E3220,0x0000002B, },
+   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
+   { 0x01FF01FF, 0x01FF01FF,0x40020140,0x40020140, },
+   { 0x00000000, 0x42004200,0x02008140,0x00808140, },
+   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
+   { 0x00003028, 0x00000000,0x00000000,0x00000000, },
+   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
+   { 0x00000000, 0x00000000,0x00000000,0x00000000, },
+};
+// clang-format on
 
-  case SYS_rmdir:
-    return rmdirSystemCall::handleDetPost(gs, s, t, sched);
+static const uint32_t cpuidLeaves = sizeof(cpuids) / sizeof(cpuids[0]);
+static const uint32_t extendedCpuidLeaves =
+    sizeof(extended_cpuids) / sizeof(extended_cpuids[0]);
 
-  case SYS_rt_sigprocmask:
-    return rt_sigprocmaskSystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * Leaves, then extended leaves, into table, with the topology a machine of
+ * cpus CPUs reports, --cpus, if cpus isn't 0. One package of cpus cores, one
+ * thread each. Leaf 0xB is left alone, it would need subleaves.
+ */
+static void fillCpuidTable(CPUIDRegs* table, unsigned cpus) {
+  memcpy(table, cpuids, sizeof(cpuids));
+  memcpy(table + cpuidLeaves, extended_cpuids, sizeof(extended_cpuids));
+  if (cpus == 0) {
+    return;
+  }
+  // Leaf 1: logical processors of the package in EBX[23:16], EDX.HTT.
+  table[1].ebx = (table[1].ebx & ~0x00FF0000u) | (min(cpus, 255u) << 16);
+  if (cpus > 1) {
+    table[1].edx |= 1u << 28;
+  }
+  // Leaf 4: cores of the package, minus one, in EAX[31:26].
+  table[4].eax = (table[4].eax & 0x03FFFFFFu) | ((min(cpus, 64u) - 1) << 26);
+  // Leaf 0x80000008: the same, AMD's way, in ECX[7:0].
+  CPUIDRegs& addressSizes = table[cpuidLeaves + 8];
+  addressSizes.ecx = (addressSizes.ecx & ~0xFFu) | (min(cpus, 256u) - 1);
+}
 
-  case SYS_rt_sigaction:
-    return rt_sigactionSystemCall::handleDetPost(gs, s, t, sched);
+// =======================================================================================
+uint64_t execution::mapCpuidTable(pid_t pid) {
+  patchSites& sites = processes.at(pid).sitePatches.write();
+  if (sites.cpuidTable != 0) {
+    return sites.cpuidTable;
+  }
 
-  case SYS_rt_sigtimedwait:
-    return rt_sigtimedwaitSystemCall::handleDetPost(gs, s, t, sched);
+  // Leaves, then extended leaves, as the trampolines expect them.
+  CPUIDRegs table[cpuidLeaves + extendedCpuidLeaves];
+  fillCpuidTable(table, myGlobalState.cpus);
+
+  long addr = 0;
+  withStubAtRip(pid, [pid, &table, &addr]() {
+    addr = injectStubSystemCall(
+        pid, SYS_mmap, 0, 4096, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((unsigned long)addr >= -4096UL) {
+      addr = 0;
+      return;
+    }
+    writeVmTraceeRaw(
+        table, traceePtr<CPUIDRegs>((CPUIDRegs*)addr), sizeof(table), pid);
+    injectStubSystemCall(pid, SYS_mprotect, addr, 4096, PROT_READ);
+  });
+  sites.cpuidTable = addr;
+  return addr;
+}
 
-  case SYS_rt_sigsuspend:
-    return rt_sigsuspendSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::patchCpuidSite(pid_t pid, uint64_t site, bool trapped) {
+  uint64_t table = mapCpuidTable(pid);
+  if (table == 0) {
+    processes.at(pid).sitePatches.write().giveUp(site);
+    return false;
+  }
+  uint64_t trampoline = patchSite(
+      pid, site, 2, "cpuid",
+      [table](
+          const uint8_t* relocated, size_t relocatedLength,
+          uint64_t trampolineAddr, uint64_t returnAddr) {
+        return cpuidTrampoline(
+            table, cpuidLeaves, extendedCpuidLeaves, relocated,
+            relocatedLength, trampolineAddr, returnAddr);
+      });
+  if (trampoline == 0) {
+    return false;
+  }
+  cpuidSitesPatched++;
+  if (trapped) {
+    tracer.writeIp(trampoline);
+    learnSite(pid, site, patchKind::cpuid);
+  }
+  return true;
+}
 
-  case SYS_rt_sigpending:
-    return rt_sigpendingSystemCall::handleDetPost(gs, s, t, sched);
+void execution::bufferSystemCallSite(state& s, int syscallNum) {
+  if (s.clockPage == nullptr) {
+    return;
+  }
+  // The time is read from the clock page like the vdso does, anywhere.
+  if (syscallNum == SYS_read || syscallNum == SYS_write) {
+    if (s.clockPageAddr != logicalClockPageAddr ||
+        (s.clockPage->bufferedSystemCalls & ((uint64_t)1 << syscallNum)) ==
+            0) {
+      return;
+    }
+    int fd = tracer.arg1();
+    if (fd < 0 || fd >= bufferedFds || !neverBlocks(s.getFdType(fd))) {
+      return;
+    }
+  }
+  // Our own system calls: the gate's, the clock functions' and the
+  // trampolines' for fds that aren't regular files.
+  uint64_t site = (uint64_t)tracer.getRip().ptr - 2;
+  if ((site >= s.clockPageAddr &&
+       site < s.clockPageAddr + logicalClockPageSize) ||
+      s.sitePatches->inRegion(site)) {
+    return;
+  }
+  bool known = !s.sitePatches->seen(site) && knownSite(s.traceePid, site);
+  patchSites& sites = s.sitePatches.write();
+  if (!known && !sites.trapped(site, patchSites::syscallTrapsBeforePatching)) {
+    return;
+  }
+  uint16_t insn = tracer.readFromTracee(
+      traceePtr<uint16_t>((uint16_t*)site), s.traceePid);
+  if (insn != 0x050f) {
+    // int $0x80 or sysenter.
+    sites.giveUp(site);
+    return;
+  }
+  patchSyscallSite(s.traceePid, site, true);
+}
 
-  case SYS_sendto:
-    return sendtoSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::patchSyscallSite(pid_t pid, uint64_t site, bool trapped) {
+  uint64_t pageAddr = processes.at(pid).clockPageAddr;
+  // Where the relocated instructions start in the trampoline.
+  size_t done = 0;
+  uint64_t trampoline = patchSite(
+      pid, site, 2, "syscall",
+      [pageAddr, &done](
+          const uint8_t* relocated, size_t relocatedLength,
+          uint64_t trampolineAddr, uint64_t returnAddr) {
+        vector<uint8_t> code = bufferedSystemCallTrampoline(
+            pageAddr, relocated, relocatedLength, trampolineAddr, returnAddr);
+        done = code.size() - trampolineTail(relocatedLength);
+        return code;
+      });
+  if (trampoline == 0) {
+    return false;
+  }
+  syscallSitesPatched++;
+  if (trapped) {
+    // This one is under way already: it returns to the relocated
+    // instructions, right after the trampoline's own syscall, should the
+    // kernel restart it.
+    tracer.writeIp(trampoline + done);
+    learnSite(pid, site, patchKind::syscall);
+  }
+  return true;
+}
 
-  case SYS_sendmsg:
-    return sendmsgSystemCall::handleDetPost(gs, s, t, sched);
+void execution::learnSite(pid_t pid, uint64_t site, patchKind kind) {
+  if (!knownSites) {
+    return;
+  }
+  addressSpace maps(parseProcMapEntries(pid));
+  const vma* m = maps.find(site);
+  fileIdentity file;
+  if (m != nullptr && patchSiteCache::identify(*m, file)) {
+    knownSites->patched(file, site - m->start + m->offset, kind);
+  }
+}
 
-  case SYS_sendmmsg:
-    return sendmmsgSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::knownSite(pid_t pid, uint64_t site) {
+  // Other threads, or a vfork parent, may be in the middle of a site we would
+  // patch, the one trapping is the only one we know isn't.
+  state& s = processes.at(pid);
+  if (!knownSites || s.vforkChild || processes.threadGroupSize(pid) > 1) {
+    return false;
+  }
+  addressSpace maps(parseProcMapEntries(pid));
+  const vma* m = maps.find(site);
+  return m != nullptr && patchKnownSites(pid, *m, site);
+}
 
-  case SYS_recvfrom:
-    return recvfromSystemCall::handleDetPost(gs, s, t, sched);
+void execution::patchKnownSitesAtExec(pid_t pid) {
+  if (!knownSites) {
+    return;
+  }
+  for (const ProcMapEntry& e : parseProcMapEntries(pid)) {
+    patchKnownSites(
+        pid,
+        vma{e.procMapBase, e.procMapBase + e.procMapSize, e.procMapPerms,
+            e.procMapOffset, e.procMapName},
+        0);
+  }
+}
 
-  case SYS_select:
-    return selectSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::patchKnownSites(pid_t pid, const vma& m, uint64_t trappedAt) {
+  state& s = processes.at(pid);
+  fileIdentity file;
+  if ((m.perms & ProcMapPermExec) == 0 ||
+      !s.sitePatches.write().firstLookAt(m.start) ||
+      !patchSiteCache::identify(m, file)) {
+    return false;
+  }
+  const patchSiteCache::fileSites* known = knownSites->sitesOf(file);
+  if (known == nullptr) {
+    return false;
+  }
 
-  case SYS_setitimer:
-    return setitimerSystemCall::handleDetPost(gs, s, t, sched);
+  bool trappedKnown = false;
+  for (auto& site : *known) {
+    if (site.first < m.offset || site.first - m.offset >= m.end - m.start) {
+      continue;
+    }
+    uint64_t addr = m.start + (site.first - m.offset);
+    // Our caller patches it, taking care of the trap.
+    if (addr == trappedAt) {
+      trappedKnown = true;
+    } else if (patchKnownSite(pid, addr, site.second)) {
+      knownSitesPatched++;
+    }
+  }
+  return trappedKnown;
+}
 
-  case SYS_set_robust_list:
-    return set_robust_listSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::patchKnownSite(pid_t pid, uint64_t site, patchKind kind) {
+  state& s = processes.at(pid);
+  // The file is the version we learned it from, but check what we overwrite.
+  uint8_t insn[3] = {0};
+  if (readVmTraceeRaw(traceePtr<uint8_t>((uint8_t*)site), insn, 3, pid) != 3 ||
+      insn[0] != 0x0f) {
+    return false;
+  }
+  switch (kind) {
+  case patchKind::rdtsc:
+    return insn[1] == 0x31 && s.clockPage != nullptr &&
+        patchTscSite(pid, site, tscInstruction::rdtsc, false);
+  case patchKind::rdtscp:
+    return insn[1] == 0x01 && insn[2] == 0xf9 && s.clockPage != nullptr &&
+        patchTscSite(pid, site, tscInstruction::rdtscp, false);
+  case patchKind::cpuid:
+    return insn[1] == 0xa2 && s.CPUIDTrapSet &&
+        patchCpuidSite(pid, site, false);
+  case patchKind::syscall:
+    return insn[1] == 0x05 && s.clockPage != nullptr &&
+        patchSyscallSite(pid, site, false);
+  }
+  return false;
+}
 
-  case SYS_statfs:
-    return statfsSystemCall::handleDetPost(gs, s, t, sched);
+// =======================================================================================
+void execution::handleSignal(int sigNum, const pid_t traceesPid) {
+  myScheduler.madeProgress();
+  processes.at(traceesPid).atSignalStop = true;
+  if (sigNum == branchCounter::overflowSignal && branches.enabled()) {
+    siginfo_t info;
+    ptracer::doPtrace(PTRACE_GETSIGINFO, traceesPid, nullptr, &info);
+    if (branches.isOverflow(traceesPid, info.si_fd)) {
+      handleBranchOverflow(traceesPid);
+      return;
+    }
+  }
 
-  case SYS_stat:
-    return statSystemCall::handleDetPost(gs, s, t, sched);
+  recordTrace(traceEvent::signal, traceesPid, sigNum, nullptr, 0);
+  if (sigNum == SIGSEGV) {
+    tracer.updateState(traceesPid);
+    uint32_t curr_insn32;
+    ssize_t ret = readVmTraceeRaw(
+        traceePtr<uint32_t>((uint32_t*)tracer.getRip().ptr), &curr_insn32,
+        sizeof(uint32_t), traceesPid);
 
-  case SYS_sysinfo:
-    return sysinfoSystemCall::handleDetPost(gs, s, t, sched);
+    if (ret == -1) {
+      runtimeError(
+          "Unable to read RIP for segfault. Cannot determine if rdtsc.\n");
+    }
 
-  case SYS_symlink:
-    return symlinkSystemCall::handleDetPost(gs, s, t, sched);
+    if ((curr_insn32 << 16) == 0x310F0000 || (curr_insn32 << 8) == 0xF9010F00) {
+      auto msg = "[%d] Tracer: Received rdtsc: Reading next instruction.\n";
+      int ip_step = 2;
 
-  case SYS_symlinkat:
-    return symlinkatSystemCall::handleDetPost(gs, s, t, sched);
+      bool rdtscp = (curr_insn32 << 8) == 0xF9010F00;
+      profileTrap(traceesPid, rdtscp ? "rdtscp" : "rdtsc");
+      uint64_t site = (uint64_t)tracer.getRip().ptr;
+      state& s = processes.at(traceesPid);
+      patchSites& sites = s.sitePatches.write();
+      if (sitePatching && s.clockPage != nullptr &&
+          ((!sites.seen(site) && knownSite(traceesPid, site)) ||
+           sites.trapped(site, patchSites::tscTrapsBeforePatching)) &&
+          patchTscSite(
+              traceesPid, site,
+              rdtscp ? tscInstruction::rdtscp : tscInstruction::rdtsc,
+              true)) {
+        if (rdtscp) {
+          rdtscpEvents++;
+        } else {
+          rdtscEvents++;
+        }
+        s.signalToDeliver = 0;
+        return;
+      }
 
-  case SYS_mknod:
-    return mknodSystemCall::handleDetPost(gs, s, t, sched);
+      if (rdtscp) {
+        rdtscpEvents++;
+        tracer.writeRcx(tscpCounter);
+        tscpCounter += RDTSC_STEPPING;
+        ip_step = 3;
+        msg = "[%d] Tracer: Received rdtscp: Reading next instruction.\n";
+      } else {
+        rdtscEvents++;
+      }
 
-  case SYS_mknodat:
-    return mknodatSystemCall::handleDetPost(gs, s, t, sched);
+      tracer.writeRax(tscCounter);
+      tracer.writeRdx(0);
+      tscCounter += RDTSC_STEPPING;
+      tracer.writeIp((uint64_t)tracer.getRip().ptr + ip_step);
 
-  case SYS_tgkill:
-    return tgkillSystemCall::handleDetPost(gs, s, t, sched);
+      // Signal is now suppressed.
+      processes.at(traceesPid).signalToDeliver = 0;
 
-  case SYS_time:
-    return timeSystemCall::handleDetPost(gs, s, t, sched);
+      // force a preemption to avoid possible busy reading TSCs.
+      // myScheduler.preemptAndScheduleNext();
+      DETTRACE_LOG(
+          log, Importance::inter, log.makeTextColored(Color::blue, msg),
+          traceesPid, sigNum);
+      return;
+    } else if ((curr_insn32 << 16) == 0xA20F0000) {
+      struct user_regs_struct regs = tracer.getRegs();
+      profileTrap(traceesPid, "cpuid");
 
-  case SYS_timer_create:
-    return timer_createSystemCall::handleDetPost(gs, s, t, sched);
+      auto msg =
+          "[%d] Tracer: intercepted cpuid instruction at %p. %rax == %p, %rcx "
+          "== %p\n";
+      DETTRACE_LOG(
+          log, Importance::inter, log.makeTextColored(Color::blue, msg),
+          traceesPid, regs.rip, regs.rax, regs.rcx);
+
+      // Leaves we have, at a site we can patch, never trap again.
+      uint64_t site = regs.rip;
+      uint32_t leaf = regs.rax;
+      bool known = leaf < cpuidLeaves ||
+          (leaf >= 0x80000000u && leaf - 0x80000000u < extendedCpuidLeaves);
+      state& s = processes.at(traceesPid);
+      patchSites& sites = s.sitePatches.write();
+      if (sitePatching && known &&
+          ((!sites.seen(site) && knownSite(traceesPid, site)) ||
+           sites.trapped(site, patchSites::cpuidTrapsBeforePatching)) &&
+          patchCpuidSite(traceesPid, site, true)) {
+        s.signalToDeliver = 0;
+        return;
+      }
 
-  case SYS_timer_delete:
-    return timer_deleteSystemCall::handleDetPost(gs, s, t, sched);
+      // step over cpuid insn
+      tracer.writeIp((uint64_t)tracer.getRip().ptr + 2);
 
-  case SYS_timer_getoverrun:
-    return timer_getoverrunSystemCall::handleDetPost(gs, s, t, sched);
+      // suppress SIGSEGV from reaching the tracee
+      processes.at(traceesPid).signalToDeliver = 0;
 
-  case SYS_timer_gettime:
-    return timer_gettimeSystemCall::handleDetPost(gs, s, t, sched);
+      // fill in canonical cpuid return values
 
-  case SYS_timer_settime:
-    return timer_settimeSystemCall::handleDetPost(gs, s, t, sched);
+      const unsigned long nleafs = sizeof(cpuids) / sizeof(cpuids[0]);
+      assert(nleafs == 1 + cpuids[0].eax);
 
-  case SYS_timerfd_create:
-    return timerfd_createSystemCall::handleDetPost(gs, s, t, sched);
+      const unsigned long nleafs_ext =
+          0x80000000ul + sizeof(extended_cpuids) / sizeof(extended_cpuids[0]);
+      assert(nleafs_ext == 1 + extended_cpuids[0].eax);
 
-  case SYS_timerfd_settime:
-    return timerfd_settimeSystemCall::handleDetPost(gs, s, t, sched);
+      CPUIDRegs table[cpuidLeaves + extendedCpuidLeaves];
+      fillCpuidTable(table, myGlobalState.cpus);
+      switch (regs.rax) {
+      case 0x0 ... nleafs: {
+        long leaf = regs.rax;
+        const struct CPUIDRegs& cpuid = table[leaf];
+        tracer.writeRax(cpuid.eax);
+        tracer.writeRbx(cpuid.ebx);
+        tracer.writeRcx(cpuid.ecx);
+        tracer.writeRdx(cpuid.edx);
+      } break;
+      case 0x80000000ul ... nleafs_ext: {
+        long leaf = regs.rax - 0x80000000ul;
+        const struct CPUIDRegs& cpuid_ext = table[cpuidLeaves + leaf];
+        tracer.writeRax(cpuid_ext.eax);
+        tracer.writeRbx(cpuid_ext.ebx);
+        tracer.writeRcx(cpuid_ext.ecx);
+        tracer.writeRdx(cpuid_ext.edx);
+      } break;
+      default:
+        runtimeError("CPUID unsupported %eax = " + to_string(regs.rax));
+      }
 
-  case SYS_timerfd_gettime:
-    return timerfd_gettimeSystemCall::handleDetPost(gs, s, t, sched);
+      return;
+    }
+  }
 
-  case SYS_times:
-    return timesSystemCall::handleDetPost(gs, s, t, sched);
+  // Remember to deliver this signal to the tracee for next event! Happens in
+  // getNextEvent.
+  processes.at(traceesPid).signalToDeliver = sigNum;
 
-  case SYS_uname:
-    return unameSystemCall::handleDetPost(gs, s, t, sched);
+  auto msg = "[%d] Tracer: Received signal: %d. Forwarding signal to tracee.\n";
+  DETTRACE_LOG(
+      log, Importance::inter, log.makeTextColored(Color::blue, msg), traceesPid,
+      sigNum);
+  return;
+}
+// =======================================================================================
+void execution::handleBranchOverflow(pid_t pid) {
+  // Ours, the tracee never sees it.
+  state& s = processes.at(pid);
+  s.signalToDeliver = 0;
+
+  // Busy, but not necessarily spinning. Let it have another quantum.
+  if (s.systemCallSinceOverflow) {
+    s.systemCallSinceOverflow = false;
+    return;
+  }
 
-  case SYS_unlink:
-    return unlinkSystemCall::handleDetPost(gs, s, t, sched);
+  branchPreemptions++;
+  DETTRACE_LOG(
+      log, Importance::inter,
+      log.makeTextColored(
+          Color::blue, "[%d] No system call for a whole branch quantum.\n"),
+      pid);
+  // In --parallel the stop was a commit, that alone moved its clock on.
+  if (!parallel) {
+    myScheduler.preemptAndScheduleNext();
+  }
+}
+// =======================================================================================
+/**
+ * Whether a system call's pre-hook asks for its post-hook. Checked against
+ * what the pre-hook returns, so keep it in sync with dettraceSystemCall.cpp.
+ */
+enum class postHookPolicy {
+  never, /**< Pre-hook always returns false. */
+  conditional, /**< Depends on the arguments or our state. */
+  always, /**< Pre-hook always returns true. */
+};
 
-  case SYS_unlinkat:
-    return unlinkatSystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * Pre and post-hook for one system call, taken from its *SystemCall class.
+ */
+struct systemCallHandler {
+  bool (*pre)(globalState&, state&, ptracer&, scheduler&);
+  void (*post)(globalState&, state&, ptracer&, scheduler&);
+  postHookPolicy policy;
+};
 
-  case SYS_utime:
-    return utimeSystemCall::handleDetPost(gs, s, t, sched);
+/**
+ * Handlers indexed by system call number, built at compile time so dispatching
+ * an event is a single indexed load. Entries without a pre-hook are system
+ * calls we do not handle.
+ */
+struct systemCallHandlerTable {
+  systemCallHandler entries[SYSTEM_CALL_COUNT];
+
+  template <typename SystemCall>
+  constexpr void add(int systemCall, postHookPolicy policy) {
+    entries[systemCall].pre = &SystemCall::handleDetPre;
+    entries[systemCall].post = &SystemCall::handleDetPost;
+    entries[systemCall].policy = policy;
+  }
 
-  case SYS_utimes:
-    return utimesSystemCall::handleDetPost(gs, s, t, sched);
+  template <typename SystemCall>
+  constexpr void addPreOnly(int systemCall) {
+    entries[systemCall].pre = &SystemCall::handleDetPre;
+    entries[systemCall].post = nullptr;
+    entries[systemCall].policy = postHookPolicy::never;
+  }
 
-  case SYS_utimensat:
-    return utimensatSystemCall::handleDetPost(gs, s, t, sched);
+  constexpr systemCallHandlerTable() : entries{} {
+    add<accessSystemCall>(SYS_access, postHookPolicy::always);
+    add<alarmSystemCall>(SYS_alarm, postHookPolicy::conditional);
+    add<arch_prctlSystemCall>(SYS_arch_prctl, postHookPolicy::conditional);
+    add<bindSystemCall>(SYS_bind, postHookPolicy::never);
+    add<chdirSystemCall>(SYS_chdir, postHookPolicy::conditional);
+    add<chmodSystemCall>(SYS_chmod, postHookPolicy::never);
+    add<clock_gettimeSystemCall>(
+        SYS_clock_gettime, postHookPolicy::conditional);
+    add<closeSystemCall>(SYS_close, postHookPolicy::always);
+    add<close_rangeSystemCall>(SYS_close_range, postHookPolicy::conditional);
+    add<connectSystemCall>(SYS_connect, postHookPolicy::always);
+    add<creatSystemCall>(SYS_creat, postHookPolicy::always);
+    add<dupSystemCall>(SYS_dup, postHookPolicy::always);
+    add<dup2SystemCall>(SYS_dup2, postHookPolicy::always);
+    addPreOnly<exit_groupSystemCall>(SYS_exit_group);
+    add<epoll_ctlSystemCall>(SYS_epoll_ctl, postHookPolicy::always);
+    add<epoll_waitSystemCall>(SYS_epoll_wait, postHookPolicy::conditional);
+    add<epoll_pwaitSystemCall>(SYS_epoll_pwait, postHookPolicy::conditional);
+    add<eventfdSystemCall>(SYS_eventfd, postHookPolicy::conditional);
+    add<eventfd2SystemCall>(SYS_eventfd2, postHookPolicy::conditional);
+    addPreOnly<execveSystemCall>(SYS_execve);
+    add<faccessatSystemCall>(SYS_faccessat, postHookPolicy::never);
+    add<fchdirSystemCall>(SYS_fchdir, postHookPolicy::always);
+    add<fchmodSystemCall>(SYS_fchmod, postHookPolicy::never);
+    add<fchmodatSystemCall>(SYS_fchmodat, postHookPolicy::never);
+    add<fgetxattrSystemCall>(SYS_fgetxattr, postHookPolicy::always);
+    add<flistxattrSystemCall>(SYS_flistxattr, postHookPolicy::always);
+    add<fchownatSystemCall>(SYS_fchownat, postHookPolicy::conditional);
+    add<fchownSystemCall>(SYS_fchown, postHookPolicy::conditional);
+    add<chownSystemCall>(SYS_chown, postHookPolicy::conditional);
+    add<lchownSystemCall>(SYS_lchown, postHookPolicy::conditional);
+    add<fcntlSystemCall>(SYS_fcntl, postHookPolicy::conditional);
+    add<fstatSystemCall>(SYS_fstat, postHookPolicy::always);
+    add<newfstatatSystemCall>(SYS_newfstatat, postHookPolicy::conditional);
+    add<fstatfsSystemCall>(SYS_fstatfs, postHookPolicy::always);
+    add<futexSystemCall>(SYS_futex, postHookPolicy::conditional);
+    add<getcwdSystemCall>(SYS_getcwd, postHookPolicy::always);
+    add<getdentsSystemCall>(SYS_getdents, postHookPolicy::always);
+    add<getdents64SystemCall>(SYS_getdents64, postHookPolicy::always);
+    add<getitimerSystemCall>(SYS_getitimer, postHookPolicy::conditional);
+    add<getpeernameSystemCall>(SYS_getpeername, postHookPolicy::always);
+#ifdef SYS_getrandom
+    add<getrandomSystemCall>(SYS_getrandom, postHookPolicy::always);
+#endif
+    add<getrlimitSystemCall>(SYS_getrlimit, postHookPolicy::never);
+    add<getrusageSystemCall>(SYS_getrusage, postHookPolicy::always);
+    add<gettimeofdaySystemCall>(
+        SYS_gettimeofday, postHookPolicy::conditional);
+    add<ioctlSystemCall>(SYS_ioctl, postHookPolicy::conditional);
+#ifdef SYS_io_uring_setup
+    add<io_uring_setupSystemCall>(
+        SYS_io_uring_setup, postHookPolicy::conditional);
+    add<io_uring_enterSystemCall>(
+        SYS_io_uring_enter, postHookPolicy::conditional);
+#endif
+    add<llistxattrSystemCall>(SYS_llistxattr, postHookPolicy::always);
+    add<lgetxattrSystemCall>(SYS_lgetxattr, postHookPolicy::always);
+    add<nanosleepSystemCall>(SYS_nanosleep, postHookPolicy::never);
+    add<mkdirSystemCall>(SYS_mkdir, postHookPolicy::always);
+    add<mkdiratSystemCall>(SYS_mkdirat, postHookPolicy::always);
+    add<lstatSystemCall>(SYS_lstat, postHookPolicy::conditional);
+    add<linkSystemCall>(SYS_link, postHookPolicy::never);
+    add<linkatSystemCall>(SYS_linkat, postHookPolicy::never);
+    add<mmapSystemCall>(SYS_mmap, postHookPolicy::always);
+    add<openSystemCall>(SYS_open, postHookPolicy::conditional);
+    add<openatSystemCall>(SYS_openat, postHookPolicy::conditional);
+    add<openat2SystemCall>(SYS_openat2, postHookPolicy::conditional);
+    add<pauseSystemCall>(SYS_pause, postHookPolicy::always);
+    add<pipeSystemCall>(SYS_pipe, postHookPolicy::always);
+    add<pipe2SystemCall>(SYS_pipe2, postHookPolicy::always);
+    add<pselect6SystemCall>(SYS_pselect6, postHookPolicy::always);
+    add<pollSystemCall>(SYS_poll, postHookPolicy::conditional);
+    add<prlimit64SystemCall>(SYS_prlimit64, postHookPolicy::conditional);
+    add<readSystemCall>(SYS_read, postHookPolicy::conditional);
+    add<readlinkSystemCall>(SYS_readlink, postHookPolicy::conditional);
+    add<readlinkatSystemCall>(SYS_readlinkat, postHookPolicy::conditional);
+    add<recvmsgSystemCall>(SYS_recvmsg, postHookPolicy::always);
+    add<renameSystemCall>(SYS_rename, postHookPolicy::conditional);
+    add<renameatSystemCall>(SYS_renameat, postHookPolicy::conditional);
+    add<renameat2SystemCall>(SYS_renameat2, postHookPolicy::conditional);
+    add<rmdirSystemCall>(SYS_rmdir, postHookPolicy::conditional);
+    add<rt_sigprocmaskSystemCall>(
+        SYS_rt_sigprocmask, postHookPolicy::conditional);
+    add<rt_sigactionSystemCall>(SYS_rt_sigaction, postHookPolicy::conditional);
+    add<rt_sigtimedwaitSystemCall>(SYS_rt_sigtimedwait, postHookPolicy::always);
+    add<rt_sigsuspendSystemCall>(SYS_rt_sigsuspend, postHookPolicy::never);
+    add<rt_sigpendingSystemCall>(SYS_rt_sigpending, postHookPolicy::always);
+    add<sendfileSystemCall>(SYS_sendfile, postHookPolicy::conditional);
+    add<sendtoSystemCall>(SYS_sendto, postHookPolicy::always);
+    add<sendmsgSystemCall>(SYS_sendmsg, postHookPolicy::always);
+    add<sendmmsgSystemCall>(SYS_sendmmsg, postHookPolicy::always);
+    add<recvfromSystemCall>(SYS_recvfrom, postHookPolicy::always);
+    add<sched_getaffinitySystemCall>(
+        SYS_sched_getaffinity, postHookPolicy::always);
+    add<sched_setaffinitySystemCall>(
+        SYS_sched_setaffinity, postHookPolicy::always);
+    add<selectSystemCall>(SYS_select, postHookPolicy::conditional);
+    add<setitimerSystemCall>(SYS_setitimer, postHookPolicy::conditional);
+    add<set_robust_listSystemCall>(SYS_set_robust_list, postHookPolicy::always);
+    add<spliceSystemCall>(SYS_splice, postHookPolicy::conditional);
+#ifdef SYS_statx
+    add<statxSystemCall>(SYS_statx, postHookPolicy::conditional);
+#endif
+    add<statfsSystemCall>(SYS_statfs, postHookPolicy::always);
+    add<statSystemCall>(SYS_stat, postHookPolicy::conditional);
+    add<sysinfoSystemCall>(SYS_sysinfo, postHookPolicy::always);
+    add<symlinkSystemCall>(SYS_symlink, postHookPolicy::always);
+    add<symlinkatSystemCall>(SYS_symlinkat, postHookPolicy::always);
+    add<mknodSystemCall>(SYS_mknod, postHookPolicy::always);
+    add<mknodatSystemCall>(SYS_mknodat, postHookPolicy::always);
+    add<tgkillSystemCall>(SYS_tgkill, postHookPolicy::never);
+    add<timeSystemCall>(SYS_time, postHookPolicy::conditional);
+    add<timer_createSystemCall>(SYS_timer_create, postHookPolicy::conditional);
+    add<timer_deleteSystemCall>(SYS_timer_delete, postHookPolicy::always);
+    add<timer_getoverrunSystemCall>(
+        SYS_timer_getoverrun, postHookPolicy::always);
+    add<timer_gettimeSystemCall>(
+        SYS_timer_gettime, postHookPolicy::conditional);
+    add<timer_settimeSystemCall>(
+        SYS_timer_settime, postHookPolicy::conditional);
+    add<timerfd_createSystemCall>(SYS_timerfd_create, postHookPolicy::always);
+    add<timerfd_settimeSystemCall>(SYS_timerfd_settime, postHookPolicy::always);
+    add<timerfd_gettimeSystemCall>(SYS_timerfd_gettime, postHookPolicy::always);
+    add<timesSystemCall>(SYS_times, postHookPolicy::always);
+    add<unameSystemCall>(SYS_uname, postHookPolicy::always);
+    add<unlinkSystemCall>(SYS_unlink, postHookPolicy::conditional);
+    add<unlinkatSystemCall>(SYS_unlinkat, postHookPolicy::conditional);
+    add<utimeSystemCall>(SYS_utime, postHookPolicy::never);
+    add<utimesSystemCall>(SYS_utimes, postHookPolicy::never);
+    add<utimensatSystemCall>(SYS_utimensat, postHookPolicy::never);
+    add<futimesatSystemCall>(SYS_futimesat, postHookPolicy::always);
+    add<wait4SystemCall>(SYS_wait4, postHookPolicy::conditional);
+    add<waitidSystemCall>(SYS_waitid, postHookPolicy::conditional);
+    add<writeSystemCall>(SYS_write, postHookPolicy::conditional);
+    add<writevSystemCall>(SYS_writev, postHookPolicy::always);
+    add<socketSystemCall>(SYS_socket, postHookPolicy::conditional);
+    add<socketpairSystemCall>(SYS_socketpair, postHookPolicy::conditional);
+    add<listenSystemCall>(SYS_listen, postHookPolicy::always);
+    add<acceptSystemCall>(SYS_accept, postHookPolicy::never);
+    add<accept4SystemCall>(SYS_accept4, postHookPolicy::always);
+    add<shutdownSystemCall>(SYS_shutdown, postHookPolicy::always);
+  }
+};
 
-  case SYS_futimesat:
-    return futimesatSystemCall::handleDetPost(gs, s, t, sched);
+static constexpr systemCallHandlerTable systemCallHandlers{};
 
-  case SYS_wait4:
-    return wait4SystemCall::handleDetPost(gs, s, t, sched);
+static const systemCallHandler& getHandler(int syscallNumber) {
+  if (syscallNumber < 0 || syscallNumber >= SYSTEM_CALL_COUNT ||
+      systemCallHandlers.entries[syscallNumber].pre == nullptr) {
+    // Generic system call. Throws error.
+    runtimeError(
+        "This is a bug. Missing case for system call: " +
+        to_string(syscallNumber));
+  }
+  return systemCallHandlers.entries[syscallNumber];
+}
 
-  case SYS_waitid:
-    return waitidSystemCall::handleDetPost(gs, s, t, sched);
+bool execution::callPreHook(
+    int syscallNumber,
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched) {
+  const systemCallHandler& handler = getHandler(syscallNumber);
+  DETTRACE_PROBE2(pre_hook, s.traceePid, syscallNumber);
+  bool callPostHook = handler.pre(gs, s, t, sched);
 
-  case SYS_write:
-    return writeSystemCall::handleDetPost(gs, s, t, sched);
-
-  case SYS_writev:
-    return writevSystemCall::handleDetPost(gs, s, t, sched);
-  case SYS_socket:
-    return socketSystemCall::handleDetPost(gs, s, t, sched);
-  case SYS_listen:
-    return listenSystemCall::handleDetPost(gs, s, t, sched);
-  case SYS_accept:
-    return acceptSystemCall::handleDetPost(gs, s, t, sched);
-  case SYS_accept4:
-    return accept4SystemCall::handleDetPost(gs, s, t, sched);
-  case SYS_shutdown:
-    return shutdownSystemCall::handleDetPost(gs, s, t, sched);
-  }
-
-  // Generic system call. Throws error.
-  runtimeError(
-      "This is a bug: "
-      "Missing case for system call: " +
-      to_string(syscallNumber));
+  if ((handler.policy == postHookPolicy::never && callPostHook) ||
+      (handler.policy == postHookPolicy::always && !callPostHook)) {
+    runtimeError(
+        "This is a bug. Post-hook policy out of date for system call: " +
+        to_string(syscallNumber));
+  }
+  return callPostHook;
+}
+// =======================================================================================
+void execution::callPostHook(
+    int syscallNumber,
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched) {
+  const systemCallHandler& handler = getHandler(syscallNumber);
+  if (handler.post == nullptr) {
+    runtimeError(
+        "This is a bug: "
+        "Missing case for system call: " +
+        to_string(syscallNumber));
+  }
+  DETTRACE_PROBE2(post_hook, s.traceePid, syscallNumber);
+  handler.post(gs, s, t, sched);
 }
 // =======================================================================================
 tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
@@ -1683,16 +3266,89 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
   // Pid of the process whose event we just intercepted through ptrace.
   pid_t traceesPid;
 
+  resumeTracee(pidToContinue, ptraceSystemcall);
+
+  // Wait for next event to intercept.
+  traceesPid = waitForTracee(pidToContinue, &status);
+  if (statsOutput) {
+    statsOutput->stopped(traceesPid);
+    if (--stopsUntilMemorySample == 0) {
+      stopsUntilMemorySample = memorySampleStops;
+      memoryPeak.keepPeak(memoryNow());
+    }
+    if (live && live->due()) {
+      publishLiveStats();
+    }
+  }
+  if (timelineOutput) {
+    timelineOutput->stopped(traceesPid);
+  }
+  DETTRACE_LOG(
+      log, Importance::extra, "getNextEvent(): Got event from waitpid().\n");
+
+  return make_tuple(getPtraceEvent(status), traceesPid, status);
+}
+// =======================================================================================
+void execution::resumeTracee(pid_t pidToContinue, bool ptraceSystemcall) {
   // At every doPtrace we have the choice to deliver a signal. We must deliver a
   // signal when an actual signal was returned (ptraceEvent::signal), otherwise
   // the signal is never delivered to the tracee! This field is updated in
   // @handleSignal
   //
   // 64 bit value to avoid warning when casting to void* below.
-  int64_t signalToDeliver = states.at(pidToContinue).signalToDeliver;
+  state& s = processes.at(pidToContinue);
+  takeInitialStop(s);
+  // It stopped again without being resumed, it was killed: waitForTracee hands
+  // that stop out next. Running tracees have no stops waiting with --parallel.
+  if (!parallel && collectedStops.count(pidToContinue) != 0) {
+    return;
+  }
+  int64_t signalToDeliver = s.signalToDeliver;
 
   // Reset signal field after for next event.
-  states.at(pidToContinue).signalToDeliver = 0;
+  s.signalToDeliver = 0;
+  // Later periods of its timers, as its clock got to them.
+  while (s.timers->signalDue(s.getLogicalTime())) {
+    s.pendingSignals.push(
+        s.timers.write().expireNextSignal(s.getLogicalTime()));
+  }
+  // Signals we raised go one per resume. At a signal-delivery-stop whose own
+  // signal we suppressed (rdtsc, cpuid, ...) ptrace delivers it with this very
+  // resume. Anywhere else ptrace can't, the kernel gets it pending instead and
+  // the tracee stops for it as it returns to user space.
+  if (signalToDeliver == 0 && !s.pendingSignals.empty()) {
+    int signum = s.pendingSignals.pop();
+    if (s.atSignalStop) {
+      signalToDeliver = signum;
+    } else {
+      doWithCheck(
+          syscall(
+              SYS_tgkill, processes.threadGroupOf(pidToContinue),
+              pidToContinue, signum),
+          [&]() { return "tgkill of pending signal " + to_string(signum); });
+    }
+  }
+  s.atSignalStop = false;
+  pinTracee(pidToContinue);
+  if (statsOutput) {
+    statsOutput->resumed(pidToContinue);
+  }
+  if (timelineOutput) {
+    timelineOutput->resumed(pidToContinue);
+  }
+  // What its vdso and patched rdtsc sites read from now on.
+  s.pushClock();
+  if (s.clockPage != nullptr) {
+    s.clockPage->tsc = tscCounter;
+    s.clockPage->tscp = tscpCounter;
+  }
+
+  // Register and memory writes from our handlers are batched, push them to the
+  // tracee before it runs again. Anything we read from its memory may change
+  // too.
+  tracer.flushRegs();
+  tracer.flushTraceeWrites();
+  tracer.clearReadCache();
 
   // Usually we use PTRACE_CONT below because we are letting seccomp + bpf
   // handle the events. So unlike standard ptrace, we do not rely on system call
@@ -1701,8 +3357,8 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
   // we need the system call to be called and then we change it's arguments. So
   // we call PTRACE_SYSCALL instead.
   if (ptraceSystemcall) {
-    log.writeToLog(
-        Importance::extra,
+    DETTRACE_LOG(
+        log, Importance::extra,
         "getNextEvent(): Waiting for next system call event.\n");
     struct user_regs_struct regs;
     ptracer::doPtrace(PTRACE_GETREGS, pidToContinue, 0, &regs);
@@ -1712,19 +3368,21 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
     // for more details, see `Caveats` section of kernel document:
     // https://www.kernel.org/doc/Documentation/prctl/seccomp_filter.txt
     if ((regs.rip & ~0xc00ULL) == 0xFFFFFFFFFF600000ULL) {
-      log.writeToLog(
-          Importance::extra, "getNextEvent(): Looking at VDSO in old glibc.\n");
+      DETTRACE_LOG(
+          log, Importance::extra,
+          "getNextEvent(): Looking at VDSO in old glibc.\n");
       int status;
       int syscallNum = regs.orig_rax;
       // vsyscall seccomp stop is a special case
       // single step would cause the vsyscall exit fully
       // we cannot use `PTRACE_SYSCALL` as it wouldn't stop
       // at syscall exit like regular syscalls.
-      ptracer::doPtrace(
-          PTRACE_SINGLESTEP, pidToContinue, 0, (void*)signalToDeliver);
+      // The signal goes with the PTRACE_CONT below, once.
+      ptracer::doPtrace(PTRACE_SINGLESTEP, pidToContinue, 0, 0);
       // wait for our SIGTRAP
       // TODO check return value of this!!
       waitpid(pidToContinue, &status, 0);
+      ptraceStops++;
 
       // call our post-hook manually for vsyscall stops.
       tracer.updateState(pidToContinue);
@@ -1732,7 +3390,7 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
       // TODO this assumes we wanted to call the post-hook for this system call,
       // is this always true?
       callPostHook(
-          syscallNum, myGlobalState, states.at(pidToContinue), tracer,
+          syscallNum, myGlobalState, processes.at(pidToContinue), tracer,
           myScheduler);
 
       // TODO What's the point of this second updateState call?
@@ -1755,8 +3413,8 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
           "here at syscall!");
     }
   } else {
-    log.writeToLog(
-        Importance::extra, "getNextEvent(): Waiting at ptrace(CONT).\n");
+    DETTRACE_LOG(
+        log, Importance::extra, "getNextEvent(): Waiting at ptrace(CONT).\n");
     // Tell the process that we just intercepted an event for to continue, with
     // us tracking it's system calls. If this is the first time this function is
     // called, it will be the starting process. Which we expect to be in a
@@ -1768,13 +3426,291 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
         ptrace(PTRACE_CONT, pidToContinue, 0, (void*)signalToDeliver),
         "failed to PTRACE_CONT from getNextEvent()\n");
   }
+}
+// =======================================================================================
+pid_t execution::waitForTracee(pid_t pid, int* status) {
+  pid_t stopped = waitForStop(pid, status);
+  pullFromTracee(stopped);
+  return stopped;
+}
+// =======================================================================================
+void execution::pullFromTracee(pid_t pid) {
+  // The tracee may have read the time through its vdso while it ran.
+  if (!processes.contains(pid)) {
+    return;
+  }
+  state& s = processes.at(pid);
+  s.pullClock();
+  if (s.clockPage != nullptr) {
+    tscCounter = max(tscCounter, s.clockPage->tsc);
+    tscpCounter = max(tscpCounter, s.clockPage->tscp);
+    drainSideEffects(s);
+  }
+}
+// =======================================================================================
+void execution::drainSideEffects(state& s) {
+  logicalClockPage* page = s.clockPage.get();
+  // The tracee's to scribble on, never read past the ring.
+  uint64_t end = min<uint64_t>(page->sideEffectBytes, sideEffectRingSize);
+  if (end == 0) {
+    return;
+  }
+  const char* ring = (const char*)page + logicalClockPageSize;
+  uint64_t at = 0;
+  while (at + sizeof(sideEffectRecord) <= end) {
+    const sideEffectRecord* record = (const sideEffectRecord*)(ring + at);
+    uint64_t n = record->result;
+    if (n > end - at - sizeof(sideEffectRecord)) {
+      break;
+    }
+    const char* data = (const char*)(record + 1);
+    if (record->syscallNumber == SYS_write && outputs) {
+      outputs->wrote(s, record->fd, data, n);
+    }
+    sideEffectsDrained++;
+    at += (sizeof(sideEffectRecord) + n + 7) & ~(uint64_t)7;
+  }
+  page->sideEffectBytes = 0;
+}
 
-  // Wait for next event to intercept.
-  traceesPid = doWithCheck(waitpid(pidToContinue, &status, 0), "waitpid");
-  log.writeToLog(
-      Importance::extra, "getNextEvent(): Got event from waitpid().\n");
+pid_t execution::waitForStop(pid_t pid, int* status) {
+  // With --parallel, we may have collected this stop already.
+  auto collected = collectedStops.find(pid);
+  if (collected != collectedStops.end()) {
+    *status = collected->second;
+    collectedStops.erase(collected);
+    return pid;
+  }
 
-  return make_tuple(getPtraceEvent(status), traceesPid, status);
+  while (notifyFd >= 0) {
+    pid_t ret = doWithCheck(waitpid(pid, status, WNOHANG), "waitpid");
+    if (ret != 0) {
+      ptraceStops++;
+      return ret;
+    }
+
+    struct pollfd fds[2] = {
+        {notifyFd, POLLIN, 0},
+        {sigchldPipe[0], POLLIN, 0},
+    };
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      runtimeError(
+          "Unable to poll seccomp notify fd: " + string{strerror(errno)});
+    }
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      handleSeccompNotify();
+    } else if ((fds[0].revents & (POLLHUP | POLLERR)) != 0) {
+      // Every process using the filter is gone.
+      close(notifyFd);
+      notifyFd = -1;
+    }
+
+    if ((fds[1].revents & POLLIN) != 0) {
+      char buf[64];
+      while (read(sigchldPipe[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+  }
+
+  if (spinWaitMicros != 0) {
+    // The tracee usually stops again in a few microseconds: catch it from a
+    // core of our own rather than sleep and be woken up.
+    auto deadline = chrono::steady_clock::now() +
+        chrono::microseconds(spinWaitMicros);
+    do {
+      pid_t ret = doWithCheck(waitpid(pid, status, WNOHANG), "waitpid");
+      if (ret != 0) {
+        ptraceStops++;
+        spunStops++;
+        return ret;
+      }
+    } while (chrono::steady_clock::now() < deadline);
+  }
+
+  if (parallel || pid == -1) {
+    // Other tracees run too, collectStop takes their stops in turn.
+    pid_t ret = doWithCheck(waitpid(pid, status, 0), "waitpid");
+    ptraceStops++;
+    return ret;
+  }
+
+  // Only pid runs, anything else stopping was killed, most likely by an
+  // exit_group. Queue their stops as they come rather than leave them for
+  // whoever waits for them next. pid not being ours fails right away.
+  for (;;) {
+    pid_t ret =
+        doWithCheck(waitpid(pid, status, WNOHANG | __WALL), "waitpid");
+    if (ret == 0) {
+      ret = doWithCheck(waitpid(-1, status, __WALL), "waitpid");
+    }
+    ptraceStops++;
+    if (ret == pid) {
+      return ret;
+    }
+    DETTRACE_LOG(log, Importance::extra, "Queued stop of [%d]\n", ret);
+    queuedStops++;
+    collectedStops[ret] = *status;
+  }
+}
+// =======================================================================================
+void execution::pinTracee(pid_t pid) {
+  if (pinTraceeCpu == -1 || pid == pinnedTracee) {
+    return;
+  }
+  // Children inherit the mask, only new tracees really move. One that's gone
+  // already fails with ESRCH, its exit is handled as usual.
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(pinTraceeCpu, &cpus);
+  sched_setaffinity(pid, sizeof(cpus), &cpus);
+  pinnedTracee = pid;
+}
+// =======================================================================================
+void execution::acquireNotifyFd(pid_t traceesPid) {
+  notifyFdAcquired = true;
+
+  // The filter's listener shows up as an anonymous inode in the tracee.
+  string fdDir = "/proc/" + to_string(traceesPid) + "/fd/";
+  DIR* dir = opendir(fdDir.c_str());
+  if (dir == nullptr) {
+    runtimeError("Unable to open " + fdDir + ": " + string{strerror(errno)});
+  }
+
+  int traceeFd = -1;
+  while (struct dirent* entry = readdir(dir)) {
+    char target[64];
+    string path = fdDir + entry->d_name;
+    ssize_t n = readlink(path.c_str(), target, sizeof(target) - 1);
+    if (n < 0) {
+      continue;
+    }
+    target[n] = '\0';
+    if (string{target} == "anon_inode:seccomp notify") {
+      traceeFd = atoi(entry->d_name);
+      break;
+    }
+  }
+  closedir(dir);
+
+  if (traceeFd < 0) {
+    runtimeError("Unable to find seccomp notify fd in tracee.\n");
+  }
+
+  int pidfd = doWithCheck(syscall(SYS_pidfd_open, traceesPid, 0), "pidfd_open");
+  notifyFd = doWithCheck(
+      syscall(SYS_pidfd_getfd, pidfd, traceeFd, 0), "pidfd_getfd");
+  close(pidfd);
+
+  DETTRACE_LOG(
+      log, Importance::info, "Using seccomp notify fd %d (tracee fd %d)\n",
+      notifyFd, traceeFd);
+}
+// =======================================================================================
+void execution::handleSeccompNotify() {
+#ifdef SCMP_ACT_NOTIFY
+  struct seccomp_notif* req;
+  struct seccomp_notif_resp* resp;
+  if (seccomp_notify_alloc(&req, &resp) != 0) {
+    runtimeError("Unable to allocate seccomp notification.\n");
+  }
+
+  int ret = seccomp_notify_receive(notifyFd, req);
+  if (ret < 0) {
+    seccomp_notify_free(req, resp);
+    // The tracee was interrupted, e.g. by a signal, before we got to it.
+    if (ret == -ENOENT) {
+      return;
+    }
+    runtimeError(
+        "Unable to receive seccomp notification: " + string{strerror(-ret)});
+  }
+  notifyEvents++;
+
+  state* s = processes.find(req->pid);
+  if (s == nullptr) {
+    runtimeError(
+        "seccomp notification from unknown tracee: " + to_string(req->pid));
+  }
+
+  seccompNotification n;
+  n.systemCall = req->data.nr;
+  for (int i = 0; i < 6; i++) {
+    n.args[i] = req->data.args[i];
+  }
+
+  if (0 <= n.systemCall && n.systemCall < SYSTEM_CALL_COUNT) {
+    DETTRACE_LOG(
+        log, Importance::inter, "[Pid %d] Notified %s\n", req->pid,
+        log.makeTextColored(Color::red, systemCallMappings[n.systemCall])
+            .c_str());
+  }
+  log.setPadding();
+  recordTrace(traceEvent::syscallPre, req->pid, n.systemCall, n.args, 0);
+  callNotifyHook(n.systemCall, myGlobalState, *s, tracer, n);
+  log.unsetPadding();
+
+  // Hooks may read tracee memory, which can change once it continues.
+  tracer.clearReadCache();
+
+  resp->id = req->id;
+  if (n.spoofReturn) {
+    resp->flags = 0;
+    resp->val = n.returnValue < 0 ? 0 : n.returnValue;
+    resp->error = n.returnValue < 0 ? n.returnValue : 0;
+  } else {
+    resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+    resp->val = 0;
+    resp->error = 0;
+  }
+
+  ret = seccomp_notify_respond(notifyFd, resp);
+  seccomp_notify_free(req, resp);
+  if (ret < 0 && ret != -ENOENT) {
+    runtimeError(
+        "Unable to respond to seccomp notification: " + string{strerror(-ret)});
+  }
+#endif
+}
+// =======================================================================================
+void execution::callNotifyHook(
+    int syscallNumber,
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    seccompNotification& n) {
+  switch (syscallNumber) {
+  case SYS_chdir:
+    return chdirSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_chmod:
+    return chmodSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_epoll_ctl:
+    return epoll_ctlSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_faccessat:
+    return faccessatSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_link:
+    return linkSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_linkat:
+    return linkatSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_readlink:
+    return readlinkSystemCall::handleNotify(gs, s, t, n);
+
+  case SYS_readlinkat:
+    return readlinkatSystemCall::handleNotify(gs, s, t, n);
+  }
+
+  runtimeError(
+      "No seccomp notify hook for system call number: " +
+      to_string(syscallNumber));
 }
 // =======================================================================================
 
@@ -1793,26 +3729,26 @@ ptraceEvent execution::getPtraceEvent(const int status) {
 
   // Check if tracee has exited.
   if (WIFEXITED(status)) {
-    log.writeToLog(Importance::extra, "nonEventExit\n");
+    DETTRACE_LOG(log, Importance::extra, "nonEventExit\n");
     exit_code = WEXITSTATUS(status);
     return ptraceEvent::nonEventExit;
   }
 
   // Condition for PTRACE_O_TRACEEXEC
   if (ptracer::isPtraceEvent(status, PTRACE_EVENT_EXEC)) {
-    log.writeToLog(Importance::extra, "exec\n");
+    DETTRACE_LOG(log, Importance::extra, "exec\n");
     return ptraceEvent::exec;
   }
 
   // Condition for PTRACE_O_TRACECLONE
   if (ptracer::isPtraceEvent(status, PTRACE_EVENT_CLONE)) {
-    log.writeToLog(Importance::extra, "clone\n");
+    DETTRACE_LOG(log, Importance::extra, "clone\n");
     return ptraceEvent::clone;
   }
 
   // Condition for PTRACE_O_TRACEVFORK
   if (ptracer::isPtraceEvent(status, PTRACE_EVENT_VFORK)) {
-    log.writeToLog(Importance::extra, "vfork\n");
+    DETTRACE_LOG(log, Importance::extra, "vfork\n");
     return ptraceEvent::vfork;
   }
 
@@ -1820,13 +3756,13 @@ ptraceEvent execution::getPtraceEvent(const int status) {
   // with SIGCHLD, ptrace calls that event a fork *sigh*. Also requires
   // PTRACE_O_FORK flag.
   if (ptracer::isPtraceEvent(status, PTRACE_EVENT_FORK)) {
-    log.writeToLog(Importance::extra, "fork\n");
+    DETTRACE_LOG(log, Importance::extra, "fork\n");
     return ptraceEvent::fork;
   }
 
 #ifdef PTRACE_EVENT_STOP
   if (ptracer::isPtraceEvent(status, PTRACE_EVENT_STOP)) {
-    log.writeToLog(Importance::extra, "event stop\n");
+    DETTRACE_LOG(log, Importance::extra, "event stop\n");
     runtimeError("Ptrace event stop.\n");
   }
 #endif
@@ -1854,26 +3790,11 @@ ptraceEvent execution::getPtraceEvent(const int status) {
   return ptraceEvent::nonEventExit;
 }
 // =======================================================================================
-/**
- * Find and erase process from map. Returns parent (if any). Otherwise, -1.
- */
-pid_t eraseChildEntry(multimap<pid_t, pid_t>& map, pid_t process) {
-  pid_t parent = -1;
-  for (auto iter = map.begin(); iter != map.end(); iter++) {
-    if (iter->second == process) {
-      parent = iter->first;
-      map.erase(iter);
-      break;
-    }
-  }
-
-  return parent;
-}
 // =======================================================================================
 
 void trapCPUID(globalState& gs, state& s, ptracer& t) {
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "Injecting arch_prctl call to tracee to intercept CPUID!\n");
   // Save current register state to restore after arch_prctl
   s.regSaver.pushRegisterState(t.getRegs());
@@ -1893,26 +3814,91 @@ void trapCPUID(globalState& gs, state& s, ptracer& t) {
   }
 
   gs.totalReplays++;
+  DETTRACE_PROBE2(replay, t.getPid(), SYS_arch_prctl);
   // Replay system call!
   t.changeSystemCall(SYS_arch_prctl);
   t.writeIp((uint64_t)t.getRip().ptr - 2);
-  gs.log.writeToLog(Importance::info, "arch_prctl(%d, 0)\n", ARCH_SET_CPUID);
+  DETTRACE_LOG(gs.log, Importance::info, "arch_prctl(%d, 0)\n", ARCH_SET_CPUID);
 }
 
-void deleteMultimapEntry(
-    unordered_multimap<pid_t, pid_t>& mymap, pid_t key, pid_t value) {
-  auto iterpair = mymap.equal_range(key);
-  auto it = iterpair.first;
-  for (; it != iterpair.second; ++it) {
-    if (it->second == value) {
-      mymap.erase(it);
-      return;
+void execution::exitThreads(pid_t threadGroup) {
+  // Oldest first, the order we clean up after them in, whatever order they
+  // exit in.
+  vector<pid_t> threads;
+  pid_t thread;
+  while ((thread = processes.popDetachedThread(threadGroup)) != -1) {
+    threads.push_back(thread);
+  }
+
+  // Let them all go first, so they exit side by side. The statuses of those we
+  // let go, -1 until they exit.
+  unordered_map<pid_t, int> exits;
+  for (pid_t thread : threads) {
+    auto msg = "Manually exiting thread %d after exit_group.\n";
+    DETTRACE_LOG(log, Importance::info, msg, thread);
+
+    takeInitialStop(processes.at(thread));
+    // We may have queued its stop at the exit event already, see
+    // waitForStop, or it may be gone altogether.
+    auto queued = collectedStops.find(thread);
+    bool gone = false;
+    if (queued != collectedStops.end()) {
+      ptraceEvent last = getPtraceEvent(queued->second);
+      gone = last == ptraceEvent::nonEventExit ||
+          last == ptraceEvent::terminatedBySignal;
+      collectedStops.erase(queued);
+    }
+    if (gone) {
+      continue;
+    }
+    int ret = ptrace(PTRACE_CONT, thread, 0, 0);
+    if (ret == -1 && errno == ESRCH) {
+      ptraceEvent event = handleExitedThread(thread);
+      if (event != ptraceEvent::nonEventExit) {
+        runtimeError(
+            "Unexpected ptrace event!" + to_string(int(event)) + "\n");
+      }
+    } else if (ret == -1) {
+      runtimeError("Unexpected error from ptrace(CONT) on thread exit.");
+    } else {
+      // Great, thread is still responding, let it continue to its
+      // nonEventExit.
+      exits[thread] = -1;
     }
   }
 
-  runtimeError(
-      "Unable to delete entry thread group entry for (" + to_string(key) +
-      ", " + to_string(value) + ")\n");
+  // Their exits, as they come. Anyone else's stop is queued, like waitForStop
+  // does.
+  size_t waiting = exits.size();
+  while (waiting != 0) {
+    int status;
+    pid_t stopped = doWithCheck(waitpid(-1, &status, __WALL), "waitpid");
+    ptraceStops++;
+    auto exited = exits.find(stopped);
+    if (exited != exits.end() && exited->second == -1) {
+      exited->second = status;
+      waiting--;
+    } else {
+      DETTRACE_LOG(log, Importance::extra, "Queued stop of [%d]\n", stopped);
+      queuedStops++;
+      collectedStops[stopped] = status;
+    }
+  }
+
+  // We have allowed them to exit through the OS. Now, clean up our state for
+  // each, in order.
+  for (pid_t thread : threads) {
+    auto exited = exits.find(thread);
+    if (exited != exits.end()) {
+      pullFromTracee(thread);
+      ptraceEvent event = getPtraceEvent(exited->second);
+      if (event != ptraceEvent::nonEventExit) {
+        runtimeError(
+            "Unexpected ptrace event!" + to_string(int(event)) + "\n");
+      }
+    }
+    handleNonEventExit(thread);
+  }
 }
 
 ptraceEvent execution::handleExitedThread(pid_t currentPid) {
@@ -1925,8 +3911,8 @@ ptraceEvent execution::handleExitedThread(pid_t currentPid) {
   // After that, it seems to respond just fine to a new PTRACE_CONT, which will
   // take us into the ptraceNonEventExit. I don't actually know that this will
   // always work, but emperically this seems to be what's happening.
-  log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      log, Importance::info,
       "No reponse from process, attempting to get exit event from waitpid.\n");
   bool succ;
   ptraceEvent event;
@@ -1934,8 +3920,8 @@ ptraceEvent execution::handleExitedThread(pid_t currentPid) {
 
   if (!succ) {
     // assume we exited correctly.
-    log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        log, Importance::info,
         "Did not hear back from process after first loopOnWaitpid() "
         "assume it is done.\n");
     return ptraceEvent::nonEventExit;
@@ -1956,16 +3942,16 @@ ptraceEvent execution::handleExitedThread(pid_t currentPid) {
       "ptraceNonEventExit.\n");
   tie(succ, event) = loopOnWaitpid(currentPid);
   if (!succ) {
-    log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        log, Importance::info,
         "Did not hear back from process after second loopOnWaitpid() "
         "assume it is done.\n");
     // assume we exited correctly.
     return ptraceEvent::nonEventExit;
   }
 
-  log.writeToLog(
-      Importance::info, "Successfully received all events from thread.\n");
+  DETTRACE_LOG(
+      log, Importance::info, "Successfully received all events from thread.\n");
   return event;
 }
 
@@ -1974,20 +3960,26 @@ pair<bool, ptraceEvent> execution::loopOnWaitpid(pid_t currentPid) {
   // to see if an exit status was delivered to us.
   int status;
 
+  auto queued = collectedStops.find(currentPid);
+  if (queued != collectedStops.end()) {
+    status = queued->second;
+    collectedStops.erase(queued);
+    return make_pair(true, getPtraceEvent(status));
+  }
   // Attempt blocking wait. Will error if thread no longer responds.
   if (waitpid(currentPid, &status, 0) != -1) {
     return make_pair(true, getPtraceEvent(status));
   } else {
-    log.writeToLog(
-        Importance::info, "Failed to hear from tracee through waitpid\n.");
+    DETTRACE_LOG(
+        log, Importance::info, "Failed to hear from tracee through waitpid\n.");
     // dummy ptrace event, you should ignore this field on false.
     return make_pair(false, ptraceEvent::eventExit);
   }
 
   // It seems we don't actually need to poll like this: but we leave in case it
   // is needed in the future.
-  log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      log, Importance::info,
       "Initial blocking waitpid failed, switching to polling?\n.");
 
   // Wait for event for N times.
@@ -0,0 +1,48 @@
+#include "fakeOwnership.hpp"
+
+/** Permission bits of a mode, what chmod sets. */
+static const mode_t permissionBits = 07777;
+// =======================================================================================
+void fakeOwnership::chown(const struct stat& real, uid_t uid, gid_t gid) {
+  fakeFile& file = entryFor(real);
+  if (uid != (uid_t)-1) {
+    file.uid = uid;
+  }
+  if (gid != (gid_t)-1) {
+    file.gid = gid;
+  }
+  // A group setgid bit without group execute is mandatory locking, it stays.
+  if (!S_ISDIR(real.st_mode) && (uid != (uid_t)-1 || gid != (gid_t)-1)) {
+    file.mode &= ~S_ISUID;
+    if (file.mode & S_IXGRP) {
+      file.mode &= ~S_ISGID;
+    }
+  }
+}
+// =======================================================================================
+void fakeOwnership::chmod(const struct stat& real, mode_t mode) {
+  entryFor(real).mode = mode & permissionBits;
+}
+// =======================================================================================
+void fakeOwnership::forget(dev_t device, ino_t inode) {
+  files.erase(fileKey{device, inode});
+}
+// =======================================================================================
+void fakeOwnership::apply(
+    dev_t device, ino_t inode, uid_t& uid, gid_t& gid, mode_t& mode) const {
+  auto it = files.find(fileKey{device, inode});
+  if (it == files.end()) {
+    return;
+  }
+  uid = it->second.uid;
+  gid = it->second.gid;
+  mode = (mode & ~permissionBits) | it->second.mode;
+}
+// =======================================================================================
+fakeOwnership::fakeFile& fakeOwnership::entryFor(const struct stat& real) {
+  auto inserted = files.emplace(
+      fileKey{real.st_dev, real.st_ino},
+      fakeFile{real.st_uid, real.st_gid, real.st_mode & permissionBits});
+  return inserted.first->second;
+}
+// =======================================================================================
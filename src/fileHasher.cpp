@@ -0,0 +1,132 @@
+#include "fileHasher.hpp"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// =======================================================================================
+contentHasher::contentHasher() : crc(crc32(0L, Z_NULL, 0)) {}
+// =======================================================================================
+void contentHasher::add(const char* data, size_t n) {
+  crc = crc32(crc, (const Bytef*)data, n);
+  size += n;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    fnv = (fnv ^ word) * 0x100000001b3ULL;
+  }
+  for (; i < n; i++) {
+    fnv = (fnv ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+  }
+}
+// =======================================================================================
+string contentHasher::hex() const {
+  char buf[64];
+  snprintf(
+      buf, sizeof(buf), "%016" PRIx64 "%08lx%" PRIx64, fnv, crc, size);
+  return buf;
+}
+// =======================================================================================
+fileHasher::~fileHasher() {
+  // They hash into us.
+  for (auto& p : pending) {
+    p.second.get();
+  }
+}
+// =======================================================================================
+bool fileHasher::identify(const string& path, fileIdentity& id) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  id.device = st.st_dev;
+  id.inode = st.st_ino;
+  id.size = st.st_size;
+  id.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  id.ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+  return true;
+}
+// =======================================================================================
+string fileHasher::hashFile(const string& path, string* contents) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return "";
+  }
+  contentHasher hasher;
+  char buf[64 * 1024];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    hasher.add(buf, n);
+    if (contents != nullptr) {
+      contents->append(buf, n);
+    }
+  }
+  close(fd);
+  return n == 0 ? hasher.hex() : "";
+}
+// =======================================================================================
+string fileHasher::hash(const string& path, fileIdentity* id) {
+  fileIdentity current;
+  if (!identify(path, current)) {
+    return "";
+  }
+  if (id != nullptr) {
+    *id = current;
+  }
+  return hashOf(path, current);
+}
+// =======================================================================================
+void fileHasher::prefetch(const string& path, const fileIdentity& id) {
+  if (pending.count(id) != 0) {
+    return;
+  }
+  {
+    lock_guard<mutex> guard(lock);
+    if (memo.count(id) != 0) {
+      return;
+    }
+  }
+  pending[id] = tasks.run([this, path, id] { hashAndMemoize(path, id); });
+}
+// =======================================================================================
+string fileHasher::hashOf(const string& path, const fileIdentity& id) {
+  auto prefetched = pending.find(id);
+  if (prefetched != pending.end()) {
+    prefetched->second.get();
+    pending.erase(prefetched);
+  }
+  {
+    lock_guard<mutex> guard(lock);
+    auto known = memo.find(id);
+    if (known != memo.end()) {
+      memoHits++;
+      return known->second;
+    }
+  }
+  hashAndMemoize(path, id);
+  lock_guard<mutex> guard(lock);
+  auto known = memo.find(id);
+  return known == memo.end() ? "" : known->second;
+}
+// =======================================================================================
+void fileHasher::hashAndMemoize(const string& path, const fileIdentity& id) {
+  fileIdentity before;
+  if (!identify(path, before) || !(before == id)) {
+    return;
+  }
+  string hash = hashFile(path, nullptr);
+  // Written to while we read it, this hash is of neither version.
+  fileIdentity after;
+  if (hash.empty() || !identify(path, after) || !(after == id)) {
+    return;
+  }
+  lock_guard<mutex> guard(lock);
+  memo[id] = hash;
+  filesHashed++;
+}
+// =======================================================================================
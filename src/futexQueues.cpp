@@ -0,0 +1,100 @@
+#include "futexQueues.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <string>
+
+// =======================================================================================
+void futexQueues::wait(
+    pid_t addressSpace, uint64_t uaddr, pid_t waiter, uint32_t bitset) {
+  futexKey key{addressSpace, uaddr};
+  if (!waitingOn.emplace(waiter, key).second) {
+    runtimeError(
+        "futexQueues: tracee " + to_string(waiter) + " is already waiting.\n");
+  }
+  queues[key].push_back(futexQueues::waiter{waiter, bitset});
+}
+// =======================================================================================
+vector<pid_t> futexQueues::wake(
+    pid_t addressSpace, uint64_t uaddr, int count, uint32_t bitset) {
+  vector<pid_t> woken;
+  auto queue = queues.find(futexKey{addressSpace, uaddr});
+  if (queue == queues.end()) {
+    return woken;
+  }
+
+  auto& waiters = queue->second;
+  for (auto it = waiters.begin();
+       it != waiters.end() && (int)woken.size() < count;) {
+    if ((it->bitset & bitset) == 0) {
+      ++it;
+      continue;
+    }
+    woken.push_back(it->pid);
+    waitingOn.erase(it->pid);
+    it = waiters.erase(it);
+  }
+  if (waiters.empty()) {
+    queues.erase(queue);
+  }
+  return woken;
+}
+// =======================================================================================
+int futexQueues::requeue(
+    pid_t addressSpace, uint64_t from, uint64_t to, int count) {
+  if (from == to) {
+    return 0;
+  }
+  auto queue = queues.find(futexKey{addressSpace, from});
+  if (queue == queues.end()) {
+    return 0;
+  }
+
+  futexKey toKey{addressSpace, to};
+  auto& waiters = queue->second;
+  int moved = 0;
+  while (!waiters.empty() && moved < count) {
+    waitingOn[waiters.front().pid] = toKey;
+    queues[toKey].push_back(waiters.front());
+    waiters.pop_front();
+    moved++;
+  }
+  if (waiters.empty()) {
+    queues.erase(queue);
+  }
+  return moved;
+}
+// =======================================================================================
+vector<pid_t> futexQueues::wakeAll(pid_t addressSpace) {
+  vector<pid_t> woken;
+  auto queue = queues.lower_bound(futexKey{addressSpace, 0});
+  while (queue != queues.end() && queue->first.first == addressSpace) {
+    for (auto& w : queue->second) {
+      woken.push_back(w.pid);
+      waitingOn.erase(w.pid);
+    }
+    queue = queues.erase(queue);
+  }
+  sort(woken.begin(), woken.end());
+  return woken;
+}
+// =======================================================================================
+void futexQueues::remove(pid_t waiter) {
+  auto it = waitingOn.find(waiter);
+  if (it == waitingOn.end()) {
+    return;
+  }
+  auto queue = queues.find(it->second);
+  auto& waiters = queue->second;
+  for (auto w = waiters.begin(); w != waiters.end(); ++w) {
+    if (w->pid == waiter) {
+      waiters.erase(w);
+      break;
+    }
+  }
+  if (waiters.empty()) {
+    queues.erase(queue);
+  }
+  waitingOn.erase(it);
+}
+// =======================================================================================
@@ -1,7 +1,14 @@
 #include "globalState.hpp"
 
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "processTable.hpp"
+#include "state.hpp"
+
 globalState::globalState(
     logger& log,
+    processTable& processes,
     ValueMapper<ino_t, ino_t> inodeMap,
     ModTimeMap mtimeMap,
     bool kernelPre4_12,
@@ -13,7 +20,123 @@ globalState::globalState(
       mtimeMap{mtimeMap},
       kernelPre4_12{kernelPre4_12},
       prng(prngSeed),
+      prngSeed(prngSeed),
+      // Seeded like the fifo threads in main.cpp.
+      devRandomBytes((unsigned short)(prngSeed + 1234567890)),
+      devUrandomBytes((unsigned short)(prngSeed + 234567890)),
       epoch(epoch),
+      processes(processes),
       allow_network(allow_network) {
   allow_trapCPUID = true;
 }
+// =======================================================================================
+void globalState::setMtime(ino_t inode, logical_clock::time_point mtime) {
+  mtimeMap[inode] = mtime;
+  if (tables != nullptr) {
+    tables->publishMtime(
+        inode,
+        chrono::duration_cast<chrono::microseconds>(mtime.time_since_epoch())
+            .count());
+  }
+}
+// =======================================================================================
+void globalState::forgetInode(ino_t inode) {
+  inodeMap.forget(inode);
+  mtimeMap.erase(inode);
+  if (tables != nullptr) {
+    tables->forgetInode(inode);
+  }
+  inodesReclaimed++;
+}
+// =======================================================================================
+void globalState::unlinking(ino_t inode, const string& hostPath) {
+  if (--unlinksUntilReclaim == 0) {
+    unlinksUntilReclaim = unlinkedFilesBatch;
+    reclaimUnlinkedInodes();
+  }
+  const ino_t* virtualInode = inodeMap.mappings().find(inode);
+  unlinkedFiles.push_back(
+      {inode, hostPath, virtualInode == nullptr ? 0 : *virtualInode});
+}
+// =======================================================================================
+/** Inodes tracees still reach: their open fds, cwds and roots. */
+static std::unordered_set<ino_t> inodesInUse(processTable& processes) {
+  std::unordered_set<ino_t> inUse;
+  // Threads share their fd table with the thread group, look at each once.
+  std::unordered_set<const void*> seen;
+  processes.forEach([&](pid_t pid, state& s) {
+    string proc = "/proc/" + to_string(pid);
+    struct stat statbuf;
+    for (const char* dir : {"/cwd", "/root"}) {
+      if (stat((proc + dir).c_str(), &statbuf) == 0) {
+        inUse.insert(statbuf.st_ino);
+      }
+    }
+    if (!seen.insert(&*s.fds).second) {
+      return;
+    }
+    DIR* fds = opendir((proc + "/fd").c_str());
+    if (fds == nullptr) {
+      return;
+    }
+    int dirFd = dirfd(fds);
+    while (struct dirent* entry = readdir(fds)) {
+      if (entry->d_name[0] != '.' &&
+          fstatat(dirFd, entry->d_name, &statbuf, 0) == 0) {
+        inUse.insert(statbuf.st_ino);
+      }
+    }
+    closedir(fds);
+  });
+  return inUse;
+}
+// =======================================================================================
+void globalState::reclaimUnlinkedInodes() {
+  std::unordered_set<ino_t> inUse = inodesInUse(processes);
+  std::vector<unlinkedFile> stillOpen;
+  for (unlinkedFile& file : unlinkedFiles) {
+    struct stat statbuf;
+    if (lstat(file.hostPath.c_str(), &statbuf) == 0 &&
+        statbuf.st_ino == file.inode) {
+      // The unlink failed.
+      continue;
+    }
+    const ino_t* virtualInode = inodeMap.mappings().find(file.inode);
+    if ((virtualInode == nullptr ? 0 : *virtualInode) != file.virtualInode) {
+      // A file created since has the inode now.
+      continue;
+    }
+    if (inUse.count(file.inode) != 0) {
+      stillOpen.push_back(std::move(file));
+      continue;
+    }
+    forgetInode(file.inode);
+  }
+  unlinkedFiles.swap(stillOpen);
+  DETTRACE_LOG(
+      log, Importance::info, "Reclaimed unlinked inodes, %zu still open\n",
+      unlinkedFiles.size());
+}
+// =======================================================================================
+void globalState::publishRandomPositions() {
+  if (tables != nullptr) {
+    tables->publishRandomPositions(
+        getRandomBytes, devRandomBytes.position(),
+        devUrandomBytes.position());
+  }
+}
+// =======================================================================================
+const vectorClock& globalState::causalSend(state& s) {
+  vectorClock& clock = s.causality.write();
+  clock.tick(processes.threadGroupOf(s.traceePid));
+  return clock;
+}
+// =======================================================================================
+bool globalState::causalReceive(state& s, const vectorClock& sent) {
+  if (sent.before(*s.causality)) {
+    return false;
+  }
+  s.causality.write().merge(sent);
+  causalReceives++;
+  return true;
+}
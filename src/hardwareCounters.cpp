@@ -0,0 +1,170 @@
+#include "hardwareCounters.hpp"
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** The events of a group, in the order of counts. The first leads. */
+static const struct {
+  uint32_t type;
+  uint64_t config;
+  bool userOnly;
+} groupEvents[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, true},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, true},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, false},
+};
+static const size_t groupSize = sizeof(groupEvents) / sizeof(groupEvents[0]);
+
+/** Percent of part in whole, for split(). */
+static double percent(uint64_t part, uint64_t whole) {
+  return whole == 0 ? 0 : 100.0 * part / whole;
+}
+// =======================================================================================
+hardwareCounters::hardwareCounters(bool enabled, logger& log)
+    : log(log), supported(enabled) {
+  if (supported) {
+    tracerGroup = openGroup(0);
+  }
+}
+// =======================================================================================
+hardwareCounters::~hardwareCounters() {
+  closeGroup(tracerGroup);
+  for (auto& g : groups) {
+    closeGroup(g.second);
+  }
+}
+// =======================================================================================
+void hardwareCounters::attach(pid_t tid) {
+  if (!enabled()) {
+    return;
+  }
+  vector<int> fds = openGroup(tid);
+  if (!fds.empty()) {
+    groups[tid] = move(fds);
+  }
+}
+// =======================================================================================
+void hardwareCounters::detach(pid_t tid) {
+  auto it = groups.find(tid);
+  if (it == groups.end()) {
+    return;
+  }
+  // After the exit stop, the counts are final.
+  counts c;
+  if (readGroup(it->second, c)) {
+    exited.add(c);
+  }
+  closeGroup(it->second);
+  groups.erase(it);
+}
+// =======================================================================================
+hardwareCounters::counts hardwareCounters::tracer() const {
+  counts c;
+  readGroup(tracerGroup, c);
+  return c;
+}
+// =======================================================================================
+hardwareCounters::counts hardwareCounters::tracees() const {
+  counts all = exited;
+  for (auto& g : groups) {
+    counts c;
+    if (readGroup(g.second, c)) {
+      all.add(c);
+    }
+  }
+  return all;
+}
+// =======================================================================================
+vector<pair<string, uint64_t>> hardwareCounters::totals() const {
+  counts t = tracees();
+  counts us = tracer();
+  return {
+      {"tracee cycles in user space: ", t.userCycles},
+      {"tracee cycles in the kernel: ", t.kernelCycles()},
+      {"tracee instructions in user space: ", t.userInstructions},
+      {"tracee context switches: ", t.contextSwitches},
+      {"tracer cycles in user space: ", us.userCycles},
+      {"tracer cycles in the kernel: ", us.kernelCycles()},
+      {"tracer instructions in user space: ", us.userInstructions},
+      {"tracer context switches: ", us.contextSwitches},
+  };
+}
+// =======================================================================================
+string hardwareCounters::split() const {
+  counts t = tracees();
+  counts us = tracer();
+  uint64_t all = t.cycles + us.cycles;
+  char line[200];
+  snprintf(
+      line, sizeof(line),
+      "cycles: %.1f%% tracee code, %.1f%% kernel for tracees, %.1f%% kernel "
+      "for the tracer, %.1f%% tracer code",
+      percent(t.userCycles, all), percent(t.kernelCycles(), all),
+      percent(us.kernelCycles(), all), percent(us.userCycles, all));
+  return line;
+}
+// =======================================================================================
+vector<int> hardwareCounters::openGroup(pid_t tid) {
+  vector<int> fds;
+  for (size_t i = 0; i < groupSize; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = groupEvents[i].type;
+    attr.config = groupEvents[i].config;
+    attr.exclude_kernel = groupEvents[i].userOnly;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int leader = fds.empty() ? -1 : fds[0];
+    int fd = syscall(
+        SYS_perf_event_open, &attr, tid, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1) {
+      // Logged once, we count nothing from here on.
+      supported = false;
+      DETTRACE_LOG(
+          log, Importance::inter,
+          log.makeTextColored(
+              Color::red,
+              "Unable to count cycles of [%d]: %s. No hardware counters are "
+              "reported.\n"),
+          tid == 0 ? getpid() : tid, strerror(errno));
+      closeGroup(fds);
+      return {};
+    }
+    fds.push_back(fd);
+  }
+  return fds;
+}
+// =======================================================================================
+bool hardwareCounters::readGroup(const vector<int>& fds, counts& c) {
+  if (fds.empty()) {
+    return false;
+  }
+  // nr, time enabled, time running, then one value per event.
+  uint64_t values[3 + groupSize];
+  ssize_t n = read(fds[0], values, sizeof(values));
+  if (n != (ssize_t)sizeof(values) || values[0] != groupSize) {
+    return false;
+  }
+  double scale = 1;
+  if (values[2] != 0 && values[2] < values[1]) {
+    scale = (double)values[1] / values[2];
+  }
+  uint64_t* v = values + 3;
+  c.cycles = v[0] * scale;
+  c.userCycles = v[1] * scale;
+  c.userInstructions = v[2] * scale;
+  c.contextSwitches = v[3] * scale;
+  return true;
+}
+// =======================================================================================
+void hardwareCounters::closeGroup(const vector<int>& fds) {
+  for (int fd : fds) {
+    close(fd);
+  }
+}
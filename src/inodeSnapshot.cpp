@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "inodeSnapshot.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+/** FNV-1a. */
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+// =======================================================================================
+uint64_t snapshotFingerprint(const vector<string>& paths) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (auto& path : paths) {
+    // Includes the terminating null, so paths can't run into each other.
+    hash = hashBytes(hash, path.c_str(), path.size() + 1);
+    struct stat statbuf = {0};
+    if (stat(path.c_str(), &statbuf) == 0) {
+      hash = hashBytes(hash, &statbuf.st_dev, sizeof(statbuf.st_dev));
+      hash = hashBytes(hash, &statbuf.st_ino, sizeof(statbuf.st_ino));
+    }
+  }
+  return hash;
+}
+// =======================================================================================
+size_t loadInodeSnapshot(
+    const string& path,
+    uint64_t fingerprint,
+    ValueMapper<ino_t, ino_t>& inodeMap,
+    ModTimeMap& mtimeMap,
+    logger& log) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    DETTRACE_LOG(
+        log, Importance::inter, "No inode snapshot at %s, starting cold\n",
+        path.c_str());
+    return 0;
+  }
+  struct stat statbuf;
+  doWithCheck(fstat(fd, &statbuf), "fstat inode snapshot");
+  size_t size = statbuf.st_size;
+  if (size < sizeof(inodeSnapshotHeader)) {
+    close(fd);
+    return 0;
+  }
+
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return 0;
+  }
+
+  auto header = (const inodeSnapshotHeader*)mapping;
+  auto entries = (const inodeSnapshotEntry*)(header + 1);
+  size_t entryBytes = size - sizeof(inodeSnapshotHeader);
+  bool valid =
+      memcmp(header->magic, INODE_SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+      header->version == INODE_SNAPSHOT_VERSION &&
+      header->entrySize == sizeof(inodeSnapshotEntry) &&
+      header->fingerprint == fingerprint &&
+      header->inodeCount <= entryBytes / sizeof(inodeSnapshotEntry) &&
+      header->mtimeCount ==
+          entryBytes / sizeof(inodeSnapshotEntry) - header->inodeCount;
+  if (!valid) {
+    DETTRACE_LOG(
+        log, Importance::inter,
+        "Inode snapshot %s is from another tree or version, starting cold\n",
+        path.c_str());
+    munmap(mapping, size);
+    return 0;
+  }
+
+  for (uint64_t i = 0; i < header->inodeCount; i++) {
+    inodeMap.restoreValue(entries[i].realInode, entries[i].value);
+  }
+  inodeMap.setFreshValue(header->freshInode);
+  auto mtimes = entries + header->inodeCount;
+  for (uint64_t i = 0; i < header->mtimeCount; i++) {
+    mtimeMap[mtimes[i].realInode] =
+        logical_clock::time_point(chrono::microseconds(mtimes[i].value));
+  }
+
+  size_t loaded = header->inodeCount;
+  munmap(mapping, size);
+  DETTRACE_LOG(
+      log, Importance::inter, "Loaded %zu inodes from snapshot %s\n", loaded,
+      path.c_str());
+  return loaded;
+}
+// =======================================================================================
+void saveInodeSnapshot(
+    const string& path,
+    uint64_t fingerprint,
+    const ValueMapper<ino_t, ino_t>& inodeMap,
+    const ModTimeMap& mtimeMap) {
+  inodeSnapshotHeader header = {};
+  memcpy(header.magic, INODE_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = INODE_SNAPSHOT_VERSION;
+  header.entrySize = sizeof(inodeSnapshotEntry);
+  header.fingerprint = fingerprint;
+  header.freshInode = inodeMap.nextFreshValue();
+  header.inodeCount = inodeMap.mappings().size();
+  header.mtimeCount = mtimeMap.size();
+  size_t size = sizeof(header) + (header.inodeCount + header.mtimeCount) *
+                                     sizeof(inodeSnapshotEntry);
+
+  string tmpPath = path + ".tmp";
+  int fd = doWithCheck(
+      open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666),
+      "Unable to open inode snapshot " + tmpPath);
+  doWithCheck(ftruncate(fd, size), "ftruncate inode snapshot");
+  void* mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    runtimeError("Unable to map inode snapshot " + tmpPath);
+  }
+
+  memcpy(mapping, &header, sizeof(header));
+  auto entry = (inodeSnapshotEntry*)((inodeSnapshotHeader*)mapping + 1);
+  inodeMap.mappings().forEach([&entry](ino_t real, ino_t virt) {
+    *entry++ = inodeSnapshotEntry{real, (int64_t)virt};
+  });
+  for (auto& mtime : mtimeMap) {
+    auto sinceEpoch = chrono::duration_cast<chrono::microseconds>(
+        mtime.second.time_since_epoch());
+    *entry++ = inodeSnapshotEntry{mtime.first, sinceEpoch.count()};
+  }
+
+  doWithCheck(munmap(mapping, size), "munmap inode snapshot");
+  close(fd);
+  doWithCheck(
+      rename(tmpPath.c_str(), path.c_str()),
+      "Unable to replace inode snapshot " + path);
+}
+// =======================================================================================
@@ -0,0 +1,212 @@
+#include "inputLog.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "systemCallList.hpp"
+#include "util.hpp"
+
+// =======================================================================================
+inputLog::inputLog(const string& path, bool replay)
+    : path(path), isReplay(replay) {
+  if (!replay) {
+    fd = doWithCheck(
+        open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666),
+        "Unable to open input log " + path);
+    mapNextWindow();
+    inputLogHeader header = {};
+    memcpy(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic));
+    header.version = INPUT_LOG_VERSION;
+    header.recordSize = sizeof(inputRecord);
+    append((const char*)&header, sizeof(header));
+    return;
+  }
+
+  fd = doWithCheck(
+      open(path.c_str(), O_RDONLY | O_CLOEXEC),
+      "Unable to open input log " + path);
+  struct stat st;
+  doWithCheck(fstat(fd, &st), "fstat input log");
+  fileSize = st.st_size;
+  inputLogHeader header;
+  if (fileSize < sizeof(header)) {
+    runtimeError("Not an input log: " + path);
+  }
+  void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    runtimeError("Unable to mmap input log: " + string(strerror(errno)));
+  }
+  file = (const char*)addr;
+  memcpy(&header, file, sizeof(header));
+  if (memcmp(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != INPUT_LOG_VERSION ||
+      header.recordSize != sizeof(inputRecord)) {
+    runtimeError(
+        path + " is not an input log of this version of dettrace, record it "
+               "again.");
+  }
+  readOffset = sizeof(header);
+}
+// =======================================================================================
+inputLog::~inputLog() {
+  if (isReplay) {
+    munmap((void*)file, fileSize);
+    close(fd);
+    return;
+  }
+
+  writeChunk();
+  off_t length = windowStart + windowUsed;
+  munmap(window, windowSize);
+  // Drop the zero filled tail of the last window.
+  if (ftruncate(fd, length) == -1) {
+    perror("ftruncate input log");
+  }
+  close(fd);
+}
+// =======================================================================================
+void inputLog::record(
+    const inputRecord& input, const char* const buffers[INPUT_BUFFERS]) {
+  const char* bytes = (const char*)&input;
+  pending.insert(pending.end(), bytes, bytes + sizeof(input));
+  for (int i = 0; i < INPUT_BUFFERS; i++) {
+    pending.insert(
+        pending.end(), buffers[i], buffers[i] + input.bufferBytes[i]);
+  }
+  inputs++;
+  if (pending.size() >= chunkSize) {
+    writeChunk();
+  }
+}
+// =======================================================================================
+const inputRecord& inputLog::next(
+    int systemCall, int fd, const char* buffers[INPUT_BUFFERS]) {
+  if (chunkOffset == chunk.size() && !readChunk()) {
+    runtimeError(
+        "--replay-inputs: the run wants more inputs than " + path +
+        " holds, next " + systemCallMappings[systemCall] + " on fd " +
+        to_string(fd) + ".");
+  }
+
+  const char* at = chunk.data() + chunkOffset;
+  if (chunk.size() - chunkOffset < sizeof(inputRecord)) {
+    runtimeError("--replay-inputs: truncated record in " + path);
+  }
+  // Buffers leave records unaligned.
+  inputRecord& input = current;
+  memcpy(&input, at, sizeof(input));
+  at += sizeof(inputRecord);
+  size_t size = sizeof(inputRecord);
+  for (int i = 0; i < INPUT_BUFFERS; i++) {
+    buffers[i] = at;
+    at += input.bufferBytes[i];
+    size += input.bufferBytes[i];
+  }
+  if (chunk.size() - chunkOffset < size) {
+    runtimeError("--replay-inputs: truncated record in " + path);
+  }
+
+  if (input.systemCall != systemCall || input.fd != fd) {
+    string recorded = input.systemCall >= 0 &&
+            input.systemCall < SYSTEM_CALL_COUNT
+        ? systemCallMappings[input.systemCall]
+        : to_string(input.systemCall);
+    runtimeError(
+        "--replay-inputs: the run diverged from the recording at input " +
+        to_string(inputs) + ": recorded " + recorded + " on fd " +
+        to_string(input.fd) + ", now " + systemCallMappings[systemCall] +
+        " on fd " + to_string(fd) + ".");
+  }
+  chunkOffset += size;
+  inputs++;
+  return input;
+}
+// =======================================================================================
+void inputLog::writeChunk() {
+  if (pending.empty()) {
+    return;
+  }
+  uLongf size = compressBound(pending.size());
+  compressed.resize(size);
+  // Level 1: the tracer is waiting, the log is mostly downloads that compress
+  // little more at higher levels.
+  int status = compress2(
+      (Bytef*)compressed.data(), &size, (const Bytef*)pending.data(),
+      pending.size(), 1);
+  if (status != Z_OK) {
+    runtimeError("Unable to compress input log chunk: " + to_string(status));
+  }
+
+  inputChunkHeader header{(uint32_t)pending.size(), (uint32_t)size};
+  append((const char*)&header, sizeof(header));
+  append(compressed.data(), size);
+  rawBytes += pending.size();
+  compressedBytes += size;
+  pending.clear();
+}
+// =======================================================================================
+void inputLog::append(const char* bytes, size_t size) {
+  while (size > 0) {
+    if (windowUsed == windowSize) {
+      mapNextWindow();
+    }
+    size_t n = min(size, windowSize - windowUsed);
+    memcpy(window + windowUsed, bytes, n);
+    windowUsed += n;
+    bytes += n;
+    size -= n;
+  }
+}
+// =======================================================================================
+void inputLog::mapNextWindow() {
+  if (window != nullptr) {
+    doWithCheck(munmap(window, windowSize), "munmap input log window");
+    windowStart += windowSize;
+  }
+
+  doWithCheck(
+      ftruncate(fd, windowStart + windowSize), "Unable to grow input log");
+  void* addr = mmap(
+      nullptr, windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, windowStart);
+  if (addr == MAP_FAILED) {
+    runtimeError("Unable to mmap input log: " + string(strerror(errno)));
+  }
+  window = (char*)addr;
+  windowUsed = 0;
+}
+// =======================================================================================
+bool inputLog::readChunk() {
+  inputChunkHeader header;
+  if (fileSize - readOffset < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, file + readOffset, sizeof(header));
+  // The zero filled tail of a window we crashed before truncating.
+  if (header.rawBytes == 0) {
+    return false;
+  }
+  readOffset += sizeof(header);
+  if (fileSize - readOffset < header.compressedBytes) {
+    runtimeError("--replay-inputs: truncated chunk in " + path);
+  }
+
+  chunk.resize(header.rawBytes);
+  uLongf size = header.rawBytes;
+  int status = uncompress(
+      (Bytef*)chunk.data(), &size, (const Bytef*)file + readOffset,
+      header.compressedBytes);
+  if (status != Z_OK || size != header.rawBytes) {
+    runtimeError("--replay-inputs: corrupt chunk in " + path);
+  }
+  readOffset += header.compressedBytes;
+  rawBytes += header.rawBytes;
+  compressedBytes += header.compressedBytes;
+  chunkOffset = 0;
+  return true;
+}
+// =======================================================================================
@@ -0,0 +1,292 @@
+#include "ioUring.hpp"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifndef SYS_io_uring_setup
+#define SYS_io_uring_setup 425
+#endif
+#ifndef SYS_io_uring_register
+#define SYS_io_uring_register 427
+#endif
+#ifndef IORING_SETUP_NO_SQARRAY
+#define IORING_SETUP_NO_SQARRAY (1U << 16)
+#endif
+
+/** Operations SQEs may be, on a regular file but for NOP. */
+static const uint8_t allowedOps[] = {
+    IORING_OP_NOP,
+    IORING_OP_READV,
+    IORING_OP_WRITEV,
+    IORING_OP_FSYNC,
+    IORING_OP_READ_FIXED,
+    IORING_OP_WRITE_FIXED,
+    IORING_OP_SYNC_FILE_RANGE,
+    IORING_OP_FALLOCATE,
+    IORING_OP_FADVISE,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+};
+
+/** What a refused SQE is turned into, an operation the kernel refuses. */
+static const uint8_t refusedOp = IORING_OP_OPENAT;
+
+static const uint8_t allowedSqeFlags =
+    IOSQE_IO_DRAIN | IOSQE_IO_LINK | IOSQE_IO_HARDLINK | IOSQE_ASYNC;
+
+static const uint8_t allowedRegistrations[] = {
+    IORING_REGISTER_BUFFERS,
+    IORING_UNREGISTER_BUFFERS,
+    IORING_REGISTER_PROBE,
+    IORING_REGISTER_BUFFERS2,
+    IORING_REGISTER_BUFFERS_UPDATE,
+};
+
+const uint32_t ioUring::setupFlags = IORING_SETUP_CQSIZE |
+    IORING_SETUP_CLAMP | IORING_SETUP_ATTACH_WQ | IORING_SETUP_SUBMIT_ALL |
+    IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG |
+    IORING_SETUP_SQE128 | IORING_SETUP_CQE32 | IORING_SETUP_SINGLE_ISSUER |
+    IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_NO_SQARRAY;
+
+/** Register our restrictions with ring fd, disabled, and enable it. */
+static bool restrictAndEnable(int fd) {
+  vector<io_uring_restriction> restrictions;
+  for (uint8_t op : allowedOps) {
+    io_uring_restriction r = {};
+    r.opcode = IORING_RESTRICTION_SQE_OP;
+    r.sqe_op = op;
+    restrictions.push_back(r);
+  }
+  for (uint8_t op : allowedRegistrations) {
+    io_uring_restriction r = {};
+    r.opcode = IORING_RESTRICTION_REGISTER_OP;
+    r.register_op = op;
+    restrictions.push_back(r);
+  }
+  io_uring_restriction r = {};
+  r.opcode = IORING_RESTRICTION_SQE_FLAGS_ALLOWED;
+  r.sqe_flags = allowedSqeFlags;
+  restrictions.push_back(r);
+  // An SQE we didn't see fails rather than runs out of order.
+  r.opcode = IORING_RESTRICTION_SQE_FLAGS_REQUIRED;
+  r.sqe_flags = IOSQE_IO_DRAIN;
+  restrictions.push_back(r);
+
+  return syscall(
+             SYS_io_uring_register, fd, IORING_REGISTER_RESTRICTIONS,
+             restrictions.data(), restrictions.size()) == 0 &&
+      syscall(
+          SYS_io_uring_register, fd, IORING_REGISTER_ENABLE_RINGS, nullptr,
+          0) == 0;
+}
+// =======================================================================================
+bool ioUring::supported() {
+  static const bool result = [] {
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_R_DISABLED;
+    int fd = syscall(SYS_io_uring_setup, 1, &params);
+    if (fd == -1) {
+      return false;
+    }
+    bool ok = restrictAndEnable(fd);
+    close(fd);
+    return ok;
+  }();
+  return result;
+}
+// =======================================================================================
+uint32_t ioUring::setupFlagsFor(uint32_t flags) {
+  uint32_t ours = flags | IORING_SETUP_R_DISABLED;
+  ours &= ~(IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+  // TASKRUN_FLAG needs one of the two.
+  if ((flags & IORING_SETUP_DEFER_TASKRUN) != 0) {
+    ours |= IORING_SETUP_COOP_TASKRUN;
+  }
+  return ours;
+}
+// =======================================================================================
+shared_ptr<ioUring> ioUring::attach(
+    int ourFd, const io_uring_params& params) {
+  shared_ptr<ioUring> ring{new ioUring()};
+  ring->fd = ourFd;
+
+  if ((params.flags & IORING_SETUP_SQE128) != 0) {
+    ring->sqeSize = 2 * sizeof(io_uring_sqe);
+  }
+  if ((params.flags & IORING_SETUP_CQE32) != 0) {
+    ring->cqeSize = 2 * sizeof(io_uring_cqe);
+  }
+  ring->sqRingSize =
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cqRingSize =
+      params.cq_off.cqes + params.cq_entries * ring->cqeSize;
+  bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMmap) {
+    ring->sqRingSize = ring->cqRingSize =
+        max(ring->sqRingSize, ring->cqRingSize);
+  }
+  ring->sqesSize = params.sq_entries * ring->sqeSize;
+
+  auto map = [&](size_t size, uint64_t offset) -> void* {
+    void* at = mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ourFd, offset);
+    return at == MAP_FAILED ? nullptr : at;
+  };
+  ring->sqRing = map(ring->sqRingSize, IORING_OFF_SQ_RING);
+  ring->cqRing =
+      singleMmap ? ring->sqRing : map(ring->cqRingSize, IORING_OFF_CQ_RING);
+  ring->sqes = map(ring->sqesSize, IORING_OFF_SQES);
+  if (ring->sqRing == nullptr || ring->cqRing == nullptr ||
+      ring->sqes == nullptr) {
+    return nullptr;
+  }
+
+  char* sq = (char*)ring->sqRing;
+  char* cq = (char*)ring->cqRing;
+  ring->sqHead = (uint32_t*)(sq + params.sq_off.head);
+  ring->sqTail = (uint32_t*)(sq + params.sq_off.tail);
+  ring->sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+  ring->sqEntries = *(uint32_t*)(sq + params.sq_off.ring_entries);
+  ring->sqDropped = (uint32_t*)(sq + params.sq_off.dropped);
+  if ((params.flags & IORING_SETUP_NO_SQARRAY) == 0) {
+    ring->sqArray = (uint32_t*)(sq + params.sq_off.array);
+  }
+  ring->cqHead = (uint32_t*)(cq + params.cq_off.head);
+  ring->cqTail = (uint32_t*)(cq + params.cq_off.tail);
+  ring->cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+  ring->cqEntries = *(uint32_t*)(cq + params.cq_off.ring_entries);
+  ring->cqes = cq + params.cq_off.cqes;
+
+  if (!restrictAndEnable(ourFd)) {
+    return nullptr;
+  }
+  return ring;
+}
+// =======================================================================================
+ioUring::~ioUring() {
+  if (sqes != nullptr) {
+    munmap(sqes, sqesSize);
+  }
+  if (cqRing != nullptr && cqRing != sqRing) {
+    munmap(cqRing, cqRingSize);
+  }
+  if (sqRing != nullptr) {
+    munmap(sqRing, sqRingSize);
+  }
+  close(fd);
+}
+// =======================================================================================
+io_uring_sqe* ioUring::sqeAt(uint32_t position) const {
+  uint32_t index = position & sqMask;
+  if (sqArray != nullptr) {
+    index = sqArray[index];
+  }
+  // The kernel drops it, see sqDropped.
+  if (index >= sqEntries) {
+    return nullptr;
+  }
+  return (io_uring_sqe*)((char*)sqes + index * sqeSize);
+}
+// =======================================================================================
+uint32_t ioUring::prepareSubmission(
+    uint32_t toSubmit, const function<bool(int)>& regularFile) {
+  uint32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(sqTail, __ATOMIC_ACQUIRE);
+  uint32_t count = min(toSubmit, tail - head);
+  uint32_t refused = 0;
+  preparedFrom = head;
+  preparedTo = head + count;
+  for (uint32_t position = head; position != preparedTo; position++) {
+    io_uring_sqe* sqe = sqeAt(position);
+    if (sqe == nullptr) {
+      continue;
+    }
+    userData[nextSequence] = sqe->user_data;
+    sqe->user_data = nextSequence++;
+    sqe->flags |= IOSQE_IO_DRAIN;
+    // Other operations, and fixed files, are refused by the kernel.
+    bool onFd = sqe->opcode != IORING_OP_NOP &&
+        (sqe->flags & IOSQE_FIXED_FILE) == 0 &&
+        find(begin(allowedOps), end(allowedOps), sqe->opcode) !=
+            end(allowedOps);
+    if (onFd && !regularFile(sqe->fd)) {
+      sqe->opcode = refusedOp;
+      refused++;
+    }
+  }
+  submitted += count;
+  return refused;
+}
+// =======================================================================================
+void ioUring::finishSubmission() {
+  uint32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  // Unless the kernel took them all.
+  if (head - preparedFrom > preparedTo - preparedFrom) {
+    head = preparedTo;
+  }
+  for (uint32_t position = head; position != preparedTo; position++) {
+    io_uring_sqe* sqe = sqeAt(position);
+    if (sqe == nullptr) {
+      continue;
+    }
+    auto it = userData.find(sqe->user_data);
+    if (it != userData.end()) {
+      sqe->user_data = it->second;
+      userData.erase(it);
+    }
+  }
+  preparedFrom = preparedTo;
+}
+// =======================================================================================
+bool ioUring::settled() const {
+  uint32_t taken = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) -
+      __atomic_load_n(sqDropped, __ATOMIC_ACQUIRE);
+  uint32_t posted = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+  uint32_t consumed = __atomic_load_n(cqHead, __ATOMIC_ACQUIRE);
+  return posted == taken || posted - consumed >= cqEntries;
+}
+// =======================================================================================
+uint32_t ioUring::unsettled() const {
+  uint32_t taken = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) -
+      __atomic_load_n(sqDropped, __ATOMIC_ACQUIRE);
+  uint32_t consumed = __atomic_load_n(cqHead, __ATOMIC_ACQUIRE);
+  return min(taken - consumed, cqEntries);
+}
+// =======================================================================================
+void ioUring::orderCompletions() {
+  uint32_t posted = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+  uint32_t count = posted - orderedTo;
+  if (count == 0) {
+    return;
+  }
+  vector<char> copies(count * cqeSize);
+  vector<uint32_t> order(count);
+  for (uint32_t i = 0; i < count; i++) {
+    memcpy(
+        &copies[i * cqeSize], cqes + ((orderedTo + i) & cqMask) * cqeSize,
+        cqeSize);
+    order[i] = i;
+  }
+  auto sequence = [&](uint32_t i) {
+    return ((io_uring_cqe*)&copies[i * cqeSize])->user_data;
+  };
+  stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return sequence(a) < sequence(b);
+  });
+  for (uint32_t i = 0; i < count; i++) {
+    auto cqe = (io_uring_cqe*)(cqes + ((orderedTo + i) & cqMask) * cqeSize);
+    memcpy(cqe, &copies[order[i] * cqeSize], cqeSize);
+    auto it = userData.find(cqe->user_data);
+    if (it != userData.end()) {
+      cqe->user_data = it->second;
+      userData.erase(it);
+    }
+  }
+  orderedTo = posted;
+}
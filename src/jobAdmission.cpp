@@ -0,0 +1,117 @@
+#include "jobAdmission.hpp"
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+
+// =======================================================================================
+jobAdmission::jobAdmission(
+    vector<core> cores, uint64_t memoryBytes, uint64_t jobBytes)
+    : cores(move(cores)),
+      taken(this->cores.size(), false),
+      memoryBytes(memoryBytes),
+      jobBytes(jobBytes) {}
+// =======================================================================================
+vector<jobAdmission::core> jobAdmission::hostCores(unsigned count) {
+  cpu_set_t ours;
+  CPU_ZERO(&ours);
+  sched_getaffinity(0, sizeof(ours), &ours);
+
+  // Machines without NUMA, or without /sys, are a single node 0.
+  map<int, int> nodeOf;
+  DIR* nodes = opendir("/sys/devices/system/node");
+  if (nodes != nullptr) {
+    struct dirent* entry;
+    while ((entry = readdir(nodes)) != nullptr) {
+      string name = entry->d_name;
+      if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+          name.find_first_not_of("0123456789", 4) != string::npos) {
+        continue;
+      }
+      ifstream in("/sys/devices/system/node/" + name + "/cpulist");
+      string list;
+      getline(in, list);
+      for (int cpu : parseCpuList(list)) {
+        nodeOf[cpu] = atoi(name.c_str() + 4);
+      }
+    }
+    closedir(nodes);
+  }
+
+  vector<core> cores;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (count != 0 && cores.size() == count) {
+      break;
+    }
+    if (CPU_ISSET(cpu, &ours)) {
+      auto node = nodeOf.find(cpu);
+      cores.push_back(core{cpu, node == nodeOf.end() ? 0 : node->second});
+    }
+  }
+  return cores;
+}
+// =======================================================================================
+vector<int> jobAdmission::parseCpuList(const string& list) {
+  vector<int> cpus;
+  stringstream ranges{list};
+  string range;
+  while (getline(ranges, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    size_t dash = range.find('-');
+    int first = atoi(range.c_str());
+    int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+// =======================================================================================
+int jobAdmission::admit() {
+  // A job bigger than the whole budget still runs, alone.
+  if (memoryBytes != 0 && jobs != 0 &&
+      (uint64_t)(jobs + 1) * jobBytes > memoryBytes) {
+    return -1;
+  }
+  map<int, unsigned> freeOnNode;
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (!taken[i]) {
+      freeOnNode[cores[i].node]++;
+    }
+  }
+  if (freeOnNode.empty()) {
+    return -1;
+  }
+  // The emptiest node, the lowest numbered on a tie.
+  int node = freeOnNode.begin()->first;
+  for (auto& free : freeOnNode) {
+    if (free.second > freeOnNode[node]) {
+      node = free.first;
+    }
+  }
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (!taken[i] && cores[i].node == node) {
+      taken[i] = true;
+      jobs++;
+      return cores[i].cpu;
+    }
+  }
+  return -1;
+}
+// =======================================================================================
+void jobAdmission::release(int cpu) {
+  for (size_t i = 0; i < cores.size(); i++) {
+    if (cores[i].cpu == cpu && taken[i]) {
+      taken[i] = false;
+      jobs--;
+      return;
+    }
+  }
+}
+// =======================================================================================
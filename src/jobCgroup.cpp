@@ -0,0 +1,158 @@
+#include "jobCgroup.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include "util.hpp"
+
+/** cpu.max period, the kernel's default. */
+static const uint64_t cpuPeriodMicros = 100000;
+// =======================================================================================
+jobCgroup::jobCgroup(const string& parent, double cpus, uint64_t memoryBytes) {
+  if (access((parent + "/cgroup.procs").c_str(), W_OK) == -1) {
+    runtimeError(
+        "--cgroup " + parent + " is not a cgroup v2 we may write to: " +
+        strerror(errno));
+  }
+  // Best effort: a controller the parent doesn't have is one we don't report.
+  for (const char* controller : {"+cpu", "+memory", "+io"}) {
+    int fd = open((parent + "/cgroup.subtree_control").c_str(), O_WRONLY);
+    if (fd != -1) {
+      (void)!write(fd, controller, strlen(controller));
+      close(fd);
+    }
+  }
+  // Jobs of dettraces sharing parent each get their own.
+  for (unsigned n = 0;; n++) {
+    dir = parent + "/dettrace-" + to_string(n);
+    if (mkdir(dir.c_str(), 0755) == 0) {
+      break;
+    }
+    if (errno != EEXIST) {
+      runtimeError(
+          "Unable to create cgroup under " + parent + ": " + strerror(errno));
+    }
+  }
+
+  if (cpus != 0) {
+    uint64_t quota = llround(cpus * cpuPeriodMicros);
+    if (!writeFile(
+            "cpu.max",
+            to_string(quota) + " " + to_string(cpuPeriodMicros) + "\n")) {
+      rmdir(dir.c_str());
+      runtimeError(
+          "Unable to limit " + dir + " to " + to_string(cpus) +
+          " CPUs, is the cpu controller on in " + parent + "?");
+    }
+  }
+  if (memoryBytes != 0 &&
+      !writeFile("memory.max", to_string(memoryBytes) + "\n")) {
+    rmdir(dir.c_str());
+    runtimeError(
+        "Unable to limit " + dir + " to " + to_string(memoryBytes) +
+        " bytes, is the memory controller on in " + parent + "?");
+  }
+}
+// =======================================================================================
+jobCgroup::~jobCgroup() {
+  killAll();
+  // Killed processes leave the cgroup as they finish dying, rmdir is EBUSY
+  // until the last one has. Don't hold on to it past a second.
+  for (int tries = 0; tries < 1000; tries++) {
+    if (rmdir(dir.c_str()) == 0 || errno != EBUSY) {
+      return;
+    }
+    usleep(1000);
+  }
+}
+// =======================================================================================
+void jobCgroup::add(pid_t pid) {
+  if (!writeFile("cgroup.procs", to_string(pid) + "\n")) {
+    runtimeError(
+        "Unable to move tracee " + to_string(pid) + " into " + dir + ": " +
+        strerror(errno));
+  }
+}
+// =======================================================================================
+void jobCgroup::killAll() {
+  if (writeFile("cgroup.kill", "1\n")) {
+    return;
+  }
+  stringstream procs{readFile("cgroup.procs")};
+  pid_t pid;
+  while (procs >> pid) {
+    kill(pid, SIGKILL);
+  }
+}
+// =======================================================================================
+vector<pair<string, uint64_t>> jobCgroup::totals() const {
+  vector<pair<string, uint64_t>> totals;
+
+  // "usage_usec 1234" lines.
+  stringstream cpuStat{readFile("cpu.stat")};
+  string key;
+  uint64_t value;
+  while (cpuStat >> key >> value) {
+    if (key == "usage_usec") {
+      totals.emplace_back("cgroup cpu (us)", value);
+    } else if (key == "user_usec") {
+      totals.emplace_back("cgroup cpu in user space (us)", value);
+    } else if (key == "system_usec") {
+      totals.emplace_back("cgroup cpu in the kernel (us)", value);
+    }
+  }
+
+  // Linux 5.19 and later.
+  string peak = readFile("memory.peak");
+  if (!peak.empty()) {
+    totals.emplace_back("cgroup memory peak (bytes)", stoull(peak));
+  }
+
+  // A "8:0 rbytes=1 wbytes=2 rios=3 ..." line per device, summed.
+  string ioStat = readFile("io.stat");
+  if (!ioStat.empty()) {
+    uint64_t read = 0;
+    uint64_t written = 0;
+    stringstream fields{ioStat};
+    string field;
+    while (fields >> field) {
+      if (field.compare(0, 7, "rbytes=") == 0) {
+        read += stoull(field.substr(7));
+      } else if (field.compare(0, 7, "wbytes=") == 0) {
+        written += stoull(field.substr(7));
+      }
+    }
+    totals.emplace_back("cgroup io read (bytes)", read);
+    totals.emplace_back("cgroup io written (bytes)", written);
+  }
+  return totals;
+}
+// =======================================================================================
+bool jobCgroup::writeFile(const string& file, const string& contents) const {
+  int fd = open((dir + "/" + file).c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  bool written =
+      write(fd, contents.data(), contents.size()) == (ssize_t)contents.size();
+  int error = errno;
+  close(fd);
+  errno = error;
+  return written;
+}
+// =======================================================================================
+string jobCgroup::readFile(const string& file) const {
+  ifstream in(dir + "/" + file);
+  stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+// =======================================================================================
@@ -0,0 +1,252 @@
+#include "jobServer.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+/**
+ * Every job starts with this header, carrying the fds. Then come its strings,
+ * each NUL terminated: templateKey, workdir, argv, env, program and programEnv.
+ */
+struct jobHeader {
+  uint64_t cloneFlags;
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t programc;
+  uint32_t programEnvc;
+  int32_t cpu;
+  uint64_t stringBytes;
+};
+
+/** Strings of a job bigger than this are refused, ARG_MAX is far below. */
+static const uint64_t maxStringBytes = 64 * 1024 * 1024;
+
+static bool socketAddress(const string& path, struct sockaddr_un& address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+static bool writeAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t done = write(fd, data, size);
+    if (done == -1 && errno == EINTR) {
+      continue;
+    }
+    if (done <= 0) {
+      return false;
+    }
+    data += done;
+    size -= done;
+  }
+  return true;
+}
+
+static bool readAll(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t done = read(fd, data, size);
+    if (done == -1 && errno == EINTR) {
+      continue;
+    }
+    if (done <= 0) {
+      return false;
+    }
+    data += done;
+    size -= done;
+  }
+  return true;
+}
+
+/** Split bytes into count NUL terminated strings, false if they don't fit. */
+static bool splitStrings(
+    const string& bytes, size_t& at, uint32_t count, vector<string>& out) {
+  for (uint32_t i = 0; i < count; i++) {
+    size_t end = bytes.find('\0', at);
+    if (end == string::npos) {
+      return false;
+    }
+    out.push_back(bytes.substr(at, end - at));
+    at = end + 1;
+  }
+  return true;
+}
+// =======================================================================================
+int listenOnSocket(const string& path) {
+  struct sockaddr_un address;
+  if (!socketAddress(path, address)) {
+    runtimeError("Server socket path too long: " + path);
+  }
+  // A mistyped path must not cost a file, only stale sockets are replaced.
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      runtimeError("Server socket path exists and is not a socket: " + path);
+    }
+    doWithCheck(unlink(path.c_str()), "unlink stale server socket " + path);
+  }
+  int sock = doWithCheck(
+      socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), "server socket");
+  // Jobs run whatever a client asks, so only we may connect: 0600 whatever
+  // the caller's umask, from the moment the socket exists.
+  mode_t oldMask = umask(0177);
+  int bound = bind(sock, (struct sockaddr*)&address, sizeof(address));
+  umask(oldMask);
+  doWithCheck(bound, "bind server socket " + path);
+  doWithCheck(listen(sock, SOMAXCONN), "listen on server socket");
+  return sock;
+}
+// =======================================================================================
+int acceptClient(int listener) {
+  int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+  if (client == -1) {
+    return -1;
+  }
+  struct ucred peer;
+  socklen_t size = sizeof(peer);
+  if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &size) == -1 ||
+      peer.uid != geteuid()) {
+    close(client);
+    errno = EPERM;
+    return -1;
+  }
+  return client;
+}
+// =======================================================================================
+int connectToSocket(const string& path) {
+  struct sockaddr_un address;
+  if (!socketAddress(path, address)) {
+    return -1;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr*)&address, sizeof(address)) == -1) {
+    int savedErrno = errno;
+    close(sock);
+    errno = savedErrno;
+    return -1;
+  }
+  return sock;
+}
+// =======================================================================================
+bool sendJob(int sock, const dettraceJob& job) {
+  string strings;
+  strings.append(job.templateKey.c_str(), job.templateKey.size() + 1);
+  strings.append(job.workdir.c_str(), job.workdir.size() + 1);
+  for (auto list : {&job.argv, &job.env, &job.program, &job.programEnv}) {
+    for (auto& str : *list) {
+      strings.append(str.c_str(), str.size() + 1);
+    }
+  }
+  jobHeader header = {
+      job.cloneFlags,
+      (uint32_t)job.argv.size(),
+      (uint32_t)job.env.size(),
+      (uint32_t)job.program.size(),
+      (uint32_t)job.programEnv.size(),
+      job.cpu,
+      strings.size()};
+
+  struct iovec io = {&header, sizeof(header)};
+  char control[CMSG_SPACE(sizeof(job.fds))];
+  memset(control, 0, sizeof(control));
+  struct msghdr message = {};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  struct cmsghdr* fds = CMSG_FIRSTHDR(&message);
+  fds->cmsg_level = SOL_SOCKET;
+  fds->cmsg_type = SCM_RIGHTS;
+  fds->cmsg_len = CMSG_LEN(sizeof(job.fds));
+  memcpy(CMSG_DATA(fds), job.fds, sizeof(job.fds));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(sock, &message, 0);
+  } while (sent == -1 && errno == EINTR);
+  if (sent != (ssize_t)sizeof(header)) {
+    return false;
+  }
+  return writeAll(sock, strings.data(), strings.size());
+}
+// =======================================================================================
+bool receiveJob(int sock, dettraceJob& job) {
+  jobHeader header;
+  struct iovec io = {&header, sizeof(header)};
+  char control[CMSG_SPACE(sizeof(job.fds))];
+  struct msghdr message = {};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  ssize_t received;
+  do {
+    received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+  } while (received == -1 && errno == EINTR);
+
+  struct cmsghdr* fds = CMSG_FIRSTHDR(&message);
+  bool gotFds = fds != nullptr && fds->cmsg_level == SOL_SOCKET &&
+      fds->cmsg_type == SCM_RIGHTS &&
+      fds->cmsg_len == CMSG_LEN(sizeof(job.fds));
+  if (gotFds) {
+    memcpy(job.fds, CMSG_DATA(fds), sizeof(job.fds));
+  }
+  // A short header can only be read on, the fds only come with its first byte.
+  if (received > 0 && received < (ssize_t)sizeof(header) &&
+      readAll(
+          sock, (char*)&header + received, sizeof(header) - received)) {
+    received = sizeof(header);
+  }
+
+  string strings;
+  bool ok = gotFds && received == (ssize_t)sizeof(header) &&
+      header.stringBytes <= maxStringBytes;
+  if (ok) {
+    strings.resize(header.stringBytes);
+    ok = readAll(sock, &strings[0], strings.size());
+  }
+  size_t at = 0;
+  vector<string> single;
+  ok = ok && splitStrings(strings, at, 2, single) &&
+      splitStrings(strings, at, header.argc, job.argv) &&
+      splitStrings(strings, at, header.envc, job.env) &&
+      splitStrings(strings, at, header.programc, job.program) &&
+      splitStrings(strings, at, header.programEnvc, job.programEnv) &&
+      at == strings.size();
+  if (!ok) {
+    for (int& fd : job.fds) {
+      if (fd != -1) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    return false;
+  }
+  job.cloneFlags = header.cloneFlags;
+  job.cpu = header.cpu;
+  job.templateKey = single[0];
+  job.workdir = single[1];
+  return true;
+}
+// =======================================================================================
+bool sendJobStatus(int sock, int32_t status) {
+  return writeAll(sock, (const char*)&status, sizeof(status));
+}
+// =======================================================================================
+bool receiveJobStatus(int sock, int32_t& status) {
+  return readAll(sock, (char*)&status, sizeof(status));
+}
+// =======================================================================================
@@ -0,0 +1,81 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "liveStats.hpp"
+#include "syscallStats.hpp"
+#include "util.hpp"
+
+// =======================================================================================
+liveStatsWriter::liveStatsWriter(const string& path) {
+  fd = doWithCheck(
+      open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666),
+      "Unable to open live statistics file " + path);
+  doWithCheck(
+      ftruncate(fd, sizeof(liveStatsPage)), "ftruncate live statistics file");
+  void* mapped = mmap(
+      nullptr, sizeof(liveStatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+      0);
+  if (mapped == MAP_FAILED) {
+    runtimeError("Unable to map live statistics file " + path);
+  }
+  page = (liveStatsPage*)mapped;
+  // Zero filled by ftruncate, readers check the magic last.
+  page->version = LIVE_STATS_VERSION;
+  page->pageSize = sizeof(liveStatsPage);
+  page->tracerPid = getpid();
+  atomic_thread_fence(memory_order_release);
+  memcpy(page->magic, LIVE_STATS_MAGIC, sizeof(page->magic));
+}
+// =======================================================================================
+liveStatsWriter::~liveStatsWriter() {
+  munmap(page, sizeof(liveStatsPage));
+  close(fd);
+}
+// =======================================================================================
+void liveStatsWriter::publish(
+    const vector<pair<string, uint64_t>>& totals,
+    const syscallStats* stats,
+    uint64_t elapsedNanos,
+    bool finished) {
+  uint64_t sequence = page->sequence.load(memory_order_relaxed);
+  page->sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  page->finished = finished;
+  page->updates++;
+  page->elapsedNanos = elapsedNanos;
+  page->totalCount = min<size_t>(totals.size(), liveStatsPage::maxTotals);
+  for (uint32_t i = 0; i < page->totalCount; i++) {
+    liveStatsTotal& total = page->totals[i];
+    size_t length = min(totals[i].first.size(), sizeof(total.name) - 1);
+    memcpy(total.name, totals[i].first.data(), length);
+    total.name[length] = '\0';
+    total.value = totals[i].second;
+  }
+  if (stats != nullptr) {
+    for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+      const syscallStats::counters& c = stats->of(i);
+      page->systemCalls[i] = {c.preHooks, c.postHooks, c.replays};
+    }
+  }
+
+  page->sequence.store(sequence + 2, memory_order_release);
+}
+// =======================================================================================
+bool liveStatsWriter::due() {
+  if (--stopsUntilCheck != 0) {
+    return false;
+  }
+  stopsUntilCheck = checkStops;
+  uint64_t now = chrono::duration_cast<chrono::nanoseconds>(
+                     chrono::steady_clock::now().time_since_epoch())
+                     .count();
+  if (now - lastPublish < publishEveryNanos) {
+    return false;
+  }
+  lastPublish = now;
+  return true;
+}
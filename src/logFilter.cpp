@@ -0,0 +1,148 @@
+#include <fnmatch.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include "logFilter.hpp"
+#include "policyProfile.hpp"
+#include "systemCallList.hpp"
+#include "util.hpp"
+
+/** Commas separated values of a term. */
+static vector<string> splitValues(const string& values) {
+  vector<string> split;
+  istringstream in(values);
+  string value;
+  while (getline(in, value, ',')) {
+    if (!value.empty()) {
+      split.push_back(value);
+    }
+  }
+  return split;
+}
+
+/** A number of a range, in base. */
+template <typename T>
+static T parseNumber(const string& term, const string& number, int base) {
+  char* end;
+  T n = (T)strtoull(number.c_str(), &end, base);
+  if (number.empty() || *end != '\0') {
+    runtimeError("--log-filter " + term + ": bad number " + number);
+  }
+  return n;
+}
+
+/** A range "A-B" or a single value, either end of a range may be left out. */
+template <typename T>
+static pair<T, T> parseRange(
+    const string& term, const string& value, int base) {
+  size_t dash = value.find('-');
+  if (dash == string::npos) {
+    T n = parseNumber<T>(term, value, base);
+    return {n, n};
+  }
+  string from = value.substr(0, dash);
+  string to = value.substr(dash + 1);
+  pair<T, T> range{numeric_limits<T>::min(), numeric_limits<T>::max()};
+  if (!from.empty()) {
+    range.first = parseNumber<T>(term, from, base);
+  }
+  if (!to.empty()) {
+    range.second = parseNumber<T>(term, to, base);
+  }
+  return range;
+}
+
+template <typename T>
+static bool inRanges(const vector<pair<T, T>>& ranges, T value) {
+  for (auto& range : ranges) {
+    if (range.first <= value && value <= range.second) {
+      return true;
+    }
+  }
+  return false;
+}
+// =======================================================================================
+logFilter logFilter::parse(const string& text) {
+  logFilter filter;
+  istringstream terms(text);
+  string term;
+  while (terms >> term) {
+    size_t equals = term.find('=');
+    if (equals == string::npos) {
+      runtimeError("--log-filter " + term + ": expected key=values");
+    }
+    string key = term.substr(0, equals);
+    vector<string> values = splitValues(term.substr(equals + 1));
+    if (values.empty()) {
+      runtimeError("--log-filter " + term + ": no values");
+    }
+
+    for (auto& value : values) {
+      if (key == "pid") {
+        filter.pids.push_back(parseNumber<pid_t>(term, value, 10));
+      } else if (key == "exe") {
+        filter.exes.push_back(value);
+      } else if (key == "syscall") {
+        long number = systemCallNumber(value);
+        if (number == -1) {
+          runtimeError(
+              "--log-filter " + term + ": unknown system call " + value);
+        }
+        filter.syscalls.resize(SYSTEM_CALL_COUNT);
+        filter.syscalls[number] = true;
+      } else if (key == "time") {
+        filter.times.push_back(parseRange<int64_t>(term, value, 10));
+      } else if (key == "entry") {
+        filter.entries.push_back(parseRange<uint64_t>(term, value, 16));
+      } else {
+        runtimeError(
+            "--log-filter " + term +
+            ": expected pid, exe, syscall, time or entry");
+      }
+    }
+  }
+  return filter;
+}
+// =======================================================================================
+bool logFilter::empty() const {
+  return pids.empty() && exes.empty() && syscalls.empty() && times.empty() &&
+      entries.empty();
+}
+// =======================================================================================
+bool logFilter::keeps(
+    pid_t tid, pid_t tgid, int syscallNum, int64_t time) const {
+  if (!pids.empty() &&
+      find_if(pids.begin(), pids.end(), [&](pid_t pid) {
+        return pid == tid || pid == tgid;
+      }) == pids.end()) {
+    return false;
+  }
+  if (!exes.empty() && execMatches.count(tgid) == 0) {
+    return false;
+  }
+  if (!syscalls.empty() && (syscallNum < 0 || !syscalls[syscallNum])) {
+    return false;
+  }
+  return times.empty() || inRanges(times, time);
+}
+// =======================================================================================
+void logFilter::execed(pid_t tgid, const string& path) {
+  for (auto& exe : exes) {
+    if (fnmatch(exe.c_str(), path.c_str(), 0) == 0) {
+      execMatches.insert(tgid);
+      return;
+    }
+  }
+  execMatches.erase(tgid);
+}
+// =======================================================================================
+void logFilter::forked(pid_t parent, pid_t child) {
+  if (execMatches.count(parent) != 0) {
+    execMatches.insert(child);
+  } else {
+    execMatches.erase(child);
+  }
+}
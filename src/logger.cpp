@@ -1,7 +1,12 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <climits>
 #include <string>
@@ -10,10 +15,93 @@
 #include "logger.hpp"
 #include "util.hpp"
 
+#include <exception>
 #include <stdexcept>
 
 using namespace std;
 
+/** Size of the async log ring buffer. Must be a power of two. */
+static const size_t logRingSize = 8 * 1024 * 1024;
+
+/**
+ * Input bytes of each gzip member of a compressed log. Smaller members lose
+ * less of a crashed run's log, larger ones compress a little better.
+ */
+static const size_t logFrameBytes = 4 * 1024 * 1024;
+
+/** Pending bytes at which a shard is written out. */
+static const size_t logShardWriteBytes = 64 * 1024;
+
+struct logCompressor {
+  z_stream stream = {};
+  /** Input bytes in the member being written. */
+  size_t memberBytes = 0;
+  char out[64 * 1024];
+};
+
+/** Loggers with a writer thread, for flushAll(). */
+static const int maxFlushLoggers = 4;
+static atomic<logger*> flushLoggers[maxFlushLoggers];
+
+/** Write all of data to fd. @return false if we couldn't. */
+static bool writeAll(int fd, const char* data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t ret = write(fd, data + done, size - done);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    done += ret;
+  }
+  return true;
+}
+
+static void pauseBriefly() {
+  struct timespec ts = {0, 200 * 1000};
+  nanosleep(&ts, nullptr);
+}
+
+static void flushOnFatalSignal(int sig) {
+  logger::flushAll();
+  // SA_RESETHAND restored the default action, re-raise so we still die (and
+  // dump core) the way we would have without this handler.
+  raise(sig);
+}
+
+static terminate_handler defaultTerminate;
+
+static void flushOnTerminate() {
+  logger::flushAll();
+  // Let the default handler print the uncaught exception for us.
+  defaultTerminate();
+}
+
+/**
+ * Install flush hooks for the ways the tracer can die with log output still
+ * sitting in a ring. Done once, the first time a logger starts a writer.
+ */
+static void installFlushHandlers() {
+  static bool installed = false;
+  if (installed) {
+    return;
+  }
+  installed = true;
+
+  atexit(logger::flushAll);
+  defaultTerminate = set_terminate(flushOnTerminate);
+
+  struct sigaction sa = {};
+  sa.sa_handler = flushOnFatalSignal;
+  sa.sa_flags = SA_RESETHAND;
+  sigemptyset(&sa.sa_mask);
+  for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+    doWithCheck(sigaction(sig, &sa, nullptr), "sigaction(fatal signal)");
+  }
+}
+
 /*======================================================================================*/
 logger::logger(string logFile, int debugLevel, bool useColor)
     : debugLevel(debugLevel), useColor(useColor) {
@@ -24,19 +112,42 @@ logger::logger(string logFile, int debugLevel, bool useColor)
   }
 
   if (logFile.empty()) {
-    fin = stderr;
+    logFd = STDERR_FILENO;
   } else {
+    const string gz = ".gz";
+    bool compressed = logFile.size() > gz.size() &&
+        logFile.compare(logFile.size() - gz.size(), gz.size(), gz) == 0;
+    string base = compressed ? logFile.substr(0, logFile.size() - gz.size())
+                             : logFile;
     // find a unique name for our log file
     char buf[1024];
     for (int i = 0; i < 100; i++) {
-      snprintf(buf, sizeof(buf), "%s.%02u", logFile.c_str(), i);
+      snprintf(
+          buf, sizeof(buf), "%s.%02u%s", base.c_str(), i,
+          compressed ? gz.c_str() : "");
       int rv = access(buf, F_OK);
       if (0 != rv) break; // file doesn't exist, we can use this name!
     }
-    FILE* logfile = fopen(buf, "w");
-    assert(nullptr != logfile);
+    logFd = open(buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    assert(-1 != logFd);
+    logPath = buf;
 
-    fin = logfile;
+    // Nothing is ever printed below inter, don't bother with a thread.
+    if (isEnabled(Importance::inter)) {
+      if (compressed) {
+        compressor = make_unique<logCompressor>();
+        // Level 1 keeps up with --debug 5, 16 + 15 window bits for gzip.
+        if (deflateInit2(
+                &compressor->stream, 1, Z_DEFLATED, 16 + 15, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+          runtimeError("Unable to start compressing the log.");
+        }
+      }
+      ring = make_unique<logRingBuffer>(logRingSize);
+      writer = thread(&logger::drainRing, this);
+      registerForFlush();
+      installFlushHandlers();
+    }
   }
 
   padding = false;
@@ -44,6 +155,162 @@ logger::logger(string logFile, int debugLevel, bool useColor)
   return;
 }
 
+logger::~logger() {
+  flushShards();
+  if (ring) {
+    unregisterForFlush();
+    pauseWriter();
+  }
+  if (compressor) {
+    deflateEnd(&compressor->stream);
+  }
+  if (logFd != STDERR_FILENO) {
+    close(logFd);
+  }
+}
+
+void logger::pauseWriter() {
+  // Or a forked tracer writes them out a second time.
+  flushShards();
+  if (ring && writer.joinable()) {
+    stopWriter.store(true, memory_order_release);
+    writer.join();
+  }
+}
+
+void logger::resumeWriter() {
+  if (ring && !writer.joinable()) {
+    stopWriter.store(false, memory_order_release);
+    writer = thread(&logger::drainRing, this);
+  }
+}
+
+void logger::registerForFlush() {
+  for (auto& slot : flushLoggers) {
+    logger* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, this)) {
+      return;
+    }
+  }
+  // Still works, we just won't be flushed on abnormal exit.
+  fprintf(stderr, "Too many loggers to flush on exit.\n");
+}
+
+void logger::unregisterForFlush() {
+  for (auto& slot : flushLoggers) {
+    logger* expected = this;
+    slot.compare_exchange_strong(expected, nullptr);
+  }
+}
+
+void logger::flushAll() {
+  for (auto& slot : flushLoggers) {
+    logger* l = slot.load();
+    if (l != nullptr) {
+      l->flush();
+    }
+  }
+}
+
+void logger::flush() {
+  flushShards();
+  // Paused, nobody to wait for, see pauseWriter().
+  if (!ring || stopWriter.load(memory_order_acquire)) {
+    return;
+  }
+  while (bytesWritten.load(memory_order_acquire) !=
+         bytesLogged.load(memory_order_acquire)) {
+    pauseBriefly();
+  }
+}
+
+void logger::drainRing() {
+  while (true) {
+    const char* data;
+    size_t n = ring->peek(&data);
+    if (n == 0 && compressor && compressor->memberBytes != 0) {
+      // Caught up: end the member so all of it can be read, and flushed.
+      compressOut(nullptr, 0, true);
+      continue;
+    }
+    if (n == 0) {
+      if (stopWriter.load(memory_order_acquire)) {
+        // Producer may have pushed right before asking us to stop.
+        if (ring->peek(&data) == 0) {
+          return;
+        }
+        continue;
+      }
+      pauseBriefly();
+      continue;
+    }
+
+    if (compressor) {
+      bool finish = compressor->memberBytes + n >= logFrameBytes;
+      compressOut(data, n, finish);
+    } else {
+      // Nowhere to put it if this fails. Drop this chunk instead of wedging
+      // the tracer.
+      writeOut(data, n);
+      bytesWritten.fetch_add(n, memory_order_release);
+    }
+    ring->consume(n);
+  }
+}
+
+bool logger::writeOut(const char* data, size_t size) {
+  return writeAll(logFd, data, size);
+}
+
+void logger::compressOut(const char* data, size_t size, bool finish) {
+  z_stream& stream = compressor->stream;
+  stream.next_in = (Bytef*)data;
+  stream.avail_in = size;
+  int status;
+  do {
+    stream.next_out = (Bytef*)compressor->out;
+    stream.avail_out = sizeof(compressor->out);
+    status = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+    writeOut(compressor->out, sizeof(compressor->out) - stream.avail_out);
+  } while (stream.avail_out == 0 || (finish && status != Z_STREAM_END));
+  compressor->memberBytes += size;
+
+  if (finish) {
+    // The next member starts with a gzip header of its own.
+    deflateReset(&stream);
+    bytesWritten.fetch_add(compressor->memberBytes, memory_order_release);
+    compressor->memberBytes = 0;
+  }
+}
+
+void logger::emit(const string& line) {
+  if (!ring) {
+    size_t done = 0;
+    while (done < line.size()) {
+      ssize_t ret = write(logFd, line.data() + done, line.size() - done);
+      if (ret == -1 && errno == EINTR) {
+        continue;
+      }
+      if (ret <= 0) {
+        return;
+      }
+      done += ret;
+    }
+    return;
+  }
+
+  bytesLogged.fetch_add(line.size(), memory_order_release);
+  size_t done = 0;
+  while (done < line.size()) {
+    size_t n = ring->push(line.data() + done, line.size() - done);
+    if (n == 0) {
+      // Writer is behind. Wait for it, never drop messages.
+      pauseBriefly();
+    }
+    done += n;
+  }
+}
+
 void logger::writeToLogNoFormat(Importance imp, std::string s) {
   logPrintfFormattingEnabled = false;
   writeToLog(imp, s);
@@ -52,72 +319,119 @@ void logger::writeToLogNoFormat(Importance imp, std::string s) {
 
 void logger::writeToLog(Importance imp, std::string format, ...) {
   // Don't bother, we're not printing anything.
-  if (debugLevel == 0) {
+  if (!isEnabled(imp) || !passesFilter()) {
     return;
   }
 
-  va_list args;
-  bool print = false;
-
-  /* Print information based on debug level. */
-  switch (debugLevel) {
-    /* Most verbose, print all messages. Also does extraI. */
-  case 5:
-    print = true;
+  const char* tag = "";
+  switch (imp) {
+  case Importance::extra:
+    tag = "[5]EXTRA ";
     break;
-  case 4:
-    if (imp == Importance::inter || imp == Importance::info) {
-      print = true;
-    }
-    break;
-    /* Ignore informatory messages. */
-  case 3:
-  case 2:
-    if (imp == Importance::inter) {
-      print = true;
-    }
+  case Importance::info:
+    tag = "[4]INFO  "; // Extra space for correct alignment.
     break;
-  case 1:
-    break;
-  case 0:
-    break;
-  default:
-    fprintf(fin, "  Warning Unknown DEBUG level %d.\n", debugLevel);
+  case Importance::inter:
+    tag = "[3]INTER ";
     break;
   }
 
-  if (print) {
-    switch (imp) {
-    case Importance::extra:
-      fprintf(fin, "[5]EXTRA ");
-      break;
-    case Importance::info:
-      fprintf(fin, "[4]INFO  "); // Extra space for correct alignment.
-      break;
-    case Importance::inter:
-      fprintf(fin, "[3]INTER ");
-      break;
-    }
-    fprintf(fin, "%lx ", logEntryID);
-    logEntryID++;
+  char prefix[64];
+  if (isSharded()) {
+    snprintf(
+        prefix, sizeof(prefix), "%s%lx @%ld %s", tag, logEntryID, contextTime,
+        padding ? "  " : "");
+  } else {
+    snprintf(
+        prefix, sizeof(prefix), "%s%lx %s", tag, logEntryID,
+        padding ? "  " : "");
+  }
+  logEntryID++;
+  string line{prefix};
 
-    if (padding) {
-      fprintf(fin, "  ");
-    }
+  if (logPrintfFormattingEnabled) {
+    va_list args;
+    char buf[1024];
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format.c_str(), args);
+    va_end(args);
 
-    if (logPrintfFormattingEnabled) {
+    if (len < 0) {
+      line += format;
+    } else if ((size_t)len < sizeof(buf)) {
+      line.append(buf, len);
+    } else {
+      // Too big for the stack buffer, format again straight into the line.
+      size_t start = line.size();
+      line.resize(start + len + 1);
       va_start(args, format);
-      vfprintf(fin, format.c_str(), args);
+      vsnprintf(&line[start], len + 1, format.c_str(), args);
       va_end(args);
-    } else {
-      fwrite(format.c_str(), 1, format.length(), fin);
+      line.resize(start + len);
     }
-    fflush(fin);
+  } else {
+    line += format;
+  }
+  if (isSharded() && contextGroup != 0) {
+    emitToShard(line);
+  } else {
+    emit(line);
   }
 
   return;
 }
 
+void logger::shardByThreadGroup() {
+  if (logPath.empty() || compressor) {
+    runtimeError("Log shards need a log file that isn't compressed.");
+  }
+  shardBase = logPath;
+}
+
+void logger::emitToShard(const string& line) {
+  logShard& shard = shards[contextGroup];
+  shard.pending += line;
+  shardBytesPending += line.size();
+  if (shard.pending.size() >= logShardWriteBytes) {
+    writeShard(contextGroup, shard);
+  }
+  // Many small shards, each under logShardWriteBytes.
+  if (shardBytesPending >= logRingSize) {
+    flushShards();
+  }
+}
+
+void logger::writeShard(pid_t group, logShard& shard) {
+  if (shard.pending.empty()) {
+    return;
+  }
+  string path = shardBase + "." + to_string(group);
+  int fd = open(
+      path.c_str(),
+      O_WRONLY | O_CREAT | O_CLOEXEC | (shard.created ? O_APPEND : O_TRUNC),
+      0666);
+  // Nowhere to put it if this fails, like the writer thread's chunks.
+  if (fd != -1) {
+    writeAll(fd, shard.pending.data(), shard.pending.size());
+    close(fd);
+  }
+  shard.created = true;
+  shardBytesPending -= shard.pending.size();
+  shard.pending.clear();
+  shard.pending.shrink_to_fit();
+}
+
+void logger::flushShards() {
+  for (auto& shard : shards) {
+    writeShard(shard.first, shard.second);
+  }
+}
+
+void logger::filterBy(const logFilter& filter) {
+  this->filter = make_unique<logFilter>(filter);
+  contextKept = true;
+}
+
 void logger::setPadding() {
   padding = true;
   return;
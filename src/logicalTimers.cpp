@@ -0,0 +1,167 @@
+#include "logicalTimers.hpp"
+
+using namespace std::chrono;
+
+// =======================================================================================
+timerSetting timerSetting::fromItimerspec(const struct itimerspec& spec) {
+  timerSetting setting;
+  setting.value = duration_cast<logical_clock::duration>(
+      seconds(spec.it_value.tv_sec) + nanoseconds(spec.it_value.tv_nsec));
+  setting.interval = duration_cast<logical_clock::duration>(
+      seconds(spec.it_interval.tv_sec) + nanoseconds(spec.it_interval.tv_nsec));
+  // Shorter than our clock ticks, still armed.
+  if (setting.value.count() == 0 &&
+      (spec.it_value.tv_sec != 0 || spec.it_value.tv_nsec != 0)) {
+    setting.value = logical_clock::duration(1);
+  }
+  if (setting.interval.count() == 0 && spec.it_interval.tv_nsec != 0) {
+    setting.interval = logical_clock::duration(1);
+  }
+  return setting;
+}
+// =======================================================================================
+timerSetting timerSetting::fromItimerval(const struct itimerval& val) {
+  timerSetting setting;
+  setting.value = duration_cast<logical_clock::duration>(
+      seconds(val.it_value.tv_sec) + microseconds(val.it_value.tv_usec));
+  setting.interval = duration_cast<logical_clock::duration>(
+      seconds(val.it_interval.tv_sec) + microseconds(val.it_interval.tv_usec));
+  return setting;
+}
+// =======================================================================================
+struct itimerspec timerSetting::toItimerspec() const {
+  struct itimerspec spec;
+  auto valueNs = duration_cast<nanoseconds>(value).count();
+  auto intervalNs = duration_cast<nanoseconds>(interval).count();
+  spec.it_value.tv_sec = valueNs / 1000000000;
+  spec.it_value.tv_nsec = valueNs % 1000000000;
+  spec.it_interval.tv_sec = intervalNs / 1000000000;
+  spec.it_interval.tv_nsec = intervalNs % 1000000000;
+  return spec;
+}
+// =======================================================================================
+struct itimerval timerSetting::toItimerval() const {
+  struct itimerval val;
+  auto valueUs = duration_cast<microseconds>(value).count();
+  auto intervalUs = duration_cast<microseconds>(interval).count();
+  val.it_value.tv_sec = valueUs / 1000000;
+  val.it_value.tv_usec = valueUs % 1000000;
+  val.it_interval.tv_sec = intervalUs / 1000000;
+  val.it_interval.tv_usec = intervalUs % 1000000;
+  return val;
+}
+// =======================================================================================
+timerSetting logicalTimers::setTimer(
+    timerKey key,
+    int signum,
+    logical_clock::time_point now,
+    timerSetting setting) {
+  timerSetting old = getTimer(key, now);
+  timer& t = timers[key];
+  disarm(key, t);
+  t.signum = signum;
+  t.interval = setting.interval;
+  t.overrun = 0;
+  if (setting.value > logical_clock::duration::zero()) {
+    arm(key, t, now + setting.value);
+  }
+  return old;
+}
+// =======================================================================================
+timerSetting logicalTimers::getTimer(
+    timerKey key, logical_clock::time_point now) const {
+  timerSetting setting;
+  auto it = timers.find(key);
+  if (it == timers.end()) {
+    return setting;
+  }
+  const timer& t = it->second;
+  setting.interval = t.interval;
+  if (!t.armed) {
+    return setting;
+  }
+  if (t.expiry > now) {
+    setting.value = t.expiry - now;
+  } else if (t.interval > logical_clock::duration::zero()) {
+    // Went off without anyone taking it, as far as the next period.
+    setting.value = t.interval - (now - t.expiry) % t.interval;
+  }
+  return setting;
+}
+// =======================================================================================
+bool logicalTimers::armed(timerKey key) const {
+  auto it = timers.find(key);
+  return it != timers.end() && it->second.armed;
+}
+// =======================================================================================
+logical_clock::time_point logicalTimers::expiry(timerKey key) const {
+  return timers.at(key).expiry;
+}
+// =======================================================================================
+uint64_t logicalTimers::expire(timerKey key, logical_clock::time_point now) {
+  auto it = timers.find(key);
+  if (it == timers.end() || !it->second.armed || it->second.expiry > now) {
+    return 0;
+  }
+  timer& t = it->second;
+  logical_clock::time_point expired = t.expiry;
+  disarm(key, t);
+  uint64_t expirations = 1;
+  if (t.interval > logical_clock::duration::zero()) {
+    expirations += (now - expired) / t.interval;
+    arm(key, t, expired + expirations * t.interval);
+  }
+  t.overrun = expirations - 1;
+  return expirations;
+}
+// =======================================================================================
+uint64_t logicalTimers::overrun(timerKey key) const {
+  auto it = timers.find(key);
+  return it == timers.end() ? 0 : it->second.overrun;
+}
+// =======================================================================================
+int logicalTimers::expireNextSignal(logical_clock::time_point now) {
+  if (!signalDue(now)) {
+    return 0;
+  }
+  timerKey key = get<2>(*bySignalExpiry.begin());
+  expire(key, now);
+  return timers.at(key).signum;
+}
+// =======================================================================================
+void logicalTimers::erase(timerKey key) {
+  auto it = timers.find(key);
+  if (it != timers.end()) {
+    disarm(it->first, it->second);
+    timers.erase(it);
+  }
+}
+// =======================================================================================
+void logicalTimers::forked() {
+  for (auto it = timers.begin(); it != timers.end();) {
+    if (it->first.first == timerKind::timerfd) {
+      ++it;
+    } else {
+      disarm(it->first, it->second);
+      it = timers.erase(it);
+    }
+  }
+}
+// =======================================================================================
+void logicalTimers::disarm(timerKey key, timer& t) {
+  if (t.armed && t.signum != 0) {
+    bySignalExpiry.erase(signalKey{t.expiry, t.sequence, key});
+  }
+  t.armed = false;
+}
+// =======================================================================================
+void logicalTimers::arm(
+    timerKey key, timer& t, logical_clock::time_point expiry) {
+  t.expiry = expiry;
+  t.armed = true;
+  t.sequence = nextSequence++;
+  if (t.signum != 0) {
+    bySignalExpiry.insert(signalKey{expiry, t.sequence, key});
+  }
+}
+// =======================================================================================
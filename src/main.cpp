@@ -6,7 +6,10 @@
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
 #include <sys/reg.h> /* For constants ORIG_EAX, etc */
+#include <poll.h>
 #include <sys/select.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/syscall.h> /* For SYS_write, etc */
 #include <sys/sysmacros.h>
 #include <sys/types.h>
@@ -31,21 +34,34 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <tuple>
 #include <vector>
 
 #include <seccomp.h>
+#include "checkpoint.hpp"
 #include "dettraceSystemCall.hpp"
 #include "execution.hpp"
+#include "inodeSnapshot.hpp"
+#include "ioUring.hpp"
+#include "jobAdmission.hpp"
+#include "jobCgroup.hpp"
+#include "policyProfile.hpp"
+#include "remoteCache.hpp"
+#include "jobServer.hpp"
+#include "logFilter.hpp"
 #include "logger.hpp"
 #include "logicalclock.hpp"
 #include "ptracer.hpp"
 #include "rnr_loader.hpp"
 #include "seccomp.hpp"
+#include "startupTimes.hpp"
 #include "state.hpp"
 #include "systemCallList.hpp"
 #include "tempfile.hpp"
@@ -66,6 +82,10 @@
  * https://stackoverflow.com/questions/47006441/ptrace-catching-many-traps-for-execve/47039345#47039345
  */
 
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
 using namespace std;
 
 struct MountPoint {
@@ -84,6 +104,10 @@ struct programArgs {
   std::string pathToChroot;
   std::vector<MountPoint> volume;
   std::string logFile;
+  /** --log-filter, "" logs everything, see logFilter. */
+  std::string logFilter;
+  /** --log-shards, see logger::shardByThreadGroup. */
+  bool logShards;
   std::string workdir;
 
   bool useColor;
@@ -94,6 +118,7 @@ struct programArgs {
   // allowing dettrace to treat the current enviornment as a chroot.
   bool alreadyInChroot;
   bool convertUids;
+  bool fakeroot;
   bool useContainer;
   bool allow_network;
   bool with_aslr;
@@ -108,15 +133,97 @@ struct programArgs {
   std::vector<std::string> traceeArgs;
 
   unsigned timeoutSeconds;
+  /** --cgroup, a delegated cgroup v2 to make the job's under, "" for none. */
+  std::string cgroup;
+  double cgroupCpus;
+  uint64_t cgroupMemory;
   logical_clock::time_point epoch;
   logical_clock::duration clock_step;
   unsigned long clone_ns_flags;
 
   unsigned short prng_seed;
+  bool prngCompat;
   bool in_docker;
 
   std::string rnr;
 
+  size_t scratchSize;
+
+  bool seccompNotify;
+
+  std::string traceFile;
+  std::string statsJson;
+  std::string liveStats;
+  std::string timeline;
+  std::string trapProfile;
+  unsigned trapProfileEvery;
+
+  bool parallel;
+  /** --lite, parallel is set too. */
+  bool lite;
+
+  bool clockOrder;
+  bool producerFirst;
+  /** --pipe-size, as the kernel rounded it, 0 for the kernel's default. */
+  int pipeSize;
+  /** --cpus, CPUs tracees see, 0 for the host's. */
+  unsigned cpus;
+  bool vectorClocks;
+
+  unsigned long preemptBranches;
+
+  /** --pin, -1 for no pinning, and --spin-wait. */
+  int pinTracerCpu;
+  int pinTraceeCpu;
+  uint32_t spinWaitMicros;
+
+  /** --watchdog rounds, 0 for none. */
+  uint32_t watchdogRounds;
+  bool hardwareCounters;
+  unsigned helperThreads;
+
+  /** Path of the --profile and what it says, null without one. */
+  std::string profile;
+  std::shared_ptr<const policyProfile> profileRules;
+  std::string suggestProfile;
+
+  std::string inodeSnapshot;
+  uint64_t snapshotFingerprint;
+
+  std::string inputLog;
+  bool replayInputs;
+
+  std::string schedule;
+  bool useSchedule;
+
+  std::string execCache;
+  // --remote-exec command and --exec-cache-remote url, "" for none.
+  std::string remoteExec;
+  std::string execCacheRemote;
+  std::string dependencies;
+  std::string hashOutputs;
+  bool ioUring;
+  bool ephemeral;
+  // Pipe to stream the trace to, -1 for none.
+  int traceStream;
+
+  // --checkpoint-at marker, "" for none, and runs to restore from it.
+  std::string checkpointAt;
+  unsigned checkpointRuns;
+  // Socket of a --fork-server, listened on before we clone.
+  std::string forkServer;
+  int forkServerFd;
+
+  // Socket of a dettrace --server to run as, or to send this job to.
+  std::string server;
+  std::string connect;
+  // Zygotes a server keeps ready.
+  unsigned pool;
+  // Budget of a server's jobs, see jobAdmission. 0 for none.
+  unsigned serverCores;
+  uint64_t serverMemory;
+  uint64_t jobMemory;
+
   programArgs(int argc, char* argv[]) {
     this->argc = argc;
     this->argv = argv;
@@ -125,10 +232,16 @@ struct programArgs {
     this->useContainer = false;
     this->useColor = true;
     this->logFile = "";
+    this->logFilter = "";
+    this->logShards = false;
     this->printStatistics = false;
     this->convertUids = false;
+    this->fakeroot = false;
     this->alreadyInChroot = false;
     this->timeoutSeconds = 0;
+    this->cgroup = "";
+    this->cgroupCpus = 0;
+    this->cgroupMemory = 0;
     this->epoch = logical_clock::from_time_t(744847200UL);
     this->clock_step = chrono::microseconds(1);
     this->allow_network = false;
@@ -138,13 +251,63 @@ struct programArgs {
     this->with_devrand_overrides = true;
     this->with_etc_overrides = true;
     this->prng_seed = 0;
+    this->prngCompat = false;
     this->in_docker = false;
     this->rnr = "";
+    this->scratchSize = 0x10000;
+    this->seccompNotify = false;
+    this->traceFile = "";
+    this->statsJson = "";
+    this->liveStats = "";
+    this->timeline = "";
+    this->trapProfile = "";
+    this->trapProfileEvery = 1;
+    this->parallel = false;
+    this->lite = false;
+    this->clockOrder = false;
+    this->producerFirst = false;
+    this->pipeSize = 0;
+    this->cpus = 0;
+    this->vectorClocks = false;
+    this->preemptBranches = 0;
+    this->pinTracerCpu = -1;
+    this->pinTraceeCpu = -1;
+    this->spinWaitMicros = 0;
+    this->watchdogRounds = 0;
+    this->hardwareCounters = false;
+    this->helperThreads = 2;
+    this->profile = "";
+    this->suggestProfile = "";
+    this->inodeSnapshot = "";
+    this->snapshotFingerprint = 0;
+    this->inputLog = "";
+    this->replayInputs = false;
+    this->schedule = "";
+    this->useSchedule = false;
+    this->execCache = "";
+    this->remoteExec = "";
+    this->execCacheRemote = "";
+    this->dependencies = "";
+    this->hashOutputs = "";
+    this->ioUring = false;
+    this->ephemeral = false;
+    this->traceStream = -1;
+    this->checkpointAt = "";
+    this->checkpointRuns = 0;
+    this->forkServer = "";
+    this->forkServerFd = -1;
+    this->server = "";
+    this->connect = "";
+    this->pool = 0;
+    this->serverCores = 0;
+    this->serverMemory = 0;
+    this->jobMemory = 0;
   }
 };
 // =======================================================================================
 programArgs parseProgramArguments(int argc, char* argv[]);
-int runTracee(programArgs* args);
+int runTracee(programArgs* args, int zygoteJob);
+bool kernelCheck(int a, int b, int c);
 int spawnTracerTracee(void* args);
 ptraceEvent getNextEvent(pid_t currentPid, pid_t& traceesPid, int& status);
 
@@ -152,7 +315,9 @@ static string devrandFifoPath, devUrandFifoPath;
 
 static bool fileExists(const string& directory);
 static void mountDir(const string& source, const string& target);
+static void mountOverlay(const string& base, const string& target);
 static void createFileIfNotExist(const string& path);
+static int checkPipeSize(int bytes);
 
 // See user_namespaces(7)
 static void update_map(char* mapping, char* map_file);
@@ -160,28 +325,54 @@ static void proc_setgroups_write(pid_t pid, const char* str);
 
 // =======================================================================================
 static execution* globalExeObject = nullptr;
+/** The job's cgroup, with --cgroup. */
+static jobCgroup* globalJobCgroup = nullptr;
 void sigalrmHandler(int _) {
   assert(nullptr != globalExeObject);
-  globalExeObject->killAllProcesses();
+  if (globalJobCgroup != nullptr) {
+    globalJobCgroup->killAll();
+  } else {
+    globalExeObject->killAllProcesses();
+  }
   // TODO: print out message about timeout expiring
   runtimeError("dettrace timeout expired\n");
 }
 // =======================================================================================
 
+using vdsoSymbols = std::
+    map<std::string, std::tuple<unsigned long, unsigned long, unsigned long>>;
+
 struct CloneArgs {
   programArgs* args;
   std::unique_ptr<TempDir> tmpdir;
-  std::map<std::string, std::tuple<unsigned long, unsigned long, unsigned long>>
-      vdsoSyms;
+  vdsoSymbols vdsoSyms;
+  /**
+   * Set up as a zygote, the job comes over this socket once the tracer and
+   * tracee are ready for it. -1 when args has the job.
+   */
+  int zygoteControl = -1;
   CloneArgs(programArgs* args) { this->args = args; }
 };
 
+/** When our job arrived, set up time is counted from here. */
+static chrono::steady_clock::time_point jobStart = chrono::steady_clock::now();
+
+static int64_t microsecondsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration_cast<chrono::microseconds>(
+             chrono::steady_clock::now() - start)
+      .count();
+}
+
 /**
  * Given a program through the command line, spawn a child thread, call PTRACEME
  * and exec the given program. The parent will use ptrace to intercept and
  * determinize the through system call interception.
  */
-int main(int argc, char** argv) {
+/**
+ * Parse our command line, with the environment overrides main applies on top.
+ */
+static programArgs parseArguments(int argc, char** argv) {
+  int64_t parseStart = startupTimes::now();
   programArgs args = parseProgramArguments(argc, argv);
 
   // Check for debug enviornment variable.
@@ -206,6 +397,74 @@ int main(int argc, char** argv) {
   if (args.alreadyInChroot) {
     args.clone_ns_flags &= ~CLONE_NEWUSER;
   }
+  startupTimes::add(startupTimes::get().optionParse, parseStart);
+  return args;
+}
+
+// This is modified code from user_namespaces(7)
+// see https://lwn.net/Articles/532593/
+/* Update the UID and GID maps for children in their namespace, notice we do
+   not live in that namespace. We use clone instead of unshare to avoid moving
+   us into to the namespace. This allows us, in the future, to extend the
+   mappings to other uids when running as root (not currently implemented, but
+   notice this cannot be done when using unshare.)*/
+static void writeIdMaps(pid_t pid) {
+  char map_path[PATH_MAX];
+  const int MAP_BUF_SIZE = 100;
+  char map_buf[MAP_BUF_SIZE];
+  char* uid_map;
+  char* gid_map;
+
+  uid_t uid = getuid();
+  gid_t gid = getgid();
+
+  // Set up container to hostOS UID and GID mappings
+  snprintf(map_path, PATH_MAX, "/proc/%d/uid_map", pid);
+  snprintf(map_buf, MAP_BUF_SIZE, "0 %ld 1", (long)uid);
+  uid_map = map_buf;
+  update_map(uid_map, map_path);
+
+  // Set GID Map
+  string deny = "deny";
+  proc_setgroups_write(pid, deny.c_str());
+  snprintf(map_path, PATH_MAX, "/proc/%d/gid_map", pid);
+  snprintf(map_buf, MAP_BUF_SIZE, "0 %ld 1", (long)gid);
+  gid_map = map_buf;
+  update_map(gid_map, map_path);
+}
+
+/** Run pid on cpu alone, the calling thread if pid is 0. */
+static void pinToCpu(pid_t pid, int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  doWithCheck(
+      sched_setaffinity(pid, sizeof(cpus), &cpus),
+      [&]() {
+        return "Unable to pin " + to_string(pid) + " to cpu " + to_string(cpu);
+      });
+}
+
+/** Our exit status for a child that ended with status. */
+static int exitCodeOf(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    return WTERMSIG(status);
+  } else {
+    return 1;
+  }
+}
+
+static int runServer(const programArgs& args, const vdsoSymbols& vdsoSyms);
+static int runClient(const programArgs& args);
+static string templateKey(const programArgs& args);
+
+int main(int argc, char** argv) {
+  programArgs args = parseArguments(argc, argv);
+  if (!args.connect.empty()) {
+    return runClient(args);
+  }
   int cloneFlags = args.clone_ns_flags;
 
   // our own user namespace. Other namepspace commands require CAP_SYS_ADMIN to
@@ -222,7 +481,9 @@ int main(int argc, char** argv) {
   // only offets are used so it doesn't really matter
   // we read it from tracer or tracee.
   CloneArgs cloneArgs(&args);
+  int64_t vdsoStart = startupTimes::now();
   auto syms = vdsoGetSymbols(getpid());
+  startupTimes::add(startupTimes::get().vdsoParse, vdsoStart);
   if (4 > syms.size()) {
     runtimeError(
         "VDSO symbol map has only " + to_string(syms.size()) +
@@ -230,10 +491,20 @@ int main(int argc, char** argv) {
   }
   cloneArgs.vdsoSyms = syms;
 
+  if (!args.server.empty()) {
+    return runServer(args, syms);
+  }
+
+  if (!args.forkServer.empty()) {
+    // Where clients can reach it, outside of our mount namespace.
+    args.forkServerFd = listenOnSocket(args.forkServer);
+  }
+
   // Requires SIGCHILD otherwise parent won't be notified of parent exit.
   // We use clone instead of unshare so that the current process does not live
   // in the new user namespace, this is a requirement for writing multiple UIDs
   // into the uid mappings.
+  startupTimes::get().cloneStarted = startupTimes::now();
   pid_t pid = clone(
       spawnTracerTracee, child_stack + STACK_SIZE, cloneFlags | SIGCHLD,
       (void*)&cloneArgs);
@@ -242,49 +513,415 @@ int main(int argc, char** argv) {
     cerr << "clone failed:\n  " + reason << endl;
     return 1;
   }
-  // This is modified code from user_namespaces(7)
-  // see https://lwn.net/Articles/532593/
-  /* Update the UID and GID maps for children in their namespace, notice we do
-     not live in that namespace. We use clone instead of unshare to avoid moving
-     us into to the namespace. This allows us, in the future, to extend the
-     mappings to other uids when running as root (not currently implemented, but
-     notice this cannot be done when using unshare.)*/
   if ((args.clone_ns_flags & CLONE_NEWUSER) == CLONE_NEWUSER) {
-    char map_path[PATH_MAX];
-    const int MAP_BUF_SIZE = 100;
-    char map_buf[MAP_BUF_SIZE];
-    char* uid_map;
-    char* gid_map;
-
-    uid_t uid = getuid();
-    gid_t gid = getgid();
-
-    // Set up container to hostOS UID and GID mappings
-    snprintf(map_path, PATH_MAX, "/proc/%d/uid_map", pid);
-    snprintf(map_buf, MAP_BUF_SIZE, "0 %ld 1", (long)uid);
-    uid_map = map_buf;
-    update_map(uid_map, map_path);
-
-    // Set GID Map
-    string deny = "deny";
-    proc_setgroups_write(pid, deny.c_str());
-    snprintf(map_path, PATH_MAX, "/proc/%d/gid_map", pid);
-    snprintf(map_buf, MAP_BUF_SIZE, "0 %ld 1", (long)gid);
-    gid_map = map_buf;
-    update_map(gid_map, map_path);
+    writeIdMaps(pid);
   }
 
   int status;
 
   // Propegate Child's exit status to use as our own exit status.
   doWithCheck(waitpid(pid, &status, 0), "cannot wait for child");
-  if (WIFEXITED(status)) {
-    return WEXITSTATUS(status);
-  } else if (WIFSIGNALED(status)) {
-    return WTERMSIG(status);
-  } else {
+  return exitCodeOf(status);
+}
+
+// =======================================================================================
+/**
+ * What a spare needs to run a job: its end of the socket the server sends the
+ * job over, and the vdso symbols the server looked up once for all jobs.
+ */
+struct SpareArgs {
+  int control;
+  int serverEnd;
+  vdsoSymbols vdsoSyms;
+  /** Options zygotes are set up with. */
+  const programArgs* serverArgs;
+};
+
+/**
+ * A process cloned into the namespaces of the next job before it arrives,
+ * waiting for it on control.
+ */
+struct spare {
+  pid_t pid;
+  int control;
+  unsigned long cloneFlags;
+};
+
+/**
+ * Run the job the server sends us, as if its client had run dettrace itself:
+ * with its standard streams, working directory, environment and arguments.
+ */
+static int runSpare(void* voidArgs) {
+  SpareArgs* spareArgs = static_cast<SpareArgs*>(voidArgs);
+  startupTimes& times = startupTimes::get();
+  startupTimes::finish(times.namespaceClone, times.cloneStarted);
+  close(spareArgs->serverEnd);
+  // The server blocks SIGCHLD, tracees must not inherit that.
+  sigset_t noSignals;
+  sigemptyset(&noSignals);
+  doWithCheck(sigprocmask(SIG_SETMASK, &noSignals, nullptr), "sigprocmask");
+
+  dettraceJob job;
+  if (!receiveJob(spareArgs->control, job)) {
     return 1;
   }
+  close(spareArgs->control);
+  // The tracer and tracees we fork inherit it.
+  if (job.cpu != -1) {
+    pinToCpu(0, job.cpu);
+  }
+
+  for (int fd = 0; fd < 3; fd++) {
+    doWithCheck(dup2(job.fds[fd], fd), "dup2 job standard stream");
+  }
+  doWithCheck(fchdir(job.fds[3]), "fchdir to job working directory");
+  for (int fd : job.fds) {
+    if (fd > 2) {
+      close(fd);
+    }
+  }
+
+  // putenv keeps pointers into job.env, which lives as long as the job.
+  clearenv();
+  for (auto& var : job.env) {
+    putenv(&var[0]);
+  }
+  vector<char*> argv;
+  for (auto& arg : job.argv) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+
+  programArgs args = parseArguments(job.argv.size(), argv.data());
+  CloneArgs cloneArgs(&args);
+  cloneArgs.vdsoSyms = spareArgs->vdsoSyms;
+  return spawnTracerTracee(&cloneArgs);
+}
+
+/**
+ * Set up a tracer and tracee with the server's options, both parked until the
+ * server sends a job for them on control, see CloneArgs::zygoteControl.
+ */
+static int runZygote(void* voidArgs) {
+  SpareArgs* spareArgs = static_cast<SpareArgs*>(voidArgs);
+  startupTimes& times = startupTimes::get();
+  startupTimes::finish(times.namespaceClone, times.cloneStarted);
+  close(spareArgs->serverEnd);
+  sigset_t noSignals;
+  sigemptyset(&noSignals);
+  doWithCheck(sigprocmask(SIG_SETMASK, &noSignals, nullptr), "sigprocmask");
+
+  // Our copy of the server's options, the job fills in the program.
+  programArgs args = *spareArgs->serverArgs;
+  CloneArgs cloneArgs(&args);
+  cloneArgs.vdsoSyms = spareArgs->vdsoSyms;
+  cloneArgs.zygoteControl = spareArgs->control;
+  return spawnTracerTracee(&cloneArgs);
+}
+
+/** Clone a spare into cloneFlags' namespaces, pid -1 if that failed. */
+static spare spawnSpare(
+    unsigned long cloneFlags, SpareArgs& spareArgs, bool zygote = false) {
+  const int STACK_SIZE(1024 * 1024);
+  static char spare_stack[STACK_SIZE];
+
+  int sockets[2];
+  doWithCheck(
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets),
+      "spare socketpair");
+  spareArgs.serverEnd = sockets[0];
+  spareArgs.control = sockets[1];
+  startupTimes::get().cloneStarted = startupTimes::now();
+  pid_t pid = clone(
+      zygote ? runZygote : runSpare, spare_stack + STACK_SIZE,
+      cloneFlags | SIGCHLD, (void*)&spareArgs);
+  close(sockets[1]);
+  startupTimes::get().cloneStarted = 0;
+  if (pid == -1) {
+    string reason = strerror(errno);
+    cerr << "clone failed:\n  " + reason << endl;
+    close(sockets[0]);
+    return spare{-1, -1, cloneFlags};
+  }
+  if ((cloneFlags & CLONE_NEWUSER) == CLONE_NEWUSER) {
+    writeIdMaps(pid);
+  }
+  return spare{pid, sockets[0], cloneFlags};
+}
+
+/**
+ * dettrace --server: run the jobs dettrace --connect sends, each in its own
+ * fresh namespaces and tracer, so with its own globalState, clock and PRNG
+ * seed. What every job startup shares is done once: starting dettrace, and
+ * looking up the vdso symbols. The next job's namespaces and id maps are set
+ * up while the last one runs, by cloning a spare that waits for it.
+ *
+ * The mounts, /dev nodes, fifos and /dev/random thread depend on the job's
+ * flags, and must not be shared between jobs, so a spare still does those once
+ * its job comes. With --pool, jobs with the server's flags skip them too: they
+ * go to a zygote, which has done all of it up to the tracee's execvpe, and a
+ * new zygote is set up in the background for the next one.
+ *
+ * With --server-cores or --server-memory, jobs beyond the budget wait for a
+ * running one to finish, in the order they came, see jobAdmission.
+ */
+static int runServer(const programArgs& args, const vdsoSymbols& vdsoSyms) {
+  int listener = listenOnSocket(args.server);
+
+  sigset_t childSignals;
+  sigemptyset(&childSignals);
+  sigaddset(&childSignals, SIGCHLD);
+  doWithCheck(
+      sigprocmask(SIG_BLOCK, &childSignals, nullptr), "sigprocmask SIGCHLD");
+  int children = doWithCheck(
+      signalfd(-1, &childSignals, SFD_CLOEXEC), "signalfd SIGCHLD");
+
+  SpareArgs spareArgs{-1, -1, vdsoSyms, &args};
+  spare next = spawnSpare(args.clone_ns_flags, spareArgs);
+  // Client connection of every running job, by the pid of its spare.
+  unordered_map<pid_t, int> clients;
+  const string serverKey = templateKey(args);
+  deque<spare> zygotes;
+  for (unsigned i = 0; i < args.pool; i++) {
+    zygotes.push_back(spawnSpare(args.clone_ns_flags, spareArgs, true));
+  }
+  unique_ptr<jobAdmission> admission;
+  if (args.serverCores != 0 || args.serverMemory != 0) {
+    admission = make_unique<jobAdmission>(
+        jobAdmission::hostCores(args.serverCores), args.serverMemory,
+        args.jobMemory);
+  }
+  // Jobs waiting for the budget, with their clients, oldest first.
+  deque<pair<int, dettraceJob>> queued;
+  // Core of every running job with a budget, by the pid of its spare.
+  unordered_map<pid_t, int> cpus;
+
+  // Hand job to a zygote or spare, its status goes to client when it is done.
+  auto startJob = [&](int client, dettraceJob& job) {
+    // Jobs asking for other namespaces than ours get a spare of their own.
+    bool fromPool = !zygotes.empty() && zygotes.front().pid != -1 &&
+        job.templateKey == serverKey;
+    spare runner = fromPool
+        ? zygotes.front()
+        : job.cloneFlags == next.cloneFlags && next.pid != -1
+            ? next
+            : spawnSpare(job.cloneFlags, spareArgs);
+    if (fromPool) {
+      zygotes.pop_front();
+      zygotes.push_back(spawnSpare(args.clone_ns_flags, spareArgs, true));
+    } else if (!zygotes.empty() && zygotes.front().pid == -1) {
+      zygotes.pop_front();
+      zygotes.push_back(spawnSpare(args.clone_ns_flags, spareArgs, true));
+    }
+    bool sent = runner.pid != -1 && sendJob(runner.control, job);
+    for (int fd : job.fds) {
+      close(fd);
+    }
+    if (runner.pid != -1) {
+      close(runner.control);
+    }
+    if (sent) {
+      clients[runner.pid] = client;
+      if (job.cpu != -1) {
+        cpus[runner.pid] = job.cpu;
+      }
+    } else {
+      if (runner.pid != -1) {
+        kill(runner.pid, SIGKILL);
+      }
+      if (job.cpu != -1) {
+        admission->release(job.cpu);
+      }
+      sendJobStatus(client, 1);
+      close(client);
+    }
+    if (!fromPool && runner.pid == next.pid) {
+      next = spawnSpare(args.clone_ns_flags, spareArgs);
+    }
+  };
+
+  for (;;) {
+    struct pollfd events[2] = {{listener, POLLIN, 0}, {children, POLLIN, 0}};
+    if (poll(events, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      doWithCheck(-1, "server poll");
+    }
+
+    if (events[1].revents & POLLIN) {
+      struct signalfd_siginfo info;
+      doWithCheck(read(children, &info, sizeof(info)), "read signalfd");
+      int status;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto client = clients.find(pid);
+        if (client != clients.end()) {
+          sendJobStatus(client->second, exitCodeOf(status));
+          close(client->second);
+          clients.erase(client);
+          auto cpu = cpus.find(pid);
+          if (cpu != cpus.end()) {
+            admission->release(cpu->second);
+            cpus.erase(cpu);
+          }
+        } else if (pid == next.pid) {
+          close(next.control);
+          next = spawnSpare(args.clone_ns_flags, spareArgs);
+        } else {
+          for (auto& zygote : zygotes) {
+            if (zygote.pid == pid) {
+              close(zygote.control);
+              zygote = spawnSpare(args.clone_ns_flags, spareArgs, true);
+            }
+          }
+        }
+      }
+      while (!queued.empty()) {
+        int cpu = admission->admit();
+        if (cpu == -1) {
+          break;
+        }
+        queued.front().second.cpu = cpu;
+        startJob(queued.front().first, queued.front().second);
+        queued.pop_front();
+      }
+    }
+
+    if ((events[0].revents & POLLIN) == 0) {
+      continue;
+    }
+    int client = acceptClient(listener);
+    if (client == -1) {
+      continue;
+    }
+    dettraceJob job;
+    if (!receiveJob(client, job)) {
+      close(client);
+      continue;
+    }
+    if (admission != nullptr) {
+      job.cpu = queued.empty() ? admission->admit() : -1;
+      if (job.cpu == -1) {
+        queued.emplace_back(client, move(job));
+        continue;
+      }
+    }
+    startJob(client, job);
+  }
+}
+
+/**
+ * Everything in args a zygote set up with them depends on. The program, its
+ * arguments, environment and working directory only matter at exec, so they
+ * are left out, unless an inode snapshot ties the run to the working directory.
+ */
+static string templateKey(const programArgs& args) {
+  ostringstream key;
+  key << args.debugLevel << ' ' << args.pathToChroot << ' ' << args.logFile
+      << ' ' << args.logFilter << ' ' << args.logShards << args.useColor
+      << args.printStatistics
+      << args.alreadyInChroot << args.convertUids << args.fakeroot
+      << args.useContainer
+      << args.allow_network << args.with_aslr << args.with_proc_overrides
+      << args.with_devrand_overrides << args.with_etc_overrides << ' '
+      << args.timeoutSeconds << ' ' << args.cgroup << ' ' << args.cgroupCpus
+      << ' ' << args.cgroupMemory << ' '
+      << args.epoch.time_since_epoch().count()
+      << ' ' << args.clock_step.count() << ' ' << args.clone_ns_flags << ' '
+      << args.prng_seed << ' ' << args.prngCompat << args.in_docker << ' '
+      << args.rnr << ' ' << args.scratchSize << ' ' << args.seccompNotify
+      << ' ' << args.traceFile << ' ' << args.statsJson << ' ' << args.liveStats
+      << ' ' << args.timeline << ' ' << args.trapProfile << ' '
+      << args.trapProfileEvery << ' '
+      << args.parallel << args.lite << args.clockOrder << args.producerFirst
+      << ' ' << args.pipeSize << ' ' << args.cpus << ' '
+      << args.vectorClocks << ' ' << args.preemptBranches << ' '
+      << args.pinTracerCpu << ' ' << args.pinTraceeCpu << ' '
+      << args.spinWaitMicros << ' ' << args.watchdogRounds << ' '
+      << args.hardwareCounters << ' ' << args.helperThreads << ' '
+      << args.profile << ' ' << args.suggestProfile << ' '
+      << args.inodeSnapshot << ' ' << args.snapshotFingerprint << ' '
+      << args.inputLog << ' ' << args.replayInputs << ' ' << args.schedule
+      << ' ' << args.useSchedule << ' ' << args.execCache << ' '
+      << args.remoteExec << ' ' << args.execCacheRemote << ' '
+      << args.dependencies << ' ' << args.hashOutputs << ' ' << args.ioUring
+      << args.ephemeral
+      << ' ' << args.traceStream
+      << ' ' << args.checkpointAt << ' ' << args.checkpointRuns;
+  if (!args.inodeSnapshot.empty()) {
+    key << ' ' << args.workdir;
+  }
+  for (auto& volume : args.volume) {
+    key << ' ' << volume.source << ':' << volume.target << ':' << volume.type;
+  }
+  return key.str();
+}
+
+/**
+ * Our versions of /proc and /etc files tracees see, by tracee path, from the
+ * chroot. Served from memory by the tracer, see syntheticFiles.
+ */
+static map<string, string> syntheticFileSources(const programArgs& args) {
+  map<string, string> sources;
+  if (args.alreadyInChroot) {
+    return sources;
+  }
+  const string& root = args.pathToChroot;
+  if (args.with_proc_overrides) {
+    for (const char* path :
+         {"/proc/meminfo", "/proc/stat", "/proc/filesystems"}) {
+      sources[path] = root + path;
+    }
+  }
+  if (args.with_etc_overrides) {
+    for (const char* path :
+         {"/etc/hosts", "/etc/passwd", "/etc/group", "/etc/ld.so.cache"}) {
+      sources[path] = root + path;
+    }
+  }
+  return sources;
+}
+
+/**
+ * dettrace --connect: have the server run our job, and exit as it did.
+ */
+static int runClient(const programArgs& args) {
+  int server = connectToSocket(args.connect);
+  if (server == -1) {
+    string reason = strerror(errno);
+    cerr << "cannot connect to dettrace server at " + args.connect + ":\n  " +
+            reason
+         << endl;
+    return 1;
+  }
+
+  dettraceJob job;
+  job.cloneFlags = args.clone_ns_flags;
+  job.argv.assign(args.argv, args.argv + args.argc);
+  extern char** environ;
+  for (int i = 0; environ[i] != nullptr; i++) {
+    job.env.push_back(environ[i]);
+  }
+  job.fds[0] = STDIN_FILENO;
+  job.fds[1] = STDOUT_FILENO;
+  job.fds[2] = STDERR_FILENO;
+  job.fds[3] = doWithCheck(
+      open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC), "open working directory");
+  job.templateKey = templateKey(args);
+  job.program = args.args;
+  for (auto& var : args.envs) {
+    job.programEnv.push_back(var.first + "=" + var.second);
+  }
+  job.workdir = args.workdir;
+
+  int32_t status;
+  if (!sendJob(server, job) || !receiveJobStatus(server, status)) {
+    cerr << "dettrace server at " + args.connect + " did not run the job"
+         << endl;
+    return 1;
+  }
+  return status;
 }
 
 // get canonicalized exe path
@@ -366,16 +1003,20 @@ static std::vector<std::unique_ptr<char[]>> make_argv(
  * Child will become the process the user wishes through call to execvpe.
  * @arg tempdir: either empty string or tempdir to use, for cpio chroot.
  */
-int runTracee(programArgs* args) {
-  const auto& pathToChroot = args->pathToChroot;
-
+/**
+ * Set up the container and exec the program. A zygote's tracee, with zygoteJob
+ * not -1, waits for its job right before exec.
+ */
+int runTracee(programArgs* args, int zygoteJob) {
   if (!args->with_aslr) {
     // Disable ASLR for our child
     doWithCheck(
         personality(PER_LINUX | ADDR_NO_RANDOMIZE), "Unable to disable ASLR");
   }
 
+  startupTimes& times = startupTimes::get();
   if (!args->alreadyInChroot) {
+    int64_t devStart = startupTimes::now();
     if (!fileExists("/dev/null")) {
       // we're running under reprotest as sudo, so we can use real mknod
       // hat tip to:
@@ -385,29 +1026,28 @@ int runTracee(programArgs* args) {
           S_IFCHR | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
       doWithCheck(mknod("/dev/null", mode, dev), "mknod");
     }
-
     if (args->with_devrand_overrides) {
       createFileIfNotExist("/dev/random");
-      mountDir(devrandFifoPath, "/dev/random");
       createFileIfNotExist("/dev/urandom");
-      mountDir(devUrandFifoPath, "/dev/urandom");
     }
+    startupTimes::add(times.devNodes, devStart);
 
-    if (args->with_proc_overrides) {
-      mountDir(pathToChroot + "/proc/meminfo", "/proc/meminfo");
-      mountDir(pathToChroot + "/proc/stat", "/proc/stat");
-      mountDir(pathToChroot + "/proc/filesystems", "/proc/filesystems");
-    }
-    if (args->with_etc_overrides) {
-      mountDir(pathToChroot + "/etc/hosts", "/etc/hosts");
-      mountDir(pathToChroot + "/etc/passwd", "/etc/passwd");
-      mountDir(pathToChroot + "/etc/group", "/etc/group");
-      mountDir(pathToChroot + "/etc/ld.so.cache", "/etc/ld.so.cache");
+    int64_t mountStart = startupTimes::now();
+    if (args->with_devrand_overrides) {
+      mountDir(devrandFifoPath, "/dev/random");
+      mountDir(devUrandFifoPath, "/dev/urandom");
     }
 
+    // The /proc and /etc overrides are served by the tracer, see
+    // syntheticFileSources.
+
     if (args->clone_ns_flags & CLONE_NEWNS) {
       for (auto v : args->volume) {
-        mountDir(v.source, v.target);
+        if (v.type == "overlay") {
+          mountOverlay(v.source, v.target);
+        } else {
+          mountDir(v.source, v.target);
+        }
       }
       // this have to be done before mount /dev/{u}random because
       // the source file is under previous /tmp
@@ -415,10 +1055,38 @@ int runTracee(programArgs* args) {
           mount("none", "/tmp", "tmpfs", 0, NULL),
           "mount /tmp as tmpfs failed");
     }
+    startupTimes::add(times.mounts, mountStart);
 
-    // set working dir
-    doWithCheck(
-        chdir(args->workdir.c_str()), "unable to chdir to " + args->workdir);
+    // set working dir, a zygote's comes with its job.
+    if (zygoteJob == -1) {
+      doWithCheck(
+          chdir(args->workdir.c_str()), "unable to chdir to " + args->workdir);
+    }
+  }
+
+  if (zygoteJob != -1) {
+    dettraceJob job;
+    if (!receiveJob(zygoteJob, job)) {
+      return 1;
+    }
+    close(zygoteJob);
+    for (int fd = 0; fd < 3; fd++) {
+      doWithCheck(dup2(job.fds[fd], fd), "dup2 job standard stream");
+    }
+    for (int fd : job.fds) {
+      close(fd);
+    }
+    args->args = job.program;
+    args->envs.clear();
+    for (auto& var : job.programEnv) {
+      auto j = var.find('=');
+      args->envs[var.substr(0, j)] = var.substr(1 + j);
+    }
+    args->workdir = job.workdir;
+    if (!args->alreadyInChroot) {
+      doWithCheck(
+          chdir(args->workdir.c_str()), "unable to chdir to " + args->workdir);
+    }
   }
 
   // trap on rdtsc/rdtscp insns
@@ -443,17 +1111,37 @@ int runTracee(programArgs* args) {
   // Set up seccomp + bpf filters using libseccomp.
   // Default action to take when no rule applies to system call. We send a
   // PTRACE_SECCOMP event message to the tracer with a unique data: INT16_MAX
-  seccomp myFilter{args->debugLevel, args->convertUids};
+  int64_t seccompStart = startupTimes::now();
+  // The tracer patches system call sites to go through the gate when the
+  // tracee has a logical clock page, which it doesn't with --parallel.
+  bool bufferGate = !args->parallel && args->rnr.empty() &&
+      getenv("DETTRACE_NO_SITE_PATCHING") == nullptr;
+  seccomp myFilter{
+      args->debugLevel, args->convertUids, args->seccompNotify,
+      !args->hashOutputs.empty(), bufferGate, args->lite, args->ioUring,
+      args->ephemeral, args->cpus != 0, args->fakeroot,
+      args->profileRules.get()};
+  startupTimes::add(times.seccompBuild, seccompStart);
+  if (args->printStatistics) {
+    // Before the filter is loaded, so the tracer doesn't see this write.
+    cerr << "dettrace Statistic. System calls the kernel allows without "
+            "running the seccomp filter (Linux 5.11+): " +
+            myFilter.describeAlwaysAllowed()
+         << endl;
+  }
 
   // Stop ourselves until the tracer is ready. This ensures the tracer has time
   // to get set up.
   raise(SIGSTOP);
 
+  seccompStart = startupTimes::now();
   myFilter.loadFilterToKernel();
+  startupTimes::add(times.seccompLoad, seccompStart);
 
   // execvpe() duplicates the actions of the shell in searching  for  an
   // executable file if the specified filename does not contain a slash (/)
   // character.
+  times.execStarted = startupTimes::now();
   int val =
       execvpe(argv[0].get(), (char* const*)argv.data(), (char**)envs.data());
   if (val == -1) {
@@ -484,15 +1172,75 @@ static pthread_mutex_t devRandThreadMutex = PTHREAD_MUTEX_INITIALIZER;
 struct DevRandThreadParam {
   std::string fifoPath;
   unsigned int prngSeed;
+  bool prngCompat;
 };
 
+/** Bytes generated and written to a /dev/[u]random fifo at a time. */
+static const size_t devRandBlockSize = 64 * 1024;
+
 /**
- * DEVRAND STEP 3: thread that writes pseudorandom output to a /dev/[u]random
- * fifo
+ * A /dev/[u]random fifo devRandThread keeps full, with the bytes of its stream
+ * generated but not written yet: pending from written on.
+ */
+struct devRandFifo {
+  devRandFifo(int fd, const DevRandThreadParam& param)
+      : fd{fd},
+        compat{param.prngCompat},
+        compatPrng(param.prngSeed),
+        prng(param.prngSeed) {}
+
+  const int fd;
+  const bool compat;
+  /** The 16-bit PRNG 2 bytes at a time, the stream dettrace produced before
+   * blockPRNG, for --prng-compat. */
+  PRNG compatPrng;
+  /** Otherwise blockPRNG a whole block at a time. */
+  blockPRNG prng;
+  vector<uint8_t> pending;
+  size_t written = 0;
+};
+
+/** Generate the next piece of fifo's stream. */
+static void refill(devRandFifo& fifo) {
+  if (fifo.compat) {
+    uint16_t random = fifo.compatPrng.get();
+    fifo.pending.assign((uint8_t*)&random, (uint8_t*)&random + 2);
+  } else {
+    fifo.pending.resize(devRandBlockSize);
+    fifo.prng.fill(fifo.pending.data(), devRandBlockSize);
+  }
+  fifo.written = 0;
+}
+
+/**
+ * Write fifo's stream until the fifo is full. A short write is finished before
+ * the next piece is generated so no bytes are lost or reordered.
+ */
+static void fillFifo(devRandFifo& fifo) {
+  for (;;) {
+    if (fifo.written == fifo.pending.size()) {
+      refill(fifo);
+    }
+    ssize_t bytes = write(
+        fifo.fd, fifo.pending.data() + fifo.written,
+        fifo.pending.size() - fifo.written);
+    if (bytes == -1) {
+      if (errno != EAGAIN && errno != EINTR) {
+        perror("[devRandThread] error writing to fifo");
+      }
+      return;
+    }
+    fifo.written += bytes;
+  }
+}
+
+/**
+ * DEVRAND STEP 3: thread that writes pseudorandom output to both the
+ * /dev/random and the /dev/urandom fifo, whichever has room. One thread for
+ * the two, the streams are independent and each is written in order.
  */
 static void* devRandThread(void* param_) {
-  struct DevRandThreadParam* param = (struct DevRandThreadParam*)param_;
-  const char* fifoPath = param->fifoPath.c_str();
+  struct DevRandThreadParam* params = (struct DevRandThreadParam*)param_;
 
   pthread_mutex_lock(&devRandThreadMutex);
   // allow this thread to be unilaterally killed when tracer exits
@@ -501,55 +1249,60 @@ static void* devRandThread(void* param_) {
       pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &oldCancelType),
       "pthread_setcanceltype");
 
-  // fprintf(stderr, "[devRandThread] using fifo  %s, seed: %x\n", fifoPath,
-  // param->prngSeed);
-
-  PRNG prng(param->prngSeed);
-
-  uint32_t totalBytesWritten = 0;
-  uint16_t random = 0;
-  bool getNewRandom = true;
-
   // NB: if the fifo is ever closed by all readers/writers, then contents
   // buffered within it get dropped. This leads to nondeterministic results, so
   // we always keep the fifo open here. We open the fifo for writing AND reading
   // as that eliminates EPIPE ("other end of pipe closed") errors when the
   // tracee has closed the fifo and we call write(). Instead, our write() call
-  // will block once the fifo fills up. Once a tracee starts reading, the buffer
-  // will drain and our write() will get unblocked. However, no bytes should get
-  // lost during this process, ensuring the tracee(s) always see(s) a
-  // deterministic sequence of reads.
-  int fd = open(fifoPath, O_RDWR);
-  doWithCheck(fd, string("open: ") + fifoPath);
+  // fails with EAGAIN once the fifo fills up, and we poll() until a tracee
+  // drains it. No bytes should get lost during this process, ensuring the
+  // tracee(s) always see(s) a deterministic sequence of reads.
+  vector<unique_ptr<devRandFifo>> fifos;
+  struct pollfd polls[2];
+  for (int i = 0; i < 2; i++) {
+    const char* fifoPath = params[i].fifoPath.c_str();
+    int fd = open(fifoPath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    doWithCheck(fd, string("open: ") + fifoPath);
+    fifos.emplace_back(new devRandFifo(fd, params[i]));
+    polls[i] = {fd, POLLOUT, 0};
+  }
   pthread_cond_signal(&devRandThreadReady);
   pthread_mutex_unlock(&devRandThreadMutex);
 
-  while (true) {
-    if (getNewRandom) {
-      random = prng.get();
+  for (;;) {
+    for (auto& fifo : fifos) {
+      fillFifo(*fifo);
     }
-    int bytesWritten = write(fd, &random, 2);
-    if (2 != bytesWritten) {
-      perror("[devRandThread] error writing to fifo");
-      // need to try writing these bytes again so that the fifo generates
-      // deterministic output
-      getNewRandom = false;
-
-    } else {
-      fsync(fd);
-      getNewRandom = true;
-      totalBytesWritten += 2;
-      // printf("[devRandThread] wrote %u bytes so far...\n",
-      // totalBytesWritten);
+    if (poll(polls, 2, -1) == -1 && errno != EINTR) {
+      perror("[devRandThread] poll");
     }
   }
-
-  close(fd);
   return NULL;
 }
 
-static inline void closeAllFds(void) {
-  for (int fd = 3; fd < 256; fd++) {
+static void closeAllFds(void) {
+  if (syscall(SYS_close_range, 3, ~0U, 0) == 0) {
+    return;
+  }
+
+  // Before Linux 5.9, close whatever /proc/self/fd lists, however high.
+  DIR* dir = opendir("/proc/self/fd");
+  if (dir == nullptr) {
+    for (int fd = 3; fd < 256; fd++) {
+      close(fd);
+    }
+    return;
+  }
+  vector<int> fds;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    int fd = atoi(entry->d_name);
+    if (fd >= 3 && fd != dirfd(dir)) {
+      fds.push_back(fd);
+    }
+  }
+  closedir(dir);
+  for (int fd : fds) {
     close(fd);
   }
 }
@@ -557,8 +1310,10 @@ static inline void closeAllFds(void) {
 static void doTracerCleanup(bool umountTmpfs, std::unique_ptr<TempDir> tmpdir) {
   closeAllFds();
 
+  // Detach only: the tracees' /tmp is freed along with our mount namespace,
+  // without us waiting on it. The fifos below are under the /tmp it hid.
   if (umountTmpfs) {
-    umount("/tmp");
+    umount2("/tmp", MNT_DETACH);
   }
 
   unlink(devrandFifoPath.c_str());
@@ -577,6 +1332,11 @@ int spawnTracerTracee(void* voidArgs) {
   CloneArgs* cloneArgs = static_cast<CloneArgs*>(voidArgs);
   auto args = cloneArgs->args;
   auto vdsoSyms = cloneArgs->vdsoSyms;
+  startupTimes::finish(
+      startupTimes::get().namespaceClone, startupTimes::get().cloneStarted);
+  // The tracee's phases are measured in the tracee.
+  startupTimes::share();
+  startupTimes& times = startupTimes::get();
 
   int pipefds[2];
 
@@ -587,12 +1347,14 @@ int spawnTracerTracee(void* voidArgs) {
   // changes inside this mount are not propegated to the parent mount. This
   // makes sure we don't pollute the host OS' mount space with entries made by
   // us here.
+  int64_t mountStart = startupTimes::now();
   if ((args->clone_ns_flags & CLONE_NEWNS) &&
       (args->clone_ns_flags & CLONE_NEWUSER)) {
     doWithCheck(
         mount("none", "/", NULL, MS_SLAVE | MS_REC, 0),
         "failed to mount / as slave");
   }
+  startupTimes::add(times.mounts, mountStart);
 
   cloneArgs->tmpdir = std::make_unique<TempDir>("dt-");
 
@@ -616,8 +1378,18 @@ int spawnTracerTracee(void* voidArgs) {
     devUrandFifoPath = tmpnamBuffer.path() + "-urandom.fifo";
   }
 
+  int64_t devStart = startupTimes::now();
   doWithCheck(mkfifo(devrandFifoPath.c_str(), 0666), "mkfifo");
   doWithCheck(mkfifo(devUrandFifoPath.c_str(), 0666), "mkfifo");
+  startupTimes::add(times.devNodes, devStart);
+
+  // A zygote's tracee waits for its part of the job on zygoteJob[1].
+  int zygoteJob[2] = {-1, -1};
+  if (cloneArgs->zygoteControl != -1) {
+    doWithCheck(
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, zygoteJob),
+        "zygote socketpair");
+  }
 
   pid_t pid = fork();
   if (pid < 0) {
@@ -627,6 +1399,7 @@ int spawnTracerTracee(void* voidArgs) {
     // We must mount proc so that the tracer sees the same PID and /proc/
     // directory as the tracee. The tracee will do the same so it sees /proc/
     // under it's chroot.
+    mountStart = startupTimes::now();
     if ((args->clone_ns_flags & CLONE_NEWNS) == CLONE_NEWNS &&
         (args->clone_ns_flags & CLONE_NEWPID) == CLONE_NEWPID) {
       doWithCheck(
@@ -642,6 +1415,7 @@ int spawnTracerTracee(void* voidArgs) {
           "tracer mounting devpts failed");
       mountDir("/dev/ptmx", "/dev/pts/ptmx");
     }
+    startupTimes::add(times.mounts, mountStart);
 
     if (!fileExists(devrandFifoPath)) {
       runtimeError("cannot create psudo /dev/random fifo");
@@ -651,50 +1425,99 @@ int spawnTracerTracee(void* voidArgs) {
       runtimeError("cannot create psudo /dev/urandom fifo");
     }
 
-    // DEVRAND STEP 2: spawn a thread to write to each fifo
-    pthread_t devRandomPthread, devUrandomPthread;
+    // DEVRAND STEP 2: spawn a thread to write to the fifos
+    int64_t fifoStart = startupTimes::now();
+    pthread_t devRandomPthread;
 
     unsigned short seed1 = args->prng_seed + 1234567890;
     unsigned short seed2 = args->prng_seed + 234567890;
     struct DevRandThreadParam params[2] = {
-        {devrandFifoPath, seed1},
-        {devUrandFifoPath, seed2},
+        {devrandFifoPath, seed1, args->prngCompat},
+        {devUrandFifoPath, seed2, args->prngCompat},
     };
-    // NB: we copy *FifoPath to the heap as our stack storage goes away: these
-    // allocations DO get leaked If we wanted to not leak them, devRandThread
-    // could copy to its stack and free the heap copy
     pthread_mutex_lock(&devRandThreadMutex);
     doWithCheck(
-        pthread_create(
-            &devRandomPthread, NULL, devRandThread, (void*)&params[0]),
-        "pthread_create /dev/random pthread");
-    pthread_cond_wait(&devRandThreadReady, &devRandThreadMutex);
-    // we should unlock then lock the mutex again, but just leave the mutex
-    // locked assuming: unlock -> lock = ID?
-    doWithCheck(
-        pthread_create(
-            &devUrandomPthread, NULL, devRandThread, (void*)&params[1]),
-        "pthread_create /dev/urandom pthread");
+        pthread_create(&devRandomPthread, NULL, devRandThread, (void*)params),
+        "pthread_create /dev/[u]random pthread");
     pthread_cond_wait(&devRandThreadReady, &devRandThreadMutex);
     pthread_mutex_unlock(&devRandThreadMutex);
     pthread_mutex_destroy(&devRandThreadMutex);
+    startupTimes::add(times.fifoThreads, fifoStart);
 
     // allow tracee to unblock. it maybe dangerous if tracee runs too early,
-    // when devrandPthread and/or devUrandPthread is not ready: the tracee could
-    // have exited before the pthreads are created, hence the FifoPath might
-    // have be deleted by the tracee already.
+    // when devRandomPthread is not ready: the tracee could have exited before
+    // the pthread is created, hence the FifoPath might have be deleted by the
+    // tracee already.
+    // Before it runs, so everything it forks is born in there too.
+    unique_ptr<jobCgroup> cgroup;
+    if (!args->cgroup.empty()) {
+      cgroup = make_unique<jobCgroup>(
+          args->cgroup, args->cgroupCpus, args->cgroupMemory);
+      cgroup->add(pid);
+      globalJobCgroup = cgroup.get();
+    }
+
     int ready = 1;
     doWithCheck(
         write(pipefds[1], (const void*)&ready, sizeof(int)),
         "spawnTracerTracee, pipe write");
 
+    if (cloneArgs->zygoteControl != -1) {
+      close(zygoteJob[1]);
+      // Parked until a job comes, the tracee sets its mounts up meanwhile.
+      dettraceJob job;
+      if (!receiveJob(cloneArgs->zygoteControl, job)) {
+        kill(pid, SIGKILL);
+        return 1;
+      }
+      jobStart = chrono::steady_clock::now();
+      close(cloneArgs->zygoteControl);
+      if (job.cpu != -1) {
+        pinToCpu(0, job.cpu);
+        pinToCpu(pid, job.cpu);
+      }
+      for (int fd = 0; fd < 3; fd++) {
+        doWithCheck(dup2(job.fds[fd], fd), "dup2 job standard stream");
+      }
+      if (!sendJob(zygoteJob[0], job)) {
+        kill(pid, SIGKILL);
+        return 1;
+      }
+      for (int fd : job.fds) {
+        close(fd);
+      }
+      close(zygoteJob[0]);
+    }
+
+    bool virtualDevRandom = args->with_devrand_overrides && !args->prngCompat;
     execution exe{
         args->debugLevel,      pid,
         args->useColor,        args->logFile,
         args->printStatistics, devRandomPthread,
-        devUrandomPthread,     cloneArgs->vdsoSyms,
+        cloneArgs->vdsoSyms,
         args->prng_seed,       args->allow_network,
         args->epoch,           args->clock_step,
+        args->scratchSize,     args->seccompNotify,
+        args->traceFile,       args->parallel,
+        args->lite,            args->preemptBranches, args->inodeSnapshot,
+        args->snapshotFingerprint, virtualDevRandom, args->prngCompat,
+        args->statsJson,       args->timeline,
+        args->trapProfile,     args->trapProfileEvery,
+        args->inputLog,        args->replayInputs,
+        args->schedule,        args->useSchedule,
+        args->execCache,       args->dependencies,
+        args->hashOutputs,     args->traceStream,
+        args->suggestProfile,  syntheticFileSources(*args),
+        args->pinTracerCpu,    args->pinTraceeCpu,
+        args->spinWaitMicros,  args->clockOrder,
+        args->vectorClocks,    args->logFilter,
+        args->liveStats,       args->watchdogRounds,
+        args->hardwareCounters, args->helperThreads,
+        args->producerFirst,   args->checkpointAt,
+        args->checkpointRuns,  args->remoteExec,
+        args->execCacheRemote, args->pipeSize,
+        args->cpus,            args->fakeroot,
+        args->logShards,
     };
 
     globalExeObject = &exe;
@@ -705,17 +1528,65 @@ int spawnTracerTracee(void* voidArgs) {
     doWithCheck(sigaction(SIGALRM, &sa, NULL), "sigaction(SIGALRM)");
     alarm(args->timeoutSeconds);
 
+    int64_t setupTime = microsecondsSince(jobStart);
+    auto runStart = chrono::steady_clock::now();
     int exit_code = exe.runProgram();
+    int64_t runTime = microsecondsSince(runStart);
+    // The original run cleans up after every restore, once.
+    if (exe.isRestoredRun()) {
+      return exit_code;
+    }
+    if (args->forkServerFd != -1) {
+      // Serves until killed, however long its runs take.
+      alarm(0);
+      exe.serveRestores(args->forkServerFd, args->args);
+    }
 
     // do exra house keeping.
+    auto teardownStart = chrono::steady_clock::now();
     doTracerCleanup(true, std::move(cloneArgs->tmpdir));
+    if (args->printStatistics) {
+      string preStr = "dettrace Statistic. ";
+      const pair<const char*, int64_t> phases[] = {
+          {"option parse", times.optionParse},
+          {"vdso parse", times.vdsoParse},
+          {"namespace clone", times.namespaceClone},
+          {"mounts", times.mounts},
+          {"/dev nodes", times.devNodes},
+          {"fifo threads", times.fifoThreads},
+          {"seccomp build", times.seccompBuild},
+          {"seccomp load", times.seccompLoad},
+          {"first exec", times.firstExec},
+      };
+      for (auto& phase : phases) {
+        cerr << preStr + "startup " + phase.first +
+                " (us): " + to_string(phase.second)
+             << endl;
+      }
+      cerr << preStr + "startup (json): " + times.toJson() << endl;
+      cerr << preStr + "job setup (us): " + to_string(setupTime) << endl;
+      cerr << preStr + "job run (us): " + to_string(runTime) << endl;
+      cerr << preStr + "tracer teardown (us): " +
+              to_string(microsecondsSince(teardownStart))
+           << endl;
+      if (cgroup != nullptr) {
+        for (auto& total : cgroup->totals()) {
+          cerr << preStr + total.first + ": " + to_string(total.second)
+               << endl;
+        }
+      }
+    }
     return exit_code;
   } else if (pid == 0) {
     int ready = 0;
     doWithCheck(
         read(pipefds[0], &ready, sizeof(int)), "spawnTracerTracee, pipe read");
     assert(ready == 1);
-    return runTracee(args);
+    if (zygoteJob[0] != -1) {
+      close(zygoteJob[0]);
+      close(cloneArgs->zygoteControl);
+    }
+    return runTracee(args, zygoteJob[1]);
   }
   return -1;
 }
@@ -791,8 +1662,16 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       "Use this string to seed to the PRNG that is used to supply all "
       "randomness accessed by the guest. This affects both /dev/[u]random and "
       "system calls that create randomness. (The rdrand instruction is disabled for "
-      "the guest.) The default PRNG seed is `4660`. ",
+      "the guest.) Each process and thread gets its own getrandom() stream, derived "
+      "from the seed and its place in the process tree, so its bytes don't depend "
+      "on what others drew. The default PRNG seed is `4660`. ",
       cxxopts::value<unsigned int>())
+    ( "prng-compat",
+      "Generate /dev/[u]random and getrandom() bytes with the 16-bit PRNG, /dev/[u]random "
+      "2 bytes at a time, as older versions of dettrace did, from one stream shared by "
+      "every process, instead of in 64 KiB blocks of a 64-bit PRNG served by the "
+      "tracer. Only needed to reproduce runs of those versions. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
     ( "base-env",
       "empty|minimal|host (default is minimal). "
       "The base environment that is set before adding additions via --env. "
@@ -819,6 +1698,13 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       "The syntax of the argument is `hostdir:targetdir`. "
       "The `targetdir` mount point must already exist.",
       cxxopts::value<std::vector<std::string>>())
+    ( "overlay",
+      "Show a read-only base directory at a target directory, the syntax is "
+      "`basedir:targetdir` like --volume's. Writes go to a tmpfs of this run "
+      "and are gone with it: parallel runs over one base share its pages in the "
+      "page cache and start without copying it. Needs overlayfs in user "
+      "namespaces (Linux 5.11).",
+      cxxopts::value<std::vector<std::string>>())
     ( "w,workdir",
       "Specify working directory (CWD) dettrace should use. "
       "default it is host's `$PWD`.",
@@ -853,7 +1739,8 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       "By default, networking is disallowed inside the guest, as it is generally "
       "non-reproducible. This flag allows networking syscalls like "
       "socket/send/recv, which become additional implicit inputs to the guest "
-      "computation.",
+      "computation. Blocking reads of TCP sockets are done by dettrace and return "
+      "as much as was asked for, up to 1 MiB, however the data arrives.",
       cxxopts::value<bool>()->default_value("false"))
     ( "real-proc",
       "When set, the program can access the full, nondeterministic /proc and /dev "
@@ -861,6 +1748,66 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       "presented in these paths instead. This overlay presents a canonical virtual "
       "hardware platform to the application.",
       cxxopts::value<bool>()->default_value("false"))
+    ( "record-inputs",
+      "Path to record the inputs --network and --real-proc let in to: what reads of "
+      "remote sockets and of /proc return, and the results of connect, send and poll "
+      "on remote sockets. The log is compressed. ",
+      cxxopts::value<std::string>())
+    ( "replay-inputs",
+      "Path of a --record-inputs log to serve those inputs from, without touching the "
+      "network. Implies --network, pass the other options the run was recorded with. ",
+      cxxopts::value<std::string>())
+    ( "record-schedule",
+      "Path to record the scheduler's decisions to, and which of them only retried a "
+      "system call that blocked again. ",
+      cxxopts::value<std::string>())
+    ( "use-schedule",
+      "Path of a --record-schedule log of the same command with the same inputs. Skips "
+      "the retries it found futile, and schedules as usual from the first decision "
+      "that differs. ",
+      cxxopts::value<std::string>())
+    ( "exec-cache",
+      "Directory to cache whole execs in. Each exec that exits with status 0 after "
+      "only reading and writing files has its outputs stored, keyed on its argv, env, "
+      "cwd and executable. Later execs with the same key and unchanged input files "
+      "get the outputs restored instead of running. ",
+      cxxopts::value<std::string>())
+    ( "exec-cache-remote",
+      "Share the --exec-cache with other machines through an HTTP store at this url, "
+      "http://HOST[:PORT][/PREFIX], taking GET, HEAD and PUT of entries/KEY and "
+      "blobs/HASH under it. Entries missing from the local cache are fetched from it, "
+      "entries stored locally are stored there too.",
+      cxxopts::value<std::string>())
+    ( "remote-exec",
+      "Experimental: hand exec cache misses to this shell command first, to run them "
+      "on another machine. It gets a job file with the exec's exe, cwd, argv, env and "
+      "the inputs it read last time as $1 and the cache directory as $2, and exits "
+      "with 0 once it put an entry for the job's key in the cache. The exec is then "
+      "restored from it, or runs here if it did not. Needs --exec-cache.",
+      cxxopts::value<std::string>())
+    ( "dependencies",
+      "Path to write, as JSON once the run is over, the files each exec read and "
+      "hashes of their contents. ",
+      cxxopts::value<std::string>())
+    ( "hash-outputs",
+      "Path to write, as JSON once the run is over, a hash of everything written to "
+      "stdout, stderr and each file. Two runs of a deterministic program write the "
+      "same hashes. ",
+      cxxopts::value<std::string>())
+    ( "io-uring",
+      "Let tracees use io_uring rather than fail io_uring_setup with ENOSYS. Rings "
+      "run reads, writes, fsyncs, fallocates, fadvises and NOPs on regular files, one "
+      "after the other, and complete them before io_uring_enter returns, with CQEs in "
+      "submission order. Other SQEs fail with EACCES. Requires Linux 5.10, cannot be "
+      "combined with --parallel, --lite, --exec-cache, --dependencies or "
+      "--hash-outputs. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "ephemeral",
+      "Nothing the tracee writes needs to survive a crash of the machine, e.g. "
+      "a build in a throwaway container: fsync, fdatasync, sync, syncfs, "
+      "sync_file_range and msync with MS_SYNC return success without flushing "
+      "anything, and without a stop. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
     ( "aslr",
       "Enable Address Space Layout Randomization. ASLR is disabled by default "
       "as it is intrinsically a source of nondeterminism.",
@@ -893,7 +1840,56 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       cxxopts::value<int>()->default_value("0"))
     ( "log-file",
       "Path to write log to. If writing to a file, the filename "
-      "has a unique suffix appended. The default is stderr. ",
+      "has a unique suffix appended. A name ending in .gz is written gzip "
+      "compressed, the suffix going before the .gz. The default is stderr. ",
+      cxxopts::value<std::string>())
+    ( "log-filter",
+      "Only log what matches all of these space separated terms, to debug one part of "
+      "a run at --debug 5: pid=N,.. threads or thread groups, exe=GLOB,.. processes "
+      "that execed a matching path, syscall=NAME,.. those system calls, time=A-B "
+      "logical microseconds since the epoch, entry=A-B log entry ids (hex). Filtered "
+      "out messages keep their entry ids, so logs stay comparable across runs. ",
+      cxxopts::value<std::string>())
+    ( "log-shards",
+      "Write what is logged about each thread group to a file of its own, the "
+      "--log-file's name followed by .PID, stamped with logical times. "
+      "dettrace-log-merge puts them back in order. Needs a --log-file not ending "
+      "in .gz. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "trace-file",
+      "Path to write a compact binary trace of every system call, signal, fork, "
+      "exec and exit to. Much cheaper than --debug, read it back with "
+      "dettrace-trace. ",
+      cxxopts::value<std::string>())
+    ( "trace-stream",
+      "File descriptor of a pipe to stream the same trace to as the run goes, used "
+      "by dettrace-trace check. ",
+      cxxopts::value<int>())
+    ( "stats-json",
+      "Path to write the --print-statistics counters to as JSON, along with pre and "
+      "post hooks, replays, injected system calls and tracer time per system call and "
+      "per process. ",
+      cxxopts::value<std::string>())
+    ( "live-stats",
+      "Path of a file to keep the --print-statistics counters and system call counts "
+      "in as the run goes, updated every 200ms or so. Watch it with dettrace-top. ",
+      cxxopts::value<std::string>())
+    ( "timeline",
+      "Path to write a timeline of the run to, as a Chrome trace that chrome://tracing "
+      "and ui.perfetto.dev open: when each tracee ran and was blocked, replays, "
+      "injected system calls, hooks and logical clocks. ",
+      cxxopts::value<std::string>())
+    ( "trap-profile",
+      "Path to write the tracee stacks that stop for system calls, rdtsc and cpuid to, "
+      "as folded stacks for flamegraph.pl. Frames are module+offset. ",
+      cxxopts::value<std::string>())
+    ( "trap-profile-every",
+      "With --trap-profile, only walk the stack of every Nth trap. The default is `1`.",
+      cxxopts::value<unsigned>()->default_value("1"))
+    ( "inode-snapshot",
+      "Start from the inode numbers and file modification times saved in this file, and "
+      "save them back to it at exit, so repeated runs over the same tree see the same "
+      "virtual inodes. Ignored if it was saved for another chroot or working directory. ",
       cxxopts::value<std::string>())
     ( "with-color",
       "Allow use of ANSI colors in log output. Useful when piping log to a file. The default is `true`. ",
@@ -916,14 +1912,180 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     ( "convert-uids",
       "Some programs attempt to use UIDs not mapped in our namespace. Catch "
       "this behavior for lchown, chown, fchown, fchowat, and dynamically change the UIDS to "
-      "0 (root). The default is `false`.",
+      "0 (root). Calls already giving 0 for both never stop. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "fakeroot",
+      "Do what fakeroot does, in the tracer: chown and its family succeed for "
+      "any owner and group, and stat then reports them, as it reports the mode "
+      "of a chmod. Builds run under fakeroot no longer need its faked. Cannot "
+      "be combined with --convert-uids. The default is `false`.",
       cxxopts::value<bool>()->default_value("false"))
     ( "timeoutSeconds",
       "Tear down all tracee processes with SIGKILL after this many seconds. The default is `0` (i.e., indefinite).",
       cxxopts::value<unsigned long>()->default_value("0"))
+    ( "cgroup",
+      "Run the job's tracees in a cgroup of their own under DIR, a cgroup v2 "
+      "directory delegated to us. --print-statistics then reports its cpu.stat, "
+      "memory.peak and io.stat, and a --timeoutSeconds kills its processes at once. "
+      "The default is `none`.",
+      cxxopts::value<std::string>())
+    ( "cgroup-cpus",
+      "Let the job's tracees use at most N CPUs of time at once, N may be a "
+      "fraction. Needs --cgroup, and the cpu controller in its DIR. The default "
+      "is `0`, no limit.",
+      cxxopts::value<double>()->default_value("0"))
+    ( "cgroup-memory",
+      "Let the job's tracees use at most BYTES of memory. Needs --cgroup, and the "
+      "memory controller in its DIR. The default is `0`, no limit.",
+      cxxopts::value<uint64_t>()->default_value("0"))
     ( "rnr",
-      "provide an optional record and replay dynamic shared object to run during syscall enter/exit.",
+      "provide an optional record and replay dynamic shared object to run during syscall enter/exit. "
+      "See include/rnr_plugin.h for the plugin interface.",
       cxxopts::value<std::string>()->default_value(""))
+    ( "scratch-size",
+      "Size in bytes of the scratch memory shared between dettrace and every tracee, "
+      "used to pass modified system call arguments. Rounded up to a whole page. "
+      "Threads and forked children get a page of it each while there are enough. "
+      "The default is `65536`.",
+      cxxopts::value<unsigned long>())
+    ( "seccomp-notify",
+      "Service system calls that only need their arguments inspected through a seccomp "
+      "notify fd instead of ptrace stops. Requires Linux 5.6 and libseccomp 2.5. "
+      "Cannot be combined with --rnr. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "preempt-branches",
+      "Preempt a tracee that ran this many conditional branches without making a system "
+      "call, so busy-waiting tracees can't starve the others. Needs hardware performance "
+      "counters, without them this is ignored. The default is `0`, never preempt.",
+      cxxopts::value<unsigned long>()->default_value("0"))
+    ( "parallel",
+      "Experimental: let tracees run at the same time, only system calls, signals and "
+      "exits are handled one at a time, in a deterministic order. Threads of a process "
+      "still take turns. Requires Linux 4.8, cannot be combined with --seccomp-notify. "
+      "The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "lite",
+      "Only determinize time, randomness, inodes, mtimes and directory listings, for "
+      "near native speed: like --parallel, but events are handled in whatever order "
+      "tracees stop with them, threads run side by side, and waits, futexes, polls, "
+      "pipes and sockets run in the kernel unhooked. Output that depends on the order "
+      "processes or threads run in is not reproducible. Same restrictions as "
+      "--parallel. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "clock-order",
+      "Run tracees in order of their logical clocks, the one furthest behind first, "
+      "instead of the highest pid first. --parallel always commits events in logical "
+      "clock order. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "producer-first",
+      "When a tracee blocks on a pipe, run whoever last fed that pipe next, rather "
+      "than the highest pid, so pipelines replay fewer blocked reads and writes. Not "
+      "used with --parallel. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "pipe-size",
+      "Give every pipe tracees create room for BYTES, rounded up to a power of "
+      "two pages, instead of the kernel's default. Writers then block, and the "
+      "scheduler switches, less often, and F_GETPIPE_SZ reports the same size on "
+      "every machine. At most /proc/sys/fs/pipe-max-size. Cannot be combined with "
+      "--lite. The default is `0`, the kernel's default.",
+      cxxopts::value<int>()->default_value("0"))
+    ( "cpus",
+      "Show tracees a machine of N CPUs, the same on every host: for "
+      "sched_getaffinity, /proc/cpuinfo, /proc/stat, /sys/devices/system/cpu/online "
+      "and cpuid's topology leaves. sched_setaffinity then only checks the mask, "
+      "tracees still run where the host puts them. The default is `0`, the host's "
+      "CPUs.",
+      cxxopts::value<unsigned>()->default_value("0"))
+    ( "vector-clocks",
+      "Track which processes heard of which through pipes, forks and waits with a "
+      "vector clock per process, shown in the --timeline where a read or wait learns "
+      "something new. Cannot be combined with --lite. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "pin",
+      "Run the tracer on cpu TRACER and the tracee it resumes on cpu TRACEE, given as "
+      "`TRACER` or `TRACER,TRACEE`, e.g. two hyperthreads of one core. Every stop goes "
+      "from one to the other, sharing caches makes that faster. Tracees see an "
+      "affinity mask of TRACEE alone. Cannot be combined with --parallel.",
+      cxxopts::value<std::string>())
+    ( "spin-wait",
+      "With --pin on two cpus, poll for the next tracee stop for this many "
+      "microseconds before sleeping until it comes. The default is `0`, never poll.",
+      cxxopts::value<unsigned>()->default_value("0"))
+    ( "watchdog",
+      "Report stalls: when this many rounds of retrying blocked tracees in a row made "
+      "progress on fewer than 1 in 100 retries, print each tracee's queue, what it "
+      "waits for, the system call it keeps replaying and who else holds its fd open. "
+      "The default is `0`, never.",
+      cxxopts::value<unsigned>()->default_value("0"))
+    ( "hardware-counters",
+      "Count cycles, instructions and context switches of the tracer and of every "
+      "tracee, and print how the cycles split between the tracees' code, the kernel "
+      "and the tracer with --print-statistics. Needs perf_event_paranoid at most 1.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "helper-threads",
+      "Threads hashing files and generating /dev/[u]random bytes while the tracer "
+      "goes on, none of it needs ptrace. Tracees see the same either way, `0` does it "
+      "all on the tracer. The default is `2`.",
+      cxxopts::value<unsigned>()->default_value("2"))
+    ( "checkpoint-at",
+      "Checkpoint the run the first time its tracee gets to this marker, "
+      "`syscall:NAME`, e.g. `syscall:accept4`, or `open:PATH`, e.g. "
+      "`open:input.txt`. System calls let through by seccomp are never seen. The "
+      "tracee must be a single thread then, or the next time it gets there is "
+      "tried. Runs restored with --checkpoint-runs start from there instead of from "
+      "the start, sharing the file system and the tracee's open files.",
+      cxxopts::value<std::string>())
+    ( "checkpoint-runs",
+      "After the run, run it this many times more from the --checkpoint-at "
+      "checkpoint, one after the other. A restored run exiting with another code "
+      "than the run is reported. The default is `0`.",
+      cxxopts::value<unsigned>()->default_value("0"))
+    ( "fork-server",
+      "Once the run is over, serve runs from its --checkpoint-at checkpoint on a unix "
+      "socket at this path, until killed. Each `dettrace --connect PATH` with the "
+      "same program and arguments runs from the checkpoint with the client's stdin, "
+      "stdout and stderr, which must be files, pipes or terminals, and exits as that "
+      "run did. Startup up to the marker is not repeated.",
+      cxxopts::value<std::string>())
+    ( "profile",
+      "Narrow the system calls dettrace intercepts for a kind of workload: a profile "
+      "installed with dettrace by name, e.g. `compile`, or the path of a profile file. "
+      "Each line of one is a system call and `allow`, `intercept` or `errno` and an "
+      "errno. A profile allowing a system call a workload does need determinized makes "
+      "its output nondeterministic.",
+      cxxopts::value<std::string>())
+    ( "suggest-profile",
+      "Write the narrowest profile that is safe for this run to this file when it ends: "
+      "the system calls it made whose outcome dettrace never had to change are allowed.",
+      cxxopts::value<std::string>())
+    ( "server",
+      "Run as a server listening on this unix socket, running the jobs `dettrace "
+      "--connect` sends it. The next job's namespaces are set up while the last "
+      "one runs. Its other flags are the namespace flags of those jobs.",
+      cxxopts::value<std::string>())
+    ( "connect",
+      "Have the dettrace --server listening on this unix socket run the program, "
+      "with our arguments, environment, working directory and standard streams.",
+      cxxopts::value<std::string>())
+    ( "pool",
+      "With --server, keep this many tracers set up with tracees parked right before "
+      "exec, for jobs whose flags are the server's. The program, its arguments, "
+      "environment and working directory may differ. The default is `0`.",
+      cxxopts::value<unsigned>()->default_value("0"))
+    ( "server-cores",
+      "With --server, run at most N jobs at once, each with its tracer and tracees "
+      "pinned to a core of its own, spread over NUMA nodes. Jobs past that wait "
+      "for one to finish. The default is `0`, no limit, unless --server-memory.",
+      cxxopts::value<unsigned>()->default_value("0"))
+    ( "server-memory",
+      "With --server, only run as many jobs at once as fit in BYTES, each "
+      "counted as --job-memory, and each on a core of its own. The default is "
+      "`0`, no limit.",
+      cxxopts::value<uint64_t>()->default_value("0"))
+    ( "job-memory",
+      "Memory a job's tracees are counted as for --server-memory. The default "
+      "is `0`.",
+      cxxopts::value<uint64_t>()->default_value("0"))
     ( "program",
       "program to run",
       cxxopts::value<std::string>())
@@ -958,21 +2120,162 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
         (static_cast<OptionValue1>(result["with-color"])).unwrap_or(false);
     args.logFile =
         (static_cast<OptionValue1>(result["log-file"])).unwrap_or(emptyString);
+    if (result["log-filter"].count()) {
+      args.logFilter = result["log-filter"].as<std::string>();
+      // Bad terms are reported now, not once the tracer is running.
+      logFilter::parse(args.logFilter);
+    }
+    args.logShards = result["log-shards"].as<bool>();
+    if (args.logShards &&
+        (args.logFile.empty() ||
+         (args.logFile.size() > 3 &&
+          args.logFile.compare(args.logFile.size() - 3, 3, ".gz") == 0))) {
+      runtimeError("--log-shards requires a --log-file not ending in .gz.");
+    }
+    args.traceFile = (static_cast<OptionValue1>(result["trace-file"]))
+                         .unwrap_or(emptyString);
+    if (result["trace-stream"].count()) {
+      args.traceStream = result["trace-stream"].as<int>();
+      // The tracer keeps it, the tracee mustn't inherit it.
+      doWithCheck(
+          fcntl(args.traceStream, F_SETFD, FD_CLOEXEC),
+          "--trace-stream: bad file descriptor " +
+              to_string(args.traceStream));
+    }
+    args.statsJson = (static_cast<OptionValue1>(result["stats-json"]))
+                         .unwrap_or(emptyString);
+    args.liveStats = (static_cast<OptionValue1>(result["live-stats"]))
+                         .unwrap_or(emptyString);
+    args.timeline =
+        (static_cast<OptionValue1>(result["timeline"])).unwrap_or(emptyString);
+    args.trapProfile = (static_cast<OptionValue1>(result["trap-profile"]))
+                           .unwrap_or(emptyString);
+    args.trapProfileEvery =
+        (static_cast<OptionValue1>(result["trap-profile-every"])).unwrap_or(1U);
+    if (result["record-inputs"].count() && result["replay-inputs"].count()) {
+      runtimeError("--record-inputs and --replay-inputs are exclusive.");
+    }
+    if (result["record-inputs"].count()) {
+      args.inputLog = result["record-inputs"].as<std::string>();
+    }
+    if (result["replay-inputs"].count()) {
+      args.inputLog = result["replay-inputs"].as<std::string>();
+      args.replayInputs = true;
+    }
+    if (result["record-schedule"].count() && result["use-schedule"].count()) {
+      runtimeError("--record-schedule and --use-schedule are exclusive.");
+    }
+    if (result["record-schedule"].count()) {
+      args.schedule = result["record-schedule"].as<std::string>();
+    }
+    if (result["use-schedule"].count()) {
+      args.schedule = result["use-schedule"].as<std::string>();
+      args.useSchedule = true;
+    }
+    args.execCache = (static_cast<OptionValue1>(result["exec-cache"]))
+                         .unwrap_or(emptyString);
+    args.dependencies = (static_cast<OptionValue1>(result["dependencies"]))
+                            .unwrap_or(emptyString);
+    args.hashOutputs = (static_cast<OptionValue1>(result["hash-outputs"]))
+                           .unwrap_or(emptyString);
+    // Outputs the cache restores are never written by a tracee.
+    if (!args.execCache.empty() && !args.hashOutputs.empty()) {
+      runtimeError("--exec-cache cannot be combined with --hash-outputs.");
+    }
+    args.ioUring = result["io-uring"].as<bool>();
+    args.ephemeral = result["ephemeral"].as<bool>();
+    if (args.ioUring) {
+      // Ring reads and writes never stop the tracee for them to see.
+      if (!args.execCache.empty() || !args.dependencies.empty() ||
+          !args.hashOutputs.empty()) {
+        runtimeError(
+            "--io-uring cannot be combined with --exec-cache, --dependencies "
+            "or --hash-outputs.");
+      }
+      // Others sharing a ring would see its CQEs before we order them.
+      if (result["parallel"].as<bool>() || result["lite"].as<bool>()) {
+        runtimeError(
+            "--io-uring cannot be combined with --parallel or --lite.");
+      }
+      if (kernelCheck(5, 10, 0) || !ioUring::supported()) {
+        runtimeError(
+            "--io-uring requires Linux 5.10 or newer, with io_uring enabled.");
+      }
+    }
+    args.remoteExec = (static_cast<OptionValue1>(result["remote-exec"]))
+                          .unwrap_or(emptyString);
+    if (!args.remoteExec.empty() && args.execCache.empty()) {
+      runtimeError("--remote-exec needs --exec-cache.");
+    }
+    args.execCacheRemote =
+        (static_cast<OptionValue1>(result["exec-cache-remote"]))
+            .unwrap_or(emptyString);
+    if (!args.execCacheRemote.empty()) {
+      remoteCache::url url;
+      if (args.execCache.empty()) {
+        runtimeError("--exec-cache-remote needs --exec-cache.");
+      }
+      if (!remoteCache::parseUrl(args.execCacheRemote, url)) {
+        runtimeError(
+            "--exec-cache-remote expects http://HOST[:PORT][/PREFIX], got: " +
+            args.execCacheRemote);
+      }
+    }
+    args.server =
+        (static_cast<OptionValue1>(result["server"])).unwrap_or(emptyString);
+    args.connect =
+        (static_cast<OptionValue1>(result["connect"])).unwrap_or(emptyString);
+    args.pool = (static_cast<OptionValue1>(result["pool"])).unwrap_or(0U);
+    args.serverCores = result["server-cores"].as<unsigned>();
+    args.serverMemory = result["server-memory"].as<uint64_t>();
+    args.jobMemory = result["job-memory"].as<uint64_t>();
+    if (args.server.empty() &&
+        (args.serverCores != 0 || args.serverMemory != 0)) {
+      runtimeError("--server-cores and --server-memory need --server.");
+    }
+    if (args.serverMemory != 0 && args.jobMemory == 0) {
+      runtimeError("--server-memory needs the --job-memory of a job.");
+    }
     args.printStatistics =
         (static_cast<OptionValue1>(result["print-statistics"]))
             .unwrap_or(false);
     args.convertUids =
         (static_cast<OptionValue1>(result["convert-uids"])).unwrap_or(false);
+    args.fakeroot = result["fakeroot"].as<bool>();
+    if (args.fakeroot && args.convertUids) {
+      runtimeError("--fakeroot cannot be combined with --convert-uids.");
+    }
     args.timeoutSeconds =
         (static_cast<OptionValue1>(result["timeoutSeconds"])).unwrap_or(0);
+    args.cgroup =
+        (static_cast<OptionValue1>(result["cgroup"])).unwrap_or(emptyString);
+    args.cgroupCpus = result["cgroup-cpus"].as<double>();
+    args.cgroupMemory = result["cgroup-memory"].as<uint64_t>();
+    if (args.cgroup.empty() &&
+        (args.cgroupCpus != 0 || args.cgroupMemory != 0)) {
+      runtimeError("--cgroup-cpus and --cgroup-memory need --cgroup.");
+    }
+    if (args.cgroupCpus < 0) {
+      runtimeError("--cgroup-cpus expects a number of CPUs.");
+    }
+    if (!args.cgroup.empty()) {
+      char* resolved = realpath(args.cgroup.c_str(), nullptr);
+      if (resolved == nullptr) {
+        runtimeError("--cgroup " + args.cgroup + ": " + strerror(errno));
+      }
+      args.cgroup = resolved;
+      free(resolved);
+    }
     args.allow_network =
-        (static_cast<OptionValue1>(result["network"])).unwrap_or(false);
+        (static_cast<OptionValue1>(result["network"])).unwrap_or(false) ||
+        args.replayInputs;
     args.with_aslr =
         (static_cast<OptionValue1>(result["aslr"])).unwrap_or(false);
     auto use_real_proc = result["real-proc"].as<bool>(); // must have default!
     auto base_env = result["base-env"].as<std::string>();
     args.prng_seed =
         (static_cast<OptionValue1>(result["prng-seed"])).unwrap_or(0x1234);
+    args.prngCompat = result["prng-compat"].as<bool>();
 
     char* cwd = get_current_dir_name();
     string host_cwd(cwd);
@@ -980,6 +2283,31 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     args.workdir =
         (static_cast<OptionValue1>(result["workdir"])).unwrap_or(host_cwd);
 
+    if (result["inode-snapshot"].count()) {
+      args.inodeSnapshot = result["inode-snapshot"].as<std::string>();
+      // The tracer doesn't stay in this directory.
+      if (args.inodeSnapshot[0] != '/') {
+        args.inodeSnapshot = host_cwd + "/" + args.inodeSnapshot;
+      }
+    }
+
+    if (result["profile"].count()) {
+      args.profile = policyProfile::resolve(
+          result["profile"].as<std::string>(), getExePath() + "/../profiles");
+      if (args.profile[0] != '/') {
+        args.profile = host_cwd + "/" + args.profile;
+      }
+      // Read now, the tracee builds its filter inside the chroot.
+      args.profileRules = std::make_shared<policyProfile>(
+          policyProfile::load(args.profile));
+    }
+    if (result["suggest-profile"].count()) {
+      args.suggestProfile = result["suggest-profile"].as<std::string>();
+      if (args.suggestProfile[0] != '/') {
+        args.suggestProfile = host_cwd + "/" + args.suggestProfile;
+      }
+    }
+
     // userns|pidns|mountns default vaules are true
     bool host_userns =
         (static_cast<OptionValue1>(result["host-userns"])).unwrap_or(false);
@@ -1031,12 +2359,180 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       base_env = "host";
     }
 
+    if (result["scratch-size"].count()) {
+      const size_t pageSize = 4096;
+      size_t size = result["scratch-size"].as<unsigned long>();
+      if (size == 0) {
+        runtimeError("--scratch-size must be greater than zero.");
+      }
+      args.scratchSize = (size + pageSize - 1) / pageSize * pageSize;
+    }
+
+    args.preemptBranches = result["preempt-branches"].as<unsigned long>();
+
+    if (result["pin"].count()) {
+      string pin = result["pin"].as<std::string>();
+      char* end = nullptr;
+      long tracer = strtol(pin.c_str(), &end, 10);
+      long tracee = tracer;
+      if (*end == ',') {
+        tracee = strtol(end + 1, &end, 10);
+      }
+      if (pin.empty() || *end != '\0' || tracer < 0 || tracee < 0 ||
+          tracer >= CPU_SETSIZE || tracee >= CPU_SETSIZE) {
+        runtimeError("--pin expects a cpu or two, e.g. 2 or 2,3: " + pin);
+      }
+      args.pinTracerCpu = tracer;
+      args.pinTraceeCpu = tracee;
+    }
+    args.spinWaitMicros = result["spin-wait"].as<unsigned>();
+    if (args.spinWaitMicros != 0 &&
+        (args.pinTracerCpu == -1 || args.pinTracerCpu == args.pinTraceeCpu)) {
+      // Polling on the tracee's cpu only keeps it from running.
+      runtimeError("--spin-wait needs --pin on two cpus.");
+    }
+    args.watchdogRounds = result["watchdog"].as<unsigned>();
+    args.hardwareCounters = result["hardware-counters"].as<bool>();
+    args.helperThreads = result["helper-threads"].as<unsigned>();
+
     if (result["rnr"].count() > 0) {
       args.rnr = result["rnr"].as<std::string>();
 
       rnr::loadRnr(args.rnr);
     }
 
+    if (result["seccomp-notify"].as<bool>()) {
+      if (!seccomp::isNotifySupported()) {
+        runtimeError(
+            "--seccomp-notify: dettrace was built without seccomp notify "
+            "support.");
+      }
+      if (kernelCheck(5, 6, 0)) {
+        runtimeError("--seccomp-notify requires Linux 5.6 or newer.");
+      }
+      if (!args.rnr.empty()) {
+        runtimeError("--seccomp-notify cannot be combined with --rnr.");
+      }
+      if (!args.inputLog.empty()) {
+        runtimeError(
+            "--seccomp-notify cannot be combined with --record-inputs or "
+            "--replay-inputs.");
+      }
+      if (!args.execCache.empty()) {
+        runtimeError("--seccomp-notify cannot be combined with --exec-cache.");
+      }
+      args.seccompNotify = true;
+    }
+
+    args.lite = result["lite"].as<bool>();
+    args.clockOrder = result["clock-order"].as<bool>();
+    args.producerFirst = result["producer-first"].as<bool>();
+    args.pipeSize = result["pipe-size"].as<int>();
+    if (args.pipeSize < 0) {
+      runtimeError("--pipe-size expects a number of bytes.");
+    }
+    // Pipes are the kernel's with --lite, we never see them made.
+    if (args.lite && args.pipeSize != 0) {
+      runtimeError("--pipe-size cannot be combined with --lite.");
+    }
+    if (args.pipeSize != 0) {
+      args.pipeSize = checkPipeSize(args.pipeSize);
+    }
+    args.cpus = result["cpus"].as<unsigned>();
+    if (args.cpus > CPU_SETSIZE) {
+      runtimeError(
+          "--cpus expects at most " + to_string(CPU_SETSIZE) + " CPUs.");
+    }
+    args.vectorClocks = result["vector-clocks"].as<bool>();
+    // Pipes and waits run unhooked with --lite, nothing to hear of.
+    if (args.lite && args.vectorClocks) {
+      runtimeError("--vector-clocks cannot be combined with --lite.");
+    }
+    if (result["parallel"].as<bool>() || args.lite) {
+      const string flag = args.lite ? "--lite" : "--parallel";
+      if (kernelCheck(4, 8, 0)) {
+        runtimeError(flag + " requires Linux 4.8 or newer.");
+      }
+      if (args.seccompNotify) {
+        runtimeError(flag + " cannot be combined with --seccomp-notify.");
+      }
+      // Inputs are logged in the order the tracer stops for them, only the
+      // same from run to run when it handles one tracee at a time.
+      if (!args.inputLog.empty()) {
+        runtimeError(
+            flag + " cannot be combined with --record-inputs or "
+                   "--replay-inputs.");
+      }
+      if (!args.schedule.empty()) {
+        runtimeError(
+            flag + " cannot be combined with --record-schedule or "
+                   "--use-schedule.");
+      }
+      if (!args.execCache.empty() || !args.dependencies.empty()) {
+        runtimeError(
+            flag + " cannot be combined with --exec-cache or --dependencies.");
+      }
+      // Tracees writing to the same file at once would hash in whichever
+      // order the tracer got to them.
+      if (!args.hashOutputs.empty()) {
+        runtimeError(flag + " cannot be combined with --hash-outputs.");
+      }
+      // Pinned tracees would all share one cpu.
+      if (args.pinTracerCpu != -1) {
+        runtimeError(flag + " cannot be combined with --pin.");
+      }
+      args.parallel = true;
+    }
+
+    if (result["checkpoint-at"].count()) {
+      args.checkpointAt = result["checkpoint-at"].as<std::string>();
+      checkpoint::parseMarker(args.checkpointAt);
+      // Restores reuse the tracee's pid, and set the last pid of the
+      // namespace back, both need our own pid namespace.
+      if ((args.clone_ns_flags & CLONE_NEWPID) == 0) {
+        runtimeError("--checkpoint-at cannot be combined with --host-pidns.");
+      }
+      if (kernelCheck(4, 8, 0)) {
+        runtimeError("--checkpoint-at requires Linux 4.8 or newer.");
+      }
+      if (args.parallel || args.seccompNotify || !args.rnr.empty() ||
+          args.hardwareCounters || !args.server.empty()) {
+        runtimeError(
+            "--checkpoint-at cannot be combined with --parallel, --lite, "
+            "--seccomp-notify, --rnr, --hardware-counters or --server.");
+      }
+      // The /dev/[u]random fifos are fed by threads of ours fork leaves
+      // behind.
+      if (!args.with_devrand_overrides || args.prngCompat) {
+        runtimeError(
+            "--checkpoint-at cannot be combined with --real-proc or "
+            "--prng-compat.");
+      }
+      // Every run would write the same files.
+      if (!args.traceFile.empty() || !args.timeline.empty() ||
+          !args.trapProfile.empty() || !args.inputLog.empty() ||
+          !args.schedule.empty() || !args.execCache.empty() ||
+          !args.dependencies.empty() || !args.hashOutputs.empty() ||
+          args.traceStream != -1) {
+        runtimeError(
+            "--checkpoint-at cannot be combined with options writing or "
+            "reading a file of the run: --trace-file, --timeline, "
+            "--trap-profile, --record-inputs, --replay-inputs, "
+            "--record-schedule, --use-schedule, --exec-cache, --dependencies, "
+            "--hash-outputs or --trace-stream.");
+      }
+    }
+    args.checkpointRuns = result["checkpoint-runs"].as<unsigned>();
+    if (args.checkpointRuns != 0 && args.checkpointAt.empty()) {
+      runtimeError("--checkpoint-runs needs --checkpoint-at.");
+    }
+    if (result["fork-server"].count()) {
+      args.forkServer = result["fork-server"].as<std::string>();
+      if (args.checkpointAt.empty()) {
+        runtimeError("--fork-server needs --checkpoint-at.");
+      }
+    }
+
     if (result["volume"].count()) {
       auto mounts = result["volume"].as<std::vector<std::string>>();
       for (auto v : mounts) {
@@ -1055,6 +2551,21 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       }
     }
 
+    if (result["overlay"].count()) {
+      for (auto v : result["overlay"].as<std::vector<std::string>>()) {
+        MountPoint mountPoint;
+        auto j = v.find(':');
+        mountPoint.source = v.substr(0, j);
+        mountPoint.target = j == string::npos ? v : v.substr(1 + j);
+        mountPoint.type = "overlay";
+        // Overlayfs mount options are separated by commas.
+        if (mountPoint.source.find(',') != string::npos) {
+          runtimeError("--overlay base directory cannot have a comma: " + v);
+        }
+        args.volume.push_back(mountPoint);
+      }
+    }
+
     if (base_env == "host") {
       extern char** environ;
       for (int i = 0; environ[i]; i++) {
@@ -1102,16 +2613,20 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
 
     args.args.clear();
     if (!result["program"].count()) {
-      std::cout << options.help() << std::endl;
-      exit(1);
-    }
-    args.args.push_back(result["program"].as<std::string>());
+      // A server gets its programs from its jobs.
+      if (args.server.empty()) {
+        std::cout << options.help() << std::endl;
+        exit(1);
+      }
+    } else {
+      args.args.push_back(result["program"].as<std::string>());
 
-    const std::vector<std::string> emptyArgs;
-    auto traceeArgs =
-        (static_cast<OptionValue1>(result["programArgs"])).unwrap_or(emptyArgs);
-    std::copy(
-        traceeArgs.begin(), traceeArgs.end(), std::back_inserter(args.args));
+      const std::vector<std::string> emptyArgs;
+      auto traceeArgs = (static_cast<OptionValue1>(result["programArgs"]))
+                            .unwrap_or(emptyArgs);
+      std::copy(
+          traceeArgs.begin(), traceeArgs.end(), std::back_inserter(args.args));
+    }
 
     if (args.pathToChroot == "") {
       args.pathToChroot = getExePath() + "/../root/";
@@ -1128,6 +2643,11 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       // Treat current enviornment as our chroot.
       args.pathToChroot = "/";
     }
+
+    if (!args.inodeSnapshot.empty()) {
+      args.snapshotFingerprint =
+          snapshotFingerprint({args.pathToChroot, args.workdir});
+    }
   } catch (cxxopts::option_not_exists_exception& e) {
     std::cerr << "command line parsing exception: " << e.what() << std::endl;
     std::cerr << options.help() << std::endl;
@@ -1136,6 +2656,26 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
   return args;
 }
 // =======================================================================================
+/**
+ * Check pipes can be given room for bytes, on a pipe of our own.
+ * @return the size the kernel rounds bytes to
+ */
+static int checkPipeSize(int bytes) {
+  int fds[2];
+  doWithCheck(pipe2(fds, O_CLOEXEC), "Unable to create a pipe");
+  int size = fcntl(fds[0], F_SETPIPE_SZ, bytes);
+  int error = errno;
+  close(fds[0]);
+  close(fds[1]);
+  if (size == -1) {
+    runtimeError(
+        "--pipe-size " + to_string(bytes) +
+        ": unable to resize a pipe: " + strerror(error) +
+        ". See /proc/sys/fs/pipe-max-size.");
+  }
+  return size;
+}
+// =======================================================================================
 /**
  * Use stat to check if file/directory exists to mount.
  * @return boolean if file exists
@@ -1184,6 +2724,36 @@ static void mountDir(const string& source, const string& target) {
       "Unable to bind mount: " + source + " to " + target);
 }
 // =======================================================================================
+/**
+ * Mount base at target as an overlay whose writes go to a tmpfs of our own.
+ */
+static void mountOverlay(const string& base, const string& target) {
+  if (!fileExists(base)) {
+    runtimeError(
+        "Trying to overlay " + base + " => " + target +
+        ". Base directory does not exist.\n");
+  }
+  if (!fileExists(target)) {
+    runtimeError(
+        "Trying to overlay " + base + " => " + target +
+        ". Target directory does not exist.\n");
+  }
+
+  // Unmounted and removed as we return: the overlay holds on to its own clone
+  // of the tmpfs mount, nothing of it is left on the host.
+  TempDir layer("dt-overlay-", true);
+  string upper = layer.path() + "/upper";
+  string work = layer.path() + "/work";
+  doWithCheck(mkdir(upper.c_str(), 0755), "mkdir " + upper);
+  doWithCheck(mkdir(work.c_str(), 0755), "mkdir " + work);
+
+  string options =
+      "lowerdir=" + base + ",upperdir=" + upper + ",workdir=" + work;
+  doWithCheck(
+      mount("overlay", target.c_str(), "overlay", 0, options.c_str()),
+      "Unable to mount overlay: " + base + " on " + target);
+}
+// =======================================================================================
 static void update_map(char* mapping, char* map_file) {
   int fd = open(map_file, O_WRONLY);
   if (fd == -1) {
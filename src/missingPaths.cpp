@@ -0,0 +1,34 @@
+#include "missingPaths.hpp"
+
+// =======================================================================================
+int missingPaths::find(const string& path) const {
+  auto it = paths.find(path);
+  return it == paths.end() ? 0 : it->second.err;
+}
+// =======================================================================================
+void missingPaths::insert(
+    const string& path, int err, dev_t device, ino_t inode) {
+  if (paths.size() >= maxPaths) {
+    clear();
+  }
+  auto directory = make_pair(device, inode);
+  if (paths.emplace(path, entry{err, directory}).second) {
+    byDirectory[directory].push_back(path);
+  }
+}
+// =======================================================================================
+void missingPaths::created(dev_t device, ino_t inode) {
+  auto it = byDirectory.find(make_pair(device, inode));
+  if (it == byDirectory.end()) {
+    return;
+  }
+  for (const string& path : it->second) {
+    paths.erase(path);
+  }
+  byDirectory.erase(it);
+}
+// =======================================================================================
+void missingPaths::clear() {
+  paths.clear();
+  byDirectory.clear();
+}
@@ -0,0 +1,99 @@
+#include "outputHasher.hpp"
+
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "systemCallList.hpp"
+#include "util.hpp"
+#include "utilSystemCalls.hpp"
+
+// =======================================================================================
+outputHasher::outputHasher(const string& path) : path(path) {
+  // Check now rather than lose the manifest at the end of the run.
+  ofstream out(path);
+  if (!out) {
+    runtimeError("Unable to open output hash manifest " + path);
+  }
+}
+// =======================================================================================
+outputHasher::~outputHasher() {
+  ofstream out(path);
+  out << "{";
+  const char* comma = "";
+  for (auto& output : outputs) {
+    out << comma << "\n  " << jsonString(output.first) << ": {\"hash\": \""
+        << output.second.hex() << "\", \"bytes\": " << output.second.size
+        << "}";
+    comma = ",";
+  }
+  out << "\n}\n";
+}
+// =======================================================================================
+string outputHasher::outputOf(state& s, int fd) {
+  if (s.getFdType(fd) == fdType::regular) {
+    return traceeFdPath(s.traceePid, fd);
+  }
+  // Whatever the tracer's stdout and stderr are, a terminal's name or a pipe's
+  // inode differ from run to run.
+  switch (fd) {
+  case STDOUT_FILENO:
+    return "<stdout>";
+  case STDERR_FILENO:
+    return "<stderr>";
+  default:
+    return "";
+  }
+}
+// =======================================================================================
+void outputHasher::systemCall(state& s, ptracer& t, int syscallNum) {
+  if (syscallNum != SYS_write && syscallNum != SYS_writev) {
+    return;
+  }
+  int64_t written = t.getReturnValue();
+  if (written <= 0) {
+    return;
+  }
+  string output = outputOf(s, t.arg1());
+  if (output.empty()) {
+    return;
+  }
+
+  buffer.resize(written);
+  vector<traceeIo> reads;
+  if (syscallNum == SYS_write) {
+    reads.emplace_back(
+        traceePtr<char>((char*)t.arg2()), buffer.data(), written);
+  } else {
+    int iovcnt = min<int>(t.arg3(), IOV_MAX);
+    struct iovec iov[IOV_MAX];
+    t.readTraceeBatch(
+        {traceeIo(
+            traceePtr<struct iovec>((struct iovec*)t.arg2()), iov,
+            iovcnt * sizeof(struct iovec))},
+        s.traceePid);
+    // The kernel fills the buffers in order, the last one maybe partly.
+    uint64_t offset = 0;
+    for (int i = 0; i < iovcnt && offset < (uint64_t)written; i++) {
+      size_t n = min<uint64_t>(iov[i].iov_len, written - offset);
+      reads.emplace_back(
+          traceePtr<char>((char*)iov[i].iov_base), buffer.data() + offset, n);
+      offset += n;
+    }
+  }
+  t.readTraceeBatch(reads, s.traceePid);
+  outputs[output].add(buffer.data(), written);
+  bytesHashed += written;
+}
+// =======================================================================================
+void outputHasher::wrote(state& s, int fd, const char* data, size_t n) {
+  string output = outputOf(s, fd);
+  if (output.empty()) {
+    return;
+  }
+  outputs[output].add(data, n);
+  bytesHashed += n;
+}
+// =======================================================================================
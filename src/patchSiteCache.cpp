@@ -0,0 +1,93 @@
+#include "patchSiteCache.hpp"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <fstream>
+
+#include "util.hpp"
+
+/** First line of a saved cache, bump the number when lines change. */
+static const string cacheHeader = "dettrace-patch-sites 1";
+
+// =======================================================================================
+bool patchSiteCache::load(const string& path) {
+  ifstream in(path);
+  string header;
+  if (!getline(in, header) || header != cacheHeader) {
+    return false;
+  }
+  fileIdentity file;
+  unsigned kind;
+  uint64_t offset;
+  while (in >> file.device >> file.inode >> file.size >> file.mtime >> kind >>
+         offset) {
+    if (kind <= (unsigned)patchKind::syscall) {
+      sites[file][offset] = (patchKind)kind;
+    }
+  }
+  return true;
+}
+// =======================================================================================
+void patchSiteCache::save(const string& path) {
+  string tmpPath = path + ".tmp";
+  {
+    ofstream out(tmpPath, ios::trunc);
+    if (!out) {
+      runtimeError("Unable to open patch sites " + tmpPath);
+    }
+    out << cacheHeader << "\n";
+    for (auto& known : sites) {
+      const fileIdentity& file = known.first;
+      for (auto& site : known.second) {
+        out << file.device << " " << file.inode << " " << file.size << " "
+            << file.mtime << " " << (unsigned)site.second << " " << site.first
+            << "\n";
+      }
+    }
+  }
+  doWithCheck(
+      rename(tmpPath.c_str(), path.c_str()),
+      "Unable to replace patch sites " + path);
+}
+// =======================================================================================
+void patchSiteCache::patched(
+    const fileIdentity& file, uint64_t offset, patchKind kind) {
+  sites[file][offset] = kind;
+}
+// =======================================================================================
+const patchSiteCache::fileSites* patchSiteCache::sitesOf(
+    const fileIdentity& file) const {
+  auto known = sites.find(file);
+  return known == sites.end() ? nullptr : &known->second;
+}
+// =======================================================================================
+bool patchSiteCache::identify(const vma& m, fileIdentity& file) {
+  // Removed or replaced since, what is mapped isn't what the path has.
+  const string deleted = " (deleted)";
+  if (m.name.empty() || m.name[0] != '/' ||
+      (m.name.size() > deleted.size() &&
+       m.name.compare(
+           m.name.size() - deleted.size(), deleted.size(), deleted) == 0)) {
+    return false;
+  }
+  struct stat st;
+  if (stat(m.name.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  file = fileIdentity{};
+  file.device = st.st_dev;
+  file.inode = st.st_ino;
+  file.size = st.st_size;
+  file.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  return true;
+}
+// =======================================================================================
+size_t patchSiteCache::size() const {
+  size_t known = 0;
+  for (auto& file : sites) {
+    known += file.second.size();
+  }
+  return known;
+}
+// =======================================================================================
@@ -0,0 +1,58 @@
+#include "pathCache.hpp"
+
+#include <limits.h>
+#include <unistd.h>
+
+// =======================================================================================
+stringId traceePaths::root(pathTable& table, pid_t traceePid) {
+  return lookup(table, rootPath, "/proc/" + to_string(traceePid) + "/root");
+}
+// =======================================================================================
+stringId traceePaths::cwd(pathTable& table, pid_t traceePid) {
+  return lookup(table, cwdPath, "/proc/" + to_string(traceePid) + "/cwd");
+}
+// =======================================================================================
+stringId traceePaths::dirFd(pathTable& table, pid_t traceePid, int fd) {
+  return lookup(
+      table, fdPaths[fd],
+      "/proc/" + to_string(traceePid) + "/fd/" + to_string(fd));
+}
+// =======================================================================================
+stringId traceePaths::lookup(
+    pathTable& table, cachedPath& cached, const string& procPath) {
+  if (cached.path != stringInterner::noString &&
+      cached.generation == table.currentGeneration()) {
+    table.hits++;
+    return cached.path;
+  }
+
+  char pathbuf[PATH_MAX + 1];
+  ssize_t ret = readlink(procPath.c_str(), pathbuf, PATH_MAX);
+  if (ret == -1) {
+    cached.path = stringInterner::noString;
+    return cached.path;
+  }
+  cached.path = table.strings.intern(pathbuf, ret);
+  cached.generation = table.currentGeneration();
+  return cached.path;
+}
+// =======================================================================================
+bool traceePaths::cachesFds(int first, int last) const {
+  for (auto& fd : fdPaths) {
+    if (first <= fd.first && fd.first <= last) {
+      return true;
+    }
+  }
+  return false;
+}
+// =======================================================================================
+void traceePaths::forgetFds(int first, int last) {
+  for (auto it = fdPaths.begin(); it != fdPaths.end();) {
+    if (first <= it->first && it->first <= last) {
+      it = fdPaths.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+// =======================================================================================
@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "policyProfile.hpp"
+#include "systemCallList.hpp"
+#include "util.hpp"
+
+/** errnos profiles may name, the ones worth failing a system call with. */
+static const struct {
+  const char* name;
+  int err;
+} errnoNames[] = {
+    {"EPERM", EPERM},   {"ENOENT", ENOENT}, {"EINTR", EINTR},
+    {"EIO", EIO},       {"EBADF", EBADF},   {"EAGAIN", EAGAIN},
+    {"ENOMEM", ENOMEM}, {"EACCES", EACCES}, {"EFAULT", EFAULT},
+    {"EINVAL", EINVAL}, {"ENOSYS", ENOSYS}, {"EOPNOTSUPP", EOPNOTSUPP},
+};
+
+// =======================================================================================
+long systemCallNumber(const string& name) {
+  for (long i = 0; i < SYSTEM_CALL_COUNT; i++) {
+    if (systemCallMappings[i] == name) {
+      return i;
+    }
+  }
+  return -1;
+}
+// =======================================================================================
+policyProfile policyProfile::parse(const string& text, const string& origin) {
+  policyProfile profile;
+  istringstream lines(text);
+  string line;
+  for (int number = 1; getline(lines, line); number++) {
+    string where = origin + ":" + to_string(number) + ": ";
+    line = line.substr(0, line.find('#'));
+    istringstream words(line);
+    string name, what, err, extra;
+    if (!(words >> name)) {
+      continue;
+    }
+    words >> what >> err >> extra;
+    long systemCall = systemCallNumber(name);
+    if (systemCall == -1) {
+      runtimeError(where + "unknown system call " + name);
+    }
+
+    systemCallPolicy policy{disposition::intercept, 0};
+    if (what == "allow" || what == "intercept") {
+      policy.what =
+          what == "allow" ? disposition::allow : disposition::intercept;
+      if (!err.empty()) {
+        runtimeError(where + "unexpected " + err);
+      }
+    } else if (what == "errno") {
+      policy.what = disposition::reject;
+      for (auto& known : errnoNames) {
+        if (err == known.name) {
+          policy.err = known.err;
+        }
+      }
+      if (policy.err == 0) {
+        policy.err = atoi(err.c_str());
+      }
+      if (policy.err <= 0 || !extra.empty()) {
+        runtimeError(where + "errno needs an errno name or number");
+      }
+    } else {
+      runtimeError(
+          where + "expected allow, intercept or errno after " + name);
+    }
+    profile.policies[systemCall] = policy;
+  }
+  return profile;
+}
+// =======================================================================================
+policyProfile policyProfile::load(const string& path) {
+  ifstream file(path);
+  if (!file) {
+    runtimeError("Unable to read profile " + path + ": " + strerror(errno));
+  }
+  stringstream text;
+  text << file.rdbuf();
+  return parse(text.str(), path);
+}
+// =======================================================================================
+string policyProfile::resolve(const string& name, const string& dir) {
+  if (name.find('/') != string::npos) {
+    return name;
+  }
+  return dir + "/" + name + ".profile";
+}
+// =======================================================================================
+const systemCallPolicy* policyProfile::find(long systemCall) const {
+  auto it = policies.find(systemCall);
+  return it == policies.end() ? nullptr : &it->second;
+}
+// =======================================================================================
+uint64_t policyProfile::fingerprint() const {
+  // FNV-1a over (system call, disposition, errno).
+  uint64_t hash = 0xcbf29ce484222325;
+  for (auto& policy : policies) {
+    for (int64_t value :
+         {(int64_t)policy.first, (int64_t)policy.second.what,
+          (int64_t)policy.second.err}) {
+      hash ^= (uint64_t)value;
+      hash *= 0x100000001b3;
+    }
+  }
+  return hash;
+}
+// =======================================================================================
+profileSuggestion::~profileSuggestion() {
+  ofstream file(path);
+  file << text();
+}
+// =======================================================================================
+void profileSuggestion::hooked(int systemCall, bool changed) {
+  counts& c = bySystemCall[systemCall];
+  c.hooks++;
+  c.changed += changed;
+}
+// =======================================================================================
+string profileSuggestion::text() const {
+  ostringstream out;
+  out << "# Suggested by dettrace --suggest-profile: system calls whose hooks\n"
+         "# never changed an outcome in that run are allowed.\n";
+  for (auto& entry : bySystemCall) {
+    const string& name = systemCallMappings[entry.first];
+    const counts& c = entry.second;
+    bool allow = c.changed == 0 && !keepsTracerState(entry.first);
+    out << name << (allow ? " allow" : " intercept") << " # " << c.hooks
+        << " hooks, " << c.changed << " changed\n";
+  }
+  return out.str();
+}
+// =======================================================================================
+bool profileSuggestion::keepsTracerState(long systemCall) {
+  switch (systemCall) {
+  // File descriptors, their types and blocking.
+  case SYS_open:
+  case SYS_openat:
+  case SYS_creat:
+  case SYS_close:
+  case SYS_dup:
+  case SYS_dup2:
+  case SYS_dup3:
+  case SYS_fcntl:
+  case SYS_pipe:
+  case SYS_pipe2:
+  case SYS_socket:
+  case SYS_socketpair:
+  case SYS_connect:
+  case SYS_timerfd_create:
+  case SYS_eventfd:
+  case SYS_eventfd2:
+  // Working directory, image, process tree.
+  case SYS_chdir:
+  case SYS_fchdir:
+  case SYS_execve:
+  case SYS_exit_group:
+  case SYS_arch_prctl:
+  // Signals and timers, delivered on the logical clock.
+  case SYS_rt_sigaction:
+  case SYS_rt_sigprocmask:
+  case SYS_alarm:
+  case SYS_setitimer:
+  case SYS_timer_create:
+  case SYS_timer_delete:
+  case SYS_timer_settime:
+  case SYS_timerfd_settime:
+  case SYS_tgkill:
+  // Logical mtimes of what they create or change.
+  case SYS_mkdir:
+  case SYS_mkdirat:
+  case SYS_mknod:
+  case SYS_mknodat:
+  case SYS_symlink:
+  case SYS_symlinkat:
+  case SYS_rename:
+  case SYS_renameat:
+  case SYS_renameat2:
+  case SYS_unlink:
+  case SYS_unlinkat:
+  case SYS_rmdir:
+  case SYS_utime:
+  case SYS_utimes:
+  case SYS_utimensat:
+  case SYS_futimesat:
+  // May block, only with another tracee's help.
+  case SYS_read:
+  case SYS_write:
+  case SYS_writev:
+  case SYS_futex:
+  case SYS_wait4:
+  case SYS_waitid:
+  case SYS_poll:
+  case SYS_select:
+  case SYS_pselect6:
+  case SYS_epoll_wait:
+  case SYS_epoll_pwait:
+  case SYS_nanosleep:
+  case SYS_pause:
+  case SYS_rt_sigsuspend:
+  case SYS_rt_sigtimedwait:
+  case SYS_accept:
+  case SYS_accept4:
+  case SYS_recvfrom:
+  case SYS_recvmsg:
+  case SYS_sendto:
+  case SYS_sendmsg:
+  case SYS_sendmmsg:
+    return true;
+  default:
+    return false;
+  }
+}
+// =======================================================================================
@@ -0,0 +1,270 @@
+#include "memoryUsage.hpp"
+#include "processTable.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+// =======================================================================================
+state& processTable::addRoot(pid_t pid, state s) {
+  int slot = allocate(pid, move(s));
+  processEntry& e = entries[slot];
+  e.leader = slot;
+  e.groupSize = 1;
+  return *e.st;
+}
+// =======================================================================================
+state& processTable::addProcess(pid_t spawner, pid_t pid, state s) {
+  int parent = entries[slot(spawner)].leader;
+  int child = allocate(pid, move(s));
+  processEntry& e = entries[child];
+  e.leader = child;
+  e.groupSize = 1;
+  linkChild(parent, child);
+  return *e.st;
+}
+// =======================================================================================
+state& processTable::addThread(pid_t spawner, pid_t tid, state s) {
+  int leader = entries[slot(spawner)].leader;
+  int thread = allocate(tid, move(s));
+  processEntry& l = entries[leader];
+  processEntry& t = entries[thread];
+
+  t.leader = leader;
+  t.prevThread = l.lastThread;
+  if (l.lastThread == none) {
+    l.firstThread = thread;
+  } else {
+    entries[l.lastThread].nextThread = thread;
+  }
+  l.lastThread = thread;
+  l.groupSize++;
+  threadCount++;
+  if (threadCount > peakThreads) {
+    peakThreads = threadCount;
+  }
+
+  linkChild(leader, thread);
+  return *t.st;
+}
+// =======================================================================================
+pid_t processTable::remove(pid_t pid) {
+  int s = slot(pid);
+  processEntry& e = entries[s];
+
+  if (e.leader == s) {
+    if (e.groupSize != 1) {
+      runtimeError(
+          "Thread group leader " + to_string(pid) + " removed before its " +
+          to_string(e.groupSize - 1) + " thread(s).\n");
+    }
+  } else {
+    // Leave our thread group.
+    unlinkThread(s);
+    entries[e.leader].groupSize--;
+    threadCount--;
+  }
+
+  // Unlink from our parent's children.
+  pid_t parentPid = -1;
+  if (e.parent != none) {
+    processEntry& p = entries[e.parent];
+    parentPid = p.pid;
+    if (e.leader == s) {
+      unreaped[parentPid].insert(pid);
+      p.childProcesses--;
+    }
+    if (e.prevSibling == none) {
+      p.firstChild = e.nextSibling;
+    } else {
+      entries[e.prevSibling].nextSibling = e.nextSibling;
+    }
+    if (e.nextSibling == none) {
+      p.lastChild = e.prevSibling;
+    } else {
+      entries[e.nextSibling].prevSibling = e.prevSibling;
+    }
+  }
+
+  // Orphan any children still around, e.g. when we were killed by a signal.
+  for (int c = e.firstChild; c != none;) {
+    int next = entries[c].nextSibling;
+    entries[c].parent = entries[c].prevSibling = entries[c].nextSibling = none;
+    c = next;
+  }
+
+  // Our own zombies go to init.
+  if (e.leader == s) {
+    unreaped.erase(pid);
+  }
+  slotOf.erase(pid);
+  e = processEntry{};
+  freeSlots.push_back(s);
+  return parentPid;
+}
+// =======================================================================================
+state& processTable::at(pid_t pid) { return *entries[slot(pid)].st; }
+// =======================================================================================
+state* processTable::find(pid_t pid) {
+  auto it = slotOf.find(pid);
+  if (it == slotOf.end()) {
+    return nullptr;
+  }
+  return entries[it->second].st.get();
+}
+// =======================================================================================
+pid_t processTable::threadGroupOf(pid_t pid) const {
+  return entries[entries[slot(pid)].leader].pid;
+}
+// =======================================================================================
+size_t processTable::threadGroupSize(pid_t pid) const {
+  return entries[entries[slot(pid)].leader].groupSize;
+}
+// =======================================================================================
+void processTable::detachThreads(pid_t pid) {
+  processEntry& l = entries[entries[slot(pid)].leader];
+  if (l.firstThread == none) {
+    return;
+  }
+
+  // Append, in case some threads are already detached.
+  if (l.lastDetached == none) {
+    l.firstDetached = l.firstThread;
+  } else {
+    entries[l.lastDetached].nextThread = l.firstThread;
+    entries[l.firstThread].prevThread = l.lastDetached;
+  }
+  l.lastDetached = l.lastThread;
+  l.firstThread = l.lastThread = none;
+}
+// =======================================================================================
+pid_t processTable::popDetachedThread(pid_t pid) {
+  const processEntry& l = entries[entries[slot(pid)].leader];
+  int t = l.firstDetached;
+  if (t == none) {
+    return -1;
+  }
+  unlinkThread(t);
+  return entries[t].pid;
+}
+// =======================================================================================
+bool processTable::isThread(pid_t pid) const {
+  int s = slot(pid);
+  return entries[s].leader != s;
+}
+// =======================================================================================
+bool processTable::hasChildren(pid_t pid) const {
+  auto it = slotOf.find(pid);
+  return it != slotOf.end() && entries[it->second].firstChild != none;
+}
+// =======================================================================================
+bool processTable::hasChildProcess(pid_t parent, pid_t child) const {
+  auto it = slotOf.find(parent);
+  if (it == slotOf.end()) {
+    return false;
+  }
+  int leader = entries[it->second].leader;
+  if (child == -1) {
+    return entries[leader].childProcesses != 0;
+  }
+  auto c = slotOf.find(child);
+  return c != slotOf.end() && entries[c->second].leader == c->second &&
+      entries[c->second].parent == leader;
+}
+// =======================================================================================
+bool processTable::hasUnreaped(pid_t parent, pid_t child) const {
+  auto it = unreaped.find(threadGroupOf(parent));
+  if (it == unreaped.end()) {
+    return false;
+  }
+  return child == -1 || it->second.count(child) != 0;
+}
+// =======================================================================================
+void processTable::reaped(pid_t parent, pid_t child) {
+  auto it = unreaped.find(threadGroupOf(parent));
+  if (it == unreaped.end()) {
+    return;
+  }
+  it->second.erase(child);
+  if (it->second.empty()) {
+    unreaped.erase(it);
+  }
+}
+// =======================================================================================
+size_t processTable::bytesHeld() const {
+  size_t bytes = entries.size() * sizeof(processEntry) +
+      freeSlots.capacity() * sizeof(int) + unorderedMapBytes(slotOf) +
+      unorderedMapBytes(unreaped) + slotOf.size() * sizeof(state);
+  for (auto& parent : unreaped) {
+    bytes += parent.second.bucket_count() * sizeof(void*) +
+        parent.second.size() * (sizeof(pid_t) + sizeof(void*));
+  }
+  return bytes;
+}
+// =======================================================================================
+int processTable::allocate(pid_t pid, state s) {
+  if (slotOf.count(pid) != 0) {
+    runtimeError("Tracee " + to_string(pid) + " is already in the table.\n");
+  }
+
+  int slot;
+  if (freeSlots.empty()) {
+    slot = entries.size();
+    entries.emplace_back();
+  } else {
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+  }
+
+  processEntry& e = entries[slot];
+  e.pid = pid;
+  e.st = make_unique<state>(move(s));
+  slotOf.emplace(pid, slot);
+  return slot;
+}
+// =======================================================================================
+int processTable::slot(pid_t pid) const {
+  auto it = slotOf.find(pid);
+  if (it == slotOf.end()) {
+    runtimeError("No such tracee: " + to_string(pid) + "\n");
+  }
+  return it->second;
+}
+// =======================================================================================
+void processTable::unlinkThread(int thread) {
+  processEntry& t = entries[thread];
+  processEntry& l = entries[t.leader];
+
+  // Our neighbours know which list we are on, failing that the list heads do.
+  if (t.prevThread != none) {
+    entries[t.prevThread].nextThread = t.nextThread;
+  } else if (l.firstThread == thread) {
+    l.firstThread = t.nextThread;
+  } else if (l.firstDetached == thread) {
+    l.firstDetached = t.nextThread;
+  }
+  if (t.nextThread != none) {
+    entries[t.nextThread].prevThread = t.prevThread;
+  } else if (l.lastThread == thread) {
+    l.lastThread = t.prevThread;
+  } else if (l.lastDetached == thread) {
+    l.lastDetached = t.prevThread;
+  }
+  t.prevThread = t.nextThread = none;
+}
+// =======================================================================================
+void processTable::linkChild(int parent, int child) {
+  processEntry& p = entries[parent];
+  processEntry& c = entries[child];
+  c.parent = parent;
+  if (c.leader == child) {
+    p.childProcesses++;
+  }
+  c.prevSibling = p.lastChild;
+  if (p.lastChild == none) {
+    p.firstChild = child;
+  } else {
+    entries[p.lastChild].nextSibling = child;
+  }
+  p.lastChild = child;
+}
+// =======================================================================================
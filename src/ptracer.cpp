@@ -1,10 +1,12 @@
 extern "C" {
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/reg.h> /* For constants ORIG_EAX, etc */
 #include <sys/syscall.h> /* For SYS_write, etc */
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 #include <sys/vfs.h>
 #include <sys/wait.h>
@@ -16,8 +18,10 @@ extern "C" {
 #include <memory>
 #include <set>
 #include <tuple>
+#include <vector>
 
 #include "dettraceSystemCall.hpp"
+#include "probes.hpp"
 #include "ptracer.hpp"
 
 using namespace std;
@@ -39,21 +43,36 @@ uint64_t ptracer::arg4() { return regs.r10; }
 uint64_t ptracer::arg5() { return regs.r8; }
 uint64_t ptracer::arg6() { return regs.r9; }
 struct user_regs_struct ptracer::getRegs() {
+  fetchFullRegs();
   return regs;
 }
 
 void ptracer::setRegs(struct user_regs_struct newValues) {
   regs = newValues;
+  regsPartial = false;
+  regsDirty = true;
+  traceeChanges++;
+  return;
+}
+
+void ptracer::flushRegs() {
+  if (!regsDirty) {
+    return;
+  }
   // Please note how the memory address is passed in data argument here.
   // Which I guess sort of makes sense? We are passing data to it?
   doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = false;
   return;
 }
 
 traceePtr<void> ptracer::getRip() { return traceePtr<void>((void *)regs.rip); }
 traceePtr<void> ptracer::getRsp() { return traceePtr<void>((void *)regs.rsp); }
 
-traceePtr<void> ptracer::getRax() { return traceePtr<void>((void *)regs.rax); }
+traceePtr<void> ptracer::getRax() {
+  fetchFullRegs();
+  return traceePtr<void>((void *)regs.rax);
+}
 
 uint64_t ptracer::getEventMessage(pid_t traceePid) {
   long event;
@@ -62,24 +81,107 @@ uint64_t ptracer::getEventMessage(pid_t traceePid) {
   return event;
 }
 
-int ptracer::getReturnValue() { return (int)regs.rax; }
+int ptracer::getReturnValue() {
+  fetchFullRegs();
+  return (int)regs.rax;
+}
 
 uint64_t ptracer::getSystemCallNumber() { return regs.orig_rax; }
 
 void ptracer::setReturnRegister(uint64_t retVal) {
+  fetchFullRegs();
   regs.rax = retVal;
-  // Please note how the memory address is passed in data argument here.
-  // Which I guess sort of makes sense? We are passing data to it?
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::updateState(pid_t newPid) {
+  // Never drop pending writes for the previous tracee on the floor.
+  flushRegs();
+  flushTraceeWrites();
+  clearReadCache();
   traceePid = newPid;
   doPtrace(PTRACE_GETREGS, traceePid, NULL, &regs);
+  regsPartial = false;
+  applyPendingRestores();
 
   return;
 }
 
+void ptracer::updateStateSeccomp(pid_t newPid) {
+  if (!useSyscallInfo) {
+    updateState(newPid);
+    return;
+  }
+
+  flushRegs();
+  flushTraceeWrites();
+  clearReadCache();
+  traceePid = newPid;
+
+  struct ptraceSyscallInfo info;
+  doPtrace(
+      (enum __ptrace_request)PTRACE_GET_SYSCALL_INFO, traceePid,
+      (void *)sizeof(info), &info);
+  if (info.op != PTRACE_SYSCALL_INFO_SECCOMP) {
+    // Not a seccomp stop after all, get everything.
+    doPtrace(PTRACE_GETREGS, traceePid, NULL, &regs);
+    regsPartial = false;
+    applyPendingRestores();
+    return;
+  }
+
+  regs.orig_rax = info.seccomp.nr;
+  regs.rdi = info.seccomp.args[0];
+  regs.rsi = info.seccomp.args[1];
+  regs.rdx = info.seccomp.args[2];
+  regs.r10 = info.seccomp.args[3];
+  regs.r8 = info.seccomp.args[4];
+  regs.r9 = info.seccomp.args[5];
+  regs.rip = info.instruction_pointer;
+  regs.rsp = info.stack_pointer;
+  regsPartial = true;
+  applyPendingRestores();
+
+  return;
+}
+
+void ptracer::restoreArgLater(int arg, uint64_t ours, uint64_t original) {
+  static unsigned long long user_regs_struct::*const argRegs[] = {
+      &user_regs_struct::rdi, &user_regs_struct::rsi, &user_regs_struct::rdx,
+      &user_regs_struct::r10, &user_regs_struct::r8,  &user_regs_struct::r9,
+  };
+  if (arg < 1 || arg > 6) {
+    runtimeError("restoreArgLater: no argument " + to_string(arg));
+  }
+  pendingRestores[traceePid].push_back({argRegs[arg - 1], ours, original});
+}
+
+void ptracer::applyPendingRestores() {
+  auto pending = pendingRestores.find(traceePid);
+  if (pending == pendingRestores.end()) {
+    return;
+  }
+  for (const pendingRestore& restore : pending->second) {
+    // The arguments are there even in a partial view, all of regs is written.
+    if (regs.*restore.reg == restore.ours) {
+      fetchFullRegs();
+      regs.*restore.reg = restore.original;
+      regsDirty = true;
+      lazyRestores++;
+    }
+  }
+  pendingRestores.erase(pending);
+}
+
+void ptracer::fetchFullRegs() {
+  if (!regsPartial) {
+    return;
+  }
+  doPtrace(PTRACE_GETREGS, traceePid, NULL, &regs);
+  regsPartial = false;
+}
+
 pid_t ptracer::getPid() { return traceePid; }
 
 void ptracer::setOptions(pid_t pid) {
@@ -103,6 +205,71 @@ void ptracer::setOptions(pid_t pid) {
 
 string ptracer::readTraceeCString(
     traceePtr<char> readAddress, pid_t traceePid) {
+  // Check if we already read this string during the current stop.
+  if (traceePid == this->traceePid) {
+    auto it = readCache.upper_bound((uintptr_t)readAddress.ptr);
+    if (it != readCache.begin()) {
+      --it;
+      const size_t offset = (uintptr_t)readAddress.ptr - it->first;
+      const string& bytes = it->second;
+      if (offset < bytes.size()) {
+        const char* start = bytes.data() + offset;
+        const void* nul = memchr(start, '\0', bytes.size() - offset);
+        if (nul != nullptr) {
+          readCacheHits++;
+          return string{start, (size_t)((const char*)nul - start)};
+        }
+      }
+    }
+  }
+
+  // We don't know how long the string is, any queued write may matter.
+  flushTraceeWrites();
+  string str = readTraceeCStringUncached(readAddress, traceePid);
+  // Include the NUL so lookups know where the string ends.
+  insertReadCache(readAddress.ptr, str.c_str(), str.size() + 1, traceePid);
+  return str;
+}
+
+string ptracer::readTraceeCStringUncached(
+    traceePtr<char> readAddress, pid_t traceePid) {
+  const size_t pageSize = 4096; // x86_64 only, like wordSize.
+  string r;
+  char buffer[pageSize];
+
+  // Read up to the end of the current page at a time. Reading across a page
+  // boundary could fail even though the string itself ends before it.
+  while (true) {
+    const size_t toPageEnd = pageSize - ((uintptr_t)readAddress.ptr % pageSize);
+    readVmCalls++;
+    ssize_t bytesRead =
+        readVmTraceeRaw(readAddress, buffer, toPageEnd, traceePid);
+
+    if (bytesRead <= 0) {
+      // process_vm_readv respects page protections while ptrace does not,
+      // finish reading with PTRACE_PEEKDATA.
+      if (bytesRead == -1 && errno == EFAULT) {
+        return r + readTraceeCStringPeek(readAddress, traceePid);
+      }
+      runtimeError(
+          "readTraceeCString: Unable to read bytes at address: " +
+          string{strerror(errno)});
+    }
+
+    const size_t length = strnlen(buffer, bytesRead);
+    r.append(buffer, length);
+    if (length < (size_t)bytesRead) {
+      return r;
+    }
+
+    // Notice this doesn't change readAddress outside this function -> pass by
+    // value.
+    readAddress.ptr += bytesRead;
+  }
+}
+
+string ptracer::readTraceeCStringPeek(
+    traceePtr<char> readAddress, pid_t traceePid) {
   string r;
   bool done = false;
 
@@ -121,14 +288,221 @@ string ptracer::readTraceeCString(
       r += p[i];
     }
 
-    // Notice this doesn't change readAddress outside this function -> pass by
-    // value.
     readAddress.ptr += bytesRead;
   }
 
   return r;
 }
 
+bool ptracer::lookupReadCache(
+    const void* traceeAddress,
+    void* localAddress,
+    size_t size,
+    pid_t pid) {
+  if (pid != traceePid) {
+    return false;
+  }
+
+  // Find last entry starting at or before traceeAddress.
+  const uintptr_t address = (uintptr_t)traceeAddress;
+  auto it = readCache.upper_bound(address);
+  if (it == readCache.begin()) {
+    return false;
+  }
+  --it;
+
+  const string& bytes = it->second;
+  if (address + size > it->first + bytes.size()) {
+    return false;
+  }
+
+  memcpy(localAddress, bytes.data() + (address - it->first), size);
+  readCacheHits++;
+  return true;
+}
+
+void ptracer::insertReadCache(
+    const void* traceeAddress,
+    const void* localAddress,
+    size_t size,
+    pid_t pid) {
+  if (pid != traceePid) {
+    return;
+  }
+  readCache[(uintptr_t)traceeAddress] = string{(const char*)localAddress, size};
+}
+
+void ptracer::clearReadCache() { readCache.clear(); }
+
+/**
+ * Shared implementation of readTraceeBatch and writeTraceeBatch. We chunk by
+ * IOV_MAX since that is the most process_vm_{readv, writev} accept at once.
+ */
+static void doTraceeBatch(
+    const vector<traceeIo>& ios, pid_t traceePid, bool isWrite) {
+  const size_t chunkSize = IOV_MAX;
+
+  for (size_t start = 0; start < ios.size(); start += chunkSize) {
+    size_t count = min(chunkSize, ios.size() - start);
+    vector<iovec> local(count);
+    vector<iovec> remote(count);
+    ssize_t expected = 0;
+
+    for (size_t i = 0; i < count; i++) {
+      const traceeIo& io = ios[start + i];
+      local[i] = {io.localAddress, io.size};
+      remote[i] = {io.traceeAddress, io.size};
+      expected += io.size;
+    }
+
+    if (isWrite) {
+      DETTRACE_PROBE3(vm_write, traceePid, count, expected);
+    } else {
+      DETTRACE_PROBE3(vm_read, traceePid, count, expected);
+    }
+    ssize_t done = isWrite
+        ? process_vm_writev(
+              traceePid, local.data(), count, remote.data(), count, 0)
+        : process_vm_readv(
+              traceePid, local.data(), count, remote.data(), count, 0);
+    if (done != expected) {
+      string name = isWrite ? "writeTraceeBatch" : "readTraceeBatch";
+      string reason = done == -1 ? string{strerror(errno)} : "partial transfer";
+      runtimeError(name + ": Unable to transfer bytes: " + reason);
+    }
+  }
+}
+
+void ptracer::readTraceeBatch(const vector<traceeIo>& ios, pid_t traceePid) {
+  if (ios.empty()) {
+    return;
+  }
+  for (const traceeIo& io : ios) {
+    if (pendingWriteOverlaps(io.traceeAddress, io.size)) {
+      flushTraceeWrites();
+      break;
+    }
+  }
+  readVmCalls++;
+  doTraceeBatch(ios, traceePid, false);
+}
+
+void ptracer::writeTraceeBatch(const vector<traceeIo>& ios, pid_t traceePid) {
+  for (const traceeIo& io : ios) {
+    queueTraceeWrite(io.traceeAddress, io.localAddress, io.size, traceePid);
+  }
+}
+
+void ptracer::queueTraceeWrite(
+    const void* traceeAddress,
+    const void* localAddress,
+    size_t size,
+    pid_t pid) {
+  clearReadCache();
+  traceeChanges++;
+  if (pid != traceePid) {
+    // Not our current tracee, don't bother queueing.
+    writeVmCalls++;
+    doTraceeBatch(
+        {traceeIo(traceePtr<void>((void*)traceeAddress), (void*)localAddress,
+                  size)},
+        pid, true);
+    return;
+  }
+  pendingWrites.emplace_back(
+      (uintptr_t)traceeAddress, string{(const char*)localAddress, size});
+}
+
+bool ptracer::pendingWriteOverlaps(const void* traceeAddress, size_t size) {
+  const uintptr_t start = (uintptr_t)traceeAddress;
+  for (const auto& write : pendingWrites) {
+    if (start < write.first + write.second.size() &&
+        write.first < start + size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ptracer::flushTraceeWrites() {
+  if (pendingWrites.empty()) {
+    return;
+  }
+
+  // Merge queued writes into disjoint ranges keyed by start address. Applying
+  // the writes in program order means later writes win on overlap.
+  map<uintptr_t, string> merged;
+  for (const auto& write : pendingWrites) {
+    uintptr_t start = write.first;
+    uintptr_t end = start + write.second.size();
+
+    // Find all ranges touching [start, end), including adjacent ones.
+    auto first = merged.upper_bound(start);
+    if (first != merged.begin()) {
+      auto prev = std::prev(first);
+      if (prev->first + prev->second.size() >= start) {
+        first = prev;
+      }
+    }
+    auto last = first;
+    uintptr_t newStart = start;
+    uintptr_t newEnd = end;
+    while (last != merged.end() && last->first <= end) {
+      newStart = min(newStart, last->first);
+      newEnd = max(newEnd, last->first + last->second.size());
+      ++last;
+    }
+
+    string bytes(newEnd - newStart, '\0');
+    for (auto it = first; it != last; ++it) {
+      bytes.replace(it->first - newStart, it->second.size(), it->second);
+    }
+    bytes.replace(start - newStart, write.second.size(), write.second);
+
+    merged.erase(first, last);
+    merged.emplace(newStart, std::move(bytes));
+  }
+
+  vector<traceeIo> ios;
+  for (auto& range : merged) {
+    ios.emplace_back(
+        traceePtr<void>((void*)range.first), (void*)range.second.data(),
+        range.second.size());
+  }
+
+  writeVmCalls++;
+  doTraceeBatch(ios, traceePid, true);
+
+  if (verifyWrites) {
+    // Replay writes one byte at a time, in order, and compare with what the
+    // tracee now has in memory.
+    map<uintptr_t, char> expected;
+    for (const auto& write : pendingWrites) {
+      for (size_t i = 0; i < write.second.size(); i++) {
+        expected[write.first + i] = write.second[i];
+      }
+    }
+    for (auto& range : merged) {
+      string actual(range.second.size(), '\0');
+      doTraceeBatch(
+          {traceeIo(traceePtr<void>((void*)range.first), (void*)actual.data(),
+                    actual.size())},
+          traceePid, false);
+      for (size_t i = 0; i < actual.size(); i++) {
+        if (expected.at(range.first + i) != actual[i]) {
+          runtimeError(
+              "flushTraceeWrites: merged writes differ from ordered writes "
+              "at address " +
+              to_string(range.first + i) + "\n");
+        }
+      }
+    }
+  }
+
+  pendingWrites.clear();
+  clearReadCache();
+}
+
 long ptracer::doPtrace(
     enum __ptrace_request request, pid_t pid, void *addr, void *data) {
   /*
@@ -159,62 +533,86 @@ long ptracer::doPtrace(
 }
 
 void ptracer::changeSystemCall(uint64_t val) {
+  fetchFullRegs();
   regs.orig_rax = val;
   regs.rax = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
   return;
 }
 
 void ptracer::writeArg1(uint64_t val) {
+  fetchFullRegs();
   regs.rdi = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeArg2(uint64_t val) {
+  fetchFullRegs();
   regs.rsi = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 void ptracer::writeArg3(uint64_t val) {
+  fetchFullRegs();
   regs.rdx = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeArg4(uint64_t val) {
+  fetchFullRegs();
   regs.r10 = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeArg5(uint64_t val) {
+  fetchFullRegs();
   regs.r8 = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeArg6(uint64_t val) {
+  fetchFullRegs();
   regs.r9 = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeIp(uint64_t val) {
+  fetchFullRegs();
   regs.rip = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeRax(uint64_t val) {
+  fetchFullRegs();
   regs.rax = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeRbx(uint64_t val) {
+  fetchFullRegs();
   regs.rbx = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeRdx(uint64_t val) {
+  fetchFullRegs();
   regs.rdx = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
 
 void ptracer::writeRcx(uint64_t val) {
+  fetchFullRegs();
   regs.rcx = val;
-  doPtrace(PTRACE_SETREGS, traceePid, nullptr, &regs);
+  regsDirty = true;
+  traceeChanges++;
 }
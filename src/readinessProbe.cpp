@@ -0,0 +1,190 @@
+#include "readinessProbe.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <string>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+// =======================================================================================
+readinessProbe::~readinessProbe() { forgetAll(); }
+// =======================================================================================
+readinessProbe::result readinessProbe::probe(pid_t traceePid, int fd) {
+  duplicate* dup = duplicateOf(traceePid, fd);
+  if (dup == nullptr) {
+    return result::unknown;
+  }
+
+  struct pollfd pfd = {dup->localFd, POLLIN, 0};
+  int ret = poll(&pfd, 1, 0);
+  if (ret < 0) {
+    return result::unknown;
+  }
+  // POLLHUP (no writers left) and POLLERR mean the read returns right away too.
+  return ret == 0 ? result::empty : result::ready;
+}
+// =======================================================================================
+int readinessProbe::pollEvents(pid_t traceePid, int fd) {
+  duplicate* dup = duplicateOf(traceePid, fd, false);
+  if (dup == nullptr || !dup->shared) {
+    return -1;
+  }
+  struct pollfd pfd = {dup->localFd, POLLIN | POLLOUT | POLLPRI, 0};
+  if (poll(&pfd, 1, 0) < 0) {
+    return -1;
+  }
+  return pfd.revents;
+}
+// =======================================================================================
+ssize_t readinessProbe::drain(
+    pid_t traceePid, int fd, void* buffer, size_t count) {
+  int localFd = usableFd(traceePid, fd, O_RDONLY);
+  return localFd == -1 ? -1 : read(localFd, buffer, count);
+}
+// =======================================================================================
+ssize_t readinessProbe::fill(
+    pid_t traceePid, int fd, const void* buffer, size_t count) {
+  int localFd = usableFd(traceePid, fd, O_WRONLY);
+  return localFd == -1 ? -1 : write(localFd, buffer, count);
+}
+// =======================================================================================
+ssize_t readinessProbe::receive(
+    pid_t traceePid, int fd, void* buffer, size_t count) {
+  duplicate* dup = duplicateOf(traceePid, fd, false);
+  if (dup == nullptr || dup->type != S_IFSOCK) {
+    errno = EBADF;
+    return -1;
+  }
+  for (;;) {
+    ssize_t bytes = recv(dup->localFd, buffer, count, MSG_DONTWAIT);
+    if (bytes != -1 || errno != EAGAIN) {
+      return bytes;
+    }
+    struct pollfd pfd = {dup->localFd, POLLIN, 0};
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+      return -1;
+    }
+  }
+}
+// =======================================================================================
+int readinessProbe::usableFd(pid_t traceePid, int fd, int accessMode) {
+  duplicate* dup = duplicateOf(traceePid, fd, accessMode == O_RDONLY);
+  if (dup == nullptr) {
+    errno = EBADF;
+    return -1;
+  }
+  // Shared with the tracee, who may have made it blocking again.
+  int flags = fcntl(dup->localFd, F_GETFL);
+  int mode = flags & O_ACCMODE;
+  if (flags == -1 ||
+      (mode != accessMode && (dup->type != S_IFSOCK || mode != O_RDWR))) {
+    errno = EBADF;
+    return -1;
+  }
+  if ((flags & O_NONBLOCK) == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return dup->localFd;
+}
+// =======================================================================================
+readinessProbe::duplicate* readinessProbe::duplicateOf(
+    pid_t traceePid, int fd, bool allowReopen) {
+  auto it = duplicates.find(fd);
+  if (it == duplicates.end()) {
+    bool shared;
+    int localFd = duplicateFd(traceePid, fd, allowReopen, shared);
+    if (localFd == -1) {
+      return nullptr;
+    }
+    struct stat statbuf = {0};
+    bool usable = fstat(localFd, &statbuf) == 0;
+    mode_t type = statbuf.st_mode & S_IFMT;
+    if (usable && type == S_IFSOCK) {
+      int socketType = 0;
+      socklen_t length = sizeof(socketType);
+      usable =
+          getsockopt(localFd, SOL_SOCKET, SO_TYPE, &socketType, &length) ==
+              0 &&
+          socketType == SOCK_STREAM;
+    } else {
+      usable = usable && type == S_IFIFO;
+    }
+    if (!usable) {
+      close(localFd);
+      return nullptr;
+    }
+    it = duplicates
+             .emplace(fd, duplicate{localFd, statbuf.st_ino, type, shared})
+             .first;
+  }
+  return &it->second;
+}
+// =======================================================================================
+ino_t readinessProbe::inodeOf(int fd) const {
+  auto it = duplicates.find(fd);
+  return it == duplicates.end() || it->second.type != S_IFIFO
+      ? 0
+      : it->second.inode;
+}
+// =======================================================================================
+void readinessProbe::forget(int fd) {
+  auto it = duplicates.find(fd);
+  if (it != duplicates.end()) {
+    close(it->second.localFd);
+    duplicates.erase(it);
+  }
+}
+// =======================================================================================
+void readinessProbe::forget(int first, int last) {
+  for (auto it = duplicates.begin(); it != duplicates.end();) {
+    if (first <= it->first && it->first <= last) {
+      close(it->second.localFd);
+      it = duplicates.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+// =======================================================================================
+void readinessProbe::forgetAll() {
+  for (auto& d : duplicates) {
+    close(d.second.localFd);
+  }
+  duplicates.clear();
+}
+// =======================================================================================
+int readinessProbe::duplicateFd(
+    pid_t traceePid, int fd, bool allowReopen, bool& shared) {
+  shared = true;
+  int pidfd = syscall(SYS_pidfd_open, traceePid, 0);
+  if (pidfd != -1) {
+    int localFd = syscall(SYS_pidfd_getfd, pidfd, fd, 0);
+    close(pidfd);
+    if (localFd != -1) {
+      return localFd;
+    }
+  }
+
+  if (!allowReopen) {
+    return -1;
+  }
+  // Older kernel, or traceePid is not a thread group leader. Opening the pipe
+  // again through /proc gets us our own reader of the same pipe.
+  shared = false;
+  std::string procPath =
+      "/proc/" + std::to_string(traceePid) + "/fd/" + std::to_string(fd);
+  return open(procPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+// =======================================================================================
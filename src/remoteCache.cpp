@@ -0,0 +1,377 @@
+#include "remoteCache.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+/** Value of header name in the headers of a response, "" if absent. */
+static string headerValue(const string& headers, const char* name) {
+  size_t length = strlen(name);
+  size_t line = headers.find("\r\n");
+  while (line != string::npos && line + 2 < headers.size()) {
+    size_t start = line + 2;
+    line = headers.find("\r\n", start);
+    size_t end = line == string::npos ? headers.size() : line;
+    if (end - start > length && headers[start + length] == ':' &&
+        strncasecmp(headers.c_str() + start, name, length) == 0) {
+      size_t value = headers.find_first_not_of(" \t", start + length + 1);
+      return value >= end ? "" : headers.substr(value, end - value);
+    }
+  }
+  return "";
+}
+// =======================================================================================
+/**
+ * Connect sock to address within millis, and have its sends and receives time
+ * out after as long. False with errno set if that fails.
+ */
+static bool connectWithin(
+    int sock, const struct sockaddr* address, socklen_t length, int millis) {
+  int flags = fcntl(sock, F_GETFL);
+  if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return false;
+  }
+  if (connect(sock, address, length) == -1) {
+    if (errno != EINPROGRESS) {
+      return false;
+    }
+    struct pollfd pending = {sock, POLLOUT, 0};
+    int ready;
+    do {
+      ready = poll(&pending, 1, millis);
+    } while (ready == -1 && errno == EINTR);
+    if (ready == 0) {
+      errno = ETIMEDOUT;
+    }
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if (ready != 1 ||
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &size) == -1) {
+      return false;
+    }
+    if (error != 0) {
+      errno = error;
+      return false;
+    }
+  }
+  struct timeval timeout = {millis / 1000, (millis % 1000) * 1000};
+  if (fcntl(sock, F_SETFL, flags) == -1 ||
+      setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ||
+      setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) {
+    return false;
+  }
+  return true;
+}
+// =======================================================================================
+bool remoteCache::parseUrl(const string& text, url& out) {
+  const string scheme = "http://";
+  if (text.compare(0, scheme.size(), scheme) != 0) {
+    return false;
+  }
+  size_t slash = text.find('/', scheme.size());
+  string authority = text.substr(scheme.size(), slash - scheme.size());
+  out.path = slash == string::npos ? "" : text.substr(slash);
+  while (!out.path.empty() && out.path.back() == '/') {
+    out.path.pop_back();
+  }
+  size_t colon = authority.rfind(':');
+  out.host = authority.substr(0, colon);
+  out.port = "80";
+  if (colon != string::npos) {
+    out.port = authority.substr(colon + 1);
+    if (out.port.empty() ||
+        out.port.find_first_not_of("0123456789") != string::npos) {
+      return false;
+    }
+  }
+  return !out.host.empty();
+}
+// =======================================================================================
+remoteCache::remoteCache(const string& text, logger& log, int timeoutMillis)
+    : log(log), timeoutMillis(timeoutMillis) {
+  if (!parseUrl(text, at)) {
+    runtimeError(
+        "--exec-cache-remote expects http://HOST[:PORT][/PREFIX], got: " +
+        text);
+  }
+}
+// =======================================================================================
+remoteCache::~remoteCache() { disconnect(""); }
+// =======================================================================================
+bool remoteCache::fetch(
+    const vector<string>& names, vector<pair<bool, string>>& found) {
+  found.assign(names.size(), make_pair(false, string()));
+  vector<pair<string, string>> requests;
+  for (const string& name : names) {
+    requests.emplace_back("GET", name);
+  }
+  vector<int> statuses;
+  vector<string> bodies;
+  if (!exchange(requests, nullptr, statuses, &bodies)) {
+    return false;
+  }
+  for (size_t i = 0; i < names.size(); i++) {
+    if (statuses[i] == 200) {
+      found[i] = make_pair(true, move(bodies[i]));
+      fetched++;
+    }
+  }
+  return true;
+}
+// =======================================================================================
+bool remoteCache::has(const vector<string>& names, vector<bool>& found) {
+  found.assign(names.size(), false);
+  vector<pair<string, string>> requests;
+  for (const string& name : names) {
+    requests.emplace_back("HEAD", name);
+  }
+  vector<int> statuses;
+  if (!exchange(requests, nullptr, statuses, nullptr)) {
+    return false;
+  }
+  for (size_t i = 0; i < names.size(); i++) {
+    found[i] = statuses[i] == 200;
+  }
+  return true;
+}
+// =======================================================================================
+bool remoteCache::store(const string& name, const string& contents) {
+  vector<int> statuses;
+  if (!exchange({{"PUT", name}}, &contents, statuses, nullptr)) {
+    return false;
+  }
+  if (statuses[0] / 100 != 2) {
+    disconnect("PUT of " + name + " answered " + to_string(statuses[0]));
+    return false;
+  }
+  stored++;
+  return true;
+}
+// =======================================================================================
+bool remoteCache::exchange(
+    const vector<pair<string, string>>& requests,
+    const string* putBody,
+    vector<int>& statuses,
+    vector<string>* bodies) {
+  if (failed || requests.empty()) {
+    return false;
+  }
+  statuses.clear();
+  if (bodies != nullptr) {
+    bodies->clear();
+  }
+
+  // A kept alive connection the server closed since is only found out now:
+  // one more go on a new one. A server may also close it after answering any
+  // of them, the rest then go again on a new one.
+  bool retried = false;
+  while (statuses.size() < requests.size()) {
+    bool reused = sock != -1;
+    if (sock == -1 && !connectToStore()) {
+      return false;
+    }
+
+    string text;
+    for (size_t i = statuses.size(); i < requests.size(); i++) {
+      text += requests[i].first + " " + at.path + "/" + requests[i].second +
+          " HTTP/1.1\r\nHost: " + at.host + "\r\n";
+      if (putBody != nullptr) {
+        text += "Content-Length: " + to_string(putBody->size()) + "\r\n\r\n";
+        text += *putBody;
+      } else {
+        text += "\r\n";
+      }
+    }
+    bool sent = true;
+    for (size_t done = 0; done < text.size();) {
+      ssize_t n = send(
+          sock, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        disconnect("timed out sending to " + at.host + ":" + at.port);
+        return false;
+      }
+      if (n <= 0) {
+        sent = false;
+        break;
+      }
+      done += n;
+    }
+    size_t answered = statuses.size();
+    // readResponse disconnects when the server closes after a response.
+    while (sent && sock != -1 && statuses.size() < requests.size()) {
+      int status;
+      string body;
+      if (!readResponse(
+              requests[statuses.size()].first == "HEAD", status, body)) {
+        break;
+      }
+      statuses.push_back(status);
+      if (bodies != nullptr) {
+        bodies->push_back(move(body));
+      }
+    }
+    if (failed) {
+      return false;
+    }
+    if (statuses.size() > answered && sock == -1) {
+      continue;
+    }
+    if (statuses.size() == requests.size()) {
+      return true;
+    }
+    if (!reused || statuses.size() > answered || retried) {
+      break;
+    }
+    retried = true;
+    disconnect("");
+  }
+  if (statuses.size() == requests.size()) {
+    return true;
+  }
+  disconnect("no answer from " + at.host + ":" + at.port);
+  return false;
+}
+// =======================================================================================
+bool remoteCache::connectToStore() {
+  struct addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses;
+  int error = getaddrinfo(at.host.c_str(), at.port.c_str(), &hints, &addresses);
+  if (error != 0) {
+    disconnect(at.host + ": " + gai_strerror(error));
+    return false;
+  }
+  string why;
+  for (auto a = addresses; a != nullptr && sock == -1; a = a->ai_next) {
+    sock = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, 0);
+    if (sock != -1 &&
+        !connectWithin(sock, a->ai_addr, a->ai_addrlen, timeoutMillis)) {
+      why = strerror(errno);
+      close(sock);
+      sock = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (sock == -1) {
+    disconnect("cannot connect to " + at.host + ":" + at.port + ": " + why);
+    return false;
+  }
+  return true;
+}
+// =======================================================================================
+bool remoteCache::readResponse(bool head, int& status, string& body) {
+  size_t end;
+  while ((end = buffer.find("\r\n\r\n")) == string::npos) {
+    if (!fill(buffer.size())) {
+      return false;
+    }
+  }
+  string headers = buffer.substr(0, end);
+  buffer.erase(0, end + 4);
+  // HTTP/1.1 200 OK
+  if (headers.compare(0, 5, "HTTP/") != 0 || headers.size() < 12) {
+    return false;
+  }
+  status = atoi(headers.c_str() + 9);
+  bool closes =
+      strcasecmp(headerValue(headers, "Connection").c_str(), "close") == 0;
+
+  body.clear();
+  string length = headerValue(headers, "Content-Length");
+  string encoding = headerValue(headers, "Transfer-Encoding");
+  if (head || status == 204 || status == 304 || status / 100 == 1) {
+    // No body.
+  } else if (strcasecmp(encoding.c_str(), "chunked") == 0) {
+    for (;;) {
+      size_t line;
+      while ((line = buffer.find("\r\n")) == string::npos) {
+        if (!fill(buffer.size())) {
+          return false;
+        }
+      }
+      size_t size = strtoul(buffer.c_str(), nullptr, 16);
+      buffer.erase(0, line + 2);
+      // The chunk and its CRLF, or the CRLF after the last one, no trailers.
+      while (buffer.size() < size + 2) {
+        if (!fill(buffer.size())) {
+          return false;
+        }
+      }
+      body.append(buffer, 0, size);
+      buffer.erase(0, size + 2);
+      if (size == 0) {
+        break;
+      }
+    }
+  } else if (!length.empty()) {
+    size_t size = strtoull(length.c_str(), nullptr, 10);
+    while (buffer.size() < size) {
+      if (!fill(buffer.size())) {
+        return false;
+      }
+    }
+    body = buffer.substr(0, size);
+    buffer.erase(0, size);
+  } else {
+    // Until the server closes.
+    while (fill(buffer.size())) {
+    }
+    body = move(buffer);
+    buffer.clear();
+    closes = true;
+  }
+  if (closes) {
+    disconnect("");
+  }
+  return true;
+}
+// =======================================================================================
+bool remoteCache::fill(size_t at) {
+  if (sock == -1) {
+    return false;
+  }
+  char chunk[64 * 1024];
+  ssize_t n;
+  do {
+    n = recv(sock, chunk, sizeof(chunk), 0);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    disconnect(
+        "timed out waiting for " + this->at.host + ":" + this->at.port);
+    return false;
+  }
+  if (n <= 0) {
+    return false;
+  }
+  buffer.append(chunk, n);
+  return buffer.size() > at;
+}
+// =======================================================================================
+void remoteCache::disconnect(const string& why) {
+  if (sock != -1) {
+    close(sock);
+    sock = -1;
+  }
+  buffer.clear();
+  if (!why.empty() && !failed) {
+    failed = true;
+    DETTRACE_LOG(
+        log, Importance::inter,
+        log.makeTextColored(
+            Color::red,
+            "--exec-cache-remote: %s. Only the local cache is used from "
+            "here on.\n"),
+        why.c_str());
+  }
+}
@@ -1,7 +1,14 @@
 #include <dlfcn.h>
+#include <sched.h>
+#include <string.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "rnr_loader.hpp"
+#include "systemCallList.hpp"
 #include "util.hpp"
 #include "utilSystemCalls.hpp"
 
@@ -52,12 +59,300 @@ static rnr_loader __rnr__ = {
     .rnr_sysexit = rnr_nop_sysexit,
 };
 
+// Version 2 plugins, see rnr_plugin.h.
+static bool pluginV2 = false;
+static bool pluginLoaded = false;
+static rnr_plugin plugin;
+
+static_assert(
+    SYSTEM_CALL_COUNT <= RNR_MAX_SYSCALLS,
+    "rnr_plugin interest sets must cover every system call");
+
+/** An entry or exit as queued for an asynchronous plugin. */
+struct rnrEvent {
+  rnr_syscall call;
+  unsigned char data[RNR_EVENT_BYTES];
+};
+
+/**
+ * Single producer, single consumer ring of events for an asynchronous
+ * plugin, like logRingBuffer but of whole events. The tracer fills slots in
+ * place and waits while the ring is full, so the plugin sees every event.
+ */
+static const uint64_t eventRingSize = 256;
+static rnrEvent* eventRing = nullptr;
+alignas(64) static atomic<uint64_t> eventHead{0};
+alignas(64) static atomic<uint64_t> eventTail{0};
+static atomic<bool> stopConsumer{false};
+/**
+ * Started on the first event, a thread started before we clone the tracer
+ * would be left behind.
+ */
+static thread consumer;
+
+static void pauseBriefly() {
+  struct timespec ts = {0, 50 * 1000};
+  nanosleep(&ts, nullptr);
+}
+
+static void consumeEvents() {
+  while (true) {
+    uint64_t t = eventTail.load(memory_order_relaxed);
+    if (t == eventHead.load(memory_order_acquire)) {
+      if (stopConsumer.load(memory_order_acquire)) {
+        // The tracer may have queued one more right before asking us to stop.
+        if (t == eventHead.load(memory_order_acquire)) {
+          return;
+        }
+        continue;
+      }
+      pauseBriefly();
+      continue;
+    }
+    plugin.consume(plugin.ctx, &eventRing[t % eventRingSize].call);
+    eventTail.store(t + 1, memory_order_release);
+  }
+}
+
+/** A system call argument holding a buffer, see bufferArgs(). */
+struct bufferArg {
+  int arg;
+  rnr_buffer_kind kind;
+  /** Argument with the size of RNR_BUFFER_IN buffers. */
+  int sizeArg;
+};
+
+/** Buffers of syscallNo we pre-read on entry or exit, into args. */
+static int bufferArgs(int syscallNo, bool exit, bufferArg args[]) {
+  const int none = -1;
+  int n = 0;
+  auto add = [&](int arg, rnr_buffer_kind kind, int sizeArg) {
+    args[n++] = bufferArg{arg, kind, sizeArg};
+  };
+  if (exit) {
+    switch (syscallNo) {
+    case SYS_read:
+    case SYS_pread64:
+    case SYS_recvfrom:
+    case SYS_getdents:
+    case SYS_getdents64:
+    case SYS_readlink:
+      add(1, RNR_BUFFER_OUT, none);
+      break;
+    case SYS_readlinkat:
+      add(2, RNR_BUFFER_OUT, none);
+      break;
+    case SYS_getrandom:
+      add(0, RNR_BUFFER_OUT, none);
+      break;
+    }
+    return n;
+  }
+
+  switch (syscallNo) {
+  case SYS_write:
+  case SYS_pwrite64:
+  case SYS_sendto:
+    add(1, RNR_BUFFER_IN, 2);
+    break;
+  case SYS_open:
+  case SYS_creat:
+  case SYS_stat:
+  case SYS_lstat:
+  case SYS_access:
+  case SYS_execve:
+  case SYS_unlink:
+  case SYS_mkdir:
+  case SYS_rmdir:
+  case SYS_chdir:
+  case SYS_readlink:
+    add(0, RNR_BUFFER_PATH, none);
+    break;
+  case SYS_openat:
+#ifdef SYS_openat2
+  case SYS_openat2:
+#endif
+  case SYS_newfstatat:
+#ifdef SYS_statx
+  case SYS_statx:
+#endif
+  case SYS_unlinkat:
+  case SYS_mkdirat:
+  case SYS_faccessat:
+  case SYS_readlinkat:
+    add(1, RNR_BUFFER_PATH, none);
+    break;
+  case SYS_rename:
+  case SYS_link:
+  case SYS_symlink:
+    add(0, RNR_BUFFER_PATH, none);
+    add(1, RNR_BUFFER_PATH, none);
+    break;
+  case SYS_renameat:
+    add(1, RNR_BUFFER_PATH, none);
+    add(3, RNR_BUFFER_PATH, none);
+    break;
+  }
+  return n;
+}
+
+/**
+ * Fill in call.buffers, reading up to max_buffer_bytes of each. Bytes go to
+ * arena if given, otherwise to data, which has room for room bytes.
+ */
+static void readBuffers(
+    rnr_syscall& call,
+    ptracer& t,
+    scratchArena* arena,
+    unsigned char* data,
+    size_t room) {
+  call.nbuffers = 0;
+  if (plugin.max_buffer_bytes == 0) {
+    return;
+  }
+  bufferArg args[RNR_MAX_BUFFERS];
+  int count = bufferArgs(call.syscallno, call.exit, args);
+  const user_regs_struct& regs = call.regs;
+  unsigned long values[6] = {
+      regs.rdi, regs.rsi, regs.rdx, regs.r10, regs.r8, regs.r9};
+
+  for (int i = 0; i < count; i++) {
+    rnr_buffer& b = call.buffers[call.nbuffers];
+    b.arg = args[i].arg;
+    b.kind = args[i].kind;
+    b.addr = values[b.arg];
+    if (b.addr == 0) {
+      continue;
+    }
+    string path;
+    if (b.kind == RNR_BUFFER_PATH) {
+      path = t.readTraceeCString(traceePtr<char>((char*)b.addr), call.pid);
+      b.size = path.size();
+    } else if (b.kind == RNR_BUFFER_IN) {
+      b.size = values[args[i].sizeArg];
+    } else if (call.retval > 0) {
+      b.size = call.retval;
+    } else {
+      continue;
+    }
+
+    b.copied = min(b.size, plugin.max_buffer_bytes);
+    if (arena != nullptr) {
+      data = arena->allocate<unsigned char>(b.copied);
+    } else {
+      b.copied = min(b.copied, (unsigned long)room);
+    }
+    b.data = data;
+    if (b.kind == RNR_BUFFER_PATH) {
+      memcpy(data, path.data(), b.copied);
+    } else if (b.copied > 0) {
+      // Our own queued writes, e.g. sorted getdents entries, must be visible.
+      if (t.pendingWriteOverlaps((void*)b.addr, b.copied)) {
+        t.flushTraceeWrites();
+      }
+      ssize_t got = readVmTraceeRaw(
+          traceePtr<unsigned char>((unsigned char*)b.addr), data, b.copied,
+          call.pid);
+      b.copied = got < 0 ? 0 : got;
+    }
+    if (arena == nullptr) {
+      data += b.copied;
+      room -= b.copied;
+    }
+    call.nbuffers++;
+  }
+}
+
+/** Whether the plugin asked for syscallNo, see rnr_want(). */
+static bool wanted(int syscallNo) {
+  return syscallNo >= 0 && syscallNo < RNR_MAX_SYSCALLS &&
+      (plugin.interest[syscallNo / 8] & (1u << (syscallNo % 8))) != 0;
+}
+
+/**
+ * Hand an entry or exit to the plugin, with the stopped tracee's registers
+ * and buffers. Sets noop and returns what sysenter returned if the plugin
+ * wants the system call skipped. Asynchronous plugins get it queued.
+ */
+static long callPlugin(
+    int syscallNumber,
+    bool exit,
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    bool& noop) {
+  rnr_syscall local;
+  rnr_syscall* call = &local;
+  rnrEvent* event = nullptr;
+  uint64_t h = 0;
+  bool async = (plugin.flags & RNR_PLUGIN_ASYNC) != 0;
+  if (async) {
+    if (eventRing == nullptr) {
+      eventRing = new rnrEvent[eventRingSize];
+      consumer = thread(consumeEvents);
+    }
+    h = eventHead.load(memory_order_relaxed);
+    while (h - eventTail.load(memory_order_acquire) == eventRingSize) {
+      sched_yield();
+    }
+    event = &eventRing[h % eventRingSize];
+    call = &event->call;
+  }
+
+  memset(call, 0, sizeof(*call));
+  call->pid = s.traceePid;
+  call->tid = s.traceePid;
+  call->syscallno = syscallNumber;
+  call->exit = exit;
+  call->regs = t.getRegs();
+  call->retval = exit ? (long)call->regs.rax : 0;
+
+  if (async) {
+    readBuffers(*call, t, nullptr, event->data, sizeof(event->data));
+    eventHead.store(h + 1, memory_order_release);
+    return 0;
+  }
+  readBuffers(*call, t, &gs.scratch, nullptr, 0);
+  long retval = 0;
+  if (!exit && plugin.sysenter != nullptr) {
+    retval = plugin.sysenter(plugin.ctx, call);
+  } else if (exit && plugin.sysexit != nullptr) {
+    plugin.sysexit(plugin.ctx, call);
+  }
+  noop = call->noop != 0;
+  return retval;
+}
+
+/**
+ * Cancel the system call, the post hook puts it back with retval as its
+ * return value.
+ */
+static void skipSystemCall(
+    int syscallNumber, long retval, globalState& gs, state& s, ptracer& t) {
+  isNoop = true;
+  noopSyscall = syscallNumber;
+  noopRetval = retval;
+  replaceSystemCallWithNoop(gs, s, t);
+  t.setReturnRegister((uint64_t)retval);
+}
+
 bool rnr::callPreHook(
     int syscallNumber,
     globalState& gs,
     state& s,
     ptracer& t,
     scheduler& sched) {
+  if (pluginV2) {
+    if (wanted(syscallNumber)) {
+      bool noop = false;
+      long retval = callPlugin(syscallNumber, false, gs, s, t, noop);
+      if (noop) {
+        skipSystemCall(syscallNumber, retval, gs, s, t);
+      }
+    }
+    return true;
+  }
+
   struct SyscallState syscallState;
   syscallState.noop = false;
   auto regs = t.getRegs();
@@ -69,11 +364,7 @@ bool rnr::callPreHook(
   // If fingerprinter indicates that the syscall shouldn't be run,
   // cancel the syscall and set the return value
   if (syscallState.noop) {
-    isNoop = true;
-    noopSyscall = syscallNumber;
-    noopRetval = prehook_retval;
-    replaceSystemCallWithNoop(gs, s, t);
-    t.setReturnRegister((uint64_t)prehook_retval);
+    skipSystemCall(syscallNumber, prehook_retval, gs, s, t);
   }
   // Return flag indicating whether to run post-hook
   return true;
@@ -92,6 +383,13 @@ void rnr::callPostHook(
     t.setReturnRegister((uint64_t)noopRetval);
     isNoop = false;
   }
+  if (pluginV2) {
+    bool noop = false;
+    if (wanted(syscallNumber)) {
+      callPlugin(syscallNumber, true, gs, s, t, noop);
+    }
+    return;
+  }
   auto regs = t.getRegs();
   auto sysexit = __rnr__.rnr_sysexit;
   sysexit(
@@ -102,10 +400,30 @@ void rnr::callPostHook(
 /* must be called early, no lock is provied */
 void rnr::loadRnr(const string& dso) {
   void* handle = dlopen(dso.c_str(), RTLD_NOW);
+  if (!handle) {
+    runtimeError("could not load " + dso + ": " + dlerror());
+  }
+  pluginLoaded = true;
+
+  auto init = dlsym(handle, "rnr_plugin_init");
+  if (init) {
+    auto initPlugin = reinterpret_cast<decltype(rnr_plugin_init)*>(
+        reinterpret_cast<unsigned long>(init));
+    memset(&plugin, 0, sizeof(plugin));
+    plugin.abi_version = RNR_PLUGIN_ABI_VERSION;
+    if (initPlugin(&plugin) != 0) {
+      runtimeError("rnr_plugin_init of " + dso + " failed");
+    }
+    if ((plugin.flags & RNR_PLUGIN_ASYNC) && plugin.consume == nullptr) {
+      runtimeError("asynchronous rnr plugin without consume()");
+    }
+    pluginV2 = true;
+    return;
+  }
 
   auto sysenter = dlsym(handle, "rnr_sysenter");
   if (!sysenter) {
-    runtimeError("could not find rnr_sysenter");
+    runtimeError("could not find rnr_sysenter or rnr_plugin_init");
   }
   auto sysexit = dlsym(handle, "rnr_sysexit");
   if (!sysexit) {
@@ -119,3 +437,12 @@ void rnr::loadRnr(const string& dso) {
 
   // NB: no dlclose to keep keep the symbols intact.
 }
+
+void rnr::finish() {
+  if (consumer.joinable()) {
+    stopConsumer.store(true, memory_order_release);
+    consumer.join();
+  }
+}
+// =======================================================================================
+bool rnr::loaded() { return pluginLoaded; }
@@ -0,0 +1,92 @@
+#include "scheduleLog.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "util.hpp"
+
+// =======================================================================================
+scheduleLog::scheduleLog(const string& path, bool follow)
+    : path(path), isFollowing(follow) {
+  if (!follow) {
+    // Check now rather than lose the log at the end of the run.
+    FILE* out = fopen(path.c_str(), "we");
+    if (out == nullptr) {
+      runtimeError("Unable to open schedule log " + path);
+    }
+    fclose(out);
+    return;
+  }
+
+  FILE* in = fopen(path.c_str(), "re");
+  if (in == nullptr) {
+    runtimeError("Unable to open schedule log " + path);
+  }
+  scheduleLogHeader header;
+  bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+      memcmp(header.magic, SCHEDULE_LOG_MAGIC, sizeof(header.magic)) == 0 &&
+      header.version == SCHEDULE_LOG_VERSION;
+  if (ok) {
+    decisions.resize(header.decisions);
+    ok = fread(decisions.data(), sizeof(int32_t), decisions.size(), in) ==
+        decisions.size();
+  }
+  fclose(in);
+  if (!ok) {
+    runtimeError(
+        path + " is not a schedule log of this version of dettrace, record "
+               "it again.");
+  }
+}
+// =======================================================================================
+scheduleLog::~scheduleLog() {
+  if (isFollowing) {
+    return;
+  }
+  FILE* out = fopen(path.c_str(), "we");
+  if (out == nullptr) {
+    perror("schedule log");
+    return;
+  }
+  scheduleLogHeader header = {};
+  memcpy(header.magic, SCHEDULE_LOG_MAGIC, sizeof(header.magic));
+  header.version = SCHEDULE_LOG_VERSION;
+  header.decisions = decisions.size();
+  if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+      fwrite(decisions.data(), sizeof(int32_t), decisions.size(), out) !=
+          decisions.size()) {
+    perror("schedule log");
+  }
+  fclose(out);
+}
+// =======================================================================================
+void scheduleLog::decided(uint64_t decision, pid_t pid) {
+  if (decisions.size() <= decision) {
+    decisions.resize(decision + 1);
+  }
+  decisions[decision] = pid;
+}
+// =======================================================================================
+void scheduleLog::futile(uint64_t decision) {
+  if (decision < decisions.size() && decisions[decision] > 0) {
+    decisions[decision] = -decisions[decision];
+    futileDecisions++;
+  }
+}
+// =======================================================================================
+bool scheduleLog::skip(uint64_t decision, pid_t pid) {
+  if (divergedAt != -1) {
+    return false;
+  }
+  if (decision >= decisions.size() ||
+      (decisions[decision] != pid && decisions[decision] != -pid)) {
+    divergedAt = decision;
+    return false;
+  }
+  if (decisions[decision] > 0) {
+    return false;
+  }
+  futileDecisions++;
+  return true;
+}
+// =======================================================================================
@@ -1,22 +1,16 @@
 #include "scheduler.hpp"
 #include "dettraceSystemCall.hpp"
 #include "logger.hpp"
+#include "probes.hpp"
 #include "ptracer.hpp"
 #include "state.hpp"
 #include "systemCallList.hpp"
 #include "util.hpp"
 
-//#include <deque>
-#include <queue>
-#include <set>
-#include <vector>
-
-bool removeElementFromHeap(priority_queue<pid_t>& heap, pid_t element);
-
 scheduler::scheduler(pid_t startingPid, logger& log)
     : log(log), nextPid(startingPid) {
   // Processes are always spawned as runnable.
-  runnableHeap.push(startingPid);
+  runnableHeap.insert(startingPid);
 }
 
 pid_t scheduler::getNext() { return nextPid; }
@@ -31,28 +25,30 @@ void scheduler::removeAndScheduleParent(pid_t child, pid_t parent) {
   }
 
   remove(child);
-  auto msg =
-      log.makeTextColored(Color::blue, "Parent [%d] scheduled for exit.\n");
-  log.writeToLog(Importance::info, msg, parent);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(Color::blue, "Parent [%d] scheduled for exit.\n"),
+      parent);
 
   nextPid = parent;
+  // Not a decision, nor a pick whose retry could be futile.
+  pickProgressed = true;
 }
 
 bool scheduler::isFinished(pid_t process) {
-  const bool finished =
-      finishedProcesses.find(process) != finishedProcesses.end();
-  return finished;
+  return finishedProcesses.contains(process);
 }
 
 // CHECK
 void scheduler::markFinishedAndScheduleNext(pid_t process) {
-  auto msg =
-      log.makeTextColored(Color::blue, "Process [%d] marked as finished!\n");
-  log.writeToLog(Importance::info, msg, process);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(Color::blue, "Process [%d] marked as finished!\n"),
+      process);
 
   auto str =
       "Process moved to finished set (deleted from runnable/blocked heaps)\n";
-  log.writeToLog(Importance::info, str);
+  DETTRACE_LOG(log, Importance::info, str);
 
   // Remove process from our regular set of runnable!
   remove(process);
@@ -64,31 +60,235 @@ void scheduler::markFinishedAndScheduleNext(pid_t process) {
 
 // CHECK
 void scheduler::preemptAndScheduleNext() {
-  pid_t curr = runnableHeap.top();
-  auto msg = log.makeTextColored(Color::blue, "Preempting process: [%d]\n");
-  log.writeToLog(Importance::info, msg, curr);
+  pid_t curr = current();
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(Color::blue, "Preempting process: [%d]\n"), curr);
 
   // We're now blocked.
-  runnableHeap.pop();
-  blockedHeap.push(curr);
-  log.writeToLog(Importance::extra, "Process marked as blocked.\n", curr);
+  runnableHeap.erase(curr);
+  blockedHeap.insert(curr);
+  DETTRACE_PROBE1(preempt, curr);
+  if (events != nullptr) {
+    events->instant(curr, "preempted");
+  }
+  DETTRACE_LOG(log, Importance::extra, "Process marked as blocked.\n", curr);
+
+  nextPid = scheduleNextProcess();
+}
+
+/** What a process parked for kind waits for, in the timeline. */
+static const char* waitKindName(waitKind kind) {
+  switch (kind) {
+  case waitKind::pipeReadable:
+    return "pipe readable";
+  case waitKind::pipeWritable:
+    return "pipe writable";
+  case waitKind::childExit:
+    return "child exit";
+  case waitKind::futex:
+    return "futex";
+  case waitKind::futexWord:
+    return "futex word";
+  case waitKind::timer:
+    return "timer";
+  case waitKind::eventfd:
+    return "eventfd";
+  }
+  return "unknown";
+}
+
+void scheduler::preemptAndWaitFor(waitReason reason) {
+  preemptAndWaitForAny(vector<waitReason>{reason}, 0);
+}
+
+void scheduler::preemptAndWaitForAny(
+    const vector<waitReason>& reasons, uint32_t retryAfter) {
+  pid_t curr = current();
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(
+          Color::blue, "Preempting process: [%d] until one of %zu events\n"),
+      curr, reasons.size());
+
+  runnableHeap.erase(curr);
+  waitingSet.insert(curr);
+  DETTRACE_PROBE2(park, curr, reasons.size());
+  for (const waitReason& reason : reasons) {
+    waiters[(int)reason.kind].emplace(reason.key, curr);
+    waitingCount[(int)reason.kind]++;
+  }
+  waitingFor[curr] = reasons;
+  if (retryAfter != 0) {
+    retryOf[curr] = retries.emplace(heapSwaps + retryAfter, curr);
+  }
+  if (events != nullptr && !reasons.empty()) {
+    events->parked(curr, waitKindName(reasons.front().kind));
+  }
+  if (producerFirst) {
+    preferWakerOf(reasons);
+  }
 
   nextPid = scheduleNextProcess();
 }
 
+void scheduler::preferWakerOf(const vector<waitReason>& reasons) {
+  for (const waitReason& reason : reasons) {
+    if (reason.kind != waitKind::pipeReadable &&
+        reason.kind != waitKind::pipeWritable) {
+      continue;
+    }
+    auto waker = wokenBy[(int)reason.kind].find(reason.key);
+    if (waker == wokenBy[(int)reason.kind].end()) {
+      continue;
+    }
+    pid_t producer = waker->second;
+    // Parked itself, or gone: nothing to gain.
+    if (blockedHeap.erase(producer)) {
+      runnableHeap.insert(producer);
+    }
+    if (runnableHeap.contains(producer)) {
+      preferred = producer;
+      return;
+    }
+  }
+}
+
+pid_t scheduler::firstRunnable() {
+  pid_t next = runnableHeap.first();
+  if (preferred != -1) {
+    if (runnableHeap.contains(preferred) && preferred != next) {
+      next = preferred;
+      producersPreferred++;
+    }
+    preferred = -1;
+  }
+  return next;
+}
+
+void scheduler::wake(waitKind kind, uint64_t key) {
+  if (!hasWaiters(kind)) {
+    return;
+  }
+  auto range = waiters[(int)kind].equal_range(key);
+  vector<pid_t> woken;
+  for (auto it = range.first; it != range.second; it++) {
+    woken.push_back(it->second);
+  }
+  // The process running woke them, see preferProducers.
+  if (producerFirst && !woken.empty() &&
+      (kind == waitKind::pipeReadable || kind == waitKind::pipeWritable)) {
+    wokenBy[(int)kind][key] = nextPid;
+  }
+  for (pid_t process : woken) {
+    forgetWaiter(process);
+    blockedHeap.insert(process);
+    waitWakeups++;
+    DETTRACE_LOG(
+        log, Importance::extra, "Woke up waiting process: [%d]\n", process);
+  }
+}
+
+void scheduler::wakeAll(waitKind kind) {
+  if (!hasWaiters(kind)) {
+    return;
+  }
+  vector<pid_t> woken;
+  for (auto& waiter : waiters[(int)kind]) {
+    woken.push_back(waiter.second);
+  }
+  for (pid_t process : woken) {
+    // Waiting on several keys of this kind, already woken.
+    if (forgetWaiter(process)) {
+      blockedHeap.insert(process);
+      waitWakeups++;
+    }
+  }
+}
+
+void scheduler::wakeDueRetries() {
+  while (!retries.empty() && retries.begin()->first <= heapSwaps) {
+    pid_t process = retries.begin()->second;
+    // Drops its retry too.
+    forgetWaiter(process);
+    blockedHeap.insert(process);
+    waitWakeups++;
+  }
+}
+
+bool scheduler::takeExpiredTimer(
+    pid_t pid, logical_clock::time_point* deadline) {
+  auto it = expiredTimers.find(pid);
+  if (it == expiredTimers.end()) {
+    return false;
+  }
+  *deadline = it->second;
+  expiredTimers.erase(it);
+  return true;
+}
+
+bool scheduler::fireNextTimer() {
+  if (timers.empty()) {
+    return false;
+  }
+  logical_clock::time_point deadline;
+  pid_t pid = timers.popEarliest(&deadline);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(Color::blue, "Timer of process [%d] went off.\n"),
+      pid);
+  expiredTimers[pid] = deadline;
+  timersFired++;
+  wake(waitKind::timer, pid);
+  return true;
+}
+
+bool scheduler::forgetWaiter(pid_t process) {
+  if (!waitingSet.erase(process)) {
+    return false;
+  }
+  if (events != nullptr) {
+    events->woken(process);
+  }
+  auto reasons = waitingFor.find(process);
+  for (const waitReason& reason : reasons->second) {
+    auto range = waiters[(int)reason.kind].equal_range(reason.key);
+    for (auto it = range.first; it != range.second; it++) {
+      if (it->second == process) {
+        waiters[(int)reason.kind].erase(it);
+        break;
+      }
+    }
+    waitingCount[(int)reason.kind]--;
+  }
+  waitingFor.erase(reasons);
+
+  auto retry = retryOf.find(process);
+  if (retry != retryOf.end()) {
+    retries.erase(retry->second);
+    retryOf.erase(retry);
+  }
+  return true;
+}
+
 // CHECK
 void scheduler::addAndScheduleNext(pid_t newProcess) {
-  auto msg = log.makeTextColored(
-      Color::blue, "New process added to scheduler: [%d]\n");
-  log.writeToLog(Importance::info, msg, newProcess);
-
-  msg = log.makeTextColored(Color::blue, "[%d] scheduled as next.\n");
-  log.writeToLog(Importance::info, msg, newProcess);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(
+          Color::blue, "New process added to scheduler: [%d]\n"),
+      newProcess);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(Color::blue, "[%d] scheduled as next.\n"),
+      newProcess);
 
   // Add the process to the runnableHeap, and set nextPid ourselves.
   // (This is because the new process is always capable of running.)
-  runnableHeap.push(newProcess);
+  runnableHeap.insert(newProcess);
   nextPid = newProcess;
+  pickProgressed = true;
+  progressSinceStall = true;
 
   // We still want to count this scheduling event :)
   callsToScheduleNextProcess++;
@@ -97,18 +297,22 @@ void scheduler::addAndScheduleNext(pid_t newProcess) {
 
 // CHECK
 void scheduler::remove(pid_t process) {
-  auto msg = log.makeTextColored(
-      Color::blue, "Removing process runnable|blocked heaps: [%d]\n");
-  log.writeToLog(Importance::info, msg, process);
+  DETTRACE_LOG(
+      log, Importance::info,
+      log.makeTextColored(
+          Color::blue, "Removing process runnable|blocked heaps: [%d]\n"),
+      process);
 
   // Sanity check that there is at least one process available.
-  if (runnableHeap.empty() && blockedHeap.empty()) {
+  if (runnableHeap.empty() && blockedHeap.empty() && waitingSet.empty()) {
     string err = "scheduler::remove: No such element to delete from scheduler.";
     runtimeError(err);
   }
 
-  if (!removeElementFromHeap(runnableHeap, process)) {
-    if (!removeElementFromHeap(blockedHeap, process)) {
+  cancelTimer(process);
+  progressSinceStall = true;
+  if (!runnableHeap.erase(process)) {
+    if (!blockedHeap.erase(process) && !forgetWaiter(process)) {
       string err =
           "scheduler::remove: No such element to delete from scheduler.";
       runtimeError(err);
@@ -126,8 +330,8 @@ bool scheduler::removeAndScheduleNext(pid_t process) {
   // complicated, but it keeps finihsed processes out of the runnable/blocked
   // queues.
   if (isFinished(process)) {
-    log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        log, Importance::info,
         "Removing markedAsFinished process from finish set.\n");
     finishedProcesses.erase(process);
   } else {
@@ -136,7 +340,7 @@ bool scheduler::removeAndScheduleNext(pid_t process) {
     remove(process);
   }
 
-  if (runnableHeap.empty() && blockedHeap.empty()) {
+  if (runnableHeap.empty() && blockedHeap.empty() && waitingSet.empty()) {
     return true;
   } else {
     nextPid = scheduleNextProcess();
@@ -144,69 +348,202 @@ bool scheduler::removeAndScheduleNext(pid_t process) {
   }
 }
 
-// CHECK
+void scheduler::replayed(pid_t pid) {
+  if (stallRounds != 0) {
+    windowReplays++;
+    windowReplaysOf[pid]++;
+  }
+  if (schedule == nullptr || schedule->following()) {
+    return;
+  }
+  // The pick, then the preempt's own decision.
+  if (!pickProgressed && decisions == pickedAt + 2 &&
+      blockedHeap.contains(pid)) {
+    schedule->futile(pickedAt);
+  }
+}
+
 pid_t scheduler::scheduleNextProcess() {
+  pid_t next = pickNextProcess();
+  if (schedule != nullptr && schedule->following()) {
+    // Exactly what the futile retry did: preemptAndScheduleNext.
+    while (schedule->skip(decisions, next)) {
+      DETTRACE_LOG(
+          log, Importance::info,
+          log.makeTextColored(Color::blue, "Skipping futile retry of [%d]\n"),
+          next);
+      decisions++;
+      runnableHeap.erase(next);
+      blockedHeap.insert(next);
+      if (events != nullptr) {
+        events->instant(next, "skipped retry");
+      }
+      next = pickNextProcess();
+    }
+  } else if (schedule != nullptr) {
+    schedule->decided(decisions, next);
+  }
+  pickedAt = decisions++;
+  pickProgressed = false;
+  return next;
+}
+
+// CHECK
+pid_t scheduler::pickNextProcess() {
   printProcesses();
   callsToScheduleNextProcess++;
 
   if (!runnableHeap.empty()) {
-    pid_t nextProcess = runnableHeap.top();
+    pid_t nextProcess = firstRunnable();
     return nextProcess;
   } else {
+    // Every few rounds, or when nobody else can run, retry parked processes
+    // too in case we missed the event that unblocks them.
+    heapSwaps++;
+    if (stallRounds != 0 && heapSwaps - windowStart >= stallWindow) {
+      checkStall();
+    }
+    wakeDueRetries();
+    bool retryAll = heapSwaps % waitRetryInterval == 0;
+    // Nobody can run, nothing happens until the next timer goes off.
+    bool stalled = blockedHeap.empty();
+    bool fired = false;
+    if (stalled || retryAll) {
+      fired = fireNextTimer();
+    }
+    if (stalled && !fired && !waitingSet.empty()) {
+      checkDeadlock();
+    }
+    if (blockedHeap.empty() || retryAll) {
+      for (int kind = 0; kind < WAIT_KIND_COUNT; kind++) {
+        wakeAll((waitKind)kind);
+      }
+    }
+    if (blockedHeap.empty() && !retries.empty()) {
+      // Only back-offs are left, nothing else happens before the first one is
+      // due: retry it now.
+      pid_t process = retries.begin()->second;
+      forgetWaiter(process);
+      blockedHeap.insert(process);
+      waitWakeups++;
+    }
     if (blockedHeap.empty()) {
       runtimeError("No processes left to run!\n");
     }
-    priority_queue<pid_t> temp = runnableHeap;
-    runnableHeap = blockedHeap;
-    blockedHeap = temp;
+    runnableHeap.swap(blockedHeap);
+    DETTRACE_PROBE1(heap_swap, heapSwaps);
+    if (events != nullptr) {
+      events->instant(0, "heap swap");
+    }
 
-    pid_t nextProcess = runnableHeap.top();
+    pid_t nextProcess = firstRunnable();
     return nextProcess;
   }
 }
 
-// CHECK
-void scheduler::printProcesses() {
-  log.writeToLog(Importance::extra, "Printing runnable processes\n");
-  // Print the runnableHeap.
-  priority_queue<pid_t> runnableCopy = runnableHeap;
-  while (!runnableCopy.empty()) {
-    pid_t curr = runnableCopy.top();
-    runnableCopy.pop();
-    log.writeToLog(Importance::extra, "Pid [%d], runnable\n", curr);
-  }
-
-  log.writeToLog(Importance::extra, "Printing blocked processes\n");
-  // Print the blockedHeap.
-  priority_queue<pid_t> blockedCopy = blockedHeap;
-  while (!blockedCopy.empty()) {
-    pid_t curr = blockedCopy.top();
-    blockedCopy.pop();
-    log.writeToLog(Importance::extra, "Pid [%d], blocked\n", curr);
+void scheduler::checkDeadlock() {
+  static_assert(
+      maxFutileStalls > state::maxReadDeferrals,
+      "reads of pipes from outside must get to run before we call deadlock");
+  // Retried on a back-off, it waits for something we can't see, a socket or a
+  // tty, which may come however long it takes.
+  for (pid_t curr = waitingSet.highest(); curr != -1;
+       curr = waitingSet.highestBelow(curr)) {
+    if (retryOf.count(curr) != 0) {
+      futileStalls = 0;
+      progressSinceStall = false;
+      return;
+    }
   }
-  return;
+  futileStalls = progressSinceStall ? 0 : futileStalls + 1;
+  progressSinceStall = false;
+  if (futileStalls < maxFutileStalls) {
+    return;
+  }
+
+  string report = "Deadlock: every tracee is waiting and " +
+      to_string(maxFutileStalls) + " rounds of retries made no progress.\n";
+  for (pid_t curr = waitingSet.highest(); curr != -1;
+       curr = waitingSet.highestBelow(curr)) {
+    report += "  [" + to_string(curr) + "] waits for " + describeWait(curr) +
+        "\n";
+  }
+  runtimeError(report);
 }
 
-// CHECK
-bool removeElementFromHeap(priority_queue<pid_t>& heap, pid_t element) {
-  vector<pid_t> elements;
-  bool foundElement = false;
+string scheduler::describeWait(pid_t process) const {
+  string wait;
+  const char* separator = "";
+  for (const waitReason& reason : waitingFor.at(process)) {
+    wait += separator + string(waitKindName(reason.kind)) + " " +
+        to_string(reason.key);
+    separator = " or ";
+  }
+  return wait;
+}
 
-  // Go through heap, try to find the element.
-  while (!heap.empty()) {
-    pid_t p = heap.top();
-    heap.pop();
-    if (element == p) {
-      foundElement = true;
-    } else {
-      elements.push_back(p);
+void scheduler::checkStall() {
+  bool stalled = windowReplays > 0 &&
+      windowProgress * stallProgressRatio < windowReplays;
+  if (stalled) {
+    stall = {stallWindow, windowProgress, windowReplays, windowReplaysOf};
+    stallFound = true;
+    // Don't report the same stall every window.
+    stallWindow = stallWindow > UINT32_MAX / 2 ? UINT32_MAX : stallWindow * 2;
+  } else {
+    stallWindow = stallRounds;
+  }
+  windowStart = heapSwaps;
+  windowProgress = 0;
+  windowReplays = 0;
+  windowReplaysOf.clear();
+}
+
+string scheduler::describeQueues(const string& indent) const {
+  string queues;
+  const pair<const char*, const pidBitmap*> heaps[] = {
+      {"runnable", &runnableHeap.members()},
+      {"blocked, to be retried", &blockedHeap.members()},
+  };
+  for (auto& heap : heaps) {
+    for (pid_t curr = heap.second->highest(); curr != -1;
+         curr = heap.second->highestBelow(curr)) {
+      queues += indent + "[" + to_string(curr) + "] " + heap.first + "\n";
     }
   }
+  for (pid_t curr = waitingSet.highest(); curr != -1;
+       curr = waitingSet.highestBelow(curr)) {
+    queues += indent + "[" + to_string(curr) + "] parked, waits for " +
+        describeWait(curr) + "\n";
+  }
+  return queues;
+}
+
+// CHECK
+void scheduler::printProcesses() {
+  // Walking the queues isn't free, skip it entirely when it won't be printed.
+  if (!log.isEnabled(Importance::extra)) {
+    return;
+  }
+
+  DETTRACE_LOG(log, Importance::extra, "Printing runnable processes\n");
+  const pidBitmap& runnable = runnableHeap.members();
+  for (pid_t curr = runnable.highest(); curr != -1;
+       curr = runnable.highestBelow(curr)) {
+    DETTRACE_LOG(log, Importance::extra, "Pid [%d], runnable\n", curr);
+  }
 
-  // Take all elements that we popped off and put them back in the heap.
-  for (auto e : elements) {
-    heap.push(e);
+  DETTRACE_LOG(log, Importance::extra, "Printing blocked processes\n");
+  const pidBitmap& blocked = blockedHeap.members();
+  for (pid_t curr = blocked.highest(); curr != -1;
+       curr = blocked.highestBelow(curr)) {
+    DETTRACE_LOG(log, Importance::extra, "Pid [%d], blocked\n", curr);
   }
 
-  return foundElement;
+  DETTRACE_LOG(log, Importance::extra, "Printing waiting processes\n");
+  for (pid_t curr = waitingSet.highest(); curr != -1;
+       curr = waitingSet.highestBelow(curr)) {
+    DETTRACE_LOG(log, Importance::extra, "Pid [%d], waiting\n", curr);
+  }
+  return;
 }
@@ -1,34 +1,380 @@
 #include "seccomp.hpp"
+#include "seccompActionCache.hpp"
 #include "util.hpp"
+#include "vdso.hpp"
 
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
+#include <iterator>
 #include <stdexcept>
 #include <string>
 
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/seccomp.h>
+#include <linux/fs.h>
+#include <linux/futex.h>
+#include <linux/audit.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <sys/personality.h>
+#include <sys/prctl.h>
 #include <sys/ptrace.h>
 #include <sys/reg.h> /* For constants ORIG_EAX, etc */
+#include <sys/stat.h>
 #include <sys/syscall.h> /* For SYS_write, etc */
+#include <unistd.h>
 
 using namespace std;
 
-seccomp::seccomp(int debugLevel, bool convertUids) {
+/**
+ * System calls dettrace never supports. Newer libcs and runtimes probe for
+ * these first and fall back to an interface we intercept when they fail, so
+ * the filter fails them directly instead of stopping the tracee just to
+ * report an error. The result is the same on every run either way.
+ */
+static const struct {
+  long systemCall;
+  int err;
+} rejectedSystemCalls[] = {
+#ifdef SYS_pidfd_send_signal
+    {SYS_pidfd_send_signal, ENOSYS},
+#endif
+#ifdef SYS_pidfd_open
+    {SYS_pidfd_open, ENOSYS},
+#endif
+#ifdef SYS_clone3
+    // Falls back to clone, where we see fork events.
+    {SYS_clone3, ENOSYS},
+#endif
+#ifdef SYS_pidfd_getfd
+    {SYS_pidfd_getfd, ENOSYS},
+#endif
+#ifdef SYS_faccessat2
+    // Falls back to faccessat.
+    {SYS_faccessat2, ENOSYS},
+#endif
+#ifdef SYS_rseq
+    {SYS_rseq, ENOSYS},
+#endif
+    // Hardware counters and BPF programs are inherently nondeterministic.
+    {SYS_perf_event_open, EPERM},
+    {SYS_bpf, EPERM},
+};
+
+/**
+ * System calls ordered by how often we see them in typical package builds,
+ * most frequent first (from --print-statistics runs and strace -c of the
+ * benchmarking/ builds). libseccomp checks higher priority system calls first,
+ * so these are resolved in a few jumps whether we allow or trace them.
+ */
+static const long hotSystemCalls[] = {
+    SYS_read, SYS_write, SYS_futex, SYS_lseek, SYS_pread64, SYS_fstat,
+    SYS_close, SYS_mmap, SYS_openat, SYS_stat, SYS_lstat, SYS_newfstatat,
+    SYS_rt_sigaction, SYS_brk, SYS_munmap, SYS_mprotect, SYS_access,
+    SYS_ioctl, SYS_fcntl, SYS_getdents64, SYS_rt_sigprocmask, SYS_wait4,
+    SYS_clone, SYS_execve, SYS_pwrite64};
+
+/**
+ * System calls --lite lets through. They only decide the order tracees run
+ * in, and they may block: in the kernel they block the tracee alone, with
+ * --lite nobody waits on it.
+ */
+static const long liteSystemCalls[] = {
+    SYS_wait4, SYS_waitid, SYS_futex, SYS_poll, SYS_select, SYS_pselect6,
+    SYS_epoll_wait, SYS_epoll_pwait, SYS_pipe, SYS_pipe2, SYS_eventfd,
+    SYS_eventfd2, SYS_socketpair, SYS_accept, SYS_accept4, SYS_recvfrom,
+    SYS_recvmsg, SYS_sendto, SYS_sendmsg, SYS_sendmmsg};
+
+seccomp::seccomp(
+    int debugLevel,
+    bool convertUids,
+    bool useNotify,
+    bool traceWritev,
+    bool bufferGate,
+    bool lite,
+    bool ioUring,
+    bool ephemeral,
+    bool virtualCpus,
+    bool fakeroot,
+    const policyProfile* profile)
+    : useNotify{useNotify},
+      bufferGate{bufferGate && !useNotify},
+      lite{lite},
+      profile{profile} {
+  if (useNotify && !isNotifySupported()) {
+    runtimeError("dettrace was built without seccomp notify support.\n");
+  }
+
+  // The notify fd only comes from libseccomp loading the filter itself.
+  string cache = useNotify
+      ? ""
+      : cachePath(
+            debugLevel >= 4, convertUids, traceWritev, lite, ioUring,
+            ephemeral, virtualCpus, fakeroot, profile);
+  if (!cache.empty() && loadCache(cache)) {
+    return;
+  }
+
   ctx = seccomp_init(SCMP_ACT_TRACE(INT16_MAX));
 
   if (ctx == nullptr) {
     runtimeError("Unable to init seccomp filter.\n");
   }
 
-  loadRules(debugLevel >= 4, convertUids);
+  loadRules(
+      debugLevel >= 4, convertUids, traceWritev, ioUring, ephemeral,
+      virtualCpus, fakeroot);
+  optimizeRuleOrder();
+  if (!cache.empty()) {
+    saveCache(cache);
+  }
+  if (this->bufferGate && !exportProgram(cachedProgram)) {
+    this->bufferGate = false;
+  }
+}
+
+bool seccomp::exportProgram(vector<struct sock_filter>& program) {
+  int fd = syscall(SYS_memfd_create, "dettrace-seccomp", MFD_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  off_t size = -1;
+  if (seccomp_export_bpf(ctx, fd) == 0) {
+    size = lseek(fd, 0, SEEK_END);
+  }
+  bool ok = size > 0 && size % sizeof(struct sock_filter) == 0;
+  if (ok) {
+    program.resize(size / sizeof(struct sock_filter));
+    ok = pread(fd, program.data(), size, 0) == size;
+  }
+  close(fd);
+  if (!ok) {
+    program.clear();
+  }
+  return ok;
 }
 
-void seccomp::loadRules(bool debug, bool convertUids) {
+vector<struct sock_filter> seccomp::gateRules() {
+  const uint64_t gate = logicalClockPageAddr + logicalClockGateOffset;
+  const uint32_t ipLow = offsetof(struct seccomp_data, instruction_pointer);
+  static_assert(
+      (logicalClockPageAddr & 0xffffffff) + logicalClockPageSize <=
+          UINT32_MAX,
+      "the gate must not straddle 4GB");
+  // Jumps are relative to the next instruction, anything else goes on to the
+  // rules after these. The number is checked before the instruction pointer:
+  // the kernel only caches system calls whose verdict depends on nothing but
+  // their number and architecture, see seccompActionCache, and every other
+  // system call still gets there.
+  return {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 0, 9),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_read, 1, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_write, 0, 6),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ipLow + 4),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)(gate >> 32), 0, 4),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ipLow),
+      BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)gate, 0, 2),
+      BPF_JUMP(
+          BPF_JMP | BPF_JGE | BPF_K, (uint32_t)gate + logicalClockGateSize, 1,
+          0),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+}
+
+void seccomp::addGate(vector<struct sock_filter>& program) {
+  vector<struct sock_filter> rules = gateRules();
+  if (rules.size() + program.size() <= BPF_MAXINSNS) {
+    program.insert(program.begin(), rules.begin(), rules.end());
+  }
+}
+
+vector<uint32_t> seccomp::alwaysAllowed() {
+  vector<struct sock_filter> program = cachedProgram;
+  if (program.empty() && (ctx == nullptr || !exportProgram(program))) {
+    return {};
+  }
+  if (bufferGate) {
+    addGate(program);
+  }
+  return seccompActionCache::alwaysAllowed(program, AUDIT_ARCH_X86_64);
+}
+
+string seccomp::describeAlwaysAllowed() {
+  vector<uint32_t> allowed = alwaysAllowed();
+  string names;
+  for (uint32_t nr : allowed) {
+    char* name = seccomp_syscall_resolve_num_arch(SCMP_ARCH_X86_64, nr);
+    names += (names.empty() ? "" : ",") +
+        (name != nullptr ? string{name} : to_string(nr));
+    free(name);
+  }
+  return to_string(allowed.size()) + " (" + names + ")";
+}
+
+string seccomp::cachePath(
+    bool debug,
+    bool convertUids,
+    bool traceWritev,
+    bool lite,
+    bool ioUring,
+    bool ephemeral,
+    bool virtualCpus,
+    bool fakeroot,
+    const policyProfile* profile) {
+  if (getenv("DETTRACE_NO_SECCOMP_CACHE") != nullptr) {
+    return "";
+  }
+  string dir;
+  const char* xdgCache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdgCache != nullptr && xdgCache[0] == '/') {
+    dir = xdgCache;
+  } else if (home != nullptr && home[0] == '/') {
+    dir = string{home} + "/.cache";
+  } else {
+    return "";
+  }
+  mkdir(dir.c_str(), 0755);
+  dir += "/dettrace";
+  if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+    return "";
+  }
+
+  const struct scmp_version* library = seccomp_version();
+  return dir + "/seccomp-" APP_VERSION "+build." APP_BUILDID "-libseccomp" +
+      to_string(library->major) + "." + to_string(library->minor) + "." +
+      to_string(library->micro) + (debug ? "-debug" : "") +
+      (convertUids ? "-uids" : "") + (traceWritev ? "-writev" : "") +
+      (lite ? "-lite" : "") + (ioUring ? "-io_uring" : "") +
+      (ephemeral ? "-ephemeral" : "") + (virtualCpus ? "-cpus" : "") +
+      (fakeroot ? "-fakeroot" : "") +
+      (profile != nullptr ? "-profile" + to_string(profile->fingerprint())
+                          : "") +
+      ".bpf";
+}
+
+bool seccomp::loadCache(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat info;
+  bool ok = fstat(fd, &info) == 0 && info.st_size > 0 &&
+      info.st_size % sizeof(struct sock_filter) == 0 &&
+      info.st_size / sizeof(struct sock_filter) <= BPF_MAXINSNS;
+  if (ok) {
+    cachedProgram.resize(info.st_size / sizeof(struct sock_filter));
+    ssize_t bytes = read(fd, cachedProgram.data(), info.st_size);
+    ok = bytes == info.st_size;
+  }
+  close(fd);
+  if (!ok) {
+    cachedProgram.clear();
+  }
+  return ok;
+}
+
+void seccomp::saveCache(const string& path) {
+  // Written under a name of our own then renamed, concurrent runs never see a
+  // partial program.
+  string tmpPath = path + "." + to_string(getpid()) + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return;
+  }
+  bool ok = seccomp_export_bpf(ctx, fd) == 0;
+  close(fd);
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) == -1) {
+    unlink(tmpPath.c_str());
+  }
+}
+
+void seccomp::optimizeRuleOrder() {
+  uint8_t priority = UINT8_MAX;
+  for (long systemCall : hotSystemCalls) {
+    int ret = seccomp_syscall_priority(ctx, systemCall, priority--);
+    if (ret < 0) {
+      runtimeError(
+          "Failed to set system call priority! Reason: \n" +
+          to_string(systemCall));
+    }
+  }
+
+#if SCMP_VER_MAJOR > 2 || (SCMP_VER_MAJOR == 2 && SCMP_VER_MINOR >= 5)
+  // Compile the rest into a binary search on the system call number rather
+  // than a linear chain. A libseccomp older than the headers we built with
+  // rejects the attribute, then we keep the linear filter.
+  seccomp_attr_set(ctx, SCMP_FLTATR_CTL_OPTIMIZE, 2);
+#endif
+}
+
+void seccomp::loadRules(
+    bool debug,
+    bool convertUids,
+    bool traceWritev,
+    bool ioUring,
+    bool ephemeral,
+    bool virtualCpus,
+    bool fakeroot) {
+  for (const auto& rejected : rejectedSystemCalls) {
+    reject(rejected.systemCall, rejected.err);
+  }
+
+  // Nothing a job writes has to survive a crash of the machine: flushes to
+  // disk succeed right away. msync only flushes with MS_SYNC.
+  if (ephemeral) {
+    for (uint16_t flush : {SYS_fsync, SYS_fdatasync, SYS_sync, SYS_syncfs,
+                           SYS_sync_file_range}) {
+      succeed(flush);
+    }
+    succeed(SYS_msync, {SCMP_A2(SCMP_CMP_MASKED_EQ, MS_SYNC, MS_SYNC)});
+    noIntercept(SYS_msync, {SCMP_A2(SCMP_CMP_MASKED_EQ, MS_SYNC, 0)});
+  } else {
+    noIntercept(SYS_fdatasync);
+    noIntercept(SYS_fsync);
+    noIntercept(SYS_msync);
+    noIntercept(SYS_sync);
+  }
+
+#ifdef SYS_io_uring_setup
+  if (ioUring) {
+    intercept(SYS_io_uring_setup);
+    intercept(SYS_io_uring_enter);
+    // Rings only take the registrations we restrict them to, see ioUring.
+    noIntercept(SYS_io_uring_register);
+  } else {
+    reject(SYS_io_uring_setup, ENOSYS);
+    reject(SYS_io_uring_enter, ENOSYS);
+    reject(SYS_io_uring_register, ENOSYS);
+  }
+#endif
+
   // Add other UID functions we might need to intercept here!
-  if (convertUids) {
+  if (fakeroot) {
+    // Their owners are ours to keep, see fakeOwnership, chmods below.
+    intercept(SYS_fchownat);
+    intercept(SYS_chown);
+    intercept(SYS_lchown);
+    intercept(SYS_fchown);
+  } else if (convertUids && debug) {
     intercept(SYS_fchownat);
     intercept(SYS_chown);
     intercept(SYS_lchown);
     intercept(SYS_fchown);
+  } else if (convertUids) {
+    // Owner and group are converted to 0, a call already giving 0 for both
+    // (install -o root -g root) is left as it is and needs no stop.
+    noIntercept(
+        SYS_fchownat, {SCMP_A2(SCMP_CMP_EQ, 0), SCMP_A3(SCMP_CMP_EQ, 0)});
+    for (uint16_t systemCall : {SYS_chown, SYS_lchown, SYS_fchown}) {
+      noIntercept(
+          systemCall, {SCMP_A1(SCMP_CMP_EQ, 0), SCMP_A2(SCMP_CMP_EQ, 0)});
+    }
   } else {
     noIntercept(SYS_fchownat);
     noIntercept(SYS_chown);
@@ -44,9 +390,16 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   // Bind seems safe enough to let though, specially since user is stuck in
   // chroot. There might be some slight issues with permission denied if we set
   // up our bind mounts wrong and might need to allow for recursive mounting.
-  // But it will be obvious.
-  noIntercept(SYS_bind);
-  noIntercept(SYS_splice);
+  // But it will be obvious. Seen for the unix sockets it creates, see
+  // globalState::missing, like links.
+  intercept(SYS_bind);
+  // In-kernel copies. Only a blocking pipe at either end needs us, see
+  // sendfileSystemCall. copy_file_range only copies between regular files.
+  intercept(SYS_sendfile);
+  intercept(SYS_splice);
+#ifdef SYS_copy_file_range
+  noIntercept(SYS_copy_file_range);
+#endif
   noIntercept(SYS_dup3);
   noIntercept(SYS_capget);
   noIntercept(SYS_capset);
@@ -66,7 +419,7 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_epoll_create1);
   noIntercept(SYS_epoll_create);
   // noIntercept(SYS_epoll_ctl);
-  intercept(SYS_epoll_ctl);
+  inspect(SYS_epoll_ctl);
   intercept(SYS_epoll_wait);
   intercept(SYS_epoll_pwait);
   // Advise on access patter by program of file.
@@ -74,15 +427,14 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_fallocate);
   // Variants of regular function that use file descriptor instead of char*
   // path.
-  noIntercept(SYS_fchdir);
-  noIntercept(SYS_fchmod);
-  noIntercept(SYS_fchmodat);
+  // Both change the cwd tracee paths are resolved against, see traceePaths.
+  intercept(SYS_fchdir);
+  intercept(SYS_fchmod, fakeroot);
+  intercept(SYS_fchmodat, fakeroot);
 
-  noIntercept(SYS_fdatasync);
   // TODO Flock may block! In the future this may lead to deadlock.
   // deal with it then :)
   noIntercept(SYS_flock);
-  noIntercept(SYS_fsync);
   noIntercept(SYS_ftruncate);
   // TODO: Add to intercept with debug for path.
   noIntercept(SYS_fsetxattr);
@@ -103,14 +455,19 @@ void seccomp::loadRules(bool debug, bool convertUids) {
 
   noIntercept(SYS_mprotect);
   noIntercept(SYS_mremap);
-  noIntercept(SYS_msync);
   noIntercept(SYS_lseek);
 
   noIntercept(SYS_prctl);
   noIntercept(SYS_pread64);
   noIntercept(SYS_pwrite64);
   noIntercept(SYS_listxattr);
-  intercept(SYS_rt_sigprocmask);
+  // Only masks rt_sigsuspend injects need a hook, and only those set a mask.
+  // Reading the mask alone, with a NULL set, stays in the kernel.
+  if (debug) {
+    intercept(SYS_rt_sigprocmask);
+  } else {
+    noIntercept(SYS_rt_sigprocmask, {SCMP_A1(SCMP_CMP_EQ, 0)});
+  }
 
   // intercept(SYS_sigaction); // is mapped to SYS_rt_sigaction on cat16
   // intercept(SYS_signal); // is mapped to SYS_rt_sigaction on cat16
@@ -134,26 +491,24 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_setuid);
   // This seems to be, surprisingly, deterministic. The affinity is set/get by
   // us so it should always be the same mask. User cannot actually observe
-  // differences.
-  noIntercept(SYS_sched_getaffinity);
-  noIntercept(SYS_sched_setaffinity);
+  // differences. Unless it is --cpus that they should see.
+  intercept(SYS_sched_getaffinity, virtualCpus);
+  intercept(SYS_sched_setaffinity, virtualCpus);
   intercept(SYS_socket);
-  noIntercept(SYS_sync);
+  intercept(SYS_socketpair);
   noIntercept(SYS_umask);
 
   // Okay to not intercept.
   noIntercept(SYS_getsockname);
   noIntercept(SYS_getsockopt);
   noIntercept(SYS_setsockopt);
-  noIntercept(SYS_socketpair);
   noIntercept(SYS_mlock);
   noIntercept(SYS_setsid);
 
   noIntercept(SYS_sched_yield);
   noIntercept(SYS_truncate);
-  noIntercept(SYS_eventfd2);
-  // TODO
-  noIntercept(SYS_writev);
+  // TODO: only --hash-outputs needs to see these for now.
+  intercept(SYS_writev, traceWritev);
 
   // These system calls must be intercepted as to know when a fork even has
   // happened: We handle forks when see the system call pre exit. Since this is
@@ -166,12 +521,17 @@ void seccomp::loadRules(bool debug, bool convertUids) {
 
   noIntercept(SYS_clone);
 
-  intercept(SYS_rename, debug);
-  intercept(SYS_renameat, debug);
-  intercept(SYS_renameat2, debug);
-  intercept(SYS_rmdir, debug);
-  intercept(SYS_unlink, debug);
-  intercept(SYS_unlinkat, debug);
+  // Moving or removing directories invalidates cached tracee paths, see
+  // pathTable, and unlinks may free inodes we mapped. Handlers only logging
+  // their arguments are let through below debug level 4 instead, access,
+  // chmod, getrlimit and set_robust_list among them; these and chdir keep
+  // their stop, a pre-hook one, see globalState::pathUpdatesInPreHooks.
+  intercept(SYS_rename);
+  intercept(SYS_renameat);
+  intercept(SYS_renameat2);
+  intercept(SYS_rmdir);
+  intercept(SYS_unlink);
+  intercept(SYS_unlinkat);
 
   intercept(SYS_execve);
 
@@ -188,16 +548,26 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_timerfd_create);
   intercept(SYS_timerfd_settime);
   intercept(SYS_timerfd_gettime);
+  // Reads of them are served by the tracer, see serveEventfdRead.
+  intercept(SYS_eventfd);
+  intercept(SYS_eventfd2);
 
   // These system calls cause an even that is caught by ptrace and determinized:
   intercept(SYS_access, debug);
   // Not used, let's figure out who does one!
   intercept(SYS_alarm);
-  intercept(SYS_chdir, debug);
-  intercept(SYS_chmod, debug);
+  intercept(SYS_chdir);
+  if (fakeroot) {
+    intercept(SYS_chmod);
+  } else {
+    inspect(SYS_chmod, debug);
+  }
   intercept(SYS_creat);
   intercept(SYS_clock_gettime);
   intercept(SYS_close);
+#ifdef SYS_close_range
+  intercept(SYS_close_range);
+#endif
   // TODO: This system call
   intercept(SYS_connect);
 
@@ -205,14 +575,37 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_dup);
   intercept(SYS_dup2);
 
-  intercept(SYS_faccessat, debug);
+  inspect(SYS_faccessat, debug);
   intercept(SYS_fgetxattr, debug);
   intercept(SYS_flistxattr, debug);
-  intercept(SYS_fcntl);
+  // Only duplicating a descriptor and setting O_NONBLOCK change our state;
+  // the plain get/set and locking commands are left in kernel.
+  if (debug) {
+    intercept(SYS_fcntl);
+  } else {
+    for (int cmd : {F_GETFD, F_SETFD, F_GETFL, F_GETLK, F_SETLK, F_SETLKW}) {
+      noIntercept(SYS_fcntl, {SCMP_A1(SCMP_CMP_EQ, (scmp_datum_t)cmd)});
+    }
+    noIntercept(
+        SYS_fcntl,
+        {SCMP_A1(SCMP_CMP_EQ, F_SETFL),
+         SCMP_A2(SCMP_CMP_MASKED_EQ, O_NONBLOCK, 0)});
+  }
   intercept(SYS_fstat);
   intercept(SYS_fstatfs);
 
-  intercept(SYS_futex);
+  // Only the waits can block and need to be turned into polling, wakeups
+  // go straight to the kernel. The private and clock flags are masked off.
+  if (debug || lite) {
+    intercept(SYS_futex);
+  } else {
+    const scmp_datum_t cmdMask = (uint32_t)FUTEX_CMD_MASK;
+    for (scmp_datum_t cmd :
+         {FUTEX_WAKE, FUTEX_REQUEUE, FUTEX_CMP_REQUEUE, FUTEX_WAKE_OP,
+          FUTEX_WAKE_BITSET}) {
+      noIntercept(SYS_futex, {SCMP_A1(SCMP_CMP_MASKED_EQ, cmdMask, cmd)});
+    }
+  }
   intercept(SYS_getcwd, debug);
   intercept(SYS_getdents);
   // TODO
@@ -221,12 +614,27 @@ void seccomp::loadRules(bool debug, bool convertUids) {
 #ifdef SYS_getrandom
   intercept(SYS_getrandom);
 #endif
-  intercept(SYS_getrlimit);
+  intercept(SYS_getrlimit, debug);
   intercept(SYS_getrusage);
   intercept(SYS_gettimeofday);
-  // TODO we might be able to use seccomp to only intercept on the ioctl system
-  // calls arguments that we care about
-  intercept(SYS_ioctl);
+  // Requests our ioctl handler passes through untouched run in kernel. Every
+  // other request still stops so the handler can emulate it or reject it as
+  // unsupported.
+  if (debug) {
+    intercept(SYS_ioctl);
+  } else {
+    const scmp_datum_t passThroughRequests[] = {
+        TCGETS,      TCSETS,        TCSETSW,     TCSETSF,    TCGETA,
+        FIOCLEX,     FIONCLEX,      FIONREAD,    TIOCSPGRP,  TIOCGPGRP,
+        TIOCGPTN,    TIOCSPTLCK,    TIOCGPTPEER, TIOCSCTTY,  TIOCSWINSZ,
+        SIOCGIFADDR, SIOCGIFHWADDR, SIOCSIFMAP,  FS_IOC_FIEMAP};
+    for (scmp_datum_t request : passThroughRequests) {
+      noIntercept(SYS_ioctl, {SCMP_A1(SCMP_CMP_EQ, request)});
+    }
+#ifdef FICLONE
+    noIntercept(SYS_ioctl, {SCMP_A1(SCMP_CMP_EQ, FICLONE)});
+#endif
+  }
   // TODO
   intercept(SYS_llistxattr);
   // TODO
@@ -238,6 +646,9 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_nanosleep);
   intercept(SYS_newfstatat);
   intercept(SYS_lstat);
+#ifdef SYS_statx
+  intercept(SYS_statx);
+#endif
 
   // System calls that can create a new file for us to keep track of.
   intercept(SYS_mkdir);
@@ -248,11 +659,14 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_symlinkat);
   intercept(SYS_open);
   intercept(SYS_openat);
+#ifdef SYS_openat2
+  intercept(SYS_openat2);
+#endif
 
   intercept(SYS_tgkill);
 
-  intercept(SYS_link, debug);
-  intercept(SYS_linkat, debug);
+  inspect(SYS_link);
+  inspect(SYS_linkat);
 
   intercept(SYS_pipe);
   intercept(SYS_pipe2);
@@ -261,8 +675,8 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_poll);
   intercept(SYS_prlimit64);
   intercept(SYS_read);
-  intercept(SYS_readlink, debug);
-  intercept(SYS_readlinkat, debug);
+  inspect(SYS_readlink, debug);
+  inspect(SYS_readlinkat, debug);
   // TODO
   intercept(SYS_recvmsg);
   intercept(SYS_sendmsg);
@@ -278,7 +692,7 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   // Defintely not deteministic </3
   intercept(SYS_select);
   // TODO
-  intercept(SYS_set_robust_list);
+  intercept(SYS_set_robust_list, debug);
   intercept(SYS_stat);
   intercept(SYS_statfs);
   intercept(SYS_sysinfo);
@@ -305,9 +719,42 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   // noIntercept(SYS_shmat);
   // noIntercept(SYS_shmdt);
   // noIntercept(SYS_shmctl);
+
+  // Overrides of system calls we have no rule for.
+  if (profile != nullptr) {
+    for (const auto& policy : profile->overrides()) {
+      overridden(policy.first);
+    }
+  }
+}
+
+bool seccomp::overridden(uint16_t systemCall) {
+  const systemCallPolicy* policy =
+      profile == nullptr ? nullptr : profile->find(systemCall);
+  if (policy == nullptr) {
+    return false;
+  }
+  if (!overridesApplied.insert(systemCall).second) {
+    return true;
+  }
+
+  uint32_t action = policy->what == disposition::allow
+      ? SCMP_ACT_ALLOW
+      : policy->what == disposition::reject ? SCMP_ACT_ERRNO(policy->err)
+                                            : SCMP_ACT_TRACE(systemCall);
+  int ret = seccomp_rule_add(ctx, action, systemCall, 0);
+  if (ret < 0) {
+    runtimeError(
+        "Failed to add system call profile rule! Reason: \n" +
+        to_string(systemCall));
+  }
+  return true;
 }
 
 void seccomp::noIntercept(uint16_t systemCall) {
+  if (overridden(systemCall)) {
+    return;
+  }
   // Send system call number as data to tracer to avoid a ptrace(GET_REGS).
   int ret = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, systemCall, 0);
   if (ret < 0) {
@@ -320,6 +767,15 @@ void seccomp::noIntercept(uint16_t systemCall) {
 }
 
 void seccomp::intercept(uint16_t systemCall) {
+  if (overridden(systemCall)) {
+    return;
+  }
+  if (lite &&
+      find(begin(liteSystemCalls), end(liteSystemCalls), systemCall) !=
+          end(liteSystemCalls)) {
+    noIntercept(systemCall);
+    return;
+  }
   // Send system call number as data to tracer to avoid a ptrace(GET_REGS).
   int ret = seccomp_rule_add(ctx, SCMP_ACT_TRACE(systemCall), systemCall, 0);
   if (ret < 0) {
@@ -331,6 +787,68 @@ void seccomp::intercept(uint16_t systemCall) {
   return;
 }
 
+void seccomp::inspect(uint16_t systemCall) {
+  if (overridden(systemCall)) {
+    return;
+  }
+  if (!useNotify) {
+    intercept(systemCall);
+    return;
+  }
+
+#ifdef SCMP_ACT_NOTIFY
+  int ret = seccomp_rule_add(ctx, SCMP_ACT_NOTIFY, systemCall, 0);
+  if (ret < 0) {
+    runtimeError(
+        "Failed to add system call notify rule! Reason: \n" +
+        to_string(systemCall));
+  }
+#endif
+
+  return;
+}
+
+void seccomp::inspect(uint16_t systemCall, bool cond) {
+  if (cond) {
+    inspect(systemCall);
+  } else {
+    noIntercept(systemCall);
+  }
+
+  return;
+}
+
+void seccomp::reject(uint16_t systemCall, int err) {
+  if (overridden(systemCall)) {
+    return;
+  }
+  int ret = seccomp_rule_add(ctx, SCMP_ACT_ERRNO(err), systemCall, 0);
+  if (ret < 0) {
+    runtimeError(
+        "Failed to add system call rejection rule! Reason: \n" +
+        to_string(systemCall));
+  }
+
+  return;
+}
+
+void seccomp::succeed(
+    uint16_t systemCall, const vector<scmp_arg_cmp>& argFilters) {
+  if (overridden(systemCall)) {
+    return;
+  }
+  int ret = seccomp_rule_add_array(
+      ctx, SCMP_ACT_ERRNO(0), systemCall, argFilters.size(),
+      argFilters.data());
+  if (ret < 0) {
+    runtimeError(
+        "Failed to add system call success rule! Reason: \n" +
+        to_string(systemCall));
+  }
+
+  return;
+}
+
 void seccomp::intercept(uint16_t systemCall, bool cond) {
   if (cond) {
     intercept(systemCall);
@@ -341,11 +859,77 @@ void seccomp::intercept(uint16_t systemCall, bool cond) {
   return;
 }
 
+void seccomp::noIntercept(
+    uint16_t systemCall, const vector<scmp_arg_cmp>& argFilters) {
+  if (overridden(systemCall)) {
+    return;
+  }
+  int ret = seccomp_rule_add_array(
+      ctx, SCMP_ACT_ALLOW, systemCall, argFilters.size(), argFilters.data());
+  if (ret < 0) {
+    runtimeError(
+        "Failed to add system call argument no interception rule! Reason: \n" +
+        to_string(systemCall));
+  }
+
+  return;
+}
+
+void seccomp::intercept(
+    uint16_t systemCall, const vector<scmp_arg_cmp>& argFilters) {
+  if (overridden(systemCall)) {
+    return;
+  }
+  int ret = seccomp_rule_add_array(
+      ctx,
+      SCMP_ACT_TRACE(systemCall),
+      systemCall,
+      argFilters.size(),
+      argFilters.data());
+  if (ret < 0) {
+    runtimeError(
+        "Failed to add system call argument interception rule! Reason: \n" +
+        to_string(systemCall));
+  }
+
+  return;
+}
+
+bool seccomp::isArgumentFiltered(long systemCall) {
+  return systemCall == SYS_fcntl || systemCall == SYS_futex ||
+      systemCall == SYS_ioctl || systemCall == SYS_fchownat ||
+      systemCall == SYS_chown || systemCall == SYS_lchown ||
+      systemCall == SYS_fchown;
+}
+
+bool seccomp::isNotifySupported() {
+#ifdef SCMP_ACT_NOTIFY
+  return true;
+#else
+  return false;
+#endif
+}
+
 void seccomp::loadFilterToKernel() {
+  if (bufferGate) {
+    addGate(cachedProgram);
+  }
+  if (!cachedProgram.empty()) {
+    struct sock_fprog program = {
+        (unsigned short)cachedProgram.size(), cachedProgram.data()};
+    doWithCheck(
+        prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program, 0, 0),
+        "Unable to load cached seccomp filter");
+    return;
+  }
   int ret = seccomp_load(ctx);
   if (ret < 0) {
     runtimeError("Unable to seccomp_load.\n Reason: " + string{strerror(-ret)});
   }
 }
 
-seccomp::~seccomp() { seccomp_release(ctx); }
+seccomp::~seccomp() {
+  if (ctx != nullptr) {
+    seccomp_release(ctx);
+  }
+}
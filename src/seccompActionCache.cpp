@@ -0,0 +1,60 @@
+#include "seccompActionCache.hpp"
+
+#include <linux/seccomp.h>
+#include <stddef.h>
+
+// =======================================================================================
+bool seccompActionCache::alwaysAllows(
+    const vector<struct sock_filter>& program, uint32_t arch, uint32_t nr) {
+  uint32_t accumulator = 0;
+  // Classic BPF only jumps forward, every path ends within size steps.
+  for (size_t pc = 0; pc < program.size(); pc++) {
+    const struct sock_filter& insn = program[pc];
+    switch (insn.code) {
+    case BPF_LD | BPF_W | BPF_ABS:
+      if (insn.k == offsetof(struct seccomp_data, nr)) {
+        accumulator = nr;
+      } else if (insn.k == offsetof(struct seccomp_data, arch)) {
+        accumulator = arch;
+      } else {
+        return false;
+      }
+      break;
+    case BPF_RET | BPF_K:
+      return insn.k == SECCOMP_RET_ALLOW;
+    case BPF_JMP | BPF_JA:
+      pc += insn.k;
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_K:
+      pc += accumulator == insn.k ? insn.jt : insn.jf;
+      break;
+    case BPF_JMP | BPF_JGE | BPF_K:
+      pc += accumulator >= insn.k ? insn.jt : insn.jf;
+      break;
+    case BPF_JMP | BPF_JGT | BPF_K:
+      pc += accumulator > insn.k ? insn.jt : insn.jf;
+      break;
+    case BPF_JMP | BPF_JSET | BPF_K:
+      pc += (accumulator & insn.k) != 0 ? insn.jt : insn.jf;
+      break;
+    case BPF_ALU | BPF_AND | BPF_K:
+      accumulator &= insn.k;
+      break;
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+// =======================================================================================
+vector<uint32_t> seccompActionCache::alwaysAllowed(
+    const vector<struct sock_filter>& program, uint32_t arch) {
+  vector<uint32_t> allowed;
+  for (uint32_t nr = 0; nr < systemCallCount; nr++) {
+    if (alwaysAllows(program, arch, nr)) {
+      allowed.push_back(nr);
+    }
+  }
+  return allowed;
+}
+// =======================================================================================
@@ -0,0 +1,152 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sharedTables.hpp"
+
+// =======================================================================================
+sharedTables::sharedTables() {
+  memfd = syscall(SYS_memfd_create, "dettrace-tables", MFD_CLOEXEC);
+  if (memfd == -1) {
+    return;
+  }
+  void* local = MAP_FAILED;
+  if (ftruncate(memfd, sharedTablesSize) == 0) {
+    local = mmap(
+        nullptr, sharedTablesSize, PROT_READ | PROT_WRITE, MAP_SHARED, memfd,
+        0);
+  }
+  if (local == MAP_FAILED) {
+    close(memfd);
+    memfd = -1;
+    return;
+  }
+  // A fresh memfd reads as zeros: empty tables, sequence 0.
+  header = (sharedTablesHeader*)local;
+  header->version = SHARED_TABLES_VERSION;
+  header->slots = sharedTableSlots;
+  header->complete = 1;
+}
+// =======================================================================================
+sharedTables::~sharedTables() {
+  if (header != nullptr) {
+    munmap(header, sharedTablesSize);
+    close(memfd);
+  }
+}
+// =======================================================================================
+void sharedTables::publishInode(uint64_t realInode, uint64_t virtualInode) {
+  if (header == nullptr) {
+    return;
+  }
+  beginWrite();
+  insert(
+      (sharedTableEntry*)sharedTablesInodes(header), header->inodes, realInode,
+      virtualInode);
+  endWrite();
+}
+// =======================================================================================
+void sharedTables::publishMtime(uint64_t realInode, int64_t mtime) {
+  if (header == nullptr) {
+    return;
+  }
+  beginWrite();
+  insert(
+      (sharedTableEntry*)sharedTablesMtimes(header), header->mtimes, realInode,
+      mtime);
+  endWrite();
+}
+// =======================================================================================
+void sharedTables::publishEpoch(int64_t epoch) {
+  if (header == nullptr) {
+    return;
+  }
+  beginWrite();
+  header->epoch = epoch;
+  endWrite();
+}
+// =======================================================================================
+void sharedTables::publishRandomPositions(
+    uint64_t getrandom, uint64_t devRandom, uint64_t devUrandom) {
+  if (header == nullptr) {
+    return;
+  }
+  beginWrite();
+  header->getrandomPosition = getrandom;
+  header->devRandomPosition = devRandom;
+  header->devUrandomPosition = devUrandom;
+  endWrite();
+}
+// =======================================================================================
+void sharedTables::forgetInode(uint64_t realInode) {
+  if (header == nullptr) {
+    return;
+  }
+  beginWrite();
+  erase(
+      (sharedTableEntry*)sharedTablesInodes(header), header->inodes, realInode);
+  erase(
+      (sharedTableEntry*)sharedTablesMtimes(header), header->mtimes, realInode);
+  endWrite();
+}
+// =======================================================================================
+void sharedTables::beginWrite() {
+  header->sequence.store(
+      header->sequence.load(memory_order_relaxed) + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+// =======================================================================================
+void sharedTables::endWrite() {
+  header->sequence.store(
+      header->sequence.load(memory_order_relaxed) + 1, memory_order_release);
+}
+// =======================================================================================
+void sharedTables::insert(
+    sharedTableEntry* table,
+    uint64_t& count,
+    uint64_t realInode,
+    int64_t value) {
+  if (realInode == 0) {
+    return;
+  }
+  uint32_t i = sharedTableSlot(realInode);
+  while (table[i].realInode != 0 && table[i].realInode != realInode) {
+    i = (i + 1) & (sharedTableSlots - 1);
+  }
+  if (table[i].realInode == 0) {
+    // Keep probes short, past three quarters full readers ask the tracer.
+    if (count >= sharedTableSlots / 4 * 3) {
+      header->complete = 0;
+      return;
+    }
+    count++;
+  }
+  // The value first: a reader never sees the key of a slot without its value.
+  table[i].value = value;
+  atomic_thread_fence(memory_order_release);
+  table[i].realInode = realInode;
+}
+// =======================================================================================
+void sharedTables::erase(
+    sharedTableEntry* table, uint64_t& count, uint64_t realInode) {
+  const uint32_t mask = sharedTableSlots - 1;
+  uint32_t hole = sharedTableSlot(realInode);
+  while (table[hole].realInode != 0 && table[hole].realInode != realInode) {
+    hole = (hole + 1) & mask;
+  }
+  if (realInode == 0 || table[hole].realInode == 0) {
+    return;
+  }
+  // Shift back the entries probed past it, readers retry on the sequence.
+  for (uint32_t i = (hole + 1) & mask; table[i].realInode != 0;
+       i = (i + 1) & mask) {
+    uint32_t fromHome = (i - sharedTableSlot(table[i].realInode)) & mask;
+    if (fromHome >= ((i - hole) & mask)) {
+      table[hole] = table[i];
+      hole = i;
+    }
+  }
+  table[hole].realInode = 0;
+  count--;
+}
+// =======================================================================================
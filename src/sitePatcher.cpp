@@ -0,0 +1,440 @@
+#include "sitePatcher.hpp"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include "vdso.hpp"
+
+// =======================================================================================
+bool patchSites::trapped(uint64_t site, uint32_t trapsBeforePatching) {
+  uint32_t& count = traps[site];
+  if (count == UINT32_MAX) {
+    return false;
+  }
+  count++;
+  return count >= trapsBeforePatching;
+}
+// =======================================================================================
+void patchSites::giveUp(uint64_t site) { traps[site] = UINT32_MAX; }
+// =======================================================================================
+uint64_t patchSites::reserve(uint64_t site, size_t size) {
+  for (region& r : regions) {
+    if (r.used + size <= regionSize && inJumpReach(site, r.start) &&
+        inJumpReach(site, r.start + regionSize)) {
+      uint64_t start = r.start + r.used;
+      r.used += size;
+      return start;
+    }
+  }
+  return 0;
+}
+// =======================================================================================
+void patchSites::addRegion(uint64_t start) { regions.push_back({start, 0}); }
+// =======================================================================================
+bool patchSites::inRegion(uint64_t addr) const {
+  for (const region& r : regions) {
+    if (r.start <= addr && addr < r.start + regionSize) {
+      return true;
+    }
+  }
+  return false;
+}
+// =======================================================================================
+bool inJumpReach(uint64_t from, uint64_t to) {
+  // Leave some slack, both ends of our jumps are a few bytes off.
+  const int64_t reach = INT32_MAX - 4096;
+  int64_t distance = (int64_t)(to - from);
+  return -reach <= distance && distance <= reach;
+}
+// =======================================================================================
+/**
+ * Length of the instruction at code if it runs the same from any address and
+ * doesn't branch: register moves, arithmetic, shifts, loads and stores that
+ * aren't rip relative, fences. 0 for anything else, or if it doesn't fit in
+ * available.
+ */
+static size_t relocatableLength(const uint8_t* code, size_t available) {
+  size_t i = 0;
+  bool rexW = false;
+  if (i < available && (code[i] & 0xf0) == 0x40) {
+    rexW = (code[i] & 0x08) != 0;
+    i++;
+  }
+  if (i >= available) {
+    return 0;
+  }
+
+  uint8_t opcode = code[i++];
+  size_t immediate = 0;
+  if (opcode == 0x0f) {
+    if (i >= available) {
+      return 0;
+    }
+    uint8_t opcode2 = code[i++];
+    if (opcode2 == 0xae) {
+      // lfence, mfence, sfence.
+      bool fence = i < available &&
+          (code[i] == 0xe8 || code[i] == 0xf0 || code[i] == 0xf8);
+      return fence ? i + 1 : 0;
+    }
+    // imul, movzx and movsx.
+    if (opcode2 != 0xaf && opcode2 != 0xb6 && opcode2 != 0xb7 &&
+        opcode2 != 0xbe && opcode2 != 0xbf) {
+      return 0;
+    }
+  } else if (opcode >= 0xb8 && opcode <= 0xbf) {
+    // mov $imm, %reg
+    size_t length = i + (rexW ? 8 : 4);
+    return length <= available ? length : 0;
+  } else if (opcode == 0x90) {
+    return i;
+  } else if (opcode < 0x40 && (opcode & 0x07) == 4) {
+    // add, or, adc, sbb, and, sub, xor, cmp of %al and an imm8.
+    return i + 1 <= available ? i + 1 : 0;
+  } else if (opcode < 0x40 && (opcode & 0x07) == 5) {
+    // Of %eax or %rax and an imm32, like the cmp $-4096, %rax after most
+    // system calls.
+    return i + 4 <= available ? i + 4 : 0;
+  } else if (opcode < 0x40 && (opcode & 0x07) < 4) {
+    // add, or, adc, sbb, and, sub, xor, cmp between registers and memory.
+  } else if (opcode == 0xc1 || opcode == 0x83 || opcode == 0x6b) {
+    immediate = 1;
+  } else if (opcode == 0x81 || opcode == 0x69) {
+    immediate = 4;
+  } else if (
+      (opcode < 0x84 || opcode > 0x8b || opcode == 0x86 || opcode == 0x87) &&
+      opcode != 0x8d && opcode != 0xd1 && opcode != 0xd3) {
+    // Not test, mov, lea or a shift by 1 or %cl either.
+    return 0;
+  }
+
+  if (i >= available) {
+    return 0;
+  }
+  uint8_t modrm = code[i++];
+  uint8_t mod = modrm >> 6;
+  uint8_t rm = modrm & 0x07;
+  if (mod != 3) {
+    if (rm == 4) {
+      if (i >= available) {
+        return 0;
+      }
+      uint8_t sib = code[i++];
+      if (mod == 0 && (sib & 0x07) == 5) {
+        i += 4;
+      }
+    } else if (mod == 0 && rm == 5) {
+      // rip relative.
+      return 0;
+    }
+    if (mod == 1) {
+      i += 1;
+    } else if (mod == 2) {
+      i += 4;
+    }
+  }
+  i += immediate;
+  return i <= available ? i : 0;
+}
+// =======================================================================================
+size_t sitePatchLength(
+    const uint8_t* code, size_t available, size_t insnLength) {
+  const size_t jumpLength = 5;
+  size_t length = insnLength;
+  while (length < jumpLength) {
+    size_t next = relocatableLength(code + length, available - length);
+    if (next == 0) {
+      return 0;
+    }
+    length += next;
+  }
+  return length;
+}
+// =======================================================================================
+static void append(vector<uint8_t>& code, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    code.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+static void appendJump(vector<uint8_t>& code, uint64_t from, uint64_t to) {
+  code.push_back(0xe9);
+  append(code, to - (from + 5), 4);
+}
+
+vector<uint8_t> tscTrampoline(
+    tscInstruction insn,
+    uint64_t countersAddr,
+    uint64_t step,
+    const uint8_t* relocated,
+    size_t relocatedLength,
+    uint64_t trampolineAddr,
+    uint64_t returnAddr) {
+  vector<uint8_t> code;
+  // movabs $countersAddr, %rdx
+  code.insert(code.end(), {0x48, 0xba});
+  append(code, countersAddr, 8);
+  if (insn == tscInstruction::rdtscp) {
+    // mov 0x8(%rdx), %rcx; lea step(%rcx), %rax; mov %rax, 0x8(%rdx)
+    code.insert(code.end(), {0x48, 0x8b, 0x4a, 0x08, 0x48, 0x8d, 0x81});
+    append(code, step, 4);
+    code.insert(code.end(), {0x48, 0x89, 0x42, 0x08});
+  }
+  // mov (%rdx), %rax; lea step(%rax), %rax; mov %rax, (%rdx);
+  // lea -step(%rax), %rax. No flags may change.
+  code.insert(code.end(), {0x48, 0x8b, 0x02, 0x48, 0x8d, 0x80});
+  append(code, step, 4);
+  code.insert(code.end(), {0x48, 0x89, 0x02, 0x48, 0x8d, 0x80});
+  append(code, -step, 4);
+  // mov $0, %edx
+  code.insert(code.end(), {0xba, 0x00, 0x00, 0x00, 0x00});
+
+  code.insert(code.end(), relocated, relocated + relocatedLength);
+  appendJump(code, trampolineAddr + code.size(), returnAddr);
+  return code;
+}
+// =======================================================================================
+vector<uint8_t> cpuidTrampoline(
+    uint64_t tableAddr,
+    uint32_t leaves,
+    uint32_t extendedLeaves,
+    const uint8_t* relocated,
+    size_t relocatedLength,
+    uint64_t trampolineAddr,
+    uint64_t returnAddr) {
+  vector<uint8_t> code;
+  // Step over the red zone, keep the flags, cpuid doesn't change them.
+  // lea -0x80(%rsp), %rsp; pushf
+  code.insert(code.end(), {0x48, 0x8d, 0x64, 0x24, 0x80, 0x9c});
+  // Entry in %rdx: leaves below `leaves` are entries 0 on, extended leaves
+  // follow them. Anything else goes to the real cpuid.
+  // mov %eax, %edx; cmp $leaves, %edx; jb 1f
+  code.insert(code.end(), {0x89, 0xc2, 0x81, 0xfa});
+  append(code, leaves, 4);
+  code.insert(code.end(), {0x72, 0x14});
+  // sub $0x80000000, %edx; cmp $extendedLeaves, %edx; jae 2f;
+  // add $leaves, %edx
+  code.insert(code.end(), {0x81, 0xea, 0x00, 0x00, 0x00, 0x80, 0x81, 0xfa});
+  append(code, extendedLeaves, 4);
+  code.insert(code.end(), {0x73, 0x2d, 0x81, 0xc2});
+  append(code, leaves, 4);
+  // 1: shl $4, %rdx; movabs $tableAddr, %rbx; add %rdx, %rbx
+  code.insert(code.end(), {0x48, 0xc1, 0xe2, 0x04, 0x48, 0xbb});
+  append(code, tableAddr, 8);
+  code.insert(code.end(), {0x48, 0x01, 0xd3});
+  // mov 0x8(%rbx), %ecx; mov 0xc(%rbx), %edx; mov (%rbx), %eax;
+  // mov 0x4(%rbx), %ebx
+  code.insert(
+      code.end(),
+      {0x8b, 0x4b, 0x08, 0x8b, 0x53, 0x0c, 0x8b, 0x03, 0x8b, 0x5b, 0x04});
+  // popf; lea 0x80(%rsp), %rsp; jmp 3f
+  code.insert(
+      code.end(),
+      {0x9d, 0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00, 0xeb, 0x0b});
+  // 2: popf; lea 0x80(%rsp), %rsp; cpuid
+  code.insert(
+      code.end(),
+      {0x9d, 0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00, 0x0f, 0xa2});
+
+  // 3:
+  code.insert(code.end(), relocated, relocated + relocatedLength);
+  appendJump(code, trampolineAddr + code.size(), returnAddr);
+  return code;
+}
+// =======================================================================================
+// A rel8 jump opcode at the end of code, its target still to be bound.
+static size_t jump8(vector<uint8_t>& code, uint8_t opcode) {
+  code.insert(code.end(), {opcode, 0});
+  return code.size() - 1;
+}
+// =======================================================================================
+// Point the rel8 jump8 left at the end of code.
+static void bind8(vector<uint8_t>& code, size_t rel) {
+  size_t distance = code.size() - (rel + 1);
+  assert(distance < 128);
+  code[rel] = distance;
+}
+// =======================================================================================
+// A rel32 jcc for the rel8 opcode of the same condition at the end of code, its
+// target still to be bound.
+static size_t jump32(vector<uint8_t>& code, uint8_t opcode8) {
+  code.insert(code.end(), {0x0f, (uint8_t)(opcode8 + 0x10), 0, 0, 0, 0});
+  return code.size() - 4;
+}
+// =======================================================================================
+// Point the rel32 jump32 left at the end of code.
+static void bind32(vector<uint8_t>& code, size_t rel) {
+  uint32_t distance = code.size() - (rel + 4);
+  memcpy(&code[rel], &distance, sizeof(distance));
+}
+// =======================================================================================
+vector<uint8_t> bufferedSystemCallTrampoline(
+    uint64_t pageAddr,
+    const uint8_t* relocated,
+    size_t relocatedLength,
+    uint64_t trampolineAddr,
+    uint64_t returnAddr) {
+  const uint8_t je = 0x74, jae = 0x73, ja = 0x77, jle = 0x7e, jmp = 0xeb;
+  // System calls the logical clock functions stand in for, by their nr.
+  const pair<uint32_t, const char*> timeCalls[] = {
+      {SYS_clock_gettime, "__vdso_clock_gettime"},
+      {SYS_gettimeofday, "__vdso_gettimeofday"},
+      {SYS_time, "__vdso_time"},
+  };
+  vector<uint8_t> code;
+  vector<size_t> toSlow;
+  size_t toTime[3];
+  // Step over the red zone, keep the flags, system calls don't change them.
+  // lea -0x80(%rsp), %rsp; pushf
+  code.insert(code.end(), {0x48, 0x8d, 0x64, 0x24, 0x80, 0x9c});
+  for (size_t i = 0; i < 3; i++) {
+    // cmp $nr, %rax; je time i
+    code.insert(code.end(), {0x48, 0x3d});
+    append(code, timeCalls[i].first, 4);
+    toTime[i] = jump32(code, je);
+  }
+  // %rcx and %r11 are ours, the system call would clobber them anyway.
+  // cmp $63, %rax; ja slow; movabs $pageAddr, %r11
+  code.insert(code.end(), {0x48, 0x83, 0xf8, 0x3f});
+  toSlow.push_back(jump32(code, ja));
+  code.insert(code.end(), {0x49, 0xbb});
+  append(code, pageAddr, 8);
+  // bt %rax, bufferedSystemCalls(%r11); jnc slow
+  code.insert(code.end(), {0x49, 0x0f, 0xa3, 0x83});
+  append(code, offsetof(logicalClockPage, bufferedSystemCalls), 4);
+  toSlow.push_back(jump32(code, jae));
+  // cmp $bufferedFds, %rdi; jae slow
+  code.insert(code.end(), {0x48, 0x81, 0xff});
+  append(code, bufferedFds, 4);
+  toSlow.push_back(jump32(code, jae));
+  // bt %rdi, regularFds(%r11); jnc slow
+  code.insert(code.end(), {0x49, 0x0f, 0xa3, 0xbb});
+  append(code, offsetof(logicalClockPage, regularFds), 4);
+  toSlow.push_back(jump32(code, jae));
+
+  // A recorded one stops if its record may not fit: %rdx bytes, its header and
+  // padding.
+  // bt %rax, recordedSystemCalls(%r11); jnc gate
+  code.insert(code.end(), {0x49, 0x0f, 0xa3, 0x83});
+  append(code, offsetof(logicalClockPage, recordedSystemCalls), 4);
+  size_t toGate = jump8(code, jae);
+  // mov sideEffectBytes(%r11), %rcx; lea 0x17(%rcx,%rdx), %rcx;
+  // cmp $sideEffectRingSize, %rcx; ja slow
+  code.insert(code.end(), {0x49, 0x8b, 0x8b});
+  append(code, offsetof(logicalClockPage, sideEffectBytes), 4);
+  code.insert(code.end(), {0x48, 0x8d, 0x4c, 0x11, 0x17, 0x48, 0x81, 0xf9});
+  append(code, sideEffectRingSize, 4);
+  toSlow.push_back(jump32(code, ja));
+
+  // gate: the flags stay pushed, under the system call number.
+  // push %rax; lea logicalClockGateOffset(%r11), %r11; call *%r11
+  bind8(code, toGate);
+  code.insert(code.end(), {0x50, 0x4d, 0x8d, 0x9b});
+  append(code, logicalClockGateOffset, 4);
+  code.insert(code.end(), {0x41, 0xff, 0xd3});
+  // movabs $pageAddr, %r11; mov (%rsp), %rcx;
+  // bt %rcx, recordedSystemCalls(%r11); jnc recorded
+  code.insert(code.end(), {0x49, 0xbb});
+  append(code, pageAddr, 8);
+  code.insert(code.end(), {0x48, 0x8b, 0x0c, 0x24, 0x49, 0x0f, 0xa3, 0x8b});
+  append(code, offsetof(logicalClockPage, recordedSystemCalls), 4);
+  vector<size_t> toRecorded;
+  toRecorded.push_back(jump8(code, jae));
+  // test %rax, %rax; jle recorded
+  code.insert(code.end(), {0x48, 0x85, 0xc0});
+  toRecorded.push_back(jump8(code, jle));
+  // push %rdi; push %rsi; mov sideEffectBytes(%r11), %rcx;
+  // lea sideEffectRing(%r11,%rcx), %rcx
+  code.insert(code.end(), {0x57, 0x56, 0x49, 0x8b, 0x8b});
+  append(code, offsetof(logicalClockPage, sideEffectBytes), 4);
+  code.insert(code.end(), {0x49, 0x8d, 0x8c, 0x0b});
+  append(code, logicalClockPageSize, 4);
+  // The header: mov 0x10(%rsp), %r11d; mov %r11d, (%rcx); mov %edi, 4(%rcx);
+  // mov %rax, 8(%rcx)
+  code.insert(
+      code.end(), {0x44, 0x8b, 0x5c, 0x24, 0x10, 0x44, 0x89, 0x19, 0x89, 0x79,
+                   0x04, 0x48, 0x89, 0x41, 0x08});
+  // The bytes: lea 0x10(%rcx), %rdi; mov %rax, %rcx; cld; rep movsb
+  code.insert(
+      code.end(),
+      {0x48, 0x8d, 0x79, 0x10, 0x48, 0x89, 0xc1, 0xfc, 0xf3, 0xa4});
+  // Where the next one goes: movabs $pageAddr + sideEffectRing, %r11;
+  // sub %r11, %rdi; add $7, %rdi; and $-8, %rdi
+  code.insert(code.end(), {0x49, 0xbb});
+  append(code, pageAddr + logicalClockPageSize, 8);
+  code.insert(
+      code.end(),
+      {0x4c, 0x29, 0xdf, 0x48, 0x83, 0xc7, 0x07, 0x48, 0x83, 0xe7, 0xf8});
+  // movabs $pageAddr, %r11; mov %rdi, sideEffectBytes(%r11); pop %rsi; pop %rdi
+  code.insert(code.end(), {0x49, 0xbb});
+  append(code, pageAddr, 8);
+  code.insert(code.end(), {0x49, 0x89, 0xbb});
+  append(code, offsetof(logicalClockPage, sideEffectBytes), 4);
+  code.insert(code.end(), {0x5e, 0x5f});
+  // recorded: lea 8(%rsp), %rsp; popf; lea 0x80(%rsp), %rsp; jmp done
+  for (size_t rel : toRecorded) {
+    bind8(code, rel);
+  }
+  code.insert(
+      code.end(), {0x48, 0x8d, 0x64, 0x24, 0x08, 0x9d, 0x48, 0x8d, 0xa4, 0x24,
+                   0x80, 0x00, 0x00, 0x00});
+  size_t toDone = jump8(code, jmp);
+
+  // time i: movabs $function, %r11; jmp call
+  vector<size_t> toCall;
+  for (size_t i = 0; i < 3; i++) {
+    bind32(code, toTime[i]);
+    code.insert(code.end(), {0x49, 0xbb});
+    append(code, pageAddr + logicalClockFunctionOffset(timeCalls[i].second), 8);
+    if (i != 2) {
+      toCall.push_back(jump8(code, jmp));
+    }
+  }
+  for (size_t rel : toCall) {
+    bind8(code, rel);
+  }
+  // The functions clobber %rdx too, and the flags.
+  // call: push %rdx; call *%r11; pop %rdx; popf; lea 0x80(%rsp), %rsp;
+  // jmp done
+  code.insert(
+      code.end(),
+      {0x52, 0x41, 0xff, 0xd3, 0x5a, 0x9d, 0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00,
+       0x00, 0x00});
+  size_t toDoneFromTime = jump8(code, jmp);
+
+  // slow: popf; lea 0x80(%rsp), %rsp; syscall
+  for (size_t rel : toSlow) {
+    bind32(code, rel);
+  }
+  code.insert(
+      code.end(),
+      {0x9d, 0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00, 0x0f, 0x05});
+
+  // done:
+  bind8(code, toDone);
+  bind8(code, toDoneFromTime);
+  code.insert(code.end(), relocated, relocated + relocatedLength);
+  appendJump(code, trampolineAddr + code.size(), returnAddr);
+  return code;
+}
+// =======================================================================================
+size_t trampolineTail(size_t relocatedLength) { return relocatedLength + 5; }
+// =======================================================================================
+vector<uint8_t> bufferedSystemCallGate() {
+  // syscall; ret
+  vector<uint8_t> code = {0x0f, 0x05, 0xc3};
+  code.resize(logicalClockGateSize, 0xcc);
+  return code;
+}
+// =======================================================================================
+vector<uint8_t> sitePatchJump(
+    uint64_t site, size_t patchLength, uint64_t trampolineAddr) {
+  vector<uint8_t> code;
+  appendJump(code, site, trampolineAddr);
+  // Nothing should jump here, trap if something does.
+  code.resize(patchLength, 0xcc);
+  return code;
+}
+// =======================================================================================
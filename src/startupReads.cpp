@@ -0,0 +1,143 @@
+#include "startupReads.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "util.hpp"
+#include "utilSystemCalls.hpp"
+
+/** First line of a saved memo, bump the number when lines change. */
+static const string memoHeader = "dettrace-startup-reads 1";
+
+/** Files an exec's startup is, at most. */
+static const size_t maxStartupReads = 64;
+
+// =======================================================================================
+bool startupReads::load(const string& path) {
+  ifstream in(path);
+  string header;
+  if (!getline(in, header) || header != memoHeader) {
+    return false;
+  }
+  fileIdentity exe;
+  string read;
+  while (in >> exe.device >> exe.inode >> exe.size >> exe.mtime &&
+         in.get() == ' ' && getline(in, read)) {
+    memo[exe].push_back(read);
+  }
+  return true;
+}
+// =======================================================================================
+void startupReads::save(const string& path) {
+  vector<pid_t> pids;
+  for (auto& s : starting) {
+    pids.push_back(s.first);
+  }
+  for (pid_t pid : pids) {
+    finish(pid);
+  }
+
+  string tmpPath = path + ".tmp";
+  {
+    ofstream out(tmpPath, ios::trunc);
+    if (!out) {
+      runtimeError("Unable to open startup reads " + tmpPath);
+    }
+    out << memoHeader << "\n";
+    for (auto& known : memo) {
+      const fileIdentity& exe = known.first;
+      for (const string& read : known.second) {
+        out << exe.device << " " << exe.inode << " " << exe.size << " "
+            << exe.mtime << " " << read << "\n";
+      }
+    }
+  }
+  doWithCheck(
+      rename(tmpPath.c_str(), path.c_str()),
+      "Unable to replace startup reads " + path);
+}
+// =======================================================================================
+void startupReads::execed(pid_t pid) {
+  finish(pid);
+  string procExe = "/proc/" + to_string(pid) + "/exe";
+  struct stat st;
+  if (stat(procExe.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+    return;
+  }
+  // Without ctime, like executableHashes: a chmod doesn't change the startup.
+  fileIdentity exe;
+  exe.device = st.st_dev;
+  exe.inode = st.st_ino;
+  exe.size = st.st_size;
+  exe.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  if (!execedVersions.insert(exe).second) {
+    return;
+  }
+  starting[pid] = startup{exe, {}};
+
+  auto known = memo.find(exe);
+  if (known == memo.end() || known->second.empty()) {
+    return;
+  }
+  execsReadAhead++;
+  filesReadAhead += known->second.size();
+  // Nobody waits for it, with no helpers it never runs.
+  vector<string> reads = known->second;
+  tasks.run([reads]() {
+    for (const string& read : reads) {
+      // A file replaced by a fifo since must not block a helper.
+      int fd = open(read.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+      }
+    }
+  });
+}
+// =======================================================================================
+void startupReads::systemCall(state& s, ptracer& t, int syscallNum) {
+  auto of = starting.find(s.traceePid);
+  if (of == starting.end()) {
+    return;
+  }
+  int fd = fdOpenedForReading(s, t, syscallNum);
+  if (fd == -1) {
+    return;
+  }
+  string opened = traceeFdPath(s.traceePid, fd);
+  struct stat st;
+  // One per line in a saved memo.
+  if (opened.empty() || opened.find('\n') != string::npos ||
+      stat(opened.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+    return;
+  }
+  vector<string>& reads = of->second.reads;
+  if (find(reads.begin(), reads.end(), opened) == reads.end()) {
+    reads.push_back(opened);
+  }
+  if (reads.size() == maxStartupReads) {
+    finish(s.traceePid);
+  }
+}
+// =======================================================================================
+void startupReads::exited(pid_t pid) {
+  finish(pid);
+}
+// =======================================================================================
+void startupReads::finish(pid_t pid) {
+  auto of = starting.find(pid);
+  if (of == starting.end()) {
+    return;
+  }
+  // An exec that read nothing, or failed right away, keeps the last startup.
+  if (!of->second.reads.empty()) {
+    memo[of->second.exe] = move(of->second.reads);
+  }
+  starting.erase(of);
+}
+// =======================================================================================
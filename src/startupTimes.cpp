@@ -0,0 +1,57 @@
+#include "startupTimes.hpp"
+
+#include <sys/mman.h>
+
+#include <chrono>
+#include <new>
+
+#include "util.hpp"
+
+static startupTimes localTimes;
+static startupTimes* current = &localTimes;
+
+// =======================================================================================
+startupTimes& startupTimes::get() { return *current; }
+// =======================================================================================
+void startupTimes::share() {
+  void* shared = mmap(
+      nullptr, sizeof(startupTimes), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    runtimeError("mmap startup times failed");
+  }
+  // Never unmapped, it is a page for the life of the tracer.
+  current = new (shared) startupTimes(*current);
+}
+// =======================================================================================
+int64_t startupTimes::now() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+// =======================================================================================
+void startupTimes::add(int64_t& phase, int64_t start) {
+  phase += (now() - start) / 1000;
+}
+// =======================================================================================
+void startupTimes::finish(int64_t& phase, int64_t& start) {
+  if (start != 0) {
+    add(phase, start);
+    start = 0;
+  }
+}
+// =======================================================================================
+string startupTimes::toJson() const {
+  auto field = [](const char* name, int64_t value) {
+    return "\"" + string(name) + "_us\": " + to_string(value);
+  };
+  return "{" + field("option_parse", optionParse) + ", " +
+      field("vdso_parse", vdsoParse) + ", " +
+      field("namespace_clone", namespaceClone) + ", " +
+      field("mounts", mounts) + ", " + field("dev_nodes", devNodes) + ", " +
+      field("fifo_threads", fifoThreads) + ", " +
+      field("seccomp_build", seccompBuild) + ", " +
+      field("seccomp_load", seccompLoad) + ", " +
+      field("first_exec", firstExec) + "}";
+}
+// =======================================================================================
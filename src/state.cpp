@@ -9,132 +9,77 @@ state::state(
     logical_clock::duration clock_step)
     : clock(clock),
       clock_step(clock_step),
-      fdStatus(new unordered_map<int, descriptorType>),
       traceePid(traceePid),
       signalToDeliver(0),
       mmapMemory(2048),
       debugLevel(debugLevel) {
-  currentSignalHandlers =
-      std::make_shared<unordered_map<int, enum sighandler_type>>();
-  timerCreateTimers = std::make_shared<unordered_map<timerID_t, timerInfo>>();
-  remote_sockfds = std::make_shared<unordered_set<int>>();
-  timerfds = std::make_shared<unordered_map<int, struct itimerspec>>();
-  signalfds = std::make_shared<unordered_set<int>>();
-
-  poll_retry_count = 0;
-  poll_retry_maximum = LONG_MAX;
+  readProbe = std::make_shared<readinessProbe>();
 
   return;
 }
 
-void state::setFdStatus(int fd, descriptorType dt) {
-  (*fdStatus.get())[fd] = dt;
-}
-
-descriptorType state::getFdStatus(int fd) { return fdStatus.get()->at(fd); }
-
-int state::countFdStatus(int fd) { return fdStatus.get()->count(fd); }
-
 state state::forked(pid_t childPid) const {
-  state childState(childPid, this->debugLevel, this->clock, this->clock_step);
-  childState.CPUIDTrapSet = this->CPUIDTrapSet;
-  childState.currentSignalHandlers =
-      make_shared<unordered_map<int, enum sighandler_type>>(
-          *(this->currentSignalHandlers));
-  childState.dirEntries = this->dirEntries;
-
-  childState.exfsNotNull = this->exfsNotNull;
-  childState.rdfsNotNull = this->rdfsNotNull;
-  childState.wrfsNotNull = this->wrfsNotNull;
-
-  childState.fdStatus =
-      make_shared<unordered_map<int, descriptorType>>(*(this->fdStatus));
-  childState.fileExisted = this->fileExisted;
-  childState.firstTrySystemcall = false;
-  childState.inodeToDelete = this->inodeToDelete;
-  childState.isExitGroup = false;
-  childState.mmapMemory = this->mmapMemory;
-  childState.noopSystemCall = false;
-  childState.onPreExitEvent = false;
-  childState.origExfs = this->origExfs;
-  childState.origRdfs = this->origRdfs;
-  childState.origWrfs = this->origWrfs;
-  childState.originalArg1 = 0;
-  childState.originalArg2 = 0;
-  childState.originalArg3 = 0;
-  childState.originalArg4 = 0;
-  childState.originalArg5 = 0;
-  childState.originalArg6 = 0;
-  childState.rdfsNotNull = false;
-  childState.regSaver = this->regSaver;
-  childState.requestedSignalHandler = this->requestedSignalHandler;
-  childState.requestedSignalToHandle = this->requestedSignalToHandle;
-  childState.signalInjected = false;
-  childState.timerCreateTimers =
-      make_shared<unordered_map<timerID_t, timerInfo>>(
-          *(this->timerCreateTimers));
-  childState.totalBytes = this->totalBytes;
-  childState.traceePid = childPid;
-  childState.userDefinedTimeout = false;
-  childState.wait4Blocking = false;
-
-  childState.poll_retry_count = 0;
-  childState.poll_retry_maximum = LONG_MAX;
-
-  childState.remote_sockfds =
-      make_shared<unordered_set<int>>(*(this->remote_sockfds));
-  childState.timerfds =
-      make_shared<unordered_map<int, struct itimerspec>>(*(this->timerfds));
-  childState.signalfds = make_shared<unordered_set<int>>(*(this->signalfds));
-  childState.clock = this->clock;
+  // Threads share everything else in their state objects.
+  state childState = cloned(childPid);
+  childState.currentSignalHandlers = this->currentSignalHandlers.forked();
+  childState.fds = this->fds.forked();
+  childState.timerCreateTimers = this->timerCreateTimers.forked();
+  childState.timers = this->timers.forked();
+  if (!this->timers->empty()) {
+    childState.timers.write().forked();
+  }
+  childState.readProbe = std::make_shared<readinessProbe>();
+  childState.epollInterests = this->epollInterests.forked();
+  childState.paths = this->paths.forked();
+  childState.sitePatches = this->sitePatches.forked();
+  childState.causality = this->causality.forked();
   return childState;
 }
 
 state state::cloned(pid_t childPid) const {
-  state childState(childPid, this->debugLevel, this->clock, this->clock_step);
-  childState.CPUIDTrapSet = this->CPUIDTrapSet;
-  childState.currentSignalHandlers = this->currentSignalHandlers;
-  childState.dirEntries = this->dirEntries;
-
-  childState.exfsNotNull = this->exfsNotNull;
-  childState.rdfsNotNull = this->rdfsNotNull;
-  childState.wrfsNotNull = this->wrfsNotNull;
+  // Shares every copyOnWrite part of this state, and the rest is copied.
+  state childState(*this);
+  childState.traceePid = childPid;
 
-  childState.fdStatus = this->fdStatus;
+  // Each thread reads its own directories.
+  childState.dirEntries = this->dirEntries.forked();
+  childState.dirStamps = this->dirStamps.forked();
+  // Its own part of the scratch memory, which forked children share too.
+  childState.mmapMemory.takeNextSlot();
 
-  childState.fileExisted = this->fileExisted;
-  childState.firstTrySystemcall = false;
-  childState.inodeToDelete = this->inodeToDelete;
-  childState.isExitGroup = false;
-  childState.mmapMemory = this->mmapMemory;
-  childState.noopSystemCall = false;
+  // Nothing of what this thread is in the middle of.
+  childState.wait4Blocking = false;
   childState.onPreExitEvent = false;
-  childState.origExfs = this->origExfs;
-  childState.origRdfs = this->origRdfs;
-  childState.origWrfs = this->origWrfs;
+  childState.callPostHook = false;
+  childState.deferredPreHook = false;
+  childState.vforkChild = false;
+  childState.systemCallSinceOverflow = false;
+  childState.futexWoken = false;
+  childState.futexOldValue = 0;
+  childState.readDeferrals = 0;
+  childState.signalToDeliver = 0;
+  // Pending signals are not inherited.
+  childState.pendingSignals = signalQueue{};
+  childState.atSignalStop = false;
+  childState.firstTrySystemcall = true;
+  childState.syscallInjected = false;
+  childState.noopSystemCall = false;
+  childState.noopReturnValue = 0;
+  childState.systemCallSkipped = false;
+  childState.socketReadServed = false;
+  childState.socketReadResult = 0;
+  childState.userDefinedTimeout = false;
   childState.originalArg1 = 0;
   childState.originalArg2 = 0;
   childState.originalArg3 = 0;
   childState.originalArg4 = 0;
   childState.originalArg5 = 0;
   childState.originalArg6 = 0;
-  childState.rdfsNotNull = false;
-  childState.regSaver = this->regSaver;
-  childState.requestedSignalHandler = this->requestedSignalHandler;
-  childState.requestedSignalToHandle = this->requestedSignalToHandle;
-  childState.signalInjected = false;
-  childState.timerCreateTimers = this->timerCreateTimers;
-  childState.totalBytes = this->totalBytes;
-  childState.traceePid = childPid;
-  childState.userDefinedTimeout = false;
-  childState.wait4Blocking = false;
-
-  childState.poll_retry_count = 0;
-  childState.poll_retry_maximum = LONG_MAX;
-
-  childState.remote_sockfds = this->remote_sockfds;
-  childState.timerfds = this->timerfds;
-  childState.signalfds = this->signalfds;
-  childState.clock = this->clock;
+  childState.isExitGroup = false;
+  childState.canGetStuck = false;
+  childState.pollBackoff = 1;
+  // forkPath is the spawner's to give, see childForkPath.
+  childState.childrenSpawned = 0;
+  childState.getrandomBytes = nullptr;
   return childState;
 }
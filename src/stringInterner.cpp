@@ -0,0 +1,88 @@
+#include "stringInterner.hpp"
+
+#include <string.h>
+
+#include "util.hpp"
+
+/** FNV-1a, paths are short. */
+static uint32_t hashBytes(const char* data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+  }
+  return hash;
+}
+// =======================================================================================
+const stringId stringInterner::noString;
+
+stringInterner::stringInterner() : slots(1024, noString) {}
+// =======================================================================================
+stringId stringInterner::intern(const char* data, size_t size) {
+  if (size >= UINT32_MAX) {
+    runtimeError("stringInterner: string too long to intern.\n");
+  }
+  uint32_t hash = hashBytes(data, size);
+  size_t slot = probe(data, size, hash);
+  if (slots[slot] != noString) {
+    return slots[slot];
+  }
+
+  stringId id = views.size();
+  views.push_back(view{store(data, size), (uint32_t)size, hash});
+  slots[slot] = id;
+  if (2 * views.size() > slots.size()) {
+    grow();
+  }
+  return id;
+}
+// =======================================================================================
+stringId stringInterner::find(const char* data, size_t size) const {
+  return slots[probe(data, size, hashBytes(data, size))];
+}
+// =======================================================================================
+const char* stringInterner::store(const char* data, size_t size) {
+  char* copy;
+  if (size + 1 > blockSize / 4) {
+    // Big strings get their own block, keep filling the current one.
+    bigBlocks.emplace_back(new char[size + 1]);
+    copy = bigBlocks.back().get();
+  } else {
+    if (blockUsed + size + 1 > blockSize) {
+      blocks.emplace_back(new char[blockSize]);
+      blockUsed = 0;
+    }
+    copy = blocks.back().get() + blockUsed;
+    blockUsed += size + 1;
+  }
+  memcpy(copy, data, size);
+  copy[size] = '\0';
+  return copy;
+}
+// =======================================================================================
+size_t stringInterner::probe(
+    const char* data, size_t size, uint32_t hash) const {
+  size_t mask = slots.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    stringId id = slots[i];
+    if (id == noString) {
+      return i;
+    }
+    const view& v = views[id];
+    if (v.hash == hash && v.size == size && memcmp(v.data, data, size) == 0) {
+      return i;
+    }
+  }
+}
+// =======================================================================================
+void stringInterner::grow() {
+  slots.assign(2 * slots.size(), noString);
+  size_t mask = slots.size() - 1;
+  for (stringId id = 0; id < views.size(); id++) {
+    size_t i = views[id].hash & mask;
+    while (slots[i] != noString) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = id;
+  }
+}
+// =======================================================================================
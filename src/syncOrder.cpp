@@ -0,0 +1,127 @@
+#include "syncOrder.hpp"
+#include "util.hpp"
+
+#include <string>
+
+// =======================================================================================
+void syncOrder::add(pid_t pid, pid_t group, uint64_t ticks) {
+  if (contains(pid)) {
+    runtimeError("syncOrder: tracee " + to_string(pid) + " added twice.\n");
+  }
+  if (byArrival) {
+    group = pid;
+  }
+  tracees.emplace(pid, tracee{group, ticks, status::ready, false, 0});
+  readyByGroup[group].insert(clockKey{ticks, pid});
+  markDirty(group);
+}
+// =======================================================================================
+void syncOrder::remove(pid_t pid) {
+  auto it = tracees.find(pid);
+  if (it == tracees.end()) {
+    return;
+  }
+  tracee& t = it->second;
+  if (t.st == status::ready) {
+    auto group = readyByGroup.find(t.group);
+    group->second.erase(clockKey{t.ticks, pid});
+    if (group->second.empty()) {
+      readyByGroup.erase(group);
+    }
+  } else {
+    active.erase(clockKey{t.ticks, pid});
+    if (--activeMembers[t.group] == 0) {
+      activeMembers.erase(t.group);
+    }
+    if (t.st == status::running) {
+      running--;
+    } else if (byArrival) {
+      stoppedByArrival.erase({t.arrival, pid});
+    }
+    markDirty(t.group);
+  }
+  tracees.erase(it);
+}
+// =======================================================================================
+void syncOrder::stopped(pid_t pid, bool barrier) {
+  tracee& t = tracees.at(pid);
+  if (t.st == status::ready) {
+    // Killed while waiting for its group to free up.
+    readyByGroup[t.group].erase(clockKey{t.ticks, pid});
+    if (readyByGroup[t.group].empty()) {
+      readyByGroup.erase(t.group);
+    }
+    active.insert(clockKey{t.ticks, pid});
+    activeMembers[t.group]++;
+  } else if (t.st == status::running) {
+    running--;
+  } else if (byArrival) {
+    stoppedByArrival.erase({t.arrival, pid});
+  }
+  t.st = status::stopped;
+  t.barrier = barrier;
+  if (byArrival) {
+    t.arrival = arrivals++;
+    stoppedByArrival.insert({t.arrival, pid});
+  }
+}
+// =======================================================================================
+pid_t syncOrder::nextCommit() const {
+  if (byArrival) {
+    return stoppedByArrival.empty() ? -1 : stoppedByArrival.begin()->second;
+  }
+  if (active.empty()) {
+    return -1;
+  }
+  pid_t first = active.begin()->second;
+  const tracee& t = tracees.at(first);
+  if (t.st != status::stopped || (t.barrier && running != 0)) {
+    return -1;
+  }
+  return first;
+}
+// =======================================================================================
+void syncOrder::committed(pid_t pid) {
+  tracee& t = tracees.at(pid);
+  if (t.st != status::stopped) {
+    runtimeError(
+        "syncOrder: committed tracee " + to_string(pid) + " was not stopped.\n");
+  }
+  active.erase(clockKey{t.ticks, pid});
+  if (--activeMembers[t.group] == 0) {
+    activeMembers.erase(t.group);
+  }
+  if (byArrival) {
+    stoppedByArrival.erase({t.arrival, pid});
+  }
+  t.ticks++;
+  t.st = status::ready;
+  t.barrier = false;
+  readyByGroup[t.group].insert(clockKey{t.ticks, pid});
+  markDirty(t.group);
+}
+// =======================================================================================
+vector<pid_t> syncOrder::takeResumable() {
+  vector<pid_t> resumable;
+  for (pid_t group : dirtyGroups) {
+    auto ready = readyByGroup.find(group);
+    if (ready == readyByGroup.end() || activeMembers.count(group) != 0) {
+      continue;
+    }
+    clockKey next = *ready->second.begin();
+    ready->second.erase(ready->second.begin());
+    if (ready->second.empty()) {
+      readyByGroup.erase(ready);
+    }
+
+    tracee& t = tracees.at(next.second);
+    t.st = status::running;
+    active.insert(next);
+    activeMembers[group]++;
+    running++;
+    resumable.push_back(next.second);
+  }
+  dirtyGroups.clear();
+  return resumable;
+}
+// =======================================================================================
@@ -0,0 +1,147 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "syntheticFiles.hpp"
+#include "util.hpp"
+
+// =======================================================================================
+syntheticFiles::~syntheticFiles() {
+  for (auto& entry : files) {
+    close(entry.second.memfd);
+  }
+}
+// =======================================================================================
+void syntheticFiles::add(const string& path, const string& source) {
+  ifstream in(source);
+  if (!in) {
+    runtimeError(
+        "Unable to read " + source + " to serve as " + path + ": " +
+        strerror(errno));
+  }
+  stringstream contents;
+  contents << in.rdbuf();
+  addContents(path, contents.str());
+}
+// =======================================================================================
+void syntheticFiles::addContents(const string& path, const string& bytes) {
+  int memfd = syscall(
+      SYS_memfd_create, ("dettrace" + path).c_str(),
+      MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd == -1) {
+    runtimeError("Unable to create memfd for " + path + ": " + strerror(errno));
+  }
+  size_t written = 0;
+  while (written < bytes.size()) {
+    ssize_t n = write(memfd, bytes.data() + written, bytes.size() - written);
+    if (n <= 0) {
+      close(memfd);
+      runtimeError("Unable to fill memfd for " + path + ": " + strerror(errno));
+    }
+    written += n;
+  }
+  // Tracees opening it through /proc get their own offset but could still
+  // ask for write access, the seals refuse it.
+  doWithCheck(
+      fcntl(
+          memfd, F_ADD_SEALS,
+          F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL),
+      "fcntl(F_ADD_SEALS)");
+
+  auto old = files.find(path);
+  if (old != files.end()) {
+    close(old->second.memfd);
+  }
+  files[path] = file{
+      memfd, "/proc/" + to_string(getpid()) + "/fd/" + to_string(memfd)};
+}
+// =======================================================================================
+void syntheticFiles::addMachine(unsigned cpus) {
+  addContents("/proc/cpuinfo", procCpuinfo(cpus));
+  addContents("/proc/stat", procStat(cpus));
+  for (const char* list : {"online", "possible", "present"}) {
+    addContents(string{"/sys/devices/system/cpu/"} + list, cpuList(cpus));
+  }
+}
+// =======================================================================================
+string syntheticFiles::cpuList(unsigned cpus) {
+  return cpus == 1 ? "0\n" : "0-" + to_string(cpus - 1) + "\n";
+}
+// =======================================================================================
+string syntheticFiles::procStat(unsigned cpus) {
+  // user nice system idle iowait irq softirq steal guest guest_nice, of one
+  // CPU of root/proc/stat.
+  const uint64_t times[] = {2211468, 3748, 2846238, 744773726, 3560158,
+                            0,       2730344, 0,    0,         0};
+  stringstream stat;
+  stat << "cpu ";
+  for (uint64_t time : times) {
+    stat << ' ' << time * cpus;
+  }
+  stat << '\n';
+  for (unsigned cpu = 0; cpu < cpus; cpu++) {
+    stat << "cpu" << cpu;
+    for (uint64_t time : times) {
+      stat << ' ' << time;
+    }
+    stat << '\n';
+  }
+  stat << "intr 0\n"
+       << "ctxt 945782086795\n"
+       << "btime 1548326528\n"
+       << "processes 47797475\n"
+       << "procs_running 1\n"
+       << "procs_blocked 0\n"
+       << "softirq 0 0 0 0 0 0 0 0 0 0 0\n";
+  return stat.str();
+}
+// =======================================================================================
+string syntheticFiles::procCpuinfo(unsigned cpus) {
+  // The flags of leaves 1 and 0x80000001 of execution's cpuids, ht with
+  // more than one CPU as leaf 1 then has it.
+  const string flags = string{
+      "fpu de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov pat pse36 "
+      "clflush mmx fxsr sse sse2"} +
+      (cpus > 1 ? " ht" : "") +
+      " syscall nx lm pni cx16 x2apic hypervisor lahf_lm";
+  stringstream info;
+  for (unsigned cpu = 0; cpu < cpus; cpu++) {
+    info << "processor\t: " << cpu << '\n'
+         << "vendor_id\t: GenuineIntel\n"
+         << "cpu family\t: 6\n"
+         << "model\t\t: 6\n"
+         << "model name\t: QEMU Virtual CPU version 2.5+\n"
+         << "stepping\t: 3\n"
+         << "microcode\t: 0x1\n"
+         << "cpu MHz\t\t: 2000.000\n"
+         << "cache size\t: 16384 KB\n"
+         << "physical id\t: 0\n"
+         << "siblings\t: " << cpus << '\n'
+         << "core id\t\t: " << cpu << '\n'
+         << "cpu cores\t: " << cpus << '\n'
+         << "apicid\t\t: " << cpu << '\n'
+         << "initial apicid\t: " << cpu << '\n'
+         << "fpu\t\t: yes\n"
+         << "fpu_exception\t: yes\n"
+         << "cpuid level\t: 13\n"
+         << "wp\t\t: yes\n"
+         << "flags\t\t: " << flags << '\n'
+         << "bogomips\t: 4000.00\n"
+         << "clflush size\t: 64\n"
+         << "cache_alignment\t: 64\n"
+         << "address sizes\t: 40 bits physical, 48 bits virtual\n"
+         << "power management:\n\n";
+  }
+  return info.str();
+}
+// =======================================================================================
+const string* syntheticFiles::redirect(const string& path) const {
+  auto it = files.find(path);
+  return it == files.end() ? nullptr : &it->second.openPath;
+}
+// =======================================================================================
@@ -0,0 +1,300 @@
+#include "syscallStats.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "util.hpp"
+
+// =======================================================================================
+void syscallStats::recordHook(
+    pid_t pid,
+    int systemCall,
+    bool post,
+    uint64_t replays,
+    uint64_t injected,
+    uint64_t nanos) {
+  for (counters* c : {&bySystemCall[systemCall], &byProcess[pid]}) {
+    if (post) {
+      c->postHooks++;
+    } else {
+      c->preHooks++;
+    }
+    c->replays += replays;
+    c->injected += injected;
+    c->tracerNanos += nanos;
+  }
+  latenciesOf(systemCall).hook.record(nanos);
+  if (executableCounters* e = executableOf(pid)) {
+    e->replays += replays;
+    e->tracerNanos += nanos;
+  }
+  auto stop = stops.find(pid);
+  if (stop != stops.end()) {
+    stop->second.systemCall = systemCall;
+  }
+}
+// =======================================================================================
+syscallStats::latencies& syscallStats::latenciesOf(int systemCall) {
+  unique_ptr<latencies>& l = bySystemCallLatency[systemCall];
+  if (!l) {
+    l = make_unique<latencies>();
+  }
+  return *l;
+}
+// =======================================================================================
+syscallStats::executableCounters* syscallStats::executableOf(pid_t pid) {
+  auto r = runners.find(pid);
+  return r == runners.end() ? nullptr : r->second.executable;
+}
+// =======================================================================================
+uint64_t syscallStats::runningNanos(const running& r) {
+  if (r.isThread) {
+    return 0;
+  }
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now() - r.since)
+      .count();
+}
+// =======================================================================================
+void syscallStats::execed(pid_t pid, const string& path) {
+  exited(pid);
+  executableCounters* e = &byExecutable[path];
+  e->execs++;
+  runners[pid] = running{e, false, chrono::steady_clock::now()};
+}
+// =======================================================================================
+void syscallStats::spawned(pid_t parent, pid_t child, bool isThread) {
+  if (executableCounters* e = executableOf(parent)) {
+    runners[child] = running{e, isThread, chrono::steady_clock::now()};
+  }
+}
+// =======================================================================================
+void syscallStats::exited(pid_t pid) {
+  auto r = runners.find(pid);
+  if (r != runners.end()) {
+    r->second.executable->wallNanos += runningNanos(r->second);
+    runners.erase(r);
+  }
+}
+// =======================================================================================
+void syscallStats::stopped(pid_t pid) {
+  stops[pid] = pendingStop{chrono::steady_clock::now(), -1};
+  if (executableCounters* e = executableOf(pid)) {
+    e->stops++;
+  }
+}
+// =======================================================================================
+void syscallStats::resumed(pid_t pid) {
+  auto stop = stops.find(pid);
+  if (stop == stops.end()) {
+    return;
+  }
+  auto waited = chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now() - stop->second.at);
+  anyStop.record(waited.count());
+  if (stop->second.systemCall != -1) {
+    latenciesOf(stop->second.systemCall).stopToResume.record(waited.count());
+  }
+  stops.erase(stop);
+}
+// =======================================================================================
+/** "p50/p99/max: a/b/c". */
+static string percentiles(const latencyHistogram& h) {
+  return to_string(h.percentile(0.5)) + "/" + to_string(h.percentile(0.99)) +
+      "/" + to_string(h.max());
+}
+
+void syscallStats::printLatencies(ostream& out) const {
+  string preStr = "dettrace Statistic. ";
+  if (anyStop.count() != 0) {
+    out << preStr + "all stops stop to resume (ns) p50/p99/max: " +
+            percentiles(anyStop)
+        << endl;
+  }
+  for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+    if (!bySystemCallLatency[i]) {
+      continue;
+    }
+    const latencies& l = *bySystemCallLatency[i];
+    out << preStr + systemCallMappings[i] +
+            " hook (ns) p50/p99/max: " + percentiles(l.hook)
+        << endl;
+    if (l.stopToResume.count() != 0) {
+      out << preStr + systemCallMappings[i] +
+              " stop to resume (ns) p50/p99/max: " +
+              percentiles(l.stopToResume)
+          << endl;
+    }
+  }
+}
+// =======================================================================================
+double syscallStats::stopsPerCall(const counters& c) {
+  uint64_t calls = c.preHooks > c.replays ? c.preHooks - c.replays : 1;
+  return (double)(c.preHooks + c.postHooks + c.injected) / calls;
+}
+// =======================================================================================
+void syscallStats::printStops(ostream& out) const {
+  vector<int> called;
+  for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+    if (bySystemCall[i].preHooks + bySystemCall[i].postHooks != 0) {
+      called.push_back(i);
+    }
+  }
+  stable_sort(called.begin(), called.end(), [this](int a, int b) {
+    return stopsPerCall(bySystemCall[a]) > stopsPerCall(bySystemCall[b]);
+  });
+
+  string preStr = "dettrace Statistic. ";
+  for (int i : called) {
+    const counters& c = bySystemCall[i];
+    char perCall[32];
+    snprintf(perCall, sizeof(perCall), "%.2f", stopsPerCall(c));
+    out << preStr + systemCallMappings[i] + " stops per call: " + perCall +
+            " (pre " + to_string(c.preHooks) + ", post " +
+            to_string(c.postHooks) + ", injected " + to_string(c.injected) +
+            ")"
+        << endl;
+  }
+}
+// =======================================================================================
+vector<pair<string, syscallStats::executableCounters>>
+syscallStats::executablesNow() const {
+  unordered_map<const executableCounters*, uint64_t> stillRunning;
+  for (auto& r : runners) {
+    stillRunning[r.second.executable] += runningNanos(r.second);
+  }
+  vector<pair<string, executableCounters>> all;
+  for (auto& e : byExecutable) {
+    all.push_back(e);
+    auto running = stillRunning.find(&e.second);
+    if (running != stillRunning.end()) {
+      all.back().second.wallNanos += running->second;
+    }
+  }
+  return all;
+}
+// =======================================================================================
+void syscallStats::printExecutables(ostream& out, size_t lines) const {
+  vector<pair<string, executableCounters>> sorted = executablesNow();
+  sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+    return a.second.tracerNanos != b.second.tracerNanos
+        ? a.second.tracerNanos > b.second.tracerNanos
+        : a.first < b.first;
+  });
+  sorted.resize(min(sorted.size(), lines));
+
+  string preStr = "dettrace Statistic. ";
+  for (auto& e : sorted) {
+    const executableCounters& c = e.second;
+    out << preStr + e.first + ": " + to_string(c.execs) + " execs, " +
+            to_string(c.stops) + " stops, " + to_string(c.replays) +
+            " replays, tracer " + to_string(c.tracerNanos / 1000000) +
+            " ms, wall " + to_string(c.wallNanos / 1000000) + " ms"
+        << endl;
+  }
+}
+// =======================================================================================
+/** "System Call Events: " as system_call_events. */
+static string jsonKey(const string& name) {
+  string key;
+  for (char c : name) {
+    if (isalnum((unsigned char)c)) {
+      key += tolower((unsigned char)c);
+    } else if (!key.empty() && key.back() != '_') {
+      key += '_';
+    }
+  }
+  while (!key.empty() && key.back() == '_') {
+    key.pop_back();
+  }
+  return key;
+}
+
+static string countersJson(const syscallStats::counters& c) {
+  return "{\"pre_hooks\": " + to_string(c.preHooks) +
+      ", \"post_hooks\": " + to_string(c.postHooks) +
+      ", \"replays\": " + to_string(c.replays) +
+      ", \"injected\": " + to_string(c.injected) +
+      ", \"tracer_ns\": " + to_string(c.tracerNanos) + "}";
+}
+
+static string histogramJson(const latencyHistogram& h) {
+  return "{\"p50\": " + to_string(h.percentile(0.5)) +
+      ", \"p99\": " + to_string(h.percentile(0.99)) +
+      ", \"max\": " + to_string(h.max()) + "}";
+}
+// =======================================================================================
+void syscallStats::writeJson(
+    const string& path,
+    const vector<pair<string, uint64_t>>& totals) const {
+  ofstream out(path);
+  if (!out) {
+    runtimeError("Unable to open statistics file " + path);
+  }
+
+  out << "{\n  \"totals\": {";
+  const char* separator = "\n";
+  for (auto& total : totals) {
+    out << separator << "    \"" << jsonKey(total.first)
+        << "\": " << total.second;
+    separator = ",\n";
+  }
+
+  out << "\n  },\n  \"system_calls\": {";
+  separator = "\n";
+  for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+    const counters& c = bySystemCall[i];
+    if (c.preHooks + c.postHooks == 0) {
+      continue;
+    }
+    string json = countersJson(c);
+    char perCall[32];
+    snprintf(perCall, sizeof(perCall), "%.2f", stopsPerCall(c));
+    json.pop_back();
+    json += string(", \"stops_per_call\": ") + perCall + "}";
+    if (bySystemCallLatency[i]) {
+      json.pop_back();
+      json += ", \"hook_ns\": " + histogramJson(bySystemCallLatency[i]->hook) +
+          ", \"stop_to_resume_ns\": " +
+          histogramJson(bySystemCallLatency[i]->stopToResume) + "}";
+    }
+    out << separator << "    \"" << systemCallMappings[i] << "\": " << json;
+    separator = ",\n";
+  }
+
+  out << "\n  },\n  \"processes\": {";
+  separator = "\n";
+  vector<pid_t> pids;
+  for (auto& process : byProcess) {
+    pids.push_back(process.first);
+  }
+  sort(pids.begin(), pids.end());
+  for (pid_t pid : pids) {
+    out << separator << "    \"" << pid
+        << "\": " << countersJson(byProcess.at(pid));
+    separator = ",\n";
+  }
+  out << "\n  },\n  \"executables\": {";
+  separator = "\n";
+  vector<pair<string, executableCounters>> executables = executablesNow();
+  sort(executables.begin(), executables.end(), [](auto& a, auto& b) {
+    return a.first < b.first;
+  });
+  for (auto& e : executables) {
+    const executableCounters& c = e.second;
+    out << separator << "    " << jsonString(e.first)
+        << ": {\"execs\": " << c.execs << ", \"stops\": " << c.stops
+        << ", \"replays\": " << c.replays
+        << ", \"tracer_ns\": " << c.tracerNanos
+        << ", \"wall_ns\": " << c.wallNanos << "}";
+    separator = ",\n";
+  }
+  out << "\n  }\n}\n";
+
+  if (!out) {
+    runtimeError("Unable to write statistics file " + path);
+  }
+}
+// =======================================================================================
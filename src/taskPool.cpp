@@ -0,0 +1,58 @@
+#include "taskPool.hpp"
+
+// =======================================================================================
+taskPool::taskPool(unsigned helpers) {
+  for (unsigned i = 0; i < helpers; i++) {
+    this->helpers.emplace_back(&taskPool::work, this);
+  }
+}
+// =======================================================================================
+taskPool::~taskPool() { pause(); }
+// =======================================================================================
+void taskPool::pause() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  changed.notify_all();
+  for (auto& helper : helpers) {
+    helper.join();
+  }
+  paused += helpers.size();
+  helpers.clear();
+}
+// =======================================================================================
+void taskPool::resume() {
+  stopping = false;
+  for (; paused != 0; paused--) {
+    helpers.emplace_back(&taskPool::work, this);
+  }
+}
+// =======================================================================================
+void taskPool::enqueue(shared_ptr<pendingTask> task) {
+  {
+    lock_guard<mutex> guard(lock);
+    queue.push_back(move(task));
+  }
+  changed.notify_one();
+}
+// =======================================================================================
+void taskPool::work() {
+  unique_lock<mutex> guard(lock);
+  for (;;) {
+    changed.wait(guard, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return;
+    }
+    shared_ptr<pendingTask> task = move(queue.front());
+    queue.pop_front();
+    guard.unlock();
+    // The tracer may have taken it already.
+    if (task->claim()) {
+      task->run();
+      ranByHelpers++;
+    }
+    task.reset();
+    guard.lock();
+  }
+}
@@ -0,0 +1,107 @@
+#include "timeline.hpp"
+
+#include "util.hpp"
+
+// =======================================================================================
+timeline::timeline(const string& path) {
+  out = fopen(path.c_str(), "we");
+  if (out == nullptr) {
+    runtimeError("Unable to open timeline file " + path);
+  }
+  created = chrono::steady_clock::now();
+  fprintf(
+      out,
+      "[{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, "
+      "\"args\": {\"name\": \"tracer\"}}");
+}
+// =======================================================================================
+timeline::~timeline() {
+  fprintf(out, "\n]\n");
+  fclose(out);
+}
+// =======================================================================================
+double timeline::since(chrono::steady_clock::time_point t) const {
+  return chrono::duration<double, micro>(t - created).count();
+}
+// =======================================================================================
+void timeline::nameTrack(pid_t pid) {
+  if (named[pid]) {
+    return;
+  }
+  named[pid] = true;
+  fprintf(
+      out,
+      ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+      "\"args\": {\"name\": \"tracee %d\"}}",
+      pid, pid);
+}
+// =======================================================================================
+void timeline::slice(
+    pid_t pid,
+    const string& name,
+    chrono::steady_clock::time_point start,
+    chrono::steady_clock::time_point end) {
+  fprintf(
+      out,
+      ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+      "\"ts\": %.3f, \"dur\": %.3f}",
+      name.c_str(), pid, since(start), since(end) - since(start));
+}
+// =======================================================================================
+void timeline::resumed(pid_t pid) {
+  nameTrack(pid);
+  running[pid] = chrono::steady_clock::now();
+}
+// =======================================================================================
+void timeline::stopped(pid_t pid) {
+  auto run = running.find(pid);
+  if (run == running.end()) {
+    return;
+  }
+  slice(pid, "run", run->second, chrono::steady_clock::now());
+  running.erase(run);
+}
+// =======================================================================================
+void timeline::parked(pid_t pid, const char* reason) {
+  parkedSince[pid] = make_pair(chrono::steady_clock::now(), reason);
+}
+// =======================================================================================
+void timeline::woken(pid_t pid) {
+  auto park = parkedSince.find(pid);
+  if (park == parkedSince.end()) {
+    return;
+  }
+  slice(
+      pid, string{"blocked on "} + park->second.second, park->second.first,
+      chrono::steady_clock::now());
+  parkedSince.erase(park);
+}
+// =======================================================================================
+void timeline::hook(
+    pid_t pid,
+    const string& name,
+    chrono::steady_clock::time_point start) {
+  fprintf(
+      out,
+      ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, "
+      "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"tracee\": %d}}",
+      name.c_str(), since(start),
+      since(chrono::steady_clock::now()) - since(start), pid);
+}
+// =======================================================================================
+void timeline::instant(pid_t pid, const string& name) {
+  fprintf(
+      out,
+      ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, "
+      "\"tid\": %d, \"ts\": %.3f}",
+      name.c_str(), pid, since(chrono::steady_clock::now()));
+}
+// =======================================================================================
+void timeline::logicalTime(pid_t pid, int64_t logicalMicros) {
+  fprintf(
+      out,
+      ",\n{\"name\": \"logical clock %d\", \"ph\": \"C\", \"pid\": 0, "
+      "\"ts\": %.3f, \"args\": {\"us\": %lld}}",
+      pid, since(chrono::steady_clock::now()), (long long)logicalMicros);
+}
+// =======================================================================================
@@ -0,0 +1,27 @@
+#include "timerWheel.hpp"
+
+// =======================================================================================
+void timerWheel::arm(pid_t pid, logical_clock::time_point deadline) {
+  cancel(pid);
+  timerKey key{deadline, nextSequence++, pid};
+  byDeadline.insert(key);
+  timers.emplace(pid, key);
+}
+// =======================================================================================
+void timerWheel::cancel(pid_t pid) {
+  auto it = timers.find(pid);
+  if (it != timers.end()) {
+    byDeadline.erase(it->second);
+    timers.erase(it);
+  }
+}
+// =======================================================================================
+pid_t timerWheel::popEarliest(logical_clock::time_point* deadline) {
+  timerKey earliest = *byDeadline.begin();
+  byDeadline.erase(byDeadline.begin());
+  pid_t pid = get<2>(earliest);
+  timers.erase(pid);
+  *deadline = get<0>(earliest);
+  return pid;
+}
+// =======================================================================================
@@ -0,0 +1,76 @@
+/**
+ * dettrace-log-merge: put the shards of a `dettrace --log-shards` run back
+ * together, in the order they were logged.
+ *
+ *   dettrace-log-merge LOG [SHARD...]
+ *
+ * LOG is the log file the run wrote, e.g. build.log.00. Without shards every
+ * file next to it named LOG.PID is merged in, see logMerge.hpp.
+ */
+#include <dirent.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "logMerge.hpp"
+
+using namespace std;
+
+/** The files next to log named log.PID, by thread group. */
+static vector<string> shardsOf(const string& log) {
+  size_t slash = log.rfind('/');
+  string dir = slash == string::npos ? "." : log.substr(0, slash + 1);
+  string prefix = (slash == string::npos ? log : log.substr(slash + 1)) + ".";
+  vector<pair<long, string>> found;
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return {};
+  }
+  while (struct dirent* entry = readdir(d)) {
+    string name = entry->d_name;
+    if (name.size() <= prefix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    string group = name.substr(prefix.size());
+    if (group.find_first_not_of("0123456789") != string::npos) {
+      continue;
+    }
+    found.push_back({stol(group), slash == string::npos ? name : dir + name});
+  }
+  closedir(d);
+  sort(found.begin(), found.end());
+  vector<string> shards;
+  for (auto& shard : found) {
+    shards.push_back(shard.second);
+  }
+  return shards;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || string{argv[1]} == "--help") {
+    cerr << "usage: dettrace-log-merge LOG [SHARD...]" << endl;
+    return argc < 2 ? 2 : 0;
+  }
+  vector<string> files{argv[1]};
+  vector<string> shards =
+      argc > 2 ? vector<string>(argv + 2, argv + argc) : shardsOf(argv[1]);
+  files.insert(files.end(), shards.begin(), shards.end());
+
+  vector<unique_ptr<ifstream>> opened;
+  vector<istream*> inputs;
+  for (auto& file : files) {
+    opened.push_back(make_unique<ifstream>(file));
+    if (!*opened.back()) {
+      cerr << "dettrace-log-merge: unable to open " << file << endl;
+      return 1;
+    }
+    inputs.push_back(opened.back().get());
+  }
+  mergeLogShards(inputs, cout);
+  return 0;
+}
@@ -0,0 +1,195 @@
+/**
+ * dettrace-top: watch a run through the file `dettrace --live-stats` keeps
+ * its counters in.
+ *
+ *   dettrace-top [--interval SECONDS] [--lines N] [--once] FILE
+ *
+ * Every interval the screen is redrawn with the totals that moved most since
+ * the last redraw, per second, and the system calls with the most hooks. It
+ * exits once the run is over, or right after the first screen with --once.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cxxopts.hpp"
+#include "liveStats.hpp"
+
+using namespace std;
+
+/** A counter of the page, how much it moved since the last screen. */
+struct row {
+  string name;
+  uint64_t value;
+  double perSecond;
+};
+
+/** The busiest lines of rows, by rate, then by value. */
+static vector<row> busiest(vector<row> rows, size_t lines) {
+  stable_sort(rows.begin(), rows.end(), [](const row& a, const row& b) {
+    return a.perSecond != b.perSecond ? a.perSecond > b.perSecond
+                                      : a.value > b.value;
+  });
+  rows.resize(min(rows.size(), lines));
+  return rows;
+}
+
+/** The page now, against before, seconds earlier. */
+static void printScreen(
+    const liveStatsPage& now,
+    const liveStatsPage& before,
+    double seconds,
+    size_t lines,
+    bool clear) {
+  auto rate = [&](uint64_t a, uint64_t b) {
+    return seconds > 0 && a > b ? (a - b) / seconds : 0.0;
+  };
+
+  vector<row> totals;
+  for (uint32_t i = 0; i < now.totalCount; i++) {
+    uint64_t was = i < before.totalCount ? before.totals[i].value : 0;
+    // Named as printed, "name: ".
+    string name = now.totals[i].name;
+    name = name.substr(0, name.find_last_not_of(": ") + 1);
+    totals.push_back(
+        {name, now.totals[i].value, rate(now.totals[i].value, was)});
+  }
+  vector<row> systemCalls;
+  for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+    const liveStatsSystemCall& c = now.systemCalls[i];
+    const liveStatsSystemCall& was = before.systemCalls[i];
+    uint64_t hooks = c.preHooks + c.postHooks;
+    if (hooks != 0) {
+      systemCalls.push_back(
+          {systemCallMappings[i], hooks,
+           rate(hooks, was.preHooks + was.postHooks)});
+    }
+  }
+
+  if (clear) {
+    cout << "\033[H\033[2J";
+  }
+  char line[160];
+  snprintf(
+      line, sizeof(line), "dettrace %d: %.1f s%s, %lu updates\n",
+      now.tracerPid, now.elapsedNanos / 1e9, now.finished ? ", finished" : "",
+      (unsigned long)now.updates);
+  cout << line << "\n";
+  snprintf(line, sizeof(line), "%-56s %14s %12s\n", "total", "value", "per s");
+  cout << line;
+  for (auto& r : busiest(totals, lines)) {
+    snprintf(
+        line, sizeof(line), "%-56s %14lu %12.1f\n", r.name.c_str(),
+        (unsigned long)r.value, r.perSecond);
+    cout << line;
+  }
+  cout << "\n";
+  snprintf(
+      line, sizeof(line), "%-56s %14s %12s\n", "system call", "hooks",
+      "per s");
+  cout << line;
+  for (auto& r : busiest(systemCalls, lines)) {
+    snprintf(
+        line, sizeof(line), "%-56s %14lu %12.1f\n", r.name.c_str(),
+        (unsigned long)r.value, r.perSecond);
+    cout << line;
+  }
+  cout << flush;
+}
+
+int main(int argc, char** argv) {
+  // clang-format off
+  cxxopts::Options options("dettrace-top",
+      "Watch a dettrace run through its --live-stats file.");
+  options
+    .positional_help("FILE")
+    .add_options()
+    ( "help",
+      "display this help dialogue")
+    ( "interval",
+      "Seconds between screens. The default is `1`.",
+      cxxopts::value<double>())
+    ( "lines",
+      "Rows of totals and of system calls to show. The default is `15`.",
+      cxxopts::value<size_t>())
+    ( "once",
+      "Print one screen, with rates since the run started, and exit.")
+    ( "file",
+      "the --live-stats file",
+      cxxopts::value<string>());
+  // clang-format on
+
+  string file;
+  double interval = 1;
+  size_t lines = 15;
+  bool once = false;
+  try {
+    options.parse_positional({"file"});
+    auto result = options.parse(argc, argv);
+    if (result.count("help") || !result.count("file")) {
+      cout << options.help() << endl;
+      return result.count("help") ? 0 : 2;
+    }
+    file = result["file"].as<string>();
+    if (result.count("interval")) {
+      interval = result["interval"].as<double>();
+    }
+    if (result.count("lines")) {
+      lines = result["lines"].as<size_t>();
+    }
+    once = result.count("once") != 0;
+  } catch (exception& e) {
+    cerr << "dettrace-top: " << e.what() << endl;
+    cerr << options.help() << endl;
+    return 2;
+  }
+
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror(("dettrace-top: " + file).c_str());
+    return 1;
+  }
+  void* mapped =
+      mmap(nullptr, sizeof(liveStatsPage), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    perror(("dettrace-top: mmap " + file).c_str());
+    return 1;
+  }
+  const liveStatsPage* page = (const liveStatsPage*)mapped;
+
+  // Big, and taken as a whole each time: keep them off the stack.
+  auto now = make_unique<liveStatsPage>();
+  auto before = make_unique<liveStatsPage>();
+  auto next = make_unique<liveStatsPage>();
+  if (!readLiveStats(page, now.get())) {
+    cerr << "dettrace-top: " << file
+         << " is not a live statistics file of this dettrace version" << endl;
+    return 1;
+  }
+  if (once) {
+    printScreen(*now, *before, now->elapsedNanos / 1e9, lines, false);
+    return 0;
+  }
+
+  for (;;) {
+    double seconds = (now->elapsedNanos - before->elapsedNanos) / 1e9;
+    printScreen(*now, *before, seconds, lines, true);
+    if (now->finished) {
+      return 0;
+    }
+    usleep(interval * 1000000);
+    // Only move on once the tracer did, so rates are over its updates.
+    if (readLiveStats(page, next.get()) && next->updates != now->updates) {
+      swap(before, now);
+      swap(now, next);
+    }
+  }
+}
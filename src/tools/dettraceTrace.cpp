@@ -0,0 +1,593 @@
+/**
+ * dettrace-trace: decode, filter and compare binary traces written by
+ * `dettrace --trace-file`.
+ *
+ *   dettrace-trace print [--pid N] [--syscall NAME] TRACE
+ *   dettrace-trace diff [--pid N] [--syscall NAME] TRACE_A TRACE_B
+ *   dettrace-trace check [--pid N] [--syscall NAME] -- DETTRACE [ARGS...]
+ *
+ * diff compares the (filtered) event streams record by record and reports the
+ * first divergence, which is usually where the nondeterminism came in. It exits
+ * 0 when the traces match and 1 otherwise.
+ *
+ * check runs the dettrace command line twice at once and diffs the two traces
+ * as they are streamed to it, see runCheck.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/personality.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cxxopts.hpp"
+#include "systemCallList.hpp"
+#include "traceFile.hpp"
+
+using namespace std;
+
+/** Records passing this filter are printed/compared. */
+struct traceFilter {
+  int pid = -1; /*< -1 for all pids. */
+  int64_t syscall = -1; /*< -1 for all events. */
+
+  bool matches(const traceRecord& r) const {
+    if (pid != -1 && r.pid != pid) {
+      return false;
+    }
+    if (syscall != -1) {
+      bool isSyscall = r.event == traceEvent::syscallPre ||
+                       r.event == traceEvent::syscallPost;
+      if (!isSyscall || r.number != syscall) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * Read-only mapping of a trace file.
+ */
+class traceReader {
+public:
+  explicit traceReader(string path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      fail(path, strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      fail(path, strerror(errno));
+    }
+    length = st.st_size;
+    if (length < sizeof(traceFileHeader)) {
+      fail(path, "too short to be a trace");
+    }
+
+    void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      fail(path, strerror(errno));
+    }
+    data = (const char*)addr;
+
+    const traceFileHeader* header = (const traceFileHeader*)data;
+    if (memcmp(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic)) != 0) {
+      fail(path, "not a dettrace trace file");
+    }
+    if (header->version != TRACE_FILE_VERSION ||
+        header->recordSize != sizeof(traceRecord)) {
+      fail(
+          path, "unsupported trace version " + to_string(header->version) +
+                    ", expected " + to_string(TRACE_FILE_VERSION));
+    }
+
+    const traceRecord* first =
+        (const traceRecord*)(data + sizeof(traceFileHeader));
+    size_t count = (length - sizeof(traceFileHeader)) / sizeof(traceRecord);
+    // A trace from a crashed run ends in a zero filled tail.
+    for (size_t i = 0; i < count && first[i].pid != 0; i++) {
+      records.push_back(&first[i]);
+    }
+  }
+
+  ~traceReader() { munmap((void*)data, length); }
+
+  vector<const traceRecord*> filtered(const traceFilter& filter) const {
+    vector<const traceRecord*> result;
+    for (auto r : records) {
+      if (filter.matches(*r)) {
+        result.push_back(r);
+      }
+    }
+    return result;
+  }
+
+private:
+  [[noreturn]] static void fail(const string& path, const string& reason) {
+    cerr << "dettrace-trace: " << path << ": " << reason << endl;
+    exit(2);
+  }
+
+  const char* data;
+  size_t length;
+  vector<const traceRecord*> records;
+};
+
+static string systemCallName(int64_t nr) {
+  if (0 <= nr && nr < SYSTEM_CALL_COUNT) {
+    return systemCallMappings[nr];
+  }
+  return "syscall_" + to_string(nr);
+}
+
+static string formatRecord(const traceRecord& r) {
+  char buf[512];
+  int n = snprintf(
+      buf, sizeof(buf), "%8lu [%d] t=%ld ", (unsigned long)r.entryID, r.pid,
+      (long)r.logicalTime);
+  string line{buf, (size_t)n};
+
+  switch (r.event) {
+  case traceEvent::syscallPre:
+  case traceEvent::syscallPost:
+    snprintf(
+        buf, sizeof(buf), "%s %s(0x%lx, 0x%lx, 0x%lx, 0x%lx, 0x%lx, 0x%lx)",
+        r.event == traceEvent::syscallPre ? "pre " : "post",
+        systemCallName(r.number).c_str(), r.args[0], r.args[1], r.args[2],
+        r.args[3], r.args[4], r.args[5]);
+    line += buf;
+    if (r.event == traceEvent::syscallPost) {
+      line += " = " + to_string(r.returnValue);
+    }
+    break;
+  case traceEvent::signal:
+    line += "signal " + to_string(r.number) + " (" + strsignal(r.number) + ")";
+    break;
+  case traceEvent::fork:
+    line += string(r.number ? "thread " : "fork ") + to_string(r.returnValue);
+    break;
+  case traceEvent::exec:
+    line += "exec";
+    break;
+  case traceEvent::exit:
+    line += "exit " + to_string(r.returnValue);
+    if (r.number != 0) {
+      line += " by signal " + to_string(r.number);
+    }
+    break;
+  default:
+    line += "unknown event " + to_string((uint32_t)r.event);
+  }
+  return line;
+}
+
+/** Everything but entryID, which shifts when unrelated events differ. */
+static bool sameEvent(const traceRecord& a, const traceRecord& b) {
+  return a.pid == b.pid && a.event == b.event && a.number == b.number &&
+         memcmp(a.args, b.args, sizeof(a.args)) == 0 &&
+         a.returnValue == b.returnValue && a.logicalTime == b.logicalTime;
+}
+
+static int printTrace(const string& path, const traceFilter& filter) {
+  traceReader trace{path};
+  for (auto r : trace.filtered(filter)) {
+    cout << formatRecord(*r) << "\n";
+  }
+  return 0;
+}
+
+/** Matching events shown before a divergence. */
+static const size_t divergenceContext = 3;
+
+/**
+ * Report that the traces diverge at event i, after the events of context.
+ * a or b is null where its trace ended.
+ */
+static void printDivergence(
+    size_t i,
+    const vector<const traceRecord*>& context,
+    const traceRecord* a,
+    const traceRecord* b) {
+  cout << "Traces diverge at event " << i << ":" << endl;
+  for (auto r : context) {
+    cout << "  " << formatRecord(*r) << "\n";
+  }
+  cout << "< " << (a != nullptr ? formatRecord(*a) : "<end of trace>") << "\n";
+  cout << "> " << (b != nullptr ? formatRecord(*b) : "<end of trace>")
+       << endl;
+}
+
+static int diffTraces(
+    const string& pathA, const string& pathB, const traceFilter& filter) {
+  traceReader traceA{pathA}, traceB{pathB};
+  auto a = traceA.filtered(filter);
+  auto b = traceB.filtered(filter);
+
+  size_t common = min(a.size(), b.size());
+  size_t i = 0;
+  while (i < common && sameEvent(*a[i], *b[i])) {
+    i++;
+  }
+  if (i == a.size() && i == b.size()) {
+    cout << "Traces match (" << a.size() << " events)." << endl;
+    return 0;
+  }
+
+  size_t from = i < divergenceContext ? 0 : i - divergenceContext;
+  printDivergence(
+      i, vector<const traceRecord*>(a.begin() + from, a.begin() + i),
+      i < a.size() ? a[i] : nullptr, i < b.size() ? b[i] : nullptr);
+  return 1;
+}
+
+/**
+ * One of the two dettrace runs of check, and what we have of its trace.
+ */
+struct checkedRun {
+  pid_t pid = -1;
+  int trace = -1; /*< Read end of its --trace-stream, -1 once at EOF. */
+  string manifest; /*< Its --hash-outputs manifest. */
+  string bytes; /*< Read but not yet a whole header or record. */
+  bool gotHeader = false;
+  deque<traceRecord> records; /*< Filtered, not yet compared. */
+  int status = 0;
+
+  /** Take the header and whole records out of bytes. */
+  bool parse(const traceFilter& filter) {
+    size_t used = 0;
+    if (!gotHeader) {
+      if (bytes.size() < sizeof(traceFileHeader)) {
+        return true;
+      }
+      traceFileHeader header;
+      memcpy(&header, bytes.data(), sizeof(header));
+      if (memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+          header.version != TRACE_FILE_VERSION ||
+          header.recordSize != sizeof(traceRecord)) {
+        return false;
+      }
+      gotHeader = true;
+      used = sizeof(header);
+    }
+    for (; bytes.size() - used >= sizeof(traceRecord);
+         used += sizeof(traceRecord)) {
+      traceRecord r;
+      memcpy(&r, bytes.data() + used, sizeof(r));
+      if (filter.matches(r)) {
+        records.push_back(r);
+      }
+    }
+    bytes.erase(0, used);
+    return true;
+  }
+};
+
+/**
+ * Start run i of command: in a process group of its own, pinned to its own
+ * CPU, streaming its trace and hashing its outputs for us. The second run's
+ * conditions differ on purpose: its start is delayed, it runs at a lower
+ * priority, without ASLR for dettrace itself, and its output is thrown away.
+ * Both read /dev/null, the same input.
+ */
+static void startRun(
+    checkedRun& run,
+    int i,
+    const vector<string>& command,
+    const vector<int>& cpus) {
+  char manifest[] = "/tmp/dettrace-check-XXXXXX";
+  int manifestFd = mkstemp(manifest);
+  if (manifestFd == -1) {
+    perror("dettrace-trace: mkstemp");
+    exit(2);
+  }
+  close(manifestFd);
+  run.manifest = manifest;
+
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    perror("dettrace-trace: pipe2");
+    exit(2);
+  }
+  run.pid = fork();
+  if (run.pid == -1) {
+    perror("dettrace-trace: fork");
+    exit(2);
+  }
+  if (run.pid == 0) {
+    setpgid(0, 0);
+    if (cpus.size() >= 2) {
+      cpu_set_t cpu;
+      CPU_ZERO(&cpu);
+      CPU_SET(cpus[i * cpus.size() / 2], &cpu);
+      sched_setaffinity(0, sizeof(cpu), &cpu);
+    }
+    int devNull = open("/dev/null", O_RDWR);
+    dup2(devNull, STDIN_FILENO);
+    if (i == 1) {
+      usleep(20 * 1000);
+      setpriority(PRIO_PROCESS, 0, 10);
+      personality(ADDR_NO_RANDOMIZE);
+      dup2(devNull, STDOUT_FILENO);
+      dup2(devNull, STDERR_FILENO);
+    }
+    // Without O_CLOEXEC, dettrace closes it for its tracees itself.
+    int traceFd = dup(fds[1]);
+    vector<string> args{command[0], "--trace-stream", to_string(traceFd),
+                        "--hash-outputs", run.manifest};
+    args.insert(args.end(), command.begin() + 1, command.end());
+    vector<char*> argv;
+    for (auto& arg : args) {
+      argv.push_back((char*)arg.c_str());
+    }
+    argv.push_back(nullptr);
+    execvp(argv[0], argv.data());
+    perror(("dettrace-trace: " + command[0]).c_str());
+    _exit(127);
+  }
+  setpgid(run.pid, run.pid);
+  close(fds[1]);
+  run.trace = fds[0];
+}
+
+/** Lines of the manifest at path, empty if it can't be read. */
+static set<string> manifestLines(const string& path) {
+  set<string> lines;
+  ifstream in(path);
+  string line;
+  while (getline(in, line)) {
+    if (line != "{" && line != "}") {
+      // The last entry has no trailing comma.
+      if (!line.empty() && line.back() == ',') {
+        line.pop_back();
+      }
+      lines.insert(line);
+    }
+  }
+  return lines;
+}
+
+/**
+ * Runs command, a dettrace command line, twice at once under different
+ * conditions, see startRun, and compares their traces event by event as they
+ * come. On the first divergence both runs are killed, without waiting for the
+ * rest of them. Runs that don't diverge have their exit statuses and
+ * --hash-outputs manifests compared once they are done.
+ * @return 0 if the runs match, 1 if they don't, 2 if they failed to run.
+ */
+static int runCheck(const vector<string>& command, const traceFilter& filter) {
+  cpu_set_t allowed;
+  vector<int> cpus;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+
+  checkedRun runs[2];
+  for (int i = 0; i < 2; i++) {
+    startRun(runs[i], i, command, cpus);
+  }
+
+  // The last matching events, shown before a divergence.
+  deque<traceRecord> context;
+  size_t compared = 0;
+  int result = -1;
+  while (result == -1) {
+    struct pollfd fds[2];
+    int polled[2];
+    int count = 0;
+    for (int i = 0; i < 2; i++) {
+      if (runs[i].trace != -1) {
+        polled[count] = i;
+        fds[count++] = {runs[i].trace, POLLIN, 0};
+      }
+    }
+    if (count == 0) {
+      break;
+    }
+    if (poll(fds, count, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("dettrace-trace: poll");
+      result = 2;
+      break;
+    }
+
+    for (int j = 0; j < count && result == -1; j++) {
+      if (fds[j].revents == 0) {
+        continue;
+      }
+      int i = polled[j];
+      checkedRun& run = runs[i];
+      char buf[64 * 1024];
+      ssize_t n = read(run.trace, buf, sizeof(buf));
+      if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      if (n <= 0) {
+        close(run.trace);
+        run.trace = -1;
+        if (!run.gotHeader) {
+          cerr << "dettrace-trace: run " << i + 1 << " ended without a trace"
+               << endl;
+          result = 2;
+        }
+        continue;
+      }
+      run.bytes.append(buf, n);
+      if (!run.parse(filter)) {
+        cerr << "dettrace-trace: run " << i + 1
+             << " streamed a trace of another version" << endl;
+        result = 2;
+      }
+    }
+
+    deque<traceRecord>& a = runs[0].records;
+    deque<traceRecord>& b = runs[1].records;
+    while (result == -1 && !a.empty() && !b.empty()) {
+      if (!sameEvent(a.front(), b.front())) {
+        vector<const traceRecord*> before;
+        for (auto& r : context) {
+          before.push_back(&r);
+        }
+        printDivergence(compared, before, &a.front(), &b.front());
+        result = 1;
+        break;
+      }
+      context.push_back(a.front());
+      if (context.size() > divergenceContext) {
+        context.pop_front();
+      }
+      a.pop_front();
+      b.pop_front();
+      compared++;
+    }
+    // One trace ended before the other.
+    bool aDone = runs[0].trace == -1 && a.empty();
+    bool bDone = runs[1].trace == -1 && b.empty();
+    if (result == -1 && (aDone != bDone) && (!a.empty() || !b.empty())) {
+      vector<const traceRecord*> before;
+      for (auto& r : context) {
+        before.push_back(&r);
+      }
+      printDivergence(
+          compared, before, aDone ? nullptr : &a.front(),
+          bDone ? nullptr : &b.front());
+      result = 1;
+    }
+  }
+
+  for (auto& run : runs) {
+    if (result != -1) {
+      kill(-run.pid, SIGKILL);
+    }
+    waitpid(run.pid, &run.status, 0);
+    if (run.trace != -1) {
+      close(run.trace);
+    }
+  }
+
+  if (result == -1) {
+    result = 0;
+    if (runs[0].status != runs[1].status) {
+      cout << "Traces match (" << compared << " events), but the runs exited "
+           << "with different statuses: " << runs[0].status << " and "
+           << runs[1].status << "." << endl;
+      result = 1;
+    }
+    set<string> outputsA = manifestLines(runs[0].manifest);
+    set<string> outputsB = manifestLines(runs[1].manifest);
+    if (outputsA != outputsB) {
+      cout << "Outputs differ:" << endl;
+      for (auto& line : outputsA) {
+        if (outputsB.count(line) == 0) {
+          cout << "<" << line << "\n";
+        }
+      }
+      for (auto& line : outputsB) {
+        if (outputsA.count(line) == 0) {
+          cout << ">" << line << "\n";
+        }
+      }
+      cout << flush;
+      result = 1;
+    }
+    if (result == 0) {
+      cout << "Runs match (" << compared << " events, " << outputsA.size()
+           << " outputs)." << endl;
+    }
+  }
+  for (auto& run : runs) {
+    unlink(run.manifest.c_str());
+  }
+  return result;
+}
+
+int main(int argc, char** argv) {
+  // clang-format off
+  cxxopts::Options options("dettrace-trace",
+      "Decode, filter and compare dettrace --trace-file traces.");
+  options
+    .positional_help(
+        "print TRACE | diff TRACE_A TRACE_B | check -- DETTRACE [ARGS...]")
+    .add_options()
+    ( "help",
+      "display this help dialogue")
+    ( "pid",
+      "Only show events for this pid.",
+      cxxopts::value<int>())
+    ( "syscall",
+      "Only show events for this system call, by name or number.",
+      cxxopts::value<string>())
+    ( "command",
+      "print, diff or check",
+      cxxopts::value<string>())
+    ( "traces",
+      "trace files, or the dettrace command line to check",
+      cxxopts::value<vector<string>>());
+  // clang-format on
+
+  string command;
+  vector<string> traces;
+  traceFilter filter;
+  try {
+    options.parse_positional({"command", "traces"});
+    auto result = options.parse(argc, argv);
+    if (result.count("help") || !result.count("command")) {
+      cout << options.help() << endl;
+      return result.count("help") ? 0 : 2;
+    }
+    command = result["command"].as<string>();
+    if (result.count("traces")) {
+      traces = result["traces"].as<vector<string>>();
+    }
+    if (result.count("pid")) {
+      filter.pid = result["pid"].as<int>();
+    }
+    if (result.count("syscall")) {
+      string name = result["syscall"].as<string>();
+      for (int i = 0; i < SYSTEM_CALL_COUNT; i++) {
+        if (systemCallMappings[i] == name) {
+          filter.syscall = i;
+        }
+      }
+      if (filter.syscall == -1) {
+        filter.syscall = stol(name);
+      }
+    }
+  } catch (exception& e) {
+    cerr << "dettrace-trace: " << e.what() << endl;
+    cerr << options.help() << endl;
+    return 2;
+  }
+
+  if (command == "print" && traces.size() == 1) {
+    return printTrace(traces[0], filter);
+  }
+  if (command == "diff" && traces.size() == 2) {
+    return diffTraces(traces[0], traces[1], filter);
+  }
+  if (command == "check" && !traces.empty()) {
+    return runCheck(traces, filter);
+  }
+  cerr << options.help() << endl;
+  return 2;
+}
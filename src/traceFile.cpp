@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "traceFile.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+// =======================================================================================
+traceWriter::traceWriter(string path) {
+  fd = doWithCheck(
+      open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666),
+      "Unable to open trace file " + path);
+  mapNextWindow();
+
+  traceFileHeader header = {};
+  memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_FILE_VERSION;
+  header.recordSize = sizeof(traceRecord);
+  memcpy(window, &header, sizeof(header));
+  windowUsed = sizeof(header);
+}
+// =======================================================================================
+traceWriter::~traceWriter() {
+  off_t length = windowStart + windowUsed;
+  munmap(window, windowSize);
+  // Drop the zero filled tail of the last window.
+  if (ftruncate(fd, length) == -1) {
+    perror("ftruncate trace file");
+  }
+  close(fd);
+}
+// =======================================================================================
+void traceWriter::append(traceRecord record) {
+  record.entryID = nextEntryID++;
+
+  // Records may straddle two windows, copy in up to two pieces.
+  const char* bytes = (const char*)&record;
+  size_t left = sizeof(record);
+  while (left > 0) {
+    if (windowUsed == windowSize) {
+      mapNextWindow();
+    }
+    size_t n = min(left, windowSize - windowUsed);
+    memcpy(window + windowUsed, bytes, n);
+    windowUsed += n;
+    bytes += n;
+    left -= n;
+  }
+}
+// =======================================================================================
+void traceWriter::mapNextWindow() {
+  if (window != nullptr) {
+    doWithCheck(munmap(window, windowSize), "munmap trace window");
+    windowStart += windowSize;
+  }
+
+  doWithCheck(
+      ftruncate(fd, windowStart + windowSize), "Unable to grow trace file");
+  void* addr = mmap(
+      nullptr, windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, windowStart);
+  if (addr == MAP_FAILED) {
+    runtimeError("Unable to mmap trace file: " + string(strerror(errno)));
+  }
+  window = (char*)addr;
+  windowUsed = 0;
+}
+// =======================================================================================
+traceStream::traceStream(int fd) : fd(fd) {
+  traceFileHeader header = {};
+  memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_FILE_VERSION;
+  header.recordSize = sizeof(traceRecord);
+  send(&header, sizeof(header));
+  batch.reserve(batchRecords);
+}
+// =======================================================================================
+traceStream::~traceStream() {
+  send(batch.data(), batch.size() * sizeof(traceRecord));
+  if (fd != -1) {
+    close(fd);
+  }
+}
+// =======================================================================================
+void traceStream::append(traceRecord record) {
+  record.entryID = nextEntryID++;
+  batch.push_back(record);
+  if (batch.size() == batchRecords) {
+    send(batch.data(), batch.size() * sizeof(traceRecord));
+    batch.clear();
+  }
+}
+// =======================================================================================
+void traceStream::send(const void* bytes, size_t size) {
+  const char* next = (const char*)bytes;
+  while (fd != -1 && size > 0) {
+    ssize_t n = write(fd, next, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    // The checker stopped reading, it no longer needs our records.
+    if (n <= 0) {
+      close(fd);
+      fd = -1;
+      return;
+    }
+    next += n;
+    size -= n;
+  }
+}
+// =======================================================================================
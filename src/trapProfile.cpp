@@ -0,0 +1,93 @@
+#include "trapProfile.hpp"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <fstream>
+
+// =======================================================================================
+trapProfile::trapProfile(const string& path, uint32_t period)
+    : path(path), period(period == 0 ? 1 : period) {}
+// =======================================================================================
+trapProfile::~trapProfile() {
+  ofstream out(path);
+  if (!out) {
+    fprintf(stderr, "Unable to write trap profile %s\n", path.c_str());
+    return;
+  }
+  for (auto& stack : stacks) {
+    out << stack.first << ' ' << stack.second << '\n';
+  }
+}
+// =======================================================================================
+void trapProfile::trapped(
+    pid_t pid, const string& trap, uint64_t rip, uint64_t rbp) {
+  if (traps++ % period != 0) {
+    return;
+  }
+
+  vector<uint64_t> frames{rip};
+  for (int i = 0; i < maxFrames && rbp != 0 && rbp % 8 == 0; i++) {
+    // The caller's frame pointer and our return address.
+    uint64_t frame[2];
+    iovec local = {frame, sizeof(frame)};
+    iovec remote = {(void*)rbp, sizeof(frame)};
+    if (process_vm_readv(pid, &local, 1, &remote, 1, 0) != sizeof(frame) ||
+        frame[1] == 0) {
+      break;
+    }
+    frames.push_back(frame[1]);
+    // Stacks grow down, a frame pointer that doesn't go up is garbage.
+    if (frame[0] <= rbp) {
+      break;
+    }
+    rbp = frame[0];
+  }
+
+  string stack;
+  for (auto frame = frames.rbegin(); frame != frames.rend(); frame++) {
+    stack += frameName(pid, *frame) + ";";
+  }
+  stacks[stack + trap]++;
+}
+// =======================================================================================
+void trapProfile::mapped(pid_t pid, const vma& m) {
+  auto known = maps.find(pid);
+  // Otherwise the first frame looked up reads pid's maps, m included.
+  if (known != maps.end()) {
+    known->second.map(m);
+  }
+}
+// =======================================================================================
+string trapProfile::frameName(pid_t pid, uint64_t addr) {
+  auto known = maps.find(pid);
+  const vma* m = known == maps.end() ? nullptr : known->second.find(addr);
+  if (m == nullptr) {
+    // New mappings since we last looked.
+    addressSpace& fresh = maps[pid];
+    fresh = addressSpace(parseProcMapEntries(pid));
+    m = fresh.find(addr);
+  }
+
+  char name[32];
+  if (m == nullptr) {
+    snprintf(name, sizeof(name), "0x%" PRIx64, addr);
+    return name;
+  }
+  snprintf(name, sizeof(name), "+0x%" PRIx64, addr - m->start + m->offset);
+  return moduleName(*m) + name;
+}
+// =======================================================================================
+string trapProfile::moduleName(const vma& m) {
+  if (m.name.empty()) {
+    return "[anon]";
+  }
+  string name = m.name.substr(m.name.rfind('/') + 1);
+  // They would split the folded line.
+  replace(name.begin(), name.end(), ' ', '_');
+  replace(name.begin(), name.end(), ';', '_');
+  return name;
+}
+// =======================================================================================
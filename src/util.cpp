@@ -5,6 +5,7 @@
 
 #include <iostream>
 
+#include "logger.hpp"
 #include "util.hpp"
 
 using namespace std;
@@ -45,6 +46,8 @@ unordered_map<int, string> futexAdditionalFlags = {
 
 /*======================================================================================*/
 void runtimeError(string error) {
+  // Make sure the log leading up to this error is on disk before we unwind.
+  logger::flushAll();
   throw runtime_error("dettrace runtime exception: " + error);
 }
 
@@ -72,12 +75,24 @@ int parseNum(const char* const numToParse) {
   return num;
 }
 /*======================================================================================*/
-int doWithCheck(int returnValue, string errorMessage) {
-  string reason = strerror(errno);
-  if (returnValue == -1) {
-    runtimeError(errorMessage + ":\n  " + reason);
+void failWithErrno(const string& errorMessage, int error) {
+  runtimeError(errorMessage + ":\n  " + strerror(error));
+}
+/*======================================================================================*/
+string jsonString(const string& str) {
+  string json = "\"";
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json += escaped;
+    } else {
+      json += c;
+    }
   }
-
-  return returnValue;
+  return json + "\"";
 }
 /*======================================================================================*/
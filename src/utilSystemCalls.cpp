@@ -1,10 +1,29 @@
 #include "utilSystemCalls.hpp"
 
 #include <fcntl.h>
+#include <linux/magic.h>
+#include <linux/openat2.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 
+#include "probes.hpp"
+#include "processTable.hpp"
 #include "util.hpp"
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+/** Most heap swaps an empty poll waits before it is retried anyway. */
+static const uint32_t maxPollBackoff = 64;
+
 // File local functions.
 
 bool preemptIfBlocked(
@@ -14,7 +33,7 @@ bool preemptIfBlocked(
     scheduler& sched,
     int64_t errnoValue) {
   if (-errnoValue == t.getReturnValue()) {
-    gs.log.writeToLog(Importance::info, "Syscall would have blocked!\n");
+    DETTRACE_LOG(gs.log, Importance::info, "Syscall would have blocked!\n");
 
     sched.preemptAndScheduleNext();
     return true;
@@ -29,13 +48,19 @@ bool replaySyscallIfBlocked(
     state& s,
     ptracer& t,
     scheduler& sched,
-    int64_t errornoValue) {
+    int64_t errornoValue,
+    const waitReason* reason) {
   if (-errornoValue == t.getReturnValue()) {
-    gs.log.writeToLog(
-        Importance::info, "System call would have blocked! Replaying\n");
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "System call would have blocked! Replaying\n");
 
     gs.replayDueToBlocking++;
-    sched.preemptAndScheduleNext();
+    if (reason != nullptr) {
+      sched.preemptAndWaitFor(*reason);
+    } else {
+      sched.preemptAndScheduleNext();
+    }
     replaySystemCall(gs, t, t.getSystemCallNumber());
     return true;
   } else {
@@ -47,6 +72,90 @@ bool replaySyscallIfBlocked(
   }
 }
 // =======================================================================================
+bool addPipeReadyReasons(
+    state& s,
+    int fd,
+    bool readable,
+    bool writable,
+    vector<waitReason>& reasons) {
+  // Writes to it and the tracer's reads of it wake these, see
+  // serveEventfdRead.
+  const shared_ptr<eventfdInfo>& eventfd = s.fdInfoOf(fd).eventfd;
+  if (eventfd != nullptr) {
+    reasons.push_back(waitReason{waitKind::eventfd, eventfd->id});
+    return true;
+  }
+  if (s.countFdStatus(fd) == 0) { // Only for pipes
+    return false;
+  }
+  ino_t inode = pipeKeyFor(s, fd);
+  if (inode == 0) {
+    return false;
+  }
+  if (readable) {
+    reasons.push_back(waitReason{waitKind::pipeReadable, inode});
+  }
+  if (writable) {
+    reasons.push_back(waitReason{waitKind::pipeWritable, inode});
+  }
+  return true;
+}
+// =======================================================================================
+bool replayPollWhenReady(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    const vector<waitReason>& reasons,
+    bool backOff) {
+  if (t.getReturnValue() != 0) {
+    s.pollBackoff = 1;
+    return false;
+  }
+
+  gs.replayDueToBlocking++;
+  gs.emptyPollRetries++;
+  if (backOff || reasons.empty()) {
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "Nothing ready, replaying on %zu events or after %u heap swaps\n",
+        reasons.size(), s.pollBackoff);
+    sched.preemptAndWaitForAny(reasons, s.pollBackoff);
+    s.pollBackoff = min(2 * s.pollBackoff, maxPollBackoff);
+  } else {
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Nothing ready, replaying on %zu events\n",
+        reasons.size());
+    sched.preemptAndWaitForAny(reasons, 0);
+  }
+  replaySystemCall(gs, t, t.getSystemCallNumber());
+  return true;
+}
+// =======================================================================================
+bool replayUntilTimeout(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    logical_clock::duration timeout,
+    const vector<waitReason>& reasons,
+    bool backOff) {
+  logical_clock::time_point deadline;
+  if (sched.takeExpiredTimer(s.traceePid, &deadline)) {
+    DETTRACE_LOG(gs.log, Importance::info, "Timed out.\n");
+    s.advanceTimeTo(deadline);
+    s.pollBackoff = 1;
+    return false;
+  }
+
+  if (!sched.timerArmed(s.traceePid)) {
+    sched.armTimer(s.traceePid, s.getLogicalTime() + timeout);
+  }
+  vector<waitReason> anyOf = reasons;
+  anyOf.push_back(waitReason{waitKind::timer, (uint64_t)s.traceePid});
+  return replayPollWhenReady(gs, s, t, sched, anyOf, backOff);
+}
+// =======================================================================================
 void replaySystemCall(globalState& gs, ptracer& t, uint64_t systemCall) {
 #ifdef EXTRANEOUS_TRACEE_READS
   uint16_t minus2 = t.readFromTracee(
@@ -58,6 +167,7 @@ void replaySystemCall(globalState& gs, ptracer& t, uint64_t systemCall) {
 #endif
 
   gs.totalReplays++;
+  DETTRACE_PROBE2(replay, t.getPid(), systemCall);
   // Replay system call!
   t.changeSystemCall(systemCall);
   t.writeIp((uint64_t)t.getRip().ptr - 2);
@@ -80,6 +190,40 @@ void zeroOutStatfs(struct statfs& stats) {
   stats.f_flags = 1; /* Mount flags of filesystem */
 }
 // =======================================================================================
+ino_t virtualInode(globalState& gs, ino_t realinode) {
+  return gs.inodeMap.lookupOrAdd(realinode);
+}
+// =======================================================================================
+struct timespec virtualMtime(globalState& gs, ino_t realinode) {
+  // Use inode to check if we created this file during our run.
+  const auto mtime = get_with_default(gs.mtimeMap, realinode, gs.epoch);
+
+  DETTRACE_LOG(
+      gs.log, Importance::extra,
+      " realinode in mtimeMap %d, resulting mtime: %d\n",
+      gs.mtimeMap.find(realinode) != gs.mtimeMap.end(), mtime);
+
+  struct timespec ts = logical_clock::to_timespec(mtime);
+  // TODO: I suspect there is some remaining bug related to #263.
+  // Perhaps it has to do with all the conversions between time formats.
+  // However, I don't think we really need nanosecond granularity for stat
+  // results, so returning a constant here:
+  ts.tv_nsec = 999;
+  return ts;
+}
+// =======================================================================================
+off_t virtualSize(mode_t mode, off_t size) {
+  if (S_ISDIR(mode)) {
+    // joe: I haven't seen irreproducible file sizes, but I have seen the same
+    // directory contents result in different sizes across machines (with
+    // different versions of Linux, 4.15 vs 4.18). The same filesystem type
+    // (ext4), same block size, tar --sort=name and --preserve-order weren't
+    // sufficient to determinize the directory st_size.
+    return 16384;
+  }
+  return size;
+}
+// =======================================================================================
 void handleStatFamily(
     globalState& gs, state& s, ptracer& t, string syscallName) {
   struct stat* statPtr;
@@ -91,7 +235,7 @@ void handleStatFamily(
   }
 
   if (statPtr == nullptr) {
-    gs.log.writeToLog(Importance::info, syscallName + ": statbuf null.\n");
+    DETTRACE_LOG(gs.log, Importance::info, syscallName + ": statbuf null.\n");
     return;
   }
 
@@ -109,42 +253,33 @@ void handleStatFamily(
     myStat.st_size = theirStat.st_size;
 
     ino_t realinode = theirStat.st_ino;
-    gs.log.writeToLog(
-        Importance::extra, "(device,realinode) = (%lu,%lu)\n", theirStat.st_dev,
-        realinode);
-    // Use inode to check if we created this file during our run.
-    const auto mtime = get_with_default(gs.mtimeMap, realinode, gs.epoch);
-
-    gs.log.writeToLog(
-        Importance::extra, " realinode in mtimeMap %d, resulting mtime: %d\n",
-        gs.mtimeMap.find(realinode) != gs.mtimeMap.end(), mtime);
+    DETTRACE_LOG(
+        gs.log, Importance::extra, "(device,realinode) = (%lu,%lu)\n",
+        theirStat.st_dev, realinode);
+    if (gs.fakeroot != nullptr) {
+      gs.fakeroot->apply(
+          theirStat.st_dev, realinode, myStat.st_uid, myStat.st_gid,
+          myStat.st_mode);
+    }
 
     /* Time of last access */
     myStat.st_atim = logical_clock::to_timespec(gs.epoch);
     /* Time of last status change */
     myStat.st_ctim = logical_clock::to_timespec(gs.epoch);
     /* Time of last modification */
-    myStat.st_mtim = logical_clock::to_timespec(mtime);
-
-    // TODO: I suspect there is some remaining bug related to #263.
-    // Perhaps it has to do with all the conversions between time formats.
-    // However, I don't think we really need nanosecond granularity for stat
-    // results, so returning a constant here:
-    myStat.st_mtim.tv_nsec = 999;
+    myStat.st_mtim = virtualMtime(gs, realinode);
 
     // TODO: I'm surprised this doesn't break things. I guess so far, we have
     // only used single device filesystems.
     myStat.st_dev = 1; /* ID of device containing file */
 
-    myStat.st_ino = gs.inodeMap.realValueExists(realinode)
-                        ? gs.inodeMap.getVirtualValue(realinode)
-                        : gs.inodeMap.addRealValue(realinode);
+    myStat.st_ino = virtualInode(gs, realinode);
 
     // st_mode holds the permissions to the file. If we zero it out libc
     // functions will think we don't have access to this file. Hence we keep our
     // permissions as part of the stat. mode_t    st_mode;        /* File type
     // and mode */
-    gs.log.writeToLog(Importance::info, "st_mode:0%o\n", myStat.st_mode);
+    DETTRACE_LOG(gs.log, Importance::info, "st_mode:0%o\n", myStat.st_mode);
 
     myStat.st_nlink = 1; /* Number of hard links */
 
@@ -158,17 +293,11 @@ void handleStatFamily(
 
     // Program will stall if we put some arbitrary value here: TODO.
     // myStat.st_size = 512;        /* Total size, in bytes */
-    if (S_ISDIR(myStat.st_mode)) {
-      // joe: I haven't seen irreproducible file sizes, but I have seen the same
-      // directory contents result in different sizes across machines (with
-      // different versions of Linux, 4.15 vs 4.18). The same filesystem type
-      // (ext4), same block size, tar --sort=name and --preserve-order weren't
-      // sufficient to determinize the directory st_size.
-      myStat.st_size = 16384;
-    }
-    gs.log.writeToLog(Importance::info, "st_size:%u\n", myStat.st_size);
-    gs.log.writeToLog(
-        Importance::info, "overwriting tracee stat struct, copying %u bytes\n",
+    myStat.st_size = virtualSize(myStat.st_mode, myStat.st_size);
+    DETTRACE_LOG(gs.log, Importance::info, "st_size:%u\n", myStat.st_size);
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "overwriting tracee stat struct, copying %u bytes\n",
         sizeof(struct stat));
 
     myStat.st_blksize = 512; /* Block size for filesystem I/O */
@@ -184,27 +313,37 @@ void handleStatFamily(
 // =======================================================================================
 void printInfoString(
     uint64_t addr, logger& log, pid_t traceePid, ptracer& t, string postFix) {
-  if ((char*)addr != nullptr && log.getDebugLevel() > 0) {
+  if ((char*)addr != nullptr && log.isEnabled(Importance::info)) {
     string path = t.readTraceeCString(traceePtr<char>((char*)addr), traceePid);
     string msg = postFix + log.makeTextColored(Color::green, path) + "\n";
-    log.writeToLog(Importance::info, msg);
+    DETTRACE_LOG(log, Importance::info, msg);
   }
   return;
 }
 // =======================================================================================
 void injectPause(globalState& gs, state& s, ptracer& t) {
-  gs.log.writeToLog(Importance::info, "Injecting pause call to tracee!\n");
+  DETTRACE_LOG(gs.log, Importance::info, "Injecting pause call to tracee!\n");
   s.syscallInjected = true;
   gs.injectedSystemCalls++;
 
   replaySystemCall(gs, t, SYS_pause);
 }
 // =======================================================================================
-void replaceSystemCallWithNoop(globalState& gs, state& s, ptracer& t) {
+bool replaceSystemCallWithNoop(
+    globalState& gs, state& s, ptracer& t, int64_t returnValue) {
+  if (gs.skipSystemCalls) {
+    t.changeSystemCall(-1);
+    t.setReturnRegister(returnValue);
+    DETTRACE_LOG(gs.log, Importance::info, "Skipping this system call\n");
+    s.systemCallSkipped = true;
+    return true;
+  }
   t.changeSystemCall(SYS_time);
-  gs.log.writeToLog(Importance::info, "Turning this system call into a NOOP\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Turning this system call into a NOOP\n");
   s.noopSystemCall = true;
-  return;
+  s.noopReturnValue = returnValue;
+  return false;
 }
 // =======================================================================================
 void cancelSystemCall(globalState& gs, state& s, ptracer& t) {
@@ -212,6 +351,8 @@ void cancelSystemCall(globalState& gs, state& s, ptracer& t) {
   long cancelled = t.getSystemCallNumber();
   pid_t pid = t.getPid();
   t.changeSystemCall(-1);
+  t.flushRegs();
+  t.flushTraceeWrites();
   ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
 
   long rax = regs.rax;
@@ -219,12 +360,13 @@ void cancelSystemCall(globalState& gs, state& s, ptracer& t) {
   regs.orig_rax = -1;
   regs.rax = -1;
 
-  gs.log.writeToLog(
-      Importance::info,
+  DETTRACE_LOG(
+      gs.log, Importance::info,
       "cancel pending syscall: " + to_string(cancelled) + "\n");
 
   ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
   ptracer::doPtrace(PTRACE_SINGLESTEP, pid, 0, 0);
+  t.clearReadCache();
 
   int status = 0;
   waitpid(pid, &status, 0);
@@ -243,6 +385,11 @@ void cancelSystemCall(globalState& gs, state& s, ptracer& t) {
 }
 
 void failSystemCall(globalState& gs, state& s, ptracer& t, int err) {
+  if (gs.skipSystemCalls) {
+    t.changeSystemCall(-1);
+    t.setReturnRegister(-err);
+    return;
+  }
   cancelSystemCall(gs, s, t);
   long ret = -err;
   t.setReturnRegister(ret);
@@ -252,24 +399,143 @@ void failSystemCall(globalState& gs, state& s, ptracer& t, int err) {
 pair<int, int> getPipeFds(globalState& gs, state& s, ptracer& t) {
   // Get values of both file descriptors.
   int* pipefdTracee = (int*)t.arg1();
-  traceePtr<int> fdPtr1 = traceePtr<int>(&pipefdTracee[0]);
-  traceePtr<int> fdPtr2 = traceePtr<int>(&pipefdTracee[1]);
+  int fds[2];
+  t.readTraceeBatch(
+      {traceeIo(traceePtr<int>(pipefdTracee), fds, sizeof(fds))}, t.getPid());
 
-  int fd1 = t.readFromTracee(fdPtr1, t.getPid());
-  int fd2 = t.readFromTracee(fdPtr2, t.getPid());
+  int fd1 = fds[0];
+  int fd2 = fds[1];
 
-  gs.log.writeToLog(Importance::info, "Got pipe fd1: " + to_string(fd1) + "\n");
-  gs.log.writeToLog(Importance::info, "Got pipe fd2: " + to_string(fd2) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Got pipe fd1: " + to_string(fd1) + "\n");
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Got pipe fd2: " + to_string(fd2) + "\n");
 
   return make_pair(fd1, fd2);
 }
 
+// =======================================================================================
+bool statWillFail(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    traceePtr<char> path,
+    int dirfd,
+    bool followLinks) {
+  if (!gs.predictMissingFiles || path.ptr == nullptr ||
+      (dirfd < 0 && dirfd != AT_FDCWD)) {
+    return false;
+  }
+  string traceePath = t.readTraceeCString(path, s.traceePid);
+  // AT_EMPTY_PATH, a stat of dirfd itself.
+  if (traceePath.empty()) {
+    return false;
+  }
+  string resolvedPath = resolve_tracee_path(gs, s, traceePath, dirfd);
+  if (resolvedPath.empty()) {
+    return false;
+  }
+  if (missingPathError(gs, resolvedPath, followLinks) == 0) {
+    return false;
+  }
+  DETTRACE_LOG(
+      gs.log, Importance::info, "%s is missing, no post-hook.\n",
+      resolvedPath.c_str());
+  gs.missingStatsPredicted++;
+  return true;
+}
+// =======================================================================================
+int missingPathError(
+    globalState& gs, const string& hostPath, bool followLinks) {
+  int err = gs.missing.find(hostPath);
+  if (err != 0) {
+    gs.missing.hits++;
+    return err;
+  }
+  struct stat statbuf;
+  if (lstat(hostPath.c_str(), &statbuf) == 0) {
+    if (!followLinks || !S_ISLNK(statbuf.st_mode) ||
+        stat(hostPath.c_str(), &statbuf) == 0) {
+      return 0;
+    }
+    // A dangling link, it appears with its target: not kept.
+    return errno == ENOENT || errno == ENOTDIR ? errno : 0;
+  }
+  if (errno != ENOENT && errno != ENOTDIR) {
+    return 0;
+  }
+  err = errno;
+
+  // Up to the deepest ancestor that is a directory, unless one is a dangling
+  // link.
+  string directory = hostPath;
+  for (;;) {
+    size_t slash = directory.find_last_of('/');
+    if (slash == string::npos) {
+      return err;
+    }
+    directory.resize(slash == 0 ? 1 : slash);
+    if (stat(directory.c_str(), &statbuf) == 0) {
+      if (S_ISDIR(statbuf.st_mode)) {
+        gs.missing.insert(hostPath, err, statbuf.st_dev, statbuf.st_ino);
+        return err;
+      }
+    } else if (errno == ENOENT && lstat(directory.c_str(), &statbuf) == 0) {
+      return err;
+    } else if (errno != ENOENT && errno != ENOTDIR) {
+      return err;
+    }
+    if (directory == "/") {
+      return err;
+    }
+  }
+}
+// =======================================================================================
+void forgetMissing(globalState& gs, const string& hostPath) {
+  if (gs.missing.empty()) {
+    return;
+  }
+  string path = hostPath;
+  while (path.size() > 1 && path.back() == '/') {
+    path.pop_back();
+  }
+  struct stat statbuf;
+  // Creating through a link creates its target, wherever that is.
+  if (lstat(path.c_str(), &statbuf) == 0 && S_ISLNK(statbuf.st_mode)) {
+    gs.missing.clear();
+    return;
+  }
+  size_t slash = path.find_last_of('/');
+  if (slash == string::npos) {
+    return;
+  }
+  string directory = path.substr(0, slash == 0 ? 1 : slash);
+  if (stat(directory.c_str(), &statbuf) == 0) {
+    gs.missing.created(statbuf.st_dev, statbuf.st_ino);
+  }
+}
+// =======================================================================================
+void forgetMissing(
+    globalState& gs, state& s, ptracer& t, traceePtr<char> path, int dirfd) {
+  if (gs.missing.empty() || path.ptr == nullptr ||
+      (dirfd < 0 && dirfd != AT_FDCWD)) {
+    return;
+  }
+  string traceePath = t.readTraceeCString(path, s.traceePid);
+  if (traceePath.empty()) {
+    return;
+  }
+  string hostPath = resolve_tracee_path(gs, s, traceePath, dirfd);
+  if (!hostPath.empty()) {
+    forgetMissing(gs, hostPath);
+  }
+}
 // =======================================================================================
 bool tracee_file_exists(
-    const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd) {
+    globalState& gs, state& s, const string& traceePath, int traceeDirFd) {
+  logger& log = gs.log;
   // Create full absolute path in the hostOS file system.
-  string resolvedPath =
-      resolve_tracee_path(traceePath, traceePid, log, traceeDirFd);
+  string resolvedPath = resolve_tracee_path(gs, s, traceePath, traceeDirFd);
 
   if (resolvedPath.empty()) return false;
 
@@ -281,9 +547,10 @@ bool tracee_file_exists(
   } else if (err == ENOENT /*|| err == ENOTDIR might be needed later */) {
     return false;
   } else {
-    log.writeToLog(
-        Importance::info, "Unable to check for existance of file: " +
-                              resolvedPath + ", error: " + strerror(errno));
+    DETTRACE_LOG(
+        log, Importance::info,
+        "Unable to check for existance of file: " + resolvedPath +
+            ", error: " + strerror(errno));
     return false;
   }
 
@@ -292,15 +559,16 @@ bool tracee_file_exists(
 }
 // =======================================================================================
 ino_t inode_from_tracee(
-    const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd) {
+    globalState& gs, state& s, const string& traceePath, int traceeDirFd) {
+  logger& log = gs.log;
   // Create full absolute path in the hostOS file system.
-  string resolvedPath =
-      resolve_tracee_path(traceePath, traceePid, log, traceeDirFd);
+  string resolvedPath = resolve_tracee_path(gs, s, traceePath, traceeDirFd);
 
   if (resolvedPath.empty()) {
-    log.writeToLog(
-        Importance::info, string{"inode_from_tracee, cannot resolve "} +
-                              traceePath + "for pid: " + to_string(traceePid));
+    DETTRACE_LOG(
+        log, Importance::info,
+        string{"inode_from_tracee, cannot resolve "} + traceePath +
+            "for pid: " + to_string(s.traceePid));
     return -1;
   }
 
@@ -309,96 +577,208 @@ ino_t inode_from_tracee(
   // file it points to! So we lstat
   int res = lstat(resolvedPath.c_str(), &statbuf);
   if (res < 0) {
-    log.writeToLog(
-        Importance::info, "Unable to stat file " + traceePath + " => " +
-                              resolvedPath + " tracee, error: " +
-                              strerror(errno) + " (" + to_string(errno) + ")");
+    DETTRACE_LOG(
+        log, Importance::info,
+        "Unable to stat file " + traceePath + " => " + resolvedPath +
+            " tracee, error: " + strerror(errno) + " (" + to_string(errno) +
+            ")");
     return -1;
   }
 
   if (S_ISLNK(statbuf.st_mode)) {
-    log.writeToLog(Importance::info, "This file is a symbolic link\n");
+    DETTRACE_LOG(log, Importance::info, "This file is a symbolic link\n");
   }
 
-  log.writeToLog(
-      Importance::info, "lstat(%s) returned inode!\n", resolvedPath.c_str());
-  log.writeToLog(
-      Importance::extra, "lstat(%s) returned inode: %d!\n",
+  DETTRACE_LOG(
+      log, Importance::info, "lstat(%s) returned inode!\n",
+      resolvedPath.c_str());
+  DETTRACE_LOG(
+      log, Importance::extra, "lstat(%s) returned inode: %d!\n",
       resolvedPath.c_str(), statbuf.st_ino);
 
   return statbuf.st_ino;
 }
 // =======================================================================================
-ino_t readInodeFor(logger& log, pid_t traceePid, int fd) {
-  std::ostringstream ss;
-  // read from /proc/$pid/fd/$fd
-  ss << "/proc/" << traceePid << "/fd/" << fd;
-  string procPath = ss.str();
-  log.writeToLog(Importance::info, "procPath: %s\n", procPath.c_str());
+ino_t readInodeFor(logger& log, state& s, int fd) {
+  ino_t known = s.fdInfoOf(fd).inode;
+  if (known != 0) {
+    return known;
+  }
+  string procPath = "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(fd);
   struct stat statbuf = {0};
-  int res = stat(procPath.c_str(), &statbuf);
-  if (res < 0) {
+  if (stat(procPath.c_str(), &statbuf) < 0) {
     runtimeError(
-        "Unable to stat file in "
-        "tracee from /proc/. errno: " +
-        to_string(res));
+        "Unable to stat file in tracee from /proc/. errno: " +
+        to_string(errno));
   }
-
-  log.writeToLog(
-      Importance::info, "stat(%s) returned inode!\n", procPath.c_str());
-  log.writeToLog(
-      Importance::extra, "stat(%s) returned inode: %d!\n", procPath.c_str(),
-      statbuf.st_ino);
+  s.setFdFile(fd, statbuf.st_dev, statbuf.st_ino);
+  DETTRACE_LOG(
+      log, Importance::extra, "stat(%s) returned inode: %d!\n",
+      procPath.c_str(), statbuf.st_ino);
 
   return statbuf.st_ino;
 }
 // =======================================================================================
+ino_t pipeInodeFor(pid_t traceePid, int fd) {
+  string procPath =
+      "/proc/" + to_string(traceePid) + "/fd/" + to_string(fd);
+  struct stat statbuf = {0};
+  if (stat(procPath.c_str(), &statbuf) != 0 || !S_ISFIFO(statbuf.st_mode)) {
+    return 0;
+  }
+  return statbuf.st_ino;
+}
+// =======================================================================================
+ino_t socketInodeFor(pid_t traceePid, int fd) {
+  string procPath =
+      "/proc/" + to_string(traceePid) + "/fd/" + to_string(fd);
+  struct stat statbuf = {0};
+  if (stat(procPath.c_str(), &statbuf) != 0 || !S_ISSOCK(statbuf.st_mode)) {
+    return 0;
+  }
+  return statbuf.st_ino;
+}
+// =======================================================================================
+ino_t pipeKeyFor(state& s, int fd) {
+  const socketPairEnd& end = s.fdInfoOf(fd).socketPair;
+  if (end.inode != 0) {
+    return end.key();
+  }
+  ino_t inode = s.readProbe->inodeOf(fd);
+  // FIFOs we saw opened.
+  if (inode == 0 && s.getFdType(fd) == fdType::pipe) {
+    inode = s.fdInfoOf(fd).inode;
+  }
+  return inode != 0 ? inode : pipeInodeFor(s.traceePid, fd);
+}
+// =======================================================================================
+string traceeFdPath(pid_t traceePid, int fd) {
+  string procPath =
+      "/proc/" + to_string(traceePid) + "/fd/" + to_string(fd);
+  char buf[PATH_MAX];
+  ssize_t n = readlink(procPath.c_str(), buf, sizeof(buf));
+  if (n <= 0 || n == sizeof(buf) || buf[0] != '/') {
+    return "";
+  }
+  return string(buf, n);
+}
+// =======================================================================================
+int fdOpenedForReading(state& s, ptracer& t, int syscallNum) {
+  int flags;
+  switch (syscallNum) {
+  case SYS_open:
+    flags = t.arg2();
+    break;
+  case SYS_openat:
+    flags = t.arg3();
+    break;
+#ifdef SYS_openat2
+  case SYS_openat2:
+    flags = t.readFromTracee(
+                 traceePtr<struct open_how>((struct open_how*)t.arg3()),
+                 s.traceePid)
+                .flags;
+    break;
+#endif
+  default:
+    return -1;
+  }
+  int fd = t.getReturnValue();
+  return fd < 0 || (flags & O_ACCMODE) == O_WRONLY ? -1 : fd;
+}
+// =======================================================================================
+int duplicateTraceeFd(pid_t traceePid, int fd) {
+  static atomic<bool> supported{true};
+  if (!supported) {
+    return -1;
+  }
+
+  int pidfd = syscall(SYS_pidfd_open, traceePid, 0);
+  if (pidfd == -1) {
+    // Kernel before 5.3, or seccomp'd away.
+    if (errno == ENOSYS || errno == EPERM) {
+      supported = false;
+    }
+    return -1;
+  }
+  int ourFd = syscall(SYS_pidfd_getfd, pidfd, fd, 0);
+  if (ourFd == -1 && (errno == ENOSYS || errno == EPERM)) {
+    supported = false;
+  }
+  close(pidfd);
+  return ourFd;
+}
+// =======================================================================================
+void wakePipeWaiters(scheduler& sched) {
+  sched.wakeAll(waitKind::pipeReadable);
+  sched.wakeAll(waitKind::pipeWritable);
+}
+// =======================================================================================
+void pipeSent(globalState& gs, state& s, int fd, ino_t inode) {
+  if (!gs.vectorClocks) {
+    return;
+  }
+  if (inode == 0 && (inode = pipeKeyFor(s, fd)) == 0) {
+    return;
+  }
+  gs.pipeClocks[inode].merge(gs.causalSend(s));
+}
+// =======================================================================================
+void pipeReceived(
+    globalState& gs, state& s, scheduler& sched, int fd, ino_t inode) {
+  if (!gs.vectorClocks) {
+    return;
+  }
+  if (inode == 0 && (inode = pipeKeyFor(s, fd)) == 0) {
+    return;
+  }
+  auto sent = gs.pipeClocks.find(inode);
+  if (sent != gs.pipeClocks.end() && gs.causalReceive(s, sent->second) &&
+      sched.events != nullptr) {
+    sched.events->instant(s.traceePid, "heard of " + s.causality->str());
+  }
+}
+// =======================================================================================
+void wakeFutexWaiters(
+    globalState& gs, scheduler& sched, const vector<pid_t>& woken) {
+  for (pid_t waiter : woken) {
+    gs.processes.at(waiter).futexWoken = true;
+    sched.wake(waitKind::futexWord, waiter);
+  }
+}
+// =======================================================================================
 bool sendTraceeSignalNow(
     int signum, globalState& gs, state& s, ptracer& t, scheduler& sched) {
   enum sighandler_type sh = SIGHANDLER_DEFAULT;
-  if (s.currentSignalHandlers.get()->count(signum)) {
-    sh = s.currentSignalHandlers.get()->at(signum);
+  if (s.currentSignalHandlers->count(signum)) {
+    sh = s.currentSignalHandlers->at(signum);
   }
 
   switch (sh) {
   case SIGHANDLER_CUSTOM_1SHOT: {
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "tracee has a custom 1-shot signal " + to_string(signum) +
             " handler, sending signal to pid %u\n",
         t.getPid());
 
-    // TODO: JLD is this a race? the tracee isn't technically paused yet
-    t.changeSystemCall(SYS_pause);
-    s.signalInjected = true;
-    (*s.currentSignalHandlers.get())[signum] =
+    s.currentSignalHandlers.write()[signum] =
         SIGHANDLER_DEFAULT; // go back to default next time
-    int retVal = syscall(SYS_tgkill, t.getPid(), t.getPid(), signum);
-    if (0 != retVal) {
-      runtimeError(
-          "sending myself signal " + to_string(signum) +
-          " failed, tgkill returned " + to_string(retVal));
-    }
-    return true; // run pause post-hook
+    s.pendingSignals.push(signum);
+    t.changeSystemCall(SYS_sched_yield);
+    return false;
   }
 
   case SIGHANDLER_CUSTOM: {
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "tracee has a custom signal " + to_string(signum) +
             " handler, sending signal to pid %u\n",
         t.getPid());
 
-    // TODO: JLD is this a race? the tracee isn't technically paused yet
-    t.changeSystemCall(SYS_pause);
-    s.signalInjected = true;
-    int retVal = syscall(SYS_tgkill, t.getPid(), t.getPid(), signum);
-    if (0 != retVal) {
-      runtimeError(
-          "sending myself signal " + to_string(signum) +
-          " failed, tgkill returned " + to_string(retVal));
-    }
-    return true; // run pause post-hook
+    s.pendingSignals.push(signum);
+    t.changeSystemCall(SYS_sched_yield);
+    return false;
   }
 
   case SIGHANDLER_DEFAULT: {
@@ -406,8 +786,8 @@ bool sendTraceeSignalNow(
       runtimeError("can't send myself a signal " + to_string(signum));
     }
     // for SIGALRM, SIGVTALRM, SIGPROF, default handler terminates the tracee
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "tracee has default signal " + to_string(signum) +
             " handler, injecting exit() for pid %u\n",
         t.getPid());
@@ -418,8 +798,8 @@ bool sendTraceeSignalNow(
 
   case SIGHANDLER_IGNORED: // don't do anything
     replaceSystemCallWithNoop(gs, s, t);
-    gs.log.writeToLog(
-        Importance::info,
+    DETTRACE_LOG(
+        gs.log, Importance::info,
         "tracee is ignoring signal " + to_string(signum) + ", doing nothing\n");
     return true; // run noop (getpid) post-hook
 
@@ -432,8 +812,43 @@ bool sendTraceeSignalNow(
   return false;
 }
 // =======================================================================================
+bool setSignalTimer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    logicalTimers::timerKey key,
+    int signum,
+    timerSetting setting,
+    timerSetting* old) {
+  *old = s.timers.write().setTimer(key, signum, s.getLogicalTime(), setting);
+  if (signum == 0 || !s.timers->armed(key)) {
+    replaceSystemCallWithNoop(gs, s, t);
+    return true;
+  }
+  logical_clock::time_point expiry = s.timers->expiry(key);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Timer goes off at %ld, jumping there.\n",
+      (long)expiry.time_since_epoch().count());
+  s.advanceTimeTo(expiry);
+  s.timers.write().expire(key, expiry);
+  return sendTraceeSignalNow(signum, gs, s, t, sched);
+}
+// =======================================================================================
+timerSetting timerSettingAt(
+    const struct itimerspec& spec,
+    bool absolute,
+    logical_clock::time_point now) {
+  timerSetting setting = timerSetting::fromItimerspec(spec);
+  if (absolute && setting.value != logical_clock::duration::zero()) {
+    auto expiry = logical_clock::from_timespec(spec.it_value);
+    setting.value = max(expiry - now, logical_clock::duration(1));
+  }
+  return setting;
+}
+// =======================================================================================
 string resolve_tracee_path(
-    const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd) {
+    globalState& gs, state& s, const string& traceePath, int traceeDirFd) {
   // Some system calls take empty path and use traceeDirFd exclusively to refer
   // to a file see O_PATH option in `man 2 open`. We do not support this right
   // now...
@@ -445,54 +860,51 @@ string resolve_tracee_path(
     runtimeError("Negative dirfd given to resolve_tracee_path.");
   }
 
-  string prefixProcFd;
+  stringId prefix;
   // is absolute path:
   if (traceePath.rfind("/", 0) == 0) {
     // Absolute path, the user might have chrooted. Use their root.
-    prefixProcFd = "/proc/" + to_string(traceePid) + "/root";
+    prefix = s.paths.write().root(gs.hostPaths, s.traceePid);
   } else {
     // Only on relative paths should we use traceeDirFd if avaliable, and it's
     // not. AT_FDCWD, just uses CWD which we do anyways, in the else branch.
     if (traceeDirFd != -1 && traceeDirFd != AT_FDCWD) {
-      log.writeToLog(
-          Importance::info, "Using user's dirfd for path resolution.\n");
-      prefixProcFd =
-          "/proc/" + to_string(traceePid) + "/fd/" + to_string(traceeDirFd);
+      DETTRACE_LOG(
+          gs.log, Importance::info,
+          "Using user's dirfd for path resolution.\n");
+      prefix = s.paths.write().dirFd(gs.hostPaths, s.traceePid, traceeDirFd);
     } else {
       // Use cwd to figure out path.
-      prefixProcFd = "/proc/" + to_string(traceePid) + "/cwd";
+      prefix = s.paths.write().cwd(gs.hostPaths, s.traceePid);
     }
   }
 
-  log.writeToLog(
-      Importance::info, "prefixProcFd location: %s\n", prefixProcFd.c_str());
-  char pathbuf[PATH_MAX + 1] = {0};
-  int ret = readlink(prefixProcFd.c_str(), pathbuf, PATH_MAX);
-  if (ret == -1) {
-    log.writeToLog(
-        Importance::info,
-        "Unable to read cwd from tracee: " + to_string(traceePid) +
+  if (prefix == stringInterner::noString) {
+    DETTRACE_LOG(
+        gs.log, Importance::info,
+        "Unable to read cwd from tracee: " + to_string(s.traceePid) +
             " errno: " + to_string(errno));
     return "";
   }
 
-  auto res = string{pathbuf} + "/" + traceePath;
-  log.writeToLog(
-      Importance::info, "Resolving path %s => %s\n", traceePath.c_str(),
-      res.c_str());
+  auto res = gs.strings.str(prefix) + "/" + traceePath;
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Resolving path %s => %s\n",
+      traceePath.c_str(), res.c_str());
   return res;
 }
 // =======================================================================================
-void handlePreOpens(
+uint64_t handlePreOpens(
     globalState& gs,
     state& s,
     ptracer& t,
     int dirfd,
     traceePtr<char> charpath,
-    int flags) {
+    int flags,
+    bool plainLookup) {
   string path = t.readTraceeCString(charpath, s.traceePid);
   string coloredPath = gs.log.makeTextColored(Color::green, path);
-  gs.log.writeToLog(Importance::info, "Path: %s\n", coloredPath.c_str());
+  DETTRACE_LOG(gs.log, Importance::info, "Path: %s\n", coloredPath.c_str());
   string flagsStr = "";
   if ((flags & O_RDONLY) == O_RDONLY) {
     flagsStr += "O_RDONLY ";
@@ -557,7 +969,8 @@ void handlePreOpens(
   if ((flags & O_TRUNC) == O_TRUNC) {
     flagsStr += "O_TRUNC ";
   }
-  gs.log.writeToLog(Importance::info, "Flags: 0x%x " + flagsStr + "\n", flags);
+  DETTRACE_LOG(
+      gs.log, Importance::info, "Flags: 0x%x " + flagsStr + "\n", flags);
 
   /*
   The O_TMPFILE flag is a superset of other flags and includes, bizarrely,
@@ -576,14 +989,21 @@ Linux acghaswellcat16 4.15.0-43-generic #46-Ubuntu SMP Thu Dec 6 14:45:28 UTC
   if ((flags & O_TMPFILE) == O_TMPFILE) {
     // tmp file being created, no way it could already exist. Skip straight to
     // post-hook.
-    gs.log.writeToLog(Importance::info, "temporary file being created.\n");
-    return;
+    DETTRACE_LOG(gs.log, Importance::info, "temporary file being created.\n");
+    return 0;
   }
 
-  if (path == "/dev/random") {
+  stringId pathId = gs.strings.find(path);
+  if (pathId == gs.devRandomPath) {
     gs.devRandomOpens++;
-  } else if (path == "/dev/urandom") {
+    if (gs.virtualDevRandom) {
+      s.openingRandom = fdType::devRandom;
+    }
+  } else if (pathId == gs.devUrandomPath) {
     gs.devUrandomOpens++;
+    if (gs.virtualDevRandom) {
+      s.openingRandom = fdType::devUrandom;
+    }
   }
 
   // Flag should never be false in pre-hook.
@@ -595,31 +1015,132 @@ Linux acghaswellcat16 4.15.0-43-generic #46-Ubuntu SMP Thu Dec 6 14:45:28 UTC
   // We only case we care about newly created files, later we might want to
   // update the mtime for other modification events like O_TRUNC or O_APPEND.
   if ((flags & O_CREAT) == O_CREAT) {
-    gs.log.writeToLog(Importance::info, "Tracee included O_CREATE.\n");
-    s.fileExisted = tracee_file_exists(path, s.traceePid, gs.log, dirfd);
-    gs.log.writeToLog(
-        Importance::info, "fileExisted? %s\n",
+    DETTRACE_LOG(gs.log, Importance::info, "Tracee included O_CREATE.\n");
+    s.fileExisted = tracee_file_exists(gs, s, path, dirfd);
+    DETTRACE_LOG(
+        gs.log, Importance::info, "fileExisted? %s\n",
         s.fileExisted ? "true" : "false");
+    if (!s.fileExisted && !gs.missing.empty()) {
+      forgetMissing(gs, resolve_tracee_path(gs, s, path, dirfd));
+    }
+  }
+
+  const string* synthetic =
+      gs.synthetic != nullptr ? gs.synthetic->redirect(path) : nullptr;
+  if (synthetic != nullptr && (flags & O_ACCMODE) == O_RDONLY &&
+      (flags & (O_CREAT | O_TRUNC)) == 0 && s.mmapMemory.doesExist &&
+      synthetic->size() < s.mmapMemory.getLength()) {
+    DETTRACE_LOG(
+        gs.log, Importance::info, "Serving %s from memory\n", path.c_str());
+    traceePtr<void> replacement = s.mmapMemory.getAddr();
+    s.mmapMemory.writeBytes(
+        t, replacement, synthetic->c_str(), synthetic->size() + 1,
+        s.traceePid);
+    gs.syntheticOpens++;
+    return (uint64_t)replacement.ptr;
   }
+
+  // Search paths are mostly probed in vain, a probe we know misses needn't
+  // run at all.
+  if (gs.predictMissingFiles && gs.skipSystemCalls && plainLookup &&
+      synthetic == nullptr && (flags & O_CREAT) == 0 && !path.empty() &&
+      (dirfd >= 0 || dirfd == AT_FDCWD)) {
+    string hostPath = resolve_tracee_path(gs, s, path, dirfd);
+    int err = hostPath.empty()
+        ? 0
+        : missingPathError(gs, hostPath, (flags & O_NOFOLLOW) == 0);
+    if (err != 0) {
+      DETTRACE_LOG(
+          gs.log, Importance::info, "%s is missing, skipping the open.\n",
+          hostPath.c_str());
+      replaceSystemCallWithNoop(gs, s, t, -err);
+      gs.missingOpensSkipped++;
+    }
+  }
+  return 0;
 }
 // =======================================================================================
+/**
+ * What fd of traceePid, just returned by open, refers to. Terminals are the
+ * character devices of the tty, console and pseudo terminal majors. Files of
+ * /proc are only told apart from regular files with procFiles.
+ * @param statbuf filled in with the stat of fd, zeroed if it failed
+ */
+static fdType openedFdType(
+    pid_t traceePid, int fd, bool procFiles, struct stat& statbuf) {
+  string procPath = "/proc/" + to_string(traceePid) + "/fd/" + to_string(fd);
+  if (stat(procPath.c_str(), &statbuf) != 0) {
+    statbuf = {};
+    return fdType::unknown;
+  }
+
+  if (S_ISREG(statbuf.st_mode)) {
+    struct statfs fs;
+    if (procFiles && statfs(procPath.c_str(), &fs) == 0 &&
+        fs.f_type == PROC_SUPER_MAGIC) {
+      return fdType::procFile;
+    }
+    return fdType::regular;
+  }
+  if (S_ISFIFO(statbuf.st_mode)) {
+    return fdType::pipe;
+  }
+  if (S_ISSOCK(statbuf.st_mode)) {
+    return fdType::socket;
+  }
+  unsigned int deviceMajor = major(statbuf.st_rdev);
+  // The memory devices, wherever the node is.
+  if (S_ISCHR(statbuf.st_mode) && deviceMajor == 1) {
+    if (minor(statbuf.st_rdev) == 3) {
+      return fdType::devNull;
+    }
+    if (minor(statbuf.st_rdev) == 5) {
+      return fdType::devZero;
+    }
+  }
+  if (S_ISCHR(statbuf.st_mode) &&
+      (deviceMajor == 4 || deviceMajor == 5 ||
+       (deviceMajor >= 136 && deviceMajor <= 143))) {
+    return fdType::tty;
+  }
+  return fdType::unknown;
+}
+
 void handlePostOpens(globalState& gs, state& s, ptracer& t, int flags) {
-  gs.log.writeToLog(Importance::info, "Flags: 0x%x\n", flags);
+  DETTRACE_LOG(gs.log, Importance::info, "Flags: 0x%x\n", flags);
+  if (t.getReturnValue() >= 0) {
+    int fd = t.getReturnValue();
+    fdType type = s.openingRandom;
+    if (type == fdType::unknown) {
+      struct stat statbuf;
+      type = openedFdType(s.traceePid, fd, gs.logProcReads, statbuf);
+      if (statbuf.st_ino != 0) {
+        s.setFdFile(fd, statbuf.st_dev, statbuf.st_ino);
+      }
+    }
+    s.setFdType(fd, type);
+    // O_PATH fds can't be read or written at all.
+    if ((flags & O_PATH) == 0) {
+      s.setFdAccessMode(fd, flags & O_ACCMODE);
+    }
+  }
+  s.openingRandom = fdType::unknown;
+  s.openingSynthetic = false;
   if (t.getReturnValue() >= 0 &&
       // New regular file created through O_CREAT
       ((((flags & O_CREAT) == O_CREAT) && !s.fileExisted) ||
        // Special case for O_TMPFILE, always consider the file to be
        // newly-created
        ((flags & O_TMPFILE) == O_TMPFILE))) {
-    gs.log.writeToLog(Importance::info, "A new file was created\n!");
+    DETTRACE_LOG(gs.log, Importance::info, "A new file was created\n!");
     // Use fd to get inode.
-    auto inode = readInodeFor(gs.log, s.traceePid, t.getReturnValue());
-    gs.mtimeMap[inode] = s.getLogicalTime();
+    auto inode = readInodeFor(gs.log, s, t.getReturnValue());
+    gs.setMtime(inode, s.getLogicalTime());
     gs.inodeMap.addRealValue(inode);
     s.incrementTime();
   }
   s.fileExisted = false;
-  gs.log.writeToLog(
-      Importance::info, "File descriptor: %d\n", t.getReturnValue());
+  DETTRACE_LOG(
+      gs.log, Importance::info, "File descriptor: %d\n", t.getReturnValue());
 }
 // =======================================================================================
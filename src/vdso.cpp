@@ -1,4 +1,4 @@
-/// parsing vDSO symbols based on vDSO entry found from /proc/<pid>/maps
+/// parsing vDSO symbols based on vDSO found from AT_SYSINFO_EHDR in the auxv
 /// Note vDSO can be disabled by passing `vdso=0` kernel command line.
 /// The vDSO entry is loaded by Linux kernel before app return from execve
 /// Even statically linked app will have vDSO loaded (by Linux kernel).
@@ -77,8 +77,140 @@ static const unsigned char __vdso_gettimeofday[] = {
   , 0xc3                                         // retq
   , 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00     // nopl 0x0(%rax, %rax, 1)
   , 0x00 };
+
+/*
+ * byte code for the logical clock vdso functions, copied into the tracee's
+ * logicalClockPage. They find the page by rounding down %r11, which their
+ * trampoline jumped through, return the logical time and tick it by one step.
+ * Once readsLeft runs out they do the real system call instead, so the tracer
+ * still gets to preempt tracees polling the time.
+ * NB: the byte code must be 16 bytes aligned
+ */
+static const unsigned char __logical_clock_gettime[] = {
+    0x49, 0x81, 0xe3, 0x00, 0xf0, 0xff, 0xff      // and $-4096, %r11
+  , 0x49, 0xff, 0x4b, 0x10                        // decq 0x10(%r11)
+  , 0x7e, 0x2d                                    // jle to the syscall
+  , 0x48, 0x85, 0xf6                              // test %rsi, %rsi
+  , 0x74, 0x25                                    // je done
+  , 0x49, 0x8b, 0x03                              // mov (%r11), %rax
+  , 0x49, 0x8b, 0x4b, 0x08                        // mov 0x8(%r11), %rcx
+  , 0x48, 0x01, 0xc1                              // add %rax, %rcx
+  , 0x49, 0x89, 0x0b                              // mov %rcx, (%r11)
+  , 0x31, 0xd2                                    // xor %edx, %edx
+  , 0xb9, 0x40, 0x42, 0x0f, 0x00                  // mov $1000000, %ecx
+  , 0x48, 0xf7, 0xf1                              // div %rcx
+  , 0x48, 0x89, 0x06                              // mov %rax, (%rsi)
+  , 0x48, 0x69, 0xd2, 0xe8, 0x03, 0x00, 0x00      // imul $1000, %rdx, %rdx
+  , 0x48, 0x89, 0x56, 0x08                        // mov %rdx, 0x8(%rsi)
+  , 0x31, 0xc0                                    // done: xor %eax, %eax
+  , 0xc3                                          // retq
+  , 0xb8, 0xe4, 0x00, 0x00, 0x00                  // mov SYS_clock_gettime, %eax
+  , 0x0f, 0x05                                    // syscall
+  , 0xc3                                          // retq
+  , 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc
+  , 0xcc, 0xcc };
+
+static const unsigned char __logical_gettimeofday[] = {
+    0x49, 0x81, 0xe3, 0x00, 0xf0, 0xff, 0xff      // and $-4096, %r11
+  , 0x49, 0xff, 0x4b, 0x10                        // decq 0x10(%r11)
+  , 0x7e, 0x32                                    // jle to the syscall
+  , 0x48, 0x85, 0xff                              // test %rdi, %rdi
+  , 0x74, 0x1e                                    // je timezone
+  , 0x49, 0x8b, 0x03                              // mov (%r11), %rax
+  , 0x49, 0x8b, 0x4b, 0x08                        // mov 0x8(%r11), %rcx
+  , 0x48, 0x01, 0xc1                              // add %rax, %rcx
+  , 0x49, 0x89, 0x0b                              // mov %rcx, (%r11)
+  , 0x31, 0xd2                                    // xor %edx, %edx
+  , 0xb9, 0x40, 0x42, 0x0f, 0x00                  // mov $1000000, %ecx
+  , 0x48, 0xf7, 0xf1                              // div %rcx
+  , 0x48, 0x89, 0x07                              // mov %rax, (%rdi)
+  , 0x48, 0x89, 0x57, 0x08                        // mov %rdx, 0x8(%rdi)
+  , 0x48, 0x85, 0xf6                              // timezone: test %rsi, %rsi
+  , 0x74, 0x07                                    // je done
+  , 0x48, 0xc7, 0x06, 0x00, 0x00, 0x00, 0x00      // movq $0x0, (%rsi)
+  , 0x31, 0xc0                                    // done: xor %eax, %eax
+  , 0xc3                                          // retq
+  , 0xb8, 0x60, 0x00, 0x00, 0x00                  // mov SYS_gettimeofday, %eax
+  , 0x0f, 0x05                                    // syscall
+  , 0xc3                                          // retq
+  , 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc };
+
+static const unsigned char __logical_time[] = {
+    0x49, 0x81, 0xe3, 0x00, 0xf0, 0xff, 0xff      // and $-4096, %r11
+  , 0x49, 0xff, 0x4b, 0x10                        // decq 0x10(%r11)
+  , 0x7e, 0x20                                    // jle to the syscall
+  , 0x49, 0x8b, 0x03                              // mov (%r11), %rax
+  , 0x49, 0x8b, 0x4b, 0x08                        // mov 0x8(%r11), %rcx
+  , 0x48, 0x01, 0xc1                              // add %rax, %rcx
+  , 0x49, 0x89, 0x0b                              // mov %rcx, (%r11)
+  , 0x31, 0xd2                                    // xor %edx, %edx
+  , 0xb9, 0x40, 0x42, 0x0f, 0x00                  // mov $1000000, %ecx
+  , 0x48, 0xf7, 0xf1                              // div %rcx
+  , 0x48, 0x85, 0xff                              // test %rdi, %rdi
+  , 0x74, 0x03                                    // je done
+  , 0x48, 0x89, 0x07                              // mov %rax, (%rdi)
+  , 0xc3                                          // done: retq
+  , 0xb8, 0xc9, 0x00, 0x00, 0x00                  // mov SYS_time, %eax
+  , 0x0f, 0x05                                    // syscall
+  , 0xc3                                          // retq
+  , 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc };
+
+// jumps to the logical clock function at its imm64
+static const unsigned char __logical_trampoline[] = {
+    0x49, 0xbb, 0x00, 0x00, 0x00, 0x00            // movabs $target, %r11
+  , 0x00, 0x00, 0x00, 0x00
+  , 0x41, 0xff, 0xe3                              // jmpq *%r11
+  , 0xcc, 0xcc, 0xcc };
 // clang-format on
 
+std::map<std::string, std::basic_string<unsigned char>> vdsoGetLogicalClockData(
+    void) {
+  std::map<std::string, std::basic_string<unsigned char>> res;
+
+  res["__vdso_clock_gettime"] = std::basic_string<unsigned char>(
+      __logical_clock_gettime, sizeof(__logical_clock_gettime));
+  res["__vdso_gettimeofday"] = std::basic_string<unsigned char>(
+      __logical_gettimeofday, sizeof(__logical_gettimeofday));
+  res["__vdso_time"] =
+      std::basic_string<unsigned char>(__logical_time, sizeof(__logical_time));
+
+  for (auto& func : res) {
+    assert((func.second.size() & 0xf) == 0);
+  }
+  return res;
+}
+
+unsigned long logicalClockFunctionOffset(const std::string& name) {
+  unsigned long offset = logicalClockCodeOffset;
+  for (auto func : vdsoGetLogicalClockData()) {
+    if (func.first == name) {
+      return offset;
+    }
+    offset += func.second.size();
+  }
+  assert(false);
+  return 0;
+}
+
+void layOutLogicalClock(logicalClockPage* page) {
+  unsigned long offset = logicalClockCodeOffset;
+  for (auto func : vdsoGetLogicalClockData()) {
+    assert(offset + func.second.size() <= logicalClockPageSize);
+    memcpy((char*)page + offset, func.second.data(), func.second.size());
+    offset += func.second.size();
+  }
+}
+
+std::basic_string<unsigned char> vdsoLogicalClockTrampoline(
+    unsigned long target) {
+  std::basic_string<unsigned char> res(
+      __logical_trampoline, sizeof(__logical_trampoline));
+  memcpy(&res[2], &target, sizeof(target));
+
+  assert((res.size() & 0xf) == 0);
+  return res;
+}
+
 std::map<std::string, std::basic_string<unsigned char>> vdsoGetCandidateData(
     void) {
   std::map<std::string, std::basic_string<unsigned char>> res;
@@ -151,65 +283,92 @@ static int parseProcMapEntry(char* line, struct ProcMapEntry& res) {
 }
 
 std::vector<ProcMapEntry> parseProcMapEntries(pid_t pid) {
-  int fd;
   char mapsFile[32];
-  char* buffer;
-  const int buffer_size = 2 << 20;
-
   std::vector<ProcMapEntry> res;
 
   snprintf(mapsFile, 32, "/proc/%u/maps", pid);
 
-  fd = open(mapsFile, O_RDONLY);
+  int fd = open(mapsFile, O_RDONLY);
   if (fd < 0) {
     return {};
   }
 
-  buffer = new char[buffer_size];
-  if (!buffer) {
-    close(fd);
-    return res;
-  }
-
-  unsigned long nr = 0;
+  // Tens of thousands of mappings make for megabytes, grow as we go.
+  std::string text;
+  const size_t chunk = 64 * 1024;
   while (1) {
-    auto nb = read(fd, buffer + nr, buffer_size - nr);
+    size_t nr = text.size();
+    text.resize(nr + chunk);
+    auto nb = read(fd, &text[nr], chunk);
     if (nb < 0) {
-      if (errno == EINTR) continue;
-      delete[] buffer;
+      if (errno == EINTR) {
+        text.resize(nr);
+        continue;
+      }
       close(fd);
       return res;
-    } else if (nb == 0) {
+    }
+    text.resize(nr + nb);
+    if (nb == 0) {
       break;
-    } else {
-      nr += nb;
     }
   }
   close(fd);
-  buffer[nr] = '\0';
 
-  char *line, *text = buffer;
+  char *line, *rest = &text[0];
   struct ProcMapEntry mapEntry;
-  while ((line = strsep(&text, "\n")) != NULL) {
+  while ((line = strsep(&rest, "\n")) != NULL) {
     if (parseProcMapEntry(line, mapEntry) == 0) {
       res.push_back(mapEntry);
     }
   }
-
-  delete[] buffer;
   return res;
 }
 
-static int vdsoGetMapEntry(pid_t pid, struct ProcMapEntry& entry) {
-  auto entries = parseProcMapEntries(pid);
+unsigned long vdsoGetBase(pid_t pid) {
+  char auxvFile[32];
+  snprintf(auxvFile, 32, "/proc/%u/auxv", pid);
+
+  int fd = open(auxvFile, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  // A few dozen entries, one read gets them all.
+  Elf64_auxv_t auxv[64];
+  ssize_t nb;
+  do {
+    nb = read(fd, auxv, sizeof(auxv));
+  } while (nb < 0 && errno == EINTR);
+  close(fd);
+
+  for (ssize_t i = 0; nb > 0 && i < nb / (ssize_t)sizeof(auxv[0]); i++) {
+    if (auxv[i].a_type == AT_NULL) {
+      break;
+    }
+    if (auxv[i].a_type == AT_SYSINFO_EHDR) {
+      return auxv[i].a_un.a_val;
+    }
+  }
+  return 0;
+}
+
+vvarLayout vdsoGetVvarLayout(pid_t pid) {
+  struct ProcMapEntry vdsoMap{}, vvarMap{};
 
-  for (auto ent : entries) {
+  for (auto ent : parseProcMapEntries(pid)) {
     if (ent.procMapName == "[vdso]") {
-      entry = ent;
-      return 0;
+      vdsoMap = ent;
+    } else if (ent.procMapName == "[vvar]") {
+      vvarMap = ent;
     }
   }
-  return -1;
+
+  vvarLayout layout = {0, 0};
+  if (vdsoMap.procMapBase != 0 && vvarMap.procMapBase != 0) {
+    layout.offset = (long)(vvarMap.procMapBase - vdsoMap.procMapBase);
+    layout.size = vvarMap.procMapSize;
+  }
+  return layout;
 }
 
 std::vector<std::string> vdsoGetFuncNames(void) {
@@ -232,13 +391,11 @@ std::map<std::string, std::tuple<unsigned long, unsigned long, unsigned long>>
 vdsoGetSymbols(pid_t pid) {
   std::map<std::string, std::tuple<unsigned long, unsigned long, unsigned long>>
       res;
-  struct ProcMapEntry vdsoMapEntry;
-
-  if (vdsoGetMapEntry(pid, vdsoMapEntry) != 0) {
+  unsigned long base = vdsoGetBase(pid);
+  if (base == 0) {
     return res;
   }
 
-  unsigned long base = vdsoMapEntry.procMapBase;
   Elf64_Ehdr* ehdr = (Elf64_Ehdr*)base;
   Elf64_Shdr *shbase = (Elf64_Shdr*)(base + ehdr->e_shoff), *dynsym = NULL;
   const char* strtab = NULL;
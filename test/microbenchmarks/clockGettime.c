@@ -0,0 +1,13 @@
+// clock_gettime, from the vdso natively, a trapped system call under dettrace.
+#include <time.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  struct timespec ts;
+  for (long i = 0; i < iterations; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+  }
+  return 0;
+}
@@ -0,0 +1,23 @@
+// fork a child that exits at once and wait for it.
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  for (long i = 0; i < iterations; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      benchFail("fork");
+    }
+    if (pid == 0) {
+      _exit(0);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid) {
+      benchFail("waitpid");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+// Four threads taking turns on one mutex, <iterations> lock and unlock pairs
+// between them. Contended locks wait and wake in futex.
+#include <pthread.h>
+
+#include "microbench.h"
+
+#define THREADS 4
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static long counter = 0;
+
+static void* contend(void* arg) {
+  long iterations = *(long*)arg;
+  for (long i = 0; i < iterations; i++) {
+    pthread_mutex_lock(&lock);
+    counter++;
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  long perThread = benchIterations(argc, argv) / THREADS;
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    if (pthread_create(&threads[i], NULL, contend, &perThread) != 0) {
+      fprintf(stderr, "pthread_create failed\n");
+      return 1;
+    }
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  return counter == perThread * THREADS ? 0 : 1;
+}
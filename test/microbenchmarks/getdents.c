@@ -0,0 +1,43 @@
+// A full listing of a 10000 entry directory with getdents64 per iteration,
+// our hook sorts every listing. The directory is made on the first run and
+// kept, make clean removes it.
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+static const char* dir = "getdents.dir";
+static const int entries = 10000;
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  if (mkdir(dir, 0755) == 0) {
+    char path[64];
+    for (int i = 0; i < entries; i++) {
+      snprintf(path, sizeof(path), "%s/%05d", dir, i);
+      int fd = open(path, O_WRONLY | O_CREAT, 0644);
+      if (fd < 0) {
+        benchFail("open");
+      }
+      close(fd);
+    }
+  }
+
+  char buf[32 * 1024];
+  for (long i = 0; i < iterations; i++) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+      benchFail("open");
+    }
+    long got;
+    while ((got = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+    }
+    if (got < 0) {
+      benchFail("getdents64");
+    }
+    close(fd);
+  }
+  return 0;
+}
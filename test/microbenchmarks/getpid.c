@@ -0,0 +1,13 @@
+// getpid, a system call our seccomp filter allows in kernel.
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  for (long i = 0; i < iterations; i++) {
+    syscall(SYS_getpid);
+  }
+  return 0;
+}
@@ -0,0 +1,25 @@
+// Shared by the microbenchmarks: each one runs the operation it is named
+// after <iterations> times and exits. Time is taken outside, by
+// run_microbenchmarks.sh, as dettrace determinizes the clocks a tracee sees.
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Iterations asked for on the command line, exits on a bad command line. */
+static inline long benchIterations(int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <iterations>\n", argv[0]);
+    exit(1);
+  }
+  return strtol(argv[1], NULL, 10);
+}
+
+/** perror(what) and exit, for calls the benchmark can't go on without. */
+static inline void benchFail(const char* what) {
+  perror(what);
+  exit(1);
+}
+
+#endif
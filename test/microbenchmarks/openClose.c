@@ -0,0 +1,25 @@
+// open and close of an existing regular file, one pair per iteration.
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  const char* path = "openClose.data";
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    benchFail("open");
+  }
+  close(fd);
+
+  for (long i = 0; i < iterations; i++) {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      benchFail("open");
+    }
+    close(fd);
+  }
+  unlink(path);
+  return 0;
+}
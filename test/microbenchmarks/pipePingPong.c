@@ -0,0 +1,41 @@
+// A byte sent back and forth between two processes over a pair of pipes, one
+// round trip per iteration. Under dettrace both sides block in turn.
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  int ping[2], pong[2];
+  if (pipe(ping) != 0 || pipe(pong) != 0) {
+    benchFail("pipe");
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    benchFail("fork");
+  }
+  char byte = 0;
+  if (pid == 0) {
+    for (long i = 0; i < iterations; i++) {
+      if (read(ping[0], &byte, 1) != 1 || write(pong[1], &byte, 1) != 1) {
+        benchFail("child pipe");
+      }
+    }
+    _exit(0);
+  }
+
+  for (long i = 0; i < iterations; i++) {
+    if (write(ping[1], &byte, 1) != 1 || read(pong[0], &byte, 1) != 1) {
+      benchFail("parent pipe");
+    }
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "child failed\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,25 @@
+// posix_spawn /bin/true and wait for it, what make and python's subprocess
+// do for every command.
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+extern char** environ;
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  char* const args[] = {"true", NULL};
+  for (long i = 0; i < iterations; i++) {
+    pid_t pid;
+    if (posix_spawn(&pid, "/bin/true", NULL, NULL, args, environ) != 0) {
+      benchFail("posix_spawn");
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid) {
+      benchFail("waitpid");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,13 @@
+// rdtsc, which faults and is emulated by the tracer under dettrace.
+#include <stdint.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  uint32_t lo, hi;
+  for (long i = 0; i < iterations; i++) {
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  }
+  return 0;
+}
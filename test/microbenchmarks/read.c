@@ -0,0 +1,36 @@
+// read of a regular file in 512 byte chunks, going back to the start at EOF.
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  const char* path = "read.data";
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    benchFail("open");
+  }
+  char buf[512];
+  memset(buf, 'x', sizeof(buf));
+  for (int i = 0; i < 64; i++) {
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      benchFail("write");
+    }
+  }
+  lseek(fd, 0, SEEK_SET);
+
+  for (long i = 0; i < iterations; i++) {
+    ssize_t got = read(fd, buf, sizeof(buf));
+    if (got < 0) {
+      benchFail("read");
+    }
+    if (got == 0) {
+      lseek(fd, 0, SEEK_SET);
+    }
+  }
+  close(fd);
+  unlink(path);
+  return 0;
+}
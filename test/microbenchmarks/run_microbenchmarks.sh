@@ -0,0 +1,70 @@
+#!/bin/bash -e
+
+## Operations per second of each microbenchmark, natively and under dettrace.
+## Time is taken outside the tracee, as dettrace determinizes clocks. A run
+## with no iterations is subtracted, so set up, dettrace start up and tear down
+## don't count. Usage:
+##   ./run_microbenchmarks.sh [path/to/dettrace] [scale] [benchmark...]
+## scale, a whole number, multiplies every iteration count, benchmarks default to all of them.
+## DETTRACE_FLAGS are passed to dettrace, e.g. DETTRACE_FLAGS="--pin 2,3".
+
+cd "$(dirname "$0")"
+DETTRACE=$(realpath ${1:-../../bin/dettrace})
+SCALE=${2:-1}
+shift 2 || shift $#
+
+# Benchmark and its iteration count, enough for a second or so under dettrace.
+BENCHMARKS="
+getpid 2000000
+read 50000
+pipePingPong 5000
+stat 50000
+openClose 20000
+getdents 100
+clockGettime 50000
+rdtsc 50000
+forkExit 500
+posixSpawn 200
+threadCreateJoin 1000
+futexContention 200000
+urandom 50000
+"
+
+# Wall clock time of a command in nanoseconds.
+timeNs() {
+    local start=$(date +%s%N)
+    "$@" > /dev/null
+    local end=$(date +%s%N)
+    echo $((end - start))
+}
+
+# Operations per second of n operations taking ns nanoseconds.
+opsPerSec() {
+    awk -v n=$1 -v ns=$2 'BEGIN {
+        if (ns <= 0) { print "-"; exit }
+        printf "%.0f", n * 1e9 / ns }'
+}
+
+selected=" $* "
+printf "%-18s %14s %14s %10s\n" benchmark "native ops/s" "dettrace ops/s" \
+       slowdown
+echo "$BENCHMARKS" | while read name iterations; do
+    if [ -z "$name" ] || { [ $# -gt 0 ] && [[ "$selected" != *" $name "* ]]; }
+    then
+        continue
+    fi
+    n=$((iterations * SCALE))
+    binary=./$name.bin
+
+    # One run first, outside dettrace, for set up that is kept between runs:
+    # getdents makes its directory.
+    $binary 0 > /dev/null
+    native=$(($(timeNs $binary $n) - $(timeNs $binary 0)))
+    traced=$(($(timeNs $DETTRACE $DETTRACE_FLAGS $binary $n) -
+              $(timeNs $DETTRACE $DETTRACE_FLAGS $binary 0)))
+
+    slowdown=$(awk -v a=$traced -v b=$native \
+                   'BEGIN { if (b > 0) printf "%.1fx", a / b; else print "-" }')
+    printf "%-18s %14s %14s %10s\n" $name $(opsPerSec $n $native) \
+           $(opsPerSec $n $traced) $slowdown
+done
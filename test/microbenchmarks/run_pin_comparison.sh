@@ -0,0 +1,24 @@
+#!/bin/bash -e
+
+## Compare the benchmarks that stop the most unpinned, with the tracer and
+## tracee on one cpu, on a pair of cpus, and on the pair with --spin-wait.
+## Pick a pair of hyperthreads of one core for the pair, see
+## /sys/devices/system/cpu/cpu*/topology/thread_siblings_list. Usage:
+##   ./run_pin_comparison.sh [path/to/dettrace] [cpu] [sibling] [spin us]
+
+cd "$(dirname "$0")"
+DETTRACE=$(realpath ${1:-../../bin/dettrace})
+CPU=${2:-0}
+SIBLING=${3:-$(tr ',-' '\n\n' \
+    < /sys/devices/system/cpu/cpu$CPU/topology/thread_siblings_list |
+    grep -vx "$CPU" | head -n 1)}
+SIBLING=${SIBLING:-$CPU}
+SPIN=${4:-20}
+STOP_HEAVY="getpid stat openClose pipePingPong forkExit"
+
+make -s build
+for flags in "" "--pin $CPU" "--pin $CPU,$SIBLING" \
+             "--pin $CPU,$SIBLING --spin-wait $SPIN"; do
+    echo "== ${flags:-unpinned}"
+    DETTRACE_FLAGS="$flags" ./run_microbenchmarks.sh $DETTRACE 1 $STOP_HEAVY
+done
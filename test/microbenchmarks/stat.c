@@ -0,0 +1,25 @@
+// stat of a regular file, our hook rewrites the inode and the times.
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  const char* path = "stat.data";
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    benchFail("open");
+  }
+  close(fd);
+
+  struct stat buf;
+  for (long i = 0; i < iterations; i++) {
+    if (stat(path, &buf) != 0) {
+      benchFail("stat");
+    }
+  }
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,21 @@
+// Create a thread that returns at once and join it.
+#include <pthread.h>
+
+#include "microbench.h"
+
+static void* nothing(void* arg) {
+  return arg;
+}
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  for (long i = 0; i < iterations; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, nothing, NULL) != 0 ||
+        pthread_join(thread, NULL) != 0) {
+      fprintf(stderr, "pthread_create or pthread_join failed\n");
+      return 1;
+    }
+  }
+  return 0;
+}
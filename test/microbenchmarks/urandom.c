@@ -0,0 +1,21 @@
+// 64 byte reads of /dev/urandom, which dettrace replaces with its own PRNG.
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+int main(int argc, char* argv[]) {
+  long iterations = benchIterations(argc, argv);
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0) {
+    benchFail("open");
+  }
+  char buf[64];
+  for (long i = 0; i < iterations; i++) {
+    if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      benchFail("read");
+    }
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,62 @@
+// Block in poll with no timeout and in select without one on a pipe nothing
+// was written to yet. The child only writes once it reads the go ahead we send
+// right before waiting, so the parent is waiting before the writer runs.
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int doWithCheck(int returnValue, const char* what) {
+  if (returnValue == -1) {
+    perror(what);
+    exit(1);
+  }
+  return returnValue;
+}
+
+// Child: wait for the go ahead on goFd, then write to dataFd.
+static void writer(int goFd, int dataFd) {
+  char c;
+  doWithCheck(read(goFd, &c, 1), "read");
+  doWithCheck(write(dataFd, "hi", 2), "write");
+  // Our copy of the parent's unflushed output stays unwritten.
+  _exit(0);
+}
+
+static pid_t spawnWriter(int go[2], int data[2]) {
+  doWithCheck(pipe(go), "pipe");
+  doWithCheck(pipe(data), "pipe");
+  pid_t pid = doWithCheck(fork(), "fork");
+  if (pid == 0) {
+    writer(go[0], data[1]);
+  }
+  return pid;
+}
+
+static void readAndReap(const char* how, int dataFd, pid_t pid) {
+  char buffer[3] = {0};
+  doWithCheck(read(dataFd, buffer, 2), "read");
+  printf("%s: %s\n", how, buffer);
+  doWithCheck(waitpid(pid, NULL, 0), "waitpid");
+}
+
+int main() {
+  int go[2], data[2];
+
+  pid_t pid = spawnWriter(go, data);
+  doWithCheck(write(go[1], "g", 1), "write");
+  struct pollfd pfd = {.fd = data[0], .events = POLLIN};
+  doWithCheck(poll(&pfd, 1, -1), "poll");
+  readAndReap("poll", data[0], pid);
+
+  pid = spawnWriter(go, data);
+  doWithCheck(write(go[1], "g", 1), "write");
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(data[0], &readable);
+  doWithCheck(select(data[0] + 1, &readable, NULL, NULL, NULL), "select");
+  readAndReap("select", data[0], pid);
+  return 0;
+}
@@ -0,0 +1,49 @@
+// Read a directory, then go back to where telldir said we were with seekdir
+// and rewinddir: the same entries must come back, in the same order.
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES 4096
+
+static char* names[MAX_ENTRIES];
+static long positions[MAX_ENTRIES];
+
+int main() {
+  DIR* dir = opendir(".");
+  if (dir == NULL) {
+    perror("opendir");
+    return 1;
+  }
+
+  int count = 0;
+  struct dirent* entry;
+  while (count < MAX_ENTRIES) {
+    positions[count] = telldir(dir);
+    if ((entry = readdir(dir)) == NULL) {
+      break;
+    }
+    names[count++] = strdup(entry->d_name);
+  }
+
+  rewinddir(dir);
+  int same = 1;
+  for (int i = 0; i < count; i++) {
+    entry = readdir(dir);
+    same = same && entry != NULL && strcmp(entry->d_name, names[i]) == 0;
+  }
+  printf("rewinddir: %s\n", same ? "same entries" : "DIFFERENT entries");
+
+  same = 1;
+  for (int i = count - 1; i >= 0; i -= 3) {
+    seekdir(dir, positions[i]);
+    entry = readdir(dir);
+    same = same && entry != NULL && strcmp(entry->d_name, names[i]) == 0;
+  }
+  printf("seekdir: %s\n", same ? "same entries" : "DIFFERENT entries");
+
+  closedir(dir);
+  return 0;
+}
@@ -0,0 +1,37 @@
+#include "../catch.hpp"
+#include "../../../include/addressSpace.hpp"
+
+/**
+ * Tests for the class addressSpace
+ */
+
+TEST_CASE("addressSpace finds the mapping holding an address", "addressSpace"){
+  addressSpace maps({{0x1000, 0x2000, ProcMapPermRead, 0, 0, 0, "/bin/ls"},
+                     {0x5000, 0x1000, ProcMapPermRead, 0, 0, 0, "[vdso]"}});
+  REQUIRE(maps.size() == 2);
+  REQUIRE(maps.find(0xfff) == nullptr);
+  REQUIRE(maps.find(0x1000)->name == "/bin/ls");
+  REQUIRE(maps.find(0x2fff)->name == "/bin/ls");
+  REQUIRE(maps.find(0x3000) == nullptr);
+  REQUIRE(maps.find(0x5800)->name == "[vdso]");
+  REQUIRE(maps.find(0x6000) == nullptr);
+}
+
+TEST_CASE("addressSpace splits what is partly unmapped", "addressSpace"){
+  addressSpace maps;
+  maps.map(vma{0x1000, 0x5000, ProcMapPermRead, 0x10000, "lib.so"});
+  maps.unmap(0x2000, 0x3000);
+  REQUIRE(maps.size() == 2);
+  REQUIRE(maps.find(0x2800) == nullptr);
+  REQUIRE(maps.find(0x1fff)->end == 0x2000);
+  const vma* above = maps.find(0x3000);
+  REQUIRE(above->start == 0x3000);
+  REQUIRE(above->offset == 0x12000);
+
+  // Over the hole and both halves.
+  maps.map(vma{0x1800, 0x4000, ProcMapPermExec, 0, "[dettrace-patch]"});
+  REQUIRE(maps.size() == 3);
+  REQUIRE(maps.find(0x17ff)->name == "lib.so");
+  REQUIRE(maps.find(0x2800)->name == "[dettrace-patch]");
+  REQUIRE(maps.find(0x4000)->offset == 0x13000);
+}
@@ -0,0 +1,233 @@
+#include "../catch.hpp"
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "../../../include/ValueMapper.hpp"
+#include "../../../include/directoryEntries.hpp"
+#include "../../../include/logger.hpp"
+#include "../../../include/ptracer.hpp"
+#include "../../../include/scheduler.hpp"
+#include "../../../include/vdso.hpp"
+
+/**
+ * Timings of the tracer's core data structures, to go with changes to them.
+ * All hidden, run with: make bench, or ./otherClassesTests "[.benchmark]"
+ * in a release build.
+ */
+
+template <typename F>
+static double nanosPer(size_t operations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+      operations;
+}
+
+TEST_CASE("scheduler with 10k processes", "[.benchmark]"){
+  const pid_t processes = 10000;
+  logger log("", 0);
+  scheduler sched(1, log);
+  double addNs = nanosPer(processes - 1, [&]() {
+    for (pid_t pid = 2; pid <= processes; pid++) {
+      sched.addAndScheduleNext(pid);
+    }
+  });
+
+  // Every process gets a turn, then is preempted, ten times over.
+  pid_t checksum = 0;
+  double nextNs = nanosPer(10 * processes, [&]() {
+    for (int i = 0; i < 10 * processes; i++) {
+      checksum += sched.getNext();
+      sched.preemptAndScheduleNext();
+    }
+  });
+
+  double removeNs = nanosPer(processes - 1, [&]() {
+    for (pid_t pid = processes; pid > 1; pid--) {
+      sched.removeAndScheduleNext(pid);
+    }
+  });
+
+  printf(
+      "scheduler, %d processes: add %.1f ns, getNext+preempt %.1f ns, "
+      "remove %.1f ns\n",
+      processes, addNs, nextNs, removeNs);
+  REQUIRE(checksum != 0);
+  REQUIRE(sched.getNext() == 1);
+}
+
+TEST_CASE("ValueMapper with 1M values", "[.benchmark]"){
+  const size_t values = 1000000;
+  logger log("", 0);
+  ValueMapper<ino_t, ino_t> mapper(log, "benchmark map", 1, true);
+  std::vector<ino_t> inodes(values);
+  std::mt19937_64 generator(1);
+  for (ino_t& inode : inodes) {
+    inode = generator();
+  }
+
+  double insertNs = nanosPer(values, [&]() {
+    for (ino_t inode : inodes) {
+      mapper.lookupOrAdd(inode);
+    }
+  });
+  std::shuffle(inodes.begin(), inodes.end(), generator);
+  ino_t sum = 0;
+  double lookupNs = nanosPer(values, [&]() {
+    for (ino_t inode : inodes) {
+      sum += mapper.getVirtualValue(inode);
+    }
+  });
+
+  // Known values one by one, then as virtualizeEntries does for a directory.
+  ino_t oneSum = 0;
+  double oneNs = nanosPer(values, [&]() {
+    for (ino_t inode : inodes) {
+      oneSum += mapper.lookupOrAdd(inode);
+    }
+  });
+  std::vector<ino_t> virtuals(values);
+  double batchNs = nanosPer(
+      values, [&]() { mapper.lookupOrAddAll(inodes, virtuals); });
+
+  printf(
+      "ValueMapper, %zu values: insert %.1f ns, lookup %.1f ns, lookupOrAdd "
+      "%.1f ns, batched %.1f ns\n",
+      values, insertNs, lookupNs, oneNs, batchNs);
+  // Virtual values are 1 to values, each looked up once.
+  REQUIRE(sum == values * (values + 1) / 2);
+  REQUIRE(oneSum == sum);
+  REQUIRE(virtuals.size() == values);
+}
+
+TEST_CASE("directoryEntries sorting 100k entries", "[.benchmark]"){
+  const size_t entries = 100000;
+  logger log("", 0);
+  directoryEntries<linux_dirent> directory(entries * 32, log);
+  std::mt19937 generator(1);
+  for (size_t i = 0; i < entries; i++) {
+    std::string name = "file" + std::to_string(generator()) + ".o";
+    // Header, name, its terminator and d_type, 8 byte aligned as the kernel
+    // does.
+    size_t size = (offsetof(linux_dirent, d_name) + name.size() + 2 + 7) & ~7;
+    linux_dirent* entry = (linux_dirent*)directory.addChunk(size);
+    memset(entry, 0, size);
+    entry->d_ino = i + 1;
+    entry->d_reclen = size;
+    memcpy(entry->d_name, name.c_str(), name.size());
+  }
+
+  std::vector<uint8_t> sorted;
+  double sortNs =
+      nanosPer(entries, [&]() { sorted = directory.allSortedEntries(); });
+
+  printf(
+      "directoryEntries, %zu entries: sort %.1f ns/entry\n", entries, sortNs);
+  REQUIRE(directory.bytesHeld() >= sorted.size());
+}
+
+TEST_CASE("logger at each debug level", "[.benchmark]"){
+  const int lines = 200000;
+  char dir[] = "/tmp/loggerBenchXXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  std::string file = std::string(dir) + "/log";
+
+  for (int level : {0, 1, 3, 5}) {
+    double lineNs;
+    {
+      logger log(file, level);
+      lineNs = nanosPer(lines, [&]() {
+        for (int i = 0; i < lines; i++) {
+          DETTRACE_LOG(log, Importance::info, "pid %d: line %d\n", 42, i);
+        }
+        log.flush();
+      });
+    }
+    printf("logger, debug level %d: %.1f ns/line\n", level, lineNs);
+    unlink((file + ".00").c_str());
+  }
+
+  // The same at --debug 5 with --log-file *.gz.
+  double gzipNs;
+  {
+    logger log(file + ".gz", 5);
+    gzipNs = nanosPer(lines, [&]() {
+      for (int i = 0; i < lines; i++) {
+        DETTRACE_LOG(log, Importance::info, "pid %d: line %d\n", 42, i);
+      }
+      log.flush();
+    });
+  }
+  struct stat statbuf;
+  REQUIRE(stat((file + ".00.gz").c_str(), &statbuf) == 0);
+  printf(
+      "logger, debug level 5, compressed: %.1f ns/line, %lld bytes\n", gzipNs,
+      (long long)statbuf.st_size);
+  unlink((file + ".00.gz").c_str());
+  rmdir(dir);
+}
+
+TEST_CASE("parseProcMapEntries on a large maps file", "[.benchmark]"){
+  // Alternate protections, so the kernel can't merge neighbouring mappings.
+  const size_t mappings = 20000;
+  size_t page = sysconf(_SC_PAGESIZE);
+  uint8_t* region = (uint8_t*)mmap(
+      nullptr, mappings * page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  REQUIRE(region != MAP_FAILED);
+  for (size_t i = 0; i < mappings; i += 2) {
+    mprotect(region + i * page, page, PROT_READ | PROT_WRITE);
+  }
+
+  const int parses = 20;
+  size_t found = 0;
+  double parseNs = nanosPer(parses, [&]() {
+    for (int i = 0; i < parses; i++) {
+      found = parseProcMapEntries(getpid()).size();
+    }
+  });
+
+  printf(
+      "parseProcMapEntries, %zu mappings: %.2f ms/parse\n", found,
+      parseNs / 1000000);
+  munmap(region, mappings * page);
+  REQUIRE(found >= mappings);
+}
+
+static uint64_t traceeWord = 42;
+
+TEST_CASE("readFromTracee<uint64_t> through process_vm_readv", "[.benchmark]"){
+  pid_t child = fork();
+  REQUIRE(child != -1);
+  if (child == 0) {
+    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    raise(SIGSTOP);
+    _exit(0);
+  }
+  // Waits for the child to stop.
+  ptracer t(child);
+
+  // Every read misses the read cache, as the first read of a stop does.
+  const int reads = 1000000;
+  uint64_t sum = 0;
+  double readNs = nanosPer(reads, [&]() {
+    for (int i = 0; i < reads; i++) {
+      t.clearReadCache();
+      sum += t.readFromTracee(traceePtr<uint64_t>(&traceeWord), child);
+    }
+  });
+
+  printf("readFromTracee<uint64_t>: %.1f ns/read\n", readNs);
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+  REQUIRE(sum == 42ULL * reads);
+}
@@ -0,0 +1,38 @@
+#include "../catch.hpp"
+#include <unistd.h>
+#include <string>
+#include "../../../include/executableHashes.hpp"
+
+/**
+ * Tests for the class executableHashes, on this test's own process.
+ */
+
+TEST_CASE("executableHashes memoizes and saves", "executableHashes"){
+  taskPool tasks(1);
+  std::string saved =
+      "/tmp/dettrace-executables-test-" + std::to_string(getpid());
+  std::string expected = fileHasher::hashFile("/proc/self/exe", nullptr);
+  REQUIRE(!expected.empty());
+  {
+    executableHashes hashes(tasks);
+    hashes.execed(getpid());
+    hashes.spawned(getpid(), 1);
+    REQUIRE(hashes.hashOf(getpid()) == expected);
+    REQUIRE(hashes.hashOf(1) == expected);
+    REQUIRE(hashes.executablesHashed == 1);
+
+    hashes.execed(getpid());
+    REQUIRE(hashes.memoHits == 1);
+    hashes.exited(1);
+    REQUIRE(hashes.hashOf(1) == "");
+    hashes.save(saved);
+  }
+
+  executableHashes loaded(tasks);
+  REQUIRE(loaded.load(saved));
+  loaded.execed(getpid());
+  REQUIRE(loaded.hashOf(getpid()) == expected);
+  REQUIRE(loaded.executablesHashed == 0);
+  REQUIRE(loaded.memoHits == 1);
+  unlink(saved.c_str());
+}
@@ -0,0 +1,50 @@
+#include "../catch.hpp"
+#include <string.h>
+#include <sys/stat.h>
+#include "../../../include/fakeOwnership.hpp"
+
+/**
+ * Tests for the class fakeOwnership.
+ */
+
+static struct stat realFile(ino_t inode, mode_t mode) {
+  struct stat statbuf;
+  memset(&statbuf, 0, sizeof(statbuf));
+  statbuf.st_dev = 8;
+  statbuf.st_ino = inode;
+  statbuf.st_mode = mode;
+  statbuf.st_uid = 1000;
+  statbuf.st_gid = 1000;
+  return statbuf;
+}
+
+TEST_CASE("fakeOwnership reports chowns and chmods", "fakeOwnership"){
+  fakeOwnership owners;
+  struct stat file = realFile(10, S_IFREG | 04755);
+  owners.chown(file, 0, -1);
+
+  uid_t uid = 1000;
+  gid_t gid = 1000;
+  mode_t mode = file.st_mode;
+  owners.apply(8, 10, uid, gid, mode);
+  REQUIRE(uid == 0);
+  REQUIRE(gid == 1000);
+  // chown drops setuid, the file type stays.
+  REQUIRE(mode == (S_IFREG | 0755));
+
+  owners.chmod(file, 0);
+  mode = file.st_mode;
+  owners.apply(8, 10, uid, gid, mode);
+  REQUIRE(mode == S_IFREG);
+  REQUIRE(uid == 0);
+
+  // Not ours: left alone.
+  uid = 1000;
+  mode = S_IFDIR | 0700;
+  owners.apply(8, 11, uid, gid, mode);
+  REQUIRE(uid == 1000);
+  REQUIRE(mode == (S_IFDIR | 0700));
+
+  owners.forget(8, 10);
+  REQUIRE(owners.size() == 0);
+}
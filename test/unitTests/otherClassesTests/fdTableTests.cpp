@@ -0,0 +1,96 @@
+#include "../catch.hpp"
+#include <fcntl.h>
+#include "../../../include/fdTable.hpp"
+
+/**
+ * Tests for the class fdTable
+ */
+
+TEST_CASE("fdTable dup copies a slot and close resets it", "fdTable"){
+  fdTable fds;
+  REQUIRE(!fds[7].known());
+  REQUIRE(!fds[-1].known());
+
+  fds.setType(3, fdType::socket);
+  fds.setBlocking(3, descriptorType::nonBlocking);
+  fds.setRemote(3, true);
+  fds.dup(3, 10);
+  REQUIRE(fds[10].type == fdType::socket);
+  REQUIRE(fds[10].tracksBlocking);
+  REQUIRE(fds[10].blocking == descriptorType::nonBlocking);
+  REQUIRE(fds[10].remote);
+
+  fds.close(3);
+  REQUIRE(!fds[3].known());
+  REQUIRE(fds.anyRemote());
+  // dup2 over a remote socket.
+  fds.dup(4, 10);
+  REQUIRE(!fds[10].known());
+  REQUIRE(!fds.anyRemote());
+}
+
+TEST_CASE("fdTable timerfds outlive execve and their closed dups", "fdTable"){
+  fdTable fds;
+  timerfdInfo timer;
+  timer.timer = 2;
+  fds.setTimerfd(5, timer);
+  fds.setType(5, fdType::timerfd);
+  fds.setBlocking(6, descriptorType::blocking);
+  fds.dup(5, 8);
+
+  fds.execed();
+  REQUIRE(fds[5].type == fdType::unknown);
+  REQUIRE(!fds[6].known());
+  REQUIRE(fds[8].timerfd);
+
+  fds.close(5);
+  REQUIRE(fds.timerHeld(2));
+  fds.close(8);
+  REQUIRE(!fds.timerHeld(2));
+}
+
+TEST_CASE("fdTable eventfds close our duplicate with their last fd", "fdTable"){
+  fdTable fds;
+  int ourFd = dup(0);
+  REQUIRE(ourFd != -1);
+  fds.setEventfd(4, make_shared<eventfdInfo>(ourFd, 1));
+  fds.dup(4, 9);
+  REQUIRE(fds[9].type == fdType::eventfd);
+  REQUIRE(fds[9].eventfd->id == 1);
+
+  fds.close(4);
+  REQUIRE(fcntl(ourFd, F_GETFD) != -1);
+  fds.execed();
+  REQUIRE(!fds[9].known());
+  REQUIRE(fcntl(ourFd, F_GETFD) == -1);
+}
+
+TEST_CASE("fdTable inodes follow dups until execve", "fdTable"){
+  fdTable fds;
+  fds.setFile(3, 20, 1234);
+  REQUIRE(fds[3].known());
+  fds.dup(3, 7);
+  REQUIRE(fds[7].device == 20);
+  REQUIRE(fds[7].inode == 1234);
+
+  fds.close(3);
+  REQUIRE(fds[3].inode == 0);
+  fds.execed();
+  REQUIRE(!fds[7].known());
+}
+
+TEST_CASE("fdTable regularFds has /dev/null and /dev/zero", "fdTable"){
+  fdTable fds;
+  fds.setType(1, fdType::devNull);
+  fds.setAccessMode(1, O_WRONLY);
+  fds.setType(3, fdType::regular);
+  fds.setType(4, fdType::pipe);
+  fds.setType(70, fdType::devZero);
+  fds.dup(1, 2);
+  REQUIRE(fds[2].accessMode == O_WRONLY);
+
+  uint64_t bits[2];
+  fds.regularFds(bits, 2);
+  REQUIRE(bits[0] == 0b1110);
+  REQUIRE(bits[1] == (uint64_t)1 << 6);
+}
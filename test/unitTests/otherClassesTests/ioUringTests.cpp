@@ -0,0 +1,101 @@
+#include "../catch.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../../../include/ioUring.hpp"
+
+/**
+ * Tests for the class ioUring, on a ring of our own playing the tracee.
+ */
+
+TEST_CASE("ioUring drains, refuses and orders SQEs", "ioUring"){
+  if (!ioUring::supported()) {
+    WARN("io_uring restrictions not supported here, skipping");
+    return;
+  }
+  io_uring_params params = {};
+  params.flags = ioUring::setupFlagsFor(IORING_SETUP_SINGLE_ISSUER);
+  REQUIRE((params.flags & IORING_SETUP_R_DISABLED) != 0);
+  REQUIRE((params.flags & IORING_SETUP_SINGLE_ISSUER) == 0);
+  int fd = syscall(SYS_io_uring_setup, 8, &params);
+  REQUIRE(fd >= 0);
+  auto ring = ioUring::attach(dup(fd), params);
+  REQUIRE(ring != nullptr);
+
+  size_t size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  size = std::max(
+      size, (size_t)params.sq_off.array + params.sq_entries * sizeof(uint32_t));
+  char* rings = (char*)mmap(
+      nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+      IORING_OFF_SQ_RING);
+  auto sqes = (io_uring_sqe*)mmap(
+      nullptr, params.sq_entries * sizeof(io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+  REQUIRE(rings != MAP_FAILED);
+  REQUIRE(sqes != MAP_FAILED);
+
+  int file = open("/proc/self/exe", O_RDONLY);
+  int pipeFds[2];
+  REQUIRE(pipe(pipeFds) == 0);
+  char fileBuffer[4];
+  char pipeBuffer[4];
+  memset(sqes, 0, 3 * sizeof(io_uring_sqe));
+  sqes[0].opcode = IORING_OP_READ;
+  sqes[0].fd = file;
+  sqes[0].addr = (uint64_t)fileBuffer;
+  sqes[0].len = sizeof(fileBuffer);
+  sqes[0].user_data = 100;
+  // A pipe, refused.
+  sqes[1].opcode = IORING_OP_READ;
+  sqes[1].fd = pipeFds[0];
+  sqes[1].addr = (uint64_t)pipeBuffer;
+  sqes[1].len = sizeof(pipeBuffer);
+  sqes[1].user_data = 200;
+  sqes[2].opcode = IORING_OP_NOP;
+  sqes[2].user_data = 300;
+  auto array = (uint32_t*)(rings + params.sq_off.array);
+  for (uint32_t i = 0; i < 3; i++) {
+    array[i] = i;
+  }
+  __atomic_store_n(
+      (uint32_t*)(rings + params.sq_off.tail), 3, __ATOMIC_RELEASE);
+
+  uint32_t refused = ring->prepareSubmission(
+      3, [file](int sqeFd) { return sqeFd == file; });
+  REQUIRE(refused == 1);
+  REQUIRE((sqes[2].flags & IOSQE_IO_DRAIN) != 0);
+  int submitted = syscall(SYS_io_uring_enter, fd, 3, 0, 0, nullptr, 0);
+  ring->finishSubmission();
+  // Stopped at the refused one, the NOP is left with its own user_data.
+  REQUIRE(submitted == 2);
+  REQUIRE(sqes[2].user_data == 300);
+  while (!ring->settled()) {
+    syscall(
+        SYS_io_uring_enter, fd, 0, ring->unsettled(), IORING_ENTER_GETEVENTS,
+        nullptr, 0);
+  }
+  ring->orderCompletions();
+
+  auto cqes = (io_uring_cqe*)(rings + params.cq_off.cqes);
+  REQUIRE(*(uint32_t*)(rings + params.cq_off.tail) == 2);
+  REQUIRE(cqes[0].user_data == 100);
+  REQUIRE(cqes[0].res == (int)sizeof(fileBuffer));
+  REQUIRE(memcmp(fileBuffer, "\x7f" "ELF", 4) == 0);
+  REQUIRE(cqes[1].user_data == 200);
+  REQUIRE(cqes[1].res == -EACCES);
+
+  // So is registering files.
+  int files[1] = {file};
+  REQUIRE(
+      syscall(SYS_io_uring_register, fd, IORING_REGISTER_FILES, files, 1) ==
+      -1);
+  REQUIRE(errno == EACCES);
+
+  close(file);
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+  close(fd);
+}
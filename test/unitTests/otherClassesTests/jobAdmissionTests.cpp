@@ -0,0 +1,44 @@
+#include "../catch.hpp"
+#include "../../../include/jobAdmission.hpp"
+
+/**
+ * Tests for the class jobAdmission.
+ */
+
+TEST_CASE("jobAdmission cpu lists", "jobAdmission"){
+  REQUIRE(jobAdmission::parseCpuList("").empty());
+  REQUIRE(jobAdmission::parseCpuList("3") == std::vector<int>{3});
+  std::vector<int> cpus = {0, 1, 2, 8, 10, 11};
+  REQUIRE(jobAdmission::parseCpuList("0-2,8,10-11") == cpus);
+  REQUIRE(!jobAdmission::hostCores(0).empty());
+  REQUIRE(jobAdmission::hostCores(1).size() == 1);
+}
+
+TEST_CASE("jobAdmission spreads jobs over nodes", "jobAdmission"){
+  jobAdmission admission{{{0, 0}, {1, 0}, {2, 1}, {3, 1}}, 0, 0};
+  int first = admission.admit();
+  int second = admission.admit();
+  REQUIRE(first == 0);
+  // Node 1 has more free cores now.
+  REQUIRE(second == 2);
+  REQUIRE(admission.admit() == 1);
+  REQUIRE(admission.admit() == 3);
+  REQUIRE(admission.admit() == -1);
+  admission.release(2);
+  REQUIRE(admission.running() == 3);
+  REQUIRE(admission.admit() == 2);
+}
+
+TEST_CASE("jobAdmission memory budget", "jobAdmission"){
+  jobAdmission admission{{{0, 0}, {1, 0}, {2, 0}}, 100, 40};
+  REQUIRE(admission.admit() != -1);
+  REQUIRE(admission.admit() != -1);
+  REQUIRE(admission.admit() == -1);
+
+  // One job bigger than the budget still runs, alone.
+  jobAdmission small{{{0, 0}, {1, 0}}, 10, 40};
+  REQUIRE(small.admit() == 0);
+  REQUIRE(small.admit() == -1);
+  small.release(0);
+  REQUIRE(small.admit() == 0);
+}
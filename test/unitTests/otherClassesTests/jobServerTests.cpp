@@ -0,0 +1,48 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "../catch.hpp"
+#include "../../../include/jobServer.hpp"
+
+/**
+ * Tests for the job server's sockets.
+ */
+
+TEST_CASE("server sockets only replace sockets", "jobServer"){
+  char dir[] = "/tmp/jobServerXXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  std::string path = std::string(dir) + "/server";
+
+  int file = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+  REQUIRE(file != -1);
+  close(file);
+  REQUIRE_THROWS_AS(listenOnSocket(path), std::runtime_error);
+  struct stat st;
+  REQUIRE(stat(path.c_str(), &st) == 0);
+  REQUIRE(S_ISREG(st.st_mode));
+  unlink(path.c_str());
+
+  // A stale socket is replaced, and only we may connect to the new one.
+  mode_t oldMask = umask(0);
+  close(listenOnSocket(path));
+  int listener = listenOnSocket(path);
+  umask(oldMask);
+  REQUIRE(stat(path.c_str(), &st) == 0);
+  REQUIRE(S_ISSOCK(st.st_mode));
+  REQUIRE((st.st_mode & 0777) == 0600);
+
+  int client = connectToSocket(path);
+  REQUIRE(client != -1);
+  int accepted = acceptClient(listener);
+  REQUIRE(accepted != -1);
+  close(accepted);
+  close(client);
+  close(listener);
+  unlink(path.c_str());
+  rmdir(dir);
+}
@@ -0,0 +1,41 @@
+#include "../catch.hpp"
+#include <stdint.h>
+#include "../../../include/latencyHistogram.hpp"
+
+/**
+ * Tests for the class latencyHistogram
+ */
+
+TEST_CASE("latencyHistogram small values are exact", "latencyHistogram"){
+  latencyHistogram h;
+  for (uint64_t v = 1; v <= 4; v++) {
+    h.record(v);
+  }
+  REQUIRE(h.count() == 4);
+  REQUIRE(h.mean() == 2);
+  REQUIRE(h.percentile(0.5) == 2);
+  REQUIRE(h.percentile(1.0) == 4);
+  REQUIRE(h.max() == 4);
+}
+
+TEST_CASE("latencyHistogram percentiles are within an eighth", "latencyHistogram"){
+  latencyHistogram h;
+  for (uint64_t v = 1; v <= 100000; v++) {
+    h.record(v * 1000);
+  }
+  uint64_t p50 = h.percentile(0.5);
+  uint64_t p99 = h.percentile(0.99);
+  REQUIRE(p50 >= 50000 * 1000);
+  REQUIRE(p50 <= 50000 * 1000 + 50000 * 1000 / 8);
+  REQUIRE(p99 >= 99000 * 1000);
+  REQUIRE(p99 <= 100000 * 1000);
+  REQUIRE(h.max() == 100000 * 1000);
+}
+
+TEST_CASE("latencyHistogram empty", "latencyHistogram"){
+  latencyHistogram h;
+  REQUIRE(h.percentile(0.99) == 0);
+  REQUIRE(h.mean() == 0);
+  h.record(UINT64_MAX);
+  REQUIRE(h.percentile(0.5) == UINT64_MAX);
+}
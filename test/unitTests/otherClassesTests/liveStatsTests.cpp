@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "../catch.hpp"
+#include "../../../include/liveStats.hpp"
+#include "../../../include/syscallStats.hpp"
+
+/**
+ * Tests for the class liveStatsWriter and readLiveStats
+ */
+
+TEST_CASE("live statistics read back as published", "liveStats"){
+  char dir[] = "/tmp/liveStatsXXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  std::string file = std::string(dir) + "/stats";
+
+  liveStatsWriter writer(file);
+  int fd = open(file.c_str(), O_RDONLY);
+  REQUIRE(fd != -1);
+  const liveStatsPage* page = (const liveStatsPage*)mmap(
+      nullptr, sizeof(liveStatsPage), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  REQUIRE(page != MAP_FAILED);
+
+  syscallStats stats;
+  stats.recordHook(1, 2, false, 0, 0, 10);
+  stats.recordHook(1, 2, true, 3, 0, 10);
+  // Too long a name is cut short.
+  writer.publish(
+      {{"System Call Events: ", 12}, {std::string(100, 'x'), 5}}, &stats,
+      1000, false);
+
+  auto copy = std::make_unique<liveStatsPage>();
+  REQUIRE(readLiveStats(page, copy.get()));
+  REQUIRE(copy->sequence.load() == 2);
+  REQUIRE(copy->updates == 1);
+  REQUIRE(!copy->finished);
+  REQUIRE(copy->totalCount == 2);
+  REQUIRE(std::string(copy->totals[0].name) == "System Call Events: ");
+  REQUIRE(copy->totals[0].value == 12);
+  REQUIRE(std::string(copy->totals[1].name) == std::string(55, 'x'));
+  REQUIRE(copy->systemCalls[2].preHooks == 1);
+  REQUIRE(copy->systemCalls[2].postHooks == 1);
+  REQUIRE(copy->systemCalls[2].replays == 3);
+
+  writer.publish({}, nullptr, 2000, true);
+  REQUIRE(readLiveStats(page, copy.get()));
+  REQUIRE(copy->finished);
+  REQUIRE(copy->totalCount == 0);
+  REQUIRE(copy->elapsedNanos == 2000);
+
+  munmap((void*)page, sizeof(liveStatsPage));
+  unlink(file.c_str());
+  rmdir(dir);
+}
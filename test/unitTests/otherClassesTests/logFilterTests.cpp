@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../catch.hpp"
+#include "../../../include/logFilter.hpp"
+#include "../../../include/logger.hpp"
+
+/**
+ * Tests for the class logFilter, and its use by logger
+ */
+
+TEST_CASE("logFilter matches every term given", "logFilter"){
+  logFilter filter =
+      logFilter::parse("pid=7,9 syscall=openat,read time=100-200,500-");
+  REQUIRE(!filter.empty());
+  REQUIRE(filter.keeps(7, 7, SYS_openat, 150));
+  // Any thread of thread group 9.
+  REQUIRE(filter.keeps(12, 9, SYS_read, 600));
+  REQUIRE(!filter.keeps(8, 8, SYS_openat, 150));
+  REQUIRE(!filter.keeps(7, 7, SYS_write, 150));
+  REQUIRE(!filter.keeps(7, 7, -1, 150));
+  REQUIRE(!filter.keeps(7, 7, SYS_openat, 300));
+
+  logFilter entries = logFilter::parse("entry=1a-1f");
+  REQUIRE(entries.keeps(3, 3, -1, 0));
+  REQUIRE(entries.keepsEntry(0x1a));
+  REQUIRE(!entries.keepsEntry(0x20));
+  REQUIRE(logFilter::parse("  ").empty());
+}
+
+TEST_CASE("logFilter follows execs and forks", "logFilter"){
+  logFilter filter = logFilter::parse("exe=*/cc1");
+  REQUIRE(filter.matchesExecs());
+  REQUIRE(!filter.keeps(5, 5, -1, 0));
+  filter.execed(5, "/usr/lib/gcc/x86_64-linux-gnu/9/cc1");
+  REQUIRE(filter.keeps(6, 5, -1, 0));
+  filter.forked(5, 10);
+  REQUIRE(filter.keeps(10, 10, -1, 0));
+  filter.execed(10, "/bin/as");
+  REQUIRE(!filter.keeps(10, 10, -1, 0));
+  REQUIRE(filter.keeps(5, 5, -1, 0));
+}
+
+TEST_CASE("logFilter rejects malformed terms", "logFilter"){
+  REQUIRE_THROWS(logFilter::parse("pid"));
+  REQUIRE_THROWS(logFilter::parse("pid="));
+  REQUIRE_THROWS(logFilter::parse("pid=x"));
+  REQUIRE_THROWS(logFilter::parse("syscall=nosuchcall"));
+  REQUIRE_THROWS(logFilter::parse("colour=red"));
+}
+
+TEST_CASE("logger keeps entry ids of filtered out messages", "logFilter"){
+  char dir[] = "/tmp/logFilterXXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  std::string file = std::string(dir) + "/log";
+  {
+    logger log(file, 4, false);
+    log.filterBy(logFilter::parse("pid=2"));
+    for (pid_t pid = 1; pid <= 3; pid++) {
+      log.setContext(pid, pid, -1, 0);
+      DETTRACE_LOG(log, Importance::info, "pid %d\n", pid);
+      log.writeToLog(Importance::info, "again %d\n", pid);
+    }
+  }
+
+  std::ifstream in(file + ".00");
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(in, line);) {
+    lines.push_back(line);
+  }
+  unlink((file + ".00").c_str());
+  rmdir(dir);
+  REQUIRE(lines.size() == 2);
+  REQUIRE(lines[0] == "[4]INFO  2 pid 2");
+  REQUIRE(lines[1] == "[4]INFO  3 again 2");
+}
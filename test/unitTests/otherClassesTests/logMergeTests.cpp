@@ -0,0 +1,27 @@
+#include "../catch.hpp"
+#include <sstream>
+#include <string>
+#include "../../../include/logMerge.hpp"
+
+/**
+ * Tests for mergeLogShards.
+ */
+
+TEST_CASE("mergeLogShards orders entries by id", "logMerge"){
+  uint64_t id;
+  REQUIRE(logEntryOf("[4]INFO  1f @12 Saw exec", id));
+  REQUIRE(id == 0x1f);
+  REQUIRE(!logEntryOf("  continued", id));
+  REQUIRE(!logEntryOf("[3]INTER pid 12", id));
+
+  std::istringstream tracer("[3]INTER 0 @0 Starting\n");
+  std::istringstream first(
+      "[3]INTER 1 @5 read\n  two lines\n[5]EXTRA 4 @9 write\n");
+  std::istringstream second("[3]INTER 2 @7 open\n[3]INTER 3 @7 close\n");
+  std::ostringstream out;
+  mergeLogShards({&tracer, &first, &second}, out);
+  REQUIRE(
+      out.str() ==
+      "[3]INTER 0 @0 Starting\n[3]INTER 1 @5 read\n  two lines\n"
+      "[3]INTER 2 @7 open\n[3]INTER 3 @7 close\n[5]EXTRA 4 @9 write\n");
+}
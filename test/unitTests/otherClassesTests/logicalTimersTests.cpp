@@ -0,0 +1,59 @@
+#include "../catch.hpp"
+#include <signal.h>
+#include <stdint.h>
+#include "../../../include/logicalTimers.hpp"
+
+/**
+ * Tests for the class logicalTimers
+ */
+
+static logical_clock::time_point at(int64_t us) {
+  return logical_clock::time_point{logical_clock::duration{us}};
+}
+
+static timerSetting every(int64_t value, int64_t interval) {
+  timerSetting setting;
+  setting.value = logical_clock::duration{value};
+  setting.interval = logical_clock::duration{interval};
+  return setting;
+}
+
+TEST_CASE("logicalTimers periodic expirations and overrun", "logicalTimers"){
+  logicalTimers timers;
+  logicalTimers::timerKey key{timerKind::timerfd, timers.newTimerfd()};
+  timers.setTimer(key, 0, at(1000), every(100, 100));
+  REQUIRE(timers.expire(key, at(1099)) == 0);
+  REQUIRE(timers.expire(key, at(1100)) == 1);
+  REQUIRE(timers.overrun(key) == 0);
+  REQUIRE(timers.expire(key, at(1450)) == 3);
+  REQUIRE(timers.overrun(key) == 2);
+  REQUIRE(timers.expiry(key) == at(1500));
+  REQUIRE(timers.getTimer(key, at(1460)).value.count() == 40);
+}
+
+TEST_CASE("logicalTimers one-shot timers disarm", "logicalTimers"){
+  logicalTimers timers;
+  logicalTimers::timerKey key{timerKind::posix, 11000};
+  timerSetting old = timers.setTimer(key, SIGALRM, at(0), every(50, 0));
+  REQUIRE(old.value.count() == 0);
+  REQUIRE(timers.getTimer(key, at(10)).value.count() == 40);
+  REQUIRE(timers.expire(key, at(500)) == 1);
+  REQUIRE_FALSE(timers.armed(key));
+  REQUIRE(timers.getTimer(key, at(500)).value.count() == 0);
+}
+
+TEST_CASE("logicalTimers signals come due in expiry order", "logicalTimers"){
+  logicalTimers timers;
+  timers.setTimer({timerKind::real, 0}, SIGALRM, at(0), every(20, 0));
+  timers.setTimer({timerKind::prof, 0}, SIGPROF, at(0), every(10, 0));
+  timers.setTimer({timerKind::timerfd, 0}, 0, at(0), every(5, 0));
+  REQUIRE_FALSE(timers.signalDue(at(9)));
+  REQUIRE(timers.expireNextSignal(at(30)) == SIGPROF);
+  REQUIRE(timers.expireNextSignal(at(30)) == SIGALRM);
+  REQUIRE_FALSE(timers.signalDue(at(30)));
+
+  timers.setTimer({timerKind::real, 0}, SIGALRM, at(30), every(20, 0));
+  timers.forked();
+  REQUIRE_FALSE(timers.signalDue(at(100)));
+  REQUIRE(timers.expire({timerKind::timerfd, 0}, at(100)) == 1);
+}
@@ -0,0 +1,31 @@
+#include "../catch.hpp"
+#include <errno.h>
+#include "../../../include/missingPaths.hpp"
+
+/**
+ * Tests for the class missingPaths
+ */
+
+TEST_CASE("missingPaths forgets what a directory may now have", "missingPaths"){
+  missingPaths missing;
+  missing.insert("/usr/include/a.h", ENOENT, 1, 10);
+  missing.insert("/usr/include/sys/a.h", ENOENT, 1, 10);
+  missing.insert("/opt/dir/file/x", ENOTDIR, 1, 20);
+  REQUIRE(missing.find("/usr/include/a.h") == ENOENT);
+  REQUIRE(missing.find("/opt/dir/file/x") == ENOTDIR);
+  REQUIRE(missing.find("/usr/include/b.h") == 0);
+
+  missing.created(1, 10);
+  REQUIRE(missing.find("/usr/include/a.h") == 0);
+  REQUIRE(missing.find("/usr/include/sys/a.h") == 0);
+  REQUIRE(missing.find("/opt/dir/file/x") == ENOTDIR);
+  // Same inode, another device.
+  missing.created(2, 20);
+  REQUIRE(missing.size() == 1);
+
+  missing.insert("/usr/include/a.h", ENOENT, 1, 10);
+  missing.clear();
+  REQUIRE(missing.empty());
+  missing.created(1, 10);
+  REQUIRE(missing.empty());
+}
@@ -0,0 +1,44 @@
+#include "../catch.hpp"
+#include <unistd.h>
+#include <string>
+#include "../../../include/patchSiteCache.hpp"
+
+/**
+ * Tests for the class patchSiteCache, on this test's own executable.
+ */
+
+TEST_CASE("patchSiteCache identifies, saves and loads", "patchSiteCache"){
+  std::string saved =
+      "/tmp/dettrace-patch-sites-test-" + std::to_string(getpid());
+  char exe[4096];
+  ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe));
+  REQUIRE(n > 0);
+  vma m{0x400000, 0x500000, ProcMapPermRead | ProcMapPermExec, 0x1000,
+        std::string(exe, n)};
+
+  fileIdentity file;
+  REQUIRE(patchSiteCache::identify(m, file));
+  REQUIRE(!patchSiteCache::identify(vma{0, 4096, 0, 0, ""}, file));
+  REQUIRE(!patchSiteCache::identify(vma{0, 4096, 0, 0, "[vdso]"}, file));
+  {
+    patchSiteCache cache;
+    REQUIRE(cache.sitesOf(file) == nullptr);
+    cache.patched(file, 0x1234, patchKind::rdtsc);
+    cache.patched(file, 0x2000, patchKind::syscall);
+    cache.patched(file, 0x1234, patchKind::rdtsc);
+    REQUIRE(cache.size() == 2);
+    cache.save(saved);
+  }
+
+  patchSiteCache loaded;
+  REQUIRE(loaded.load(saved));
+  const patchSiteCache::fileSites* sites = loaded.sitesOf(file);
+  REQUIRE(sites != nullptr);
+  REQUIRE(sites->size() == 2);
+  REQUIRE(sites->at(0x1234) == patchKind::rdtsc);
+  REQUIRE(sites->at(0x2000) == patchKind::syscall);
+  unlink(saved.c_str());
+
+  patchSiteCache none;
+  REQUIRE(!none.load(saved));
+}
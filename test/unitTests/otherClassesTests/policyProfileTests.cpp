@@ -0,0 +1,55 @@
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "../catch.hpp"
+#include "../../../include/policyProfile.hpp"
+
+/**
+ * Tests for the class policyProfile
+ */
+
+TEST_CASE("policyProfile parses dispositions", "policyProfile"){
+  policyProfile profile = policyProfile::parse(
+      "# a comment\n"
+      "wait4 allow\n"
+      "\n"
+      "timer_create errno ENOSYS  # trailing comment\n"
+      "getrusage intercept\n"
+      "uname errno 13\n",
+      "test");
+  REQUIRE(profile.overrides().size() == 4);
+  REQUIRE(profile.find(SYS_wait4)->what == disposition::allow);
+  REQUIRE(profile.find(SYS_timer_create)->what == disposition::reject);
+  REQUIRE(profile.find(SYS_timer_create)->err == ENOSYS);
+  REQUIRE(profile.find(SYS_getrusage)->what == disposition::intercept);
+  REQUIRE(profile.find(SYS_uname)->err == 13);
+  REQUIRE(profile.find(SYS_read) == nullptr);
+}
+
+TEST_CASE("policyProfile rejects malformed lines", "policyProfile"){
+  REQUIRE_THROWS(policyProfile::parse("nosuchcall allow\n", "test"));
+  REQUIRE_THROWS(policyProfile::parse("wait4 maybe\n", "test"));
+  REQUIRE_THROWS(policyProfile::parse("wait4 errno\n", "test"));
+}
+
+TEST_CASE("policyProfile fingerprints and resolves", "policyProfile"){
+  policyProfile a = policyProfile::parse("wait4 allow\n", "a");
+  policyProfile b = policyProfile::parse("wait4 intercept\n", "b");
+  REQUIRE(a.fingerprint() != b.fingerprint());
+  policyProfile c = policyProfile::parse("wait4 allow\n", "c");
+  REQUIRE(a.fingerprint() == c.fingerprint());
+  REQUIRE(policyProfile::resolve("compile", "/p") == "/p/compile.profile");
+  REQUIRE(policyProfile::resolve("./mine", "/p") == "./mine");
+}
+
+TEST_CASE("profileSuggestion allows what never changed", "policyProfile"){
+  profileSuggestion suggestion{"/dev/null"};
+  suggestion.hooked(SYS_uname, false);
+  suggestion.hooked(SYS_getrusage, true);
+  suggestion.hooked(SYS_wait4, false);
+  policyProfile suggested = policyProfile::parse(suggestion.text(), "s");
+  REQUIRE(suggested.find(SYS_uname)->what == disposition::allow);
+  REQUIRE(suggested.find(SYS_getrusage)->what == disposition::intercept);
+  // Blocks, never allowed.
+  REQUIRE(suggested.find(SYS_wait4)->what == disposition::intercept);
+}
@@ -0,0 +1,103 @@
+#include "../catch.hpp"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "../../../include/PRNG.hpp"
+
+/**
+ * Tests for the classes blockPRNG and randomByteStream
+ */
+
+TEST_CASE("blockPRNG is deterministic", "blockPRNG"){
+  std::vector<uint8_t> first(4096), second(4096);
+  blockPRNG{5}.fill(first.data(), first.size());
+  blockPRNG{5}.fill(second.data(), second.size());
+  REQUIRE(first == second);
+
+  blockPRNG{6}.fill(second.data(), second.size());
+  REQUIRE(first != second);
+}
+
+TEST_CASE("randomByteStream doesn't depend on read sizes", "randomByteStream"){
+  const size_t total = 200 * 1000;
+  std::vector<uint8_t> whole(total), pieces(total);
+  randomByteStream{7}.read(whole.data(), total);
+
+  randomByteStream stream{7};
+  size_t done = 0;
+  for (size_t size = 1; done < total; size = size * 3 + 1) {
+    size_t bytes = std::min(size, total - done);
+    stream.read(pieces.data() + done, bytes);
+    done += bytes;
+  }
+  REQUIRE(whole == pieces);
+}
+
+TEST_CASE("randomByteStream is the same generated ahead", "randomByteStream"){
+  const size_t total = 300 * 1000;
+  std::vector<uint8_t> whole(total), ahead(total), onTracer(total);
+  randomByteStream{9}.read(whole.data(), total);
+
+  taskPool helpers{2}, none{0};
+  randomByteStream onHelpers{9}, onNone{9};
+  onHelpers.generateOn(helpers);
+  onNone.generateOn(none);
+  for (size_t done = 0; done < total; done += 1000) {
+    onHelpers.read(ahead.data() + done, 1000);
+    onNone.read(onTracer.data() + done, 1000);
+  }
+  REQUIRE(whole == ahead);
+  REQUIRE(whole == onTracer);
+}
+
+TEST_CASE("mixSeed tells apart siblings and paths", "mixSeed"){
+  uint64_t root = 0;
+  uint64_t first = mixSeed(root, 0), second = mixSeed(root, 1);
+  REQUIRE(first != second);
+  REQUIRE(first != 0);
+  // A grandchild never repeats its parent's or uncle's path.
+  REQUIRE(mixSeed(first, 0) != first);
+  REQUIRE(mixSeed(first, 0) != second);
+  REQUIRE(mixSeed(first, 0) != mixSeed(second, 0));
+}
+
+template <typename F>
+static double secondsFor(F f){
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Hidden, run with: ./otherClassesTests "[.benchmark]"
+TEST_CASE("randomByteStream against 16-bit PRNG words", "[.benchmark]"){
+  for (size_t size : {4096, 64 * 1024, 1024 * 1024}) {
+    const size_t totalBytes = 256 * 1024 * 1024;
+    std::vector<uint8_t> buffer(size);
+    uint64_t sum = 0;
+
+    double wordTime = secondsFor([&]() {
+      PRNG prng{1};
+      for (size_t done = 0; done < totalBytes; done += size) {
+        uint16_t* words = (uint16_t*)buffer.data();
+        for (size_t i = 0; i < size / sizeof(uint16_t); i++) {
+          words[i] = prng.get();
+        }
+        sum += buffer[size - 1];
+      }
+    });
+
+    double streamTime = secondsFor([&]() {
+      randomByteStream stream{1};
+      for (size_t done = 0; done < totalBytes; done += size) {
+        stream.read(buffer.data(), size);
+        sum += buffer[size - 1];
+      }
+    });
+
+    printf("%zu byte requests: PRNG words %.3fs, randomByteStream %.3fs "
+           "(%lu)\n",
+           size, wordTime, streamTime, (unsigned long)(sum & 1));
+  }
+}
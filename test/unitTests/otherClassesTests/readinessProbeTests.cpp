@@ -0,0 +1,39 @@
+#include "../catch.hpp"
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../../../include/readinessProbe.hpp"
+
+/**
+ * Tests for the class readinessProbe, on fds of our own playing the tracee's.
+ */
+
+TEST_CASE("readinessProbe probes stream socketpairs", "readinessProbe"){
+  int sv[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+  readinessProbe probe;
+  if (probe.probe(getpid(), sv[0]) == readinessProbe::result::unknown) {
+    WARN("pidfd_getfd not supported here, skipping");
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+  REQUIRE(probe.probe(getpid(), sv[0]) == readinessProbe::result::empty);
+  REQUIRE(probe.inodeOf(sv[0]) == 0);
+
+  REQUIRE(probe.fill(getpid(), sv[1], "abc", 3) == 3);
+  REQUIRE(probe.probe(getpid(), sv[0]) == readinessProbe::result::ready);
+  char buffer[8];
+  REQUIRE(probe.drain(getpid(), sv[0], buffer, sizeof(buffer)) == 3);
+  REQUIRE(probe.drain(getpid(), sv[0], buffer, sizeof(buffer)) == -1);
+  REQUIRE(errno == EAGAIN);
+
+  int dgram[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_DGRAM, 0, dgram) == 0);
+  REQUIRE(probe.probe(getpid(), dgram[0]) == readinessProbe::result::unknown);
+
+  close(sv[0]);
+  close(sv[1]);
+  close(dgram[0]);
+  close(dgram[1]);
+}
@@ -0,0 +1,177 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../catch.hpp"
+#include "../../../include/remoteCache.hpp"
+
+/**
+ * Tests for the class remoteCache
+ */
+
+/**
+ * Serve one connection on listener: GET, HEAD and PUT of objects, answered
+ * once all the requests that came in one read are parsed, like a pipelining
+ * server would. If answers isn't 0, the last of that many answers closes the
+ * connection.
+ */
+static void serveOne(
+    int listener,
+    std::map<std::string, std::string>& objects,
+    size_t answers) {
+  int client = accept(listener, nullptr, nullptr);
+  std::string in;
+  char buf[4096];
+  ssize_t n;
+  bool closes = false;
+  while (!closes && (n = read(client, buf, sizeof(buf))) > 0) {
+    in.append(buf, n);
+    std::string out;
+    size_t end;
+    while (!closes && (end = in.find("\r\n\r\n")) != std::string::npos) {
+      std::string method = in.substr(0, in.find(' '));
+      size_t pathStart = method.size() + 1;
+      std::string path =
+          in.substr(pathStart, in.find(' ', pathStart) - pathStart);
+      size_t length = 0;
+      size_t header = in.find("Content-Length: ");
+      if (header != std::string::npos && header < end) {
+        length = std::stoul(in.substr(header + 16));
+      }
+      if (in.size() < end + 4 + length) {
+        break;
+      }
+      std::string body = in.substr(end + 4, length);
+      in.erase(0, end + 4 + length);
+      auto object = objects.find(path);
+      closes = answers != 0 && --answers == 0;
+      std::string connection = closes ? "Connection: close\r\n" : "";
+      if (method == "PUT") {
+        objects[path] = body;
+        out += "HTTP/1.1 201 Created\r\n" + connection +
+            "Content-Length: 0\r\n\r\n";
+      } else if (object == objects.end()) {
+        out += "HTTP/1.1 404 Not Found\r\n" + connection +
+            "Content-Length: 9\r\n\r\n";
+        out += method == "HEAD" ? "" : "not found";
+      } else {
+        out += "HTTP/1.1 200 OK\r\n" + connection + "Content-Length: " +
+            std::to_string(object->second.size()) + "\r\n\r\n";
+        out += method == "HEAD" ? "" : object->second;
+      }
+    }
+    if (write(client, out.data(), out.size()) != (ssize_t)out.size()) {
+      break;
+    }
+  }
+  // Requests we won't answer are dropped, not reset, so the answers we gave
+  // still get there.
+  shutdown(client, SHUT_WR);
+  while (closes && read(client, buf, sizeof(buf)) > 0) {
+  }
+  close(client);
+}
+
+TEST_CASE("remoteCache parses urls", "remoteCache"){
+  remoteCache::url url;
+  REQUIRE(remoteCache::parseUrl("http://cache.local:8080/ci/", url));
+  REQUIRE(url.host == "cache.local");
+  REQUIRE(url.port == "8080");
+  REQUIRE(url.path == "/ci");
+  REQUIRE(remoteCache::parseUrl("http://cache", url));
+  REQUIRE(url.port == "80");
+  REQUIRE(url.path == "");
+  REQUIRE(!remoteCache::parseUrl("https://cache", url));
+  REQUIRE(!remoteCache::parseUrl("http://cache:x/", url));
+  REQUIRE(!remoteCache::parseUrl("http:///path", url));
+}
+
+/** A loopback listener, its url with prefix /prefix/ goes to url. */
+static int listenOnLoopback(std::string& url) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  REQUIRE(bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0);
+  REQUIRE(listen(listener, 1) == 0);
+  socklen_t length = sizeof(address);
+  getsockname(listener, (struct sockaddr*)&address, &length);
+  url = "http://127.0.0.1:" + std::to_string(ntohs(address.sin_port)) +
+      "/prefix/";
+  return listener;
+}
+
+TEST_CASE("remoteCache pipelines fetches on one connection", "remoteCache"){
+  std::string url;
+  int listener = listenOnLoopback(url);
+
+  std::map<std::string, std::string> objects;
+  objects["/prefix/blobs/a"] = "contents of a";
+  objects["/prefix/blobs/empty"] = "";
+  // One connection for all of it, or the second accept never comes.
+  std::thread server(serveOne, listener, std::ref(objects), 0);
+  {
+    logger log("", 0);
+    remoteCache cache(url, log);
+    std::vector<std::pair<bool, std::string>> found;
+    REQUIRE(cache.fetch({"blobs/a", "blobs/missing", "blobs/empty"}, found));
+    REQUIRE(found.size() == 3);
+    REQUIRE(found[0] == std::make_pair(true, std::string("contents of a")));
+    REQUIRE(!found[1].first);
+    REQUIRE(found[2] == std::make_pair(true, std::string()));
+
+    REQUIRE(cache.store("entries/k", "entry"));
+    std::vector<bool> has;
+    REQUIRE(cache.has({"entries/k", "entries/other"}, has));
+    REQUIRE(has == std::vector<bool>({true, false}));
+    REQUIRE(cache.fetched == 2);
+    REQUIRE(cache.stored == 1);
+    REQUIRE(cache.enabled());
+  }
+  server.join();
+  close(listener);
+  REQUIRE(objects["/prefix/entries/k"] == "entry");
+}
+
+TEST_CASE("remoteCache sends again what a closing server left", "remoteCache"){
+  std::string url;
+  int listener = listenOnLoopback(url);
+  std::map<std::string, std::string> objects;
+  objects["/prefix/blobs/a"] = "a";
+  objects["/prefix/blobs/b"] = "b";
+  // Two answers on the first connection, the third on a second one.
+  std::thread server([&]() {
+    serveOne(listener, objects, 2);
+    serveOne(listener, objects, 1);
+  });
+  {
+    logger log("", 0);
+    remoteCache cache(url, log);
+    std::vector<std::pair<bool, std::string>> found;
+    REQUIRE(cache.fetch({"blobs/a", "blobs/missing", "blobs/b"}, found));
+    REQUIRE(found[0] == std::make_pair(true, std::string("a")));
+    REQUIRE(!found[1].first);
+    REQUIRE(found[2] == std::make_pair(true, std::string("b")));
+    REQUIRE(cache.enabled());
+  }
+  server.join();
+  close(listener);
+}
+
+TEST_CASE("remoteCache gives up on a silent server", "remoteCache"){
+  std::string url;
+  // Connects through the backlog, but nobody ever answers.
+  int listener = listenOnLoopback(url);
+  logger log("", 0);
+  remoteCache cache(url, log, 100);
+  std::vector<bool> has;
+  REQUIRE(!cache.has({"blobs/a"}, has));
+  REQUIRE(has == std::vector<bool>({false}));
+  REQUIRE(!cache.enabled());
+  close(listener);
+}
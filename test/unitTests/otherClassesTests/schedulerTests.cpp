@@ -0,0 +1,61 @@
+#include "../catch.hpp"
+#include "../../../include/logger.hpp"
+#include "../../../include/scheduler.hpp"
+
+/**
+ * Tests for scheduler policies
+ */
+
+/**
+ * Shell 1 runs producer 2, bystander 3 and consumer 4. The consumer blocks on
+ * pipe 100, the producer writes to it, then the consumer blocks again.
+ * @return who runs after the consumer's second block.
+ */
+static pid_t afterSecondBlock(bool producerFirst, uint32_t& preferred) {
+  logger log{"", 0};
+  scheduler sched{1, log};
+  if (producerFirst) {
+    sched.preferProducers();
+  }
+  for (pid_t pid = 2; pid <= 4; pid++) {
+    sched.addAndScheduleNext(pid);
+  }
+  sched.preemptAndWaitFor({waitKind::pipeReadable, 100});
+  REQUIRE(sched.getNext() == 3);
+  sched.preemptAndScheduleNext();
+  REQUIRE(sched.getNext() == 2);
+  sched.wake(waitKind::pipeReadable, 100);
+  sched.preemptAndScheduleNext();
+  sched.preemptAndScheduleNext();
+  REQUIRE(sched.getNext() == 4);
+  sched.preemptAndWaitFor({waitKind::pipeReadable, 100});
+  preferred = sched.producersPreferred;
+  return sched.getNext();
+}
+
+TEST_CASE("producer-first runs the writer of a pipe next", "scheduler"){
+  uint32_t preferred;
+  REQUIRE(afterSecondBlock(false, preferred) == 3);
+  REQUIRE(preferred == 0);
+  REQUIRE(afterSecondBlock(true, preferred) == 2);
+  REQUIRE(preferred == 1);
+}
+
+TEST_CASE("only waits on events we model deadlock", "scheduler"){
+  logger log{"", 0};
+  scheduler pipeReader{1, log};
+  REQUIRE_THROWS_AS(
+      [&]() {
+        for (int i = 0; i < 1000; i++) {
+          pipeReader.preemptAndWaitForAny({{waitKind::pipeReadable, 100}}, 0);
+        }
+      }(),
+      std::runtime_error);
+
+  // A socket read, retried on a back-off, waits for as long as it takes.
+  scheduler socketReader{1, log};
+  for (int i = 0; i < 1000; i++) {
+    socketReader.preemptAndWaitForAny({}, 4);
+  }
+  REQUIRE(socketReader.getNext() == 1);
+}
@@ -0,0 +1,30 @@
+#include "../catch.hpp"
+#include <stdint.h>
+#include "../../../include/scratchArena.hpp"
+
+/**
+ * Tests for the class scratchArena
+ */
+
+TEST_CASE("scratchArena aligns and doesn't overlap", "scratchArena"){
+  scratchArena arena;
+  char* c = arena.allocate<char>(3);
+  uint64_t* u = arena.allocate<uint64_t>(4);
+  REQUIRE((uintptr_t)u % alignof(uint64_t) == 0);
+  REQUIRE((char*)u >= c + 3);
+}
+
+TEST_CASE("scratchArena reuses its blocks after reset", "scratchArena"){
+  scratchArena arena;
+  char* first = arena.allocate<char>(1000);
+  arena.allocate<char>(300 * 1000);
+  size_t capacity = arena.capacity();
+
+  arena.reset();
+  REQUIRE(arena.allocate<char>(1000) == first);
+  // The big block was given back.
+  REQUIRE(arena.capacity() < capacity);
+  // What doesn't fit in the rest of a block goes to the next one.
+  char* second = arena.allocate<char>(256 * 1024 - 500);
+  REQUIRE((second >= first + 1000 || second + 256 * 1024 - 500 <= first));
+}
@@ -0,0 +1,54 @@
+#include "../catch.hpp"
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include "../../../include/seccompActionCache.hpp"
+
+/**
+ * Tests for the class seccompActionCache, on a filter shaped like ours: a
+ * gate checking the instruction pointer of reads, allowed calls by number, and
+ * ioctl allowed for some requests only.
+ */
+
+TEST_CASE("seccompActionCache finds constant verdicts", "seccompActionCache"){
+  const uint32_t nr = offsetof(struct seccomp_data, nr);
+  const uint32_t ip = offsetof(struct seccomp_data, instruction_pointer);
+  const uint32_t arg1 = offsetof(struct seccomp_data, args[1]);
+  std::vector<struct sock_filter> program = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 0, 13),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, nr),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_read, 0, 3),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ip),
+      BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x70000000, 8, 9),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, nr),
+      BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x40000000, 7, 0),
+      BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, SYS_getpid, 6, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_getpid, 4, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_ioctl, 0, 4),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, arg1),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x5401, 0, 2),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | 0x7fff),
+  };
+
+  REQUIRE(seccompActionCache::alwaysAllows(
+      program, AUDIT_ARCH_X86_64, SYS_getpid));
+  // On the instruction pointer and on an argument, never cached.
+  REQUIRE(!seccompActionCache::alwaysAllows(
+      program, AUDIT_ARCH_X86_64, SYS_read));
+  REQUIRE(!seccompActionCache::alwaysAllows(
+      program, AUDIT_ARCH_X86_64, SYS_ioctl));
+  // Traced, and another architecture.
+  REQUIRE(!seccompActionCache::alwaysAllows(
+      program, AUDIT_ARCH_X86_64, SYS_write));
+  REQUIRE(!seccompActionCache::alwaysAllows(
+      program, AUDIT_ARCH_I386, SYS_getpid));
+  REQUIRE(!seccompActionCache::alwaysAllows({}, AUDIT_ARCH_X86_64, 0));
+
+  std::vector<uint32_t> allowed =
+      seccompActionCache::alwaysAllowed(program, AUDIT_ARCH_X86_64);
+  REQUIRE(allowed == std::vector<uint32_t>{SYS_getpid});
+}
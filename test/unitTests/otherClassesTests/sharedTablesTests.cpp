@@ -0,0 +1,62 @@
+#include "../catch.hpp"
+#include "../../../include/sharedTables.hpp"
+
+/**
+ * Tests for the class sharedTables
+ */
+
+TEST_CASE("sharedTables readers see what was published", "sharedTables"){
+  sharedTables tables;
+  REQUIRE(tables.valid());
+  tables.publishInode(1234, 7);
+  tables.publishInode(1234, 8);
+  tables.publishMtime(1234, 42);
+  tables.publishRandomPositions(1, 2, 3);
+
+  int64_t inode = 0, mtime = 0, missing = 0;
+  bool found = false, foundMissing = true;
+  uint64_t position = 0;
+  sharedTablesRead(tables.get(), [&](const sharedTablesHeader* header) {
+    found = sharedTableFind(sharedTablesInodes(header), 1234, inode) &&
+        sharedTableFind(sharedTablesMtimes(header), 1234, mtime);
+    foundMissing = sharedTableFind(sharedTablesInodes(header), 99, missing);
+    position = header->devUrandomPosition;
+  });
+  REQUIRE(found);
+  REQUIRE(inode == 8);
+  REQUIRE(mtime == 42);
+  REQUIRE(!foundMissing);
+  REQUIRE(position == 3);
+  REQUIRE(tables.get()->inodes == 1);
+  REQUIRE(tables.get()->sequence % 2 == 0);
+  REQUIRE(tables.get()->complete == 1);
+}
+
+TEST_CASE("sharedTables forget inodes", "sharedTables"){
+  sharedTables tables;
+  REQUIRE(tables.valid());
+  // Enough inodes for probe runs to form.
+  for (uint64_t inode = 1; inode <= 5000; inode++) {
+    tables.publishInode(inode, inode + 1);
+  }
+  tables.publishMtime(10, 42);
+  for (uint64_t inode = 2; inode <= 5000; inode += 2) {
+    tables.forgetInode(inode);
+  }
+  tables.forgetInode(10);
+
+  bool ok = true;
+  sharedTablesRead(tables.get(), [&](const sharedTablesHeader* header) {
+    ok = true;
+    for (uint64_t inode = 1; inode <= 5000; inode++) {
+      int64_t value = 0;
+      bool found = sharedTableFind(sharedTablesInodes(header), inode, value);
+      ok = ok && found == (inode % 2 == 1) && (!found || value == inode + 1);
+    }
+    int64_t mtime;
+    ok = ok && !sharedTableFind(sharedTablesMtimes(header), 10, mtime);
+  });
+  REQUIRE(ok);
+  REQUIRE(tables.get()->inodes == 2500);
+  REQUIRE(tables.get()->mtimes == 0);
+}
@@ -0,0 +1,93 @@
+#include "../catch.hpp"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#include "../../../include/sitePatcher.hpp"
+#include "../../../include/vdso.hpp"
+
+/**
+ * Tests for the code sitePatcher generates, run in this process: a clock page
+ * of our own where tracees have theirs, and no seccomp filter, so the gate's
+ * system calls simply run.
+ */
+
+/** Run the trampoline at code as the write site it replaces. */
+static long runWrite(uint64_t code, int fd, const void* buf, size_t count) {
+  long ret;
+  // Past our red zone, as a site's caller would be.
+  asm volatile(
+      "sub $128, %%rsp\n\t"
+      "call *%[code]\n\t"
+      "add $128, %%rsp"
+      : "=a"(ret)
+      : "a"((long)SYS_write), "D"((long)fd), "S"(buf), "d"(count),
+        [code] "r"(code)
+      : "rcx", "r11", "memory", "cc");
+  return ret;
+}
+
+TEST_CASE("buffered writes go in the side effect ring", "sitePatcher"){
+  size_t size = logicalClockPageSize + sideEffectRingSize;
+  void* mapping = mmap(
+      (void*)logicalClockPageAddr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (mapping != (void*)logicalClockPageAddr) {
+    WARN("logicalClockPageAddr taken here, skipping");
+    return;
+  }
+  auto page = (logicalClockPage*)mapping;
+  std::vector<uint8_t> gate = bufferedSystemCallGate();
+  memcpy((char*)page + logicalClockGateOffset, gate.data(), gate.size());
+
+  char path[] = "/tmp/dettrace-site-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  int readOnly = open(path, O_RDONLY);
+  unlink(path);
+  page->bufferedSystemCalls = (uint64_t)1 << SYS_write;
+  page->recordedSystemCalls = (uint64_t)1 << SYS_write;
+  page->regularFds[fd / 64] |= (uint64_t)1 << (fd % 64);
+  page->regularFds[readOnly / 64] |= (uint64_t)1 << (readOnly % 64);
+
+  // The relocated instructions: a ret, back to runWrite.
+  const uint8_t ret = 0xc3;
+  void* region = mmap(
+      nullptr, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  REQUIRE(region != MAP_FAILED);
+  uint64_t code = (uint64_t)region;
+  std::vector<uint8_t> trampoline = bufferedSystemCallTrampoline(
+      logicalClockPageAddr, &ret, 1, code, code);
+  memcpy(region, trampoline.data(), trampoline.size());
+
+  REQUIRE(runWrite(code, fd, "hello", 5) == 5);
+  REQUIRE(page->sideEffectBytes == 24);
+  auto record = (sideEffectRecord*)((char*)page + logicalClockPageSize);
+  REQUIRE(record->syscallNumber == SYS_write);
+  REQUIRE(record->fd == fd);
+  REQUIRE(record->result == 5);
+  REQUIRE(memcmp(record + 1, "hello", 5) == 0);
+
+  // Failed, nothing to record.
+  REQUIRE(runWrite(code, readOnly, "x", 1) == -EBADF);
+  REQUIRE(page->sideEffectBytes == 24);
+
+  // Too big for what is left, it takes the site's own system call.
+  std::vector<char> big(sideEffectRingSize);
+  REQUIRE(runWrite(code, fd, big.data(), big.size()) == (long)big.size());
+  REQUIRE(page->sideEffectBytes == 24);
+
+  page->recordedSystemCalls = 0;
+  REQUIRE(runWrite(code, fd, "!", 1) == 1);
+  REQUIRE(page->sideEffectBytes == 24);
+  REQUIRE(lseek(fd, 0, SEEK_CUR) == (off_t)(6 + big.size()));
+
+  close(fd);
+  close(readOnly);
+  munmap(region, 4096);
+  munmap(mapping, size);
+}
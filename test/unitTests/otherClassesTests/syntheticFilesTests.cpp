@@ -0,0 +1,52 @@
+#include "../catch.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include "../../../include/syntheticFiles.hpp"
+
+/**
+ * Tests for the files of --cpus, see syntheticFiles::addMachine.
+ */
+
+/** Lines of text that start with prefix. */
+static int countLines(const std::string& text, const std::string& prefix) {
+  int lines = 0;
+  size_t start = 0;
+  while (start < text.size()) {
+    if (text.compare(start, prefix.size(), prefix) == 0) {
+      lines++;
+    }
+    size_t end = text.find('\n', start);
+    start = end == std::string::npos ? text.size() : end + 1;
+  }
+  return lines;
+}
+
+TEST_CASE("syntheticFiles machine of N cpus", "syntheticFiles"){
+  REQUIRE(syntheticFiles::cpuList(1) == "0\n");
+  REQUIRE(syntheticFiles::cpuList(12) == "0-11\n");
+
+  // glibc counts cpuN lines for _SC_NPROCESSORS_* without /sys.
+  std::string stat = syntheticFiles::procStat(12);
+  REQUIRE(countLines(stat, "cpu") == 13);
+  REQUIRE(countLines(stat, "cpu11 ") == 1);
+  REQUIRE(countLines(stat, "btime ") == 1);
+
+  std::string info = syntheticFiles::procCpuinfo(3);
+  REQUIRE(countLines(info, "processor\t: ") == 3);
+  REQUIRE(countLines(info, "siblings\t: 3") == 3);
+  REQUIRE(info.find(" ht ") != std::string::npos);
+  REQUIRE(syntheticFiles::procCpuinfo(1).find(" ht ") == std::string::npos);
+  REQUIRE(syntheticFiles::procStat(4) == syntheticFiles::procStat(4));
+
+  syntheticFiles files;
+  files.addMachine(4);
+  const std::string* online = files.redirect("/sys/devices/system/cpu/online");
+  REQUIRE(online != nullptr);
+  int fd = open(online->c_str(), O_RDONLY);
+  REQUIRE(fd != -1);
+  char buffer[16] = {};
+  REQUIRE(read(fd, buffer, sizeof(buffer)) == 4);
+  REQUIRE(std::string{buffer} == "0-3\n");
+  close(fd);
+}
@@ -0,0 +1,42 @@
+#include <sys/syscall.h>
+
+#include <sstream>
+#include <string>
+
+#include "../catch.hpp"
+#include "../../../include/syscallStats.hpp"
+
+/**
+ * Tests for the per executable counters of syscallStats
+ */
+
+TEST_CASE("syscallStats attributes stops to executables", "syscallStats"){
+  syscallStats stats;
+  stats.execed(10, "/bin/sh");
+  stats.stopped(10);
+  stats.recordHook(10, SYS_read, false, 2, 0, 5000000);
+  // A forked shell and its thread stay the shell's, until the exec.
+  stats.spawned(10, 11, false);
+  stats.spawned(11, 12, true);
+  stats.stopped(12);
+  stats.execed(11, "/usr/bin/cc1");
+  stats.stopped(11);
+  stats.recordHook(11, SYS_openat, false, 0, 0, 9000000);
+  stats.exited(11);
+  // Unknown to us, counted nowhere.
+  stats.stopped(99);
+
+  std::ostringstream out;
+  stats.printExecutables(out, 10);
+  std::istringstream lines(out.str());
+  std::string cc1, sh, more;
+  std::getline(lines, cc1);
+  std::getline(lines, sh);
+  REQUIRE(!std::getline(lines, more));
+  REQUIRE(
+      cc1.find("/usr/bin/cc1: 1 execs, 1 stops, 0 replays, tracer 9 ms") !=
+      std::string::npos);
+  REQUIRE(
+      sh.find("/bin/sh: 1 execs, 2 stops, 2 replays, tracer 5 ms") !=
+      std::string::npos);
+}
@@ -0,0 +1,59 @@
+#include <string>
+#include <vector>
+
+#include "../catch.hpp"
+#include "../../../include/taskPool.hpp"
+
+/**
+ * Tests for the class taskPool
+ */
+
+TEST_CASE("taskPool hands back every result", "taskPool"){
+  for (unsigned helpers : {0, 1, 3}) {
+    taskPool pool{helpers};
+    std::vector<taskResult<std::string>> results;
+    for (int i = 0; i < 100; i++) {
+      results.push_back(pool.run([i] { return std::to_string(i * i); }));
+    }
+    for (int i = 0; i < 100; i++) {
+      REQUIRE(results[i].valid());
+      REQUIRE(results[i].get() == std::to_string(i * i));
+      REQUIRE(!results[i].valid());
+    }
+    REQUIRE(pool.submitted == 100);
+    if (helpers == 0) {
+      REQUIRE(pool.ranByHelpers == 0);
+    }
+  }
+}
+
+TEST_CASE("taskPool runs what no one takes", "taskPool"){
+  int ran = 0;
+  {
+    taskPool pool{1};
+    for (int i = 0; i < 10; i++) {
+      pool.run([&ran] { ran++; });
+    }
+  }
+  REQUIRE(ran == 10);
+}
+
+TEST_CASE("taskPool pauses and resumes its helpers", "taskPool"){
+  taskPool pool{2};
+  std::vector<taskResult<int>> results;
+  for (int i = 0; i < 10; i++) {
+    results.push_back(pool.run([i] { return i; }));
+  }
+  pool.pause();
+  // Queued before the pause, they ran then. Nothing runs on its own now.
+  uint64_t ranBefore = pool.ranByHelpers;
+  results.push_back(pool.run([] { return 10; }));
+  REQUIRE(pool.ranByHelpers == ranBefore);
+  pool.resume();
+  for (int i = 0; i < 12; i++) {
+    results.push_back(pool.run([i] { return 11 + i; }));
+  }
+  for (int i = 0; i < 23; i++) {
+    REQUIRE(results[i].get() == i);
+  }
+}
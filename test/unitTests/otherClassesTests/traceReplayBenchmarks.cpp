@@ -0,0 +1,162 @@
+#include "../catch.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../../../include/logger.hpp"
+#include "../../../include/scheduler.hpp"
+#include "../../../include/syscallStats.hpp"
+#include "../../../include/traceFile.hpp"
+
+/**
+ * Replay of a --trace-file, offline, through the tracer state every event
+ * reaches without the tracee: the scheduler and syscallStats. Hidden, run
+ * with: make bench DETTRACE_BENCH_TRACE=run.trace, without a trace a
+ * synthetic build like one is replayed.
+ *
+ * The scheduler picks who runs, the trace what they do next: a tracee the
+ * recorded tracer switched away from after an event is preempted after it
+ * here too. Handlers aren't run, they need the tracee's memory and /proc,
+ * which a trace doesn't have.
+ */
+
+/** Records of path, empty if it isn't a trace. */
+static std::vector<traceRecord> readTrace(const char* path) {
+  std::vector<traceRecord> records;
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    return records;
+  }
+  traceFileHeader header;
+  if (fread(&header, sizeof(header), 1, file) == 1 &&
+      memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+      header.version == TRACE_FILE_VERSION &&
+      header.recordSize == sizeof(traceRecord)) {
+    traceRecord record;
+    // A trace from a crashed run ends in a zero filled tail.
+    while (fread(&record, sizeof(record), 1, file) == 1 && record.pid != 0) {
+      records.push_back(record);
+    }
+  }
+  fclose(file);
+  return records;
+}
+
+/**
+ * A make like run: pid 1 forks children one after another, each a few
+ * hundred system calls, then waits for them.
+ */
+static std::vector<traceRecord> syntheticTrace() {
+  const int children = 500;
+  const int64_t calls[] = {SYS_openat, SYS_fstat, SYS_read, SYS_mmap,
+                           SYS_close,  SYS_write, SYS_brk};
+  std::vector<traceRecord> records;
+  auto add = [&](pid_t pid, traceEvent event, int64_t number, int64_t ret) {
+    traceRecord record = {};
+    record.pid = pid;
+    record.event = event;
+    record.number = number;
+    record.returnValue = ret;
+    records.push_back(record);
+  };
+  for (pid_t child = 2; child < children + 2; child++) {
+    add(1, traceEvent::syscallPre, SYS_clone, 0);
+    add(1, traceEvent::fork, 0, child);
+    add(1, traceEvent::syscallPost, SYS_clone, child);
+    for (int i = 0; i < 300; i++) {
+      int64_t nr = calls[(child + i) % 7];
+      add(child, traceEvent::syscallPre, nr, 0);
+      add(child, traceEvent::syscallPost, nr, 0);
+    }
+    add(child, traceEvent::exit, 0, 0);
+    add(1, traceEvent::syscallPre, SYS_wait4, 0);
+    add(1, traceEvent::syscallPost, SYS_wait4, child);
+  }
+  add(1, traceEvent::exit, 0, 0);
+  return records;
+}
+
+TEST_CASE("replay of a trace through the scheduler", "[.benchmark]"){
+  const char* path = getenv("DETTRACE_BENCH_TRACE");
+  std::vector<traceRecord> records =
+      path != nullptr ? readTrace(path) : syntheticTrace();
+  REQUIRE(!records.empty());
+
+  // What each tracee does, in order, and whether the tracer switched after.
+  std::unordered_map<pid_t, std::deque<std::pair<traceRecord, bool>>> events;
+  for (size_t i = 0; i < records.size(); i++) {
+    bool switched =
+        i + 1 < records.size() && records[i + 1].pid != records[i].pid;
+    events[records[i].pid].emplace_back(records[i], switched);
+  }
+
+  logger log("", 0);
+  pid_t first = records[0].pid;
+  scheduler sched(first, log);
+  syscallStats stats;
+  stats.execed(first, "/bin/sh");
+  uint64_t replayed = 0;
+  uint64_t preempted = 0;
+  auto start = std::chrono::steady_clock::now();
+  bool done = false;
+  while (!done) {
+    pid_t pid = sched.getNext();
+    auto& mine = events[pid];
+    if (mine.empty()) {
+      stats.exited(pid);
+      done = sched.removeAndScheduleNext(pid);
+      continue;
+    }
+    traceRecord record = mine.front().first;
+    bool switched = mine.front().second;
+    mine.pop_front();
+    replayed++;
+
+    switch (record.event) {
+    case traceEvent::syscallPre:
+    case traceEvent::syscallPost:
+      stats.stopped(pid);
+      stats.recordHook(
+          pid, (int)record.number, record.event == traceEvent::syscallPost, 0,
+          0, 0);
+      stats.resumed(pid);
+      sched.ranSystemCall();
+      break;
+    case traceEvent::fork:
+      stats.spawned(pid, (pid_t)record.returnValue, record.number == 1);
+      sched.addAndScheduleNext((pid_t)record.returnValue);
+      switched = false;
+      break;
+    case traceEvent::exit:
+      mine.clear();
+      stats.exited(pid);
+      done = sched.removeAndScheduleNext(pid);
+      switched = false;
+      break;
+    default:
+      stats.stopped(pid);
+      stats.resumed(pid);
+      break;
+    }
+    if (switched) {
+      sched.preemptAndScheduleNext();
+      preempted++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double eventNs =
+      std::chrono::duration<double, std::nano>(end - start).count() /
+      replayed;
+
+  printf(
+      "trace replay, %s: %zu records, %zu tracees, %zu preemptions: %.1f "
+      "ns/event\n",
+      path != nullptr ? path : "synthetic", records.size(), events.size(),
+      (size_t)preempted, eventNs);
+  REQUIRE(replayed > 0);
+}
@@ -0,0 +1,177 @@
+#include "../catch.hpp"
+#include <sys/types.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "../../../include/ValueMapper.hpp"
+#include "../../../include/flatHashMap.hpp"
+
+/**
+ * Tests for the classes flatHashMap and ValueMapper
+ */
+
+TEST_CASE("flatHashMap finds what is inserted", "flatHashMap"){
+  flatHashMap<ino_t, ino_t> map;
+
+  SECTION("missing keys are not found"){
+    REQUIRE(map.find(42) == nullptr);
+    REQUIRE(map.size() == 0);
+  }
+
+  SECTION("lookupOrInsert only inserts once"){
+    auto first = map.lookupOrInsert(42);
+    REQUIRE(first.second);
+    *first.first = 7;
+    auto second = map.lookupOrInsert(42);
+    REQUIRE_FALSE(second.second);
+    REQUIRE(*second.first == 7);
+    REQUIRE(map.size() == 1);
+  }
+
+  SECTION("entries survive the table growing"){
+    for (ino_t i = 0; i < 10000; i++) {
+      *map.lookupOrInsert(i * 4096).first = i;
+    }
+    REQUIRE(map.size() == 10000);
+    // At most half full: 10000 entries take 32768 slots.
+    REQUIRE(map.bytesHeld() >= 32768 * 2 * sizeof(ino_t));
+    for (ino_t i = 0; i < 10000; i++) {
+      REQUIRE(map.find(i * 4096) != nullptr);
+      REQUIRE(*map.find(i * 4096) == i);
+    }
+    REQUIRE(map.find(1) == nullptr);
+
+    size_t seen = 0;
+    map.forEach([&seen](ino_t key, ino_t value) {
+      REQUIRE(key == value * 4096);
+      seen++;
+    });
+    REQUIRE(seen == 10000);
+  }
+
+  SECTION("erase keeps the rest of a probe run reachable"){
+    for (ino_t i = 0; i < 1000; i++) {
+      *map.lookupOrInsert(i).first = i + 1;
+    }
+    for (ino_t i = 0; i < 1000; i += 3) {
+      REQUIRE(map.erase(i));
+    }
+    REQUIRE_FALSE(map.erase(0));
+    for (ino_t i = 0; i < 1000; i++) {
+      if (i % 3 == 0) {
+        REQUIRE(map.find(i) == nullptr);
+      } else {
+        REQUIRE(*map.find(i) == i + 1);
+      }
+    }
+    REQUIRE(map.size() == 666);
+  }
+}
+
+TEST_CASE("ValueMapper hands out fresh values in order", "ValueMapper"){
+  logger log("/dev/null", 0);
+  ValueMapper<ino_t, ino_t> mapper(log, "test map", 1, true);
+
+  REQUIRE(mapper.lookupOrAdd(500) == 1);
+  REQUIRE(mapper.lookupOrAdd(20) == 2);
+  REQUIRE(mapper.lookupOrAdd(500) == 1);
+  REQUIRE(mapper.realValueExists(20));
+  REQUIRE_FALSE(mapper.realValueExists(21));
+  REQUIRE(mapper.getVirtualValue(20) == 2);
+  REQUIRE(mapper.getRealValue(2) == 20);
+  REQUIRE_THROWS(mapper.getVirtualValue(21));
+  REQUIRE_THROWS(mapper.getRealValue(3));
+
+  SECTION("lookupOrAddAll agrees with lookupOrAdd"){
+    std::vector<ino_t> virtuals;
+    mapper.lookupOrAddAll({20, 7, 500, 7, 9}, virtuals);
+    REQUIRE(virtuals == std::vector<ino_t>({2, 3, 1, 3, 4}));
+    REQUIRE(mapper.getRealValue(4) == 9);
+    REQUIRE(mapper.lookupOrAdd(8) == 5);
+  }
+
+  SECTION("forgotten values come back with fresh virtual values"){
+    REQUIRE(mapper.forget(500));
+    REQUIRE_FALSE(mapper.forget(500));
+    REQUIRE_THROWS(mapper.getRealValue(1));
+    REQUIRE(mapper.lookupOrAdd(500) == 3);
+    REQUIRE(mapper.getVirtualValue(20) == 2);
+  }
+
+  SECTION("addRealValue overwrites old mappings"){
+    REQUIRE(mapper.addRealValue(500) == 3);
+    REQUIRE(mapper.getVirtualValue(500) == 3);
+    REQUIRE(mapper.getRealValue(3) == 500);
+  }
+}
+
+/**
+ * Inode numbers as seen by stat while building a tree: sequential runs from
+ * where each directory was allocated, each visited many times by different
+ * processes, so in no particular order.
+ */
+static std::vector<ino_t> statLikeInodes(){
+  std::vector<ino_t> inodes;
+  uint64_t seed = 1;
+  for (int run = 0; run < 200; run++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    ino_t base = (seed >> 20) % (1ULL << 32);
+    for (ino_t i = 0; i < 500; i++) {
+      inodes.push_back(base + i);
+    }
+  }
+  std::vector<ino_t> lookups;
+  for (int pass = 0; pass < 30; pass++) {
+    lookups.insert(lookups.end(), inodes.begin(), inodes.end());
+  }
+  std::mt19937 generator(1);
+  std::shuffle(lookups.begin(), lookups.end(), generator);
+  return lookups;
+}
+
+template <typename F>
+static double secondsFor(F f){
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Hidden, run with: ./otherClassesTests "[.benchmark]"
+TEST_CASE("flatHashMap against unordered_map on stat-like inodes",
+          "[.benchmark]"){
+  auto inodes = statLikeInodes();
+  ino_t flatSum = 0, stdSum = 0;
+
+  double flatTime = secondsFor([&]() {
+    flatHashMap<ino_t, ino_t> map;
+    ino_t fresh = 1;
+    for (ino_t inode : inodes) {
+      auto entry = map.lookupOrInsert(inode);
+      if (entry.second) {
+        *entry.first = fresh++;
+      }
+      flatSum += *entry.first;
+    }
+  });
+
+  double stdTime = secondsFor([&]() {
+    std::unordered_map<ino_t, ino_t> map;
+    ino_t fresh = 1;
+    for (ino_t inode : inodes) {
+      auto entry = map.emplace(inode, fresh);
+      if (entry.second) {
+        fresh++;
+      }
+      stdSum += entry.first->second;
+    }
+  });
+
+  printf("%zu lookups: flatHashMap %.3fs, unordered_map %.3fs\n",
+         inodes.size(), flatTime, stdTime);
+  REQUIRE(flatSum == stdSum);
+}
@@ -0,0 +1,59 @@
+#include "../catch.hpp"
+#include "../../../include/runQueue.hpp"
+#include "../../../include/vectorClock.hpp"
+
+/**
+ * Tests for the classes vectorClock and runQueue
+ */
+
+TEST_CASE("vectorClock orders sends and receives", "vectorClock"){
+  vectorClock writer, reader, other;
+  writer.tick(5);
+  REQUIRE(writer[5] == 1);
+  REQUIRE(writer[3] == 0);
+
+  // The reader hears of the write once, not twice.
+  REQUIRE(reader.merge(writer));
+  REQUIRE(!reader.merge(writer));
+  REQUIRE(writer.before(reader));
+
+  reader.tick(3);
+  REQUIRE(writer.before(reader));
+  REQUIRE(!reader.before(writer));
+
+  other.tick(9);
+  REQUIRE(other.concurrent(reader));
+  REQUIRE(!writer.concurrent(reader));
+  REQUIRE(reader.str() == "{3: 1, 5: 1}");
+}
+
+TEST_CASE("runQueue goes by stamps once ordered by them", "runQueue"){
+  unordered_map<pid_t, int64_t> clocks = {{2, 30}, {7, 10}, {9, 10}};
+  runQueue queue;
+  queue.insert(2);
+  queue.insert(7);
+  queue.insert(9);
+  REQUIRE(queue.first() == 9);
+
+  queue.orderBy([&](pid_t pid) {
+    return logicalStamp{
+        logical_clock::time_point(logical_clock::duration(clocks[pid])), pid};
+  });
+  // Lowest clock first, ties broken by pid.
+  REQUIRE(queue.first() == 7);
+  REQUIRE(queue.erase(7));
+  REQUIRE(!queue.erase(7));
+  REQUIRE(queue.first() == 9);
+
+  // Stamped as it joins, later clock changes don't reorder it.
+  clocks[2] = 1;
+  REQUIRE(queue.first() == 9);
+  queue.erase(2);
+  queue.insert(2);
+  REQUIRE(queue.first() == 2);
+
+  runQueue other;
+  queue.swap(other);
+  REQUIRE(queue.empty());
+  REQUIRE(other.first() == 2);
+}